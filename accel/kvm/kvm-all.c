@@ -31,6 +31,7 @@
 #include "sysemu/kvm_int.h"
 #include "sysemu/runstate.h"
 #include "sysemu/cpus.h"
+#include "sysemu/cpu-throttle.h"
 #include "qemu/bswap.h"
 #include "exec/memory.h"
 #include "exec/ram_addr.h"
@@ -39,6 +40,7 @@
 #include "trace.h"
 #include "hw/irq.h"
 #include "qapi/visitor.h"
+#include "qapi/qapi-commands-machine.h"
 #include "qapi/qapi-types-common.h"
 #include "qapi/qapi-visit-common.h"
 #include "sysemu/reset.h"
@@ -149,6 +151,7 @@ struct KVMState
     uint64_t kvm_dirty_ring_bytes;  /* Size of the per-vcpu dirty ring */
     uint32_t kvm_dirty_ring_size;   /* Number of dirty GFNs per ring */
     struct KVMDirtyRingReaper reaper;
+    int64_t halt_poll_ns;           /* -1 to keep the host's default */
 };
 
 KVMState *kvm_state;
@@ -251,6 +254,9 @@ static KVMSlot *kvm_get_free_slot(KVMMemoryListener *kml)
     KVMState *s = kvm_state;
     int i;
 
+    if (kml->nr_slots_used == s->nr_slots) {
+        return NULL;
+    }
     for (i = 0; i < s->nr_slots; i++) {
         if (kml->slots[i].memory_size == 0) {
             return &kml->slots[i];
@@ -267,7 +273,7 @@ bool kvm_has_free_slot(MachineState *ms)
     KVMMemoryListener *kml = &s->memory_listener;
 
     kvm_slots_lock();
-    result = !!kvm_get_free_slot(kml);
+    result = kml->nr_slots_used < s->nr_slots;
     kvm_slots_unlock();
 
     return result;
@@ -290,20 +296,30 @@ static KVMSlot *kvm_lookup_matching_slot(KVMMemoryListener *kml,
                                          hwaddr start_addr,
                                          hwaddr size)
 {
-    KVMState *s = kvm_state;
-    int i;
-
-    for (i = 0; i < s->nr_slots; i++) {
-        KVMSlot *mem = &kml->slots[i];
+    KVMSlot *mem = g_hash_table_lookup(kml->slots_by_addr, &start_addr);
 
-        if (start_addr == mem->start_addr && size == mem->memory_size) {
-            return mem;
-        }
+    if (mem && size == mem->memory_size) {
+        return mem;
     }
 
     return NULL;
 }
 
+/* Called with KVMMemoryListener.slots_lock held */
+static void kvm_slot_publish(KVMMemoryListener *kml, KVMSlot *mem)
+{
+    g_hash_table_insert(kml->slots_by_addr, &mem->start_addr, mem);
+    kml->nr_slots_used++;
+}
+
+/* Called with KVMMemoryListener.slots_lock held */
+static void kvm_slot_unpublish(KVMMemoryListener *kml, KVMSlot *mem)
+{
+    g_hash_table_remove(kml->slots_by_addr, &mem->start_addr);
+    kml->nr_slots_used--;
+}
+
+
 /*
  * Calculate and align the start address and the size of the section.
  * Return the size. If the size is 0, the aligned section is empty.
@@ -332,12 +348,17 @@ int kvm_physical_memory_addr_from_host(KVMState *s, void *ram,
                                        hwaddr *phys_addr)
 {
     KVMMemoryListener *kml = &s->memory_listener;
-    int i, ret = 0;
+    int i, n, ret = 0;
 
     kvm_slots_lock();
-    for (i = 0; i < s->nr_slots; i++) {
+    /* Used slots are packed at low indices; stop after the last one.  */
+    for (i = 0, n = 0; n < kml->nr_slots_used; i++) {
         KVMSlot *mem = &kml->slots[i];
 
+        if (!mem->memory_size) {
+            continue;
+        }
+        n++;
         if (ram >= mem->ram && ram < mem->ram + mem->memory_size) {
             *phys_addr = mem->start_addr + (ram - mem->ram);
             ret = 1;
@@ -384,6 +405,50 @@ err:
     return ret;
 }
 
+/*
+ * Exit reasons are counted in CPUState.kvm_exits, by the vCPU thread only;
+ * reasons unknown to this table share the last counter.
+ */
+static const char *const kvm_exit_reason_names[] = {
+    [KVM_EXIT_UNKNOWN] = "unknown",
+    [KVM_EXIT_EXCEPTION] = "exception",
+    [KVM_EXIT_IO] = "io",
+    [KVM_EXIT_HYPERCALL] = "hypercall",
+    [KVM_EXIT_DEBUG] = "debug",
+    [KVM_EXIT_HLT] = "hlt",
+    [KVM_EXIT_MMIO] = "mmio",
+    [KVM_EXIT_IRQ_WINDOW_OPEN] = "irq-window-open",
+    [KVM_EXIT_SHUTDOWN] = "shutdown",
+    [KVM_EXIT_FAIL_ENTRY] = "fail-entry",
+    [KVM_EXIT_INTR] = "intr",
+    [KVM_EXIT_SET_TPR] = "set-tpr",
+    [KVM_EXIT_TPR_ACCESS] = "tpr-access",
+    [KVM_EXIT_S390_SIEIC] = "s390-sieic",
+    [KVM_EXIT_S390_RESET] = "s390-reset",
+    [KVM_EXIT_DCR] = "dcr",
+    [KVM_EXIT_NMI] = "nmi",
+    [KVM_EXIT_INTERNAL_ERROR] = "internal-error",
+    [KVM_EXIT_OSI] = "osi",
+    [KVM_EXIT_PAPR_HCALL] = "papr-hcall",
+    [KVM_EXIT_S390_UCONTROL] = "s390-ucontrol",
+    [KVM_EXIT_WATCHDOG] = "watchdog",
+    [KVM_EXIT_S390_TSCH] = "s390-tsch",
+    [KVM_EXIT_EPR] = "epr",
+    [KVM_EXIT_SYSTEM_EVENT] = "system-event",
+    [KVM_EXIT_S390_STSI] = "s390-stsi",
+    [KVM_EXIT_IOAPIC_EOI] = "ioapic-eoi",
+    [KVM_EXIT_HYPERV] = "hyperv",
+    [KVM_EXIT_ARM_NISV] = "arm-nisv",
+    [KVM_EXIT_X86_RDMSR] = "x86-rdmsr",
+    [KVM_EXIT_X86_WRMSR] = "x86-wrmsr",
+    [KVM_EXIT_DIRTY_RING_FULL] = "dirty-ring-full",
+    [KVM_EXIT_AP_RESET_HOLD] = "ap-reset-hold",
+    [KVM_EXIT_X86_BUS_LOCK] = "x86-bus-lock",
+    [KVM_EXIT_XEN] = "xen",
+};
+
+#define KVM_EXIT_NR_COUNTED ARRAY_SIZE(kvm_exit_reason_names)
+
 static int do_kvm_destroy_vcpu(CPUState *cpu)
 {
     KVMState *s = kvm_state;
@@ -417,6 +482,9 @@ static int do_kvm_destroy_vcpu(CPUState *cpu)
         }
     }
 
+    g_free(cpu->kvm_exits);
+    cpu->kvm_exits = NULL;
+
     vcpu = g_malloc0(sizeof(*vcpu));
     vcpu->vcpu_id = kvm_arch_vcpu_id(cpu);
     vcpu->kvm_fd = cpu->kvm_fd;
@@ -506,6 +574,8 @@ int kvm_init_vcpu(CPUState *cpu, Error **errp)
         }
     }
 
+    cpu->kvm_exits = g_new0(unsigned long, KVM_EXIT_NR_COUNTED + 1);
+
     ret = kvm_arch_init_vcpu(cpu);
     if (ret < 0) {
         error_setg_errno(errp, -ret,
@@ -624,9 +694,37 @@ static void kvm_slot_sync_dirty_pages(KVMSlot *slot)
     cpu_physical_memory_set_dirty_lebitmap(slot->dirty_bmap, start, pages);
 }
 
-static void kvm_slot_reset_dirty_pages(KVMSlot *slot)
+/*
+ * The dirty ring tells exactly which pages were written, so only the parts
+ * of dirty_bmap that the reaper touched need to be published and cleared.
+ * This keeps the cost of a sync proportional to the dirty set rather than
+ * to the size of the guest.
+ */
+#define KVM_DIRTY_SUMMARY_PAGES  (BITS_PER_LONG * 64)
+
+static unsigned long kvm_slot_dirty_summary_bits(KVMSlot *slot)
+{
+    return DIV_ROUND_UP(slot->memory_size / qemu_real_host_page_size,
+                        KVM_DIRTY_SUMMARY_PAGES);
+}
+
+static void kvm_slot_sync_dirty_ring_pages(KVMSlot *slot)
 {
-    memset(slot->dirty_bmap, 0, slot->dirty_bmap_size);
+    unsigned long pages = slot->memory_size / qemu_real_host_page_size;
+    unsigned long nr = kvm_slot_dirty_summary_bits(slot);
+    unsigned long chunk;
+
+    for (chunk = find_first_bit(slot->dirty_summary, nr); chunk < nr;
+         chunk = find_next_bit(slot->dirty_summary, nr, chunk + 1)) {
+        unsigned long first = chunk * KVM_DIRTY_SUMMARY_PAGES;
+        unsigned long n = MIN(KVM_DIRTY_SUMMARY_PAGES, pages - first);
+        unsigned long *bmap = slot->dirty_bmap + BIT_WORD(first);
+
+        cpu_physical_memory_set_dirty_lebitmap(bmap,
+            slot->ram_start_offset + first * qemu_real_host_page_size, n);
+        memset(bmap, 0, BITS_TO_LONGS(n) * sizeof(unsigned long));
+    }
+    bitmap_zero(slot->dirty_summary, nr);
 }
 
 #define ALIGN(x, y)  (((x)+(y)-1) & ~((y)-1))
@@ -659,6 +757,10 @@ static void kvm_slot_init_dirty_bitmap(KVMSlot *mem)
                                         /*HOST_LONG_BITS*/ 64) / 8;
     mem->dirty_bmap = g_malloc0(bitmap_size);
     mem->dirty_bmap_size = bitmap_size;
+
+    if (kvm_state->kvm_dirty_ring_size) {
+        mem->dirty_summary = bitmap_new(kvm_slot_dirty_summary_bits(mem));
+    }
 }
 
 /*
@@ -705,6 +807,7 @@ static void kvm_dirty_ring_mark_page(KVMState *s, uint32_t as_id,
     }
 
     set_bit(offset, mem->dirty_bmap);
+    set_bit(offset / KVM_DIRTY_SUMMARY_PAGES, mem->dirty_summary);
 }
 
 static bool dirty_gfn_is_dirtied(struct kvm_dirty_gfn *gfn)
@@ -743,6 +846,7 @@ static uint32_t kvm_dirty_ring_reap_one(KVMState *s, CPUState *cpu)
         count++;
     }
     cpu->kvm_fetch_index = fetch;
+    qatomic_set(&cpu->dirty_pages, cpu->dirty_pages + count);
 
     return count;
 }
@@ -899,6 +1003,22 @@ static int kvm_log_clear_one_slot(KVMSlot *mem, int as_id, uint64_t start,
     unsigned long *bmap_clear = NULL, psize = qemu_real_host_page_size;
     int ret;
 
+    /* We should never do log_clear before log_sync */
+    assert(mem->dirty_bmap);
+
+    /*
+     * If the last sync reported nothing dirty in the range, or the bits
+     * were cleared already, there is nothing for us to clear: skip the
+     * ioctl.  Pages the guest dirtied since the sync stay dirty in the
+     * kernel and are reported again by the next one.
+     */
+    if (find_next_bit(mem->dirty_bmap, (start + size) / psize,
+                      start / psize) >= (start + size) / psize) {
+        trace_kvm_clear_dirty_log_skip(mem->slot | (as_id << 16),
+                                       start / psize, size / psize);
+        return 0;
+    }
+
     /*
      * We need to extend either the start or the size or both to
      * satisfy the KVM interface requirement.  Firstly, do the start
@@ -945,8 +1065,6 @@ static int kvm_log_clear_one_slot(KVMSlot *mem, int as_id, uint64_t start,
      */
 
     assert(bmap_start % BITS_PER_LONG == 0);
-    /* We should never do log_clear before log_sync */
-    assert(mem->dirty_bmap);
     if (start_delta || bmap_npages - size / psize) {
         /* Slow path - we need to manipulate a temp bitmap */
         bmap_clear = bitmap_new(bmap_npages);
@@ -1014,7 +1132,7 @@ static int kvm_physical_log_clear(KVMMemoryListener *kml,
     KVMState *s = kvm_state;
     uint64_t start, size, offset, count;
     KVMSlot *mem;
-    int ret = 0, i;
+    int ret = 0, i, n;
 
     if (!s->manual_dirty_log_protect) {
         /* No need to do explicit clear */
@@ -1031,11 +1149,14 @@ static int kvm_physical_log_clear(KVMMemoryListener *kml,
 
     kvm_slots_lock();
 
-    for (i = 0; i < s->nr_slots; i++) {
+    for (i = 0, n = 0; n < kml->nr_slots_used; i++) {
         mem = &kml->slots[i];
-        /* Discard slots that are empty or do not overlap the section */
-        if (!mem->memory_size ||
-            mem->start_addr > start + size - 1 ||
+        if (!mem->memory_size) {
+            continue;
+        }
+        n++;
+        /* Discard slots that do not overlap the section */
+        if (mem->start_addr > start + size - 1 ||
             start > mem->start_addr + mem->memory_size - 1) {
             continue;
         }
@@ -1390,15 +1511,19 @@ static void kvm_set_phys_mem(KVMMemoryListener *kml,
                  */
                 if (kvm_state->kvm_dirty_ring_size) {
                     kvm_dirty_ring_reap_locked(kvm_state);
+                    kvm_slot_sync_dirty_ring_pages(mem);
                 } else {
                     kvm_slot_get_dirty_log(kvm_state, mem);
+                    kvm_slot_sync_dirty_pages(mem);
                 }
-                kvm_slot_sync_dirty_pages(mem);
             }
 
             /* unregister the slot */
+            kvm_slot_unpublish(kml, mem);
             g_free(mem->dirty_bmap);
             mem->dirty_bmap = NULL;
+            g_free(mem->dirty_summary);
+            mem->dirty_summary = NULL;
             mem->memory_size = 0;
             mem->flags = 0;
             err = kvm_set_user_memory_region(kml, mem, false);
@@ -1430,6 +1555,7 @@ static void kvm_set_phys_mem(KVMMemoryListener *kml,
                     strerror(-err));
             abort();
         }
+        kvm_slot_publish(kml, mem);
         start_addr += slot_size;
         ram_start_offset += slot_size;
         ram += slot_size;
@@ -1516,28 +1642,26 @@ static void kvm_log_sync(MemoryListener *listener,
 static void kvm_log_sync_global(MemoryListener *l)
 {
     KVMMemoryListener *kml = container_of(l, KVMMemoryListener, listener);
-    KVMState *s = kvm_state;
     KVMSlot *mem;
-    int i;
+    int i, n;
 
     /* Flush all kernel dirty addresses into KVMSlot dirty bitmap */
     kvm_dirty_ring_flush();
 
-    /*
-     * TODO: make this faster when nr_slots is big while there are
-     * only a few used slots (small VMs).
-     */
     kvm_slots_lock();
-    for (i = 0; i < s->nr_slots; i++) {
+    for (i = 0, n = 0; n < kml->nr_slots_used; i++) {
         mem = &kml->slots[i];
-        if (mem->memory_size && mem->flags & KVM_MEM_LOG_DIRTY_PAGES) {
-            kvm_slot_sync_dirty_pages(mem);
+        if (!mem->memory_size) {
+            continue;
+        }
+        n++;
+        if (mem->flags & KVM_MEM_LOG_DIRTY_PAGES) {
             /*
-             * This is not needed by KVM_GET_DIRTY_LOG because the
-             * ioctl will unconditionally overwrite the whole region.
-             * However kvm dirty ring has no such side effect.
+             * Unlike KVM_GET_DIRTY_LOG, which overwrites the whole
+             * region, the dirty ring only ever sets bits, so the ones
+             * that were published must be cleared here.
              */
-            kvm_slot_reset_dirty_pages(mem);
+            kvm_slot_sync_dirty_ring_pages(mem);
         }
     }
     kvm_slots_unlock();
@@ -1638,6 +1762,7 @@ void kvm_memory_listener_register(KVMState *s, KVMMemoryListener *kml,
     int i;
 
     kml->slots = g_malloc0(s->nr_slots * sizeof(KVMSlot));
+    kml->slots_by_addr = g_hash_table_new(g_int64_hash, g_int64_equal);
     kml->as_id = as_id;
 
     for (i = 0; i < s->nr_slots; i++) {
@@ -2512,6 +2637,20 @@ static int kvm_init(MachineState *ms)
         }
     }
 
+    if (s->halt_poll_ns >= 0) {
+        if (!kvm_vm_check_extension(s, KVM_CAP_HALT_POLL)) {
+            error_report("KVM does not support setting halt-poll-ns");
+            ret = -EINVAL;
+            goto err;
+        }
+        ret = kvm_vm_enable_cap(s, KVM_CAP_HALT_POLL, 0, s->halt_poll_ns);
+        if (ret < 0) {
+            error_report("Could not set halt-poll-ns to %"PRId64": %s",
+                         s->halt_poll_ns, strerror(-ret));
+            goto err;
+        }
+    }
+
 #ifdef KVM_CAP_VCPU_EVENTS
     s->vcpu_events = kvm_check_extension(s, KVM_CAP_VCPU_EVENTS);
 #endif
@@ -2801,6 +2940,13 @@ static void kvm_eat_signals(CPUState *cpu)
     } while (sigismember(&chkset, SIG_IPI));
 }
 
+static void kvm_count_exit(CPUState *cpu, uint32_t reason)
+{
+    unsigned long *count = &cpu->kvm_exits[MIN(reason, KVM_EXIT_NR_COUNTED)];
+
+    qatomic_set(count, *count + 1);
+}
+
 int kvm_cpu_exec(CPUState *cpu)
 {
     struct kvm_run *run = cpu->kvm_run;
@@ -2876,6 +3022,7 @@ int kvm_cpu_exec(CPUState *cpu)
         }
 
         trace_kvm_run_exit(cpu->cpu_index, run->exit_reason);
+        kvm_count_exit(cpu, run->exit_reason);
         switch (run->exit_reason) {
         case KVM_EXIT_IO:
             DPRINTF("handle_io\n");
@@ -2923,6 +3070,7 @@ int kvm_cpu_exec(CPUState *cpu)
             qemu_mutex_lock_iothread();
             kvm_dirty_ring_reap(kvm_state);
             qemu_mutex_unlock_iothread();
+            cpu_throttle_dirty_limit_sleep(cpu);
             ret = 0;
             break;
         case KVM_EXIT_SYSTEM_EVENT:
@@ -3095,6 +3243,11 @@ bool kvm_has_sync_mmu(void)
     return kvm_state->sync_mmu;
 }
 
+uint32_t kvm_dirty_ring_size(void)
+{
+    return kvm_state->kvm_dirty_ring_size;
+}
+
 int kvm_has_vcpu_events(void)
 {
     return kvm_state->vcpu_events;
@@ -3484,6 +3637,42 @@ static bool kvm_accel_has_memory(MachineState *ms, AddressSpace *as,
     return false;
 }
 
+KvmVcpuExitsList *qmp_query_kvm_exits(Error **errp)
+{
+    KvmVcpuExitsList *head = NULL, **tail = &head;
+    CPUState *cpu;
+
+    if (!kvm_enabled()) {
+        error_setg(errp, "KVM is not enabled");
+        return NULL;
+    }
+
+    CPU_FOREACH(cpu) {
+        KvmVcpuExits *value = g_new0(KvmVcpuExits, 1);
+        KvmExitStatList **exits_tail = &value->exits;
+        int i;
+
+        value->cpu_index = cpu->cpu_index;
+        for (i = 0; i <= KVM_EXIT_NR_COUNTED; i++) {
+            unsigned long count = qatomic_read(&cpu->kvm_exits[i]);
+            KvmExitStat *stat;
+
+            if (!count) {
+                continue;
+            }
+            stat = g_new0(KvmExitStat, 1);
+            stat->reason = g_strdup(i < KVM_EXIT_NR_COUNTED &&
+                                    kvm_exit_reason_names[i] ?
+                                    kvm_exit_reason_names[i] : "other");
+            stat->count = count;
+            QAPI_LIST_APPEND(exits_tail, stat);
+        }
+        QAPI_LIST_APPEND(tail, value);
+    }
+
+    return head;
+}
+
 static void kvm_get_kvm_shadow_mem(Object *obj, Visitor *v,
                                    const char *name, void *opaque,
                                    Error **errp)
@@ -3603,6 +3792,40 @@ static void kvm_set_dirty_ring_size(Object *obj, Visitor *v,
     s->kvm_dirty_ring_size = value;
 }
 
+static void kvm_get_halt_poll_ns(Object *obj, Visitor *v,
+                                 const char *name, void *opaque,
+                                 Error **errp)
+{
+    KVMState *s = KVM_STATE(obj);
+    int64_t value = s->halt_poll_ns;
+
+    visit_type_int(v, name, &value, errp);
+}
+
+static void kvm_set_halt_poll_ns(Object *obj, Visitor *v,
+                                 const char *name, void *opaque,
+                                 Error **errp)
+{
+    KVMState *s = KVM_STATE(obj);
+    int64_t value;
+
+    if (s->fd != -1) {
+        error_setg(errp, "Cannot set properties after the accelerator has been initialized");
+        return;
+    }
+
+    if (!visit_type_int(v, name, &value, errp)) {
+        return;
+    }
+    if (value < -1 || value > UINT32_MAX) {
+        error_setg(errp, "halt-poll-ns must be between -1 and %" PRIu32,
+                   UINT32_MAX);
+        return;
+    }
+
+    s->halt_poll_ns = value;
+}
+
 static void kvm_accel_instance_init(Object *obj)
 {
     KVMState *s = KVM_STATE(obj);
@@ -3614,6 +3837,7 @@ static void kvm_accel_instance_init(Object *obj)
     s->kernel_irqchip_split = ON_OFF_AUTO_AUTO;
     /* KVM dirty ring is by default off */
     s->kvm_dirty_ring_size = 0;
+    s->halt_poll_ns = -1;
 }
 
 static void kvm_accel_class_init(ObjectClass *oc, void *data)
@@ -3641,6 +3865,13 @@ static void kvm_accel_class_init(ObjectClass *oc, void *data)
         NULL, NULL);
     object_class_property_set_description(oc, "dirty-ring-size",
         "Size of KVM dirty page ring buffer (default: 0, i.e. use bitmap)");
+
+    object_class_property_add(oc, "halt-poll-ns", "int",
+        kvm_get_halt_poll_ns, kvm_set_halt_poll_ns,
+        NULL, NULL);
+    object_class_property_set_description(oc, "halt-poll-ns",
+        "Maximum time in ns a vCPU polls before sleeping when it halts "
+        "(default: -1, i.e. use the host's setting)");
 }
 
 static const TypeInfo kvm_accel_type = {
@@ -15,6 +15,8 @@
 
 #ifndef CONFIG_USER_ONLY
 #include "hw/pci/msi.h"
+#include "qapi/error.h"
+#include "qapi/qapi-commands-machine.h"
 #endif
 
 KVMState *kvm_state;
@@ -44,6 +46,11 @@ bool kvm_has_sync_mmu(void)
     return false;
 }
 
+uint32_t kvm_dirty_ring_size(void)
+{
+    return 0;
+}
+
 int kvm_has_many_ioeventfds(void)
 {
     return 0;
@@ -147,4 +154,10 @@ bool kvm_arm_supports_user_irq(void)
 {
     return false;
 }
+
+KvmVcpuExitsList *qmp_query_kvm_exits(Error **errp)
+{
+    error_setg(errp, "KVM is not enabled");
+    return NULL;
+}
 #endif
@@ -187,6 +187,7 @@ static inline TranslationBlock *tb_lookup(CPUState *cpu, target_ulong pc,
                tb->flags == flags &&
                tb->trace_vcpu_dstate == *cpu->trace_dstate &&
                tb_cflags(tb) == cflags)) {
+        qatomic_set(&cpu->tb_jmp_cache_hits, cpu->tb_jmp_cache_hits + 1);
         return tb;
     }
     tb = tb_htable_lookup(cpu, pc, cs_base, flags, cflags);
@@ -197,6 +198,33 @@ static inline TranslationBlock *tb_lookup(CPUState *cpu, target_ulong pc,
     return tb;
 }
 
+/*
+ * Translate a block that tb_lookup() did not find.  In user mode the
+ * mmap_lock serializes translation across all threads, so when several
+ * of them miss on the same code at once, all but the first would wait
+ * for the lock only to translate the block again.  Look it up once more
+ * after taking the lock and reuse the TB if another thread published it
+ * in the meantime.
+ */
+static TranslationBlock *tb_gen_code_locked(CPUState *cpu, target_ulong pc,
+                                            target_ulong cs_base,
+                                            uint32_t flags, uint32_t cflags)
+{
+    TranslationBlock *tb;
+
+    mmap_lock();
+#ifdef CONFIG_USER_ONLY
+    tb = tb_htable_lookup(cpu, pc, cs_base, flags, cflags);
+    if (tb) {
+        mmap_unlock();
+        return tb;
+    }
+#endif
+    tb = tb_gen_code(cpu, pc, cs_base, flags, cflags);
+    mmap_unlock();
+    return tb;
+}
+
 static inline void log_cpu_exec(target_ulong pc, CPUState *cpu,
                                 const TranslationBlock *tb)
 {
@@ -509,29 +537,100 @@ static bool tb_lookup_cmp(const void *p, const void *d)
     return false;
 }
 
+/*
+ * Fill in @desc and its hash for a lookup in tb_ctx.htable.  Returns
+ * false if @pc cannot be translated and executed from RAM.
+ */
+static bool tb_desc_init(struct tb_desc *desc, uint32_t *hash,
+                         CPUState *cpu, target_ulong pc,
+                         target_ulong cs_base, uint32_t flags,
+                         uint32_t cflags)
+{
+    tb_page_addr_t phys_pc;
+
+    desc->env = (CPUArchState *)cpu->env_ptr;
+    desc->cs_base = cs_base;
+    desc->flags = flags;
+    desc->cflags = cflags;
+    desc->trace_vcpu_dstate = *cpu->trace_dstate;
+    desc->pc = pc;
+    phys_pc = get_page_addr_code(desc->env, pc);
+    if (phys_pc == -1) {
+        return false;
+    }
+    desc->phys_page1 = phys_pc & TARGET_PAGE_MASK;
+    *hash = tb_hash_func(phys_pc, pc, flags, cflags, *cpu->trace_dstate);
+    return true;
+}
+
 TranslationBlock *tb_htable_lookup(CPUState *cpu, target_ulong pc,
                                    target_ulong cs_base, uint32_t flags,
                                    uint32_t cflags)
 {
-    tb_page_addr_t phys_pc;
+    TranslationBlock *tb, **slot;
     struct tb_desc desc;
     uint32_t h;
 
-    desc.env = (CPUArchState *)cpu->env_ptr;
-    desc.cs_base = cs_base;
-    desc.flags = flags;
-    desc.cflags = cflags;
-    desc.trace_vcpu_dstate = *cpu->trace_dstate;
-    desc.pc = pc;
-    phys_pc = get_page_addr_code(desc.env, pc);
-    if (phys_pc == -1) {
+    if (!tb_desc_init(&desc, &h, cpu, pc, cs_base, flags, cflags)) {
         return NULL;
     }
-    desc.phys_page1 = phys_pc & TARGET_PAGE_MASK;
-    h = tb_hash_func(phys_pc, pc, flags, cflags, *cpu->trace_dstate);
-    return qht_lookup_custom(&tb_ctx.htable, &desc, h, tb_lookup_cmp);
+
+    /*
+     * Invalidated TBs have CF_INVALID set and no longer compare equal,
+     * and tb_flush clears the cache before TB memory is reused.
+     */
+    slot = &cpu->tb_lookup_cache[h & (TB_LOOKUP_CACHE_SIZE - 1)];
+    tb = *slot;
+    if (tb && tb_lookup_cmp(tb, &desc)) {
+        qatomic_set(&cpu->tb_lookup_cache_hits,
+                    cpu->tb_lookup_cache_hits + 1);
+        return tb;
+    }
+
+    tb = qht_lookup_custom(&tb_ctx.htable, &desc, h, tb_lookup_cmp);
+    if (tb) {
+        *slot = tb;
+        qatomic_set(&cpu->tb_lookup_htable_hits,
+                    cpu->tb_lookup_htable_hits + 1);
+    } else {
+        qatomic_set(&cpu->tb_lookup_misses, cpu->tb_lookup_misses + 1);
+    }
+    return tb;
 }
 
+#ifdef CONFIG_USER_ONLY
+/*
+ * Translate the block at @pc before the guest first reaches it.  This
+ * is meant to run on a helper thread while @cpu executes elsewhere, so
+ * it neither touches the vCPU's lookup caches nor takes any path that
+ * would need to unwind the vCPU: the block and the page after it must
+ * already be mapped executable, and nothing is done once the code
+ * buffer is three quarters full, since making room needs a flush.
+ *
+ * Returns false when the caller should stop translating ahead.
+ */
+bool tb_pretranslate(CPUState *cpu, target_ulong pc, target_ulong cs_base,
+                     uint32_t flags, uint32_t cflags)
+{
+    target_ulong page2 = (pc & TARGET_PAGE_MASK) + TARGET_PAGE_SIZE;
+    struct tb_desc desc;
+    uint32_t h;
+    bool ret = true;
+
+    mmap_lock();
+    if (tcg_code_size() > tcg_code_capacity() / 4 * 3) {
+        ret = false;
+    } else if ((page_get_flags(pc) & PAGE_EXEC) &&
+               (page_get_flags(page2) & PAGE_EXEC) &&
+               tb_desc_init(&desc, &h, cpu, pc, cs_base, flags, cflags) &&
+               !qht_lookup_custom(&tb_ctx.htable, &desc, h, tb_lookup_cmp)) {
+        tb_gen_code(cpu, pc, cs_base, flags, cflags);
+    }
+    mmap_unlock();
+    return ret;
+}
+#endif
+
 void tb_set_jmp_target(TranslationBlock *tb, int n, uintptr_t addr)
 {
     if (TCG_TARGET_HAS_direct_jump) {
@@ -636,6 +735,7 @@ static inline bool cpu_handle_exception(CPUState *cpu, int *ret)
 #endif
         return false;
     }
+    qatomic_set(&cpu->exception_exits, cpu->exception_exits + 1);
     if (cpu->exception_index >= EXCP_INTERRUPT) {
         /* exit request from the cpu execution loop */
         *ret = cpu->exception_index;
@@ -941,9 +1041,7 @@ int cpu_exec(CPUState *cpu)
 
             tb = tb_lookup(cpu, pc, cs_base, flags, cflags);
             if (tb == NULL) {
-                mmap_lock();
-                tb = tb_gen_code(cpu, pc, cs_base, flags, cflags);
-                mmap_unlock();
+                tb = tb_gen_code_locked(cpu, pc, cs_base, flags, cflags);
                 /*
                  * We add the TB in the virtual pc hash table
                  * for the fast lookup
@@ -991,7 +1089,7 @@ void tcg_exec_realizefn(CPUState *cpu, Error **errp)
         tcg_target_initialized = true;
     }
     tlb_init(cpu);
-    qemu_plugin_vcpu_init_hook(cpu);
+    cpu->tb_lookup_cache = g_new0(TranslationBlock *, TB_LOOKUP_CACHE_SIZE);
 
 #ifndef CONFIG_USER_ONLY
     tcg_iommu_init_notifier_list(cpu);
@@ -1006,6 +1104,8 @@ void tcg_exec_unrealizefn(CPUState *cpu)
 #endif /* !CONFIG_USER_ONLY */
 
     qemu_plugin_vcpu_exit_hook(cpu);
+    g_free(cpu->tb_lookup_cache);
+    cpu->tb_lookup_cache = NULL;
     tlb_destroy(cpu);
 }
 
@@ -236,8 +236,10 @@ static void tlb_mmu_flush_locked(CPUTLBDesc *desc, CPUTLBDescFast *fast)
     desc->large_page_addr = -1;
     desc->large_page_mask = -1;
     desc->vindex = 0;
+    desc->lindex = 0;
     memset(fast->table, -1, sizeof_tlb(fast));
     memset(desc->vtable, -1, sizeof(desc->vtable));
+    memset(desc->ltable, 0, sizeof(desc->ltable));
 }
 
 static void tlb_flush_one_mmuidx_locked(CPUArchState *env, int mmu_idx,
@@ -339,6 +341,17 @@ void tlb_flush_counts(size_t *pfull, size_t *ppart, size_t *pelide)
     *pelide = elide;
 }
 
+void tlb_cpu_counts(CPUState *cpu, size_t *pfull, size_t *ppart,
+                    size_t *pelide, size_t *pfill)
+{
+    CPUTLBCommon *c = &env_tlb((CPUArchState *)cpu->env_ptr)->c;
+
+    *pfull = qatomic_read(&c->full_flush_count);
+    *ppart = qatomic_read(&c->part_flush_count);
+    *pelide = qatomic_read(&c->elide_flush_count);
+    *pfill = qatomic_read(&c->fill_count);
+}
+
 static void tlb_flush_by_mmuidx_async_work(CPUState *cpu, run_on_cpu_data data)
 {
     CPUArchState *env = cpu->env_ptr;
@@ -513,6 +526,193 @@ static void tlb_flush_page_locked(CPUArchState *env, int midx,
     }
 }
 
+static void tlb_flush_range_locked(CPUArchState *env, int midx,
+                                   target_ulong addr, target_ulong len,
+                                   unsigned bits)
+{
+    CPUTLBDesc *d = &env_tlb(env)->d[midx];
+    CPUTLBDescFast *f = &env_tlb(env)->f[midx];
+    target_ulong mask = MAKE_64BIT_MASK(0, bits);
+
+    /*
+     * If @bits is smaller than the tlb size, there may be multiple entries
+     * within the TLB; otherwise all addresses that match under @mask hit
+     * the same TLB entry.
+     * TODO: Perhaps allow bits to be a few bits less than the size.
+     * For now, just flush the entire TLB.
+     *
+     * If @len is larger than the tlb size, then it will take longer to
+     * test all of the entries in the TLB than it will to flush it all.
+     */
+    if (mask < f->mask || len > f->mask) {
+        tlb_debug("forcing full flush midx %d ("
+                  TARGET_FMT_lx "/" TARGET_FMT_lx "+" TARGET_FMT_lx ")\n",
+                  midx, addr, mask, len);
+        tlb_flush_one_mmuidx_locked(env, midx, get_clock_realtime());
+        return;
+    }
+
+    /*
+     * Check if we need to flush due to large pages.
+     * Because large_page_mask contains all 1's from the msb,
+     * we only need to test the end of the range.
+     */
+    if (((addr + len - 1) & d->large_page_mask) == d->large_page_addr) {
+        tlb_debug("forcing full flush midx %d ("
+                  TARGET_FMT_lx "/" TARGET_FMT_lx ")\n",
+                  midx, d->large_page_addr, d->large_page_mask);
+        tlb_flush_one_mmuidx_locked(env, midx, get_clock_realtime());
+        return;
+    }
+
+    for (target_ulong i = 0; i < len; i += TARGET_PAGE_SIZE) {
+        target_ulong page = addr + i;
+        CPUTLBEntry *entry = tlb_entry(env, midx, page);
+
+        if (tlb_flush_entry_mask_locked(entry, page, mask)) {
+            tlb_n_used_entries_dec(env, midx);
+        }
+        tlb_flush_vtlb_page_mask_locked(env, midx, page, mask);
+    }
+}
+
+static void tlb_flush_range_by_mmuidx_async_0(CPUState *cpu,
+                                              TLBFlushRangeData d)
+{
+    CPUArchState *env = cpu->env_ptr;
+    int mmu_idx;
+
+    assert_cpu_is_self(cpu);
+
+    tlb_debug("range:" TARGET_FMT_lx "/%u+" TARGET_FMT_lx " mmu_map:0x%x\n",
+              d.addr, d.bits, d.len, d.idxmap);
+
+    qemu_spin_lock(&env_tlb(env)->c.lock);
+    for (mmu_idx = 0; mmu_idx < NB_MMU_MODES; mmu_idx++) {
+        if ((d.idxmap >> mmu_idx) & 1) {
+            tlb_flush_range_locked(env, mmu_idx, d.addr, d.len, d.bits);
+        }
+    }
+    qemu_spin_unlock(&env_tlb(env)->c.lock);
+
+    /*
+     * If the length is larger than the jump cache size, then it will take
+     * longer to clear each entry individually than it will to clear it all.
+     */
+    if (d.len >= (TARGET_PAGE_SIZE * TB_JMP_CACHE_SIZE)) {
+        cpu_tb_jmp_cache_clear(cpu);
+        return;
+    }
+
+    for (target_ulong i = 0; i < d.len; i += TARGET_PAGE_SIZE) {
+        tb_flush_jmp_cache(cpu, d.addr + i);
+    }
+}
+
+static void tlb_flush_range_by_mmuidx_async_1(CPUState *cpu,
+                                              run_on_cpu_data data)
+{
+    TLBFlushRangeData *d = data.host_ptr;
+    tlb_flush_range_by_mmuidx_async_0(cpu, *d);
+    g_free(d);
+}
+
+/*
+ * Merge @d into @p if they apply to the same tlbs and the two ranges
+ * overlap or are adjacent.  Ranges that wrap around the end of the
+ * address space are never merged.
+ */
+static bool tlb_flush_range_merge(TLBFlushRangeData *p,
+                                  const TLBFlushRangeData *d)
+{
+    target_ulong p_end = p->addr + p->len;
+    target_ulong d_end = d->addr + d->len;
+
+    if (p->idxmap != d->idxmap || p->bits != d->bits ||
+        p_end < p->addr || d_end < d->addr ||
+        d->addr > p_end || p->addr > d_end) {
+        return false;
+    }
+    p->addr = MIN(p->addr, d->addr);
+    p->len = MAX(p_end, d_end) - p->addr;
+    return true;
+}
+
+static void tlb_flush_pending_async_work(CPUState *cpu, run_on_cpu_data data)
+{
+    CPUTLBCommon *c = &env_tlb(cpu->env_ptr)->c;
+    TLBFlushRangeData pending[CPU_TLB_PENDING_FLUSHES];
+    unsigned i, n;
+    uint16_t full;
+
+    qemu_spin_lock(&c->lock);
+    full = c->pending_full;
+    n = c->pending_count;
+    memcpy(pending, c->pending, n * sizeof(pending[0]));
+    c->pending_full = 0;
+    c->pending_count = 0;
+    c->pending_queued = false;
+    qemu_spin_unlock(&c->lock);
+
+    if (full) {
+        tlb_flush_by_mmuidx_async_work(cpu, RUN_ON_CPU_HOST_INT(full));
+    }
+    for (i = 0; i < n; i++) {
+        pending[i].idxmap &= ~full;
+        if (pending[i].idxmap) {
+            tlb_flush_range_by_mmuidx_async_0(cpu, pending[i]);
+        }
+    }
+}
+
+/*
+ * Queue a flush of @d on another cpu.  While an earlier request has not
+ * run yet, @d is merged with it instead of queueing more work, so that a
+ * storm of page or range flushes from the guest costs a single work item
+ * per destination.  When too many distinct ranges are waiting, fall back
+ * to a full flush of the affected mmu_idx.
+ */
+static void tlb_flush_range_queue(CPUState *cpu, const TLBFlushRangeData *d)
+{
+    CPUTLBCommon *c = &env_tlb(cpu->env_ptr)->c;
+    bool queue;
+    unsigned i;
+
+    qemu_spin_lock(&c->lock);
+    for (i = 0; i < c->pending_count; i++) {
+        if (tlb_flush_range_merge(&c->pending[i], d)) {
+            break;
+        }
+    }
+    if (i == c->pending_count) {
+        if (i < CPU_TLB_PENDING_FLUSHES) {
+            c->pending[c->pending_count++] = *d;
+        } else {
+            c->pending_full |= d->idxmap;
+        }
+    }
+    queue = !c->pending_queued;
+    c->pending_queued = true;
+    qemu_spin_unlock(&c->lock);
+
+    if (queue) {
+        async_run_on_cpu(cpu, tlb_flush_pending_async_work, RUN_ON_CPU_NULL);
+    }
+}
+
+/* Queue a flush of @d on every cpu except @src.  */
+static void tlb_flush_range_queue_others(CPUState *src,
+                                         const TLBFlushRangeData *d)
+{
+    CPUState *dst_cpu;
+
+    CPU_FOREACH(dst_cpu) {
+        if (dst_cpu != src) {
+            tlb_flush_range_queue(dst_cpu, d);
+        }
+    }
+}
+
 /**
  * tlb_flush_page_by_mmuidx_async_0:
  * @cpu: cpu on which to flush
@@ -588,6 +788,18 @@ static void tlb_flush_page_by_mmuidx_async_2(CPUState *cpu,
     g_free(d);
 }
 
+/* Describe the flush of the single page at @addr as a range.  */
+static inline TLBFlushRangeData tlb_flush_page_data(target_ulong addr,
+                                                    uint16_t idxmap)
+{
+    return (TLBFlushRangeData) {
+        .addr = addr,
+        .len = TARGET_PAGE_SIZE,
+        .idxmap = idxmap,
+        .bits = TARGET_LONG_BITS,
+    };
+}
+
 void tlb_flush_page_by_mmuidx(CPUState *cpu, target_ulong addr, uint16_t idxmap)
 {
     tlb_debug("addr: "TARGET_FMT_lx" mmu_idx:%" PRIx16 "\n", addr, idxmap);
@@ -597,22 +809,9 @@ void tlb_flush_page_by_mmuidx(CPUState *cpu, target_ulong addr, uint16_t idxmap)
 
     if (qemu_cpu_is_self(cpu)) {
         tlb_flush_page_by_mmuidx_async_0(cpu, addr, idxmap);
-    } else if (idxmap < TARGET_PAGE_SIZE) {
-        /*
-         * Most targets have only a few mmu_idx.  In the case where
-         * we can stuff idxmap into the low TARGET_PAGE_BITS, avoid
-         * allocating memory for this operation.
-         */
-        async_run_on_cpu(cpu, tlb_flush_page_by_mmuidx_async_1,
-                         RUN_ON_CPU_TARGET_PTR(addr | idxmap));
     } else {
-        TLBFlushPageByMMUIdxData *d = g_new(TLBFlushPageByMMUIdxData, 1);
-
-        /* Otherwise allocate a structure, freed by the worker.  */
-        d->addr = addr;
-        d->idxmap = idxmap;
-        async_run_on_cpu(cpu, tlb_flush_page_by_mmuidx_async_2,
-                         RUN_ON_CPU_HOST_PTR(d));
+        TLBFlushRangeData d = tlb_flush_page_data(addr, idxmap);
+        tlb_flush_range_queue(cpu, &d);
     }
 }
 
@@ -624,34 +823,15 @@ void tlb_flush_page(CPUState *cpu, target_ulong addr)
 void tlb_flush_page_by_mmuidx_all_cpus(CPUState *src_cpu, target_ulong addr,
                                        uint16_t idxmap)
 {
+    TLBFlushRangeData d;
+
     tlb_debug("addr: "TARGET_FMT_lx" mmu_idx:%"PRIx16"\n", addr, idxmap);
 
     /* This should already be page aligned */
     addr &= TARGET_PAGE_MASK;
 
-    /*
-     * Allocate memory to hold addr+idxmap only when needed.
-     * See tlb_flush_page_by_mmuidx for details.
-     */
-    if (idxmap < TARGET_PAGE_SIZE) {
-        flush_all_helper(src_cpu, tlb_flush_page_by_mmuidx_async_1,
-                         RUN_ON_CPU_TARGET_PTR(addr | idxmap));
-    } else {
-        CPUState *dst_cpu;
-
-        /* Allocate a separate data block for each destination cpu.  */
-        CPU_FOREACH(dst_cpu) {
-            if (dst_cpu != src_cpu) {
-                TLBFlushPageByMMUIdxData *d
-                    = g_new(TLBFlushPageByMMUIdxData, 1);
-
-                d->addr = addr;
-                d->idxmap = idxmap;
-                async_run_on_cpu(dst_cpu, tlb_flush_page_by_mmuidx_async_2,
-                                 RUN_ON_CPU_HOST_PTR(d));
-            }
-        }
-    }
+    d = tlb_flush_page_data(addr, idxmap);
+    tlb_flush_range_queue_others(src_cpu, &d);
 
     tlb_flush_page_by_mmuidx_async_0(src_cpu, addr, idxmap);
 }
@@ -665,36 +845,28 @@ void tlb_flush_page_by_mmuidx_all_cpus_synced(CPUState *src_cpu,
                                               target_ulong addr,
                                               uint16_t idxmap)
 {
+    TLBFlushRangeData r;
+
     tlb_debug("addr: "TARGET_FMT_lx" mmu_idx:%"PRIx16"\n", addr, idxmap);
 
     /* This should already be page aligned */
     addr &= TARGET_PAGE_MASK;
 
+    r = tlb_flush_page_data(addr, idxmap);
+    tlb_flush_range_queue_others(src_cpu, &r);
+
     /*
-     * Allocate memory to hold addr+idxmap only when needed.
-     * See tlb_flush_page_by_mmuidx for details.
+     * Most targets have only a few mmu_idx.  In the case where
+     * we can stuff idxmap into the low TARGET_PAGE_BITS, avoid
+     * allocating memory for this operation.
      */
     if (idxmap < TARGET_PAGE_SIZE) {
-        flush_all_helper(src_cpu, tlb_flush_page_by_mmuidx_async_1,
-                         RUN_ON_CPU_TARGET_PTR(addr | idxmap));
         async_safe_run_on_cpu(src_cpu, tlb_flush_page_by_mmuidx_async_1,
                               RUN_ON_CPU_TARGET_PTR(addr | idxmap));
     } else {
-        CPUState *dst_cpu;
-        TLBFlushPageByMMUIdxData *d;
-
-        /* Allocate a separate data block for each destination cpu.  */
-        CPU_FOREACH(dst_cpu) {
-            if (dst_cpu != src_cpu) {
-                d = g_new(TLBFlushPageByMMUIdxData, 1);
-                d->addr = addr;
-                d->idxmap = idxmap;
-                async_run_on_cpu(dst_cpu, tlb_flush_page_by_mmuidx_async_2,
-                                 RUN_ON_CPU_HOST_PTR(d));
-            }
-        }
+        /* Otherwise allocate a structure, freed by the worker.  */
+        TLBFlushPageByMMUIdxData *d = g_new(TLBFlushPageByMMUIdxData, 1);
 
-        d = g_new(TLBFlushPageByMMUIdxData, 1);
         d->addr = addr;
         d->idxmap = idxmap;
         async_safe_run_on_cpu(src_cpu, tlb_flush_page_by_mmuidx_async_2,
@@ -707,95 +879,6 @@ void tlb_flush_page_all_cpus_synced(CPUState *src, target_ulong addr)
     tlb_flush_page_by_mmuidx_all_cpus_synced(src, addr, ALL_MMUIDX_BITS);
 }
 
-static void tlb_flush_range_locked(CPUArchState *env, int midx,
-                                   target_ulong addr, target_ulong len,
-                                   unsigned bits)
-{
-    CPUTLBDesc *d = &env_tlb(env)->d[midx];
-    CPUTLBDescFast *f = &env_tlb(env)->f[midx];
-    target_ulong mask = MAKE_64BIT_MASK(0, bits);
-
-    /*
-     * If @bits is smaller than the tlb size, there may be multiple entries
-     * within the TLB; otherwise all addresses that match under @mask hit
-     * the same TLB entry.
-     * TODO: Perhaps allow bits to be a few bits less than the size.
-     * For now, just flush the entire TLB.
-     *
-     * If @len is larger than the tlb size, then it will take longer to
-     * test all of the entries in the TLB than it will to flush it all.
-     */
-    if (mask < f->mask || len > f->mask) {
-        tlb_debug("forcing full flush midx %d ("
-                  TARGET_FMT_lx "/" TARGET_FMT_lx "+" TARGET_FMT_lx ")\n",
-                  midx, addr, mask, len);
-        tlb_flush_one_mmuidx_locked(env, midx, get_clock_realtime());
-        return;
-    }
-
-    /*
-     * Check if we need to flush due to large pages.
-     * Because large_page_mask contains all 1's from the msb,
-     * we only need to test the end of the range.
-     */
-    if (((addr + len - 1) & d->large_page_mask) == d->large_page_addr) {
-        tlb_debug("forcing full flush midx %d ("
-                  TARGET_FMT_lx "/" TARGET_FMT_lx ")\n",
-                  midx, d->large_page_addr, d->large_page_mask);
-        tlb_flush_one_mmuidx_locked(env, midx, get_clock_realtime());
-        return;
-    }
-
-    for (target_ulong i = 0; i < len; i += TARGET_PAGE_SIZE) {
-        target_ulong page = addr + i;
-        CPUTLBEntry *entry = tlb_entry(env, midx, page);
-
-        if (tlb_flush_entry_mask_locked(entry, page, mask)) {
-            tlb_n_used_entries_dec(env, midx);
-        }
-        tlb_flush_vtlb_page_mask_locked(env, midx, page, mask);
-    }
-}
-
-typedef struct {
-    target_ulong addr;
-    target_ulong len;
-    uint16_t idxmap;
-    uint16_t bits;
-} TLBFlushRangeData;
-
-static void tlb_flush_range_by_mmuidx_async_0(CPUState *cpu,
-                                              TLBFlushRangeData d)
-{
-    CPUArchState *env = cpu->env_ptr;
-    int mmu_idx;
-
-    assert_cpu_is_self(cpu);
-
-    tlb_debug("range:" TARGET_FMT_lx "/%u+" TARGET_FMT_lx " mmu_map:0x%x\n",
-              d.addr, d.bits, d.len, d.idxmap);
-
-    qemu_spin_lock(&env_tlb(env)->c.lock);
-    for (mmu_idx = 0; mmu_idx < NB_MMU_MODES; mmu_idx++) {
-        if ((d.idxmap >> mmu_idx) & 1) {
-            tlb_flush_range_locked(env, mmu_idx, d.addr, d.len, d.bits);
-        }
-    }
-    qemu_spin_unlock(&env_tlb(env)->c.lock);
-
-    for (target_ulong i = 0; i < d.len; i += TARGET_PAGE_SIZE) {
-        tb_flush_jmp_cache(cpu, d.addr + i);
-    }
-}
-
-static void tlb_flush_range_by_mmuidx_async_1(CPUState *cpu,
-                                              run_on_cpu_data data)
-{
-    TLBFlushRangeData *d = data.host_ptr;
-    tlb_flush_range_by_mmuidx_async_0(cpu, *d);
-    g_free(d);
-}
-
 void tlb_flush_range_by_mmuidx(CPUState *cpu, target_ulong addr,
                                target_ulong len, uint16_t idxmap,
                                unsigned bits)
@@ -825,10 +908,7 @@ void tlb_flush_range_by_mmuidx(CPUState *cpu, target_ulong addr,
     if (qemu_cpu_is_self(cpu)) {
         tlb_flush_range_by_mmuidx_async_0(cpu, d);
     } else {
-        /* Otherwise allocate a structure, freed by the worker.  */
-        TLBFlushRangeData *p = g_memdup(&d, sizeof(d));
-        async_run_on_cpu(cpu, tlb_flush_range_by_mmuidx_async_1,
-                         RUN_ON_CPU_HOST_PTR(p));
+        tlb_flush_range_queue(cpu, &d);
     }
 }
 
@@ -843,7 +923,6 @@ void tlb_flush_range_by_mmuidx_all_cpus(CPUState *src_cpu,
                                         uint16_t idxmap, unsigned bits)
 {
     TLBFlushRangeData d;
-    CPUState *dst_cpu;
 
     /*
      * If all bits are significant, and len is small,
@@ -865,16 +944,7 @@ void tlb_flush_range_by_mmuidx_all_cpus(CPUState *src_cpu,
     d.idxmap = idxmap;
     d.bits = bits;
 
-    /* Allocate a separate data block for each destination cpu.  */
-    CPU_FOREACH(dst_cpu) {
-        if (dst_cpu != src_cpu) {
-            TLBFlushRangeData *p = g_memdup(&d, sizeof(d));
-            async_run_on_cpu(dst_cpu,
-                             tlb_flush_range_by_mmuidx_async_1,
-                             RUN_ON_CPU_HOST_PTR(p));
-        }
-    }
-
+    tlb_flush_range_queue_others(src_cpu, &d);
     tlb_flush_range_by_mmuidx_async_0(src_cpu, d);
 }
 
@@ -893,7 +963,6 @@ void tlb_flush_range_by_mmuidx_all_cpus_synced(CPUState *src_cpu,
                                                unsigned bits)
 {
     TLBFlushRangeData d, *p;
-    CPUState *dst_cpu;
 
     /*
      * If all bits are significant, and len is small,
@@ -915,14 +984,7 @@ void tlb_flush_range_by_mmuidx_all_cpus_synced(CPUState *src_cpu,
     d.idxmap = idxmap;
     d.bits = bits;
 
-    /* Allocate a separate data block for each destination cpu.  */
-    CPU_FOREACH(dst_cpu) {
-        if (dst_cpu != src_cpu) {
-            p = g_memdup(&d, sizeof(d));
-            async_run_on_cpu(dst_cpu, tlb_flush_range_by_mmuidx_async_1,
-                             RUN_ON_CPU_HOST_PTR(p));
-        }
-    }
+    tlb_flush_range_queue_others(src_cpu, &d);
 
     p = g_memdup(&d, sizeof(d));
     async_safe_run_on_cpu(src_cpu, tlb_flush_range_by_mmuidx_async_1,
@@ -1086,6 +1148,39 @@ static void tlb_add_large_page(CPUArchState *env, int mmu_idx,
     env_tlb(env)->d[mmu_idx].large_page_mask = lp_mask;
 }
 
+/*
+ * Remember a large page mapping, so that the other pages it covers
+ * can be entered by tlb_fill_large_page without asking the target.
+ */
+static void tlb_record_large_page(CPUTLBDesc *desc, target_ulong vaddr,
+                                  hwaddr paddr, MemTxAttrs attrs, int prot,
+                                  target_ulong size)
+{
+    target_ulong lp_mask = ~(size - 1);
+    target_ulong lp_vaddr = vaddr & lp_mask;
+    CPUTLBLargePage *lp = NULL;
+    size_t i;
+
+    for (i = 0; i < CPU_TLB_LARGE_SIZE; i++) {
+        if (desc->ltable[i].prot &&
+            desc->ltable[i].vaddr == lp_vaddr &&
+            desc->ltable[i].mask == lp_mask) {
+            lp = &desc->ltable[i];
+            break;
+        }
+    }
+    if (!lp) {
+        lp = &desc->ltable[desc->lindex++ % CPU_TLB_LARGE_SIZE];
+    }
+
+    lp->vaddr = lp_vaddr;
+    lp->mask = lp_mask;
+    lp->paddr = (paddr & TARGET_PAGE_MASK)
+                - ((vaddr & TARGET_PAGE_MASK) - lp_vaddr);
+    lp->attrs = attrs;
+    lp->prot = prot;
+}
+
 /* Add a new TLB entry. At most one entry for a given virtual address
  * is permitted. Only a single TARGET_PAGE_SIZE region is mapped, the
  * supplied size is only used by tlb_flush_page.
@@ -1118,6 +1213,7 @@ void tlb_set_page_with_attrs(CPUState *cpu, target_ulong vaddr,
         sz = TARGET_PAGE_SIZE;
     } else {
         tlb_add_large_page(env, mmu_idx, vaddr, size);
+        tlb_record_large_page(desc, vaddr, paddr, attrs, prot, size);
         sz = size;
     }
     vaddr_page = vaddr & TARGET_PAGE_MASK;
@@ -1291,12 +1387,61 @@ static inline ram_addr_t qemu_ram_addr_from_host_nofail(void *ptr)
  * caller's prior references to the TLB table (e.g. CPUTLBEntry pointers) must
  * be discarded and looked up again (e.g. via tlb_entry()).
  */
+/*
+ * Enter the page containing @addr into the tlb from a large page mapping
+ * previously installed by the target, if one covers it with the required
+ * permission.  This avoids a page table walk for every TARGET_PAGE_SIZE
+ * page of a large mapping.  Return true if the page was entered.
+ */
+static bool tlb_fill_large_page(CPUState *cpu, target_ulong addr,
+                                MMUAccessType access_type, int mmu_idx)
+{
+    CPUArchState *env = cpu->env_ptr;
+    CPUTLBDesc *desc = &env_tlb(env)->d[mmu_idx];
+    target_ulong vaddr_page = addr & TARGET_PAGE_MASK;
+    int need;
+    size_t i;
+
+    switch (access_type) {
+    case MMU_DATA_LOAD:
+        need = PAGE_READ;
+        break;
+    case MMU_DATA_STORE:
+        need = PAGE_WRITE;
+        break;
+    case MMU_INST_FETCH:
+        need = PAGE_EXEC;
+        break;
+    default:
+        g_assert_not_reached();
+    }
+
+    for (i = 0; i < CPU_TLB_LARGE_SIZE; i++) {
+        CPUTLBLargePage *lp = &desc->ltable[i];
+
+        if ((lp->prot & need) && (addr & lp->mask) == lp->vaddr) {
+            tlb_set_page_with_attrs(cpu, vaddr_page,
+                                    lp->paddr + (vaddr_page - lp->vaddr),
+                                    lp->attrs, lp->prot, mmu_idx,
+                                    ~lp->mask + 1);
+            return true;
+        }
+    }
+    return false;
+}
+
 static void tlb_fill(CPUState *cpu, target_ulong addr, int size,
                      MMUAccessType access_type, int mmu_idx, uintptr_t retaddr)
 {
     CPUClass *cc = CPU_GET_CLASS(cpu);
+    CPUTLBCommon *c = &env_tlb((CPUArchState *)cpu->env_ptr)->c;
     bool ok;
 
+    qatomic_set(&c->fill_count, c->fill_count + 1);
+    if (tlb_fill_large_page(cpu, addr, access_type, mmu_idx)) {
+        return;
+    }
+
     /*
      * This is not a probe, so only valid return is success; failure
      * should result in exception + longjmp to the cpu loop.
@@ -1352,7 +1497,7 @@ static uint64_t io_readx(CPUArchState *env, CPUIOTLBEntry *iotlbentry,
         cpu_io_recompile(cpu, retaddr);
     }
 
-    if (!qemu_mutex_iothread_locked()) {
+    if (!mr->lockless_io && !qemu_mutex_iothread_locked()) {
         qemu_mutex_lock_iothread();
         locked = true;
     }
@@ -1413,7 +1558,7 @@ static void io_writex(CPUArchState *env, CPUIOTLBEntry *iotlbentry,
      */
     save_iotlb_data(cpu, iotlbentry->addr, section, mr_offset);
 
-    if (!qemu_mutex_iothread_locked()) {
+    if (!mr->lockless_io && !qemu_mutex_iothread_locked()) {
         qemu_mutex_lock_iothread();
         locked = true;
     }
@@ -1599,7 +1744,8 @@ static int probe_access_internal(CPUArchState *env, target_ulong addr,
             CPUState *cs = env_cpu(env);
             CPUClass *cc = CPU_GET_CLASS(cs);
 
-            if (!cc->tcg_ops->tlb_fill(cs, addr, fault_size, access_type,
+            if (!tlb_fill_large_page(cs, addr, access_type, mmu_idx) &&
+                !cc->tcg_ops->tlb_fill(cs, addr, fault_size, access_type,
                                        mmu_idx, nonfault, retaddr)) {
                 /* Non-faulting page table read failed.  */
                 *phost = NULL;
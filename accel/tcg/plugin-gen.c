@@ -127,11 +127,25 @@ static void gen_empty_udata_cb(void)
 /*
  * For now we only support addi_i64.
  * When we support more ops, we can generate one empty inline cb for each.
+ *
+ * The target address is ptr + cpu_index * stride, which lets per-vCPU
+ * ops use a scoreboard.  For global ops the stride is 0 and the index
+ * computation is folded away by the optimizer.
  */
 static void gen_empty_inline_cb(void)
 {
+    TCGv_i32 cpu_index = tcg_temp_new_i32();
+    TCGv_ptr cpu_offset = tcg_temp_new_ptr();
     TCGv_i64 val = tcg_temp_new_i64();
-    TCGv_ptr ptr = tcg_const_ptr(NULL); /* overwritten later */
+    TCGv_ptr ptr;
+
+    tcg_gen_ld_i32(cpu_index, cpu_env,
+                   -offsetof(ArchCPU, env) + offsetof(CPUState, cpu_index));
+    /* the second operand will be replaced by the stride */
+    tcg_gen_mul_i32(cpu_index, cpu_index, cpu_index);
+    tcg_gen_ext_i32_ptr(cpu_offset, cpu_index);
+    ptr = tcg_const_ptr(NULL); /* overwritten later */
+    tcg_gen_add_ptr(ptr, ptr, cpu_offset);
 
     tcg_gen_ld_i64(val, ptr, 0);
     /* pass an immediate != 0 so that it doesn't get optimized away */
@@ -139,6 +153,8 @@ static void gen_empty_inline_cb(void)
     tcg_gen_st_i64(val, ptr, 0);
     tcg_temp_free_ptr(ptr);
     tcg_temp_free_i64(val);
+    tcg_temp_free_ptr(cpu_offset);
+    tcg_temp_free_i32(cpu_index);
 }
 
 static void gen_empty_mem_cb(TCGv addr, uint32_t info)
@@ -318,6 +334,37 @@ static TCGOp *copy_const_ptr(TCGOp **begin_op, TCGOp *op, void *ptr)
     return op;
 }
 
+static TCGOp *copy_ext_i32_ptr(TCGOp **begin_op, TCGOp *op)
+{
+    if (UINTPTR_MAX == UINT32_MAX) {
+        /* mov_i32 */
+        op = copy_op(begin_op, op, INDEX_op_mov_i32);
+    } else {
+        /* ext_i32_i64 */
+        op = copy_op(begin_op, op, INDEX_op_ext_i32_i64);
+    }
+    return op;
+}
+
+static TCGOp *copy_add_ptr(TCGOp **begin_op, TCGOp *op)
+{
+    if (UINTPTR_MAX == UINT32_MAX) {
+        /* add_i32 */
+        op = copy_op(begin_op, op, INDEX_op_add_i32);
+    } else {
+        /* add_i64 */
+        op = copy_op(begin_op, op, INDEX_op_add_i64);
+    }
+    return op;
+}
+
+static TCGOp *copy_mul_i32(TCGOp **begin_op, TCGOp *op, uint32_t v)
+{
+    op = copy_op(begin_op, op, INDEX_op_mul_i32);
+    op->args[2] = tcgv_i32_arg(tcg_constant_i32(v));
+    return op;
+}
+
 static TCGOp *copy_extu_tl_i64(TCGOp **begin_op, TCGOp *op)
 {
     if (TARGET_LONG_BITS == 32) {
@@ -447,9 +494,21 @@ static TCGOp *append_inline_cb(const struct qemu_plugin_dyn_cb *cb,
                                TCGOp *begin_op, TCGOp *op,
                                int *unused)
 {
+    /* ld_i32 cpu_index */
+    op = copy_op(&begin_op, op, INDEX_op_ld_i32);
+
+    /* mul_i32 by the stride */
+    op = copy_mul_i32(&begin_op, op, cb->inline_insn.stride);
+
+    /* ext_i32_ptr */
+    op = copy_ext_i32_ptr(&begin_op, op);
+
     /* const_ptr */
     op = copy_const_ptr(&begin_op, op, cb->userp);
 
+    /* add_ptr */
+    op = copy_add_ptr(&begin_op, op);
+
     /* ld_i64 */
     op = copy_ld_i64(&begin_op, op);
 
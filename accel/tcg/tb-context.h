@@ -35,6 +35,8 @@ struct TBContext {
     /* statistics */
     unsigned tb_flush_count;
     unsigned tb_phys_invalidate_count;
+    unsigned tb_evict_count;
+    size_t tb_evicted_tbs;
 };
 
 extern TBContext tb_ctx;
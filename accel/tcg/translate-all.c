@@ -43,6 +43,7 @@
 #endif
 #else
 #include "exec/ram_addr.h"
+#include "qapi/qapi-commands-machine.h"
 #endif
 
 #include "exec/cputlb.h"
@@ -102,6 +103,11 @@
 #endif
 
 #define SMC_BITMAP_USE_THRESHOLD 10
+/*
+ * Invalidated TBs leave their bytes set in the code bitmap; rebuild it
+ * when a write hits it after this many TBs have left the page.
+ */
+#define SMC_BITMAP_STALE_THRESHOLD 8
 
 typedef struct PageDesc {
     /* list of TBs intersecting this ram page */
@@ -111,6 +117,7 @@ typedef struct PageDesc {
        of lookups we do to a given page to use a bitmap */
     unsigned long *code_bitmap;
     unsigned int code_write_count;
+    unsigned int code_bitmap_stale;
 #else
     unsigned long flags;
     void *target_data;
@@ -914,6 +921,24 @@ static inline void invalidate_page_bitmap(PageDesc *p)
     g_free(p->code_bitmap);
     p->code_bitmap = NULL;
     p->code_write_count = 0;
+    p->code_bitmap_stale = 0;
+#endif
+}
+
+/*
+ * A TB has left the page: the bitmap, if any, stays valid as a superset
+ * of the code on the page, so keep it unless the page is now empty.
+ * Call with @p->lock held.
+ */
+static inline void page_bitmap_remove_tb(PageDesc *p)
+{
+    assert_page_locked(p);
+#ifdef CONFIG_SOFTMMU
+    if (p->first_tb == (uintptr_t)NULL) {
+        invalidate_page_bitmap(p);
+    } else if (p->code_bitmap) {
+        p->code_bitmap_stale++;
+    }
 #endif
 }
 
@@ -986,6 +1011,10 @@ static void do_tb_flush(CPUState *cpu, run_on_cpu_data tb_flush_count)
 
     CPU_FOREACH(cpu) {
         cpu_tb_jmp_cache_clear(cpu);
+        if (cpu->tb_lookup_cache) {
+            memset(cpu->tb_lookup_cache, 0,
+                   TB_LOOKUP_CACHE_SIZE * sizeof(TranslationBlock *));
+        }
     }
 
     qht_reset_size(&tb_ctx.htable, CODE_GEN_HTABLE_SIZE);
@@ -1017,6 +1046,69 @@ void tb_flush(CPUState *cpu)
     }
 }
 
+static void tb_evict_one(TranslationBlock *tb)
+{
+    tb_phys_invalidate(tb, -1);
+}
+
+/*
+ * Make room in the code buffer by invalidating the TBs of a single
+ * region, rather than flushing all of them.  Falls back to a full
+ * flush if no region can be evicted.
+ */
+static void do_tb_evict(CPUState *cpu, run_on_cpu_data tb_cache_gen)
+{
+    size_t n_tbs;
+    bool ok;
+
+    mmap_lock();
+    /* If it is already been done on request of another CPU, just retry. */
+    if (tb_ctx.tb_flush_count + tb_ctx.tb_evict_count !=
+        tb_cache_gen.host_int) {
+        mmap_unlock();
+        return;
+    }
+
+    qemu_thread_jit_write();
+    ok = tcg_region_evict(tb_evict_one, &n_tbs);
+    qemu_thread_jit_execute();
+    if (!ok) {
+        unsigned tb_flush_count = tb_ctx.tb_flush_count;
+
+        mmap_unlock();
+        do_tb_flush(cpu, RUN_ON_CPU_HOST_INT(tb_flush_count));
+        return;
+    }
+
+    /*
+     * The jump caches were cleared of the evicted TBs one by one,
+     * but the TB memory is about to be reused.
+     */
+    CPU_FOREACH(cpu) {
+        if (cpu->tb_lookup_cache) {
+            memset(cpu->tb_lookup_cache, 0,
+                   TB_LOOKUP_CACHE_SIZE * sizeof(TranslationBlock *));
+        }
+    }
+
+    qatomic_set(&tb_ctx.tb_evicted_tbs, tb_ctx.tb_evicted_tbs + n_tbs);
+    qatomic_mb_set(&tb_ctx.tb_evict_count, tb_ctx.tb_evict_count + 1);
+    mmap_unlock();
+}
+
+static void tb_evict(CPUState *cpu)
+{
+    unsigned tb_cache_gen = qatomic_mb_read(&tb_ctx.tb_flush_count) +
+                            qatomic_mb_read(&tb_ctx.tb_evict_count);
+
+    if (cpu_in_exclusive_context(cpu)) {
+        do_tb_evict(cpu, RUN_ON_CPU_HOST_INT(tb_cache_gen));
+    } else {
+        async_safe_run_on_cpu(cpu, do_tb_evict,
+                              RUN_ON_CPU_HOST_INT(tb_cache_gen));
+    }
+}
+
 /*
  * Formerly ifdef DEBUG_TB_CHECK. These debug functions are user-mode-only,
  * so in order to prevent bit rot we compile them unconditionally in user-mode,
@@ -1196,11 +1288,11 @@ static void do_tb_phys_invalidate(TranslationBlock *tb, bool rm_from_page_list)
     if (rm_from_page_list) {
         p = page_find(tb->page_addr[0] >> TARGET_PAGE_BITS);
         tb_page_remove(p, tb);
-        invalidate_page_bitmap(p);
+        page_bitmap_remove_tb(p);
         if (tb->page_addr[1] != -1) {
             p = page_find(tb->page_addr[1] >> TARGET_PAGE_BITS);
             tb_page_remove(p, tb);
-            invalidate_page_bitmap(p);
+            page_bitmap_remove_tb(p);
         }
     }
 
@@ -1246,30 +1338,43 @@ void tb_phys_invalidate(TranslationBlock *tb, tb_page_addr_t page_addr)
 }
 
 #ifdef CONFIG_SOFTMMU
+/* Mark the bytes of @tb that lie on its @n'th page in @p's code bitmap */
+static void page_bitmap_add_tb(PageDesc *p, TranslationBlock *tb, int n)
+{
+    int tb_start, tb_end;
+
+    /* NOTE: this is subtle as a TB may span two physical pages */
+    if (n == 0) {
+        /* NOTE: tb_end may be after the end of the page, but
+           it is not a problem */
+        tb_start = tb->pc & ~TARGET_PAGE_MASK;
+        tb_end = tb_start + tb->size;
+        if (tb_end > TARGET_PAGE_SIZE) {
+            tb_end = TARGET_PAGE_SIZE;
+        }
+    } else {
+        tb_start = 0;
+        tb_end = ((tb->pc + tb->size) & ~TARGET_PAGE_MASK);
+    }
+    bitmap_set(p->code_bitmap, tb_start, tb_end - tb_start);
+}
+
 /* call with @p->lock held */
 static void build_page_bitmap(PageDesc *p)
 {
-    int n, tb_start, tb_end;
     TranslationBlock *tb;
+    int n;
 
     assert_page_locked(p);
-    p->code_bitmap = bitmap_new(TARGET_PAGE_SIZE);
+    if (p->code_bitmap) {
+        bitmap_zero(p->code_bitmap, TARGET_PAGE_SIZE);
+    } else {
+        p->code_bitmap = bitmap_new(TARGET_PAGE_SIZE);
+    }
+    p->code_bitmap_stale = 0;
 
     PAGE_FOR_EACH_TB(p, tb, n) {
-        /* NOTE: this is subtle as a TB may span two physical pages */
-        if (n == 0) {
-            /* NOTE: tb_end may be after the end of the page, but
-               it is not a problem */
-            tb_start = tb->pc & ~TARGET_PAGE_MASK;
-            tb_end = tb_start + tb->size;
-            if (tb_end > TARGET_PAGE_SIZE) {
-                tb_end = TARGET_PAGE_SIZE;
-             }
-        } else {
-            tb_start = 0;
-            tb_end = ((tb->pc + tb->size) & ~TARGET_PAGE_MASK);
-        }
-        bitmap_set(p->code_bitmap, tb_start, tb_end - tb_start);
+        page_bitmap_add_tb(p, tb, n);
     }
 }
 #endif
@@ -1294,7 +1399,16 @@ static inline void tb_page_add(PageDesc *p, TranslationBlock *tb,
     page_already_protected = p->first_tb != (uintptr_t)NULL;
 #endif
     p->first_tb = (uintptr_t)tb | n;
-    invalidate_page_bitmap(p);
+#ifdef CONFIG_SOFTMMU
+    /*
+     * Keep an existing bitmap up to date rather than dropping it, so that
+     * pages mixing code and data that keep gaining TBs, as in guests with
+     * a JIT, do not go back to invalidating on every write.
+     */
+    if (p->code_bitmap) {
+        page_bitmap_add_tb(p, tb, n);
+    }
+#endif
 
 #if defined(CONFIG_USER_ONLY)
     if (p->flags & PAGE_WRITE) {
@@ -1379,10 +1493,10 @@ tb_link_page(TranslationBlock *tb, tb_page_addr_t phys_pc,
     /* remove TB from the page(s) if we couldn't insert it */
     if (unlikely(existing_tb)) {
         tb_page_remove(p, tb);
-        invalidate_page_bitmap(p);
+        page_bitmap_remove_tb(p);
         if (p2) {
             tb_page_remove(p2, tb);
-            invalidate_page_bitmap(p2);
+            page_bitmap_remove_tb(p2);
         }
         tb = existing_tb;
     }
@@ -1400,10 +1514,9 @@ tb_link_page(TranslationBlock *tb, tb_page_addr_t phys_pc,
     return tb;
 }
 
-/* Called with mmap_lock held for user mode emulation.  */
-TranslationBlock *tb_gen_code(CPUState *cpu,
-                              target_ulong pc, target_ulong cs_base,
-                              uint32_t flags, int cflags)
+static TranslationBlock *do_tb_gen_code(CPUState *cpu,
+                                        target_ulong pc, target_ulong cs_base,
+                                        uint32_t flags, int cflags)
 {
     CPUArchState *env = cpu->env_ptr;
     TranslationBlock *tb, *existing_tb;
@@ -1435,8 +1548,8 @@ TranslationBlock *tb_gen_code(CPUState *cpu,
  buffer_overflow:
     tb = tcg_tb_alloc(tcg_ctx);
     if (unlikely(!tb)) {
-        /* flush must be done */
-        tb_flush(cpu);
+        /* eviction or flush must be done */
+        tb_evict(cpu);
         mmap_unlock();
         /* Make the execution loop process the flush as soon as possible.  */
         cpu->exception_index = EXCP_INTERRUPT;
@@ -1677,6 +1790,20 @@ TranslationBlock *tb_gen_code(CPUState *cpu,
     return tb;
 }
 
+/* Called with mmap_lock held for user mode emulation.  */
+TranslationBlock *tb_gen_code(CPUState *cpu,
+                              target_ulong pc, target_ulong cs_base,
+                              uint32_t flags, int cflags)
+{
+    int64_t start = get_clock();
+    TranslationBlock *tb = do_tb_gen_code(cpu, pc, cs_base, flags, cflags);
+
+    qatomic_set(&cpu->tb_translations, cpu->tb_translations + 1);
+    qatomic_set(&cpu->tb_translate_ns,
+                cpu->tb_translate_ns + get_clock() - start);
+    return tb;
+}
+
 /*
  * @p must be non-NULL.
  * user-mode: call with mmap_lock held.
@@ -1859,6 +1986,12 @@ void tb_invalidate_phys_page_fast(struct page_collection *pages,
 
         nr = start & ~TARGET_PAGE_MASK;
         b = p->code_bitmap[BIT_WORD(nr)] >> (nr & (BITS_PER_LONG - 1));
+        if ((b & ((1 << len) - 1)) &&
+            p->code_bitmap_stale >= SMC_BITMAP_STALE_THRESHOLD) {
+            /* The hit may be on code that is gone: look again.  */
+            build_page_bitmap(p);
+            b = p->code_bitmap[BIT_WORD(nr)] >> (nr & (BITS_PER_LONG - 1));
+        }
         if (b & ((1 << len) - 1)) {
             goto do_invalidate;
         }
@@ -2084,11 +2217,27 @@ static gboolean tb_tree_stats_iter(gpointer key, gpointer value, gpointer data)
     return false;
 }
 
+static void tb_lookup_counts(size_t *pcache, size_t *phtable, size_t *pmiss)
+{
+    CPUState *cpu;
+    size_t cache = 0, htable = 0, miss = 0;
+
+    CPU_FOREACH(cpu) {
+        cache += qatomic_read(&cpu->tb_lookup_cache_hits);
+        htable += qatomic_read(&cpu->tb_lookup_htable_hits);
+        miss += qatomic_read(&cpu->tb_lookup_misses);
+    }
+    *pcache = cache;
+    *phtable = htable;
+    *pmiss = miss;
+}
+
 void dump_exec_info(void)
 {
     struct tb_tree_stats tst = {};
     struct qht_stats hst;
     size_t nb_tbs, flush_full, flush_part, flush_elide;
+    size_t lookup_cache, lookup_htable, lookup_miss;
 
     tcg_tb_foreach(tb_tree_stats_iter, &tst);
     nb_tbs = tst.nb_tbs;
@@ -2125,6 +2274,15 @@ void dump_exec_info(void)
                 qatomic_read(&tb_ctx.tb_flush_count));
     qemu_printf("TB invalidate count %u\n",
                 qatomic_read(&tb_ctx.tb_phys_invalidate_count));
+    qemu_printf("TB region evictions %u\n",
+                qatomic_read(&tb_ctx.tb_evict_count));
+    qemu_printf("TBs evicted         %zu\n",
+                qatomic_read(&tb_ctx.tb_evicted_tbs));
+
+    tb_lookup_counts(&lookup_cache, &lookup_htable, &lookup_miss);
+    qemu_printf("TB L2 cache hits    %zu\n", lookup_cache);
+    qemu_printf("TB hash table hits  %zu\n", lookup_htable);
+    qemu_printf("TB lookup misses    %zu\n", lookup_miss);
 
     tlb_flush_counts(&flush_full, &flush_part, &flush_elide);
     qemu_printf("TLB full flushes    %zu\n", flush_full);
@@ -2138,6 +2296,48 @@ void dump_opcount_info(void)
     tcg_dump_op_count();
 }
 
+TcgStats *qmp_query_tcg_stats(Error **errp)
+{
+    TcgStats *stats;
+    TcgVcpuStatsList **tail;
+    CPUState *cpu;
+
+    if (!tcg_enabled()) {
+        error_setg(errp, "TCG statistics are only available with accel=tcg");
+        return NULL;
+    }
+
+    stats = g_new0(TcgStats, 1);
+    stats->code_size = tcg_code_size();
+    stats->code_capacity = tcg_code_capacity();
+    stats->tb_count = tcg_nb_tbs();
+    stats->flushes = qatomic_read(&tb_ctx.tb_flush_count);
+    stats->evictions = qatomic_read(&tb_ctx.tb_evict_count);
+    stats->invalidations = qatomic_read(&tb_ctx.tb_phys_invalidate_count);
+
+    tail = &stats->vcpus;
+    CPU_FOREACH(cpu) {
+        TcgVcpuStats *v = g_new0(TcgVcpuStats, 1);
+        size_t full, part, elide, fill;
+
+        v->cpu_index = cpu->cpu_index;
+        v->translations = qatomic_read(&cpu->tb_translations);
+        v->translation_time = qatomic_read(&cpu->tb_translate_ns);
+        v->jmp_cache_hits = qatomic_read(&cpu->tb_jmp_cache_hits);
+        v->lookup_cache_hits = qatomic_read(&cpu->tb_lookup_cache_hits);
+        v->htable_hits = qatomic_read(&cpu->tb_lookup_htable_hits);
+        v->lookup_misses = qatomic_read(&cpu->tb_lookup_misses);
+        v->exception_exits = qatomic_read(&cpu->exception_exits);
+        tlb_cpu_counts(cpu, &full, &part, &elide, &fill);
+        v->tlb_fills = fill;
+        v->tlb_full_flushes = full;
+        v->tlb_partial_flushes = part;
+        v->tlb_elided_flushes = elide;
+        QAPI_LIST_APPEND(tail, v);
+    }
+    return stats;
+}
+
 #else /* CONFIG_USER_ONLY */
 
 void cpu_interrupt(CPUState *cpu, int mask)
@@ -2273,10 +2473,26 @@ int page_get_flags(target_ulong address)
 /* Modify the flags of a page and invalidate the code if necessary.
    The flag PAGE_WRITE_ORG is positioned automatically depending
    on PAGE_WRITE.  The mmap_lock should already be held.  */
+/*
+ * PageDescs are allocated in leaves of V_L2_SIZE consecutive entries,
+ * so when walking a range of pages only the first page of each leaf
+ * needs a walk of the radix tree.  @p is the PageDesc for @index - 1,
+ * or NULL for the first page of the range.
+ */
+static inline PageDesc *page_find_next(PageDesc *p, tb_page_addr_t index,
+                                       int alloc)
+{
+    if (p && (index & (V_L2_SIZE - 1)) != 0) {
+        return p + 1;
+    }
+    return page_find_alloc(index, alloc);
+}
+
 void page_set_flags(target_ulong start, target_ulong end, int flags)
 {
     target_ulong addr, len;
     bool reset_target_data;
+    PageDesc *p = NULL;
 
     /* This function should never be called with addresses outside the
        guest address space.  If this assert fires, it probably indicates
@@ -2299,7 +2515,7 @@ void page_set_flags(target_ulong start, target_ulong end, int flags)
     for (addr = start, len = end - start;
          len != 0;
          len -= TARGET_PAGE_SIZE, addr += TARGET_PAGE_SIZE) {
-        PageDesc *p = page_find_alloc(addr >> TARGET_PAGE_BITS, 1);
+        p = page_find_next(p, addr >> TARGET_PAGE_BITS, 1);
 
         /* If the write protection bit is set, then we invalidate
            the code inside.  */
@@ -2341,7 +2557,7 @@ void *page_alloc_target_data(target_ulong address, size_t size)
 
 int page_check_range(target_ulong start, target_ulong len, int flags)
 {
-    PageDesc *p;
+    PageDesc *p = NULL;
     target_ulong end;
     target_ulong addr;
 
@@ -2367,7 +2583,7 @@ int page_check_range(target_ulong start, target_ulong len, int flags)
     for (addr = start, len = end - start;
          len != 0;
          len -= TARGET_PAGE_SIZE, addr += TARGET_PAGE_SIZE) {
-        p = page_find(addr >> TARGET_PAGE_BITS);
+        p = page_find_next(p, addr >> TARGET_PAGE_BITS, 0);
         if (!p) {
             return -1;
         }
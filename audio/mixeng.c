@@ -457,6 +457,14 @@ void mixeng_volume (struct st_sample *buf, int len, struct mixeng_volume *vol)
         return;
     }
 
+    /*
+     * Guests leave most streams at full volume; scaling by one would only
+     * cost a multiply per channel of every sample on each timer tick.
+     */
+    if (vol->l == nominal_volume.l && vol->r == nominal_volume.r) {
+        return;
+    }
+
     while (len--) {
 #ifdef FLOAT_MIXENG
         buf->l = buf->l * vol->l;
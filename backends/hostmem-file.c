@@ -17,6 +17,7 @@
 #include "sysemu/hostmem.h"
 #include "qom/object_interfaces.h"
 #include "qom/object.h"
+#include "qapi/qapi-visit-common.h"
 
 OBJECT_DECLARE_SIMPLE_TYPE(HostMemoryBackendFile, MEMORY_BACKEND_FILE)
 
@@ -29,6 +30,7 @@ struct HostMemoryBackendFile {
     bool discard_data;
     bool is_pmem;
     bool readonly;
+    OnOffAuto rom;
 };
 
 static void
@@ -40,6 +42,7 @@ file_backend_memory_alloc(HostMemoryBackend *backend, Error **errp)
 #else
     HostMemoryBackendFile *fb = MEMORY_BACKEND_FILE(backend);
     uint32_t ram_flags;
+    bool rom;
     gchar *name;
 
     if (!backend->size) {
@@ -51,13 +54,43 @@ file_backend_memory_alloc(HostMemoryBackend *backend, Error **errp)
         return;
     }
 
+    /*
+     * readonly=on,rom=off maps a read-only file as writable private
+     * memory, for example a memory template shared by many VMs: each
+     * VM only pays for the pages it writes to.
+     */
+    switch (fb->rom) {
+    case ON_OFF_AUTO_AUTO:
+        rom = fb->readonly;
+        break;
+    case ON_OFF_AUTO_ON:
+        if (!fb->readonly) {
+            error_setg(errp, "property 'rom' = 'on' is not supported with"
+                       " 'readonly' = 'off'");
+            return;
+        }
+        rom = true;
+        break;
+    case ON_OFF_AUTO_OFF:
+        if (fb->readonly && backend->share) {
+            error_setg(errp, "property 'rom' = 'off' is incompatible with"
+                       " 'readonly' = 'on' and 'share' = 'on'");
+            return;
+        }
+        rom = false;
+        break;
+    default:
+        g_assert_not_reached();
+    }
+
     name = host_memory_backend_get_name(backend);
     ram_flags = backend->share ? RAM_SHARED : 0;
     ram_flags |= backend->reserve ? 0 : RAM_NORESERVE;
     ram_flags |= fb->is_pmem ? RAM_PMEM : 0;
+    ram_flags |= fb->readonly && !rom ? RAM_READONLY_FD : 0;
     memory_region_init_ram_from_file(&backend->mr, OBJECT(backend), name,
                                      backend->size, fb->align, ram_flags,
-                                     fb->mem_path, fb->readonly, errp);
+                                     fb->mem_path, rom, errp);
     g_free(name);
 #endif
 }
@@ -167,6 +200,27 @@ static void file_memory_backend_set_readonly(Object *obj, bool value,
     fb->readonly = value;
 }
 
+static int file_memory_backend_get_rom(Object *obj, Error **errp)
+{
+    HostMemoryBackendFile *fb = MEMORY_BACKEND_FILE(obj);
+
+    return fb->rom;
+}
+
+static void file_memory_backend_set_rom(Object *obj, int value, Error **errp)
+{
+    HostMemoryBackend *backend = MEMORY_BACKEND(obj);
+    HostMemoryBackendFile *fb = MEMORY_BACKEND_FILE(obj);
+
+    if (host_memory_backend_mr_inited(backend)) {
+        error_setg(errp, "cannot change property 'rom' of %s.",
+                   object_get_typename(obj));
+        return;
+    }
+
+    fb->rom = value;
+}
+
 static void file_backend_unparent(Object *obj)
 {
     HostMemoryBackend *backend = MEMORY_BACKEND(obj);
@@ -203,6 +257,13 @@ file_backend_class_init(ObjectClass *oc, void *data)
     object_class_property_add_bool(oc, "readonly",
         file_memory_backend_get_readonly,
         file_memory_backend_set_readonly);
+    object_class_property_add_enum(oc, "rom", "OnOffAuto",
+        &OnOffAuto_lookup,
+        file_memory_backend_get_rom,
+        file_memory_backend_set_rom);
+    object_class_property_set_description(oc, "rom",
+        "Whether the guest sees the memory as read-only;"
+        " 'auto' follows 'readonly'");
 }
 
 static void file_backend_instance_finalize(Object *o)
@@ -396,6 +396,7 @@ BlockDriverState *bdrv_new(void)
     }
     qemu_co_mutex_init(&bs->reqs_lock);
     qemu_mutex_init(&bs->dirty_bitmap_mutex);
+    block_acct_init(&bs->stats);
     bs->refcnt = 1;
     bs->aio_context = qemu_get_aio_context();
 
@@ -5061,6 +5062,8 @@ static void bdrv_delete(BlockDriverState *bs)
 
     bdrv_close(bs);
 
+    block_latency_histograms_clear(&bs->stats);
+    block_acct_cleanup(&bs->stats);
     g_free(bs);
 }
 
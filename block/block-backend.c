@@ -1420,12 +1420,68 @@ static const AIOCBInfo blk_aio_em_aiocb_info = {
     .get_aio_context    = blk_aio_em_aiocb_get_aio_context,
 };
 
+/*
+ * Per-thread cache of BlkAioEmAIOCBs, so that a steady stream of requests
+ * does not go through malloc and free for each of them.
+ */
+#define BLK_AIO_EM_CACHE_SIZE 64
+
+static __thread BlkAioEmAIOCB *blk_aio_em_cache[BLK_AIO_EM_CACHE_SIZE];
+static __thread unsigned int blk_aio_em_cache_len;
+static __thread Notifier blk_aio_em_cache_cleanup_notifier;
+
+static void blk_aio_em_cache_cleanup(Notifier *n, void *value)
+{
+    while (blk_aio_em_cache_len) {
+        g_free(blk_aio_em_cache[--blk_aio_em_cache_len]);
+    }
+}
+
+static BlkAioEmAIOCB *blk_aio_em_get(BlockBackend *blk,
+                                     BlockCompletionFunc *cb, void *opaque)
+{
+    BlkAioEmAIOCB *acb;
+
+    if (!blk_aio_em_cache_len) {
+        return blk_aio_get(&blk_aio_em_aiocb_info, blk, cb, opaque);
+    }
+
+    acb = blk_aio_em_cache[--blk_aio_em_cache_len];
+    acb->common = (BlockAIOCB) {
+        .aiocb_info = &blk_aio_em_aiocb_info,
+        .bs         = blk_bs(blk),
+        .cb         = cb,
+        .opaque     = opaque,
+        .refcnt     = 1,
+    };
+    return acb;
+}
+
+static void blk_aio_em_release(BlkAioEmAIOCB *acb)
+{
+    /*
+     * An AIOCB that is still referenced, e.g. by bdrv_aio_cancel(), is
+     * freed by the last qemu_aio_unref()
+     */
+    if (acb->common.refcnt > 1 ||
+        blk_aio_em_cache_len == BLK_AIO_EM_CACHE_SIZE) {
+        qemu_aio_unref(acb);
+        return;
+    }
+
+    if (!blk_aio_em_cache_cleanup_notifier.notify) {
+        blk_aio_em_cache_cleanup_notifier.notify = blk_aio_em_cache_cleanup;
+        qemu_thread_atexit_add(&blk_aio_em_cache_cleanup_notifier);
+    }
+    blk_aio_em_cache[blk_aio_em_cache_len++] = acb;
+}
+
 static void blk_aio_complete(BlkAioEmAIOCB *acb)
 {
     if (acb->has_returned) {
         acb->common.cb(acb->common.opaque, acb->rwco.ret);
         blk_dec_in_flight(acb->rwco.blk);
-        qemu_aio_unref(acb);
+        blk_aio_em_release(acb);
     }
 }
 
@@ -1445,7 +1501,7 @@ static BlockAIOCB *blk_aio_prwv(BlockBackend *blk, int64_t offset, int bytes,
     Coroutine *co;
 
     blk_inc_in_flight(blk);
-    acb = blk_aio_get(&blk_aio_em_aiocb_info, blk, cb, opaque);
+    acb = blk_aio_em_get(blk, cb, opaque);
     acb->rwco = (BlkRwCo) {
         .blk    = blk,
         .offset = offset,
@@ -2455,6 +2511,29 @@ int coroutine_fn blk_co_copy_range(BlockBackend *blk_in, int64_t off_in,
                               bytes, read_flags, write_flags);
 }
 
+int coroutine_fn blk_co_sendfile(BlockBackend *blk, int64_t offset,
+                                 int bytes, int fd, const void *hdr,
+                                 size_t hdr_len)
+{
+    int ret;
+
+    /* The data would bypass the I/O limits */
+    if (blk->public.throttle_group_member.throttle_state) {
+        return -ENOTSUP;
+    }
+
+    blk_inc_in_flight(blk);
+    blk_wait_while_drained(blk);
+
+    ret = blk_check_byte_request(blk, offset, bytes);
+    if (!ret) {
+        ret = bdrv_co_sendfile(blk->root, offset, bytes, fd, hdr, hdr_len);
+    }
+
+    blk_dec_in_flight(blk);
+    return ret;
+}
+
 const BdrvChild *blk_root(BlockBackend *blk)
 {
     return blk->root;
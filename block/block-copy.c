@@ -24,6 +24,8 @@
 
 #define BLOCK_COPY_MAX_COPY_RANGE (16 * MiB)
 #define BLOCK_COPY_MAX_BUFFER (1 * MiB)
+#define BLOCK_COPY_MIN_RW_CHUNK (256 * KiB)
+#define BLOCK_COPY_MAX_RW_CHUNK (16 * MiB)
 #define BLOCK_COPY_MAX_MEM (128 * MiB)
 #define BLOCK_COPY_MAX_WORKERS 64
 #define BLOCK_COPY_SLICE_TIME 100000000ULL /* ns */
@@ -151,6 +153,18 @@ typedef struct BlockCopyState {
      * block_copy_reset_unallocated() every time it does.
      */
     bool skip_unallocated; /* atomic */
+    /*
+     * Chunk size of COPY_READ_WRITE tasks.  It starts at
+     * BLOCK_COPY_MAX_BUFFER and is doubled or halved by
+     * block_copy_tune_chunk() after every BLOCK_COPY_SLICE_TIME of copying,
+     * keeping direction while throughput improves.
+     */
+    int64_t rw_chunk;
+    bool rw_chunk_grow;
+    int64_t tune_start_ns;
+    uint64_t tune_bytes;
+    uint64_t tune_last_rate;
+    bool rate_limited; /* atomic */
     /* State fields that use a thread-safe API */
     BdrvDirtyBitmap *copy_bitmap;
     ProgressMeter *progress;
@@ -201,6 +215,7 @@ static int64_t block_copy_chunk_size(BlockCopyState *s)
     case COPY_READ_WRITE_CLUSTER:
         return s->cluster_size;
     case COPY_READ_WRITE:
+        return MIN(s->rw_chunk, s->max_transfer);
     case COPY_RANGE_SMALL:
         return MIN(MAX(s->cluster_size, BLOCK_COPY_MAX_BUFFER),
                    s->max_transfer);
@@ -213,6 +228,55 @@ static int64_t block_copy_chunk_size(BlockCopyState *s)
     }
 }
 
+/*
+ * Account @bytes copied by a COPY_READ_WRITE task, and adjust the chunk size
+ * once a measuring window is over.  Small chunks waste time on per-request
+ * overhead, large ones reduce the parallelism of the workers and stall on
+ * slow regions; which one wins depends on the storage, so probe for it.
+ * Throughput is meaningless when it is capped by the rate limit, so the size
+ * is left alone then.
+ *
+ * Called with lock held.
+ */
+static void block_copy_tune_chunk(BlockCopyState *s, int64_t bytes)
+{
+    int64_t now = qemu_clock_get_ns(QEMU_CLOCK_REALTIME);
+    int64_t min_chunk = MAX(s->cluster_size, BLOCK_COPY_MIN_RW_CHUNK);
+    int64_t max_chunk = MAX(s->cluster_size, BLOCK_COPY_MAX_RW_CHUNK);
+    uint64_t rate;
+
+    if (qatomic_read(&s->rate_limited)) {
+        s->tune_start_ns = 0;
+        return;
+    }
+    if (!s->tune_start_ns) {
+        s->tune_start_ns = now;
+        s->tune_bytes = 0;
+        return;
+    }
+
+    s->tune_bytes += bytes;
+    if (now - s->tune_start_ns < BLOCK_COPY_SLICE_TIME) {
+        return;
+    }
+
+    rate = muldiv64(s->tune_bytes, NANOSECONDS_PER_SECOND,
+                    now - s->tune_start_ns);
+    if (rate < s->tune_last_rate) {
+        s->rw_chunk_grow = !s->rw_chunk_grow;
+    }
+    if (s->rw_chunk_grow) {
+        s->rw_chunk = MIN(s->rw_chunk * 2, max_chunk);
+    } else {
+        s->rw_chunk = MAX(s->rw_chunk / 2, min_chunk);
+    }
+    trace_block_copy_tune_chunk(s, rate, s->rw_chunk);
+
+    s->tune_last_rate = rate;
+    s->tune_start_ns = now;
+    s->tune_bytes = 0;
+}
+
 /*
  * Search for the first dirty area in offset/bytes range and create task at
  * the beginning of it.
@@ -338,6 +402,8 @@ BlockCopyState *block_copy_state_new(BdrvChild *source, BdrvChild *target,
         .len = bdrv_dirty_bitmap_size(copy_bitmap),
         .write_flags = write_flags,
         .mem = shres_create(BLOCK_COPY_MAX_MEM),
+        .rw_chunk = MAX(cluster_size, BLOCK_COPY_MAX_BUFFER),
+        .rw_chunk_grow = true,
         .max_transfer = QEMU_ALIGN_DOWN(
                                     block_copy_max_transfer(source, target),
                                     cluster_size),
@@ -524,6 +590,9 @@ static coroutine_fn int block_copy_task_entry(AioTask *task)
             }
         } else {
             progress_work_done(s->progress, t->bytes);
+            if (method == COPY_READ_WRITE && t->method == COPY_READ_WRITE) {
+                block_copy_tune_chunk(s, t->bytes);
+            }
         }
     }
     co_put_to_shres(s->mem, t->bytes);
@@ -941,6 +1010,7 @@ void block_copy_set_skip_unallocated(BlockCopyState *s, bool skip)
 void block_copy_set_speed(BlockCopyState *s, uint64_t speed)
 {
     ratelimit_set_speed(&s->rate_limit, speed, BLOCK_COPY_SLICE_TIME);
+    qatomic_set(&s->rate_limited, speed != 0);
 
     /*
      * Note: it's good to kick all call states from here, but it should be done
@@ -25,14 +25,49 @@
 #include "qemu/module.h"
 #include "qapi/error.h"
 #include "qapi/qmp/qdict.h"
+#include "qemu/option.h"
+#include "qemu/units.h"
 #include "block/copy-on-read.h"
 
+/* Largest readahead window the user may ask for */
+#define COR_READAHEAD_MAX (64 * MiB)
+
+/*
+ * Readahead is copied in pieces of this size, so that guest writes to the
+ * area don't have to wait for the whole window to be copied
+ */
+#define COR_READAHEAD_CHUNK (1 * MiB)
 
 typedef struct BDRVStateCOR {
     BlockDriverState *bottom_bs;
     bool chain_frozen;
+
+    /*
+     * Readahead: once the guest reads sequentially, the window grows from
+     * twice the request size up to readahead_max, and the area behind the
+     * guest's last read is copied into the top layer in the background.
+     */
+    uint64_t readahead_max;
+    uint64_t readahead_window;
+    uint64_t next_offset;       /* where a sequential read would start */
+    uint64_t readahead_end;     /* end of the area prefetched so far */
+    bool readahead_busy;
 } BDRVStateCOR;
 
+static QemuOptsList cor_runtime_opts = {
+    .name = "copy-on-read",
+    .head = QTAILQ_HEAD_INITIALIZER(cor_runtime_opts.head),
+    .desc = {
+        {
+            .name = "readahead-size",
+            .type = QEMU_OPT_SIZE,
+            .help = "Largest area to copy ahead of sequential reads "
+                    "(0 disables readahead)",
+        },
+        { /* end of list */ }
+    },
+};
+
 
 static int cor_open(BlockDriverState *bs, QDict *options, int flags,
                     Error **errp)
@@ -41,6 +76,20 @@ static int cor_open(BlockDriverState *bs, QDict *options, int flags,
     BDRVStateCOR *state = bs->opaque;
     /* Find a bottom node name, if any */
     const char *bottom_node = qdict_get_try_str(options, "bottom");
+    QemuOpts *opts;
+
+    opts = qemu_opts_create(&cor_runtime_opts, NULL, 0, &error_abort);
+    if (!qemu_opts_absorb_qdict(opts, options, errp)) {
+        qemu_opts_del(opts);
+        return -EINVAL;
+    }
+    state->readahead_max = qemu_opt_get_size(opts, "readahead-size", 0);
+    qemu_opts_del(opts);
+    if (state->readahead_max > COR_READAHEAD_MAX) {
+        error_setg(errp, "readahead-size must not exceed %d MiB",
+                   (int)(COR_READAHEAD_MAX / MiB));
+        return -EINVAL;
+    }
 
     bs->file = bdrv_open_child(NULL, options, "file", bs, &child_of_bds,
                                BDRV_CHILD_FILTERED | BDRV_CHILD_PRIMARY,
@@ -127,6 +176,100 @@ static int64_t cor_getlength(BlockDriverState *bs)
 }
 
 
+static int coroutine_fn cor_co_preadv_part(BlockDriverState *bs,
+                                           uint64_t offset, uint64_t bytes,
+                                           QEMUIOVector *qiov,
+                                           size_t qiov_offset,
+                                           int flags);
+
+typedef struct CorReadahead {
+    BlockDriverState *bs;
+    uint64_t offset;
+    uint64_t bytes;
+} CorReadahead;
+
+static void coroutine_fn cor_readahead_entry(void *opaque)
+{
+    CorReadahead *ra = opaque;
+    BlockDriverState *bs = ra->bs;
+    BDRVStateCOR *state = bs->opaque;
+    uint64_t offset = ra->offset;
+    uint64_t end = ra->offset + ra->bytes;
+    int ret;
+
+    while (offset < end) {
+        uint64_t bytes = MIN(end - offset, COR_READAHEAD_CHUNK);
+
+        /* Errors don't matter here, the guest's own read will see them */
+        ret = cor_co_preadv_part(bs, offset, bytes, NULL, 0,
+                                 BDRV_REQ_PREFETCH);
+        if (ret < 0) {
+            break;
+        }
+        offset += bytes;
+    }
+
+    state->readahead_busy = false;
+    g_free(ra);
+    bdrv_dec_in_flight(bs);
+}
+
+/*
+ * Called for every guest read of [@offset, @offset + @bytes).  Tracks
+ * whether reads are sequential and, if so, starts copying the area ahead
+ * of them into the top layer, so that the guest's next reads don't have
+ * to wait for a slow backing file.  At most one readahead is in flight.
+ */
+static void cor_readahead(BlockDriverState *bs, uint64_t offset,
+                          uint64_t bytes)
+{
+    BDRVStateCOR *state = bs->opaque;
+    uint64_t align = bs->bl.request_alignment;
+    uint64_t end = offset + bytes;
+    uint64_t ra_start, ra_end;
+    int64_t len;
+    CorReadahead *ra;
+
+    if (offset != state->next_offset) {
+        state->readahead_window = 0;
+        state->readahead_end = 0;
+        state->next_offset = end;
+        return;
+    }
+    state->next_offset = end;
+
+    state->readahead_window = MIN(MAX(state->readahead_window * 2, bytes * 2),
+                                  state->readahead_max);
+
+    if (state->readahead_busy || (bs->open_flags & BDRV_O_INACTIVE)) {
+        return;
+    }
+
+    len = bdrv_getlength(bs);
+    if (len < 0) {
+        return;
+    }
+
+    ra_start = QEMU_ALIGN_DOWN(MAX(end, state->readahead_end), align);
+    ra_end = MIN(QEMU_ALIGN_UP(end + state->readahead_window, align), len);
+    if (ra_start >= ra_end) {
+        return;
+    }
+
+    ra = g_new(CorReadahead, 1);
+    *ra = (CorReadahead) {
+        .bs     = bs,
+        .offset = ra_start,
+        .bytes  = ra_end - ra_start,
+    };
+    state->readahead_end = ra_end;
+    state->readahead_busy = true;
+
+    bdrv_inc_in_flight(bs);
+    aio_co_enter(bdrv_get_aio_context(bs),
+                 qemu_coroutine_create(cor_readahead_entry, ra));
+}
+
 static int coroutine_fn cor_co_preadv_part(BlockDriverState *bs,
                                            uint64_t offset, uint64_t bytes,
                                            QEMUIOVector *qiov,
@@ -138,6 +281,10 @@ static int coroutine_fn cor_co_preadv_part(BlockDriverState *bs,
     int ret;
     BDRVStateCOR *state = bs->opaque;
 
+    if (state->readahead_max && !(flags & BDRV_REQ_PREFETCH)) {
+        cor_readahead(bs, offset, bytes);
+    }
+
     if (!state->bottom_bs) {
         return bdrv_co_preadv_part(bs->file, offset, bytes, qiov, qiov_offset,
                                    flags | BDRV_REQ_COPY_ON_READ);
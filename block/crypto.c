@@ -21,7 +21,9 @@
 #include "qemu/osdep.h"
 
 #include "block/block_int.h"
+#include "block/aio_task.h"
 #include "block/qdict.h"
+#include "block/thread-pool.h"
 #include "sysemu/block-backend.h"
 #include "crypto/block.h"
 #include "qapi/opts-visitor.h"
@@ -35,9 +37,28 @@
 
 typedef struct BlockCrypto BlockCrypto;
 
+/*
+ * Number of ciphers to set up, i.e. of threads that may encrypt or decrypt
+ * for a node at the same time: as many as there are CPUs, within limits.
+ */
+#define BLOCK_CRYPTO_MIN_THREADS 4
+#define BLOCK_CRYPTO_MAX_THREADS 16
+
+/*
+ * Buffers of at least this size are encrypted and decrypted in the thread
+ * pool, in parts of this size that are processed in parallel.  Smaller ones
+ * are not worth the round trip to another thread.
+ */
+#define BLOCK_CRYPTO_OFFLOAD_SIZE (64 * 1024)
+
 struct BlockCrypto {
     QCryptoBlock *block;
     bool updating_keys;
+
+    /* Ciphers in @block, and how many of them are in use */
+    int max_threads;
+    int nb_threads;
+    CoQueue thread_task_queue;
 };
 
 
@@ -290,11 +311,15 @@ static int block_crypto_open_generic(QCryptoBlockFormat format,
     if (flags & BDRV_O_NO_IO) {
         cflags |= QCRYPTO_BLOCK_OPEN_NO_IO;
     }
+    crypto->max_threads = MIN(MAX(g_get_num_processors(),
+                                  BLOCK_CRYPTO_MIN_THREADS),
+                              BLOCK_CRYPTO_MAX_THREADS);
+    qemu_co_queue_init(&crypto->thread_task_queue);
     crypto->block = qcrypto_block_open(open_opts, NULL,
                                        block_crypto_read_func,
                                        bs,
                                        cflags,
-                                       1,
+                                       crypto->max_threads,
                                        errp);
 
     if (!crypto->block) {
@@ -396,6 +421,104 @@ static int block_crypto_reopen_prepare(BDRVReopenState *state,
  */
 #define BLOCK_CRYPTO_MAX_IO_SIZE (1024 * 1024)
 
+typedef int (*BlockCryptoEncDecFunc)(QCryptoBlock *block, uint64_t offset,
+                                     uint8_t *buf, size_t len, Error **errp);
+
+typedef struct BlockCryptoEncDecTask {
+    AioTask task;
+
+    BlockDriverState *bs;
+    uint64_t offset;
+    uint8_t *buf;
+    size_t len;
+    BlockCryptoEncDecFunc func;
+} BlockCryptoEncDecTask;
+
+/* Wait until one of the block's ciphers is free and claim it */
+static void coroutine_fn block_crypto_co_get_thread(BlockCrypto *crypto)
+{
+    while (crypto->nb_threads >= crypto->max_threads) {
+        qemu_co_queue_wait(&crypto->thread_task_queue, NULL);
+    }
+    crypto->nb_threads++;
+}
+
+static void coroutine_fn block_crypto_co_put_thread(BlockCrypto *crypto)
+{
+    crypto->nb_threads--;
+    qemu_co_queue_next(&crypto->thread_task_queue);
+}
+
+static int block_crypto_encdec_pool_func(void *opaque)
+{
+    BlockCryptoEncDecTask *t = opaque;
+    BlockCrypto *crypto = t->bs->opaque;
+
+    return t->func(crypto->block, t->offset, t->buf, t->len, NULL) < 0 ?
+           -EIO : 0;
+}
+
+static int coroutine_fn block_crypto_encdec_task_entry(AioTask *task)
+{
+    BlockCryptoEncDecTask *t = container_of(task, BlockCryptoEncDecTask, task);
+    BlockCrypto *crypto = t->bs->opaque;
+    ThreadPool *pool = aio_get_thread_pool(bdrv_get_aio_context(t->bs));
+    int ret;
+
+    block_crypto_co_get_thread(crypto);
+    ret = thread_pool_submit_co(pool, block_crypto_encdec_pool_func, t);
+    block_crypto_co_put_thread(crypto);
+
+    return ret;
+}
+
+/*
+ * Encrypt or decrypt @len bytes of @buf in place, with @func.  Large
+ * buffers are split up and processed by several threads in the thread
+ * pool, while the calling coroutine waits.
+ */
+static int coroutine_fn
+block_crypto_co_encdec(BlockDriverState *bs, uint64_t offset, uint8_t *buf,
+                       size_t len, BlockCryptoEncDecFunc func)
+{
+    BlockCrypto *crypto = bs->opaque;
+    AioTaskPool *aio;
+    size_t done, cur;
+    int ret;
+
+    if (len < BLOCK_CRYPTO_OFFLOAD_SIZE) {
+        block_crypto_co_get_thread(crypto);
+        ret = func(crypto->block, offset, buf, len, NULL);
+        block_crypto_co_put_thread(crypto);
+        return ret < 0 ? -EIO : 0;
+    }
+
+    assert(QEMU_IS_ALIGNED(BLOCK_CRYPTO_OFFLOAD_SIZE,
+                           qcrypto_block_get_sector_size(crypto->block)));
+
+    aio = aio_task_pool_new(crypto->max_threads);
+    for (done = 0; done < len && aio_task_pool_status(aio) == 0; done += cur) {
+        BlockCryptoEncDecTask *t = g_new(BlockCryptoEncDecTask, 1);
+
+        cur = MIN(len - done, BLOCK_CRYPTO_OFFLOAD_SIZE);
+        *t = (BlockCryptoEncDecTask) {
+            .task.func  = block_crypto_encdec_task_entry,
+            .bs         = bs,
+            .offset     = offset + done,
+            .buf        = buf + done,
+            .len        = cur,
+            .func       = func,
+        };
+        aio_task_pool_start_task(aio, &t->task);
+    }
+
+    aio_task_pool_wait_all(aio);
+    ret = aio_task_pool_status(aio);
+    aio_task_pool_free(aio);
+
+    return ret;
+}
+
 static coroutine_fn int
 block_crypto_co_preadv(BlockDriverState *bs, uint64_t offset, uint64_t bytes,
                        QEMUIOVector *qiov, int flags)
@@ -439,9 +562,9 @@ block_crypto_co_preadv(BlockDriverState *bs, uint64_t offset, uint64_t bytes,
             goto cleanup;
         }
 
-        if (qcrypto_block_decrypt(crypto->block, offset + bytes_done,
-                                  cipher_data, cur_bytes, NULL) < 0) {
-            ret = -EIO;
+        ret = block_crypto_co_encdec(bs, offset + bytes_done, cipher_data,
+                                     cur_bytes, qcrypto_block_decrypt);
+        if (ret < 0) {
             goto cleanup;
         }
 
@@ -495,9 +618,9 @@ block_crypto_co_pwritev(BlockDriverState *bs, uint64_t offset, uint64_t bytes,
 
         qemu_iovec_to_buf(qiov, bytes_done, cipher_data, cur_bytes);
 
-        if (qcrypto_block_encrypt(crypto->block, offset + bytes_done,
-                                  cipher_data, cur_bytes, NULL) < 0) {
-            ret = -EIO;
+        ret = block_crypto_co_encdec(bs, offset + bytes_done, cipher_data,
+                                     cur_bytes, qcrypto_block_encrypt);
+        if (ret < 0) {
             goto cleanup;
         }
 
@@ -35,17 +35,32 @@
 /* Prevent overly long bounce buffer allocations */
 #define FUSE_MAX_BOUNCE_BYTES (MIN(BDRV_REQUEST_MAX_BYTES, 64 * 1024 * 1024))
 
+/* Request buffers kept around for reuse instead of being freed */
+#define FUSE_MAX_SPARE_BUFS 16
+
+/*
+ * How long the kernel may cache the attributes of read-only exports.
+ * Their size can still change through block_resize, so do not make
+ * this unlimited.
+ */
+#define FUSE_RO_ATTR_TIMEOUT 60.
+
 
 typedef struct FuseExport {
     BlockExport common;
 
     struct fuse_session *fuse_session;
-    struct fuse_buf fuse_buf;
     bool mounted, fd_handler_set_up;
 
+    /* Request buffers not currently in use */
+    void *spare_bufs[FUSE_MAX_SPARE_BUFS];
+    int nb_spare_bufs;
+
     char *mountpoint;
     bool writable;
     bool growable;
+    /* Serializes resizes, since requests are handled concurrently */
+    CoMutex resize_lock;
     /* Whether allow_other was used as a mount option or not */
     bool allow_other;
 
@@ -54,6 +69,11 @@ typedef struct FuseExport {
     gid_t st_gid;
 } FuseExport;
 
+typedef struct FuseRequest {
+    FuseExport *exp;
+    struct fuse_buf buf;
+} FuseRequest;
+
 static GHashTable *exports;
 static const struct fuse_lowlevel_ops fuse_ops;
 
@@ -123,6 +143,7 @@ static int fuse_export_create(BlockExport *blk_exp,
     exp->mountpoint = g_strdup(args->mountpoint);
     exp->writable = blk_exp_args->writable;
     exp->growable = args->growable;
+    qemu_co_mutex_init(&exp->resize_lock);
 
     /* set default */
     if (!args->has_allow_other) {
@@ -226,6 +247,32 @@ fail:
     return ret;
 }
 
+static void fuse_put_request_buf(FuseExport *exp, void *mem)
+{
+    if (exp->nb_spare_bufs < FUSE_MAX_SPARE_BUFS) {
+        exp->spare_bufs[exp->nb_spare_bufs++] = mem;
+    } else {
+        free(mem);
+    }
+}
+
+/**
+ * Handle a single request.  The handlers issue their block layer
+ * requests from this coroutine, so several requests can be in flight
+ * at the same time.
+ */
+static void coroutine_fn fuse_co_process_request(void *opaque)
+{
+    FuseRequest *req = opaque;
+    FuseExport *exp = req->exp;
+
+    fuse_session_process_buf(exp->fuse_session, &req->buf);
+
+    fuse_put_request_buf(exp, req->buf.mem);
+    g_free(req);
+    blk_exp_unref(&exp->common);
+}
+
 /**
  * Callback to be invoked when the FUSE session FD can be read from.
  * (This is basically the FUSE event loop.)
@@ -233,21 +280,34 @@ fail:
 static void read_from_fuse_export(void *opaque)
 {
     FuseExport *exp = opaque;
+    FuseRequest *req;
+    Coroutine *co;
     int ret;
 
     blk_exp_ref(&exp->common);
 
+    req = g_new0(FuseRequest, 1);
+    req->exp = exp;
+    if (exp->nb_spare_bufs) {
+        /* libfuse always reads up to the session's buffer size */
+        req->buf.mem = exp->spare_bufs[--exp->nb_spare_bufs];
+    }
+
     do {
-        ret = fuse_session_receive_buf(exp->fuse_session, &exp->fuse_buf);
+        ret = fuse_session_receive_buf(exp->fuse_session, &req->buf);
     } while (ret == -EINTR);
-    if (ret < 0) {
-        goto out;
+    if (ret <= 0) {
+        if (req->buf.mem) {
+            fuse_put_request_buf(exp, req->buf.mem);
+        }
+        g_free(req);
+        blk_exp_unref(&exp->common);
+        return;
     }
 
-    fuse_session_process_buf(exp->fuse_session, &exp->fuse_buf);
-
-out:
-    blk_exp_unref(&exp->common);
+    /* The reference is dropped when the coroutine is done */
+    co = qemu_coroutine_create(fuse_co_process_request, req);
+    qemu_coroutine_enter(co);
 }
 
 static void fuse_export_shutdown(BlockExport *blk_exp)
@@ -286,7 +346,9 @@ static void fuse_export_delete(BlockExport *blk_exp)
         fuse_session_destroy(exp->fuse_session);
     }
 
-    free(exp->fuse_buf.mem);
+    while (exp->nb_spare_bufs) {
+        free(exp->spare_bufs[--exp->nb_spare_bufs]);
+    }
     g_free(exp->mountpoint);
 }
 
@@ -377,20 +439,39 @@ static void fuse_getattr(fuse_req_t req, fuse_ino_t inode,
         .st_ctime   = now,
     };
 
-    fuse_reply_attr(req, &statbuf, 1.);
+    fuse_reply_attr(req, &statbuf,
+                    exp->writable ? 1. : FUSE_RO_ATTR_TIMEOUT);
 }
 
-static int fuse_do_truncate(const FuseExport *exp, int64_t size,
+/*
+ * Resize the image to @size.  With @grow_only, an image that is already
+ * at least @size long is left alone: concurrent requests beyond EOF must
+ * not shrink it back under each other.
+ */
+static int fuse_do_truncate(FuseExport *exp, int64_t size, bool grow_only,
                             bool req_zero_write, PreallocMode prealloc)
 {
     uint64_t blk_perm, blk_shared_perm;
     BdrvRequestFlags truncate_flags = 0;
+    int64_t length;
     int ret;
 
     if (req_zero_write) {
         truncate_flags |= BDRV_REQ_ZERO_WRITE;
     }
 
+    QEMU_LOCK_GUARD(&exp->resize_lock);
+
+    if (grow_only) {
+        length = blk_getlength(exp->common.blk);
+        if (length < 0) {
+            return length;
+        }
+        if (length >= size) {
+            return 0;
+        }
+    }
+
     /* Growable exports have a permanent RESIZE permission */
     if (!exp->growable) {
         blk_get_perm(exp->common.blk, &blk_perm, &blk_shared_perm);
@@ -466,7 +547,8 @@ static void fuse_setattr(fuse_req_t req, fuse_ino_t inode, struct stat *statbuf,
             return;
         }
 
-        ret = fuse_do_truncate(exp, statbuf->st_size, true, PREALLOC_MODE_OFF);
+        ret = fuse_do_truncate(exp, statbuf->st_size, false, true,
+                               PREALLOC_MODE_OFF);
         if (ret < 0) {
             fuse_reply_err(req, -ret);
             return;
@@ -495,6 +577,16 @@ static void fuse_setattr(fuse_req_t req, fuse_ino_t inode, struct stat *statbuf,
 static void fuse_open(fuse_req_t req, fuse_ino_t inode,
                       struct fuse_file_info *fi)
 {
+    FuseExport *exp = fuse_req_userdata(req);
+
+    /*
+     * Nothing can change a read-only export's data through the mount, so
+     * let the kernel keep its page cache across opens instead of dropping
+     * it every time the image is opened again.
+     */
+    if (!exp->writable) {
+        fi->keep_cache = 1;
+    }
     fuse_reply_open(req, fi);
 }
 
@@ -578,7 +670,8 @@ static void fuse_write(fuse_req_t req, fuse_ino_t inode, const char *buf,
 
     if (offset + size > length) {
         if (exp->growable) {
-            ret = fuse_do_truncate(exp, offset + size, true, PREALLOC_MODE_OFF);
+            ret = fuse_do_truncate(exp, offset + size, true, true,
+                                   PREALLOC_MODE_OFF);
             if (ret < 0) {
                 fuse_reply_err(req, -ret);
                 return;
@@ -638,7 +731,7 @@ static void fuse_fallocate(fuse_req_t req, fuse_ino_t inode, int mode,
     } else if (mode & FALLOC_FL_ZERO_RANGE) {
         if (!(mode & FALLOC_FL_KEEP_SIZE) && offset + length > blk_len) {
             /* No need for zeroes, we are going to write them ourselves */
-            ret = fuse_do_truncate(exp, offset + length, false,
+            ret = fuse_do_truncate(exp, offset + length, true, false,
                                    PREALLOC_MODE_OFF);
             if (ret < 0) {
                 fuse_reply_err(req, -ret);
@@ -663,14 +756,15 @@ static void fuse_fallocate(fuse_req_t req, fuse_ino_t inode, int mode,
 
         if (offset > blk_len) {
             /* No preallocation needed here */
-            ret = fuse_do_truncate(exp, offset, true, PREALLOC_MODE_OFF);
+            ret = fuse_do_truncate(exp, offset, true, true,
+                                   PREALLOC_MODE_OFF);
             if (ret < 0) {
                 fuse_reply_err(req, -ret);
                 return;
             }
         }
 
-        ret = fuse_do_truncate(exp, offset + length, true,
+        ret = fuse_do_truncate(exp, offset + length, true, true,
                                PREALLOC_MODE_FALLOC);
     } else {
         ret = -EOPNOTSUPP;
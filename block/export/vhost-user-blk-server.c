@@ -44,8 +44,14 @@ typedef struct VuBlkReq {
     struct virtio_blk_outhdr out;
     VuServer *server;
     struct VuVirtq *vq;
+    int vq_idx;
 } VuBlkReq;
 
+typedef struct {
+    /* Used ring elements filled in but not yet made visible to the driver */
+    unsigned int pending;
+} VuBlkQueue;
+
 /* vhost user block device */
 typedef struct {
     BlockExport export;
@@ -54,17 +60,63 @@ typedef struct {
     QIOChannelSocket *sioc;
     struct virtio_blk_config blkcfg;
     bool writable;
+    uint16_t num_queues;
+    VuBlkQueue *queues;
+    bool flush_scheduled;
 } VuBlkExport;
 
+static void vu_blk_flush_queue(VuBlkExport *vexp, int idx)
+{
+    VuDev *vu_dev = &vexp->vu_server.vu_dev;
+    VuBlkQueue *q = &vexp->queues[idx];
+    VuVirtq *vq;
+
+    if (!q->pending) {
+        return;
+    }
+
+    /* The client may have gone away since the requests completed */
+    if (vu_dev->vq) {
+        vq = vu_get_queue(vu_dev, idx);
+        vu_queue_flush(vu_dev, vq, q->pending);
+        vu_queue_notify(vu_dev, vq);
+    }
+    q->pending = 0;
+}
+
+static void vu_blk_flush_bh(void *opaque)
+{
+    VuBlkExport *vexp = opaque;
+    int i;
+
+    vexp->flush_scheduled = false;
+    for (i = 0; i < vexp->num_queues; i++) {
+        vu_blk_flush_queue(vexp, i);
+    }
+    blk_dec_in_flight(vexp->export.blk);
+}
+
+/*
+ * Requests that complete in the same event loop iteration are published
+ * with a single used index update and a single notification per queue.
+ * This relies on VHOST_USER_PROTOCOL_F_INFLIGHT_SHMFD not being offered,
+ * since vu_queue_fill() does not update the inflight region.
+ */
 static void vu_blk_req_complete(VuBlkReq *req)
 {
     VuDev *vu_dev = &req->server->vu_dev;
+    VuBlkExport *vexp = container_of(req->server, VuBlkExport, vu_server);
+    VuBlkQueue *q = &vexp->queues[req->vq_idx];
 
     /* IO size with 1 extra status byte */
-    vu_queue_push(vu_dev, req->vq, &req->elem, req->size + 1);
-    vu_queue_notify(vu_dev, req->vq);
-
+    vu_queue_fill(vu_dev, req->vq, &req->elem, req->size + 1, q->pending++);
     free(req);
+
+    if (!vexp->flush_scheduled) {
+        vexp->flush_scheduled = true;
+        blk_inc_in_flight(vexp->export.blk);
+        aio_bh_schedule_oneshot(vexp->export.ctx, vu_blk_flush_bh, vexp);
+    }
 }
 
 static bool vu_blk_sect_range_ok(VuBlkExport *vexp, uint64_t sector,
@@ -295,8 +347,10 @@ err:
 static void vu_blk_process_vq(VuDev *vu_dev, int idx)
 {
     VuServer *server = container_of(vu_dev, VuServer, vu_dev);
+    VuBlkExport *vexp = container_of(server, VuBlkExport, vu_server);
     VuVirtq *vq = vu_get_queue(vu_dev, idx);
 
+    blk_io_plug(vexp->export.blk);
     while (1) {
         VuBlkReq *req;
 
@@ -307,19 +361,26 @@ static void vu_blk_process_vq(VuDev *vu_dev, int idx)
 
         req->server = server;
         req->vq = vq;
+        req->vq_idx = idx;
 
         Coroutine *co =
             qemu_coroutine_create(vu_blk_virtio_process_req, req);
         qemu_coroutine_enter(co);
     }
+    blk_io_unplug(vexp->export.blk);
 }
 
 static void vu_blk_queue_set_started(VuDev *vu_dev, int idx, bool started)
 {
+    VuServer *server = container_of(vu_dev, VuServer, vu_dev);
+    VuBlkExport *vexp = container_of(server, VuBlkExport, vu_server);
     VuVirtq *vq;
 
     assert(vu_dev);
 
+    /* Don't lose completions when the ring is stopped or reset */
+    vu_blk_flush_queue(vexp, idx);
+
     vq = vu_get_queue(vu_dev, idx);
     vu_set_queue_handler(vu_dev, vq, started ? vu_blk_process_vq : NULL);
 }
@@ -502,6 +563,8 @@ static int vu_blk_exp_create(BlockExport *exp, BlockExportOptions *opts,
 
     vu_blk_initialize_config(blk_bs(exp->blk), &vexp->blkcfg,
                              logical_block_size, num_queues);
+    vexp->num_queues = num_queues;
+    vexp->queues = g_new0(VuBlkQueue, num_queues);
 
     blk_add_aio_context_notifier(exp->blk, blk_aio_attached, blk_aio_detach,
                                  vexp);
@@ -510,6 +573,7 @@ static int vu_blk_exp_create(BlockExport *exp, BlockExportOptions *opts,
                                  num_queues, &vu_blk_iface, errp)) {
         blk_remove_aio_context_notifier(exp->blk, blk_aio_attached,
                                         blk_aio_detach, vexp);
+        g_free(vexp->queues);
         return -EADDRNOTAVAIL;
     }
 
@@ -522,6 +586,7 @@ static void vu_blk_exp_delete(BlockExport *exp)
 
     blk_remove_aio_context_notifier(exp->blk, blk_aio_attached, blk_aio_detach,
                                     vexp);
+    g_free(vexp->queues);
 }
 
 const BlockExportDriver blk_exp_vhost_user_blk = {
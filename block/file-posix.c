@@ -63,8 +63,10 @@
 #include <sys/dkio.h>
 #endif
 #ifdef __linux__
+#include <poll.h>
 #include <sys/ioctl.h>
 #include <sys/param.h>
+#include <sys/sendfile.h>
 #include <sys/syscall.h>
 #include <sys/vfs.h>
 #include <linux/cdrom.h>
@@ -134,6 +136,26 @@
 #define RAW_LOCK_PERM_BASE             100
 #define RAW_LOCK_SHARED_BASE           200
 
+/*
+ * Misaligned requests up to RAW_BOUNCE_BUF_SIZE bytes use bounce buffers
+ * from a per-node pool of up to RAW_BOUNCE_POOL_SIZE buffers.
+ */
+#define RAW_BOUNCE_BUF_SIZE     (1 * MiB)
+#define RAW_BOUNCE_POOL_SIZE    8
+
+/* Number of extents remembered from SEEK_DATA/SEEK_HOLE queries */
+#define RAW_BSC_SIZE            16
+
+/*
+ * A range of the file known to be data or a (non-trailing) hole, as found
+ * by find_allocation().  Unused entries have start == end.
+ */
+typedef struct RawBlockStatusExtent {
+    int64_t start;
+    int64_t end;
+    bool data;
+} RawBlockStatusExtent;
+
 typedef struct BDRVRawState {
     int fd;
     bool use_lock;
@@ -173,6 +195,20 @@ typedef struct BDRVRawState {
         uint64_t discard_bytes_ok;
     } stats;
 
+    /* Bounce buffers for misaligned requests, see raw_bounce_buf_get() */
+    QemuMutex bounce_lock;
+    void *bounce_bufs[RAW_BOUNCE_POOL_SIZE];
+    int nb_bounce_bufs;
+    uint64_t bounce_nb_reused;
+    uint64_t bounce_nb_allocated;
+
+    /*
+     * Block status cache, see raw_bsc_find_allocation().  Only accessed
+     * from the node's AioContext.
+     */
+    RawBlockStatusExtent bsc[RAW_BSC_SIZE];
+    int bsc_next;
+
     PRManager *pr_mgr;
 } BDRVRawState;
 
@@ -216,6 +252,11 @@ typedef struct RawPosixAIOData {
             int aio_fd2;
             off_t aio_offset2;
         } copy_range;
+        struct {
+            int out_fd;
+            const void *hdr;
+            size_t hdr_len;
+        } sendfile;
         struct {
             PreallocMode prealloc;
             Error **errp;
@@ -572,6 +613,8 @@ static int raw_open_common(BlockDriverState *bs, QDict *options,
     struct stat st;
     OnOffAuto locking;
 
+    qemu_mutex_init(&s->bounce_lock);
+
     opts = qemu_opts_create(&raw_runtime_opts, NULL, 0, &error_abort);
     if (!qemu_opts_absorb_qdict(opts, options, errp)) {
         ret = -EINVAL;
@@ -1128,11 +1171,15 @@ out:
     return ret;
 }
 
+static void raw_bsc_invalidate(BDRVRawState *s, int64_t offset,
+                               int64_t bytes);
+
 static void raw_reopen_commit(BDRVReopenState *state)
 {
     BDRVRawReopenState *rs = state->opaque;
     BDRVRawState *s = state->bs->opaque;
 
+    raw_bsc_invalidate(s, 0, INT64_MAX);
     s->drop_cache = rs->drop_cache;
     s->check_cache_dropped = rs->check_cache_dropped;
     s->open_flags = rs->open_flags;
@@ -1506,6 +1553,56 @@ static ssize_t handle_aiocb_rw_linear(RawPosixAIOData *aiocb, char *buf)
     return offset;
 }
 
+/*
+ * Returns an aligned buffer of at least @bytes bytes for a misaligned
+ * request, reusing one from the pool when possible.  Runs in the thread
+ * pool workers, so the pool is protected by bounce_lock.
+ */
+static void *raw_bounce_buf_get(BlockDriverState *bs, size_t bytes)
+{
+    BDRVRawState *s = bs->opaque;
+    void *buf = NULL;
+
+    if (bytes > RAW_BOUNCE_BUF_SIZE ||
+        bdrv_opt_mem_align(bs) > qemu_real_host_page_size) {
+        return qemu_try_blockalign(bs, bytes);
+    }
+
+    qemu_mutex_lock(&s->bounce_lock);
+    if (s->nb_bounce_bufs) {
+        buf = s->bounce_bufs[--s->nb_bounce_bufs];
+        s->bounce_nb_reused++;
+    } else {
+        s->bounce_nb_allocated++;
+    }
+    qemu_mutex_unlock(&s->bounce_lock);
+
+    if (!buf) {
+        buf = qemu_try_memalign(qemu_real_host_page_size, RAW_BOUNCE_BUF_SIZE);
+    }
+    return buf;
+}
+
+static void raw_bounce_buf_put(BlockDriverState *bs, void *buf, size_t bytes)
+{
+    BDRVRawState *s = bs->opaque;
+
+    if (bytes > RAW_BOUNCE_BUF_SIZE ||
+        bdrv_opt_mem_align(bs) > qemu_real_host_page_size) {
+        qemu_vfree(buf);
+        return;
+    }
+
+    qemu_mutex_lock(&s->bounce_lock);
+    if (s->nb_bounce_bufs < RAW_BOUNCE_POOL_SIZE) {
+        s->bounce_bufs[s->nb_bounce_bufs++] = buf;
+        buf = NULL;
+    }
+    qemu_mutex_unlock(&s->bounce_lock);
+
+    qemu_vfree(buf);
+}
+
 static int handle_aiocb_rw(void *opaque)
 {
     RawPosixAIOData *aiocb = opaque;
@@ -1547,7 +1644,7 @@ static int handle_aiocb_rw(void *opaque)
      * Ok, we have to do it the hard way, copy all segments into
      * a single aligned buffer.
      */
-    buf = qemu_try_blockalign(aiocb->bs, aiocb->aio_nbytes);
+    buf = raw_bounce_buf_get(aiocb->bs, aiocb->aio_nbytes);
     if (buf == NULL) {
         nbytes = -ENOMEM;
         goto out;
@@ -1582,7 +1679,7 @@ static int handle_aiocb_rw(void *opaque)
         }
         assert(count == 0);
     }
-    qemu_vfree(buf);
+    raw_bounce_buf_put(aiocb->bs, buf, aiocb->aio_nbytes);
 
 out:
     if (nbytes == aiocb->aio_nbytes) {
@@ -1770,6 +1867,84 @@ static off_t copy_file_range(int in_fd, off_t *in_off, int out_fd,
 }
 #endif
 
+#ifdef __linux__
+/* Wait until the socket @fd can take more data */
+static int sendfile_wait_writable(int fd)
+{
+    struct pollfd pfd = { .fd = fd, .events = POLLOUT };
+    int ret;
+
+    do {
+        ret = poll(&pfd, 1, -1);
+    } while (ret < 0 && errno == EINTR);
+
+    return ret < 0 ? -errno : 0;
+}
+
+static int handle_aiocb_sendfile(void *opaque)
+{
+    RawPosixAIOData *aiocb = opaque;
+    int out_fd = aiocb->sendfile.out_fd;
+    const char *hdr = aiocb->sendfile.hdr;
+    size_t hdr_len = aiocb->sendfile.hdr_len;
+    uint64_t bytes = aiocb->aio_nbytes;
+    off_t offset = aiocb->aio_offset;
+    struct stat st;
+    ssize_t ret;
+
+    /*
+     * Once the header is out, the data must follow, so make sure that the
+     * whole range can be read before writing anything.
+     */
+    if (fstat(aiocb->aio_fildes, &st) < 0 || !S_ISREG(st.st_mode) ||
+        offset + bytes > st.st_size) {
+        return -ENOTSUP;
+    }
+
+    while (hdr_len) {
+        ret = send(out_fd, hdr, hdr_len, MSG_MORE | MSG_NOSIGNAL);
+        if (ret < 0) {
+            if (errno == EINTR) {
+                continue;
+            } else if (errno == EAGAIN) {
+                ret = sendfile_wait_writable(out_fd);
+                if (ret < 0) {
+                    return ret;
+                }
+                continue;
+            }
+            return -errno;
+        }
+        hdr += ret;
+        hdr_len -= ret;
+    }
+
+    while (bytes) {
+        ret = sendfile(out_fd, aiocb->aio_fildes, &offset, bytes);
+        trace_file_sendfile(aiocb->bs, aiocb->aio_fildes, offset, out_fd,
+                            bytes, ret);
+        if (ret < 0) {
+            if (errno == EINTR) {
+                continue;
+            } else if (errno == EAGAIN) {
+                ret = sendfile_wait_writable(out_fd);
+                if (ret < 0) {
+                    return ret;
+                }
+                continue;
+            }
+            return -errno;
+        }
+        if (ret == 0) {
+            /* The file was truncated under our feet */
+            return -EIO;
+        }
+        bytes -= ret;
+    }
+    return 0;
+}
+#endif
+
 static int handle_aiocb_copy_range(void *opaque)
 {
     RawPosixAIOData *aiocb = opaque;
@@ -2088,8 +2263,12 @@ static int coroutine_fn raw_co_pwritev(BlockDriverState *bs, uint64_t offset,
                                        uint64_t bytes, QEMUIOVector *qiov,
                                        int flags)
 {
+    int ret;
+
     assert(flags == 0);
-    return raw_co_prw(bs, offset, bytes, qiov, QEMU_AIO_WRITE);
+    ret = raw_co_prw(bs, offset, bytes, qiov, QEMU_AIO_WRITE);
+    raw_bsc_invalidate(bs->opaque, offset, bytes);
+    return ret;
 }
 
 static void raw_aio_plug(BlockDriverState *bs)
@@ -2126,6 +2305,28 @@ static void raw_aio_unplug(BlockDriverState *bs)
 #endif
 }
 
+static void raw_register_buf(BlockDriverState *bs, void *host, size_t size)
+{
+    BDRVRawState __attribute__((unused)) *s = bs->opaque;
+#ifdef CONFIG_LINUX_IO_URING
+    if (s->use_linux_io_uring) {
+        LuringState *aio = aio_get_linux_io_uring(bdrv_get_aio_context(bs));
+        luring_register_buf(aio, host, size);
+    }
+#endif
+}
+
+static void raw_unregister_buf(BlockDriverState *bs, void *host)
+{
+    BDRVRawState __attribute__((unused)) *s = bs->opaque;
+#ifdef CONFIG_LINUX_IO_URING
+    if (s->use_linux_io_uring) {
+        LuringState *aio = aio_get_linux_io_uring(bdrv_get_aio_context(bs));
+        luring_unregister_buf(aio, host);
+    }
+#endif
+}
+
 static int raw_co_flush_to_disk(BlockDriverState *bs)
 {
     BDRVRawState *s = bs->opaque;
@@ -2186,6 +2387,11 @@ static void raw_close(BlockDriverState *bs)
         qemu_close(s->fd);
         s->fd = -1;
     }
+
+    while (s->nb_bounce_bufs) {
+        qemu_vfree(s->bounce_bufs[--s->nb_bounce_bufs]);
+    }
+    qemu_mutex_destroy(&s->bounce_lock);
 }
 
 /**
@@ -2230,7 +2436,9 @@ static int coroutine_fn raw_co_truncate(BlockDriverState *bs, int64_t offset,
 
     if (S_ISREG(st.st_mode)) {
         /* Always resizes to the exact @offset */
-        return raw_regular_truncate(bs, s->fd, offset, prealloc, errp);
+        ret = raw_regular_truncate(bs, s->fd, offset, prealloc, errp);
+        raw_bsc_invalidate(s, 0, INT64_MAX);
+        return ret;
     }
 
     if (prealloc != PREALLOC_MODE_OFF) {
@@ -2640,6 +2848,21 @@ static int coroutine_fn raw_co_delete_file(BlockDriverState *bs,
     return ret;
 }
 
+static void raw_bsc_invalidate(BDRVRawState *s, int64_t offset,
+                               int64_t bytes)
+{
+    int64_t end = bytes > INT64_MAX - offset ? INT64_MAX : offset + bytes;
+    int i;
+
+    for (i = 0; i < RAW_BSC_SIZE; i++) {
+        RawBlockStatusExtent *e = &s->bsc[i];
+
+        if (e->start < end && offset < e->end) {
+            e->start = e->end = 0;
+        }
+    }
+}
+
 /*
  * Find allocation range in @bs around offset @start.
  * May change underlying file descriptor's file offset.
@@ -2735,6 +2958,61 @@ static int find_allocation(BlockDriverState *bs, off_t start,
 #endif
 }
 
+/*
+ * Like find_allocation(), but answer from the extents found by earlier
+ * calls if possible.  On fragmented sparse files lseek(SEEK_DATA/SEEK_HOLE)
+ * is expensive, and mirror, qemu-img map and NBD clients tend to query
+ * the same ranges over and over.
+ *
+ * Writes, discards and truncation through this node drop the extents they
+ * touch once they have completed.  A data extent that turns into a hole
+ * behind our back is harmless (it still reads correctly), but a hole that
+ * gets written to is not, so holes are only remembered while nobody else
+ * may write to the file.
+ */
+static int raw_bsc_find_allocation(BlockDriverState *bs, off_t start,
+                                   off_t *data, off_t *hole)
+{
+    BDRVRawState *s = bs->opaque;
+    RawBlockStatusExtent *e;
+    int i, ret;
+
+    for (i = 0; i < RAW_BSC_SIZE; i++) {
+        e = &s->bsc[i];
+        if (e->start <= start && start < e->end) {
+            if (e->data) {
+                *data = start;
+                *hole = e->end;
+            } else {
+                *hole = start;
+                *data = e->end;
+            }
+            return 0;
+        }
+    }
+
+    ret = find_allocation(bs, start, data, hole);
+    if (ret < 0) {
+        return ret;
+    }
+
+    if (*data == start) {
+        e = &s->bsc[s->bsc_next];
+        *e = (RawBlockStatusExtent) {
+            .start = start, .end = *hole, .data = true,
+        };
+    } else if (!(s->shared_perm & BLK_PERM_WRITE)) {
+        e = &s->bsc[s->bsc_next];
+        *e = (RawBlockStatusExtent) {
+            .start = start, .end = *data, .data = false,
+        };
+    } else {
+        return 0;
+    }
+    s->bsc_next = (s->bsc_next + 1) % RAW_BSC_SIZE;
+    return 0;
+}
+
 /*
  * Returns the allocation status of the specified offset.
  *
@@ -2770,7 +3048,7 @@ static int coroutine_fn raw_co_block_status(BlockDriverState *bs,
         return BDRV_BLOCK_DATA | BDRV_BLOCK_OFFSET_VALID;
     }
 
-    ret = find_allocation(bs, offset, &data, &hole);
+    ret = raw_bsc_find_allocation(bs, offset, &data, &hole);
     if (ret == -ENXIO) {
         /* Trailing hole */
         *pnum = bytes;
@@ -2960,6 +3238,7 @@ raw_do_pdiscard(BlockDriverState *bs, int64_t offset, int bytes, bool blkdev)
     }
 
     ret = raw_thread_pool_submit(bs, handle_aiocb_discard, &acb);
+    raw_bsc_invalidate(s, offset, bytes);
     raw_account_discard(s, bytes, ret);
     return ret;
 }
@@ -2977,6 +3256,7 @@ raw_do_pwrite_zeroes(BlockDriverState *bs, int64_t offset, int bytes,
     BDRVRawState *s = bs->opaque;
     RawPosixAIOData acb;
     ThreadPoolFunc *handler;
+    int ret;
 
 #ifdef CONFIG_FALLOCATE
     if (offset + bytes > bs->total_sectors * BDRV_SECTOR_SIZE) {
@@ -3034,7 +3314,9 @@ raw_do_pwrite_zeroes(BlockDriverState *bs, int64_t offset, int bytes,
         handler = handle_aiocb_write_zeroes;
     }
 
-    return raw_thread_pool_submit(bs, handler, &acb);
+    ret = raw_thread_pool_submit(bs, handler, &acb);
+    raw_bsc_invalidate(s, offset, bytes);
+    return ret;
 }
 
 static int coroutine_fn raw_co_pwrite_zeroes(
@@ -3052,11 +3334,18 @@ static int raw_get_info(BlockDriverState *bs, BlockDriverInfo *bdi)
 static BlockStatsSpecificFile get_blockstats_specific_file(BlockDriverState *bs)
 {
     BDRVRawState *s = bs->opaque;
-    return (BlockStatsSpecificFile) {
+    BlockStatsSpecificFile stats = {
         .discard_nb_ok = s->stats.discard_nb_ok,
         .discard_nb_failed = s->stats.discard_nb_failed,
         .discard_bytes_ok = s->stats.discard_bytes_ok,
     };
+
+    qemu_mutex_lock(&s->bounce_lock);
+    stats.bounce_nb_reused = s->bounce_nb_reused;
+    stats.bounce_nb_allocated = s->bounce_nb_allocated;
+    qemu_mutex_unlock(&s->bounce_lock);
+
+    return stats;
 }
 
 static BlockStatsSpecific *raw_get_specific_stats(BlockDriverState *bs)
@@ -3183,6 +3472,10 @@ static void raw_set_perm(BlockDriverState *bs, uint64_t perm, uint64_t shared)
     s->perm_change_fd = 0;
 
     raw_handle_perm_lock(bs, RAW_PL_COMMIT, perm, shared, NULL);
+    if (shared & BLK_PERM_WRITE) {
+        /* Cached holes may be written to by others from now on */
+        raw_bsc_invalidate(s, 0, INT64_MAX);
+    }
     s->perm = perm;
     s->shared_perm = shared;
 }
@@ -3222,6 +3515,7 @@ static int coroutine_fn raw_co_copy_range_to(BlockDriverState *bs,
     RawPosixAIOData acb;
     BDRVRawState *s = bs->opaque;
     BDRVRawState *src_s;
+    int ret;
 
     assert(dst->bs == bs);
     if (src->bs->drv->bdrv_co_copy_range_to != raw_co_copy_range_to) {
@@ -3245,9 +3539,44 @@ static int coroutine_fn raw_co_copy_range_to(BlockDriverState *bs,
         },
     };
 
-    return raw_thread_pool_submit(bs, handle_aiocb_copy_range, &acb);
+    ret = raw_thread_pool_submit(bs, handle_aiocb_copy_range, &acb);
+    raw_bsc_invalidate(s, dst_offset, bytes);
+    return ret;
 }
 
+#ifdef __linux__
+static int coroutine_fn raw_co_sendfile(BlockDriverState *bs, int64_t offset,
+                                        int64_t bytes, int fd, const void *hdr,
+                                        size_t hdr_len)
+{
+    BDRVRawState *s = bs->opaque;
+    RawPosixAIOData acb;
+
+    /* sendfile() reads through the page cache */
+    if (s->open_flags & O_DIRECT) {
+        return -ENOTSUP;
+    }
+    if (fd_open(bs) < 0) {
+        return -EIO;
+    }
+
+    acb = (RawPosixAIOData) {
+        .bs             = bs,
+        .aio_type       = QEMU_AIO_SENDFILE,
+        .aio_fildes     = s->fd,
+        .aio_offset     = offset,
+        .aio_nbytes     = bytes,
+        .sendfile       = {
+            .out_fd         = fd,
+            .hdr            = hdr,
+            .hdr_len        = hdr_len,
+        },
+    };
+
+    return raw_thread_pool_submit(bs, handle_aiocb_sendfile, &acb);
+}
+#endif
+
 BlockDriver bdrv_file = {
     .format_name = "file",
     .protocol_name = "file",
@@ -3274,9 +3603,14 @@ BlockDriver bdrv_file = {
     .bdrv_co_pdiscard       = raw_co_pdiscard,
     .bdrv_co_copy_range_from = raw_co_copy_range_from,
     .bdrv_co_copy_range_to  = raw_co_copy_range_to,
+#ifdef __linux__
+    .bdrv_co_sendfile       = raw_co_sendfile,
+#endif
     .bdrv_refresh_limits = raw_refresh_limits,
     .bdrv_io_plug = raw_aio_plug,
     .bdrv_io_unplug = raw_aio_unplug,
+    .bdrv_register_buf = raw_register_buf,
+    .bdrv_unregister_buf = raw_unregister_buf,
     .bdrv_attach_aio_context = raw_aio_attach_aio_context,
 
     .bdrv_co_truncate = raw_co_truncate,
@@ -3643,6 +3977,8 @@ static BlockDriver bdrv_host_device = {
     .bdrv_refresh_limits = raw_refresh_limits,
     .bdrv_io_plug = raw_aio_plug,
     .bdrv_io_unplug = raw_aio_unplug,
+    .bdrv_register_buf = raw_register_buf,
+    .bdrv_unregister_buf = raw_unregister_buf,
     .bdrv_attach_aio_context = raw_aio_attach_aio_context,
 
     .bdrv_co_truncate       = raw_co_truncate,
@@ -3767,6 +4103,8 @@ static BlockDriver bdrv_host_cdrom = {
     .bdrv_refresh_limits = raw_refresh_limits,
     .bdrv_io_plug = raw_aio_plug,
     .bdrv_io_unplug = raw_aio_unplug,
+    .bdrv_register_buf = raw_register_buf,
+    .bdrv_unregister_buf = raw_unregister_buf,
     .bdrv_attach_aio_context = raw_aio_attach_aio_context,
 
     .bdrv_co_truncate    = raw_co_truncate,
@@ -3897,6 +4235,8 @@ static BlockDriver bdrv_host_cdrom = {
     .bdrv_refresh_limits = raw_refresh_limits,
     .bdrv_io_plug = raw_aio_plug,
     .bdrv_io_unplug = raw_aio_unplug,
+    .bdrv_register_buf = raw_register_buf,
+    .bdrv_unregister_buf = raw_unregister_buf,
     .bdrv_attach_aio_context = raw_aio_attach_aio_context,
 
     .bdrv_co_truncate    = raw_co_truncate,
@@ -828,14 +828,24 @@ bdrv_wait_serialising_requests_locked(BdrvTrackedRequest *self)
 {
     BdrvTrackedRequest *req;
     bool waited = false;
+    int64_t start_ns = 0;
 
     while ((req = bdrv_find_conflicting_request(self))) {
+        if (!waited && qatomic_read(&self->bs->stats_enabled)) {
+            start_ns = qemu_clock_get_ns(QEMU_CLOCK_REALTIME);
+        }
         self->waiting_for = req;
         qemu_co_queue_wait(&req->wait_queue, &self->bs->reqs_lock);
         self->waiting_for = NULL;
         waited = true;
     }
 
+    if (start_ns) {
+        stat64_add(&self->bs->serialising_waits, 1);
+        stat64_add(&self->bs->serialising_wait_ns,
+                   qemu_clock_get_ns(QEMU_CLOCK_REALTIME) - start_ns);
+    }
+
     return waited;
 }
 
@@ -925,6 +935,34 @@ void bdrv_dec_in_flight(BlockDriverState *bs)
     bdrv_wakeup(bs);
 }
 
+/*
+ * Per-node accounting of the requests that enter @bs, whoever sent them.
+ * It is off unless a latency histogram was set for the node, so that the
+ * common case only pays for one atomic read.
+ */
+static void bdrv_acct_start(BlockDriverState *bs, BlockAcctCookie *cookie,
+                            int64_t bytes, enum BlockAcctType type)
+{
+    if (qatomic_read(&bs->stats_enabled)) {
+        block_acct_start(&bs->stats, cookie, bytes, type);
+    } else {
+        cookie->type = BLOCK_ACCT_NONE;
+    }
+}
+
+static void bdrv_acct_end(BlockDriverState *bs, BlockAcctCookie *cookie,
+                          int ret)
+{
+    if (cookie->type == BLOCK_ACCT_NONE) {
+        return;
+    }
+    if (ret < 0) {
+        block_acct_failed(&bs->stats, cookie);
+    } else {
+        block_acct_done(&bs->stats, cookie);
+    }
+}
+
 static bool coroutine_fn bdrv_wait_serialising_requests(BdrvTrackedRequest *self)
 {
     BlockDriverState *bs = self->bs;
@@ -1806,6 +1844,7 @@ int coroutine_fn bdrv_co_preadv_part(BdrvChild *child,
     BlockDriverState *bs = child->bs;
     BdrvTrackedRequest req;
     BdrvRequestPadding pad;
+    BlockAcctCookie acct;
     int ret;
 
     trace_bdrv_co_preadv_part(bs, offset, bytes, flags);
@@ -1832,6 +1871,7 @@ int coroutine_fn bdrv_co_preadv_part(BdrvChild *child,
     }
 
     bdrv_inc_in_flight(bs);
+    bdrv_acct_start(bs, &acct, bytes, BLOCK_ACCT_READ);
 
     /* Don't do copy-on-read if we read data before write operation */
     if (qatomic_read(&bs->copy_on_read)) {
@@ -1841,6 +1881,7 @@ int coroutine_fn bdrv_co_preadv_part(BdrvChild *child,
     ret = bdrv_pad_request(bs, &qiov, &qiov_offset, &offset, &bytes, &pad,
                            NULL);
     if (ret < 0) {
+        bdrv_acct_end(bs, &acct, ret);
         return ret;
     }
 
@@ -1849,6 +1890,7 @@ int coroutine_fn bdrv_co_preadv_part(BdrvChild *child,
                               bs->bl.request_alignment,
                               qiov, qiov_offset, flags);
     tracked_request_end(&req);
+    bdrv_acct_end(bs, &acct, ret);
     bdrv_dec_in_flight(bs);
 
     bdrv_padding_destroy(&pad);
@@ -2233,6 +2275,7 @@ int coroutine_fn bdrv_co_pwritev_part(BdrvChild *child,
     BdrvTrackedRequest req;
     uint64_t align = bs->bl.request_alignment;
     BdrvRequestPadding pad;
+    BlockAcctCookie acct;
     int ret;
     bool padded = false;
 
@@ -2280,6 +2323,7 @@ int coroutine_fn bdrv_co_pwritev_part(BdrvChild *child,
     }
 
     bdrv_inc_in_flight(bs);
+    bdrv_acct_start(bs, &acct, bytes, BLOCK_ACCT_WRITE);
     tracked_request_begin(&req, bs, offset, bytes, BDRV_TRACKED_WRITE);
 
     if (flags & BDRV_REQ_ZERO_WRITE) {
@@ -2306,6 +2350,7 @@ int coroutine_fn bdrv_co_pwritev_part(BdrvChild *child,
 
 out:
     tracked_request_end(&req);
+    bdrv_acct_end(bs, &acct, ret);
     bdrv_dec_in_flight(bs);
 
     return ret;
@@ -2852,6 +2897,7 @@ int coroutine_fn bdrv_co_flush(BlockDriverState *bs)
 {
     BdrvChild *primary_child = bdrv_primary_child(bs);
     BdrvChild *child;
+    BlockAcctCookie acct = { .type = BLOCK_ACCT_NONE };
     int current_gen;
     int ret = 0;
 
@@ -2862,6 +2908,8 @@ int coroutine_fn bdrv_co_flush(BlockDriverState *bs)
         goto early_exit;
     }
 
+    bdrv_acct_start(bs, &acct, 0, BLOCK_ACCT_FLUSH);
+
     qemu_co_mutex_lock(&bs->reqs_lock);
     current_gen = qatomic_read(&bs->write_gen);
 
@@ -2967,6 +3015,7 @@ out:
     qemu_co_mutex_unlock(&bs->reqs_lock);
 
 early_exit:
+    bdrv_acct_end(bs, &acct, ret);
     bdrv_dec_in_flight(bs);
     return ret;
 }
@@ -2975,6 +3024,7 @@ int coroutine_fn bdrv_co_pdiscard(BdrvChild *child, int64_t offset,
                                   int64_t bytes)
 {
     BdrvTrackedRequest req;
+    BlockAcctCookie acct;
     int max_pdiscard, ret;
     int head, tail, align;
     BlockDriverState *bs = child->bs;
@@ -3012,6 +3062,7 @@ int coroutine_fn bdrv_co_pdiscard(BdrvChild *child, int64_t offset,
     tail = (offset + bytes) % align;
 
     bdrv_inc_in_flight(bs);
+    bdrv_acct_start(bs, &acct, bytes, BLOCK_ACCT_UNMAP);
     tracked_request_begin(&req, bs, offset, bytes, BDRV_TRACKED_DISCARD);
 
     ret = bdrv_co_write_req_prepare(child, offset, bytes, &req, 0);
@@ -3082,6 +3133,7 @@ int coroutine_fn bdrv_co_pdiscard(BdrvChild *child, int64_t offset,
 out:
     bdrv_co_write_req_finish(child, req.offset, req.bytes, &req, ret);
     tracked_request_end(&req);
+    bdrv_acct_end(bs, &acct, ret);
     bdrv_dec_in_flight(bs);
     return ret;
 }
@@ -3344,6 +3396,40 @@ int coroutine_fn bdrv_co_copy_range(BdrvChild *src, int64_t src_offset,
                                    bytes, read_flags, write_flags);
 }
 
+int coroutine_fn bdrv_co_sendfile(BdrvChild *child, int64_t offset,
+                                  int64_t bytes, int fd, const void *hdr,
+                                  size_t hdr_len)
+{
+    BlockDriverState *bs = child->bs;
+    BdrvTrackedRequest req;
+    int ret;
+
+    if (!bs || !bdrv_is_inserted(bs)) {
+        return -ENOMEDIUM;
+    }
+    ret = bdrv_check_request32(offset, bytes, NULL, 0);
+    if (ret) {
+        return ret;
+    }
+
+    /* Copy-on-read needs the data in a buffer to write it back */
+    if (!bs->drv->bdrv_co_sendfile || bs->encrypted ||
+        qatomic_read(&bs->copy_on_read)) {
+        return -ENOTSUP;
+    }
+
+    bdrv_inc_in_flight(bs);
+    tracked_request_begin(&req, bs, offset, bytes, BDRV_TRACKED_READ);
+    bdrv_wait_serialising_requests(&req);
+
+    ret = bs->drv->bdrv_co_sendfile(bs, offset, bytes, fd, hdr, hdr_len);
+
+    tracked_request_end(&req);
+    bdrv_dec_in_flight(bs);
+
+    return ret;
+}
+
 static void bdrv_parent_cb_resize(BlockDriverState *bs)
 {
     BdrvChild *c;
@@ -22,6 +22,9 @@
 /* io_uring ring size */
 #define MAX_ENTRIES 128
 
+/* Maximum number of buffers registered with luring_register_buf() */
+#define MAX_FIXED_BUFS 16
+
 typedef struct LuringAIOCB {
     Coroutine *co;
     struct io_uring_sqe sqeq;
@@ -56,6 +59,10 @@ typedef struct LuringState {
 
     /* I/O completion processing.  Only runs in I/O thread.  */
     QEMUBH *completion_bh;
+
+    /* Buffers registered with the kernel, see luring_register_buf() */
+    struct iovec fixed_bufs[MAX_FIXED_BUFS];
+    unsigned int nb_fixed_bufs;
 } LuringState;
 
 /**
@@ -102,7 +109,9 @@ static void luring_resubmit_short_read(LuringState *s, LuringAIOCB *luringcb,
     qemu_iovec_concat(resubmit_qiov, luringcb->qiov, luringcb->total_read,
                       remaining);
 
-    /* Update sqe */
+    /* Update sqe, a registered buffer can't describe the rest of the qiov */
+    luringcb->sqeq.opcode = IORING_OP_READV;
+    luringcb->sqeq.buf_index = 0;
     luringcb->sqeq.off = nread;
     luringcb->sqeq.addr = (__u64)(uintptr_t)luringcb->resubmit_qiov.iov;
     luringcb->sqeq.len = luringcb->resubmit_qiov.niov;
@@ -326,6 +335,34 @@ void luring_io_unplug(BlockDriverState *bs, LuringState *s)
     }
 }
 
+/**
+ * luring_find_fixed_buf:
+ *
+ * Returns the index of the registered buffer that contains the whole of
+ * @qiov, or -1 if there is none.  Only single-element vectors can be
+ * submitted with a registered buffer.
+ */
+static int luring_find_fixed_buf(LuringState *s, QEMUIOVector *qiov)
+{
+    uintptr_t base, end;
+    unsigned int i;
+
+    if (qiov->niov != 1) {
+        return -1;
+    }
+
+    base = (uintptr_t)qiov->iov[0].iov_base;
+    end = base + qiov->iov[0].iov_len;
+    for (i = 0; i < s->nb_fixed_bufs; i++) {
+        uintptr_t buf = (uintptr_t)s->fixed_bufs[i].iov_base;
+
+        if (base >= buf && end <= buf + s->fixed_bufs[i].iov_len) {
+            return i;
+        }
+    }
+    return -1;
+}
+
 /**
  * luring_do_submit:
  * @fd: file descriptor for I/O
@@ -340,15 +377,31 @@ void luring_io_unplug(BlockDriverState *bs, LuringState *s)
 static int luring_do_submit(int fd, LuringAIOCB *luringcb, LuringState *s,
                             uint64_t offset, int type)
 {
-    int ret;
+    int ret, buf_index = -1;
     struct io_uring_sqe *sqes = &luringcb->sqeq;
 
+    if (type == QEMU_AIO_WRITE || type == QEMU_AIO_READ) {
+        buf_index = luring_find_fixed_buf(s, luringcb->qiov);
+    }
+
     switch (type) {
     case QEMU_AIO_WRITE:
+        if (buf_index >= 0) {
+            io_uring_prep_write_fixed(sqes, fd, luringcb->qiov->iov[0].iov_base,
+                                      luringcb->qiov->iov[0].iov_len, offset,
+                                      buf_index);
+            break;
+        }
         io_uring_prep_writev(sqes, fd, luringcb->qiov->iov,
                              luringcb->qiov->niov, offset);
         break;
     case QEMU_AIO_READ:
+        if (buf_index >= 0) {
+            io_uring_prep_read_fixed(sqes, fd, luringcb->qiov->iov[0].iov_base,
+                                     luringcb->qiov->iov[0].iov_len, offset,
+                                     buf_index);
+            break;
+        }
         io_uring_prep_readv(sqes, fd, luringcb->qiov->iov,
                             luringcb->qiov->niov, offset);
         break;
@@ -400,6 +453,65 @@ int coroutine_fn luring_co_submit(BlockDriverState *bs, LuringState *s, int fd,
     return luringcb.ret;
 }
 
+static void luring_update_fixed_bufs(LuringState *s)
+{
+    int ret;
+
+    if (s->nb_fixed_bufs) {
+        ret = io_uring_register_buffers(&s->ring, s->fixed_bufs,
+                                        s->nb_fixed_bufs);
+        if (ret < 0) {
+            /* Registered buffers are only an optimization */
+            trace_luring_register_buf_failed(s, ret);
+            s->nb_fixed_bufs = 0;
+        }
+    }
+}
+
+/**
+ * luring_register_buf:
+ *
+ * Register a long-lived I/O buffer with the kernel, so that requests
+ * using it don't have to pin and map its pages every time.  The kernel
+ * only accepts the whole set of buffers at once, so this is meant for
+ * buffers that are set up before I/O starts.
+ */
+void luring_register_buf(LuringState *s, void *host, size_t size)
+{
+    if (s->nb_fixed_bufs == MAX_FIXED_BUFS) {
+        return;
+    }
+
+    if (s->nb_fixed_bufs) {
+        io_uring_unregister_buffers(&s->ring);
+    }
+    s->fixed_bufs[s->nb_fixed_bufs++] = (struct iovec) {
+        .iov_base = host,
+        .iov_len = size,
+    };
+    luring_update_fixed_bufs(s);
+}
+
+void luring_unregister_buf(LuringState *s, void *host)
+{
+    unsigned int i;
+
+    for (i = 0; i < s->nb_fixed_bufs; i++) {
+        if (s->fixed_bufs[i].iov_base == host) {
+            break;
+        }
+    }
+    if (i == s->nb_fixed_bufs) {
+        return;
+    }
+
+    io_uring_unregister_buffers(&s->ring);
+    s->nb_fixed_bufs--;
+    memmove(&s->fixed_bufs[i], &s->fixed_bufs[i + 1],
+            (s->nb_fixed_bufs - i) * sizeof(s->fixed_bufs[0]));
+    luring_update_fixed_bufs(s);
+}
+
 void luring_detach_aio_context(LuringState *s, AioContext *old_context)
 {
     aio_set_fd_handler(old_context, s->ring.ring_fd, false, NULL, NULL, NULL,
@@ -1340,6 +1340,29 @@ do_sync_target_write(MirrorBlockJob *job, MirrorMethod method,
     }
 }
 
+typedef struct MirrorTargetWrite {
+    MirrorBlockJob *job;
+    MirrorMethod method;
+    uint64_t offset;
+    uint64_t bytes;
+    QEMUIOVector *qiov;
+    int flags;
+    Coroutine *waiter;
+    bool done;
+} MirrorTargetWrite;
+
+static void coroutine_fn mirror_target_write_entry(void *opaque)
+{
+    MirrorTargetWrite *tw = opaque;
+
+    do_sync_target_write(tw->job, tw->method, tw->offset, tw->bytes,
+                         tw->qiov, tw->flags);
+    tw->done = true;
+    if (tw->waiter) {
+        aio_co_wake(tw->waiter);
+    }
+}
+
 static MirrorOp *coroutine_fn active_write_prepare(MirrorBlockJob *s,
                                                    uint64_t offset,
                                                    uint64_t bytes)
@@ -1406,6 +1429,7 @@ static int coroutine_fn bdrv_mirror_top_do_write(BlockDriverState *bs,
 {
     MirrorOp *op = NULL;
     MirrorBDSOpaque *s = bs->opaque;
+    MirrorTargetWrite tw;
     int ret = 0;
     bool copy_to_target;
 
@@ -1414,6 +1438,23 @@ static int coroutine_fn bdrv_mirror_top_do_write(BlockDriverState *bs,
 
     if (copy_to_target) {
         op = active_write_prepare(s->job, offset, bytes);
+
+        /*
+         * Write to the target concurrently with the source, so that the
+         * guest waits for the slower of the two rather than for both in
+         * turn.  The in-flight op keeps other writes and the background
+         * copy away from the range meanwhile.
+         */
+        tw = (MirrorTargetWrite) {
+            .job    = s->job,
+            .method = method,
+            .offset = offset,
+            .bytes  = bytes,
+            .qiov   = qiov,
+            .flags  = flags,
+        };
+        qemu_coroutine_enter(qemu_coroutine_create(mirror_target_write_entry,
+                                                   &tw));
     }
 
     switch (method) {
@@ -1433,16 +1474,25 @@ static int coroutine_fn bdrv_mirror_top_do_write(BlockDriverState *bs,
         abort();
     }
 
-    if (ret < 0) {
-        goto out;
-    }
-
     if (copy_to_target) {
-        do_sync_target_write(s->job, method, offset, bytes, qiov, flags);
-    }
+        if (!tw.done) {
+            tw.waiter = qemu_coroutine_self();
+            qemu_coroutine_yield();
+        }
 
-out:
-    if (copy_to_target) {
+        if (ret < 0) {
+            /*
+             * The target may now hold data that didn't make it to the
+             * source, copy the area again from the source.
+             */
+            bdrv_set_dirty_bitmap(s->job->dirty_bitmap,
+                                  QEMU_ALIGN_DOWN(offset, s->job->granularity),
+                                  QEMU_ALIGN_UP(offset + bytes,
+                                                s->job->granularity) -
+                                  QEMU_ALIGN_DOWN(offset,
+                                                  s->job->granularity));
+            s->job->actively_synced = false;
+        }
         active_write_settle(op);
     }
     return ret;
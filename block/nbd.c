@@ -49,7 +49,8 @@
 #include "qemu/yank.h"
 
 #define EN_OPTSTR ":exportname="
-#define MAX_NBD_REQUESTS    16
+#define MAX_NBD_REQUESTS    64
+#define MAX_NBD_CONNECTIONS 16
 
 #define HANDLE_TO_INDEX(bs, handle) ((handle) ^ (uint64_t)(intptr_t)(bs))
 #define INDEX_TO_HANDLE(bs, index)  ((index)  ^ (uint64_t)(intptr_t)(bs))
@@ -96,8 +97,17 @@ typedef struct BDRVNBDState {
     const char *hostname;
     char *x_dirty_bitmap;
     bool alloc_depth;
+    uint32_t multi_conn;
 
     NBDClientConnection *conn;
+
+    /*
+     * Additional connections for multi-conn, each of them an nbd node of
+     * its own. Reads and writes are spread over them and the main one.
+     */
+    BdrvChild *conns[MAX_NBD_CONNECTIONS - 1];
+    int nr_conns;
+    unsigned next_conn;
 } BDRVNBDState;
 
 static void nbd_yank(void *opaque);
@@ -1322,12 +1332,29 @@ static int nbd_co_request(BlockDriverState *bs, NBDRequest *request,
     return ret ? ret : request_ret;
 }
 
+/*
+ * Return the additional connection that the next read or write should use,
+ * or NULL for the main connection.
+ */
+static BdrvChild *nbd_next_conn(BDRVNBDState *s)
+{
+    unsigned i;
+
+    if (!s->nr_conns) {
+        return NULL;
+    }
+
+    i = s->next_conn++ % (s->nr_conns + 1);
+    return i ? s->conns[i - 1] : NULL;
+}
+
 static int nbd_client_co_preadv(BlockDriverState *bs, uint64_t offset,
                                 uint64_t bytes, QEMUIOVector *qiov, int flags)
 {
     int ret, request_ret;
     Error *local_err = NULL;
     BDRVNBDState *s = (BDRVNBDState *)bs->opaque;
+    BdrvChild *conn;
     NBDRequest request = {
         .type = NBD_CMD_READ,
         .from = offset,
@@ -1340,6 +1367,12 @@ static int nbd_client_co_preadv(BlockDriverState *bs, uint64_t offset,
     if (!bytes) {
         return 0;
     }
+
+    conn = nbd_next_conn(s);
+    if (conn) {
+        return bdrv_co_preadv(conn, offset, bytes, qiov, 0);
+    }
+
     /*
      * Work around the fact that the block layer doesn't do
      * byte-accurate sizing yet - if the read exceeds the server's
@@ -1384,6 +1417,7 @@ static int nbd_client_co_pwritev(BlockDriverState *bs, uint64_t offset,
                                  uint64_t bytes, QEMUIOVector *qiov, int flags)
 {
     BDRVNBDState *s = (BDRVNBDState *)bs->opaque;
+    BdrvChild *conn;
     NBDRequest request = {
         .type = NBD_CMD_WRITE,
         .from = offset,
@@ -1401,6 +1435,11 @@ static int nbd_client_co_pwritev(BlockDriverState *bs, uint64_t offset,
     if (!bytes) {
         return 0;
     }
+
+    conn = nbd_next_conn(s);
+    if (conn) {
+        return bdrv_co_pwritev(conn, offset, bytes, qiov, flags);
+    }
     return nbd_co_request(bs, &request, qiov);
 }
 
@@ -1897,6 +1936,12 @@ static QemuOptsList nbd_runtime_opts = {
                     "future requests before a successful reconnect will "
                     "immediately fail. Default 0",
         },
+        {
+            .name = "multi-conn",
+            .type = QEMU_OPT_NUMBER,
+            .help = "Number of connections to open if the server allows "
+                    "several, default 1",
+        },
         { /* end of list */ }
     },
 };
@@ -1953,6 +1998,13 @@ static int nbd_process_options(BlockDriverState *bs, QDict *options,
 
     s->reconnect_delay = qemu_opt_get_number(opts, "reconnect-delay", 0);
 
+    s->multi_conn = qemu_opt_get_number(opts, "multi-conn", 1);
+    if (s->multi_conn < 1 || s->multi_conn > MAX_NBD_CONNECTIONS) {
+        error_setg(errp, "multi-conn must be between 1 and %d",
+                   MAX_NBD_CONNECTIONS);
+        goto error;
+    }
+
     ret = 0;
 
  error:
@@ -1960,11 +2012,52 @@ static int nbd_process_options(BlockDriverState *bs, QDict *options,
     return ret;
 }
 
+/*
+ * Open the additional connections for multi-conn as child nodes that use
+ * the same options as @bs. As they only add bandwidth, failing to open one
+ * is not an error; the connections that could be opened are used.
+ */
+static void nbd_open_conns(BlockDriverState *bs, QDict *options,
+                           QDict *conn_opts)
+{
+    BDRVNBDState *s = (BDRVNBDState *)bs->opaque;
+    const QDictEntry *e;
+    int i;
+
+    if (!(s->info.flags & NBD_FLAG_CAN_MULTI_CONN)) {
+        trace_nbd_multi_conn_unsupported(s->multi_conn);
+        return;
+    }
+
+    qdict_put_str(conn_opts, "driver", "nbd");
+    for (i = 1; i < s->multi_conn; i++) {
+        g_autofree char *name = g_strdup_printf("conn%d", i);
+        Error *local_err = NULL;
+        BdrvChild *child;
+
+        for (e = qdict_first(conn_opts); e; e = qdict_next(conn_opts, e)) {
+            g_autofree char *key = g_strdup_printf("%s.%s", name, e->key);
+
+            qdict_put_obj(options, key, qobject_ref(e->value));
+        }
+
+        child = bdrv_open_child(NULL, options, name, bs, &child_of_bds,
+                                BDRV_CHILD_DATA, false, &local_err);
+        if (!child) {
+            warn_reportf_err(local_err, "Could only open %d of %" PRIu32
+                             " NBD connections: ", i, s->multi_conn);
+            break;
+        }
+        s->conns[s->nr_conns++] = child;
+    }
+}
+
 static int nbd_open(BlockDriverState *bs, QDict *options, int flags,
                     Error **errp)
 {
     int ret;
     BDRVNBDState *s = (BDRVNBDState *)bs->opaque;
+    g_autoptr(QDict) conn_opts = NULL;
 
     s->bs = bs;
     qemu_co_mutex_init(&s->send_mutex);
@@ -1974,6 +2067,10 @@ static int nbd_open(BlockDriverState *bs, QDict *options, int flags,
         return -EEXIST;
     }
 
+    /* Additional connections use the same options, save them */
+    conn_opts = qdict_clone_shallow(options);
+    qdict_del(conn_opts, "multi-conn");
+
     ret = nbd_process_options(bs, options, errp);
     if (ret < 0) {
         goto fail;
@@ -1988,6 +2085,10 @@ static int nbd_open(BlockDriverState *bs, QDict *options, int flags,
         goto fail;
     }
 
+    if (s->multi_conn > 1) {
+        nbd_open_conns(bs, options, conn_opts);
+    }
+
     s->connection_co = qemu_coroutine_create(nbd_connection_entry, s);
     bdrv_inc_in_flight(bs);
     aio_co_schedule(bdrv_get_aio_context(bs), s->connection_co);
@@ -2161,6 +2262,7 @@ static BlockDriver bdrv_nbd = {
     .bdrv_close                 = nbd_close,
     .bdrv_co_flush_to_os        = nbd_co_flush,
     .bdrv_co_pdiscard           = nbd_client_co_pdiscard,
+    .bdrv_child_perm            = bdrv_default_perms,
     .bdrv_refresh_limits        = nbd_refresh_limits,
     .bdrv_co_truncate           = nbd_co_truncate,
     .bdrv_getlength             = nbd_getlength,
@@ -2190,6 +2292,7 @@ static BlockDriver bdrv_nbd_tcp = {
     .bdrv_close                 = nbd_close,
     .bdrv_co_flush_to_os        = nbd_co_flush,
     .bdrv_co_pdiscard           = nbd_client_co_pdiscard,
+    .bdrv_child_perm            = bdrv_default_perms,
     .bdrv_refresh_limits        = nbd_refresh_limits,
     .bdrv_co_truncate           = nbd_co_truncate,
     .bdrv_getlength             = nbd_getlength,
@@ -2219,6 +2322,7 @@ static BlockDriver bdrv_nbd_unix = {
     .bdrv_close                 = nbd_close,
     .bdrv_co_flush_to_os        = nbd_co_flush,
     .bdrv_co_pdiscard           = nbd_client_co_pdiscard,
+    .bdrv_child_perm            = bdrv_default_perms,
     .bdrv_refresh_limits        = nbd_refresh_limits,
     .bdrv_co_truncate           = nbd_co_truncate,
     .bdrv_getlength             = nbd_getlength,
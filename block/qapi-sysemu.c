@@ -32,6 +32,7 @@
 
 #include "qemu/osdep.h"
 
+#include "block/block_int.h"
 #include "qapi/error.h"
 #include "qapi/qapi-commands-block.h"
 #include "qapi/qmp/qdict.h"
@@ -541,23 +542,39 @@ void qmp_block_latency_histogram_set(
     bool has_boundaries_flush, uint64List *boundaries_flush,
     Error **errp)
 {
-    BlockBackend *blk = qmp_get_blk(NULL, id, errp);
+    BlockBackend *blk;
+    BlockDriverState *bs = NULL;
     BlockAcctStats *stats;
+    Error *local_err = NULL;
     int ret;
 
+    blk = qmp_get_blk(NULL, id, &local_err);
     if (!blk) {
-        return;
+        bs = bdrv_find_node(id);
+        if (!bs) {
+            error_propagate(errp, local_err);
+            return;
+        }
+        error_free(local_err);
+        stats = &bs->stats;
+    } else {
+        stats = blk_get_stats(blk);
     }
 
-    stats = blk_get_stats(blk);
-
     if (!has_boundaries && !has_boundaries_read && !has_boundaries_write &&
         !has_boundaries_flush)
     {
+        if (bs) {
+            qatomic_set(&bs->stats_enabled, false);
+        }
         block_latency_histograms_clear(stats);
         return;
     }
 
+    if (bs) {
+        qatomic_set(&bs->stats_enabled, true);
+    }
+
     if (has_boundaries || has_boundaries_read) {
         ret = block_latency_histogram_set(
             stats, BLOCK_ACCT_READ,
@@ -424,9 +424,8 @@ static void bdrv_latency_histogram_stats(BlockLatencyHistogram *hist,
     }
 }
 
-static void bdrv_query_blk_stats(BlockDeviceStats *ds, BlockBackend *blk)
+static void bdrv_query_acct_stats(BlockDeviceStats *ds, BlockAcctStats *stats)
 {
-    BlockAcctStats *stats = blk_get_stats(blk);
     BlockAcctTimedStats *ts = NULL;
 
     ds->rd_bytes = stats->nr_bytes[BLOCK_ACCT_READ];
@@ -532,6 +531,14 @@ static BlockStats *bdrv_query_bds_stats(BlockDriverState *bs,
 
     s->stats->wr_highest_offset = stat64_get(&bs->wr_highest_offset);
 
+    if (qatomic_read(&bs->stats_enabled)) {
+        bdrv_query_acct_stats(s->stats, &bs->stats);
+        s->stats->has_serialising_waits = true;
+        s->stats->serialising_waits = stat64_get(&bs->serialising_waits);
+        s->stats->has_serialising_wait_ns = true;
+        s->stats->serialising_wait_ns = stat64_get(&bs->serialising_wait_ns);
+    }
+
     s->driver_specific = bdrv_get_specific_stats(bs);
     if (s->driver_specific) {
         s->has_driver_specific = true;
@@ -651,7 +658,15 @@ BlockStatsList *qmp_query_blockstats(bool has_query_nodes,
                 g_free(qdev);
             }
 
-            bdrv_query_blk_stats(s->stats, blk);
+            if (s->stats->has_serialising_waits) {
+                /* The device's statistics replace those of its root node */
+                uint64_t wr_highest_offset = s->stats->wr_highest_offset;
+
+                qapi_free_BlockDeviceStats(s->stats);
+                s->stats = g_new0(BlockDeviceStats, 1);
+                s->stats->wr_highest_offset = wr_highest_offset;
+            }
+            bdrv_query_acct_stats(s->stats, blk_get_stats(blk));
             aio_context_release(ctx);
 
             QAPI_LIST_APPEND(tail, s);
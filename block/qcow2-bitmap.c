@@ -79,7 +79,6 @@ typedef struct QEMU_PACKED Qcow2BitmapDirEntry {
 typedef struct Qcow2BitmapTable {
     uint64_t offset;
     uint32_t size; /* number of 64bit entries */
-    QSIMPLEQ_ENTRY(Qcow2BitmapTable) entry;
 } Qcow2BitmapTable;
 
 typedef struct Qcow2Bitmap {
@@ -90,6 +89,16 @@ typedef struct Qcow2Bitmap {
 
     BdrvDirtyBitmap *dirty_bitmap;
 
+    /*
+     * Only used while the bitmap is being stored: the table it had in the
+     * image before, its entries, and the entries of the new @table (all in
+     * host byte order).  Data clusters are shared between the two tables
+     * where the old ones could be reused.
+     */
+    Qcow2BitmapTable old_table;
+    uint64_t *old_entries;
+    uint64_t *entries;
+
     QSIMPLEQ_ENTRY(Qcow2Bitmap) entry;
 } Qcow2Bitmap;
 typedef QSIMPLEQ_HEAD(Qcow2BitmapList, Qcow2Bitmap) Qcow2BitmapList;
@@ -202,8 +211,14 @@ static int check_constraints_on_bitmap(BlockDriverState *bs,
     return 0;
 }
 
+/*
+ * Free the data clusters referenced by @bitmap_table, except for those that
+ * @keep_table (if not NULL) references at the same index.
+ */
 static void clear_bitmap_table(BlockDriverState *bs, uint64_t *bitmap_table,
-                               uint32_t bitmap_table_size)
+                               uint32_t bitmap_table_size,
+                               const uint64_t *keep_table,
+                               uint32_t keep_table_size)
 {
     BDRVQcow2State *s = bs->opaque;
     int i;
@@ -213,6 +228,10 @@ static void clear_bitmap_table(BlockDriverState *bs, uint64_t *bitmap_table,
         if (!addr) {
             continue;
         }
+        if (keep_table && i < keep_table_size &&
+            (keep_table[i] & BME_TABLE_ENTRY_OFFSET_MASK) == addr) {
+            continue;
+        }
 
         qcow2_free_clusters(bs, addr, s->cluster_size, QCOW2_DISCARD_ALWAYS);
         bitmap_table[i] = 0;
@@ -267,7 +286,7 @@ static int free_bitmap_clusters(BlockDriverState *bs, Qcow2BitmapTable *tb)
         return ret;
     }
 
-    clear_bitmap_table(bs, bitmap_table, tb->size);
+    clear_bitmap_table(bs, bitmap_table, tb->size, NULL, 0);
     qcow2_free_clusters(bs, tb->offset, tb->size * BME_TABLE_ENTRY_SIZE,
                         QCOW2_DISCARD_OTHER);
     g_free(bitmap_table);
@@ -504,6 +523,8 @@ static void bitmap_free(Qcow2Bitmap *bm)
         return;
     }
 
+    g_free(bm->old_entries);
+    g_free(bm->entries);
     g_free(bm->name);
     g_free(bm);
 }
@@ -1266,9 +1287,15 @@ out:
 
 /* store_bitmap_data()
  * Store bitmap to image, filling bitmap table accordingly.
+ * Data clusters of @old_table (which may be NULL) are overwritten in place
+ * instead of allocating new ones, and are not written at all if their
+ * content does not change.  @old_table must not be referenced by the image
+ * as valid bitmap data, i.e. its bitmap must be marked IN_USE.
  */
 static uint64_t *store_bitmap_data(BlockDriverState *bs,
                                    BdrvDirtyBitmap *bitmap,
+                                   const uint64_t *old_table,
+                                   uint32_t old_table_size,
                                    uint32_t *bitmap_table_size, Error **errp)
 {
     int ret;
@@ -1278,6 +1305,7 @@ static uint64_t *store_bitmap_data(BlockDriverState *bs,
     uint64_t bm_size = bdrv_dirty_bitmap_size(bitmap);
     const char *bm_name = bdrv_dirty_bitmap_name(bitmap);
     uint8_t *buf = NULL;
+    uint8_t *old_buf = NULL;
     uint64_t *tb;
     uint64_t tb_size =
             size_to_clusters(s,
@@ -1297,6 +1325,9 @@ static uint64_t *store_bitmap_data(BlockDriverState *bs,
     }
 
     buf = g_malloc(s->cluster_size);
+    if (old_table) {
+        old_buf = g_malloc(s->cluster_size);
+    }
     limit = bdrv_dirty_bitmap_serialization_coverage(s->cluster_size, bitmap);
     assert(DIV_ROUND_UP(bm_size, limit) == tb_size);
 
@@ -1306,7 +1337,7 @@ static uint64_t *store_bitmap_data(BlockDriverState *bs,
     {
         uint64_t cluster = offset / limit;
         uint64_t end, write_size;
-        int64_t off;
+        int64_t off = 0;
 
         /*
          * We found the first dirty offset, but want to write out the
@@ -1319,20 +1350,32 @@ static uint64_t *store_bitmap_data(BlockDriverState *bs,
                                                           end - offset);
         assert(write_size <= s->cluster_size);
 
-        off = qcow2_alloc_clusters(bs, s->cluster_size);
-        if (off < 0) {
-            error_setg_errno(errp, -off,
-                             "Failed to allocate clusters for bitmap '%s'",
-                             bm_name);
-            goto fail;
-        }
-        tb[cluster] = off;
-
         bdrv_dirty_bitmap_serialize_part(bitmap, buf, offset, end - offset);
         if (write_size < s->cluster_size) {
             memset(buf + write_size, 0, s->cluster_size - write_size);
         }
 
+        if (old_table && cluster < old_table_size) {
+            off = old_table[cluster] & BME_TABLE_ENTRY_OFFSET_MASK;
+        }
+        if (off > 0) {
+            tb[cluster] = off;
+            ret = bdrv_pread(bs->file, off, old_buf, s->cluster_size);
+            if (ret >= 0 && !memcmp(buf, old_buf, s->cluster_size)) {
+                offset = end;
+                continue;
+            }
+        } else {
+            off = qcow2_alloc_clusters(bs, s->cluster_size);
+            if (off < 0) {
+                error_setg_errno(errp, -off,
+                                 "Failed to allocate clusters for bitmap '%s'",
+                                 bm_name);
+                goto fail;
+            }
+            tb[cluster] = off;
+        }
+
         ret = qcow2_pre_write_overlap_check(bs, 0, off, s->cluster_size, false);
         if (ret < 0) {
             error_setg_errno(errp, -ret, "Qcow2 overlap check failed");
@@ -1351,25 +1394,29 @@ static uint64_t *store_bitmap_data(BlockDriverState *bs,
 
     *bitmap_table_size = tb_size;
     g_free(buf);
+    g_free(old_buf);
 
     return tb;
 
 fail:
-    clear_bitmap_table(bs, tb, tb_size);
+    clear_bitmap_table(bs, tb, tb_size, old_table, old_table_size);
     g_free(buf);
+    g_free(old_buf);
     g_free(tb);
 
     return NULL;
 }
 
 /* store_bitmap()
- * Store bm->dirty_bitmap to qcow2.
- * Set bm->table_offset and bm->table_size accordingly.
+ * Store bm->dirty_bitmap to qcow2, reusing the data clusters of
+ * bm->old_table where possible.
+ * Set bm->table and bm->entries accordingly.
  */
 static int store_bitmap(BlockDriverState *bs, Qcow2Bitmap *bm, Error **errp)
 {
     int ret;
     uint64_t *tb;
+    uint64_t *be_tb = NULL;
     int64_t tb_offset;
     uint32_t tb_size;
     BdrvDirtyBitmap *bitmap = bm->dirty_bitmap;
@@ -1379,7 +1426,14 @@ static int store_bitmap(BlockDriverState *bs, Qcow2Bitmap *bm, Error **errp)
 
     bm_name = bdrv_dirty_bitmap_name(bitmap);
 
-    tb = store_bitmap_data(bs, bitmap, &tb_size, errp);
+    if (bm->old_table.offset &&
+        bitmap_table_load(bs, &bm->old_table, &bm->old_entries) < 0) {
+        /* Just don't reuse anything then */
+        bm->old_entries = NULL;
+    }
+
+    tb = store_bitmap_data(bs, bitmap, bm->old_entries, bm->old_table.size,
+                           &tb_size, errp);
     if (tb == NULL) {
         return -EINVAL;
     }
@@ -1401,29 +1455,32 @@ static int store_bitmap(BlockDriverState *bs, Qcow2Bitmap *bm, Error **errp)
         goto fail;
     }
 
-    bitmap_table_to_be(tb, tb_size);
-    ret = bdrv_pwrite(bs->file, tb_offset, tb, tb_size * sizeof(tb[0]));
+    be_tb = g_memdup(tb, tb_size * sizeof(tb[0]));
+    bitmap_table_to_be(be_tb, tb_size);
+    ret = bdrv_pwrite(bs->file, tb_offset, be_tb, tb_size * sizeof(tb[0]));
     if (ret < 0) {
         error_setg_errno(errp, -ret, "Failed to write bitmap '%s' to file",
                          bm_name);
         goto fail;
     }
 
-    g_free(tb);
+    g_free(be_tb);
 
     bm->table.offset = tb_offset;
     bm->table.size = tb_size;
+    bm->entries = tb;
 
     return 0;
 
 fail:
-    clear_bitmap_table(bs, tb, tb_size);
+    clear_bitmap_table(bs, tb, tb_size, bm->old_entries, bm->old_table.size);
 
     if (tb_offset > 0) {
         qcow2_free_clusters(bs, tb_offset, tb_size * sizeof(tb[0]),
                             QCOW2_DISCARD_OTHER);
     }
 
+    g_free(be_tb);
     g_free(tb);
 
     return ret;
@@ -1530,12 +1587,8 @@ bool qcow2_store_persistent_dirty_bitmaps(BlockDriverState *bs,
     int ret;
     Qcow2BitmapList *bm_list;
     Qcow2Bitmap *bm;
-    QSIMPLEQ_HEAD(, Qcow2BitmapTable) drop_tables;
-    Qcow2BitmapTable *tb, *tb_next;
     bool need_write = false;
 
-    QSIMPLEQ_INIT(&drop_tables);
-
     if (s->nb_bitmaps == 0) {
         bm_list = bitmap_list_new();
     } else {
@@ -1599,10 +1652,9 @@ bool qcow2_store_persistent_dirty_bitmaps(BlockDriverState *bs,
                            name);
                 goto fail;
             }
-            tb = g_memdup(&bm->table, sizeof(bm->table));
+            bm->old_table = bm->table;
             bm->table.offset = 0;
             bm->table.size = 0;
-            QSIMPLEQ_INSERT_TAIL(&drop_tables, tb, entry);
         }
         bm->flags = bdrv_dirty_bitmap_enabled(bitmap) ? BME_FLAG_AUTO : 0;
         bm->granularity_bits = ctz32(bdrv_dirty_bitmap_granularity(bitmap));
@@ -1638,11 +1690,23 @@ bool qcow2_store_persistent_dirty_bitmaps(BlockDriverState *bs,
         goto fail;
     }
 
-    /* Bitmap directory was successfully updated, so, old data can be dropped.
-     * TODO it is better to reuse these clusters */
-    QSIMPLEQ_FOREACH_SAFE(tb, &drop_tables, entry, tb_next) {
-        free_bitmap_clusters(bs, tb);
-        g_free(tb);
+    /*
+     * Bitmap directory was successfully updated, so, old data can be dropped,
+     * except for the clusters that the new tables still use.
+     */
+    QSIMPLEQ_FOREACH(bm, bm_list, entry) {
+        if (!bm->old_table.offset) {
+            continue;
+        }
+        if (bm->old_entries) {
+            clear_bitmap_table(bs, bm->old_entries, bm->old_table.size,
+                               bm->entries, bm->table.size);
+            qcow2_free_clusters(bs, bm->old_table.offset,
+                                bm->old_table.size * BME_TABLE_ENTRY_SIZE,
+                                QCOW2_DISCARD_OTHER);
+        } else {
+            free_bitmap_clusters(bs, &bm->old_table);
+        }
     }
 
 success:
@@ -1667,11 +1731,12 @@ fail:
             continue;
         }
 
-        free_bitmap_clusters(bs, &bm->table);
-    }
-
-    QSIMPLEQ_FOREACH_SAFE(tb, &drop_tables, entry, tb_next) {
-        g_free(tb);
+        /* The image still references the old table and its clusters */
+        clear_bitmap_table(bs, bm->entries, bm->table.size,
+                           bm->old_entries, bm->old_table.size);
+        qcow2_free_clusters(bs, bm->table.offset,
+                            bm->table.size * BME_TABLE_ENTRY_SIZE,
+                            QCOW2_DISCARD_OTHER);
     }
 
     bitmap_list_free(bm_list);
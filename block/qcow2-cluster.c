@@ -28,6 +28,7 @@
 #include "qapi/error.h"
 #include "qcow2.h"
 #include "qemu/bswap.h"
+#include "qemu/range.h"
 #include "trace.h"
 
 int qcow2_shrink_l1_table(BlockDriverState *bs, uint64_t exact_size)
@@ -1853,6 +1854,148 @@ again:
     return 0;
 }
 
+/*
+ * Make the cluster at guest @offset point to @host_offset, which the
+ * cluster at guest @src_offset already points to, and increase the
+ * refcount of @host_offset accordingly.  QCOW_OFLAG_COPIED is cleared for
+ * @src_offset, so that neither of the two guest clusters overwrites the
+ * shared data in place.
+ *
+ * Returns -EAGAIN if the clusters are not in a state where this can be
+ * done: @src_offset doesn't point to @host_offset any more, @offset is
+ * allocated, or one of them has an allocation in flight.
+ *
+ * Must be called with s->lock held.  Images with subclusters are not
+ * supported.
+ */
+int qcow2_share_cluster(BlockDriverState *bs, uint64_t src_offset,
+                        uint64_t offset, uint64_t host_offset)
+{
+    BDRVQcow2State *s = bs->opaque;
+    QCowL2Meta *m;
+    QCow2SubclusterType type;
+    uint64_t *l2_slice, l2_entry, cur_host_offset, refcount;
+    unsigned int bytes;
+    int l2_index;
+    int ret;
+
+    assert(!has_subclusters(s));
+    assert(offset_into_cluster(s, src_offset | offset | host_offset) == 0);
+
+    QLIST_FOREACH(m, &s->cluster_allocs, next_in_flight) {
+        uint64_t start = start_of_cluster(s, l2meta_cow_start(m));
+        uint64_t end = ROUND_UP(l2meta_cow_end(m), s->cluster_size);
+
+        if (ranges_overlap(start, end - start, src_offset, s->cluster_size) ||
+            ranges_overlap(start, end - start, offset, s->cluster_size)) {
+            return -EAGAIN;
+        }
+    }
+
+    bytes = s->cluster_size;
+    ret = qcow2_get_host_offset(bs, src_offset, &bytes, &cur_host_offset,
+                                &type);
+    if (ret < 0) {
+        return ret;
+    }
+    if (type != QCOW2_SUBCLUSTER_NORMAL || cur_host_offset != host_offset) {
+        return -EAGAIN;
+    }
+
+    bytes = s->cluster_size;
+    ret = qcow2_get_host_offset(bs, offset, &bytes, &cur_host_offset, &type);
+    if (ret < 0) {
+        return ret;
+    }
+    if (type != QCOW2_SUBCLUSTER_UNALLOCATED_PLAIN &&
+        type != QCOW2_SUBCLUSTER_ZERO_PLAIN) {
+        return -EAGAIN;
+    }
+
+    ret = qcow2_get_refcount(bs, host_offset >> s->cluster_bits, &refcount);
+    if (ret < 0) {
+        return ret;
+    }
+    if (refcount == 0 || refcount >= s->refcount_max) {
+        return -EAGAIN;
+    }
+
+    ret = qcow2_update_cluster_refcount(bs, host_offset >> s->cluster_bits,
+                                        1, false, QCOW2_DISCARD_NEVER);
+    if (ret < 0) {
+        return ret;
+    }
+
+    /* The new reference must not hit the disk before the refcount */
+    qcow2_cache_set_dependency(bs, s->l2_table_cache, s->refcount_block_cache);
+
+    ret = get_cluster_table(bs, src_offset, &l2_slice, &l2_index);
+    if (ret < 0) {
+        return ret;
+    }
+    l2_entry = get_l2_entry(s, l2_slice, l2_index);
+    if (l2_entry & QCOW_OFLAG_COPIED) {
+        qcow2_cache_entry_mark_dirty(s->l2_table_cache, l2_slice);
+        set_l2_entry(s, l2_slice, l2_index, l2_entry & ~QCOW_OFLAG_COPIED);
+    }
+    qcow2_cache_put(s->l2_table_cache, (void **) &l2_slice);
+
+    ret = get_cluster_table(bs, offset, &l2_slice, &l2_index);
+    if (ret < 0) {
+        return ret;
+    }
+    qcow2_cache_entry_mark_dirty(s->l2_table_cache, l2_slice);
+    set_l2_entry(s, l2_slice, l2_index, host_offset);
+    qcow2_cache_put(s->l2_table_cache, (void **) &l2_slice);
+
+    return 0;
+}
+
+/*
+ * Set QCOW_OFLAG_COPIED in the L2 entry of the cluster at guest @offset if
+ * it points to @host_offset, whose refcount the caller has found to be
+ * one.
+ *
+ * Returns 1 if the entry points to @host_offset, 0 if it doesn't and
+ * -errno on failure.  Must be called with s->lock held.
+ */
+int qcow2_set_cluster_copied(BlockDriverState *bs, uint64_t offset,
+                             uint64_t host_offset)
+{
+    BDRVQcow2State *s = bs->opaque;
+    QCow2SubclusterType type;
+    uint64_t *l2_slice, l2_entry, cur_host_offset;
+    unsigned int bytes = s->cluster_size;
+    int l2_index;
+    int ret;
+
+    ret = qcow2_get_host_offset(bs, offset, &bytes, &cur_host_offset, &type);
+    if (ret < 0) {
+        return ret;
+    }
+    if (type != QCOW2_SUBCLUSTER_NORMAL || cur_host_offset != host_offset) {
+        return 0;
+    }
+
+    /* An L2 table shared with a snapshot is not ours to modify */
+    if (!(s->l1_table[offset_to_l1_index(s, offset)] & QCOW_OFLAG_COPIED)) {
+        return 0;
+    }
+
+    ret = get_cluster_table(bs, offset, &l2_slice, &l2_index);
+    if (ret < 0) {
+        return ret;
+    }
+    l2_entry = get_l2_entry(s, l2_slice, l2_index);
+    if (!(l2_entry & QCOW_OFLAG_COPIED)) {
+        qcow2_cache_entry_mark_dirty(s->l2_table_cache, l2_slice);
+        set_l2_entry(s, l2_slice, l2_index, l2_entry | QCOW_OFLAG_COPIED);
+    }
+    qcow2_cache_put(s->l2_table_cache, (void **) &l2_slice);
+
+    return 1;
+}
+
 /*
  * This discards as many clusters of nb_clusters as possible at once (i.e.
  * all clusters in the same L2 slice) and returns the number of discarded
@@ -1963,7 +2106,7 @@ int qcow2_cluster_discard(BlockDriverState *bs, uint64_t offset,
     ret = 0;
 fail:
     s->cache_discards = false;
-    qcow2_process_discards(bs, ret);
+    qcow2_process_discards_batched(bs, ret);
 
     return ret;
 }
@@ -2152,7 +2295,7 @@ int qcow2_subcluster_zeroize(BlockDriverState *bs, uint64_t offset,
     ret = 0;
 fail:
     s->cache_discards = false;
-    qcow2_process_discards(bs, ret);
+    qcow2_process_discards_batched(bs, ret);
 
     return ret;
 }
@@ -0,0 +1,500 @@
+/*
+ * Deduplication of data clusters for the QCOW version 2 format
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+/*
+ * With the dedup option, every full data cluster written to the image is
+ * hashed.  If a cluster with the same digest has been written before and
+ * its data compares equal, the guest cluster is pointed at the existing
+ * host cluster and the refcount of that cluster is increased, instead of
+ * allocating a new one.  This is the same kind of sharing that internal
+ * snapshots use, so the image stays readable by any qcow2 implementation.
+ *
+ * The index lives in memory only and covers the clusters written since the
+ * image was opened, which is what a one-pass writer like qemu-img convert
+ * needs.  Each entry records a host cluster, its digest and the guest
+ * clusters known to point to it:
+ *
+ *  - A host cluster that is shared this way has QCOW_OFLAG_COPIED cleared
+ *    in all L2 entries pointing to it, so writes to any of the guest
+ *    clusters copy it first and its content doesn't change until it is
+ *    freed.  The entry is dropped once that happens.
+ *
+ *  - As long as a host cluster has a single reference with
+ *    QCOW_OFLAG_COPIED set, it may be overwritten in place.  Every write
+ *    forgets the guest clusters it touches before it starts, so an entry
+ *    is never used for a cluster whose content may be changing.
+ *
+ *  - When its refcount drops back to one, the remaining L2 entry must get
+ *    QCOW_OFLAG_COPIED back, as the qcow2 spec requires.  This is done by
+ *    qcow2_co_dedup_fixup() once the caller that dropped the reference is
+ *    done with its metadata update.
+ */
+
+#include "qemu/osdep.h"
+#include "qcow2.h"
+#include "trace.h"
+
+/*
+ * An entry with a single guest cluster costs about 256 bytes with malloc
+ * overhead on a 64-bit host: 64 for Qcow2DedupEntry, 80 for its GArray,
+ * 32 for the dedup_by_guest key and some 80 for the slots of the three
+ * hash tables.  This limits the index to roughly 256 MiB.
+ */
+#define QCOW2_DEDUP_MAX_ENTRIES (1 << 20)
+
+typedef struct Qcow2DedupEntry {
+    uint8_t digest[QCOW2_DEDUP_DIGEST_SIZE];
+    uint64_t host_offset;
+    GArray *guests;         /* guest offsets of the clusters pointing here */
+    uint64_t id;
+} Qcow2DedupEntry;
+
+/* A full cluster write that missed the index and is still in flight */
+typedef struct Qcow2DedupPending {
+    uint8_t digest[QCOW2_DEDUP_DIGEST_SIZE];
+    uint64_t guest_offset;
+    uint64_t id;
+} Qcow2DedupPending;
+
+static guint dedup_digest_hash(gconstpointer key)
+{
+    guint hash;
+
+    /* The digest is uniformly distributed already */
+    memcpy(&hash, key, sizeof(hash));
+    return hash;
+}
+
+static gboolean dedup_digest_equal(gconstpointer a, gconstpointer b)
+{
+    return !memcmp(a, b, QCOW2_DEDUP_DIGEST_SIZE);
+}
+
+static void dedup_entry_free(gpointer data)
+{
+    Qcow2DedupEntry *e = data;
+
+    g_array_free(e->guests, true);
+    g_free(e);
+}
+
+void qcow2_dedup_init(BDRVQcow2State *s)
+{
+    if (s->dedup_by_host) {
+        return;
+    }
+
+    s->dedup_by_hash = g_hash_table_new(dedup_digest_hash, dedup_digest_equal);
+    s->dedup_by_guest = g_hash_table_new_full(g_int64_hash, g_int64_equal,
+                                              g_free, NULL);
+    s->dedup_by_host = g_hash_table_new_full(g_int64_hash, g_int64_equal,
+                                             NULL, dedup_entry_free);
+    s->dedup_pending = g_hash_table_new_full(g_int64_hash, g_int64_equal,
+                                             NULL, g_free);
+    s->dedup_unshared = g_array_new(false, false, sizeof(uint64_t));
+}
+
+void qcow2_dedup_cleanup(BDRVQcow2State *s)
+{
+    if (!s->dedup_by_host) {
+        return;
+    }
+
+    g_hash_table_destroy(s->dedup_by_hash);
+    g_hash_table_destroy(s->dedup_by_guest);
+    g_hash_table_destroy(s->dedup_by_host);
+    g_hash_table_destroy(s->dedup_pending);
+    g_array_free(s->dedup_unshared, true);
+    s->dedup_by_hash = NULL;
+    s->dedup_by_guest = NULL;
+    s->dedup_by_host = NULL;
+    s->dedup_pending = NULL;
+    s->dedup_unshared = NULL;
+}
+
+static void dedup_add_guest(BDRVQcow2State *s, Qcow2DedupEntry *e,
+                            uint64_t offset)
+{
+    g_array_append_val(e->guests, offset);
+    g_hash_table_insert(s->dedup_by_guest, g_memdup(&offset, sizeof(offset)),
+                        e);
+}
+
+static void dedup_entry_remove(BDRVQcow2State *s, Qcow2DedupEntry *e)
+{
+    guint i;
+
+    if (g_hash_table_lookup(s->dedup_by_hash, e->digest) == e) {
+        g_hash_table_remove(s->dedup_by_hash, e->digest);
+    }
+    for (i = 0; i < e->guests->len; i++) {
+        g_hash_table_remove(s->dedup_by_guest,
+                            &g_array_index(e->guests, uint64_t, i));
+    }
+    g_hash_table_remove(s->dedup_by_host, &e->host_offset); /* frees @e */
+}
+
+/* Forget that the guest cluster at @offset points to the host cluster of @e */
+static void dedup_entry_remove_guest(BDRVQcow2State *s, Qcow2DedupEntry *e,
+                                     uint64_t offset)
+{
+    guint i;
+
+    g_hash_table_remove(s->dedup_by_guest, &offset);
+    for (i = 0; i < e->guests->len; i++) {
+        if (g_array_index(e->guests, uint64_t, i) == offset) {
+            g_array_remove_index_fast(e->guests, i);
+            break;
+        }
+    }
+
+    /*
+     * If other guest clusters still share the host cluster, it can't be
+     * overwritten in place and the entry remains valid
+     */
+    if (e->guests->len == 0) {
+        dedup_entry_remove(s, e);
+    }
+}
+
+static void dedup_forget_guest_cluster(BDRVQcow2State *s, uint64_t offset)
+{
+    Qcow2DedupEntry *e;
+
+    g_hash_table_remove(s->dedup_pending, &offset);
+
+    e = g_hash_table_lookup(s->dedup_by_guest, &offset);
+    if (e) {
+        dedup_entry_remove_guest(s, e, offset);
+    }
+}
+
+/*
+ * Must be called before the guest range [@offset, @offset + @bytes) is
+ * written to, zeroed or discarded, so that clusters which may change are
+ * not used for deduplication.
+ */
+void qcow2_dedup_forget_guest(BDRVQcow2State *s, uint64_t offset,
+                              uint64_t bytes)
+{
+    uint64_t start, nb_clusters, i;
+
+    if (!s->dedup_by_host || bytes == 0) {
+        return;
+    }
+
+    start = start_of_cluster(s, offset);
+    nb_clusters = size_to_clusters(s, offset + bytes - start);
+
+    if (nb_clusters > g_hash_table_size(s->dedup_by_guest) +
+                      g_hash_table_size(s->dedup_pending))
+    {
+        g_autoptr(GArray) offsets = g_array_new(false, false,
+                                                sizeof(uint64_t));
+        GHashTableIter iter;
+        gpointer key;
+
+        g_hash_table_iter_init(&iter, s->dedup_by_guest);
+        while (g_hash_table_iter_next(&iter, &key, NULL)) {
+            uint64_t guest_offset = *(uint64_t *)key;
+            if (guest_offset >= start &&
+                guest_offset - start < nb_clusters << s->cluster_bits) {
+                g_array_append_val(offsets, guest_offset);
+            }
+        }
+        g_hash_table_iter_init(&iter, s->dedup_pending);
+        while (g_hash_table_iter_next(&iter, &key, NULL)) {
+            uint64_t guest_offset = *(uint64_t *)key;
+            if (guest_offset >= start &&
+                guest_offset - start < nb_clusters << s->cluster_bits) {
+                g_array_append_val(offsets, guest_offset);
+            }
+        }
+
+        for (i = 0; i < offsets->len; i++) {
+            dedup_forget_guest_cluster(s, g_array_index(offsets, uint64_t, i));
+        }
+        return;
+    }
+
+    for (i = 0; i < nb_clusters; i++) {
+        dedup_forget_guest_cluster(s, start + (i << s->cluster_bits));
+    }
+}
+
+/*
+ * Must be called when the refcount of the host clusters in
+ * [@offset, @offset + @bytes) drops to zero, before they can be reused.
+ */
+void qcow2_dedup_forget_host(BDRVQcow2State *s, uint64_t offset,
+                             uint64_t bytes)
+{
+    uint64_t start, nb_clusters, i;
+    Qcow2DedupEntry *e;
+
+    if (!s->dedup_by_host || bytes == 0) {
+        return;
+    }
+
+    start = start_of_cluster(s, offset);
+    nb_clusters = size_to_clusters(s, offset + bytes - start);
+
+    if (nb_clusters > g_hash_table_size(s->dedup_by_host)) {
+        g_autoptr(GPtrArray) entries = g_ptr_array_new();
+        GHashTableIter iter;
+        gpointer value;
+
+        g_hash_table_iter_init(&iter, s->dedup_by_host);
+        while (g_hash_table_iter_next(&iter, NULL, &value)) {
+            e = value;
+            if (e->host_offset >= start &&
+                e->host_offset - start < nb_clusters << s->cluster_bits) {
+                g_ptr_array_add(entries, e);
+            }
+        }
+        for (i = 0; i < entries->len; i++) {
+            dedup_entry_remove(s, g_ptr_array_index(entries, i));
+        }
+        return;
+    }
+
+    for (i = 0; i < nb_clusters; i++) {
+        uint64_t host_offset = start + (i << s->cluster_bits);
+
+        e = g_hash_table_lookup(s->dedup_by_host, &host_offset);
+        if (e) {
+            dedup_entry_remove(s, e);
+        }
+    }
+}
+
+/*
+ * Called when the refcount of the host cluster at @offset drops to one.
+ * If it was shared by deduplication, the remaining reference needs its
+ * QCOW_OFLAG_COPIED back, see qcow2_co_dedup_fixup().
+ */
+void qcow2_dedup_unshare_host(BDRVQcow2State *s, uint64_t offset)
+{
+    if (s->dedup_by_host && g_hash_table_contains(s->dedup_by_host, &offset)) {
+        g_array_append_val(s->dedup_unshared, offset);
+    }
+}
+
+/*
+ * Set QCOW_OFLAG_COPIED on the L2 entries of deduplicated clusters that
+ * went back to a single reference.  Must be called with s->lock held,
+ * once the caller is done with its own metadata update.
+ */
+int coroutine_fn qcow2_co_dedup_fixup(BlockDriverState *bs)
+{
+    BDRVQcow2State *s = bs->opaque;
+    int ret = 0;
+
+    while (s->dedup_unshared && s->dedup_unshared->len) {
+        uint64_t host_offset =
+            g_array_index(s->dedup_unshared, uint64_t,
+                          s->dedup_unshared->len - 1);
+        Qcow2DedupEntry *e;
+        uint64_t refcount;
+        guint i;
+
+        g_array_set_size(s->dedup_unshared, s->dedup_unshared->len - 1);
+
+        e = g_hash_table_lookup(s->dedup_by_host, &host_offset);
+        if (!e) {
+            continue;
+        }
+
+        ret = qcow2_get_refcount(bs, host_offset >> s->cluster_bits,
+                                 &refcount);
+        if (ret < 0) {
+            break;
+        }
+        if (refcount != 1) {
+            continue;
+        }
+
+        for (i = 0; i < e->guests->len; i++) {
+            ret = qcow2_set_cluster_copied(bs,
+                                           g_array_index(e->guests, uint64_t,
+                                                         i),
+                                           host_offset);
+            if (ret < 0) {
+                break;
+            }
+            if (ret) {
+                trace_qcow2_dedup_unshare(qemu_coroutine_self(),
+                                          g_array_index(e->guests, uint64_t,
+                                                        i),
+                                          host_offset);
+                break;
+            }
+        }
+        if (ret < 0) {
+            break;
+        }
+        ret = 0;
+    }
+
+    return ret;
+}
+
+/*
+ * Try to deduplicate the full, cluster-aligned write of the data in @qiov
+ * at @qiov_offset to guest @offset.
+ *
+ * Returns 1 if the cluster now points to an existing host cluster with
+ * the same data, and nothing more needs to be written.  Returns 0 if the
+ * data must be written normally; in that case, the caller must pass *@id
+ * to qcow2_dedup_commit() once the write is done.  Returns -errno on
+ * error.
+ *
+ * Must be called with s->lock not held.
+ */
+int coroutine_fn qcow2_co_dedup_write(BlockDriverState *bs, uint64_t offset,
+                                      QEMUIOVector *qiov, size_t qiov_offset,
+                                      uint64_t *id)
+{
+    BDRVQcow2State *s = bs->opaque;
+    uint8_t digest[QCOW2_DEDUP_DIGEST_SIZE];
+    Qcow2DedupPending *p;
+    Qcow2DedupEntry *e;
+    uint64_t entry_id, src_offset, host_offset;
+    uint8_t *buf;
+    int ret;
+
+    assert(offset_into_cluster(s, offset) == 0);
+    *id = 0;
+
+    buf = qemu_try_blockalign(s->data_file->bs, 2 * s->cluster_size);
+    if (!buf) {
+        return 0;
+    }
+    qemu_iovec_to_buf(qiov, qiov_offset, buf, s->cluster_size);
+
+    ret = qcow2_co_hash(bs, buf, s->cluster_size, digest);
+    if (ret < 0) {
+        ret = 0;
+        goto out;
+    }
+
+    e = g_hash_table_lookup(s->dedup_by_hash, digest);
+    if (!e) {
+        ret = 0;
+        goto miss;
+    }
+    entry_id = e->id;
+    src_offset = g_array_index(e->guests, uint64_t, 0);
+    host_offset = e->host_offset;
+
+    /* A matching digest is not proof, compare the data itself */
+    BLKDBG_EVENT(bs->file, BLKDBG_READ_AIO);
+    ret = bdrv_co_pread(s->data_file, host_offset, s->cluster_size,
+                        buf + s->cluster_size, 0);
+    if (ret < 0 || memcmp(buf, buf + s->cluster_size, s->cluster_size)) {
+        ret = 0;
+        goto miss;
+    }
+
+    qemu_co_mutex_lock(&s->lock);
+    /* Anything may have happened to the entry while we were reading */
+    e = g_hash_table_lookup(s->dedup_by_hash, digest);
+    if (e && e->id == entry_id &&
+        !g_hash_table_contains(s->dedup_by_guest, &offset))
+    {
+        ret = qcow2_share_cluster(bs, src_offset, offset, host_offset);
+        if (ret == 0) {
+            dedup_add_guest(s, e, offset);
+        }
+    } else {
+        ret = -EAGAIN;
+    }
+    qemu_co_mutex_unlock(&s->lock);
+
+    if (ret == 0) {
+        trace_qcow2_dedup_hit(qemu_coroutine_self(), offset, host_offset);
+        ret = 1;
+        goto out;
+    } else if (ret != -EAGAIN) {
+        goto out;
+    }
+    ret = 0;
+
+miss:
+    if (g_hash_table_size(s->dedup_by_host) +
+        g_hash_table_size(s->dedup_pending) < QCOW2_DEDUP_MAX_ENTRIES)
+    {
+        p = g_new(Qcow2DedupPending, 1);
+        memcpy(p->digest, digest, sizeof(p->digest));
+        p->guest_offset = offset;
+        p->id = ++s->dedup_next_id;
+        g_hash_table_replace(s->dedup_pending, &p->guest_offset, p);
+        *id = p->id;
+    }
+
+out:
+    qemu_vfree(buf);
+    return ret;
+}
+
+/*
+ * Add the cluster written at guest @offset to the index once its write to
+ * @host_offset has completed with @ret.  @id is what qcow2_co_dedup_write()
+ * returned for it.
+ */
+void qcow2_dedup_commit(BDRVQcow2State *s, uint64_t offset,
+                        uint64_t host_offset, uint64_t id, int ret)
+{
+    Qcow2DedupPending *p;
+    Qcow2DedupEntry *e;
+
+    if (!id || !s->dedup_pending) {
+        return;
+    }
+
+    p = g_hash_table_lookup(s->dedup_pending, &offset);
+    if (!p || p->id != id) {
+        /* Written again or discarded meanwhile */
+        return;
+    }
+
+    if (ret >= 0 && !g_hash_table_contains(s->dedup_by_hash, p->digest) &&
+        !g_hash_table_contains(s->dedup_by_guest, &offset))
+    {
+        e = g_hash_table_lookup(s->dedup_by_host, &host_offset);
+        if (e) {
+            dedup_entry_remove(s, e);
+        }
+
+        e = g_new(Qcow2DedupEntry, 1);
+        memcpy(e->digest, p->digest, sizeof(e->digest));
+        e->host_offset = host_offset;
+        e->id = p->id;
+        e->guests = g_array_new(false, false, sizeof(uint64_t));
+
+        g_hash_table_insert(s->dedup_by_host, &e->host_offset, e);
+        g_hash_table_insert(s->dedup_by_hash, e->digest, e);
+        dedup_add_guest(s, e, offset);
+    }
+
+    g_hash_table_remove(s->dedup_pending, &offset);
+}
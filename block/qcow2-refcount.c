@@ -747,6 +747,23 @@ void qcow2_process_discards(BlockDriverState *bs, int ret)
 
         g_free(d);
     }
+    s->nb_discards = 0;
+}
+
+/*
+ * Called where qcow2_process_discards() would be at the end of an
+ * operation.  Host discards are only issued once QCOW2_DISCARD_BATCH
+ * regions are queued, so that the many small discards of a guest fstrim
+ * get merged into few large ones.  Anything that may reuse the queued
+ * clusters, and every flush, must process the queue first.
+ */
+void qcow2_process_discards_batched(BlockDriverState *bs, int ret)
+{
+    BDRVQcow2State *s = bs->opaque;
+
+    if (ret < 0 || s->nb_discards >= QCOW2_DISCARD_BATCH) {
+        qcow2_process_discards(bs, ret);
+    }
 }
 
 static void update_refcount_discard(BlockDriverState *bs,
@@ -777,6 +794,7 @@ static void update_refcount_discard(BlockDriverState *bs,
         .bytes  = length,
     };
     QTAILQ_INSERT_TAIL(&s->discards, d, next);
+    s->nb_discards++;
 
 found:
     /* Merge discard requests if they are adjacent now */
@@ -793,6 +811,7 @@ found:
             || d->offset == p->offset + p->bytes);
 
         QTAILQ_REMOVE(&s->discards, p, next);
+        s->nb_discards--;
         d->offset = MIN(d->offset, p->offset);
         d->bytes += p->bytes;
         g_free(p);
@@ -883,9 +902,17 @@ static int QEMU_WARN_UNUSED_RESULT update_refcount(BlockDriverState *bs,
         }
         s->set_refcount(refcount_block, block_index, refcount);
 
+        if (refcount == 1 && decrease) {
+            qcow2_dedup_unshare_host(s, cluster_offset);
+        }
+
         if (refcount == 0) {
             void *table;
 
+            qcow2_drop_decompressed_cluster(s, cluster_offset,
+                                            s->cluster_size);
+            qcow2_dedup_forget_host(s, cluster_offset, s->cluster_size);
+
             table = qcow2_cache_is_table_offset(s->refcount_block_cache,
                                                 offset);
             if (table != NULL) {
@@ -908,7 +935,7 @@ static int QEMU_WARN_UNUSED_RESULT update_refcount(BlockDriverState *bs,
     ret = 0;
 fail:
     if (!s->cache_discards) {
-        qcow2_process_discards(bs, ret);
+        qcow2_process_discards_batched(bs, ret);
     }
 
     /* Write last changed block to disk */
@@ -963,28 +990,94 @@ int qcow2_update_cluster_refcount(BlockDriverState *bs,
 
 
 /* return < 0 if error */
+/*
+ * Counts the free clusters starting at @cluster_index, up to @max of them,
+ * without leaving the refcount block that describes @cluster_index.  The
+ * count is stored in *@nb_free.
+ *
+ * Returns 1 if the count stopped at a cluster that is in use, 0 if it was
+ * only limited by @max or the end of the refcount block, or -errno.
+ */
+static int count_free_clusters(BlockDriverState *bs, uint64_t cluster_index,
+                               uint64_t max, uint64_t *nb_free)
+{
+    BDRVQcow2State *s = bs->opaque;
+    uint64_t refcount_table_index, block_index, n;
+    int64_t refcount_block_offset;
+    void *refcount_block;
+    int ret;
+
+    refcount_table_index = cluster_index >> s->refcount_block_bits;
+    block_index = cluster_index & (s->refcount_block_size - 1);
+    max = MIN(max, s->refcount_block_size - block_index);
+
+    if (refcount_table_index >= s->refcount_table_size) {
+        *nb_free = max;
+        return 0;
+    }
+    refcount_block_offset =
+        s->refcount_table[refcount_table_index] & REFT_OFFSET_MASK;
+    if (!refcount_block_offset) {
+        *nb_free = max;
+        return 0;
+    }
+
+    if (offset_into_cluster(s, refcount_block_offset)) {
+        qcow2_signal_corruption(bs, true, -1, -1, "Refblock offset %#" PRIx64
+                                " unaligned (reftable index: %#" PRIx64 ")",
+                                refcount_block_offset, refcount_table_index);
+        return -EIO;
+    }
+
+    ret = qcow2_cache_get(bs, s->refcount_block_cache, refcount_block_offset,
+                          &refcount_block);
+    if (ret < 0) {
+        return ret;
+    }
+
+    for (n = 0; n < max; n++) {
+        if (s->get_refcount(refcount_block, block_index + n) != 0) {
+            break;
+        }
+    }
+
+    qcow2_cache_put(s->refcount_block_cache, &refcount_block);
+
+    *nb_free = n;
+    return n < max;
+}
+
 static int64_t alloc_clusters_noref(BlockDriverState *bs, uint64_t size,
                                     uint64_t max)
 {
     BDRVQcow2State *s = bs->opaque;
-    uint64_t i, nb_clusters, refcount;
+    uint64_t i, nb_clusters, nb_free;
     int ret;
 
     /* We can't allocate clusters if they may still be queued for discard. */
-    if (s->cache_discards) {
+    if (!QTAILQ_EMPTY(&s->discards)) {
         qcow2_process_discards(bs, 0);
     }
 
     nb_clusters = size_to_clusters(s, size);
-retry:
-    for(i = 0; i < nb_clusters; i++) {
-        uint64_t next_cluster_index = s->free_cluster_index++;
-        ret = qcow2_get_refcount(bs, next_cluster_index, &refcount);
 
+    /*
+     * Look for nb_clusters free clusters in a row, one refcount block at a
+     * time rather than one cache lookup per cluster.  A cluster in use
+     * restarts the search right after it.
+     */
+    for (i = 0; i < nb_clusters; i += nb_free) {
+        ret = count_free_clusters(bs, s->free_cluster_index,
+                                  nb_clusters - i, &nb_free);
         if (ret < 0) {
             return ret;
-        } else if (refcount != 0) {
-            goto retry;
+        }
+
+        s->free_cluster_index += nb_free;
+        if (ret) {
+            s->free_cluster_index++;
+            i = 0;
+            nb_free = 0;
         }
     }
 
@@ -1039,6 +1132,11 @@ int64_t qcow2_alloc_clusters_at(BlockDriverState *bs, uint64_t offset,
         return 0;
     }
 
+    /* We can't allocate clusters if they may still be queued for discard. */
+    if (!QTAILQ_EMPTY(&s->discards)) {
+        qcow2_process_discards(bs, 0);
+    }
+
     do {
         /* Check how many clusters there are free */
         cluster_index = offset >> s->cluster_bits;
@@ -1076,6 +1174,14 @@ int64_t qcow2_alloc_bytes(BlockDriverState *bs, int size)
     assert(size > 0 && size <= s->cluster_size);
     assert(!s->free_byte_offset || offset_into_cluster(s, s->free_byte_offset));
 
+    /*
+     * The partially used cluster may have been freed and queued for
+     * discard since; if so, we are about to reuse it.
+     */
+    if (!QTAILQ_EMPTY(&s->discards)) {
+        qcow2_process_discards(bs, 0);
+    }
+
     offset = s->free_byte_offset;
 
     if (offset) {
@@ -1208,6 +1314,8 @@ int coroutine_fn qcow2_write_caches(BlockDriverState *bs)
     BDRVQcow2State *s = bs->opaque;
     int ret;
 
+    qcow2_process_discards(bs, 0);
+
     ret = qcow2_cache_write(bs, s->l2_table_cache);
     if (ret < 0) {
         return ret;
@@ -2364,6 +2472,8 @@ static int rebuild_refcount_structure(BlockDriverState *bs,
     } QEMU_PACKED reftable_offset_and_clusters;
 
     qcow2_cache_empty(bs, s->refcount_block_cache);
+    qcow2_drop_decompressed_cluster(s, 0, INT64_MAX);
+    qcow2_dedup_forget_host(s, 0, INT64_MAX);
 
 write_refblocks:
     for (; cluster < *nb_clusters; cluster++) {
@@ -2546,6 +2656,9 @@ int qcow2_check_refcounts(BlockDriverState *bs, BdrvCheckResult *res,
     bool rebuild = false;
     int ret;
 
+    /* Rebuilding the refcounts may reuse clusters queued for discard */
+    qcow2_process_discards(bs, 0);
+
     size = bdrv_getlength(bs->file->bs);
     if (size < 0) {
         res->check_errors++;
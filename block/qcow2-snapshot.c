@@ -783,6 +783,9 @@ int qcow2_snapshot_goto(BlockDriverState *bs, const char *snapshot_id)
         goto fail;
     }
 
+    /* Every guest cluster may point somewhere else afterwards */
+    qcow2_dedup_forget_guest(s, 0, INT64_MAX);
+
     if (sn->disk_size != bs->total_sectors * BDRV_SECTOR_SIZE) {
         BlockBackend *blk = blk_new_with_bs(bs, BLK_PERM_RESIZE, BLK_PERM_ALL,
                                             &local_err);
@@ -36,6 +36,7 @@
 #include "qcow2.h"
 #include "block/thread-pool.h"
 #include "crypto.h"
+#include "crypto/hash.h"
 
 static int coroutine_fn
 qcow2_co_process(BlockDriverState *bs, ThreadPoolFunc *func, void *arg)
@@ -45,7 +46,7 @@ qcow2_co_process(BlockDriverState *bs, ThreadPoolFunc *func, void *arg)
     ThreadPool *pool = aio_get_thread_pool(bdrv_get_aio_context(bs));
 
     qemu_co_mutex_lock(&s->lock);
-    while (s->nb_threads >= QCOW2_MAX_THREADS) {
+    while (s->nb_threads >= s->max_threads) {
         qemu_co_queue_wait(&s->thread_task_queue, &s->lock);
     }
     s->nb_threads++;
@@ -525,3 +526,48 @@ qcow2_co_decrypt(BlockDriverState *bs, uint64_t host_offset,
     return qcow2_co_encdec(bs, host_offset, guest_offset, buf, len,
                            qcrypto_block_decrypt);
 }
+
+typedef struct Qcow2HashData {
+    const void *buf;
+    size_t len;
+    uint8_t *digest;
+} Qcow2HashData;
+
+static int qcow2_hash_pool_func(void *opaque)
+{
+    Qcow2HashData *data = opaque;
+    g_autofree uint8_t *result = NULL;
+    size_t result_len;
+    int ret;
+
+    ret = qcrypto_hash_bytes(QCRYPTO_HASH_ALG_SHA256, data->buf, data->len,
+                             &result, &result_len, NULL);
+    if (ret < 0) {
+        return -EIO;
+    }
+    assert(result_len == QCOW2_DEDUP_DIGEST_SIZE);
+    memcpy(data->digest, result, QCOW2_DEDUP_DIGEST_SIZE);
+
+    return 0;
+}
+
+/*
+ * qcow2_co_hash()
+ *
+ * Computes the SHA-256 digest of @len bytes at @buf into @digest, which
+ * must have room for QCOW2_DEDUP_DIGEST_SIZE bytes.
+ *
+ * Returns 0 on success, -errno on failure.
+ */
+int coroutine_fn
+qcow2_co_hash(BlockDriverState *bs, const void *buf, size_t len,
+              uint8_t *digest)
+{
+    Qcow2HashData arg = {
+        .buf = buf,
+        .len = len,
+        .digest = digest,
+    };
+
+    return qcow2_co_process(bs, qcow2_hash_pool_func, &arg);
+}
@@ -37,6 +37,7 @@
 #include "trace.h"
 #include "qemu/option_int.h"
 #include "qemu/cutils.h"
+#include "qemu/range.h"
 #include "qemu/bswap.h"
 #include "qapi/qobject-input-visitor.h"
 #include "qapi/qapi-visit-block-core.h"
@@ -316,7 +317,7 @@ static int qcow2_read_extensions(BlockDriverState *bs, uint64_t start_offset,
             }
             s->crypto = qcrypto_block_open(s->crypto_opts, "encrypt.",
                                            qcow2_crypto_hdr_read_func,
-                                           bs, cflags, QCOW2_MAX_THREADS, errp);
+                                           bs, cflags, s->max_threads, errp);
             if (!s->crypto) {
                 return -EINVAL;
             }
@@ -697,6 +698,7 @@ static const char *const mutable_opts[] = {
     QCOW2_OPT_L2_CACHE_ENTRY_SIZE,
     QCOW2_OPT_REFCOUNT_CACHE_SIZE,
     QCOW2_OPT_CACHE_CLEAN_INTERVAL,
+    QCOW2_OPT_DEDUP,
     NULL
 };
 
@@ -808,6 +810,11 @@ static QemuOptsList qcow2_runtime_opts = {
             .type = QEMU_OPT_NUMBER,
             .help = "Clean unused cache entries after this time (in seconds)",
         },
+        {
+            .name = QCOW2_OPT_DEDUP,
+            .type = QEMU_OPT_BOOL,
+            .help = "Share host clusters between identical data clusters",
+        },
         BLOCK_CRYPTO_OPT_DEF_KEY_SECRET("encrypt.",
             "ID of secret providing qcow2 AES key or LUKS passphrase"),
         { /* end of list */ }
@@ -969,6 +976,7 @@ typedef struct Qcow2ReopenState {
     int overlap_check;
     bool discard_passthrough[QCOW2_DISCARD_MAX];
     uint64_t cache_clean_interval;
+    bool dedup;
     QCryptoBlockOpenOptions *crypto_opts; /* Disk encryption runtime options */
 } Qcow2ReopenState;
 
@@ -1139,6 +1147,14 @@ static int qcow2_update_options_prepare(BlockDriverState *bs,
     r->discard_passthrough[QCOW2_DISCARD_OTHER] =
         qemu_opt_get_bool(opts, QCOW2_OPT_DISCARD_OTHER, false);
 
+    r->dedup = qemu_opt_get_bool(opts, QCOW2_OPT_DEDUP, false);
+    if (r->dedup && (s->crypt_method_header || has_subclusters(s))) {
+        error_setg(errp, "Deduplication is not supported with encryption "
+                   "or extended L2 entries");
+        ret = -EINVAL;
+        goto fail;
+    }
+
     switch (s->crypt_method_header) {
     case QCOW_CRYPT_NONE:
         if (encryptfmt) {
@@ -1219,6 +1235,13 @@ static void qcow2_update_options_commit(BlockDriverState *bs,
         s->discard_passthrough[i] = r->discard_passthrough[i];
     }
 
+    s->dedup = r->dedup;
+    if (s->dedup) {
+        qcow2_dedup_init(s);
+    } else {
+        qcow2_dedup_cleanup(s);
+    }
+
     if (s->cache_clean_interval != r->cache_clean_interval) {
         cache_clean_timer_del(bs);
         s->cache_clean_interval = r->cache_clean_interval;
@@ -1306,6 +1329,9 @@ static int coroutine_fn qcow2_do_open(BlockDriverState *bs, QDict *options,
     uint64_t l1_vm_state_index;
     bool update_header = false;
 
+    s->max_threads = MIN(MAX(g_get_num_processors(), QCOW2_MIN_THREADS),
+                         QCOW2_MAX_THREADS);
+
     ret = bdrv_pread(bs->file, 0, &header, sizeof(header));
     if (ret < 0) {
         error_setg_errno(errp, -ret, "Could not read qcow2 header");
@@ -1672,7 +1698,7 @@ static int coroutine_fn qcow2_do_open(BlockDriverState *bs, QDict *options,
             }
             s->crypto = qcrypto_block_open(s->crypto_opts, "encrypt.",
                                            NULL, NULL, cflags,
-                                           QCOW2_MAX_THREADS, errp);
+                                           s->max_threads, errp);
             if (!s->crypto) {
                 ret = -EINVAL;
                 goto fail;
@@ -2254,6 +2280,143 @@ static coroutine_fn int qcow2_add_task(BlockDriverState *bs,
     return 0;
 }
 
+/*
+ * Walk from bs->backing down to the cached owner of @e and check that the
+ * chain still looks the way it did when @e was filled in: same shape, no
+ * layer written to since and none of them too short to cover @e.
+ */
+static bool qcow2_backing_extent_valid(BlockDriverState *bs,
+                                       const Qcow2BackingExtent *e)
+{
+    BdrvChild *c = bs->backing;
+    uint64_t gen = 0;
+    int depth = 0;
+
+    while (c != e->owner) {
+        if (!c || !c->bs->backing || depth == e->depth ||
+            c->bs->total_sectors * BDRV_SECTOR_SIZE < e->offset + e->bytes) {
+            return false;
+        }
+        gen += qatomic_read(&c->bs->write_gen);
+        depth++;
+        c = c->bs->backing;
+    }
+
+    return depth == e->depth && gen == e->gen;
+}
+
+/*
+ * Find the layer of the backing chain that holds [@offset, @offset + @bytes)
+ * and return the backing child pointing to it.  *@pnum is set to the number
+ * of bytes from @offset that it holds.  Returns NULL if the chain can't be
+ * skipped, in which case the caller reads through bs->backing as usual.
+ */
+static coroutine_fn BdrvChild *
+qcow2_find_backing_owner(BlockDriverState *bs, uint64_t offset,
+                         uint64_t bytes, uint64_t *pnum)
+{
+    BDRVQcow2State *s = bs->opaque;
+    Qcow2BackingExtent *e;
+    BdrvChild *c;
+    uint64_t gen = 0;
+    int64_t n = bytes;
+    int depth = 0;
+    int i, ret;
+
+    for (i = 0; i < QCOW2_BACKING_CACHE_SIZE; i++) {
+        e = &s->backing_cache[i];
+        if (e->owner && offset >= e->offset &&
+            offset < e->offset + e->bytes &&
+            qcow2_backing_extent_valid(bs, e))
+        {
+            *pnum = MIN(bytes, e->offset + e->bytes - offset);
+            return e->owner;
+        }
+    }
+
+    /* The bottom layer holds whatever none of the layers above holds */
+    for (c = bs->backing; c->bs->backing; c = c->bs->backing) {
+        BlockDriverState *layer = c->bs;
+        unsigned int layer_gen = qatomic_read(&layer->write_gen);
+        int64_t layer_pnum;
+
+        if (!layer->drv || layer->drv->is_filter ||
+            layer->total_sectors * BDRV_SECTOR_SIZE < offset + n) {
+            /* Let the normal path deal with filters and short layers */
+            return NULL;
+        }
+
+        ret = bdrv_is_allocated(layer, offset, n, &layer_pnum);
+        if (ret < 0 || layer_pnum == 0) {
+            return NULL;
+        }
+        n = layer_pnum;
+        if (ret) {
+            break;
+        }
+        gen += layer_gen;
+        depth++;
+    }
+
+    /*
+     * Remember it even if bs->backing holds the data itself (depth 0), so
+     * that the next read of the area doesn't query the layer again.
+     */
+    e = &s->backing_cache[s->backing_cache_next];
+    s->backing_cache_next = (s->backing_cache_next + 1) %
+                            QCOW2_BACKING_CACHE_SIZE;
+    *e = (Qcow2BackingExtent) {
+        .offset = offset,
+        .bytes  = n,
+        .owner  = c,
+        .depth  = depth,
+        .gen    = gen,
+    };
+
+    *pnum = n;
+    return c;
+}
+
+/*
+ * Read an area that is unallocated in @bs from its backing chain.  With a
+ * long chain, each layer would look the area up in its own metadata only
+ * to pass the request on to the next one, so remember which layer holds
+ * the data and send the request there directly.
+ */
+static coroutine_fn int qcow2_co_preadv_backing(BlockDriverState *bs,
+                                                uint64_t offset,
+                                                uint64_t bytes,
+                                                QEMUIOVector *qiov,
+                                                size_t qiov_offset)
+{
+    BdrvChild *owner;
+    uint64_t cur_bytes;
+    int ret;
+
+    while (bytes) {
+        owner = NULL;
+        if (bs->backing->bs->backing) {
+            owner = qcow2_find_backing_owner(bs, offset, bytes, &cur_bytes);
+        }
+        if (!owner) {
+            return bdrv_co_preadv_part(bs->backing, offset, bytes,
+                                       qiov, qiov_offset, 0);
+        }
+
+        ret = bdrv_co_preadv_part(owner, offset, cur_bytes,
+                                  qiov, qiov_offset, 0);
+        if (ret < 0) {
+            return ret;
+        }
+
+        offset += cur_bytes;
+        qiov_offset += cur_bytes;
+        bytes -= cur_bytes;
+    }
+
+    return 0;
+}
+
 static coroutine_fn int qcow2_co_preadv_task(BlockDriverState *bs,
                                              QCow2SubclusterType subc_type,
                                              uint64_t host_offset,
@@ -2274,8 +2437,7 @@ static coroutine_fn int qcow2_co_preadv_task(BlockDriverState *bs,
         assert(bs->backing); /* otherwise handled in qcow2_co_preadv_part */
 
         BLKDBG_EVENT(bs->file, BLKDBG_READ_BACKING_AIO);
-        return bdrv_co_preadv_part(bs->backing, offset, bytes,
-                                   qiov, qiov_offset, 0);
+        return qcow2_co_preadv_backing(bs, offset, bytes, qiov, qiov_offset);
 
     case QCOW2_SUBCLUSTER_COMPRESSED:
         return qcow2_co_preadv_compressed(bs, host_offset,
@@ -2577,6 +2739,8 @@ out_unlocked:
 
 out_locked:
     qcow2_handle_l2meta(bs, &l2meta, false);
+    /* Errors only leave QCOW_OFLAG_COPIED unset, which is harmless */
+    qcow2_co_dedup_fixup(bs);
     qemu_co_mutex_unlock(&s->lock);
 
     qemu_vfree(crypt_buf);
@@ -2584,6 +2748,53 @@ out_locked:
     return ret;
 }
 
+/*
+ * Write the full cluster at guest @offset, which must be aligned, sharing
+ * an existing host cluster if one with the same data is known.  Returns
+ * the number of bytes written, which may be less than a cluster, or
+ * -errno on failure.
+ */
+static coroutine_fn int qcow2_co_pwritev_dedup(BlockDriverState *bs,
+                                               uint64_t offset,
+                                               QEMUIOVector *qiov,
+                                               size_t qiov_offset)
+{
+    BDRVQcow2State *s = bs->opaque;
+    unsigned int cur_bytes = s->cluster_size;
+    QCowL2Meta *l2meta = NULL;
+    uint64_t host_offset, id;
+    int ret;
+
+    ret = qcow2_co_dedup_write(bs, offset, qiov, qiov_offset, &id);
+    if (ret < 0) {
+        return ret;
+    } else if (ret) {
+        return s->cluster_size;
+    }
+
+    qemu_co_mutex_lock(&s->lock);
+    ret = qcow2_alloc_host_offset(bs, offset, &cur_bytes, &host_offset,
+                                  &l2meta);
+    if (ret == 0) {
+        ret = qcow2_pre_write_overlap_check(bs, 0, host_offset, cur_bytes,
+                                            true);
+    }
+    if (ret < 0) {
+        qcow2_handle_l2meta(bs, &l2meta, false);
+        qemu_co_mutex_unlock(&s->lock);
+        qcow2_dedup_commit(s, offset, 0, id, ret);
+        return ret;
+    }
+    qemu_co_mutex_unlock(&s->lock);
+
+    ret = qcow2_co_pwritev_task(bs, host_offset, offset, cur_bytes,
+                                qiov, qiov_offset, l2meta);
+    qcow2_dedup_commit(s, offset, host_offset, id,
+                       cur_bytes == s->cluster_size ? ret : -EINVAL);
+
+    return ret < 0 ? ret : cur_bytes;
+}
+
 static coroutine_fn int qcow2_co_pwritev_task_entry(AioTask *task)
 {
     Qcow2AioTask *t = container_of(task, Qcow2AioTask, task);
@@ -2609,6 +2820,8 @@ static coroutine_fn int qcow2_co_pwritev_part(
 
     trace_qcow2_writev_start_req(qemu_coroutine_self(), offset, bytes);
 
+    qcow2_dedup_forget_guest(s, offset, bytes);
+
     while (bytes != 0 && aio_task_pool_status(aio) == 0) {
 
         l2meta = NULL;
@@ -2622,6 +2835,19 @@ static coroutine_fn int qcow2_co_pwritev_part(
                             - offset_in_cluster);
         }
 
+        if (s->dedup && !data_file_is_raw(bs)) {
+            if (offset_in_cluster == 0 && bytes >= s->cluster_size) {
+                ret = qcow2_co_pwritev_dedup(bs, offset, qiov, qiov_offset);
+                if (ret < 0) {
+                    goto fail_nometa;
+                }
+                cur_bytes = ret;
+                goto next;
+            }
+            /* Leave the following full clusters to the above */
+            cur_bytes = MIN(cur_bytes, s->cluster_size - offset_in_cluster);
+        }
+
         qemu_co_mutex_lock(&s->lock);
 
         ret = qcow2_alloc_host_offset(bs, offset, &cur_bytes,
@@ -2649,6 +2875,7 @@ static coroutine_fn int qcow2_co_pwritev_part(
             goto fail_nometa;
         }
 
+next:
         bytes -= cur_bytes;
         offset += cur_bytes;
         qiov_offset += cur_bytes;
@@ -2691,6 +2918,8 @@ static int qcow2_inactivate(BlockDriverState *bs)
                           bdrv_get_device_or_node_name(bs));
     }
 
+    qcow2_process_discards(bs, 0);
+
     ret = qcow2_cache_flush(bs, s->l2_table_cache);
     if (ret) {
         result = ret;
@@ -2726,6 +2955,9 @@ static void qcow2_close(BlockDriverState *bs)
     cache_clean_timer_del(bs);
     qcow2_cache_destroy(s->l2_table_cache);
     qcow2_cache_destroy(s->refcount_block_cache);
+    qemu_vfree(s->decompressed_cluster);
+    s->decompressed_cluster = NULL;
+    qcow2_dedup_cleanup(s);
 
     qcrypto_block_free(s->crypto);
     s->crypto = NULL;
@@ -3950,6 +4182,7 @@ static coroutine_fn int qcow2_co_pwrite_zeroes(BlockDriverState *bs,
         (offset + bytes);
 
     trace_qcow2_pwrite_zeroes_start_req(qemu_coroutine_self(), offset, bytes);
+    qcow2_dedup_forget_guest(s, offset, bytes);
     if (offset + bytes == bs->total_sectors * BDRV_SECTOR_SIZE) {
         tail = 0;
     }
@@ -3989,6 +4222,7 @@ static coroutine_fn int qcow2_co_pwrite_zeroes(BlockDriverState *bs,
 
     /* Whatever is left can use real zero subclusters */
     ret = qcow2_subcluster_zeroize(bs, offset, bytes, flags);
+    qcow2_co_dedup_fixup(bs);
     qemu_co_mutex_unlock(&s->lock);
 
     return ret;
@@ -4016,9 +4250,12 @@ static coroutine_fn int qcow2_co_pdiscard(BlockDriverState *bs,
         }
     }
 
+    qcow2_dedup_forget_guest(s, offset, bytes);
+
     qemu_co_mutex_lock(&s->lock);
     ret = qcow2_cluster_discard(bs, offset, bytes, QCOW2_DISCARD_REQUEST,
                                 false);
+    qcow2_co_dedup_fixup(bs);
     qemu_co_mutex_unlock(&s->lock);
     return ret;
 }
@@ -4121,6 +4358,8 @@ qcow2_co_copy_range_to(BlockDriverState *bs,
 
     assert(!bs->encrypted);
 
+    qcow2_dedup_forget_guest(s, dst_offset, bytes);
+
     qemu_co_mutex_lock(&s->lock);
 
     while (bytes != 0) {
@@ -4228,6 +4467,7 @@ static int coroutine_fn qcow2_co_truncate(BlockDriverState *bs, int64_t offset,
             goto fail;
         }
 
+        qcow2_dedup_forget_guest(s, offset, old_length - offset);
         ret = qcow2_cluster_discard(bs, ROUND_UP(offset, s->cluster_size),
                                     old_length - ROUND_UP(offset,
                                                           s->cluster_size),
@@ -4641,6 +4881,8 @@ qcow2_co_pwritev_compressed_part(BlockDriverState *bs,
         return -ENOTSUP;
     }
 
+    qcow2_dedup_forget_guest(s, offset, bytes);
+
     if (bytes == 0) {
         /*
          * align end of file to a sector boundary to ease reading with
@@ -4710,6 +4952,19 @@ qcow2_co_preadv_compressed(BlockDriverState *bs,
     csize = nb_csectors * QCOW2_COMPRESSED_SECTOR_SIZE -
         (coffset & ~QCOW2_COMPRESSED_SECTOR_MASK);
 
+    /*
+     * Guests usually read a compressed cluster in pieces smaller than the
+     * cluster, so keep the last one decompressed instead of decompressing
+     * it again for every piece.
+     */
+    if (s->decompressed_cluster && s->decompressed_coffset == coffset &&
+        s->decompressed_csize == csize) {
+        qemu_iovec_from_buf(qiov, qiov_offset,
+                            s->decompressed_cluster + offset_in_cluster,
+                            bytes);
+        return 0;
+    }
+
     buf = g_try_malloc(csize);
     if (!buf) {
         return -ENOMEM;
@@ -4730,6 +4985,13 @@ qcow2_co_preadv_compressed(BlockDriverState *bs,
 
     qemu_iovec_from_buf(qiov, qiov_offset, out_buf + offset_in_cluster, bytes);
 
+    /* Other requests may have replaced the cache while we were yielding */
+    qemu_vfree(s->decompressed_cluster);
+    s->decompressed_cluster = out_buf;
+    s->decompressed_coffset = coffset;
+    s->decompressed_csize = csize;
+    out_buf = NULL;
+
 fail:
     qemu_vfree(out_buf);
     g_free(buf);
@@ -4737,6 +4999,22 @@ fail:
     return ret;
 }
 
+/*
+ * Must be called before the image file range [offset, offset + bytes) is
+ * freed, so that compressed data which is rewritten there later is not
+ * mistaken for the cluster we kept decompressed.
+ */
+void qcow2_drop_decompressed_cluster(BDRVQcow2State *s, uint64_t offset,
+                                     uint64_t bytes)
+{
+    if (s->decompressed_cluster &&
+        ranges_overlap(s->decompressed_coffset, s->decompressed_csize,
+                       offset, bytes)) {
+        qemu_vfree(s->decompressed_cluster);
+        s->decompressed_cluster = NULL;
+    }
+}
+
 static int make_completely_empty(BlockDriverState *bs)
 {
     BDRVQcow2State *s = bs->opaque;
@@ -4761,6 +5039,11 @@ static int make_completely_empty(BlockDriverState *bs)
         goto fail;
     }
 
+    /* The new metadata may reuse clusters queued for discard */
+    qcow2_process_discards(bs, 0);
+    qcow2_drop_decompressed_cluster(s, 0, INT64_MAX);
+    qcow2_dedup_forget_host(s, 0, INT64_MAX);
+
     /* Refcounts will be broken utterly */
     ret = qcow2_mark_dirty(bs);
     if (ret < 0) {
@@ -4938,7 +5221,10 @@ static coroutine_fn int qcow2_co_flush_to_os(BlockDriverState *bs)
     int ret;
 
     qemu_co_mutex_lock(&s->lock);
-    ret = qcow2_write_caches(bs);
+    ret = qcow2_co_dedup_fixup(bs);
+    if (ret == 0) {
+        ret = qcow2_write_caches(bs);
+    }
     qemu_co_mutex_unlock(&s->lock);
 
     return ret;
@@ -5203,6 +5489,25 @@ static ImageInfoSpecific *qcow2_get_specific_info(BlockDriverState *bs,
     return spec_info;
 }
 
+static BlockStatsSpecific *qcow2_get_specific_stats(BlockDriverState *bs)
+{
+    BlockStatsSpecific *stats = g_new0(BlockStatsSpecific, 1);
+    BDRVQcow2State *s = bs->opaque;
+
+    stats->driver = BLOCKDEV_DRIVER_QCOW2;
+    stats->u.qcow2.l2_cache = g_new0(Qcow2CacheStats, 1);
+    stats->u.qcow2.refcount_cache = g_new0(Qcow2CacheStats, 1);
+    if (s->l2_table_cache) {
+        qcow2_cache_get_stats(s->l2_table_cache, stats->u.qcow2.l2_cache);
+    }
+    if (s->refcount_block_cache) {
+        qcow2_cache_get_stats(s->refcount_block_cache,
+                              stats->u.qcow2.refcount_cache);
+    }
+
+    return stats;
+}
+
 static int qcow2_has_zero_init(BlockDriverState *bs)
 {
     BDRVQcow2State *s = bs->opaque;
@@ -5965,6 +6270,7 @@ BlockDriver bdrv_qcow2 = {
     .bdrv_measure           = qcow2_measure,
     .bdrv_get_info          = qcow2_get_info,
     .bdrv_get_specific_info = qcow2_get_specific_info,
+    .bdrv_get_specific_stats = qcow2_get_specific_stats,
 
     .bdrv_save_vmstate    = qcow2_save_vmstate,
     .bdrv_load_vmstate    = qcow2_load_vmstate,
@@ -71,6 +71,15 @@
 /* Maximum of parallel sub-request per guest request */
 #define QCOW2_MAX_WORKERS 8
 
+/* Number of queued discard regions that triggers host discards */
+#define QCOW2_DISCARD_BATCH 64
+
+/* Size of the digest used to find duplicate clusters, see qcow2-dedup.c */
+#define QCOW2_DEDUP_DIGEST_SIZE 32
+
+/* Number of backing chain extents remembered, see qcow2_co_preadv_backing() */
+#define QCOW2_BACKING_CACHE_SIZE 16
+
 /* indicate that the refcount of the referenced cluster is exactly one. */
 #define QCOW_OFLAG_COPIED     (1ULL << 63)
 /* indicate that the cluster is compressed (they never have the copied flag) */
@@ -150,6 +159,7 @@
 #define QCOW2_OPT_L2_CACHE_ENTRY_SIZE "l2-cache-entry-size"
 #define QCOW2_OPT_REFCOUNT_CACHE_SIZE "refcount-cache-size"
 #define QCOW2_OPT_CACHE_CLEAN_INTERVAL "cache-clean-interval"
+#define QCOW2_OPT_DEDUP "dedup"
 
 typedef struct QCowHeader {
     uint32_t magic;
@@ -322,7 +332,21 @@ typedef struct Qcow2BitmapHeaderExt {
     uint64_t bitmap_directory_offset;
 } QEMU_PACKED Qcow2BitmapHeaderExt;
 
-#define QCOW2_MAX_THREADS 4
+/*
+ * Number of threads used for compression and encryption: one per host CPU,
+ * but at least QCOW2_MIN_THREADS and at most QCOW2_MAX_THREADS
+ */
+#define QCOW2_MIN_THREADS 4
+#define QCOW2_MAX_THREADS 64
+
+/* A range of the backing chain and the layer that holds its data */
+typedef struct Qcow2BackingExtent {
+    uint64_t offset;
+    uint64_t bytes;
+    BdrvChild *owner;       /* backing child that points to the owning layer */
+    int depth;              /* layers between bs->backing and @owner */
+    uint64_t gen;           /* sum of write_gen of those layers */
+} Qcow2BackingExtent;
 
 typedef struct BDRVQcow2State {
     int cluster_bits;
@@ -348,6 +372,23 @@ typedef struct BDRVQcow2State {
     QEMUTimer *cache_clean_timer;
     unsigned cache_clean_interval;
 
+    /* Last decompressed cluster, see qcow2_co_preadv_compressed() */
+    uint8_t *decompressed_cluster;
+    uint64_t decompressed_coffset;
+    int decompressed_csize;
+
+    Qcow2BackingExtent backing_cache[QCOW2_BACKING_CACHE_SIZE];
+    int backing_cache_next;
+
+    /* Deduplication index, see qcow2-dedup.c */
+    bool dedup;
+    GHashTable *dedup_by_hash;
+    GHashTable *dedup_by_guest;
+    GHashTable *dedup_by_host;
+    GHashTable *dedup_pending;
+    GArray *dedup_unshared;
+    uint64_t dedup_next_id;
+
     QLIST_HEAD(, QCowL2Meta) cluster_allocs;
 
     uint64_t *refcount_table;
@@ -397,6 +438,7 @@ typedef struct BDRVQcow2State {
     void *unknown_header_fields;
     QLIST_HEAD(, Qcow2UnknownHeaderExtension) unknown_header_ext;
     QTAILQ_HEAD (, Qcow2DiscardRegion) discards;
+    int nb_discards;
     bool cache_discards;
 
     /* Backing file path and format as stored in the image (this is not the
@@ -408,6 +450,7 @@ typedef struct BDRVQcow2State {
 
     CoQueue thread_task_queue;
     int nb_threads;
+    int max_threads;
 
     BdrvChild *data_file;
 
@@ -843,6 +886,8 @@ int qcow2_validate_table(BlockDriverState *bs, uint64_t offset,
                          uint64_t entries, size_t entry_len,
                          int64_t max_size_bytes, const char *table_name,
                          Error **errp);
+void qcow2_drop_decompressed_cluster(BDRVQcow2State *s, uint64_t offset,
+                                     uint64_t bytes);
 
 /* qcow2-refcount.c functions */
 int qcow2_refcount_init(BlockDriverState *bs);
@@ -879,6 +924,7 @@ int qcow2_check_refcounts(BlockDriverState *bs, BdrvCheckResult *res,
                           BdrvCheckMode fix);
 
 void qcow2_process_discards(BlockDriverState *bs, int ret);
+void qcow2_process_discards_batched(BlockDriverState *bs, int ret);
 
 int qcow2_check_metadata_overlap(BlockDriverState *bs, int ign, int64_t offset,
                                  int64_t size);
@@ -923,6 +969,11 @@ int qcow2_cluster_discard(BlockDriverState *bs, uint64_t offset,
 int qcow2_subcluster_zeroize(BlockDriverState *bs, uint64_t offset,
                              uint64_t bytes, int flags);
 
+int qcow2_share_cluster(BlockDriverState *bs, uint64_t src_offset,
+                        uint64_t offset, uint64_t host_offset);
+int qcow2_set_cluster_copied(BlockDriverState *bs, uint64_t offset,
+                             uint64_t host_offset);
+
 int qcow2_expand_zero_clusters(BlockDriverState *bs,
                                BlockDriverAmendStatusCB *status_cb,
                                void *cb_opaque);
@@ -973,6 +1024,7 @@ int qcow2_cache_get_empty(BlockDriverState *bs, Qcow2Cache *c, uint64_t offset,
 void qcow2_cache_put(Qcow2Cache *c, void **table);
 void *qcow2_cache_is_table_offset(Qcow2Cache *c, uint64_t offset);
 void qcow2_cache_discard(Qcow2Cache *c, void *table);
+void qcow2_cache_get_stats(Qcow2Cache *c, Qcow2CacheStats *stats);
 
 /* qcow2-bitmap.c functions */
 int qcow2_check_bitmaps_refcounts(BlockDriverState *bs, BdrvCheckResult *res,
@@ -1010,5 +1062,23 @@ qcow2_co_encrypt(BlockDriverState *bs, uint64_t host_offset,
 int coroutine_fn
 qcow2_co_decrypt(BlockDriverState *bs, uint64_t host_offset,
                  uint64_t guest_offset, void *buf, size_t len);
+int coroutine_fn
+qcow2_co_hash(BlockDriverState *bs, const void *buf, size_t len,
+              uint8_t *digest);
+
+/* qcow2-dedup.c functions */
+void qcow2_dedup_init(BDRVQcow2State *s);
+void qcow2_dedup_cleanup(BDRVQcow2State *s);
+void qcow2_dedup_forget_guest(BDRVQcow2State *s, uint64_t offset,
+                              uint64_t bytes);
+void qcow2_dedup_forget_host(BDRVQcow2State *s, uint64_t offset,
+                             uint64_t bytes);
+void qcow2_dedup_unshare_host(BDRVQcow2State *s, uint64_t offset);
+int coroutine_fn qcow2_co_dedup_fixup(BlockDriverState *bs);
+int coroutine_fn qcow2_co_dedup_write(BlockDriverState *bs, uint64_t offset,
+                                      QEMUIOVector *qiov, size_t qiov_offset,
+                                      uint64_t *id);
+void qcow2_dedup_commit(BDRVQcow2State *s, uint64_t offset,
+                        uint64_t host_offset, uint64_t id, int ret);
 
 #endif
@@ -17,6 +17,7 @@
 #include "qemu/cutils.h"
 #include "qemu/module.h"
 #include "qemu/option.h"
+#include "qemu/timer.h"
 #include "block/block_int.h"
 #include "block/coroutines.h"
 #include "block/qdict.h"
@@ -37,6 +38,13 @@
 #define QUORUM_OPT_REWRITE        "rewrite-corrupted"
 #define QUORUM_OPT_READ_PATTERN   "read-pattern"
 
+/* Read pattern "fastest": hedge delay before any latency was measured */
+#define QUORUM_HEDGE_DEFAULT_NS   (10 * SCALE_MS)
+/* ... and its lower bound, so that the jitter of fast children is ignored */
+#define QUORUM_HEDGE_MIN_NS       (500 * SCALE_US)
+/* How long a child whose read failed is avoided */
+#define QUORUM_RETRY_FAILED_NS    NANOSECONDS_PER_SECOND
+
 /* This union holds a vote hash value */
 typedef union QuorumVoteValue {
     uint8_t h[HASH_LENGTH];    /* SHA-256 hash */
@@ -68,9 +76,17 @@ typedef struct QuorumVotes {
     bool (*compare)(QuorumVoteValue *a, QuorumVoteValue *b);
 } QuorumVotes;
 
+/* read latency statistics of one child, for the fastest read pattern */
+typedef struct QuorumChildStats {
+    int64_t avg_ns;        /* moving average of the read latency */
+    int64_t dev_ns;        /* moving mean deviation from avg_ns */
+    int64_t failed_ns;     /* time of the last failed read, 0 if none */
+} QuorumChildStats;
+
 /* the following structure holds the state of one quorum instance */
 typedef struct BDRVQuorumState {
     BdrvChild **children;  /* children BlockDriverStates */
+    QuorumChildStats *child_stats; /* per child, same order as children */
     int num_children;      /* children count */
     unsigned next_child_index;  /* the index of the next child that should
                                  * be added
@@ -144,6 +160,33 @@ typedef struct QuorumCo {
     int idx;
 } QuorumCo;
 
+typedef struct QuorumFastestRead QuorumFastestRead;
+
+/* One of the (at most two) child reads of a hedged read */
+typedef struct QuorumFastestReq {
+    QuorumFastestRead *fr;
+    int idx;                    /* index of the child */
+    uint8_t *buf;
+    QEMUIOVector qiov;
+} QuorumFastestReq;
+
+/*
+ * A hedged read.  The caller may return as soon as one child read
+ * succeeded, so the structure is refcounted and the losing child read
+ * drops the last reference.  The quorum node is kept in flight meanwhile.
+ */
+struct QuorumFastestRead {
+    BlockDriverState *bs;
+    uint64_t offset;
+    uint64_t bytes;
+
+    int refcnt;
+    int running;                /* child reads in flight */
+    int winner;                 /* first successful entry of reqs, or -1 */
+    QemuCoSleep sleep;          /* the caller waiting for a child read */
+    QuorumFastestReq reqs[2];
+};
+
 static void quorum_aio_finalize(QuorumAIOCB *acb)
 {
     g_free(acb->qcrs);
@@ -663,6 +706,189 @@ static int read_fifo_child(QuorumAIOCB *acb)
     return ret;
 }
 
+static void quorum_account_read(BDRVQuorumState *s, int i, int64_t start_ns,
+                                int ret)
+{
+    QuorumChildStats *st = &s->child_stats[i];
+    int64_t now_ns = qemu_clock_get_ns(QEMU_CLOCK_REALTIME);
+    int64_t latency_ns = now_ns - start_ns;
+    int64_t err_ns;
+
+    if (ret < 0) {
+        st->failed_ns = now_ns;
+        return;
+    }
+    st->failed_ns = 0;
+
+    if (!st->avg_ns) {
+        st->avg_ns = MAX(latency_ns, 1);
+        st->dev_ns = latency_ns / 2;
+        return;
+    }
+
+    /* Same estimator as TCP's retransmission timeout (RFC 6298) */
+    err_ns = latency_ns - st->avg_ns;
+    st->avg_ns += err_ns / 8;
+    st->dev_ns += (ABS(err_ns) - st->dev_ns) / 4;
+}
+
+/*
+ * Return the index of the child with the lowest average read latency,
+ * skipping @exclude and the children whose last read failed recently, or
+ * -1 if there is none.  Children that were never read from count as the
+ * fastest, so that they get measured.
+ */
+static int quorum_fastest_child(BDRVQuorumState *s, int exclude)
+{
+    int64_t now_ns = qemu_clock_get_ns(QEMU_CLOCK_REALTIME);
+    int i, best = -1;
+
+    for (i = 0; i < s->num_children; i++) {
+        QuorumChildStats *st = &s->child_stats[i];
+
+        if (i == exclude ||
+            (st->failed_ns && now_ns - st->failed_ns < QUORUM_RETRY_FAILED_NS))
+        {
+            continue;
+        }
+        if (best < 0 || st->avg_ns < s->child_stats[best].avg_ns) {
+            best = i;
+        }
+    }
+
+    return best;
+}
+
+static int64_t quorum_hedge_delay(QuorumChildStats *st)
+{
+    if (!st->avg_ns) {
+        return QUORUM_HEDGE_DEFAULT_NS;
+    }
+    return MAX(st->avg_ns + 4 * st->dev_ns, QUORUM_HEDGE_MIN_NS);
+}
+
+static void quorum_fastest_read_unref(QuorumFastestRead *fr)
+{
+    int i;
+
+    if (--fr->refcnt) {
+        return;
+    }
+    for (i = 0; i < ARRAY_SIZE(fr->reqs); i++) {
+        qemu_vfree(fr->reqs[i].buf);
+    }
+    g_free(fr);
+}
+
+static void coroutine_fn quorum_fastest_read_entry(void *opaque)
+{
+    QuorumFastestReq *req = opaque;
+    QuorumFastestRead *fr = req->fr;
+    BlockDriverState *bs = fr->bs;
+    BDRVQuorumState *s = bs->opaque;
+    BdrvChild *child = s->children[req->idx];
+    int64_t start_ns = qemu_clock_get_ns(QEMU_CLOCK_REALTIME);
+    int ret;
+
+    ret = bdrv_co_preadv(child, fr->offset, fr->bytes, &req->qiov, 0);
+    quorum_account_read(s, req->idx, start_ns, ret);
+    if (ret < 0) {
+        quorum_report_bad(QUORUM_OP_TYPE_READ, fr->offset, fr->bytes,
+                          child->bs->node_name, ret);
+    } else if (fr->winner < 0) {
+        fr->winner = req - fr->reqs;
+    }
+
+    fr->running--;
+    qemu_co_sleep_wake(&fr->sleep);
+    quorum_fastest_read_unref(fr);
+    bdrv_dec_in_flight(bs);
+}
+
+static void quorum_fastest_read_start(QuorumFastestRead *fr, int n, int idx)
+{
+    BDRVQuorumState *s = fr->bs->opaque;
+    QuorumFastestReq *req = &fr->reqs[n];
+    Coroutine *co;
+
+    req->fr = fr;
+    req->idx = idx;
+    req->buf = qemu_blockalign(s->children[idx]->bs, fr->bytes);
+    qemu_iovec_init_buf(&req->qiov, req->buf, fr->bytes);
+
+    fr->refcnt++;
+    fr->running++;
+    bdrv_inc_in_flight(fr->bs);
+    co = qemu_coroutine_create(quorum_fastest_read_entry, req);
+    qemu_coroutine_enter(co);
+}
+
+/*
+ * Read from the fastest child, and also from the second fastest one if the
+ * first is late.  Falls back to the FIFO pattern if both fail.
+ */
+static int read_fastest_child(QuorumAIOCB *acb)
+{
+    BDRVQuorumState *s = acb->bs->opaque;
+    QuorumFastestRead *fr;
+    int first, second, ret;
+
+    first = quorum_fastest_child(s, -1);
+    if (first < 0) {
+        return read_fifo_child(acb);
+    }
+
+    second = quorum_fastest_child(s, first);
+    if (second < 0) {
+        /* Nothing to hedge with, read straight into the caller's buffer */
+        int64_t start_ns = qemu_clock_get_ns(QEMU_CLOCK_REALTIME);
+
+        acb->qcrs[first].bs = s->children[first]->bs;
+        ret = bdrv_co_preadv(s->children[first], acb->offset, acb->bytes,
+                             acb->qiov, 0);
+        quorum_account_read(s, first, start_ns, ret);
+        if (ret < 0) {
+            quorum_report_bad_acb(&acb->qcrs[first], ret);
+            return read_fifo_child(acb);
+        }
+        return 0;
+    }
+
+    fr = g_new0(QuorumFastestRead, 1);
+    fr->bs = acb->bs;
+    fr->offset = acb->offset;
+    fr->bytes = acb->bytes;
+    fr->refcnt = 1;
+    fr->winner = -1;
+
+    quorum_fastest_read_start(fr, 0, first);
+    if (fr->running) {
+        qemu_co_sleep_ns_wakeable(&fr->sleep, QEMU_CLOCK_REALTIME,
+                                  quorum_hedge_delay(&s->child_stats[first]));
+    }
+    if (fr->winner < 0) {
+        /* The first child is late or failed */
+        quorum_fastest_read_start(fr, 1, second);
+    }
+    while (fr->winner < 0 && fr->running) {
+        qemu_co_sleep(&fr->sleep);
+    }
+
+    if (fr->winner >= 0) {
+        qemu_iovec_from_buf(acb->qiov, 0, fr->reqs[fr->winner].buf,
+                            acb->bytes);
+        ret = 0;
+    } else {
+        ret = -EIO;
+    }
+    quorum_fastest_read_unref(fr);
+
+    if (ret < 0) {
+        return read_fifo_child(acb);
+    }
+    return ret;
+}
+
 static int quorum_co_preadv(BlockDriverState *bs, uint64_t offset,
                             uint64_t bytes, QEMUIOVector *qiov, int flags)
 {
@@ -673,10 +899,16 @@ static int quorum_co_preadv(BlockDriverState *bs, uint64_t offset,
     acb->is_read = true;
     acb->children_read = 0;
 
-    if (s->read_pattern == QUORUM_READ_PATTERN_QUORUM) {
+    switch (s->read_pattern) {
+    case QUORUM_READ_PATTERN_QUORUM:
         ret = read_quorum_children(acb);
-    } else {
+        break;
+    case QUORUM_READ_PATTERN_FASTEST:
+        ret = read_fastest_child(acb);
+        break;
+    default:
         ret = read_fifo_child(acb);
+        break;
     }
     quorum_aio_finalize(acb);
 
@@ -904,7 +1136,8 @@ static QemuOptsList quorum_runtime_opts = {
         {
             .name = QUORUM_OPT_READ_PATTERN,
             .type = QEMU_OPT_STRING,
-            .help = "Allowed pattern: quorum, fifo. Quorum is default",
+            .help = "Allowed pattern: quorum, fifo, fastest. "
+                    "Quorum is default",
         },
         { /* end of list */ }
     },
@@ -971,7 +1204,7 @@ static int quorum_open(BlockDriverState *bs, QDict *options, int flags,
                               -EINVAL, NULL);
     }
     if (ret < 0) {
-        error_setg(errp, "Please set read-pattern as fifo or quorum");
+        error_setg(errp, "Please set read-pattern as fifo, fastest or quorum");
         goto exit;
     }
     s->read_pattern = ret;
@@ -997,6 +1230,7 @@ static int quorum_open(BlockDriverState *bs, QDict *options, int flags,
 
     /* allocate the children array */
     s->children = g_new0(BdrvChild *, s->num_children);
+    s->child_stats = g_new0(QuorumChildStats, s->num_children);
     opened = g_new0(bool, s->num_children);
 
     for (i = 0; i < s->num_children; i++) {
@@ -1031,6 +1265,7 @@ close_exit:
         bdrv_unref_child(bs, s->children[i]);
     }
     g_free(s->children);
+    g_free(s->child_stats);
     g_free(opened);
 exit:
     qemu_opts_del(opts);
@@ -1047,6 +1282,7 @@ static void quorum_close(BlockDriverState *bs)
     }
 
     g_free(s->children);
+    g_free(s->child_stats);
 }
 
 static void quorum_add_child(BlockDriverState *bs, BlockDriverState *child_bs,
@@ -1088,6 +1324,9 @@ static void quorum_add_child(BlockDriverState *bs, BlockDriverState *child_bs,
         goto out;
     }
     s->children = g_renew(BdrvChild *, s->children, s->num_children + 1);
+    s->child_stats = g_renew(QuorumChildStats, s->child_stats,
+                             s->num_children + 1);
+    s->child_stats[s->num_children] = (QuorumChildStats) { 0 };
     s->children[s->num_children++] = child;
     quorum_refresh_flags(bs);
 
@@ -1131,7 +1370,11 @@ static void quorum_del_child(BlockDriverState *bs, BdrvChild *child,
     /* We can safely remove this child now */
     memmove(&s->children[i], &s->children[i + 1],
             (s->num_children - i - 1) * sizeof(BdrvChild *));
+    memmove(&s->child_stats[i], &s->child_stats[i + 1],
+            (s->num_children - i - 1) * sizeof(QuorumChildStats));
     s->children = g_renew(BdrvChild *, s->children, --s->num_children);
+    s->child_stats = g_renew(QuorumChildStats, s->child_stats,
+                             s->num_children);
     bdrv_unref_child(bs, child);
 
     quorum_refresh_flags(bs);
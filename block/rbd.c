@@ -61,6 +61,12 @@
 
 #define RBD_ENCRYPTION_LUKS_HEADER_VERIFICATION_LEN 8
 
+/* Number of completions fetched from librbd at a time */
+#define RBD_MAX_POLL_EVENTS 32
+
+/* Value returned by qemu_rbd_diff_iterate_cb() to stop rbd_diff_iterate2() */
+#define QEMU_RBD_EXIT_DIFF_ITERATE2 -9000
+
 static const char rbd_luks_header_verification[
         RBD_ENCRYPTION_LUKS_HEADER_VERIFICATION_LEN] = {
     'L', 'U', 'K', 'S', 0xBA, 0xBE, 0, 1
@@ -88,15 +94,27 @@ typedef struct BDRVRBDState {
     char *namespace;
     uint64_t image_size;
     uint64_t object_size;
+
+    /*
+     * librbd signals completed requests through this eventfd instead of
+     * calling back from its own threads, see qemu_rbd_event_cb().
+     */
+    EventNotifier event_notifier;
+    AioContext *aio_context;
 } BDRVRBDState;
 
 typedef struct RBDTask {
-    BlockDriverState *bs;
     Coroutine *co;
     bool complete;
     int64_t ret;
 } RBDTask;
 
+typedef struct RBDDiffIterateReq {
+    uint64_t offs;
+    uint64_t bytes;
+    bool exists;
+} RBDDiffIterateReq;
+
 static int qemu_rbd_connect(rados_t *cluster, rados_ioctx_t *io_ctx,
                             BlockdevOptionsRbd *opts, bool cache,
                             const char *keypairs, const char *secretid,
@@ -888,6 +906,51 @@ static int qemu_rbd_attempt_legacy_options(QDict *options,
     return r;
 }
 
+/*
+ * Completion handler for all rbd aio calls started from qemu_rbd_start_co().
+ *
+ * librbd queues completed requests and kicks the eventfd, so requests are
+ * completed right here in the AioContext, without a round trip through a
+ * bottom half scheduled from a librbd thread.
+ */
+static void qemu_rbd_event_cb(EventNotifier *e)
+{
+    BDRVRBDState *s = container_of(e, BDRVRBDState, event_notifier);
+    rbd_completion_t comps[RBD_MAX_POLL_EVENTS];
+    int i, n;
+
+    event_notifier_test_and_clear(e);
+    while ((n = rbd_poll_io_events(s->image, comps,
+                                   RBD_MAX_POLL_EVENTS)) > 0) {
+        for (i = 0; i < n; i++) {
+            RBDTask *task = rbd_aio_get_arg(comps[i]);
+
+            task->ret = rbd_aio_get_return_value(comps[i]);
+            rbd_aio_release(comps[i]);
+            task->complete = true;
+            aio_co_wake(task->co);
+        }
+    }
+}
+
+static void qemu_rbd_detach_aio_context(BlockDriverState *bs)
+{
+    BDRVRBDState *s = bs->opaque;
+
+    aio_set_event_notifier(s->aio_context, &s->event_notifier, false,
+                           NULL, NULL);
+}
+
+static void qemu_rbd_attach_aio_context(BlockDriverState *bs,
+                                        AioContext *new_context)
+{
+    BDRVRBDState *s = bs->opaque;
+
+    s->aio_context = new_context;
+    aio_set_event_notifier(new_context, &s->event_notifier, false,
+                           qemu_rbd_event_cb, NULL);
+}
+
 static int qemu_rbd_open(BlockDriverState *bs, QDict *options, int flags,
                          Error **errp)
 {
@@ -999,6 +1062,22 @@ static int qemu_rbd_open(BlockDriverState *bs, QDict *options, int flags,
     /* When extending regular files, we get zeros from the OS */
     bs->supported_truncate_flags = BDRV_REQ_ZERO_WRITE;
 
+    r = event_notifier_init(&s->event_notifier, false);
+    if (r < 0) {
+        error_setg_errno(errp, -r, "failed to create event notifier");
+        goto failed_post_open;
+    }
+    r = rbd_set_image_notification(s->image,
+                                   event_notifier_get_fd(&s->event_notifier),
+                                   EVENT_TYPE_EVENTFD);
+    if (r < 0) {
+        error_setg_errno(errp, -r, "failed to set up completion events for %s",
+                         s->image_name);
+        event_notifier_cleanup(&s->event_notifier);
+        goto failed_post_open;
+    }
+    qemu_rbd_attach_aio_context(bs, bdrv_get_aio_context(bs));
+
     r = 0;
     goto out;
 
@@ -1040,7 +1119,9 @@ static void qemu_rbd_close(BlockDriverState *bs)
 {
     BDRVRBDState *s = bs->opaque;
 
+    qemu_rbd_detach_aio_context(bs);
     rbd_close(s->image);
+    event_notifier_cleanup(&s->event_notifier);
     rados_ioctx_destroy(s->io_ctx);
     g_free(s->snap);
     g_free(s->image_name);
@@ -1063,30 +1144,6 @@ static int qemu_rbd_resize(BlockDriverState *bs, uint64_t size)
     return 0;
 }
 
-static void qemu_rbd_finish_bh(void *opaque)
-{
-    RBDTask *task = opaque;
-    task->complete = true;
-    aio_co_wake(task->co);
-}
-
-/*
- * This is the completion callback function for all rbd aio calls
- * started from qemu_rbd_start_co().
- *
- * Note: this function is being called from a non qemu thread so
- * we need to be careful about what we do here. Generally we only
- * schedule a BH, and do the rest of the io completion handling
- * from qemu_rbd_finish_bh() which runs in a qemu context.
- */
-static void qemu_rbd_completion_cb(rbd_completion_t c, RBDTask *task)
-{
-    task->ret = rbd_aio_get_return_value(c);
-    rbd_aio_release(c);
-    aio_bh_schedule_oneshot(bdrv_get_aio_context(task->bs),
-                            qemu_rbd_finish_bh, task);
-}
-
 static int coroutine_fn qemu_rbd_start_co(BlockDriverState *bs,
                                           uint64_t offset,
                                           uint64_t bytes,
@@ -1095,14 +1152,13 @@ static int coroutine_fn qemu_rbd_start_co(BlockDriverState *bs,
                                           RBDAIOCmd cmd)
 {
     BDRVRBDState *s = bs->opaque;
-    RBDTask task = { .bs = bs, .co = qemu_coroutine_self() };
+    RBDTask task = { .co = qemu_coroutine_self() };
     rbd_completion_t c;
     int r;
 
     assert(!qiov || qiov->size == bytes);
 
-    r = rbd_aio_create_completion(&task,
-                                  (rbd_callback_t) qemu_rbd_completion_cb, &c);
+    r = rbd_aio_create_completion(&task, NULL, &c);
     if (r < 0) {
         return r;
     }
@@ -1212,6 +1268,90 @@ coroutine_fn qemu_rbd_co_pwrite_zeroes(BlockDriverState *bs, int64_t offset,
 }
 #endif
 
+static int qemu_rbd_diff_iterate_cb(uint64_t offs, size_t len,
+                                    int exists, void *opaque)
+{
+    RBDDiffIterateReq *req = opaque;
+
+    /* We do not diff against a snapshot, so only data extents are reported */
+    assert(exists);
+
+    /* Whole-object extents may start before the queried range */
+    if (offs < req->offs) {
+        len -= MIN(len, req->offs - offs);
+        offs = req->offs;
+    }
+    if (!len) {
+        return 0;
+    }
+
+    if (!req->exists && offs > req->offs) {
+        /*
+         * We started in an unallocated area and reached the first allocated
+         * one: req->bytes is the length of the hole before it.
+         */
+        req->bytes = offs - req->offs;
+        return QEMU_RBD_EXIT_DIFF_ITERATE2;
+    }
+
+    if (req->exists && offs > req->offs + req->bytes) {
+        /* We started in allocated data and jumped over a hole */
+        return QEMU_RBD_EXIT_DIFF_ITERATE2;
+    }
+
+    req->bytes = offs + len - req->offs;
+    req->exists = true;
+
+    return 0;
+}
+
+static int coroutine_fn qemu_rbd_co_block_status(BlockDriverState *bs,
+                                                 bool want_zero, int64_t offset,
+                                                 int64_t bytes, int64_t *pnum,
+                                                 int64_t *map,
+                                                 BlockDriverState **file)
+{
+    BDRVRBDState *s = bs->opaque;
+    RBDDiffIterateReq req = { .offs = offset };
+    uint64_t features, flags;
+    int status, r;
+
+    assert(offset + bytes <= s->image_size);
+
+    /* Default to everything allocated */
+    status = BDRV_BLOCK_DATA | BDRV_BLOCK_OFFSET_VALID;
+    *map = offset;
+    *file = bs;
+    *pnum = bytes;
+
+    /* Without a valid object map, diffing would need to read every object */
+    r = rbd_get_features(s->image, &features);
+    if (r < 0 || !(features & RBD_FEATURE_FAST_DIFF)) {
+        return status;
+    }
+    r = rbd_get_flags(s->image, &flags);
+    if (r < 0 || (flags & RBD_FLAG_FAST_DIFF_INVALID)) {
+        return status;
+    }
+
+    r = rbd_diff_iterate2(s->image, NULL, offset, bytes, true, true,
+                          qemu_rbd_diff_iterate_cb, &req);
+    if (r < 0 && r != QEMU_RBD_EXIT_DIFF_ITERATE2) {
+        return status;
+    }
+
+    if (!req.exists) {
+        if (r == 0) {
+            /* No callback at all: the whole range is unallocated */
+            req.bytes = bytes;
+        }
+        status = BDRV_BLOCK_ZERO | BDRV_BLOCK_OFFSET_VALID;
+    }
+
+    *pnum = MIN(req.bytes, bytes);
+    return status;
+}
+
 static int qemu_rbd_getinfo(BlockDriverState *bs, BlockDriverInfo *bdi)
 {
     BDRVRBDState *s = bs->opaque;
@@ -1494,6 +1634,10 @@ static BlockDriver bdrv_rbd = {
 #ifdef LIBRBD_SUPPORTS_WRITE_ZEROES
     .bdrv_co_pwrite_zeroes  = qemu_rbd_co_pwrite_zeroes,
 #endif
+    .bdrv_co_block_status   = qemu_rbd_co_block_status,
+
+    .bdrv_detach_aio_context = qemu_rbd_detach_aio_context,
+    .bdrv_attach_aio_context = qemu_rbd_attach_aio_context,
 
     .bdrv_snapshot_create   = qemu_rbd_snap_create,
     .bdrv_snapshot_delete   = qemu_rbd_snap_remove,
@@ -77,10 +77,18 @@ struct ThrottleGroup {
     bool any_timer_armed[2];
     QEMUClockType clock_type;
 
+    /* Incremented to invalidate the budgets of all members, always with
+     * the lock held.  Members read it with atomic operations. */
+    unsigned budget_gen;
+
     /* This field is protected by the global QEMU mutex */
     QTAILQ_ENTRY(ThrottleGroup) list;
 };
 
+/* Length of the time slice that a member reserves from the group limits
+ * when it gets a budget, see throttle_group_refill_budget(). */
+#define THROTTLE_GROUP_BUDGET_NS SCALE_MS
+
 /* This is protected by the global QEMU mutex */
 static QTAILQ_HEAD(, ThrottleGroup) throttle_groups =
     QTAILQ_HEAD_INITIALIZER(throttle_groups);
@@ -349,6 +357,102 @@ static void schedule_next_request(ThrottleGroupMember *tgm, bool is_write)
     }
 }
 
+/* Return whether any member of the group has throttled requests.
+ *
+ * This assumes that tg->lock is held.
+ *
+ * @tg:        the ThrottleGroup
+ * @is_write:  the type of operation (read/write)
+ */
+static bool throttle_group_has_pending_reqs(ThrottleGroup *tg, bool is_write)
+{
+    ThrottleGroupMember *tgm;
+
+    QLIST_FOREACH(tgm, &tg->head, round_robin) {
+        if (tgm_has_pending_reqs(tgm, is_write)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+/* Reserve a new budget for a ThrottleGroupMember, so that its next requests
+ * can run without taking tg->lock. Whatever is left of the old budget has
+ * already been accounted and is dropped. No budget is given while other
+ * requests of this type are waiting, so that members with a budget do not
+ * run ahead of the round-robin order for long. The budget expires once the
+ * time slice it was reserved for is over, so that a member cannot save it
+ * up for a later burst.
+ *
+ * This assumes that tg->lock is held.
+ *
+ * @tgm:       the current ThrottleGroupMember
+ * @is_write:  the type of operation (read/write)
+ */
+static void throttle_group_refill_budget(ThrottleGroupMember *tgm,
+                                         bool is_write)
+{
+    ThrottleState *ts = tgm->throttle_state;
+    ThrottleGroup *tg = container_of(ts, ThrottleGroup, ts);
+    int64_t now;
+
+    tgm->budget_bytes[is_write] = 0;
+    tgm->budget_units[is_write] = 0;
+
+    if (qatomic_read(&tgm->io_limits_disabled) ||
+        tg->any_timer_armed[is_write] ||
+        throttle_group_has_pending_reqs(tg, is_write)) {
+        return;
+    }
+
+    now = qemu_clock_get_ns(tg->clock_type);
+    if (throttle_reserve_budget(ts, is_write, now, THROTTLE_GROUP_BUDGET_NS,
+                                &tgm->budget_bytes[is_write],
+                                &tgm->budget_units[is_write])) {
+        tgm->budget_op_size = ts->cfg.op_size;
+        tgm->budget_gen = tg->budget_gen;
+        tgm->budget_expire_ns[is_write] = now + THROTTLE_GROUP_BUDGET_NS;
+    }
+}
+
+/* Take an I/O request out of the budget of a ThrottleGroupMember without
+ * taking tg->lock. Return whether the request can be executed right away.
+ *
+ * @tgm:       the current ThrottleGroupMember
+ * @bytes:     the number of bytes for this I/O
+ * @is_write:  the type of operation (read/write)
+ */
+static bool throttle_group_use_budget(ThrottleGroupMember *tgm,
+                                      int64_t bytes, bool is_write)
+{
+    ThrottleGroup *tg = container_of(tgm->throttle_state, ThrottleGroup, ts);
+    double units = 1.0;
+
+    /* pending_reqs is only changed from this member's AioContext, so
+     * checking it without the lock is fine here */
+    if (tgm->budget_gen != qatomic_read(&tg->budget_gen) ||
+        tgm->pending_reqs[is_write]) {
+        return false;
+    }
+
+    /* tg->clock_type never changes once the group is created */
+    if (qemu_clock_get_ns(tg->clock_type) >= tgm->budget_expire_ns[is_write]) {
+        return false;
+    }
+
+    if (tgm->budget_op_size && bytes > tgm->budget_op_size) {
+        units = (double) bytes / tgm->budget_op_size;
+    }
+    if (tgm->budget_bytes[is_write] < bytes ||
+        tgm->budget_units[is_write] < units) {
+        return false;
+    }
+
+    tgm->budget_bytes[is_write] -= bytes;
+    tgm->budget_units[is_write] -= units;
+    return true;
+}
+
 /* Check if an I/O request needs to be throttled, wait and set a timer
  * if necessary, and schedule the next request using a round robin
  * algorithm.
@@ -367,6 +471,11 @@ void coroutine_fn throttle_group_co_io_limits_intercept(ThrottleGroupMember *tgm
 
     assert(bytes >= 0);
 
+    /* Requests covered by the member's budget need not look at the group */
+    if (throttle_group_use_budget(tgm, bytes, is_write)) {
+        return;
+    }
+
     qemu_mutex_lock(&tg->lock);
 
     /* First we check if this I/O has to be throttled. */
@@ -391,6 +500,8 @@ void coroutine_fn throttle_group_co_io_limits_intercept(ThrottleGroupMember *tgm
     /* Schedule the next request */
     schedule_next_request(tgm, is_write);
 
+    throttle_group_refill_budget(tgm, is_write);
+
     qemu_mutex_unlock(&tg->lock);
 }
 
@@ -475,6 +586,7 @@ void throttle_group_config(ThrottleGroupMember *tgm, ThrottleConfig *cfg)
     ThrottleGroup *tg = container_of(ts, ThrottleGroup, ts);
     qemu_mutex_lock(&tg->lock);
     throttle_config(ts, tg->clock_type, cfg);
+    qatomic_inc(&tg->budget_gen);
     qemu_mutex_unlock(&tg->lock);
 
     throttle_group_restart_tgm(tgm);
@@ -548,6 +660,9 @@ void throttle_group_register_tgm(ThrottleGroupMember *tgm,
     tgm->throttle_state = ts;
     tgm->aio_context = ctx;
     qatomic_set(&tgm->restart_pending, 0);
+    memset(tgm->budget_bytes, 0, sizeof(tgm->budget_bytes));
+    memset(tgm->budget_units, 0, sizeof(tgm->budget_units));
+    memset(tgm->budget_expire_ns, 0, sizeof(tgm->budget_expire_ns));
 
     QEMU_LOCK_GUARD(&tg->lock);
     /* If the ThrottleGroup is new set this ThrottleGroupMember as the token */
@@ -0,0 +1,107 @@
+/*
+ * Hot PCs - a sampling profiler reporting where the guest spends its time.
+ *
+ * Unlike hotblocks this does not instrument translated code; each vCPU
+ * is sampled periodically instead, so it can be left enabled for long
+ * runs.  The sampling period can be set with period=<microseconds>.
+ *
+ * License: GNU GPL, version 2 or later.
+ *   See the COPYING file in the top-level directory.
+ */
+#include <inttypes.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <glib.h>
+
+#include <qemu-plugin.h>
+
+QEMU_PLUGIN_EXPORT int qemu_plugin_version = QEMU_PLUGIN_VERSION;
+
+static uint64_t period_us = 1000;
+static int limit = 20;
+static GMutex lock;
+static GHashTable *samples;
+static uint64_t total;
+
+typedef struct {
+    uint64_t pc;
+    uint64_t count;
+} SampleCount;
+
+static gint cmp_count(gconstpointer a, gconstpointer b)
+{
+    const SampleCount *ea = a;
+    const SampleCount *eb = b;
+
+    return ea->count > eb->count ? -1 : 1;
+}
+
+static void plugin_exit(qemu_plugin_id_t id, void *p)
+{
+    g_autoptr(GString) report = g_string_new("collected ");
+    GList *counts, *it;
+    int i;
+
+    g_mutex_lock(&lock);
+    g_string_append_printf(report, "%" PRIu64 " samples\n", total);
+    counts = g_list_sort(g_hash_table_get_values(samples), cmp_count);
+    if (counts) {
+        g_string_append_printf(report, "pc, samples, percent\n");
+        for (i = 0, it = counts; i < limit && it; i++, it = it->next) {
+            SampleCount *rec = it->data;
+
+            g_string_append_printf(report, "0x%016" PRIx64 ", %" PRIu64
+                                   ", %.2f\n", rec->pc, rec->count,
+                                   rec->count * 100.0 / total);
+        }
+        g_list_free(counts);
+    }
+    g_mutex_unlock(&lock);
+
+    qemu_plugin_outs(report->str);
+}
+
+static void vcpu_sample(qemu_plugin_id_t id, unsigned int cpu_index,
+                        uint64_t pc)
+{
+    SampleCount *cnt;
+
+    g_mutex_lock(&lock);
+    cnt = g_hash_table_lookup(samples, &pc);
+    if (!cnt) {
+        cnt = g_new0(SampleCount, 1);
+        cnt->pc = pc;
+        g_hash_table_insert(samples, &cnt->pc, cnt);
+    }
+    cnt->count++;
+    total++;
+    g_mutex_unlock(&lock);
+}
+
+QEMU_PLUGIN_EXPORT
+int qemu_plugin_install(qemu_plugin_id_t id, const qemu_info_t *info,
+                        int argc, char **argv)
+{
+    int i;
+
+    for (i = 0; i < argc; i++) {
+        char *opt = argv[i];
+
+        if (g_str_has_prefix(opt, "period=")) {
+            period_us = g_ascii_strtoull(opt + 7, NULL, 10);
+        } else if (g_str_has_prefix(opt, "limit=")) {
+            limit = g_ascii_strtoull(opt + 6, NULL, 10);
+        } else {
+            fprintf(stderr, "option parsing failed: %s\n", opt);
+            return -1;
+        }
+    }
+
+    samples = g_hash_table_new_full(g_int64_hash, g_int64_equal,
+                                    NULL, g_free);
+
+    qemu_plugin_register_vcpu_sample_cb(id, period_us * 1000, vcpu_sample);
+    qemu_plugin_register_atexit_cb(id, plugin_exit, NULL);
+    return 0;
+}
@@ -436,6 +436,20 @@ int qcrypto_block_cipher_encrypt_helper(QCryptoCipher *cipher,
                                           qcrypto_cipher_encrypt, errp);
 }
 
+/*
+ * Only ESSIV keeps cipher state in the IV generator; plain and plain64
+ * IVs can be computed by several threads at once without taking the
+ * block's mutex for every sector.
+ */
+static QemuMutex *qcrypto_block_ivgen_mutex(QCryptoBlock *block)
+{
+    if (!block->ivgen ||
+        qcrypto_ivgen_get_algorithm(block->ivgen) != QCRYPTO_IVGEN_ALG_ESSIV) {
+        return NULL;
+    }
+    return &block->mutex;
+}
+
 int qcrypto_block_decrypt_helper(QCryptoBlock *block,
                                  int sectorsize,
                                  uint64_t offset,
@@ -447,8 +461,9 @@ int qcrypto_block_decrypt_helper(QCryptoBlock *block,
     QCryptoCipher *cipher = qcrypto_block_pop_cipher(block);
 
     ret = do_qcrypto_block_cipher_encdec(cipher, block->niv, block->ivgen,
-                                         &block->mutex, sectorsize, offset, buf,
-                                         len, qcrypto_cipher_decrypt, errp);
+                                         qcrypto_block_ivgen_mutex(block),
+                                         sectorsize, offset, buf, len,
+                                         qcrypto_cipher_decrypt, errp);
 
     qcrypto_block_push_cipher(block, cipher);
 
@@ -466,8 +481,9 @@ int qcrypto_block_encrypt_helper(QCryptoBlock *block,
     QCryptoCipher *cipher = qcrypto_block_pop_cipher(block);
 
     ret = do_qcrypto_block_cipher_encdec(cipher, block->niv, block->ivgen,
-                                         &block->mutex, sectorsize, offset, buf,
-                                         len, qcrypto_cipher_encrypt, errp);
+                                         qcrypto_block_ivgen_mutex(block),
+                                         sectorsize, offset, buf, len,
+                                         qcrypto_cipher_encrypt, errp);
 
     qcrypto_block_push_cipher(block, cipher);
 
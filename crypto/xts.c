@@ -27,6 +27,12 @@
 #include "qemu/bswap.h"
 #include "crypto/xts.h"
 
+/*
+ * Number of blocks whose tweaks are applied around a single call to the
+ * cipher function; one 512 byte sector.
+ */
+#define XTS_BATCH_BLOCKS 32
+
 typedef union {
     uint8_t b[XTS_BLOCK_SIZE];
     uint64_t u[2];
@@ -99,6 +105,52 @@ static inline void xts_tweak_encdec(const void *ctx,
 }
 
 
+/**
+ * xts_tweak_encdec_blocks:
+ * @param ctxt: the cipher context
+ * @param func: the cipher function
+ * @src: buffer providing the input text of @nblocks blocks
+ * @dst: buffer to output the output text of @nblocks blocks
+ * @nblocks: the number of XTS_BLOCK_SIZE blocks
+ * @iv: the initialization vector tweak of XTS_BLOCK_SIZE bytes
+ *
+ * Encrypt/decrypt consecutive blocks with their tweaks.  This gives the
+ * same result as xts_tweak_encdec() on each block in turn, but the
+ * cipher function is called once for up to XTS_BATCH_BLOCKS blocks,
+ * rather than once per block.
+ */
+static void xts_tweak_encdec_blocks(const void *ctx,
+                                    xts_cipher_func *func,
+                                    const xts_uint128 *src,
+                                    xts_uint128 *dst,
+                                    unsigned long nblocks,
+                                    xts_uint128 *iv)
+{
+    xts_uint128 tweaks[XTS_BATCH_BLOCKS];
+    unsigned long i, n;
+
+    while (nblocks) {
+        n = MIN(nblocks, XTS_BATCH_BLOCKS);
+
+        for (i = 0; i < n; i++) {
+            tweaks[i] = *iv;
+            xts_uint128_xor(&dst[i], &src[i], iv);
+            xts_mult_x(iv);
+        }
+
+        func(ctx, n * XTS_BLOCK_SIZE, dst->b, dst->b);
+
+        for (i = 0; i < n; i++) {
+            xts_uint128_xor(&dst[i], &dst[i], &tweaks[i]);
+        }
+
+        src += n;
+        dst += n;
+        nblocks -= n;
+    }
+}
+
+
 void xts_decrypt(const void *datactx,
                  const void *tweakctx,
                  xts_cipher_func *encfunc,
@@ -129,11 +181,10 @@ void xts_decrypt(const void *datactx,
 
     if (QEMU_PTR_IS_ALIGNED(src, sizeof(uint64_t)) &&
         QEMU_PTR_IS_ALIGNED(dst, sizeof(uint64_t))) {
-        xts_uint128 *S = (xts_uint128 *)src;
-        xts_uint128 *D = (xts_uint128 *)dst;
-        for (i = 0; i < lim; i++, S++, D++) {
-            xts_tweak_encdec(datactx, decfunc, S, D, &T);
-        }
+        xts_tweak_encdec_blocks(datactx, decfunc, (const xts_uint128 *)src,
+                                (xts_uint128 *)dst, lim, &T);
+        src += lim * XTS_BLOCK_SIZE;
+        dst += lim * XTS_BLOCK_SIZE;
     } else {
         xts_uint128 D;
 
@@ -205,11 +256,10 @@ void xts_encrypt(const void *datactx,
 
     if (QEMU_PTR_IS_ALIGNED(src, sizeof(uint64_t)) &&
         QEMU_PTR_IS_ALIGNED(dst, sizeof(uint64_t))) {
-        xts_uint128 *S = (xts_uint128 *)src;
-        xts_uint128 *D = (xts_uint128 *)dst;
-        for (i = 0; i < lim; i++, S++, D++) {
-            xts_tweak_encdec(datactx, encfunc, S, D, &T);
-        }
+        xts_tweak_encdec_blocks(datactx, encfunc, (const xts_uint128 *)src,
+                                (xts_uint128 *)dst, lim, &T);
+        src += lim * XTS_BLOCK_SIZE;
+        dst += lim * XTS_BLOCK_SIZE;
     } else {
         xts_uint128 D;
 
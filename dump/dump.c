@@ -1297,11 +1297,34 @@ static inline bool is_zero_page(const uint8_t *buf, size_t page_size)
     return buffer_is_zero(buf, page_size);
 }
 
+/*
+ * Compress one page with @zstream, which was set up with deflateInit().
+ * This gives the same output as compress2(), without allocating and
+ * freeing the deflate state for every page.
+ */
+static bool dump_zlib_compress(z_stream *zstream, uint8_t *buf_out,
+                               size_t *size_out, const uint8_t *buf,
+                               size_t size)
+{
+    bool done;
+
+    zstream->next_in = (Bytef *)buf;
+    zstream->avail_in = size;
+    zstream->next_out = buf_out;
+    zstream->avail_out = *size_out;
+    done = deflate(zstream, Z_FINISH) == Z_STREAM_END;
+    *size_out = zstream->total_out;
+    deflateReset(zstream);
+    return done;
+}
+
 static void write_dump_pages(DumpState *s, Error **errp)
 {
     int ret = 0;
     DataCache page_desc, page_data;
     size_t len_buf_out, size_out;
+    z_stream zstream = {};
+    bool zstream_ready = false;
 #ifdef CONFIG_LZO
     lzo_bytep wrkmem = NULL;
 #endif
@@ -1329,6 +1352,14 @@ static void write_dump_pages(DumpState *s, Error **errp)
 
     buf_out = g_malloc(len_buf_out);
 
+    if (s->flag_compress & DUMP_DH_COMPRESSED_ZLIB) {
+        if (deflateInit(&zstream, Z_BEST_SPEED) != Z_OK) {
+            error_setg(errp, "dump: failed to initialize zlib");
+            goto out;
+        }
+        zstream_ready = true;
+    }
+
     /*
      * init zero page's page_desc and page_data, because every zero page
      * uses the same page_data
@@ -1374,8 +1405,8 @@ static void write_dump_pages(DumpState *s, Error **errp)
              */
              size_out = len_buf_out;
              if ((s->flag_compress & DUMP_DH_COMPRESSED_ZLIB) &&
-                    (compress2(buf_out, (uLongf *)&size_out, buf,
-                               s->dump_info.page_size, Z_BEST_SPEED) == Z_OK) &&
+                    dump_zlib_compress(&zstream, buf_out, &size_out, buf,
+                                       s->dump_info.page_size) &&
                     (size_out < s->dump_info.page_size)) {
                 pd.flags = cpu_to_dump32(s, DUMP_DH_COMPRESSED_ZLIB);
                 pd.size  = cpu_to_dump32(s, size_out);
@@ -1459,6 +1490,10 @@ out:
     free_data_cache(&page_desc);
     free_data_cache(&page_data);
 
+    if (zstream_ready) {
+        deflateEnd(&zstream);
+    }
+
 #ifdef CONFIG_LZO
     g_free(wrkmem);
 #endif
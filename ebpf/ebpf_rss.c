@@ -93,6 +93,8 @@ static bool ebpf_rss_set_indirections_table(struct EBPFRSSContext *ctx,
                                             uint16_t *indirections_table,
                                             size_t len)
 {
+    uint32_t keys[VIRTIO_NET_RSS_MAX_TABLE_LEN];
+    uint32_t count = len;
     uint32_t i = 0;
 
     if (!ebpf_rss_is_loaded(ctx) || indirections_table == NULL ||
@@ -100,7 +102,21 @@ static bool ebpf_rss_set_indirections_table(struct EBPFRSSContext *ctx,
         return false;
     }
 
+    /*
+     * The guest may rewrite the whole table whenever it rebalances its
+     * queues; update it with a single system call if the kernel supports
+     * batched map operations, and one entry at a time otherwise.
+     */
     for (; i < len; ++i) {
+        keys[i] = i;
+    }
+    if (len == 0 ||
+        bpf_map_update_batch(ctx->map_indirections_table, keys,
+                             indirections_table, &count, NULL) == 0) {
+        return true;
+    }
+
+    for (i = 0; i < len; ++i) {
         if (bpf_map_update_elem(ctx->map_indirections_table, &i,
                                 indirections_table + i, 0) < 0) {
             return false;
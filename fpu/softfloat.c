@@ -401,6 +401,105 @@ float64_gen2(float64 xa, float64 xb, float_status *s,
     return soft(ua.s, ub.s, s);
 }
 
+/*
+ * Batched variants of the above, for vector helpers.  The float_status
+ * checks are done once per chunk rather than once per element, and the
+ * host operation is done in a loop that the compiler can vectorize.
+ * Any chunk with an input that is not zero-or-normal is redone with the
+ * scalar path, and results that may be tiny are recomputed in softfloat,
+ * so the outcome (including exception flags) matches calling the scalar
+ * function on each element in turn.
+ */
+#define HARDFLOAT_VEC_CHUNK 16
+
+static inline void
+float32_gen2_vec(float32 *d, const float32 *a, const float32 *b, size_t n,
+                 float_status *s, hard_f32_op2_fn hard, soft_f32_op2_fn soft,
+                 f32_check_fn pre, f32_check_fn post)
+{
+    union_float32 ua[HARDFLOAT_VEC_CHUNK], ub[HARDFLOAT_VEC_CHUNK];
+    union_float32 ur[HARDFLOAT_VEC_CHUNK];
+    size_t i, j, k;
+
+    for (i = 0; i < n; i += k) {
+        bool ok = true;
+
+        k = MIN(n - i, HARDFLOAT_VEC_CHUNK);
+        if (unlikely(!can_use_fpu(s) || s->flush_inputs_to_zero)) {
+            ok = false;
+        }
+        for (j = 0; ok && j < k; j++) {
+            ua[j].s = a[i + j];
+            ub[j].s = b[i + j];
+            ok = pre(ua[j], ub[j]);
+        }
+        if (unlikely(!ok)) {
+            for (j = 0; j < k; j++) {
+                d[i + j] = float32_gen2(a[i + j], b[i + j], s,
+                                        hard, soft, pre, post);
+            }
+            continue;
+        }
+
+        for (j = 0; j < k; j++) {
+            ur[j].h = hard(ua[j].h, ub[j].h);
+        }
+        for (j = 0; j < k; j++) {
+            if (unlikely(f32_is_inf(ur[j]))) {
+                float_raise(float_flag_overflow, s);
+            } else if (unlikely(fabsf(ur[j].h) <= FLT_MIN) &&
+                       post(ua[j], ub[j])) {
+                ur[j].s = soft(ua[j].s, ub[j].s, s);
+            }
+            d[i + j] = ur[j].s;
+        }
+    }
+}
+
+static inline void
+float64_gen2_vec(float64 *d, const float64 *a, const float64 *b, size_t n,
+                 float_status *s, hard_f64_op2_fn hard, soft_f64_op2_fn soft,
+                 f64_check_fn pre, f64_check_fn post)
+{
+    union_float64 ua[HARDFLOAT_VEC_CHUNK], ub[HARDFLOAT_VEC_CHUNK];
+    union_float64 ur[HARDFLOAT_VEC_CHUNK];
+    size_t i, j, k;
+
+    for (i = 0; i < n; i += k) {
+        bool ok = true;
+
+        k = MIN(n - i, HARDFLOAT_VEC_CHUNK);
+        if (unlikely(!can_use_fpu(s) || s->flush_inputs_to_zero)) {
+            ok = false;
+        }
+        for (j = 0; ok && j < k; j++) {
+            ua[j].s = a[i + j];
+            ub[j].s = b[i + j];
+            ok = pre(ua[j], ub[j]);
+        }
+        if (unlikely(!ok)) {
+            for (j = 0; j < k; j++) {
+                d[i + j] = float64_gen2(a[i + j], b[i + j], s,
+                                        hard, soft, pre, post);
+            }
+            continue;
+        }
+
+        for (j = 0; j < k; j++) {
+            ur[j].h = hard(ua[j].h, ub[j].h);
+        }
+        for (j = 0; j < k; j++) {
+            if (unlikely(f64_is_inf(ur[j]))) {
+                float_raise(float_flag_overflow, s);
+            } else if (unlikely(fabs(ur[j].h) <= DBL_MIN) &&
+                       post(ua[j], ub[j])) {
+                ur[j].s = soft(ua[j].s, ub[j].s, s);
+            }
+            d[i + j] = ur[j].s;
+        }
+    }
+}
+
 /*
  * Classify a floating point number. Everything above float_class_qnan
  * is a NaN so cls >= float_class_qnan is any NaN.
@@ -1933,6 +2032,38 @@ float64_sub(float64 a, float64 b, float_status *s)
     return float64_addsub(a, b, s, hard_f64_sub, soft_f64_sub);
 }
 
+void QEMU_FLATTEN
+float32_add_vec(float32 *d, const float32 *a, const float32 *b, size_t n,
+                float_status *s)
+{
+    float32_gen2_vec(d, a, b, n, s, hard_f32_add, soft_f32_add,
+                     f32_is_zon2, f32_addsubmul_post);
+}
+
+void QEMU_FLATTEN
+float32_sub_vec(float32 *d, const float32 *a, const float32 *b, size_t n,
+                float_status *s)
+{
+    float32_gen2_vec(d, a, b, n, s, hard_f32_sub, soft_f32_sub,
+                     f32_is_zon2, f32_addsubmul_post);
+}
+
+void QEMU_FLATTEN
+float64_add_vec(float64 *d, const float64 *a, const float64 *b, size_t n,
+                float_status *s)
+{
+    float64_gen2_vec(d, a, b, n, s, hard_f64_add, soft_f64_add,
+                     f64_is_zon2, f64_addsubmul_post);
+}
+
+void QEMU_FLATTEN
+float64_sub_vec(float64 *d, const float64 *a, const float64 *b, size_t n,
+                float_status *s)
+{
+    float64_gen2_vec(d, a, b, n, s, hard_f64_sub, soft_f64_sub,
+                     f64_is_zon2, f64_addsubmul_post);
+}
+
 static bfloat16 QEMU_FLATTEN
 bfloat16_addsub(bfloat16 a, bfloat16 b, float_status *status, bool subtract)
 {
@@ -2064,6 +2195,22 @@ float64_mul(float64 a, float64 b, float_status *s)
                         f64_is_zon2, f64_addsubmul_post);
 }
 
+void QEMU_FLATTEN
+float32_mul_vec(float32 *d, const float32 *a, const float32 *b, size_t n,
+                float_status *s)
+{
+    float32_gen2_vec(d, a, b, n, s, hard_f32_mul, soft_f32_mul,
+                     f32_is_zon2, f32_addsubmul_post);
+}
+
+void QEMU_FLATTEN
+float64_mul_vec(float64 *d, const float64 *a, const float64 *b, size_t n,
+                float_status *s)
+{
+    float64_gen2_vec(d, a, b, n, s, hard_f64_mul, soft_f64_mul,
+                     f64_is_zon2, f64_addsubmul_post);
+}
+
 bfloat16 QEMU_FLATTEN
 bfloat16_mul(bfloat16 a, bfloat16 b, float_status *status)
 {
@@ -1512,6 +1512,8 @@ static void coroutine_fn v9fs_getattr(void *opaque)
     uint64_t request_mask;
     V9fsStatDotl v9stat_dotl;
     V9fsPDU *pdu = opaque;
+    uint64_t st_gen = 0;
+    int gen_err = -ENOTSUP;
 
     retval = pdu_unmarshal(pdu, offset, "dq", &fid, &request_mask);
     if (retval < 0) {
@@ -1526,9 +1528,15 @@ static void coroutine_fn v9fs_getattr(void *opaque)
     }
     /*
      * Currently we only support BASIC fields in stat, so there is no
-     * need to look at request_mask.
+     * need to look at request_mask.  st_gen is fetched along with the
+     * stat if requested, failing to get it is not fatal.
      */
-    retval = v9fs_co_lstat(pdu, &fidp->path, &stbuf);
+    if (request_mask & P9_STATS_GEN) {
+        retval = v9fs_co_lstat_gen(pdu, &fidp->path, &stbuf, &st_gen,
+                                   &gen_err);
+    } else {
+        retval = v9fs_co_lstat(pdu, &fidp->path, &stbuf);
+    }
     if (retval < 0) {
         goto out;
     }
@@ -1536,22 +1544,10 @@ static void coroutine_fn v9fs_getattr(void *opaque)
     if (retval < 0) {
         goto out;
     }
-
-    /*  fill st_gen if requested and supported by underlying fs */
-    if (request_mask & P9_STATS_GEN) {
-        retval = v9fs_co_st_gen(pdu, &fidp->path, stbuf.st_mode, &v9stat_dotl);
-        switch (retval) {
-        case 0:
-            /* we have valid st_gen: update result mask */
-            v9stat_dotl.st_result_mask |= P9_STATS_GEN;
-            break;
-        case -EINTR:
-            /* request cancelled, e.g. by Tflush */
-            goto out;
-        default:
-            /* failed to get st_gen: not fatal, ignore */
-            break;
-        }
+    if (gen_err == 0) {
+        /* we have valid st_gen: update result mask */
+        v9stat_dotl.st_gen = st_gen;
+        v9stat_dotl.st_result_mask |= P9_STATS_GEN;
     }
     retval = pdu_marshal(pdu, offset, "A", &v9stat_dotl);
     if (retval < 0) {
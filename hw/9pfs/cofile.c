@@ -23,31 +23,34 @@
 #include "qemu/main-loop.h"
 #include "coth.h"
 
-int coroutine_fn v9fs_co_st_gen(V9fsPDU *pdu, V9fsPath *path, mode_t st_mode,
-                                V9fsStatDotl *v9stat)
+int coroutine_fn v9fs_co_lstat(V9fsPDU *pdu, V9fsPath *path, struct stat *stbuf)
 {
-    int err = 0;
+    int err;
     V9fsState *s = pdu->s;
 
     if (v9fs_request_cancelled(pdu)) {
         return -EINTR;
     }
-    if (s->ctx.exops.get_st_gen) {
-        v9fs_path_read_lock(s);
-        v9fs_co_run_in_worker(
-            {
-                err = s->ctx.exops.get_st_gen(&s->ctx, path, st_mode,
-                                              &v9stat->st_gen);
-                if (err < 0) {
-                    err = -errno;
-                }
-            });
-        v9fs_path_unlock(s);
-    }
+    v9fs_path_read_lock(s);
+    v9fs_co_run_in_worker(
+        {
+            err = s->ops->lstat(&s->ctx, path, stbuf);
+            if (err < 0) {
+                err = -errno;
+            }
+        });
+    v9fs_path_unlock(s);
     return err;
 }
 
-int coroutine_fn v9fs_co_lstat(V9fsPDU *pdu, V9fsPath *path, struct stat *stbuf)
+/*
+ * Like v9fs_co_lstat(), but also fetch the inode generation in the same
+ * trip to the worker thread.  *gen_err is set to 0 if *st_gen is valid
+ * and to a negative errno otherwise; only the lstat result is returned.
+ */
+int coroutine_fn v9fs_co_lstat_gen(V9fsPDU *pdu, V9fsPath *path,
+                                   struct stat *stbuf, uint64_t *st_gen,
+                                   int *gen_err)
 {
     int err;
     V9fsState *s = pdu->s;
@@ -55,12 +58,19 @@ int coroutine_fn v9fs_co_lstat(V9fsPDU *pdu, V9fsPath *path, struct stat *stbuf)
     if (v9fs_request_cancelled(pdu)) {
         return -EINTR;
     }
+    *gen_err = -ENOTSUP;
     v9fs_path_read_lock(s);
     v9fs_co_run_in_worker(
         {
             err = s->ops->lstat(&s->ctx, path, stbuf);
             if (err < 0) {
                 err = -errno;
+            } else if (s->ctx.exops.get_st_gen) {
+                *gen_err = s->ctx.exops.get_st_gen(&s->ctx, path,
+                                                   stbuf->st_mode, st_gen);
+                if (*gen_err < 0) {
+                    *gen_err = -errno;
+                }
             }
         });
     v9fs_path_unlock(s);
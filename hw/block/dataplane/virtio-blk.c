@@ -258,6 +258,9 @@ int virtio_blk_data_plane_start(VirtIODevice *vdev)
     for (i = 0; i < nvqs; i++) {
         VirtQueue *vq = virtio_get_queue(s->vdev, i);
 
+        virtio_queue_set_notify_coalescing(vq, s->ctx,
+                                           s->conf->coalesce_usecs,
+                                           s->conf->coalesce_frames);
         virtio_queue_aio_set_host_notifier_handler(vq, s->ctx,
                 virtio_blk_data_plane_handle_output);
     }
@@ -303,6 +306,10 @@ static void virtio_blk_data_plane_stop_bh(void *opaque)
         VirtQueue *vq = virtio_get_queue(s->vdev, i);
 
         virtio_queue_aio_set_host_notifier_handler(vq, s->ctx, NULL);
+        /* Send what the IOThread held back while the irqfd is usable */
+        virtio_queue_set_notify_coalescing(vq, qemu_get_aio_context(),
+                                           s->conf->coalesce_usecs,
+                                           s->conf->coalesce_frames);
     }
 }
 
@@ -361,6 +368,14 @@ void virtio_blk_data_plane_stop(VirtIODevice *vdev)
     qemu_bh_cancel(s->bh);
     notify_guest_bh(s); /* final chance to notify guest */
 
+    /* Send the completions of the drain that are still held back */
+    for (i = 0; i < nvqs; i++) {
+        virtio_queue_set_notify_coalescing(virtio_get_queue(s->vdev, i),
+                                           qemu_get_aio_context(),
+                                           s->conf->coalesce_usecs,
+                                           s->conf->coalesce_frames);
+    }
+
     /* Clean up guest notifier (irq) */
     k->set_guest_notifiers(qbus->parent, nvqs, false);
 
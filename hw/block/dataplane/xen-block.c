@@ -43,6 +43,12 @@ typedef struct XenBlockRequest {
     BlockAcctCookie acct;
 } XenBlockRequest;
 
+/*
+ * Maximum number of write requests whose data is fetched from the
+ * frontend with a single grant copy operation.
+ */
+#define XEN_BLOCK_COPY_BATCH 8
+
 struct XenBlockDataPlane {
     XenDevice *xendev;
     XenEventChannel *event_channel;
@@ -62,6 +68,11 @@ struct XenBlockDataPlane {
     QEMUBH *bh;
     IOThread *iothread;
     AioContext *ctx;
+    XenBlockRequest *copy_reqs[XEN_BLOCK_COPY_BATCH];
+    unsigned int nr_copy_reqs;
+    XenDeviceGrantCopySegment copy_segs[XEN_BLOCK_COPY_BATCH *
+                                        BLKIF_MAX_SEGMENTS_PER_REQUEST];
+    unsigned int nr_copy_segs;
 };
 
 static int xen_block_send_response(XenBlockRequest *request);
@@ -204,21 +215,13 @@ err:
     return -1;
 }
 
-static int xen_block_copy_request(XenBlockRequest *request)
+static int xen_block_fill_copy_segs(XenBlockRequest *request,
+                                    XenDeviceGrantCopySegment segs[])
 {
     XenBlockDataPlane *dataplane = request->dataplane;
-    XenDevice *xendev = dataplane->xendev;
-    XenDeviceGrantCopySegment segs[BLKIF_MAX_SEGMENTS_PER_REQUEST];
-    int i, count;
+    int i, count = request->req.nr_segments;
     bool to_domain = (request->req.operation == BLKIF_OP_READ);
     void *virt = request->buf;
-    Error *local_err = NULL;
-
-    if (request->req.nr_segments == 0) {
-        return 0;
-    }
-
-    count = request->req.nr_segments;
 
     for (i = 0; i < count; i++) {
         if (to_domain) {
@@ -238,6 +241,23 @@ static int xen_block_copy_request(XenBlockRequest *request)
         virt += segs[i].len;
     }
 
+    return count;
+}
+
+static int xen_block_copy_request(XenBlockRequest *request)
+{
+    XenBlockDataPlane *dataplane = request->dataplane;
+    XenDevice *xendev = dataplane->xendev;
+    XenDeviceGrantCopySegment segs[BLKIF_MAX_SEGMENTS_PER_REQUEST];
+    int count;
+    bool to_domain = (request->req.operation == BLKIF_OP_READ);
+    Error *local_err = NULL;
+
+    if (request->req.nr_segments == 0) {
+        return 0;
+    }
+
+    count = xen_block_fill_copy_segs(request, segs);
     xen_device_copy_grant_refs(xendev, to_domain, segs, count, &local_err);
 
     if (local_err) {
@@ -250,7 +270,7 @@ static int xen_block_copy_request(XenBlockRequest *request)
     return 0;
 }
 
-static int xen_block_do_aio(XenBlockRequest *request);
+static int xen_block_submit_aio(XenBlockRequest *request);
 
 static void xen_block_complete_aio(void *opaque, int ret)
 {
@@ -269,7 +289,7 @@ static void xen_block_complete_aio(void *opaque, int ret)
     request->aio_inflight--;
     if (request->presync) {
         request->presync = 0;
-        xen_block_do_aio(request);
+        xen_block_submit_aio(request);
         goto done;
     }
     if (request->aio_inflight > 0) {
@@ -353,16 +373,20 @@ static bool xen_block_split_discard(XenBlockRequest *request,
     return true;
 }
 
-static int xen_block_do_aio(XenBlockRequest *request)
+static bool xen_block_needs_copy_in(XenBlockRequest *request)
 {
-    XenBlockDataPlane *dataplane = request->dataplane;
-
-    if (request->req.nr_segments &&
+    return request->req.nr_segments &&
         (request->req.operation == BLKIF_OP_WRITE ||
-         request->req.operation == BLKIF_OP_FLUSH_DISKCACHE) &&
-        xen_block_copy_request(request)) {
-        goto err;
-    }
+         request->req.operation == BLKIF_OP_FLUSH_DISKCACHE);
+}
+
+/*
+ * Submit a request whose write data, if any, is already in request->buf.
+ * This is also where a request resumes after its pre-sync flush.
+ */
+static int xen_block_submit_aio(XenBlockRequest *request)
+{
+    XenBlockDataPlane *dataplane = request->dataplane;
 
     request->aio_inflight++;
     if (request->presync) {
@@ -419,6 +443,64 @@ err:
     return -1;
 }
 
+static int xen_block_do_aio(XenBlockRequest *request)
+{
+    if (xen_block_needs_copy_in(request) &&
+        xen_block_copy_request(request)) {
+        request->status = BLKIF_RSP_ERROR;
+        xen_block_complete_request(request);
+        return -1;
+    }
+
+    return xen_block_submit_aio(request);
+}
+
+/*
+ * Fetch the data of all queued write requests with a single grant copy
+ * and submit them.  If the batched copy fails, fall back to copying each
+ * request on its own so that only the requests with bad segments fail.
+ */
+static void xen_block_flush_copy_batch(XenBlockDataPlane *dataplane)
+{
+    unsigned int i, nr_reqs = dataplane->nr_copy_reqs;
+    Error *local_err = NULL;
+
+    if (!nr_reqs) {
+        return;
+    }
+
+    xen_device_copy_grant_refs(dataplane->xendev, false,
+                               dataplane->copy_segs,
+                               dataplane->nr_copy_segs, &local_err);
+    dataplane->nr_copy_reqs = 0;
+    dataplane->nr_copy_segs = 0;
+
+    for (i = 0; i < nr_reqs; i++) {
+        XenBlockRequest *request = dataplane->copy_reqs[i];
+
+        if (local_err) {
+            xen_block_do_aio(request);
+        } else {
+            xen_block_submit_aio(request);
+        }
+    }
+    error_free(local_err);
+}
+
+static void xen_block_queue_copy(XenBlockDataPlane *dataplane,
+                                 XenBlockRequest *request)
+{
+    XenDeviceGrantCopySegment *segs;
+
+    if (dataplane->nr_copy_reqs == XEN_BLOCK_COPY_BATCH) {
+        xen_block_flush_copy_batch(dataplane);
+    }
+
+    segs = &dataplane->copy_segs[dataplane->nr_copy_segs];
+    dataplane->copy_reqs[dataplane->nr_copy_reqs++] = request;
+    dataplane->nr_copy_segs += xen_block_fill_copy_segs(request, segs);
+}
+
 static int xen_block_send_response(XenBlockRequest *request)
 {
     XenBlockDataPlane *dataplane = request->dataplane;
@@ -573,6 +655,16 @@ static bool xen_block_handle_requests(XenBlockDataPlane *dataplane)
             continue;
         }
 
+        /*
+         * Write data is fetched from the frontend for several requests at
+         * once, which saves a grant copy operation per request.
+         */
+        if (xen_block_needs_copy_in(request)) {
+            xen_block_queue_copy(dataplane, request);
+            continue;
+        }
+        xen_block_flush_copy_batch(dataplane);
+
         if (inflight_atstart > IO_PLUG_THRESHOLD &&
             batched >= inflight_atstart) {
             blk_io_unplug(dataplane->blk);
@@ -587,6 +679,7 @@ static bool xen_block_handle_requests(XenBlockDataPlane *dataplane)
             }
         }
     }
+    xen_block_flush_copy_batch(dataplane);
     if (inflight_atstart > IO_PLUG_THRESHOLD) {
         blk_io_unplug(dataplane->blk);
     }
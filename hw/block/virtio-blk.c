@@ -253,16 +253,6 @@ out:
 
 #endif
 
-static VirtIOBlockReq *virtio_blk_get_request(VirtIOBlock *s, VirtQueue *vq)
-{
-    VirtIOBlockReq *req = virtqueue_pop(vq, sizeof(VirtIOBlockReq));
-
-    if (req) {
-        virtio_blk_init_request(s, vq, req);
-    }
-    return req;
-}
-
 static int virtio_blk_handle_scsi_req(VirtIOBlockReq *req)
 {
     int status = VIRTIO_BLK_S_OK;
@@ -767,12 +757,16 @@ static int virtio_blk_handle_request(VirtIOBlockReq *req, MultiReqBuffer *mrb)
     return 0;
 }
 
+/* Requests popped from the virtqueue at once by virtio_blk_handle_vq() */
+#define VIRTIO_BLK_POP_BATCH 32
+
 bool virtio_blk_handle_vq(VirtIOBlock *s, VirtQueue *vq)
 {
-    VirtIOBlockReq *req;
+    VirtIOBlockReq *reqs[VIRTIO_BLK_POP_BATCH];
     MultiReqBuffer mrb = {};
     bool suppress_notifications = virtio_queue_get_notification(vq);
     bool progress = false;
+    unsigned int i, n;
 
     aio_context_acquire(blk_get_aio_context(s->blk));
     blk_io_plug(s->blk);
@@ -782,11 +776,23 @@ bool virtio_blk_handle_vq(VirtIOBlock *s, VirtQueue *vq)
             virtio_queue_set_notification(vq, 0);
         }
 
-        while ((req = virtio_blk_get_request(s, vq))) {
+        while ((n = virtqueue_pop_batch(vq, sizeof(VirtIOBlockReq),
+                                        (void **)reqs, ARRAY_SIZE(reqs)))) {
             progress = true;
-            if (virtio_blk_handle_request(req, &mrb)) {
-                virtqueue_detach_element(req->vq, &req->elem, 0);
-                virtio_blk_free_request(req);
+            for (i = 0; i < n; i++) {
+                virtio_blk_init_request(s, vq, reqs[i]);
+                if (virtio_blk_handle_request(reqs[i], &mrb)) {
+                    virtqueue_detach_element(vq, &reqs[i]->elem, 0);
+                    virtio_blk_free_request(reqs[i]);
+                    break;
+                }
+            }
+            if (i < n) {
+                /* Give back the requests after the one that failed */
+                while (--n > i) {
+                    virtqueue_unpop(vq, &reqs[n]->elem, 0);
+                    virtio_blk_free_request(reqs[n]);
+                }
                 break;
             }
         }
@@ -1220,7 +1226,12 @@ static void virtio_blk_device_realize(DeviceState *dev, Error **errp)
     s->sector_mask = (s->conf.conf.logical_block_size / BDRV_SECTOR_SIZE) - 1;
 
     for (i = 0; i < conf->num_queues; i++) {
-        virtio_add_queue(vdev, conf->queue_size, virtio_blk_handle_output);
+        VirtQueue *vq = virtio_add_queue(vdev, conf->queue_size,
+                                         virtio_blk_handle_output);
+
+        virtio_queue_set_notify_coalescing(vq, qemu_get_aio_context(),
+                                           conf->coalesce_usecs,
+                                           conf->coalesce_frames);
     }
     virtio_blk_data_plane_create(vdev, conf, &s->dataplane, &err);
     if (err != NULL) {
@@ -1238,6 +1249,9 @@ static void virtio_blk_device_realize(DeviceState *dev, Error **errp)
 
     blk_iostatus_enable(s->blk);
 
+    /* Every request in flight can hold a coroutine in the block layer */
+    qemu_coroutine_inc_pool_size(conf->num_queues * conf->queue_size / 2);
+
     add_boot_device_lchs(dev, "/disk@0,0",
                          conf->conf.lcyls,
                          conf->conf.lheads,
@@ -1252,6 +1266,7 @@ static void virtio_blk_device_unrealize(DeviceState *dev)
     unsigned i;
 
     blk_drain(s->blk);
+    qemu_coroutine_dec_pool_size(conf->num_queues * conf->queue_size / 2);
     del_boot_device_lchs(dev, "/disk@0,0");
     virtio_blk_data_plane_destroy(s->dataplane);
     s->dataplane = NULL;
@@ -1313,6 +1328,10 @@ static Property virtio_blk_properties[] = {
                        conf.max_write_zeroes_sectors, BDRV_REQUEST_MAX_SECTORS),
     DEFINE_PROP_BOOL("x-enable-wce-if-config-wce", VirtIOBlock,
                      conf.x_enable_wce_if_config_wce, true),
+    DEFINE_PROP_UINT32("x-coalesce-usecs", VirtIOBlock,
+                       conf.coalesce_usecs, 0),
+    DEFINE_PROP_UINT32("x-coalesce-frames", VirtIOBlock,
+                       conf.coalesce_frames, 32),
     DEFINE_PROP_END_OF_LIST(),
 };
 
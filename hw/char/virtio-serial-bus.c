@@ -161,6 +161,7 @@ static void do_flush_queued_data(VirtIOSerialPort *port, VirtQueue *vq,
                                  VirtIODevice *vdev)
 {
     VirtIOSerialPortClass *vsc;
+    bool pushed = false;
 
     assert(port);
     assert(virtio_queue_ready(vq));
@@ -207,8 +208,12 @@ static void do_flush_queued_data(VirtIOSerialPort *port, VirtQueue *vq,
         virtqueue_push(vq, port->elem, 0);
         g_free(port->elem);
         port->elem = NULL;
+        pushed = true;
+    }
+    /* A backend that is still throttled may not have consumed anything */
+    if (pushed) {
+        virtio_notify(vdev, vq);
     }
-    virtio_notify(vdev, vq);
 }
 
 static void flush_queued_data(VirtIOSerialPort *port)
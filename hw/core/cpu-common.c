@@ -206,6 +206,14 @@ static void cpu_common_realizefn(DeviceState *dev, Error **errp)
         }
     }
 
+    /*
+     * Plugin initialization queues work on the vCPU, so it must wait
+     * until the vCPU thread exists.
+     */
+    if (tcg_enabled()) {
+        qemu_plugin_vcpu_init_hook(cpu);
+    }
+
     if (dev->hotplugged) {
         cpu_synchronize_post_init(cpu);
         cpu_resume(cpu);
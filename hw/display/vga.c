@@ -34,6 +34,7 @@
 #include "qemu/timer.h"
 #include "hw/xen/xen.h"
 #include "migration/vmstate.h"
+#include "exec/target_page.h"
 #include "trace.h"
 
 //#define DEBUG_VGA_MEM
@@ -1464,10 +1465,43 @@ void vga_dirty_log_stop(VGACommonState *s)
 /*
  * graphic modes
  */
+/*
+ * A shared surface maps video memory directly, so the columns of a
+ * scanline that can have changed are those in dirty pages.  Narrow
+ * [*x0, *x1) to them, so that the UI does not rescan the whole line.
+ */
+static void vga_dirty_columns(VGACommonState *s, DirtyBitmapSnapshot *snap,
+                              ram_addr_t start, ram_addr_t end, int depth,
+                              int *x0, int *x1)
+{
+    size_t page_size = qemu_target_page_size();
+    int bypp = DIV_ROUND_UP(depth, 8);
+    ram_addr_t addr = start, first = 0, last = 0;
+
+    while (addr <= end) {
+        ram_addr_t next = MIN(QEMU_ALIGN_DOWN(addr, page_size) + page_size,
+                              end + 1);
+
+        if (memory_region_snapshot_get_dirty(&s->vram, snap, addr,
+                                             next - addr)) {
+            if (!last) {
+                first = addr;
+            }
+            last = next;
+        }
+        addr = next;
+    }
+    if (last) {
+        *x0 = (first - start) / bypp;
+        *x1 = MIN(*x1, DIV_ROUND_UP(last - start, bypp));
+    }
+}
+
 static void vga_draw_graphic(VGACommonState *s, int full_update)
 {
     DisplaySurface *surface = qemu_console_surface(s->con);
     int y1, y, update, linesize, y_start, double_scan, mask, depth;
+    int x_start = 0, x_end = 0;
     int width, height, shift_control, bwidth, bits;
     ram_addr_t page0, page1, region_start, region_end;
     DirtyBitmapSnapshot *snap = NULL;
@@ -1475,7 +1509,7 @@ static void vga_draw_graphic(VGACommonState *s, int full_update)
     uint8_t *d;
     uint32_t v, addr1, addr;
     vga_draw_line_func *vga_draw_line = NULL;
-    bool share_surface, force_shadow = false;
+    bool share_surface, force_shadow = false, invalidated;
     pixman_format_code_t format;
 #ifdef HOST_WORDS_BIGENDIAN
     bool byteswap = !s->big_endian_fb;
@@ -1693,10 +1727,22 @@ static void vga_draw_graphic(VGACommonState *s, int full_update)
                                                       page0, page1 - page0);
         }
         /* explicit invalidation for the hardware cursor (cirrus only) */
-        update |= vga_scanline_invalidated(s, y);
+        invalidated = vga_scanline_invalidated(s, y);
+        update |= invalidated;
         if (update) {
-            if (y_start < 0)
+            int x0 = 0, x1 = disp_width;
+
+            if (!full_update && !invalidated && is_buffer_shared(surface)) {
+                vga_dirty_columns(s, snap, page0, page1, depth, &x0, &x1);
+            }
+            if (y_start < 0) {
                 y_start = y;
+                x_start = x0;
+                x_end = x1;
+            } else {
+                x_start = MIN(x_start, x0);
+                x_end = MAX(x_end, x1);
+            }
             if (!(is_buffer_shared(surface))) {
                 vga_draw_line(s, d, addr, width);
                 if (s->cursor_draw_line)
@@ -1705,8 +1751,8 @@ static void vga_draw_graphic(VGACommonState *s, int full_update)
         } else {
             if (y_start >= 0) {
                 /* flush to display */
-                dpy_gfx_update(s->con, 0, y_start,
-                               disp_width, y - y_start);
+                dpy_gfx_update(s->con, x_start, y_start,
+                               x_end - x_start, y - y_start);
                 y_start = -1;
             }
         }
@@ -1726,8 +1772,8 @@ static void vga_draw_graphic(VGACommonState *s, int full_update)
     }
     if (y_start >= 0) {
         /* flush to display */
-        dpy_gfx_update(s->con, 0, y_start,
-                       disp_width, y - y_start);
+        dpy_gfx_update(s->con, x_start, y_start,
+                       x_end - x_start, y - y_start);
     }
     g_free(snap);
     memset(s->invalidated_y_table, 0, sizeof(s->invalidated_y_table));
@@ -471,8 +471,7 @@ static void virtio_gpu_transfer_to_host_2d(VirtIOGPU *g,
     bpp = DIV_ROUND_UP(PIXMAN_FORMAT_BPP(format), 8);
     stride = pixman_image_get_stride(res->image);
 
-    if (t2d.offset || t2d.r.x || t2d.r.y ||
-        t2d.r.width != pixman_image_get_width(res->image)) {
+    if (t2d.r.x || t2d.r.width != pixman_image_get_width(res->image)) {
         void *img_data = pixman_image_get_data(res->image);
         for (h = 0; h < t2d.r.height; h++) {
             src_offset = t2d.offset + stride * h;
@@ -483,10 +482,13 @@ static void virtio_gpu_transfer_to_host_2d(VirtIOGPU *g,
                        + dst_offset, t2d.r.width * bpp);
         }
     } else {
-        iov_to_buf(res->iov, res->iov_cnt, 0,
-                   pixman_image_get_data(res->image),
-                   pixman_image_get_stride(res->image)
-                   * pixman_image_get_height(res->image));
+        /*
+         * Full lines are contiguous on both sides, so copy them at once
+         * rather than walking the (possibly long) iovec once per line.
+         */
+        iov_to_buf(res->iov, res->iov_cnt, t2d.offset,
+                   (uint8_t *)pixman_image_get_data(res->image)
+                   + t2d.r.y * stride, stride * t2d.r.height);
     }
 }
 
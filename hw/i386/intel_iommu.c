@@ -198,12 +198,21 @@ static guint vtd_uint64_hash(gconstpointer v)
     return (guint)*(const uint64_t *)v;
 }
 
-static gboolean vtd_hash_remove_by_domain(gpointer key, gpointer value,
-                                          gpointer user_data)
+/*
+ * Every IOTLB entry is also linked in the list of its domain, so that
+ * domain and page selective invalidations only look at the entries of
+ * that domain rather than at the whole IOTLB.
+ */
+typedef struct VTDIOTLBDomain {
+    QLIST_HEAD(, VTDIOTLBEntry) entries;
+} VTDIOTLBDomain;
+
+static void vtd_iotlb_entry_free(gpointer data)
 {
-    VTDIOTLBEntry *entry = (VTDIOTLBEntry *)value;
-    uint16_t domain_id = *(uint16_t *)user_data;
-    return entry->domain_id == domain_id;
+    VTDIOTLBEntry *entry = data;
+
+    QLIST_REMOVE(entry, next);
+    g_free(entry);
 }
 
 /* The shift of an addr for a certain level of paging structure */
@@ -218,16 +227,36 @@ static inline uint64_t vtd_slpt_level_page_mask(uint32_t level)
     return ~((1ULL << vtd_slpt_level_shift(level)) - 1);
 }
 
-static gboolean vtd_hash_remove_by_page(gpointer key, gpointer value,
-                                        gpointer user_data)
+static bool vtd_iotlb_page_match(VTDIOTLBEntry *entry,
+                                 VTDIOTLBPageInvInfo *info)
 {
-    VTDIOTLBEntry *entry = (VTDIOTLBEntry *)value;
-    VTDIOTLBPageInvInfo *info = (VTDIOTLBPageInvInfo *)user_data;
     uint64_t gfn = (info->addr >> VTD_PAGE_SHIFT_4K) & info->mask;
     uint64_t gfn_tlb = (info->addr & entry->mask) >> VTD_PAGE_SHIFT_4K;
-    return (entry->domain_id == info->domain_id) &&
-            (((entry->gfn & info->mask) == gfn) ||
-             (entry->gfn == gfn_tlb));
+    return ((entry->gfn & info->mask) == gfn) || (entry->gfn == gfn_tlb);
+}
+
+/*
+ * Drop the IOTLB entries of @domain_id, or only those that overlap @info
+ * if it is not NULL.  Must be called with IOMMU lock held.
+ */
+static void vtd_iotlb_remove_domain_locked(IntelIOMMUState *s,
+                                           uint16_t domain_id,
+                                           VTDIOTLBPageInvInfo *info)
+{
+    VTDIOTLBDomain *domain;
+    VTDIOTLBEntry *entry, *next_entry;
+
+    domain = g_hash_table_lookup(s->iotlb_domains,
+                                 GUINT_TO_POINTER(domain_id));
+    if (!domain) {
+        return;
+    }
+    QLIST_FOREACH_SAFE(entry, &domain->entries, next, next_entry) {
+        if (!info || vtd_iotlb_page_match(entry, info)) {
+            /* Unlinks the entry from the domain as well */
+            g_hash_table_remove(s->iotlb, &entry->key);
+        }
+    }
 }
 
 /* Reset all the gen of VTDAddressSpace to zero and set the gen of
@@ -261,6 +290,7 @@ static void vtd_reset_iotlb_locked(IntelIOMMUState *s)
 {
     assert(s->iotlb);
     g_hash_table_remove_all(s->iotlb);
+    g_hash_table_remove_all(s->iotlb_domains);
 }
 
 static void vtd_reset_iotlb(IntelIOMMUState *s)
@@ -317,7 +347,7 @@ static void vtd_update_iotlb(IntelIOMMUState *s, uint16_t source_id,
                              uint8_t access_flags, uint32_t level)
 {
     VTDIOTLBEntry *entry = g_malloc(sizeof(*entry));
-    uint64_t *key = g_malloc(sizeof(*key));
+    VTDIOTLBDomain *domain;
     uint64_t gfn = vtd_get_iotlb_gfn(addr, level);
 
     trace_vtd_iotlb_page_update(source_id, addr, slpte, domain_id);
@@ -331,8 +361,18 @@ static void vtd_update_iotlb(IntelIOMMUState *s, uint16_t source_id,
     entry->slpte = slpte;
     entry->access_flags = access_flags;
     entry->mask = vtd_slpt_level_page_mask(level);
-    *key = vtd_get_iotlb_key(gfn, source_id, level);
-    g_hash_table_replace(s->iotlb, key, entry);
+    entry->key = vtd_get_iotlb_key(gfn, source_id, level);
+
+    domain = g_hash_table_lookup(s->iotlb_domains,
+                                 GUINT_TO_POINTER(domain_id));
+    if (!domain) {
+        domain = g_new0(VTDIOTLBDomain, 1);
+        g_hash_table_insert(s->iotlb_domains, GUINT_TO_POINTER(domain_id),
+                            domain);
+    }
+    /* This frees, and unlinks, an older entry with the same key */
+    g_hash_table_replace(s->iotlb, &entry->key, entry);
+    QLIST_INSERT_HEAD(&domain->entries, entry, next);
 }
 
 /* Given the reg addr of both the message data and address, generate an
@@ -1964,8 +2004,7 @@ static void vtd_iotlb_domain_invalidate(IntelIOMMUState *s, uint16_t domain_id)
     trace_vtd_inv_desc_iotlb_domain(domain_id);
 
     vtd_iommu_lock(s);
-    g_hash_table_foreach_remove(s->iotlb, vtd_hash_remove_by_domain,
-                                &domain_id);
+    vtd_iotlb_remove_domain_locked(s, domain_id, NULL);
     vtd_iommu_unlock(s);
 
     QLIST_FOREACH(vtd_as, &s->vtd_as_with_notifiers, next) {
@@ -2031,7 +2070,7 @@ static void vtd_iotlb_page_invalidate(IntelIOMMUState *s, uint16_t domain_id,
     info.addr = addr;
     info.mask = ~((1 << am) - 1);
     vtd_iommu_lock(s);
-    g_hash_table_foreach_remove(s->iotlb, vtd_hash_remove_by_page, &info);
+    vtd_iotlb_remove_domain_locked(s, domain_id, &info);
     vtd_iommu_unlock(s);
     vtd_iotlb_page_invalidate_notify(s, domain_id, addr, am);
 }
@@ -3837,7 +3876,8 @@ static void vtd_realize(DeviceState *dev, Error **errp)
     sysbus_init_mmio(SYS_BUS_DEVICE(s), &s->csrmem);
     /* No corresponding destroy */
     s->iotlb = g_hash_table_new_full(vtd_uint64_hash, vtd_uint64_equal,
-                                     g_free, g_free);
+                                     NULL, vtd_iotlb_entry_free);
+    s->iotlb_domains = g_hash_table_new_full(NULL, NULL, NULL, g_free);
     s->vtd_as_by_busptr = g_hash_table_new_full(vtd_uint64_hash, vtd_uint64_equal,
                                               g_free, g_free);
     vtd_init(s);
@@ -412,7 +412,7 @@ typedef union VTDInvDesc VTDInvDesc;
 struct VTDIOTLBPageInvInfo {
     uint16_t domain_id;
     uint64_t addr;
-    uint8_t mask;
+    uint64_t mask;
 };
 typedef struct VTDIOTLBPageInvInfo VTDIOTLBPageInvInfo;
 
@@ -656,6 +656,8 @@ static void ahci_reset_port(AHCIState *s, int port)
     pr->scr_act = 0;
     pr->tfdata = 0x7F;
     pr->sig = 0xFFFFFFFF;
+    qemu_bh_cancel(d->sdb_bh);
+    d->finished = 0;
     d->busy_slot = -1;
     d->init_d2h_sent = false;
 
@@ -769,9 +771,8 @@ static void ahci_unmap_clb_address(AHCIDevice *ad)
     ad->lst = NULL;
 }
 
-static void ahci_write_fis_sdb(AHCIState *s, NCQTransferState *ncq_tfs)
+static void ahci_write_fis_sdb(AHCIState *s, AHCIDevice *ad)
 {
-    AHCIDevice *ad = ncq_tfs->drive;
     AHCIPortRegs *pr = &ad->port_regs;
     IDEState *ide_state;
     SDBFIS *sdb_fis;
@@ -805,6 +806,13 @@ static void ahci_write_fis_sdb(AHCIState *s, NCQTransferState *ncq_tfs)
     }
 }
 
+static void ahci_sdb_bh(void *opaque)
+{
+    AHCIDevice *ad = opaque;
+
+    ahci_write_fis_sdb(ad->hba, ad);
+}
+
 static void ahci_write_fis_pio(AHCIDevice *ad, uint16_t len, bool pio_fis_i)
 {
     AHCIPortRegs *pr = &ad->port_regs;
@@ -1007,10 +1015,15 @@ static void ncq_finish(NCQTransferState *ncq_tfs)
      * clear the outstanding bit in scr_act (PxSACT). */
     if (!(ncq_tfs->drive->port_regs.scr_err & (1 << ncq_tfs->tag))) {
         ncq_tfs->drive->finished |= (1 << ncq_tfs->tag);
+        /* The SDB FIS reports every tag in finished: let the commands that
+         * complete in this event loop iteration share one FIS and one IRQ. */
+        qemu_bh_schedule(ncq_tfs->drive->sdb_bh);
+    } else {
+        /* Report the error now, before a later completion clears it */
+        qemu_bh_cancel(ncq_tfs->drive->sdb_bh);
+        ahci_write_fis_sdb(ncq_tfs->drive->hba, ncq_tfs->drive);
     }
 
-    ahci_write_fis_sdb(ncq_tfs->drive->hba, ncq_tfs);
-
     trace_ncq_finish(ncq_tfs->drive->hba, ncq_tfs->drive->port_no,
                      ncq_tfs->tag);
 
@@ -1555,6 +1568,7 @@ void ahci_realize(AHCIState *s, DeviceState *qdev, AddressSpace *as, int ports)
         ad->port_no = i;
         ad->port.dma = &ad->dma;
         ad->port.dma->ops = &ahci_dma_ops;
+        ad->sdb_bh = qemu_bh_new(ahci_sdb_bh, ad);
         ide_register_restart_cb(&ad->port);
     }
     g_free(irqs);
@@ -1572,6 +1586,7 @@ void ahci_uninit(AHCIState *s)
 
             ide_exit(s);
         }
+        qemu_bh_delete(ad->sdb_bh);
         object_unparent(OBJECT(&ad->port));
     }
 
@@ -1714,6 +1729,11 @@ static int ahci_state_post_load(void *opaque, int version_id)
         }
 
 
+        /* Completions the source had not reported yet */
+        if (ad->finished) {
+            qemu_bh_schedule(ad->sdb_bh);
+        }
+
         /*
          * If an error is present, ad->busy_slot will be valid and not -1.
          * In this case, an operation is waiting to resume and will re-check
@@ -29,7 +29,31 @@ void virtio_input_send(VirtIOInput *vinput, virtio_input_event *event)
         return;
     }
 
-    /* queue up events ... */
+    /*
+     * fold repeated motion on one axis into a single event ...  except
+     * for multitouch: ABS_MT_* values belong to the slot or contact
+     * they follow, so the same code legitimately repeats in one report
+     */
+    if ((event->type == cpu_to_le16(EV_ABS) &&
+         le16_to_cpu(event->code) < ABS_MT_SLOT) ||
+        event->type == cpu_to_le16(EV_REL)) {
+        for (i = 0; i < vinput->qindex; i++) {
+            virtio_input_event *prev = &vinput->queue[i].event;
+
+            if (prev->type != event->type || prev->code != event->code) {
+                continue;
+            }
+            if (event->type == cpu_to_le16(EV_ABS)) {
+                prev->value = event->value;
+            } else {
+                prev->value = cpu_to_le32(le32_to_cpu(prev->value) +
+                                          le32_to_cpu(event->value));
+            }
+            return;
+        }
+    }
+
+    /* ... queue up events ... */
     if (vinput->qindex == vinput->qsize) {
         vinput->qsize++;
         vinput->queue = g_realloc(vinput->queue, vinput->qsize *
@@ -129,6 +129,8 @@ static uint32_t gicr_int_pending(GICv3CPUState *cs)
     return pend;
 }
 
+static void gicv3_cpu_full_update_noirqset(GICv3CPUState *cs);
+
 /* Update the interrupt status after state in a redistributor
  * or CPU interface has changed, but don't tell the CPU i/f.
  */
@@ -172,12 +174,13 @@ static void gicv3_redist_update_noirqset(GICv3CPUState *cs)
      * best, and the previous best is outside our range (or there was no
      * previous pending interrupt at all), then that is still valid, and
      * we leave it as the best.
-     * Otherwise, we need to do a full update (because the previous best
-     * interrupt has reduced in priority and any other interrupt could
-     * now be the new best one).
+     * Otherwise, we need to do a full update of this CPU (because the
+     * previous best interrupt has reduced in priority and any other
+     * interrupt could now be the new best one); other CPUs cannot be
+     * affected by a change in our redistributor.
      */
     if (!seenbetter && cs->hppi.prio != 0xff && cs->hppi.irq < GIC_INTERNAL) {
-        gicv3_full_update_noirqset(cs->gic);
+        gicv3_cpu_full_update_noirqset(cs);
     }
 }
 
@@ -242,9 +245,9 @@ static void gicv3_update_noirqset(GICv3State *s, int start, int len)
      * best, and the previous best is outside our range (or there was
      * no previous pending interrupt at all), then that
      * is still valid, and we leave it as the best.
-     * Otherwise, we need to do a full update (because the previous best
-     * interrupt has reduced in priority and any other interrupt could
-     * now be the new best one).
+     * Otherwise, we need to do a full update of that CPU (because the
+     * previous best interrupt has reduced in priority and any other
+     * interrupt could now be the new best one).
      */
     for (i = 0; i < s->num_cpu; i++) {
         GICv3CPUState *cs = &s->cpu[i];
@@ -255,8 +258,7 @@ static void gicv3_update_noirqset(GICv3State *s, int start, int len)
 
         if (!cs->seenbetter && cs->hppi.prio != 0xff &&
             cs->hppi.irq >= start && cs->hppi.irq < start + len) {
-            gicv3_full_update_noirqset(s);
-            break;
+            gicv3_cpu_full_update_noirqset(cs);
         }
     }
 }
@@ -271,6 +273,45 @@ void gicv3_update(GICv3State *s, int start, int len)
     }
 }
 
+/* Recalculate the highest priority pending interrupt of a single CPU
+ * from scratch, but don't tell the CPU i/f. The other CPUs keep their
+ * current state, which this one's interrupts have no influence on.
+ */
+static void gicv3_cpu_full_update_noirqset(GICv3CPUState *cs)
+{
+    GICv3State *s = cs->gic;
+    bool seenbetter = false;
+    int i;
+
+    cs->hppi.prio = 0xff;
+
+    for (i = GIC_INTERNAL; i < s->num_irq; i += 32) {
+        uint32_t pend = gicd_int_pending(s, i);
+
+        while (pend) {
+            int irq = i + ctz32(pend);
+            uint8_t prio = s->gicd_ipriority[irq];
+
+            pend &= pend - 1;
+            if (s->gicd_irouter_target[irq] == cs &&
+                irqbetter(cs, irq, prio)) {
+                cs->hppi.irq = irq;
+                cs->hppi.prio = prio;
+                seenbetter = true;
+            }
+        }
+    }
+
+    if (seenbetter) {
+        cs->hppi.grp = gicv3_irq_group(s, cs, cs->hppi.irq);
+    }
+
+    /* The best interrupt so far is outside the redistributor range (or
+     * there is none), so this cannot recurse.
+     */
+    gicv3_redist_update_noirqset(cs);
+}
+
 void gicv3_full_update_noirqset(GICv3State *s)
 {
     /* Completely recalculate the GIC status from scratch, but
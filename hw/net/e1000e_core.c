@@ -829,6 +829,23 @@ e1000e_ring_advance(E1000ECore *core, const E1000E_RingInfo *r, uint32_t count)
     }
 }
 
+/*
+ * Number of descriptors owned by the device that can be read in one go,
+ * i.e. from the head up to the tail or the end of the ring.
+ */
+static inline uint32_t
+e1000e_ring_contiguous_descr_num(E1000ECore *core, const E1000E_RingInfo *r)
+{
+    uint32_t size = core->mac[r->dlen] / E1000_RING_DESC_LEN;
+    uint32_t head = core->mac[r->dh];
+    uint32_t tail = core->mac[r->dt];
+
+    if (head >= size) {
+        return 1;
+    }
+    return (head < tail ? tail : size) - head;
+}
+
 static inline uint32_t
 e1000e_ring_free_descr_num(E1000ECore *core, const E1000E_RingInfo *r)
 {
@@ -902,14 +919,18 @@ e1000e_rx_ring_init(E1000ECore *core, E1000E_RxRing *rxr, int idx)
     rxr->i      = &i[idx];
 }
 
+/* Maximum number of TX descriptors fetched with a single DMA read */
+#define E1000E_TX_DESC_BATCH 16
+
 static void
 e1000e_start_xmit(E1000ECore *core, const E1000E_TxRing *txr)
 {
     dma_addr_t base;
-    struct e1000_tx_desc desc;
+    struct e1000_tx_desc descs[E1000E_TX_DESC_BATCH];
     bool ide = false;
     const E1000E_RingInfo *txi = txr->i;
     uint32_t cause = E1000_ICS_TXQE;
+    uint32_t i, n;
 
     if (!(core->mac[TCTL] & E1000_TCTL_EN)) {
         trace_e1000e_tx_disabled();
@@ -918,16 +939,23 @@ e1000e_start_xmit(E1000ECore *core, const E1000E_TxRing *txr)
 
     while (!e1000e_ring_empty(core, txi)) {
         base = e1000e_ring_head_descr(core, txi);
+        n = MIN(e1000e_ring_contiguous_descr_num(core, txi),
+                E1000E_TX_DESC_BATCH);
 
-        pci_dma_read(core->owner, base, &desc, sizeof(desc));
+        pci_dma_read(core->owner, base, descs, n * sizeof(descs[0]));
 
-        trace_e1000e_tx_descr((void *)(intptr_t)desc.buffer_addr,
-                              desc.lower.data, desc.upper.data);
+        for (i = 0; i < n; i++, base += sizeof(descs[0])) {
+            struct e1000_tx_desc *desc = &descs[i];
 
-        e1000e_process_tx_desc(core, txr->tx, &desc, txi->idx);
-        cause |= e1000e_txdesc_writeback(core, base, &desc, &ide, txi->idx);
+            trace_e1000e_tx_descr((void *)(intptr_t)desc->buffer_addr,
+                                  desc->lower.data, desc->upper.data);
 
-        e1000e_ring_advance(core, txi, 1);
+            e1000e_process_tx_desc(core, txr->tx, desc, txi->idx);
+            cause |= e1000e_txdesc_writeback(core, base, desc, &ide,
+                                             txi->idx);
+
+            e1000e_ring_advance(core, txi, 1);
+        }
     }
 
     if (!ide || !e1000e_intrmgr_delay_tx_causes(core, &cause)) {
@@ -47,6 +47,10 @@ void vhost_net_cleanup(struct vhost_net *net)
 {
 }
 
+void vhost_net_reset_inflight(NetClientState *nc)
+{
+}
+
 uint64_t vhost_net_get_features(struct vhost_net *net, uint64_t features)
 {
     return features;
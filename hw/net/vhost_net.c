@@ -236,6 +236,51 @@ static void vhost_net_set_vq_index(struct vhost_net *net, int vq_index)
     net->dev.vq_index = vq_index;
 }
 
+#ifdef CONFIG_VHOST_NET_USER
+/*
+ * Give a vhost-user backend a shared memory region in which it records
+ * the descriptors it is processing.  The region belongs to the netdev
+ * and outlives the backend, so a restarted backend resumes the rings
+ * where its predecessor stopped instead of having them reset.
+ */
+static int vhost_net_set_inflight(struct vhost_net *net, VirtIODevice *dev)
+{
+    struct vhost_inflight *inflight = vhost_user_get_inflight(net->nc);
+    int r;
+
+    /* Multiqueue netdevs don't track inflight descriptors */
+    if (!inflight) {
+        return 0;
+    }
+
+    r = vhost_dev_prepare_inflight(&net->dev, dev);
+    if (r < 0) {
+        return r;
+    }
+
+    if (!inflight->addr) {
+        r = vhost_dev_get_inflight(&net->dev,
+                                   virtio_queue_get_num(dev, net->dev.vq_index),
+                                   inflight);
+        if (r < 0) {
+            return r;
+        }
+    }
+
+    return vhost_dev_set_inflight(&net->dev, inflight);
+}
+#endif
+
+void vhost_net_reset_inflight(NetClientState *nc)
+{
+#ifdef CONFIG_VHOST_NET_USER
+    if (nc->info->type == NET_CLIENT_DRIVER_VHOST_USER &&
+        vhost_user_get_inflight(nc)) {
+        vhost_dev_free_inflight(vhost_user_get_inflight(nc));
+    }
+#endif
+}
+
 static int vhost_net_start_one(struct vhost_net *net,
                                VirtIODevice *dev)
 {
@@ -250,6 +295,15 @@ static int vhost_net_start_one(struct vhost_net *net,
         goto fail_notifiers;
     }
 
+#ifdef CONFIG_VHOST_NET_USER
+    if (net->nc->info->type == NET_CLIENT_DRIVER_VHOST_USER) {
+        r = vhost_net_set_inflight(net, dev);
+        if (r < 0) {
+            goto fail_start;
+        }
+    }
+#endif
+
     r = vhost_dev_start(&net->dev, dev);
     if (r < 0) {
         goto fail_start;
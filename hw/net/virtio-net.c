@@ -44,6 +44,7 @@
 #include "hw/pci/pci.h"
 #include "net_rx_pkt.h"
 #include "hw/virtio/vhost.h"
+#include "sysemu/iothread.h"
 
 #define VIRTIO_NET_VM_VERSION    11
 
@@ -350,14 +351,102 @@ static void virtio_net_vnet_endian_status(VirtIONet *n, uint8_t status)
     }
 }
 
+/* Notify the guest about a data queue, from the thread that processes it */
+static void virtio_net_notify(VirtIONet *n, VirtQueue *vq)
+{
+    VirtIONetQueue *q = &n->vqs[vq2q(virtio_get_queue_index(vq))];
+
+    if (q->ctx) {
+        virtio_notify_irqfd(VIRTIO_DEVICE(n), vq);
+    } else {
+        virtio_notify(VIRTIO_DEVICE(n), vq);
+    }
+}
+
+static void virtio_net_rx_bh(void *opaque)
+{
+    VirtIONetQueue *q = opaque;
+
+    if (q->rx_notify_pending) {
+        q->rx_notify_pending = false;
+        virtio_net_notify(q->n, q->rx_vq);
+    }
+}
+
+/* Send the pending rx notification now, from the thread that owns @q */
+static void virtio_net_rx_notify_flush(VirtIONetQueue *q)
+{
+    qemu_bh_cancel(q->rx_bh);
+    virtio_net_rx_bh(q);
+}
+
 static void virtio_net_drop_tx_queue_data(VirtIODevice *vdev, VirtQueue *vq)
 {
     unsigned int dropped = virtqueue_drop_all(vq);
     if (dropped) {
-        virtio_notify(vdev, vq);
+        virtio_net_notify(VIRTIO_NET(vdev), vq);
+    }
+}
+
+/* Context: the thread that processes @q */
+static void virtio_net_queue_set_status(VirtIONetQueue *q, uint8_t queue_status)
+{
+    VirtIONet *n = q->n;
+    VirtIODevice *vdev = VIRTIO_DEVICE(n);
+    NetClientState *ncs = qemu_get_subqueue(n->nic, q - n->vqs);
+    bool queue_started;
+
+    queue_started =
+        virtio_net_started(n, queue_status) && !n->vhost_started;
+
+    if (queue_started) {
+        qemu_flush_queued_packets(ncs);
+    } else {
+        virtio_net_rx_notify_flush(q);
+    }
+
+    if (!q->tx_waiting) {
+        return;
+    }
+
+    if (queue_started) {
+        if (q->tx_timer) {
+            timer_mod(q->tx_timer,
+                      qemu_clock_get_ns(QEMU_CLOCK_VIRTUAL) + n->tx_timeout);
+        } else {
+            qemu_bh_schedule(q->tx_bh);
+        }
+    } else {
+        if (q->tx_timer) {
+            timer_del(q->tx_timer);
+        } else {
+            qemu_bh_cancel(q->tx_bh);
+        }
+        if ((n->status & VIRTIO_NET_S_LINK_UP) == 0 &&
+            (queue_status & VIRTIO_CONFIG_S_DRIVER_OK) &&
+            vdev->vm_running) {
+            /* if tx is waiting we are likely have some packets in tx queue
+             * and disabled notification */
+            q->tx_waiting = 0;
+            virtio_queue_set_notification(q->tx_vq, 1);
+            virtio_net_drop_tx_queue_data(vdev, q->tx_vq);
+        }
     }
 }
 
+typedef struct VirtIONetQueueStatus {
+    VirtIONetQueue *q;
+    uint8_t status;
+} VirtIONetQueueStatus;
+
+/* Context: BH in IOThread */
+static void virtio_net_queue_set_status_bh(void *opaque)
+{
+    VirtIONetQueueStatus *qs = opaque;
+
+    virtio_net_queue_set_status(qs->q, qs->status);
+}
+
 static void virtio_net_set_status(struct VirtIODevice *vdev, uint8_t status)
 {
     VirtIONet *n = VIRTIO_NET(vdev);
@@ -369,8 +458,6 @@ static void virtio_net_set_status(struct VirtIODevice *vdev, uint8_t status)
     virtio_net_vhost_status(n, status);
 
     for (i = 0; i < n->max_queues; i++) {
-        NetClientState *ncs = qemu_get_subqueue(n->nic, i);
-        bool queue_started;
         q = &n->vqs[i];
 
         if ((!n->multiqueue && i != 0) || i >= n->curr_queues) {
@@ -378,39 +465,16 @@ static void virtio_net_set_status(struct VirtIODevice *vdev, uint8_t status)
         } else {
             queue_status = status;
         }
-        queue_started =
-            virtio_net_started(n, queue_status) && !n->vhost_started;
-
-        if (queue_started) {
-            qemu_flush_queued_packets(ncs);
-        }
 
-        if (!q->tx_waiting) {
-            continue;
-        }
+        if (q->ctx) {
+            VirtIONetQueueStatus qs = { .q = q, .status = queue_status };
 
-        if (queue_started) {
-            if (q->tx_timer) {
-                timer_mod(q->tx_timer,
-                               qemu_clock_get_ns(QEMU_CLOCK_VIRTUAL) + n->tx_timeout);
-            } else {
-                qemu_bh_schedule(q->tx_bh);
-            }
+            /* its NetQueue, bottom halves and timers are the IOThread's */
+            aio_context_acquire(q->ctx);
+            aio_wait_bh_oneshot(q->ctx, virtio_net_queue_set_status_bh, &qs);
+            aio_context_release(q->ctx);
         } else {
-            if (q->tx_timer) {
-                timer_del(q->tx_timer);
-            } else {
-                qemu_bh_cancel(q->tx_bh);
-            }
-            if ((n->status & VIRTIO_NET_S_LINK_UP) == 0 &&
-                (queue_status & VIRTIO_CONFIG_S_DRIVER_OK) &&
-                vdev->vm_running) {
-                /* if tx is waiting we are likely have some packets in tx queue
-                 * and disabled notification */
-                q->tx_waiting = 0;
-                virtio_queue_set_notification(q->tx_vq, 1);
-                virtio_net_drop_tx_queue_data(vdev, q->tx_vq);
-            }
+            virtio_net_queue_set_status(q, queue_status);
         }
     }
 }
@@ -562,6 +626,8 @@ static void virtio_net_reset(VirtIODevice *vdev)
         if (nc->peer) {
             qemu_flush_or_purge_queued_packets(nc->peer, true);
             assert(!virtio_net_get_subqueue(nc)->async_tx.elem);
+            /* The backend must not resume descriptors of the old rings */
+            vhost_net_reset_inflight(nc->peer);
         }
     }
 }
@@ -1852,7 +1918,13 @@ static ssize_t virtio_net_receive_rcu(NetClientState *nc, const uint8_t *buf,
     }
 
     virtqueue_flush(q->rx_vq, i);
-    virtio_notify(vdev, q->rx_vq);
+
+    /*
+     * Backends such as tap deliver packets in bursts, notify the guest
+     * once the burst is over.
+     */
+    q->rx_notify_pending = true;
+    qemu_bh_schedule(q->rx_bh);
 
     return size;
 }
@@ -2475,10 +2547,9 @@ static void virtio_net_tx_complete(NetClientState *nc, ssize_t len)
 {
     VirtIONet *n = qemu_get_nic_opaque(nc);
     VirtIONetQueue *q = virtio_net_get_subqueue(nc);
-    VirtIODevice *vdev = VIRTIO_DEVICE(n);
 
     virtqueue_push(q->tx_vq, q->async_tx.elem, 0);
-    virtio_notify(vdev, q->tx_vq);
+    virtio_net_notify(n, q->tx_vq);
 
     g_free(q->async_tx.elem);
     q->async_tx.elem = NULL;
@@ -2508,7 +2579,8 @@ static int32_t virtio_net_flush_tx(VirtIONetQueue *q)
         ssize_t ret;
         unsigned int out_num;
         struct iovec sg[VIRTQUEUE_MAX_SIZE], sg2[VIRTQUEUE_MAX_SIZE + 1], *out_sg;
-        struct virtio_net_hdr_mrg_rxbuf mhdr;
+        /* Must outlive the loop if the packet ends up queued */
+        struct virtio_net_hdr_mrg_rxbuf *mhdr = &q->async_tx.hdr;
 
         elem = virtqueue_pop(q->tx_vq, sizeof(VirtQueueElement));
         if (!elem) {
@@ -2525,7 +2597,7 @@ static int32_t virtio_net_flush_tx(VirtIONetQueue *q)
         }
 
         if (n->has_vnet_hdr) {
-            if (iov_to_buf(out_sg, out_num, 0, &mhdr, n->guest_hdr_len) <
+            if (iov_to_buf(out_sg, out_num, 0, mhdr, n->guest_hdr_len) <
                 n->guest_hdr_len) {
                 virtio_error(vdev, "virtio-net header incorrect");
                 virtqueue_detach_element(q->tx_vq, elem, 0);
@@ -2533,8 +2605,8 @@ static int32_t virtio_net_flush_tx(VirtIONetQueue *q)
                 return -EINVAL;
             }
             if (n->needs_vnet_hdr_swap) {
-                virtio_net_hdr_swap(vdev, (void *) &mhdr);
-                sg2[0].iov_base = &mhdr;
+                virtio_net_hdr_swap(vdev, (void *) mhdr);
+                sg2[0].iov_base = mhdr;
                 sg2[0].iov_len = n->guest_hdr_len;
                 out_num = iov_copy(&sg2[1], ARRAY_SIZE(sg2) - 1,
                                    out_sg, out_num,
@@ -2563,8 +2635,15 @@ static int32_t virtio_net_flush_tx(VirtIONetQueue *q)
             out_sg = sg;
         }
 
-        ret = qemu_sendv_packet_async(qemu_get_subqueue(n->nic, queue_index),
-                                      out_sg, out_num, virtio_net_tx_complete);
+        /*
+         * The element, and with it the guest buffers, is only released
+         * by virtio_net_tx_complete(), so a packet that has to wait for
+         * the backend is queued without copying it.
+         */
+        ret = qemu_sendv_packet_async_with_flags(
+            qemu_get_subqueue(n->nic, queue_index),
+            QEMU_NET_PACKET_FLAG_NOCOPY, out_sg, out_num,
+            virtio_net_tx_complete);
         if (ret == 0) {
             virtio_queue_set_notification(q->tx_vq, 0);
             q->async_tx.elem = elem;
@@ -2573,7 +2652,7 @@ static int32_t virtio_net_flush_tx(VirtIONetQueue *q)
 
 drop:
         virtqueue_push(q->tx_vq, elem, 0);
-        virtio_notify(vdev, q->tx_vq);
+        virtio_net_notify(n, q->tx_vq);
         g_free(elem);
 
         if (++num_packets >= n->tx_burst) {
@@ -2728,6 +2807,16 @@ static void virtio_net_add_queue(VirtIONet *n, int index)
                              virtio_net_handle_tx_bh);
         n->vqs[index].tx_bh = qemu_bh_new(virtio_net_tx_bh, &n->vqs[index]);
     }
+    n->vqs[index].rx_bh = qemu_bh_new(virtio_net_rx_bh, &n->vqs[index]);
+
+    virtio_queue_set_notify_coalescing(n->vqs[index].rx_vq,
+                                       qemu_get_aio_context(),
+                                       n->net_conf.coalesce_usecs,
+                                       n->net_conf.coalesce_frames);
+    virtio_queue_set_notify_coalescing(n->vqs[index].tx_vq,
+                                       qemu_get_aio_context(),
+                                       n->net_conf.coalesce_usecs,
+                                       n->net_conf.coalesce_frames);
 
     n->vqs[index].tx_waiting = 0;
     n->vqs[index].n = n;
@@ -2741,6 +2830,9 @@ static void virtio_net_del_queue(VirtIONet *n, int index)
 
     qemu_purge_queued_packets(nc);
 
+    qemu_bh_delete(q->rx_bh);
+    q->rx_bh = NULL;
+    q->rx_notify_pending = false;
     virtio_del_queue(vdev, index * 2);
     if (q->tx_timer) {
         timer_free(q->tx_timer);
@@ -3147,10 +3239,212 @@ static NetClientInfo net_virtio_info = {
     .announce = virtio_net_announce,
 };
 
+/*
+ * Without vhost, the queue pairs can be processed by IOThreads: the tap
+ * queue of each pair gets its fd handlers moved next to the virtqueue
+ * host notifiers, and the guest is notified through irqfds.  Packets,
+ * including those that go through netfilters, then never touch the main
+ * loop.  The control queue stays in the main loop.
+ */
+
+static bool virtio_net_handle_rx_aio(VirtIODevice *vdev, VirtQueue *vq)
+{
+    virtio_net_handle_rx(vdev, vq);
+    return true;
+}
+
+static bool virtio_net_handle_tx_aio(VirtIODevice *vdev, VirtQueue *vq)
+{
+    virtio_net_handle_tx_bh(vdev, vq);
+    return true;
+}
+
+/* Context: QEMU global mutex held, queue pair not running anywhere else */
+static void virtio_net_dataplane_start_queue(VirtIONet *n, int index)
+{
+    VirtIONetQueue *q = &n->vqs[index];
+    IOThread *iothread = n->iothreads[index % n->num_iothreads];
+    AioContext *ctx = iothread_get_aio_context(iothread);
+    NetClientState *nc = qemu_get_subqueue(n->nic, index);
+    EventNotifier *rx_notifier = virtio_queue_get_host_notifier(q->rx_vq);
+    EventNotifier *tx_notifier = virtio_queue_get_host_notifier(q->tx_vq);
+
+    qemu_bh_delete(q->tx_bh);
+    q->tx_bh = aio_bh_new(ctx, virtio_net_tx_bh, q);
+    virtio_net_rx_notify_flush(q);
+    qemu_bh_delete(q->rx_bh);
+    q->rx_bh = aio_bh_new(ctx, virtio_net_rx_bh, q);
+    virtio_queue_set_notify_coalescing(q->rx_vq, ctx,
+                                       n->net_conf.coalesce_usecs,
+                                       n->net_conf.coalesce_frames);
+    virtio_queue_set_notify_coalescing(q->tx_vq, ctx,
+                                       n->net_conf.coalesce_usecs,
+                                       n->net_conf.coalesce_frames);
+    q->ctx = ctx;
+
+    aio_context_acquire(ctx);
+    qemu_set_aio_context(nc->peer, ctx);
+    event_notifier_set_handler(rx_notifier, NULL);
+    event_notifier_set_handler(tx_notifier, NULL);
+    virtio_queue_aio_set_host_notifier_handler(q->rx_vq, ctx,
+                                               virtio_net_handle_rx_aio);
+    virtio_queue_aio_set_host_notifier_handler(q->tx_vq, ctx,
+                                               virtio_net_handle_tx_aio);
+    aio_context_release(ctx);
+
+    if (q->tx_waiting) {
+        qemu_bh_schedule(q->tx_bh);
+    }
+    /* Pick up what was queued in either direction while we were switching */
+    event_notifier_set(rx_notifier);
+    event_notifier_set(tx_notifier);
+}
+
+/* Context: BH in IOThread */
+static void virtio_net_dataplane_stop_bh(void *opaque)
+{
+    VirtIONetQueue *q = opaque;
+    VirtIONet *n = q->n;
+    NetClientState *nc = qemu_get_subqueue(n->nic, q - n->vqs);
+
+    virtio_queue_aio_set_host_notifier_handler(q->rx_vq, q->ctx, NULL);
+    virtio_queue_aio_set_host_notifier_handler(q->tx_vq, q->ctx, NULL);
+    qemu_set_aio_context(nc->peer, NULL);
+    qemu_bh_delete(q->tx_bh);
+    q->tx_bh = NULL;
+    virtio_net_rx_notify_flush(q);
+    qemu_bh_delete(q->rx_bh);
+    q->rx_bh = NULL;
+    /* Send what is held back while the irqfd still works */
+    virtio_queue_set_notify_coalescing(q->rx_vq, qemu_get_aio_context(),
+                                       n->net_conf.coalesce_usecs,
+                                       n->net_conf.coalesce_frames);
+    virtio_queue_set_notify_coalescing(q->tx_vq, qemu_get_aio_context(),
+                                       n->net_conf.coalesce_usecs,
+                                       n->net_conf.coalesce_frames);
+}
+
+/* Context: QEMU global mutex held */
+static void virtio_net_dataplane_stop_queue(VirtIONet *n, int index)
+{
+    VirtIONetQueue *q = &n->vqs[index];
+
+    aio_context_acquire(q->ctx);
+    aio_wait_bh_oneshot(q->ctx, virtio_net_dataplane_stop_bh, q);
+    aio_context_release(q->ctx);
+    q->ctx = NULL;
+
+    q->tx_bh = qemu_bh_new(virtio_net_tx_bh, q);
+    q->rx_bh = qemu_bh_new(virtio_net_rx_bh, q);
+    if (q->tx_waiting) {
+        qemu_bh_schedule(q->tx_bh);
+    }
+}
+
+static int virtio_net_start_ioeventfd(VirtIODevice *vdev)
+{
+    VirtIONet *n = VIRTIO_NET(vdev);
+    BusState *qbus = qdev_get_parent_bus(DEVICE(vdev));
+    VirtioBusClass *k = VIRTIO_BUS_GET_CLASS(qbus);
+    int i, r;
+
+    r = virtio_device_start_ioeventfd_impl(vdev);
+    if (r < 0 || !n->num_iothreads) {
+        return r;
+    }
+
+    r = k->set_guest_notifiers(qbus->parent, virtio_get_num_queues(vdev),
+                               true);
+    if (r < 0) {
+        /* Keep processing all queues in the main loop */
+        error_report("virtio-net failed to set guest notifier (%d), "
+                     "ensure -accel kvm is set.", r);
+        return 0;
+    }
+
+    for (i = 0; i < n->max_queues; i++) {
+        virtio_net_dataplane_start_queue(n, i);
+    }
+    n->dataplane_started = true;
+    trace_virtio_net_dataplane_start(n);
+    return 0;
+}
+
+static void virtio_net_stop_ioeventfd(VirtIODevice *vdev)
+{
+    VirtIONet *n = VIRTIO_NET(vdev);
+    BusState *qbus = qdev_get_parent_bus(DEVICE(vdev));
+    VirtioBusClass *k = VIRTIO_BUS_GET_CLASS(qbus);
+    int i;
+
+    if (n->dataplane_started) {
+        trace_virtio_net_dataplane_stop(n);
+        for (i = 0; i < n->max_queues; i++) {
+            virtio_net_dataplane_stop_queue(n, i);
+        }
+        k->set_guest_notifiers(qbus->parent, virtio_get_num_queues(vdev),
+                               false);
+        n->dataplane_started = false;
+    }
+
+    virtio_device_stop_ioeventfd_impl(vdev);
+}
+
+static bool virtio_net_dataplane_realize(VirtIONet *n, Error **errp)
+{
+    uint32_t i;
+
+    if (n->net_conf.tx && !strcmp(n->net_conf.tx, "timer")) {
+        error_setg(errp, "'iothreads' cannot be used with tx=timer");
+        return false;
+    }
+    /* Both steer packets across queue pairs from the receive path */
+    if (virtio_has_feature(n->host_features, VIRTIO_NET_F_RSS) ||
+        virtio_has_feature(n->host_features, VIRTIO_NET_F_RSC_EXT)) {
+        error_setg(errp, "'iothreads' cannot be used with rss or "
+                   "guest_rsc_ext");
+        return false;
+    }
+    for (i = 0; i < MAX(n->nic_conf.peers.queues, 1); i++) {
+        NetClientState *peer = n->nic_conf.peers.ncs[i];
+
+        if (!peer || !peer->info->set_aio_context || get_vhost_net(peer)) {
+            error_setg(errp, "'iothreads' requires a tap or af-xdp netdev "
+                       "without vhost");
+            return false;
+        }
+    }
+
+    n->iothreads = g_new0(IOThread *, n->num_iothreads);
+    for (i = 0; i < n->num_iothreads; i++) {
+        n->iothreads[i] = iothread_by_id(n->iothread_ids[i]);
+        if (!n->iothreads[i]) {
+            error_setg(errp, "IOThread '%s' not found", n->iothread_ids[i]);
+            g_free(n->iothreads);
+            n->iothreads = NULL;
+            return false;
+        }
+    }
+    for (i = 0; i < n->num_iothreads; i++) {
+        object_ref(OBJECT(n->iothreads[i]));
+    }
+
+    /* Vector masking goes through the irqfds, as there is no vhost */
+    VIRTIO_DEVICE(n)->use_guest_notifier_mask = false;
+    return true;
+}
+
 static bool virtio_net_guest_notifier_pending(VirtIODevice *vdev, int idx)
 {
     VirtIONet *n = VIRTIO_NET(vdev);
     NetClientState *nc = qemu_get_subqueue(n->nic, vq2q(idx));
+
+    if (n->dataplane_started) {
+        VirtQueue *vq = virtio_get_queue(vdev, idx);
+
+        return event_notifier_test_and_clear(
+            virtio_queue_get_guest_notifier(vq));
+    }
     assert(n->vhost_started);
     return vhost_net_virtqueue_pending(get_vhost_net(nc->peer), idx);
 }
@@ -3376,6 +3670,10 @@ static void virtio_net_device_realize(DeviceState *dev, Error **errp)
         virtio_cleanup(vdev);
         return;
     }
+    if (n->num_iothreads && !virtio_net_dataplane_realize(n, errp)) {
+        virtio_cleanup(vdev);
+        return;
+    }
     n->vqs = g_malloc0(sizeof(VirtIONetQueue) * n->max_queues);
     n->curr_queues = 1;
     n->tx_timeout = n->net_conf.txtimer;
@@ -3497,6 +3795,11 @@ static void virtio_net_device_unrealize(DeviceState *dev)
     virtio_net_rsc_cleanup(n);
     g_free(n->rss_data.indirections_table);
     net_rx_pkt_uninit(n->rx_pkt);
+    for (i = 0; i < n->num_iothreads && n->iothreads; i++) {
+        object_unref(OBJECT(n->iothreads[i]));
+    }
+    g_free(n->iothreads);
+    n->iothreads = NULL;
     virtio_cleanup(vdev);
 }
 
@@ -3615,6 +3918,12 @@ static Property virtio_net_properties[] = {
                        TX_TIMER_INTERVAL),
     DEFINE_PROP_INT32("x-txburst", VirtIONet, net_conf.txburst, TX_BURST),
     DEFINE_PROP_STRING("tx", VirtIONet, net_conf.tx),
+    DEFINE_PROP_UINT32("x-coalesce-usecs", VirtIONet,
+                       net_conf.coalesce_usecs, 0),
+    DEFINE_PROP_UINT32("x-coalesce-frames", VirtIONet,
+                       net_conf.coalesce_frames, 32),
+    DEFINE_PROP_ARRAY("iothreads", VirtIONet, num_iothreads, iothread_ids,
+                      qdev_prop_string, char *),
     DEFINE_PROP_UINT16("rx_queue_size", VirtIONet, net_conf.rx_queue_size,
                        VIRTIO_NET_RX_QUEUE_DEFAULT_SIZE),
     DEFINE_PROP_UINT16("tx_queue_size", VirtIONet, net_conf.tx_queue_size,
@@ -3647,6 +3956,8 @@ static void virtio_net_class_init(ObjectClass *klass, void *data)
     vdc->set_status = virtio_net_set_status;
     vdc->guest_notifier_mask = virtio_net_guest_notifier_mask;
     vdc->guest_notifier_pending = virtio_net_guest_notifier_pending;
+    vdc->start_ioeventfd = virtio_net_start_ioeventfd;
+    vdc->stop_ioeventfd = virtio_net_stop_ioeventfd;
     vdc->legacy_features |= (0x1 << VIRTIO_NET_F_GSO);
     vdc->post_load = virtio_net_post_load_virtio;
     vdc->vmsd = &vmstate_virtio_net_device;
@@ -106,6 +106,11 @@
  *   transitioned to zone state closed for resource management purposes.
  *   Defaults to 'on'.
  *
+ * - `ioeventfd`
+ *   Once the host has configured shadow doorbells (Doorbell Buffer Config),
+ *   handle the doorbell writes of the I/O queues with eventfds instead of
+ *   MMIO emulation. Defaults to 'off'.
+ *
  * nvme namespace device parameters
  * ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
  * - `shared`
@@ -147,6 +152,10 @@
  *
  *     zoned.cross_read=<enable RAZB, default: false>
  *         Setting this property to true enables Read Across Zone Boundaries.
+ *
+ *     zoned.zone_file=<path to the zone state file, default: none>
+ *         Keep the zone descriptors and their extensions in a file, so that
+ *         zone states and write pointers survive a restart of QEMU.
  */
 
 #include "qemu/osdep.h"
@@ -221,6 +230,7 @@ static const uint32_t nvme_cse_acs[256] = {
     [NVME_ADM_CMD_ASYNC_EV_REQ]     = NVME_CMD_EFF_CSUPP,
     [NVME_ADM_CMD_NS_ATTACHMENT]    = NVME_CMD_EFF_CSUPP | NVME_CMD_EFF_NIC,
     [NVME_ADM_CMD_FORMAT_NVM]       = NVME_CMD_EFF_CSUPP | NVME_CMD_EFF_LBCC,
+    [NVME_ADM_CMD_DBBUF_CONFIG]     = NVME_CMD_EFF_CSUPP,
 };
 
 static const uint32_t nvme_cse_iocs_none[256];
@@ -297,6 +307,8 @@ static void nvme_assign_zone_state(NvmeNamespace *ns, NvmeZone *zone,
     default:
         zone->d.za = 0;
     }
+
+    nvme_zone_persist(ns, zone);
 }
 
 /*
@@ -570,6 +582,44 @@ static void nvme_sg_split(NvmeSg *sg, NvmeNamespace *ns, NvmeSg *data,
     }
 }
 
+/*
+ * Guest buffers that span several pages are often physically contiguous:
+ * extend the last mapping instead of adding one per PRP entry, so that the
+ * block layer sees fewer, larger segments.
+ */
+static void nvme_iovec_add(QEMUIOVector *iov, void *base, size_t len)
+{
+    if (iov->niov) {
+        struct iovec *last = &iov->iov[iov->niov - 1];
+
+        if (last->iov_base + last->iov_len == base) {
+            last->iov_len += len;
+            iov->size += len;
+            return;
+        }
+    }
+
+    qemu_iovec_add(iov, base, len);
+}
+
+static bool nvme_sglist_extend(QEMUSGList *qsg, hwaddr addr, size_t len)
+{
+    ScatterGatherEntry *last;
+
+    if (!qsg->nsg) {
+        return false;
+    }
+
+    last = &qsg->sg[qsg->nsg - 1];
+    if (last->base + last->len != addr) {
+        return false;
+    }
+
+    last->len += len;
+    qsg->size += len;
+    return true;
+}
+
 static uint16_t nvme_map_addr_cmb(NvmeCtrl *n, QEMUIOVector *iov, hwaddr addr,
                                   size_t len)
 {
@@ -583,7 +633,7 @@ static uint16_t nvme_map_addr_cmb(NvmeCtrl *n, QEMUIOVector *iov, hwaddr addr,
         return NVME_DATA_TRAS_ERROR;
     }
 
-    qemu_iovec_add(iov, nvme_addr_to_cmb(n, addr), len);
+    nvme_iovec_add(iov, nvme_addr_to_cmb(n, addr), len);
 
     return NVME_SUCCESS;
 }
@@ -599,7 +649,7 @@ static uint16_t nvme_map_addr_pmr(NvmeCtrl *n, QEMUIOVector *iov, hwaddr addr,
         return NVME_DATA_TRAS_ERROR;
     }
 
-    qemu_iovec_add(iov, nvme_addr_to_pmr(n, addr), len);
+    nvme_iovec_add(iov, nvme_addr_to_pmr(n, addr), len);
 
     return NVME_SUCCESS;
 }
@@ -640,6 +690,10 @@ static uint16_t nvme_map_addr(NvmeCtrl *n, NvmeSg *sg, hwaddr addr, size_t len)
         return NVME_INVALID_USE_OF_CMB | NVME_DNR;
     }
 
+    if (nvme_sglist_extend(&sg->qsg, addr, len)) {
+        return NVME_SUCCESS;
+    }
+
     if (sg->qsg.nsg + 1 > IOV_MAX) {
         goto max_mappings_exceeded;
     }
@@ -1265,18 +1319,91 @@ static inline void nvme_blk_write(BlockBackend *blk, int64_t offset,
     }
 }
 
+/*
+ * Shadow doorbells: once the host has set up a Doorbell Buffer Config,
+ * the submission queue tails and completion queue heads of the I/O queues
+ * are read from host memory, and the host only writes the doorbell
+ * registers when the value crosses the EventIdx that the controller
+ * publishes.  Values beyond the queue size are ignored, as for doorbell
+ * register writes.
+ */
+static void nvme_update_sq_eventidx(const NvmeSQueue *sq)
+{
+    uint32_t v = cpu_to_le32(sq->tail);
+
+    pci_dma_write(&sq->ctrl->parent_obj, sq->ei_addr, &v, sizeof(v));
+    trace_pci_nvme_eventidx_sq(sq->sqid, sq->tail);
+}
+
+static void nvme_update_sq_tail(NvmeSQueue *sq)
+{
+    uint32_t v;
+
+    pci_dma_read(&sq->ctrl->parent_obj, sq->db_addr, &v, sizeof(v));
+    v = le32_to_cpu(v);
+    if (v < sq->size) {
+        sq->tail = v;
+    }
+    trace_pci_nvme_shadow_doorbell_sq(sq->sqid, sq->tail);
+}
+
+static void nvme_update_cq_eventidx(const NvmeCQueue *cq)
+{
+    uint32_t v = cpu_to_le32(cq->head);
+
+    pci_dma_write(&cq->ctrl->parent_obj, cq->ei_addr, &v, sizeof(v));
+    trace_pci_nvme_eventidx_cq(cq->cqid, cq->head);
+}
+
+static void nvme_update_cq_head(NvmeCQueue *cq)
+{
+    NvmeCtrl *n = cq->ctrl;
+    bool pending = cq->head != cq->tail;
+    uint32_t v;
+
+    pci_dma_read(&n->parent_obj, cq->db_addr, &v, sizeof(v));
+    v = le32_to_cpu(v);
+    if (v < cq->size) {
+        cq->head = v;
+    }
+    trace_pci_nvme_shadow_doorbell_cq(cq->cqid, cq->head);
+
+    if (pending && cq->head == cq->tail) {
+        if (cq->irq_enabled) {
+            n->cq_pending--;
+        }
+
+        nvme_irq_deassert(n, cq);
+    }
+}
+
 static void nvme_post_cqes(void *opaque)
 {
     NvmeCQueue *cq = opaque;
     NvmeCtrl *n = cq->ctrl;
     NvmeRequest *req, *next;
-    bool pending = cq->head != cq->tail;
+    bool pending;
     int ret;
 
+    if (cq->db_addr) {
+        nvme_update_cq_head(cq);
+    }
+    pending = cq->head != cq->tail;
+
     QTAILQ_FOREACH_SAFE(req, &cq->req_list, entry, next) {
         NvmeSQueue *sq;
         hwaddr addr;
 
+        if (nvme_cq_full(cq) && cq->db_addr) {
+            /*
+             * The host may have consumed entries without ringing the
+             * doorbell: ask for a doorbell write at the next head update,
+             * then look again.
+             */
+            nvme_update_cq_eventidx(cq);
+            nvme_update_cq_head(cq);
+            pending = cq->head != cq->tail;
+        }
         if (nvme_cq_full(cq)) {
             break;
         }
@@ -1827,6 +1954,8 @@ static void nvme_advance_zone_wp(NvmeNamespace *ns, NvmeZone *zone,
 
     if (zone->d.wp == nvme_zone_wr_boundary(zone)) {
         nvme_zrm_finish(ns, zone);
+    } else {
+        nvme_zone_persist(ns, zone);
     }
 }
 
@@ -3923,9 +4052,93 @@ static uint16_t nvme_io_cmd(NvmeCtrl *n, NvmeRequest *req)
     return NVME_INVALID_OPCODE | NVME_DNR;
 }
 
+static void nvme_sq_notifier(EventNotifier *e)
+{
+    NvmeSQueue *sq = container_of(e, NvmeSQueue, notifier);
+
+    if (event_notifier_test_and_clear(e)) {
+        nvme_process_sq(sq);
+    }
+}
+
+static void nvme_cq_notifier(EventNotifier *e)
+{
+    NvmeCQueue *cq = container_of(e, NvmeCQueue, notifier);
+    NvmeSQueue *sq;
+    bool start_sqs;
+
+    if (!event_notifier_test_and_clear(e)) {
+        return;
+    }
+
+    start_sqs = nvme_cq_full(cq);
+    nvme_update_cq_head(cq);
+    nvme_update_cq_eventidx(cq);
+    if (start_sqs) {
+        QTAILQ_FOREACH(sq, &cq->sq_list, entry) {
+            timer_mod(sq->timer, qemu_clock_get_ns(QEMU_CLOCK_VIRTUAL) + 500);
+        }
+        timer_mod(cq->timer, qemu_clock_get_ns(QEMU_CLOCK_VIRTUAL) + 500);
+    }
+}
+
+/*
+ * With shadow doorbells the doorbell registers carry no information that
+ * is not in host memory, so writes to them can be turned into eventfd
+ * notifications that need no exit to the device model.  CAP.DSTRD is 0,
+ * as assumed by nvme_process_db().
+ */
+static hwaddr nvme_sq_db_offset(uint16_t sqid)
+{
+    return 0x1000 + (sqid << 3);
+}
+
+static hwaddr nvme_cq_db_offset(uint16_t cqid)
+{
+    return 0x1000 + (cqid << 3) + (1 << 2);
+}
+
+static void nvme_sq_init_dbbuf(NvmeSQueue *sq)
+{
+    NvmeCtrl *n = sq->ctrl;
+
+    sq->db_addr = n->dbbuf_dbs + (sq->sqid << 3);
+    sq->ei_addr = n->dbbuf_eis + (sq->sqid << 3);
+
+    if (n->params.ioeventfd && !sq->ioeventfd_enabled &&
+        !event_notifier_init(&sq->notifier, 0)) {
+        event_notifier_set_handler(&sq->notifier, nvme_sq_notifier);
+        memory_region_add_eventfd(&n->iomem, nvme_sq_db_offset(sq->sqid), 4,
+                                  false, 0, &sq->notifier);
+        sq->ioeventfd_enabled = true;
+    }
+}
+
+static void nvme_cq_init_dbbuf(NvmeCQueue *cq)
+{
+    NvmeCtrl *n = cq->ctrl;
+
+    cq->db_addr = n->dbbuf_dbs + (cq->cqid << 3) + (1 << 2);
+    cq->ei_addr = n->dbbuf_eis + (cq->cqid << 3) + (1 << 2);
+
+    if (n->params.ioeventfd && !cq->ioeventfd_enabled &&
+        !event_notifier_init(&cq->notifier, 0)) {
+        event_notifier_set_handler(&cq->notifier, nvme_cq_notifier);
+        memory_region_add_eventfd(&n->iomem, nvme_cq_db_offset(cq->cqid), 4,
+                                  false, 0, &cq->notifier);
+        cq->ioeventfd_enabled = true;
+    }
+}
+
 static void nvme_free_sq(NvmeSQueue *sq, NvmeCtrl *n)
 {
     n->sq[sq->sqid] = NULL;
+    if (sq->ioeventfd_enabled) {
+        memory_region_del_eventfd(&n->iomem, nvme_sq_db_offset(sq->sqid), 4,
+                                  false, 0, &sq->notifier);
+        event_notifier_set_handler(&sq->notifier, NULL);
+        event_notifier_cleanup(&sq->notifier);
+    }
     timer_free(sq->timer);
     g_free(sq->io_req);
     if (sq->sqid) {
@@ -3995,6 +4208,9 @@ static void nvme_init_sq(NvmeSQueue *sq, NvmeCtrl *n, uint64_t dma_addr,
         QTAILQ_INSERT_TAIL(&(sq->req_list), &sq->io_req[i], entry);
     }
     sq->timer = timer_new_ns(QEMU_CLOCK_VIRTUAL, nvme_process_sq, sq);
+    if (n->dbbuf_enabled && sqid) {
+        nvme_sq_init_dbbuf(sq);
+    }
 
     assert(n->cq[cqid]);
     cq = n->cq[cqid];
@@ -4294,6 +4510,12 @@ static uint16_t nvme_get_log(NvmeCtrl *n, NvmeRequest *req)
 static void nvme_free_cq(NvmeCQueue *cq, NvmeCtrl *n)
 {
     n->cq[cq->cqid] = NULL;
+    if (cq->ioeventfd_enabled) {
+        memory_region_del_eventfd(&n->iomem, nvme_cq_db_offset(cq->cqid), 4,
+                                  false, 0, &cq->notifier);
+        event_notifier_set_handler(&cq->notifier, NULL);
+        event_notifier_cleanup(&cq->notifier);
+    }
     timer_free(cq->timer);
     if (msix_enabled(&n->parent_obj)) {
         msix_vector_unuse(&n->parent_obj, cq->vector);
@@ -4352,6 +4574,9 @@ static void nvme_init_cq(NvmeCQueue *cq, NvmeCtrl *n, uint64_t dma_addr,
     QTAILQ_INIT(&cq->sq_list);
     n->cq[cqid] = cq;
     cq->timer = timer_new_ns(QEMU_CLOCK_VIRTUAL, nvme_post_cqes, cq);
+    if (n->dbbuf_enabled && cqid) {
+        nvme_cq_init_dbbuf(cq);
+    }
 }
 
 static uint16_t nvme_create_cq(NvmeCtrl *n, NvmeRequest *req)
@@ -5451,6 +5676,49 @@ out:
     return status;
 }
 
+/*
+ * Only the I/O queues use the shadow doorbells: host drivers commonly do
+ * not maintain the entries of the admin queues, whose doorbell registers
+ * thus remain authoritative.
+ */
+static uint16_t nvme_dbbuf_config(NvmeCtrl *n, const NvmeRequest *req)
+{
+    uint64_t dbs_addr = le64_to_cpu(req->cmd.dptr.prp1);
+    uint64_t eis_addr = le64_to_cpu(req->cmd.dptr.prp2);
+    int i;
+
+    /* Both buffers must be page aligned */
+    if (dbs_addr & (n->page_size - 1) || eis_addr & (n->page_size - 1)) {
+        return NVME_INVALID_FIELD | NVME_DNR;
+    }
+
+    n->dbbuf_dbs = dbs_addr;
+    n->dbbuf_eis = eis_addr;
+    n->dbbuf_enabled = true;
+
+    for (i = 1; i < n->params.max_ioqpairs + 1; i++) {
+        NvmeSQueue *sq = n->sq[i];
+        NvmeCQueue *cq = n->cq[i];
+
+        if (sq) {
+            uint32_t v = cpu_to_le32(sq->tail);
+
+            nvme_sq_init_dbbuf(sq);
+            pci_dma_write(&n->parent_obj, sq->db_addr, &v, sizeof(v));
+        }
+        if (cq) {
+            uint32_t v = cpu_to_le32(cq->head);
+
+            nvme_cq_init_dbbuf(cq);
+            pci_dma_write(&n->parent_obj, cq->db_addr, &v, sizeof(v));
+        }
+    }
+
+    trace_pci_nvme_dbbuf_config(dbs_addr, eis_addr);
+
+    return NVME_SUCCESS;
+}
+
 static uint16_t nvme_admin_cmd(NvmeCtrl *n, NvmeRequest *req)
 {
     trace_pci_nvme_admin_cmd(nvme_cid(req), nvme_sqid(req), req->cmd.opcode,
@@ -5491,6 +5759,8 @@ static uint16_t nvme_admin_cmd(NvmeCtrl *n, NvmeRequest *req)
         return nvme_ns_attachment(n, req);
     case NVME_ADM_CMD_FORMAT_NVM:
         return nvme_format(n, req);
+    case NVME_ADM_CMD_DBBUF_CONFIG:
+        return nvme_dbbuf_config(n, req);
     default:
         assert(false);
     }
@@ -5509,6 +5779,10 @@ static void nvme_process_sq(void *opaque)
     NvmeCmd cmd;
     NvmeRequest *req;
 
+    if (sq->db_addr) {
+        nvme_update_sq_tail(sq);
+    }
+
     while (!(nvme_sq_empty(sq) || QTAILQ_EMPTY(&sq->req_list))) {
         addr = sq->dma_addr + sq->head * n->sqe_size;
         if (nvme_addr_read(n, addr, (void *)&cmd, sizeof(cmd))) {
@@ -5532,6 +5806,16 @@ static void nvme_process_sq(void *opaque)
             req->status = status;
             nvme_enqueue_req_completion(cq, req);
         }
+
+        if (sq->db_addr) {
+            /*
+             * Publish how far the queue has been read, then pick up the
+             * entries that the host added meanwhile without a doorbell
+             * write.
+             */
+            nvme_update_sq_eventidx(sq);
+            nvme_update_sq_tail(sq);
+        }
     }
 }
 
@@ -5569,6 +5853,9 @@ static void nvme_ctrl_reset(NvmeCtrl *n)
     n->aer_queued = 0;
     n->outstanding_aers = 0;
     n->qs_created = false;
+    n->dbbuf_dbs = 0;
+    n->dbbuf_eis = 0;
+    n->dbbuf_enabled = false;
 }
 
 static void nvme_ctrl_shutdown(NvmeCtrl *n)
@@ -6034,6 +6321,7 @@ static void nvme_process_db(NvmeCtrl *n, hwaddr addr, int val)
 
         uint16_t new_head = val & 0xffff;
         int start_sqs;
+        bool pending;
         NvmeCQueue *cq;
 
         qid = (addr - (0x1000 + (1 << 2))) >> 3;
@@ -6085,7 +6373,11 @@ static void nvme_process_db(NvmeCtrl *n, hwaddr addr, int val)
         trace_pci_nvme_mmio_doorbell_cq(cq->cqid, new_head);
 
         start_sqs = nvme_cq_full(cq) ? 1 : 0;
+        pending = cq->head != cq->tail;
         cq->head = new_head;
+        if (cq->db_addr) {
+            nvme_update_cq_eventidx(cq);
+        }
         if (start_sqs) {
             NvmeSQueue *sq;
             QTAILQ_FOREACH(sq, &cq->sq_list, entry) {
@@ -6094,7 +6386,7 @@ static void nvme_process_db(NvmeCtrl *n, hwaddr addr, int val)
             timer_mod(cq->timer, qemu_clock_get_ns(QEMU_CLOCK_VIRTUAL) + 500);
         }
 
-        if (cq->tail == cq->head) {
+        if (pending && cq->tail == cq->head) {
             if (cq->irq_enabled) {
                 n->cq_pending--;
             }
@@ -6420,7 +6712,8 @@ static void nvme_init_ctrl(NvmeCtrl *n, PCIDevice *pci_dev)
 
     id->mdts = n->params.mdts;
     id->ver = cpu_to_le32(NVME_SPEC_VER);
-    id->oacs = cpu_to_le16(NVME_OACS_NS_MGMT | NVME_OACS_FORMAT);
+    id->oacs = cpu_to_le16(NVME_OACS_NS_MGMT | NVME_OACS_FORMAT |
+                           NVME_OACS_DBBUF);
     id->cntrltype = 0x1;
 
     /*
@@ -6608,6 +6901,7 @@ static Property nvme_props[] = {
     DEFINE_PROP_UINT8("vsl", NvmeCtrl, params.vsl, 7),
     DEFINE_PROP_BOOL("use-intel-id", NvmeCtrl, params.use_intel_id, false),
     DEFINE_PROP_BOOL("legacy-cmb", NvmeCtrl, params.legacy_cmb, false),
+    DEFINE_PROP_BOOL("ioeventfd", NvmeCtrl, params.ioeventfd, false),
     DEFINE_PROP_UINT8("zoned.zasl", NvmeCtrl, params.zasl, 0),
     DEFINE_PROP_BOOL("zoned.auto_transition", NvmeCtrl,
                      params.auto_transition_zones, true),
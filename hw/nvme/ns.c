@@ -25,6 +25,28 @@
 #define MIN_DISCARD_GRANULARITY (4 * KiB)
 #define NVME_DEFAULT_ZONE_SIZE   (128 * MiB)
 
+/*
+ * The zone state file starts with a header recording the zone geometry,
+ * followed by one descriptor per zone and then by the zone descriptor
+ * extensions, if any.  Everything is kept in host byte order; a file
+ * written by a host of the other endianness fails the magic check.
+ */
+#define NVME_ZONE_META_MAGIC    0x5a4e5351 /* "QSNZ" */
+#define NVME_ZONE_META_VERSION  1
+
+typedef struct NvmeZoneMetaHeader {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t num_zones;
+    uint32_t zd_extension_size;
+    uint64_t zone_size;
+    uint64_t zone_capacity;
+    uint64_t lbasz;
+    uint8_t  rsvd[24];
+} NvmeZoneMetaHeader;
+
+QEMU_BUILD_BUG_ON(sizeof(NvmeZoneMetaHeader) != sizeof(NvmeZoneDescr));
+
 void nvme_ns_init_format(NvmeNamespace *ns)
 {
     NvmeIdNs *id_ns = &ns->id_ns;
@@ -222,7 +244,7 @@ static void nvme_ns_zoned_init_state(NvmeNamespace *ns)
     int i;
 
     ns->zone_array = g_new0(NvmeZone, ns->num_zones);
-    if (ns->params.zd_extension_size) {
+    if (ns->params.zd_extension_size && !ns->params.zone_file) {
         ns->zd_extensions = g_malloc0(ns->params.zd_extension_size *
                                       ns->num_zones);
     }
@@ -316,6 +338,8 @@ static void nvme_clear_zone(NvmeNamespace *ns, NvmeZone *zone)
         trace_pci_nvme_clear_ns_reset(state, zone->d.zslba);
         nvme_set_zone_state(zone, NVME_ZONE_STATE_EMPTY);
     }
+
+    nvme_zone_persist(ns, zone);
 }
 
 /*
@@ -346,6 +370,182 @@ static void nvme_zoned_ns_shutdown(NvmeNamespace *ns)
     assert(ns->nr_open_zones == 0);
 }
 
+#ifdef CONFIG_POSIX
+static int nvme_ns_zoned_map_state(NvmeNamespace *ns, bool *fresh,
+                                   Error **errp)
+{
+    const char *path = ns->params.zone_file;
+    struct stat st;
+    void *ptr;
+    int fd;
+
+    fd = qemu_create(path, O_RDWR, 0644, errp);
+    if (fd < 0) {
+        return -1;
+    }
+
+    if (fstat(fd, &st) < 0) {
+        error_setg_errno(errp, errno, "could not stat zone state file '%s'",
+                         path);
+        goto err;
+    }
+
+    *fresh = st.st_size == 0;
+    if (*fresh) {
+        if (ftruncate(fd, ns->zone_meta_size) < 0) {
+            error_setg_errno(errp, errno,
+                             "could not resize zone state file '%s'", path);
+            goto err;
+        }
+    } else if (st.st_size != ns->zone_meta_size) {
+        error_setg(errp, "zone state file '%s' has size %"PRId64", expected "
+                   "%zu", path, (int64_t)st.st_size, ns->zone_meta_size);
+        goto err;
+    }
+
+    ptr = mmap(NULL, ns->zone_meta_size, PROT_READ | PROT_WRITE, MAP_SHARED,
+               fd, 0);
+    if (ptr == MAP_FAILED) {
+        error_setg_errno(errp, errno, "could not map zone state file '%s'",
+                         path);
+        goto err;
+    }
+
+    close(fd);
+    ns->zone_meta = ptr;
+    return 0;
+
+err:
+    close(fd);
+    return -1;
+}
+
+static void nvme_ns_zoned_unmap_state(NvmeNamespace *ns)
+{
+    if (ns->zone_meta) {
+        msync(ns->zone_meta, ns->zone_meta_size, MS_SYNC);
+        munmap(ns->zone_meta, ns->zone_meta_size);
+        ns->zone_meta = NULL;
+        ns->zone_meta_descrs = NULL;
+        ns->zd_extensions = NULL;
+    }
+}
+
+static void nvme_ns_zoned_sync_state(NvmeNamespace *ns)
+{
+    if (ns->zone_meta) {
+        msync(ns->zone_meta, ns->zone_meta_size, MS_SYNC);
+    }
+}
+#else
+static int nvme_ns_zoned_map_state(NvmeNamespace *ns, bool *fresh,
+                                   Error **errp)
+{
+    error_setg(errp, "zone state files are not supported on this host");
+    return -1;
+}
+
+static void nvme_ns_zoned_unmap_state(NvmeNamespace *ns)
+{
+}
+
+static void nvme_ns_zoned_sync_state(NvmeNamespace *ns)
+{
+}
+#endif
+
+/*
+ * Attach the zone state file and restore the zones from it, or save their
+ * initial state if the file is new.  Zones that were open are closed, as
+ * they would be by a power loss.
+ */
+static int nvme_ns_zoned_load_state(NvmeNamespace *ns, Error **errp)
+{
+    NvmeZoneMetaHeader hdr = {
+        .magic = NVME_ZONE_META_MAGIC,
+        .version = NVME_ZONE_META_VERSION,
+        .num_zones = ns->num_zones,
+        .zd_extension_size = ns->params.zd_extension_size,
+        .zone_size = ns->zone_size,
+        .zone_capacity = ns->zone_capacity,
+        .lbasz = ns->lbasz,
+    };
+    NvmeZone *zone;
+    bool fresh;
+    int i;
+
+    ns->zone_meta_size = sizeof(hdr) + (size_t)ns->num_zones *
+        (sizeof(NvmeZoneDescr) + ns->params.zd_extension_size);
+    if (nvme_ns_zoned_map_state(ns, &fresh, errp)) {
+        return -1;
+    }
+
+    ns->zone_meta_descrs = ns->zone_meta + sizeof(hdr);
+    if (ns->params.zd_extension_size) {
+        ns->zd_extensions = (uint8_t *)&ns->zone_meta_descrs[ns->num_zones];
+    }
+
+    if (fresh) {
+        memcpy(ns->zone_meta, &hdr, sizeof(hdr));
+        for (i = 0; i < ns->num_zones; i++) {
+            nvme_zone_persist(ns, &ns->zone_array[i]);
+        }
+        return 0;
+    }
+
+    if (memcmp(ns->zone_meta, &hdr, sizeof(hdr))) {
+        error_setg(errp, "zone state file '%s' does not match the zone "
+                   "geometry of the namespace", ns->params.zone_file);
+        goto err;
+    }
+
+    zone = ns->zone_array;
+    for (i = 0; i < ns->num_zones; i++, zone++) {
+        NvmeZoneDescr *d = &ns->zone_meta_descrs[i];
+
+        if (d->zslba != zone->d.zslba || d->zcap != zone->d.zcap ||
+            d->wp < d->zslba || d->wp > nvme_zone_wr_boundary(zone)) {
+            goto corrupt;
+        }
+
+        zone->d = *d;
+        zone->w_ptr = zone->d.wp;
+
+        switch (nvme_get_zone_state(zone)) {
+        case NVME_ZONE_STATE_EMPTY:
+        case NVME_ZONE_STATE_READ_ONLY:
+        case NVME_ZONE_STATE_OFFLINE:
+            break;
+        case NVME_ZONE_STATE_IMPLICITLY_OPEN:
+        case NVME_ZONE_STATE_EXPLICITLY_OPEN:
+        case NVME_ZONE_STATE_CLOSED:
+            if (ns->params.max_active_zones &&
+                ns->nr_active_zones == ns->params.max_active_zones) {
+                error_setg(errp, "zone state file '%s' has more active zones "
+                           "than zoned.max_active allows",
+                           ns->params.zone_file);
+                goto err;
+            }
+            nvme_clear_zone(ns, zone);
+            break;
+        case NVME_ZONE_STATE_FULL:
+            QTAILQ_INSERT_TAIL(&ns->full_zones, zone, entry);
+            break;
+        default:
+            goto corrupt;
+        }
+    }
+
+    return 0;
+
+corrupt:
+    error_setg(errp, "zone state file '%s' has an invalid descriptor for "
+               "zone %d", ns->params.zone_file, i);
+err:
+    nvme_ns_zoned_unmap_state(ns);
+    return -1;
+}
+
 static int nvme_ns_check_constraints(NvmeNamespace *ns, Error **errp)
 {
     if (!ns->blkconf.blk) {
@@ -414,6 +614,9 @@ int nvme_ns_setup(NvmeNamespace *ns, Error **errp)
             return -1;
         }
         nvme_ns_init_zoned(ns);
+        if (ns->params.zone_file && nvme_ns_zoned_load_state(ns, errp)) {
+            return -1;
+        }
     }
 
     return 0;
@@ -429,6 +632,7 @@ void nvme_ns_shutdown(NvmeNamespace *ns)
     blk_flush(ns->blkconf.blk);
     if (ns->params.zoned) {
         nvme_zoned_ns_shutdown(ns);
+        nvme_ns_zoned_sync_state(ns);
     }
 }
 
@@ -437,7 +641,11 @@ void nvme_ns_cleanup(NvmeNamespace *ns)
     if (ns->params.zoned) {
         g_free(ns->id_ns_zoned);
         g_free(ns->zone_array);
-        g_free(ns->zd_extensions);
+        if (ns->zone_meta) {
+            nvme_ns_zoned_unmap_state(ns);
+        } else {
+            g_free(ns->zd_extensions);
+        }
     }
 }
 
@@ -556,6 +764,7 @@ static Property nvme_ns_props[] = {
                        params.max_open_zones, 0),
     DEFINE_PROP_UINT32("zoned.descr_ext_size", NvmeNamespace,
                        params.zd_extension_size, 0),
+    DEFINE_PROP_STRING("zoned.zone_file", NvmeNamespace, params.zone_file),
     DEFINE_PROP_BOOL("eui64-default", NvmeNamespace, params.eui64_default,
                      true),
     DEFINE_PROP_END_OF_LIST(),
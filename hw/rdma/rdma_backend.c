@@ -29,6 +29,9 @@
 
 #define MAD_HDR_SIZE sizeof(struct ibv_grh)
 
+/* Number of work completions fetched from the device per ibv_poll_cq() */
+#define POLL_CQ_BATCH 32
+
 typedef struct BackendCtx {
     void *up_ctx;
     struct ibv_sge sge; /* Used to save MAD recv buffer */
@@ -92,7 +95,7 @@ static int rdma_poll_cq(RdmaDeviceResources *rdma_dev_res, struct ibv_cq *ibcq)
 {
     int i, ne, total_ne = 0;
     BackendCtx *bctx;
-    struct ibv_wc wc[2];
+    struct ibv_wc wc[POLL_CQ_BATCH];
     RdmaProtectedGSList *cqe_ctx_list;
 
     WITH_QEMU_LOCK_GUARD(&rdma_dev_res->lock) {
@@ -122,7 +125,7 @@ static int rdma_poll_cq(RdmaDeviceResources *rdma_dev_res, struct ibv_cq *ibcq)
                 g_free(bctx);
             }
             total_ne += ne;
-        } while (ne > 0);
+        } while (ne == POLL_CQ_BATCH);
         qatomic_sub(&rdma_dev_res->stats.missing_cqe, total_ne);
     }
 
@@ -25,7 +25,8 @@ static void process_config_write(QIOChannel *ioc, PCIDevice *dev,
                                  MPQemuMsg *msg, Error **errp);
 static void process_config_read(QIOChannel *ioc, PCIDevice *dev,
                                 MPQemuMsg *msg, Error **errp);
-static void process_bar_write(QIOChannel *ioc, MPQemuMsg *msg, Error **errp);
+static void process_bar_write(QIOChannel *ioc, MPQemuMsg *msg, bool reply,
+                              Error **errp);
 static void process_bar_read(QIOChannel *ioc, MPQemuMsg *msg, Error **errp);
 static void process_device_reset_msg(QIOChannel *ioc, PCIDevice *dev,
                                      Error **errp);
@@ -61,7 +62,10 @@ void coroutine_fn mpqemu_remote_msg_loop_co(void *data)
             process_config_read(com->ioc, pci_dev, &msg, &local_err);
             break;
         case MPQEMU_CMD_BAR_WRITE:
-            process_bar_write(com->ioc, &msg, &local_err);
+            process_bar_write(com->ioc, &msg, true, &local_err);
+            break;
+        case MPQEMU_CMD_BAR_WRITE_POSTED:
+            process_bar_write(com->ioc, &msg, false, &local_err);
             break;
         case MPQEMU_CMD_BAR_READ:
             process_bar_read(com->ioc, &msg, &local_err);
@@ -139,7 +143,8 @@ static void process_config_read(QIOChannel *ioc, PCIDevice *dev,
     }
 }
 
-static void process_bar_write(QIOChannel *ioc, MPQemuMsg *msg, Error **errp)
+static void process_bar_write(QIOChannel *ioc, MPQemuMsg *msg, bool reply,
+                              Error **errp)
 {
     ERRP_GUARD();
     BarAccessMsg *bar_access = &msg->data.bar_access;
@@ -167,6 +172,10 @@ static void process_bar_write(QIOChannel *ioc, MPQemuMsg *msg, Error **errp)
     }
 
 fail:
+    if (!reply) {
+        return;
+    }
+
     ret.cmd = MPQEMU_CMD_RET;
     ret.size = sizeof(ret.data.u64);
 
@@ -70,7 +70,7 @@ bool mpqemu_msg_send(MPQemuMsg *msg, QIOChannel *ioc, Error **errp)
     }
 
     if (!qio_channel_writev_full_all(ioc, send, G_N_ELEMENTS(send),
-                                    fds, nfds, errp)) {
+                                    fds, nfds, 0, errp)) {
         ret = true;
     } else {
         trace_mpqemu_send_io_error(msg->cmd, msg->size, nfds);
@@ -216,6 +216,20 @@ uint64_t mpqemu_msg_send_and_await_reply(MPQemuMsg *msg, PCIProxyDev *pdev,
     return msg_reply.data.u64;
 }
 
+/*
+ * Send msg without waiting for the remote to process it.  The channel
+ * keeps the order of messages, so a later request that does wait for a
+ * reply also waits for msg to be processed.
+ * Called from VCPU thread in non-coroutine context.
+ */
+bool mpqemu_msg_send_posted(MPQemuMsg *msg, PCIProxyDev *pdev, Error **errp)
+{
+    assert(!qemu_in_coroutine());
+
+    QEMU_LOCK_GUARD(&pdev->io_mutex);
+    return mpqemu_msg_send(msg, pdev->ioc, errp);
+}
+
 bool mpqemu_msg_valid(MPQemuMsg *msg)
 {
     if (msg->cmd >= MPQEMU_CMD_MAX || msg->cmd < 0) {
@@ -45,7 +45,7 @@
 #include <scsi/sg.h>
 #endif
 
-#define SCSI_WRITE_SAME_MAX         (512 * KiB)
+#define SCSI_WRITE_SAME_MAX         (4 * MiB)
 #define SCSI_DMA_BUF_SIZE           (128 * KiB)
 #define SCSI_MAX_INQUIRY_LEN        256
 #define SCSI_MAX_MODE_LEN           256
@@ -1611,12 +1611,32 @@ static void scsi_unmap_complete_noio(UnmapCBData *data, int ret)
 {
     SCSIDiskReq *r = data->r;
     SCSIDiskState *s = DO_UPCAST(SCSIDiskState, qdev, r->req.dev);
+    uint32_t max_merge = BDRV_REQUEST_MAX_BYTES / s->qdev.blocksize;
 
     assert(r->req.aiocb == NULL);
 
-    if (data->count > 0) {
+    while (data->count > 0) {
         uint64_t sector_num = ldq_be_p(&data->inbuf[0]);
         uint32_t nb_sectors = ldl_be_p(&data->inbuf[8]) & 0xffffffffULL;
+
+        data->count--;
+        data->inbuf += 16;
+
+        /*
+         * Guests such as fstrim send many descriptors for adjacent ranges:
+         * merge them into a single discard, as long as it stays within
+         * one block layer request.  Empty descriptors are legal and need
+         * no request at all.
+         */
+        while (data->count > 0 &&
+               ldq_be_p(&data->inbuf[0]) == sector_num + nb_sectors &&
+               nb_sectors <= max_merge &&
+               ldl_be_p(&data->inbuf[8]) <= max_merge - nb_sectors) {
+            nb_sectors += ldl_be_p(&data->inbuf[8]);
+            data->count--;
+            data->inbuf += 16;
+        }
+
         r->sector = sector_num * (s->qdev.blocksize / BDRV_SECTOR_SIZE);
         r->sector_count = nb_sectors * (s->qdev.blocksize / BDRV_SECTOR_SIZE);
 
@@ -1626,6 +1646,9 @@ static void scsi_unmap_complete_noio(UnmapCBData *data, int ret)
             scsi_check_condition(r, SENSE_CODE(LBA_OUT_OF_RANGE));
             goto done;
         }
+        if (nb_sectors == 0) {
+            continue;
+        }
 
         block_acct_start(blk_get_stats(s->qdev.conf.blk), &r->acct,
                          r->sector_count * BDRV_SECTOR_SIZE,
@@ -1635,8 +1658,6 @@ static void scsi_unmap_complete_noio(UnmapCBData *data, int ret)
                                         r->sector * BDRV_SECTOR_SIZE,
                                         r->sector_count * BDRV_SECTOR_SIZE,
                                         scsi_unmap_complete, data);
-        data->count--;
-        data->inbuf += 16;
         return;
     }
 
@@ -1723,9 +1744,37 @@ typedef struct WriteSameCBData {
     int64_t sector;
     int nb_sectors;
     QEMUIOVector qiov;
-    struct iovec iov;
+    void *buf;
 } WriteSameCBData;
 
+static void scsi_write_same_complete(void *opaque, int ret);
+
+/*
+ * Write the next chunk of a WRITE SAME request.  Every element of the
+ * vector points to the same copy of the block, so no bounce buffer has
+ * to be filled with the pattern.
+ */
+static void scsi_write_same_submit(WriteSameCBData *data)
+{
+    SCSIDiskReq *r = data->r;
+    SCSIDiskState *s = DO_UPCAST(SCSIDiskState, qdev, r->req.dev);
+    size_t len = MIN((size_t)data->nb_sectors * BDRV_SECTOR_SIZE,
+                     MIN(SCSI_WRITE_SAME_MAX,
+                         (size_t)IOV_MAX * s->qdev.blocksize));
+
+    qemu_iovec_reset(&data->qiov);
+    while (data->qiov.size < len) {
+        qemu_iovec_add(&data->qiov, data->buf, s->qdev.blocksize);
+    }
+
+    block_acct_start(blk_get_stats(s->qdev.conf.blk), &r->acct,
+                     data->qiov.size, BLOCK_ACCT_WRITE);
+    r->req.aiocb = blk_aio_pwritev(s->qdev.conf.blk,
+                                   data->sector << BDRV_SECTOR_BITS,
+                                   &data->qiov, 0,
+                                   scsi_write_same_complete, data);
+}
+
 static void scsi_write_same_complete(void *opaque, int ret)
 {
     WriteSameCBData *data = opaque;
@@ -1741,20 +1790,10 @@ static void scsi_write_same_complete(void *opaque, int ret)
 
     block_acct_done(blk_get_stats(s->qdev.conf.blk), &r->acct);
 
-    data->nb_sectors -= data->iov.iov_len / BDRV_SECTOR_SIZE;
-    data->sector += data->iov.iov_len / BDRV_SECTOR_SIZE;
-    data->iov.iov_len = MIN(data->nb_sectors * BDRV_SECTOR_SIZE,
-                            data->iov.iov_len);
-    if (data->iov.iov_len) {
-        block_acct_start(blk_get_stats(s->qdev.conf.blk), &r->acct,
-                         data->iov.iov_len, BLOCK_ACCT_WRITE);
-        /* Reinitialize qiov, to handle unaligned WRITE SAME request
-         * where final qiov may need smaller size */
-        qemu_iovec_init_external(&data->qiov, &data->iov, 1);
-        r->req.aiocb = blk_aio_pwritev(s->qdev.conf.blk,
-                                       data->sector << BDRV_SECTOR_BITS,
-                                       &data->qiov, 0,
-                                       scsi_write_same_complete, data);
+    data->nb_sectors -= data->qiov.size / BDRV_SECTOR_SIZE;
+    data->sector += data->qiov.size / BDRV_SECTOR_SIZE;
+    if (data->nb_sectors) {
+        scsi_write_same_submit(data);
         aio_context_release(blk_get_aio_context(s->qdev.conf.blk));
         return;
     }
@@ -1763,7 +1802,8 @@ static void scsi_write_same_complete(void *opaque, int ret)
 
 done:
     scsi_req_unref(&r->req);
-    qemu_vfree(data->iov.iov_base);
+    qemu_iovec_destroy(&data->qiov);
+    qemu_vfree(data->buf);
     g_free(data);
     aio_context_release(blk_get_aio_context(s->qdev.conf.blk));
 }
@@ -1774,8 +1814,6 @@ static void scsi_disk_emulate_write_same(SCSIDiskReq *r, uint8_t *inbuf)
     SCSIDiskState *s = DO_UPCAST(SCSIDiskState, qdev, req->dev);
     uint32_t nb_sectors = scsi_data_cdb_xfer(r->req.cmd.buf);
     WriteSameCBData *data;
-    uint8_t *buf;
-    int i;
 
     /* Fail if PBDATA=1 or LBDATA=1 or ANCHOR=1.  */
     if (nb_sectors == 0 || (req->cmd.buf[1] & 0x16)) {
@@ -1811,23 +1849,13 @@ static void scsi_disk_emulate_write_same(SCSIDiskReq *r, uint8_t *inbuf)
     data->r = r;
     data->sector = r->req.cmd.lba * (s->qdev.blocksize / BDRV_SECTOR_SIZE);
     data->nb_sectors = nb_sectors * (s->qdev.blocksize / BDRV_SECTOR_SIZE);
-    data->iov.iov_len = MIN(data->nb_sectors * BDRV_SECTOR_SIZE,
-                            SCSI_WRITE_SAME_MAX);
-    data->iov.iov_base = buf = blk_blockalign(s->qdev.conf.blk,
-                                              data->iov.iov_len);
-    qemu_iovec_init_external(&data->qiov, &data->iov, 1);
-
-    for (i = 0; i < data->iov.iov_len; i += s->qdev.blocksize) {
-        memcpy(&buf[i], inbuf, s->qdev.blocksize);
-    }
+    data->buf = blk_blockalign(s->qdev.conf.blk, s->qdev.blocksize);
+    memcpy(data->buf, inbuf, s->qdev.blocksize);
+    qemu_iovec_init(&data->qiov,
+                    MIN(nb_sectors, SCSI_WRITE_SAME_MAX / s->qdev.blocksize));
 
     scsi_req_ref(&r->req);
-    block_acct_start(blk_get_stats(s->qdev.conf.blk), &r->acct,
-                     data->iov.iov_len, BLOCK_ACCT_WRITE);
-    r->req.aiocb = blk_aio_pwritev(s->qdev.conf.blk,
-                                   data->sector << BDRV_SECTOR_BITS,
-                                   &data->qiov, 0,
-                                   scsi_write_same_complete, data);
+    scsi_write_same_submit(data);
 }
 
 static void scsi_disk_emulate_write_data(SCSIRequest *req)
@@ -29,6 +29,8 @@
 #include "hw/irq.h"
 #include "qapi/error.h"
 #include "qemu/error-report.h"
+#include "qemu/main-loop.h"
+#include "qemu/seqlock.h"
 #include "qemu/timer.h"
 #include "hw/timer/hpet.h"
 #include "hw/sysbus.h"
@@ -72,6 +74,13 @@ struct HPETState {
     /*< public >*/
 
     MemoryRegion iomem;
+    /*
+     * The MMIO region is dispatched without the BQL.  Everything but
+     * the main counter takes it anyway; updates to config, hpet_offset
+     * and hpet_counter also go through counter_seq, so that the main
+     * counter can be read without any lock.
+     */
+    QemuSeqLock counter_seq;
     uint64_t hpet_offset;
     bool hpet_offset_saved;
     qemu_irq irqs[HPET_NUM_IRQ_ROUTES];
@@ -417,6 +426,23 @@ static void hpet_del_timer(HPETTimer *t)
     update_irq(t, 0);
 }
 
+/* Called without the BQL */
+static uint64_t hpet_read_counter(HPETState *s)
+{
+    uint64_t cur_tick;
+    unsigned start;
+
+    do {
+        start = seqlock_read_begin(&s->counter_seq);
+        if (hpet_enabled(s)) {
+            cur_tick = hpet_get_ticks(s);
+        } else {
+            cur_tick = s->hpet_counter;
+        }
+    } while (seqlock_read_retry(&s->counter_seq, start));
+    return cur_tick;
+}
+
 static uint64_t hpet_ram_read(void *opaque, hwaddr addr,
                               unsigned size)
 {
@@ -425,6 +451,16 @@ static uint64_t hpet_ram_read(void *opaque, hwaddr addr,
 
     DPRINTF("qemu: Enter hpet_ram_readl at %" PRIx64 "\n", addr);
     index = addr;
+
+    /* Guests that use the HPET as a clocksource mostly read this.  */
+    if (index == HPET_COUNTER || index == HPET_COUNTER + 4) {
+        cur_tick = hpet_read_counter(s);
+        DPRINTF("qemu: reading counter%s = %" PRIx64 "\n",
+                index == HPET_COUNTER ? "" : " + 4", cur_tick);
+        return index == HPET_COUNTER ? cur_tick : cur_tick >> 32;
+    }
+
+    QEMU_IOTHREAD_LOCK_GUARD();
     /*address range of all TN regs*/
     if (index >= 0x100 && index <= 0x3ff) {
         uint8_t timer_id = (addr - 0x100) / 0x20;
@@ -463,22 +499,6 @@ static uint64_t hpet_ram_read(void *opaque, hwaddr addr,
         case HPET_CFG + 4:
             DPRINTF("qemu: invalid HPET_CFG + 4 hpet_ram_readl\n");
             return 0;
-        case HPET_COUNTER:
-            if (hpet_enabled(s)) {
-                cur_tick = hpet_get_ticks(s);
-            } else {
-                cur_tick = s->hpet_counter;
-            }
-            DPRINTF("qemu: reading counter  = %" PRIx64 "\n", cur_tick);
-            return cur_tick;
-        case HPET_COUNTER + 4:
-            if (hpet_enabled(s)) {
-                cur_tick = hpet_get_ticks(s);
-            } else {
-                cur_tick = s->hpet_counter;
-            }
-            DPRINTF("qemu: reading counter + 4  = %" PRIx64 "\n", cur_tick);
-            return cur_tick >> 32;
         case HPET_STATUS:
             return s->isr;
         default:
@@ -496,6 +516,8 @@ static void hpet_ram_write(void *opaque, hwaddr addr,
     HPETState *s = opaque;
     uint64_t old_val, new_val, val, index;
 
+    QEMU_IOTHREAD_LOCK_GUARD();
+
     DPRINTF("qemu: Enter hpet_ram_writel at %" PRIx64 " = 0x%" PRIx64 "\n",
             addr, value);
     index = addr;
@@ -593,11 +615,18 @@ static void hpet_ram_write(void *opaque, hwaddr addr,
             return;
         case HPET_CFG:
             val = hpet_fixup_reg(new_val, old_val, HPET_CFG_WRITE_MASK);
+            seqlock_write_begin(&s->counter_seq);
             s->config = (s->config & 0xffffffff00000000ULL) | val;
             if (activating_bit(old_val, new_val, HPET_CFG_ENABLE)) {
-                /* Enable main counter and interrupt generation. */
                 s->hpet_offset =
                     ticks_to_ns(s->hpet_counter) - qemu_clock_get_ns(QEMU_CLOCK_VIRTUAL);
+            } else if (deactivating_bit(old_val, new_val, HPET_CFG_ENABLE)) {
+                s->hpet_counter = hpet_get_ticks(s);
+            }
+            seqlock_write_end(&s->counter_seq);
+
+            if (activating_bit(old_val, new_val, HPET_CFG_ENABLE)) {
+                /* Enable main counter and interrupt generation. */
                 for (i = 0; i < s->num_timers; i++) {
                     if ((&s->timer[i])->cmp != ~0ULL) {
                         hpet_set_timer(&s->timer[i]);
@@ -605,7 +634,6 @@ static void hpet_ram_write(void *opaque, hwaddr addr,
                 }
             } else if (deactivating_bit(old_val, new_val, HPET_CFG_ENABLE)) {
                 /* Halt main counter and disable interrupt generation. */
-                s->hpet_counter = hpet_get_ticks(s);
                 for (i = 0; i < s->num_timers; i++) {
                     hpet_del_timer(&s->timer[i]);
                 }
@@ -637,8 +665,10 @@ static void hpet_ram_write(void *opaque, hwaddr addr,
             if (hpet_enabled(s)) {
                 DPRINTF("qemu: Writing counter while HPET enabled!\n");
             }
+            seqlock_write_begin(&s->counter_seq);
             s->hpet_counter =
                 (s->hpet_counter & 0xffffffff00000000ULL) | value;
+            seqlock_write_end(&s->counter_seq);
             DPRINTF("qemu: HPET counter written. ctr = 0x%" PRIx64 " -> "
                     "%" PRIx64 "\n", value, s->hpet_counter);
             break;
@@ -646,8 +676,10 @@ static void hpet_ram_write(void *opaque, hwaddr addr,
             if (hpet_enabled(s)) {
                 DPRINTF("qemu: Writing counter while HPET enabled!\n");
             }
+            seqlock_write_begin(&s->counter_seq);
             s->hpet_counter =
                 (s->hpet_counter & 0xffffffffULL) | (((uint64_t)value) << 32);
+            seqlock_write_end(&s->counter_seq);
             DPRINTF("qemu: HPET counter + 4 written. ctr = 0x%" PRIx64 " -> "
                     "%" PRIx64 "\n", value, s->hpet_counter);
             break;
@@ -690,9 +722,11 @@ static void hpet_reset(DeviceState *d)
     }
 
     qemu_set_irq(s->pit_enabled, 1);
+    seqlock_write_begin(&s->counter_seq);
     s->hpet_counter = 0ULL;
     s->hpet_offset = 0ULL;
     s->config = 0ULL;
+    seqlock_write_end(&s->counter_seq);
     hpet_cfg.hpet[s->hpet_id].event_timer_block_id = (uint32_t)s->capability;
     hpet_cfg.hpet[s->hpet_id].address = sbd->mmio[0].addr;
 
@@ -722,7 +756,9 @@ static void hpet_init(Object *obj)
     HPETState *s = HPET(obj);
 
     /* HPET Area */
+    seqlock_init(&s->counter_seq);
     memory_region_init_io(&s->iomem, obj, &hpet_ram_ops, s, "hpet", HPET_LEN);
+    memory_region_enable_lockless_io(&s->iomem);
     sysbus_init_mmio(sbd, &s->iomem);
 }
 
@@ -127,6 +127,8 @@
 #define ERDP_EHB        (1<<3)
 
 #define TRB_SIZE 16
+/* TDs up to this many TRBs are read only once when kicking an endpoint */
+#define XHCI_KICK_CACHED_TRBS 16
 typedef struct XHCITRB {
     uint64_t parameter;
     uint32_t status;
@@ -714,7 +716,15 @@ static TRBType xhci_ring_fetch(XHCIState *xhci, XHCIRing *ring, XHCITRB *trb,
     }
 }
 
-static int xhci_ring_chain_length(XHCIState *xhci, const XHCIRing *ring)
+/*
+ * Count the TRBs of the next TD on @ring.  The first @max_trbs of them
+ * are stored in @trbs, as xhci_ring_fetch() would return them, and @end
+ * is set to the state the ring is left in once the whole TD is fetched.
+ * This way short TDs need to be read from guest memory only once.
+ */
+static int xhci_ring_chain_length(XHCIState *xhci, const XHCIRing *ring,
+                                  XHCITRB *trbs, int max_trbs,
+                                  XHCIRing *end)
 {
     XHCITRB trb;
     int length = 0;
@@ -748,6 +758,14 @@ static int xhci_ring_chain_length(XHCIState *xhci, const XHCIRing *ring)
             continue;
         }
 
+        if (length < max_trbs) {
+            trace_usb_xhci_fetch_trb(dequeue, trb_name(&trb),
+                                     trb.parameter, trb.status, trb.control);
+            trb.addr = dequeue;
+            trb.ccs = ccs;
+            trbs[length] = trb;
+        }
+
         length += 1;
         dequeue += TRB_SIZE;
 
@@ -758,6 +776,8 @@ static int xhci_ring_chain_length(XHCIState *xhci, const XHCIRing *ring)
         }
 
         if (!control_td_set && !(trb.control & TRB_TR_CH)) {
+            end->dequeue = dequeue;
+            end->ccs = ccs;
             return length;
         }
     }
@@ -1830,6 +1850,8 @@ static void xhci_kick_epctx(XHCIEPContext *epctx, unsigned int streamid)
     XHCIStreamContext *stctx = NULL;
     XHCITransfer *xfer;
     XHCIRing *ring;
+    XHCIRing ring_end;
+    XHCITRB trbs[XHCI_KICK_CACHED_TRBS];
     USBEndpoint *ep = NULL;
     uint64_t mfindex;
     unsigned int count = 0;
@@ -1914,7 +1936,8 @@ static void xhci_kick_epctx(XHCIEPContext *epctx, unsigned int streamid)
 
     epctx->kick_active++;
     while (1) {
-        length = xhci_ring_chain_length(xhci, ring);
+        length = xhci_ring_chain_length(xhci, ring, trbs, ARRAY_SIZE(trbs),
+                                        &ring_end);
         if (length <= 0) {
             if (epctx->type == ET_ISO_OUT || epctx->type == ET_ISO_IN) {
                 /* 4.10.3.1 */
@@ -1933,14 +1956,19 @@ static void xhci_kick_epctx(XHCIEPContext *epctx, unsigned int streamid)
             break;
         }
 
-        for (i = 0; i < length; i++) {
-            TRBType type;
-            type = xhci_ring_fetch(xhci, ring, &xfer->trbs[i], NULL);
-            if (!type) {
-                xhci_die(xhci);
-                xhci_ep_free_xfer(xfer);
-                epctx->kick_active--;
-                return;
+        if (length <= ARRAY_SIZE(trbs)) {
+            memcpy(xfer->trbs, trbs, length * sizeof(trbs[0]));
+            *ring = ring_end;
+        } else {
+            for (i = 0; i < length; i++) {
+                TRBType type;
+                type = xhci_ring_fetch(xhci, ring, &xfer->trbs[i], NULL);
+                if (!type) {
+                    xhci_die(xhci);
+                    xhci_ep_free_xfer(xfer);
+                    epctx->kick_active--;
+                    return;
+                }
             }
         }
         xfer->streamid = streamid;
@@ -30,10 +30,13 @@
 #include "exec/address-spaces.h"
 #include "exec/memory.h"
 #include "exec/ram_addr.h"
+#include "hw/boards.h"
 #include "hw/hw.h"
 #include "qemu/error-report.h"
 #include "qemu/main-loop.h"
+#include "qemu/mmap-alloc.h"
 #include "qemu/range.h"
+#include "qemu/units.h"
 #include "sysemu/kvm.h"
 #include "sysemu/reset.h"
 #include "sysemu/runstate.h"
@@ -859,6 +862,42 @@ static void vfio_unregister_ram_discard_listener(VFIOContainer *container,
     g_free(vrdl);
 }
 
+/* Smallest section worth populating in parallel before mapping it */
+#define VFIO_PREFAULT_MIN_SIZE (64 * MiB)
+
+/*
+ * VFIO_IOMMU_MAP_DMA pins every page of the mapping, and it faults them in
+ * one at a time from this thread.  For large guests that is most of the
+ * start up time.  Before the guest runs, populate big RAM sections first,
+ * using one thread per vCPU and the page size of the backend, so that the
+ * kernel only has to look up present pages.  This does not allocate
+ * anything that pinning would not allocate anyway.
+ *
+ * Once vCPUs are running, touching pages could race with guest writes, so
+ * the kernel is left to do all the work.
+ */
+static void vfio_prefault_section(MemoryRegionSection *section, void *vaddr,
+                                  hwaddr size)
+{
+    int fd = memory_region_get_fd(section->mr);
+    size_t pagesize = qemu_fd_getpagesize(fd);
+    Error *local_err = NULL;
+
+    if (runstate_is_running() || section->readonly ||
+        memory_region_is_ram_device(section->mr) ||
+        size < VFIO_PREFAULT_MIN_SIZE ||
+        !QEMU_PTR_IS_ALIGNED(vaddr, pagesize) ||
+        !QEMU_IS_ALIGNED(size, pagesize)) {
+        return;
+    }
+
+    os_mem_prealloc(fd, vaddr, size, current_machine->smp.cpus, &local_err);
+    if (local_err) {
+        /* Not fatal, pinning gets another try at it */
+        warn_report_err(local_err);
+    }
+}
+
 static void vfio_listener_region_add(MemoryListener *listener,
                                      MemoryRegionSection *section)
 {
@@ -1051,6 +1090,8 @@ static void vfio_listener_region_add(MemoryListener *listener,
         }
     }
 
+    vfio_prefault_section(section, vaddr, int128_get64(llsize));
+
     ret = vfio_dma_map(container, iova, int128_get64(llsize),
                        vaddr, section->readonly);
     if (ret) {
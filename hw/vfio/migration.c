@@ -10,6 +10,7 @@
 #include "qemu/osdep.h"
 #include "qemu/main-loop.h"
 #include "qemu/cutils.h"
+#include "qemu/units.h"
 #include <linux/vfio.h>
 #include <sys/ioctl.h>
 
@@ -44,6 +45,14 @@
 #define VFIO_MIG_FLAG_DEV_SETUP_STATE   (0xffffffffef100003ULL)
 #define VFIO_MIG_FLAG_DEV_DATA_STATE    (0xffffffffef100004ULL)
 
+/*
+ * Once the guest is stopped for switchover, the stop-and-copy data of every
+ * device is read by a thread of its own, while the migration thread sends
+ * the data of the devices before it in the stream.  This much data is read
+ * ahead of the stream for each device.
+ */
+#define VFIO_PREFETCH_MAX               (256 * MiB)
+
 static int64_t bytes_transferred;
 
 static inline int vfio_mig_access(VFIODevice *vbasedev, void *val, int count,
@@ -260,6 +269,67 @@ static int vfio_save_buffer(QEMUFile *f, VFIODevice *vbasedev, uint64_t *size)
     return ret;
 }
 
+/*
+ * Read the next buffer of device data into a new chunk, like
+ * vfio_save_buffer() does into the stream.  *chunk is NULL if the device
+ * had no data.
+ */
+static int vfio_read_buffer(VFIODevice *vbasedev, VFIOStateChunk **chunk)
+{
+    VFIOMigration *migration = vbasedev->migration;
+    VFIORegion *region = &migration->region;
+    uint64_t data_offset = 0, data_size = 0, done = 0;
+    VFIOStateChunk *c;
+    int ret;
+
+    *chunk = NULL;
+    ret = vfio_mig_read(vbasedev, &data_offset, sizeof(data_offset),
+                      region->fd_offset + VFIO_MIG_STRUCT_OFFSET(data_offset));
+    if (ret < 0) {
+        return ret;
+    }
+
+    ret = vfio_mig_read(vbasedev, &data_size, sizeof(data_size),
+                        region->fd_offset + VFIO_MIG_STRUCT_OFFSET(data_size));
+    if (ret < 0) {
+        return ret;
+    }
+
+    trace_vfio_save_buffer(vbasedev->name, data_offset, data_size,
+                           migration->pending_bytes);
+    if (!data_size) {
+        return 0;
+    }
+
+    c = g_try_malloc(sizeof(*c) + data_size);
+    if (!c) {
+        error_report("%s: Error allocating buffer ", __func__);
+        return -ENOMEM;
+    }
+    c->size = data_size;
+
+    while (done < data_size) {
+        uint64_t sec_size;
+        void *buf = get_data_section_size(region, data_offset + done,
+                                          data_size - done, &sec_size);
+
+        if (buf) {
+            memcpy(c->data + done, buf, sec_size);
+        } else {
+            ret = vfio_mig_read(vbasedev, c->data + done, sec_size,
+                                region->fd_offset + data_offset + done);
+            if (ret < 0) {
+                g_free(c);
+                return ret;
+            }
+        }
+        done += sec_size;
+    }
+
+    *chunk = c;
+    return 0;
+}
+
 static int vfio_load_buffer(QEMUFile *f, VFIODevice *vbasedev,
                             uint64_t data_size)
 {
@@ -350,6 +420,127 @@ static int vfio_update_pending(VFIODevice *vbasedev)
     return 0;
 }
 
+static void *vfio_prefetch_thread(void *opaque)
+{
+    VFIODevice *vbasedev = opaque;
+    VFIOMigration *migration = vbasedev->migration;
+    int ret = 0;
+
+    while (true) {
+        VFIOStateChunk *chunk;
+
+        qemu_mutex_lock(&migration->prefetch_lock);
+        while (migration->prefetch_queued >= VFIO_PREFETCH_MAX &&
+               !migration->prefetch_quit) {
+            qemu_cond_wait(&migration->prefetch_cond,
+                           &migration->prefetch_lock);
+        }
+        if (migration->prefetch_quit) {
+            qemu_mutex_unlock(&migration->prefetch_lock);
+            break;
+        }
+        qemu_mutex_unlock(&migration->prefetch_lock);
+
+        ret = vfio_update_pending(vbasedev);
+        if (ret || !migration->pending_bytes) {
+            break;
+        }
+        ret = vfio_read_buffer(vbasedev, &chunk);
+        if (ret || !chunk) {
+            break;
+        }
+        trace_vfio_prefetch_chunk(vbasedev->name, chunk->size);
+
+        qemu_mutex_lock(&migration->prefetch_lock);
+        QSIMPLEQ_INSERT_TAIL(&migration->prefetch_chunks, chunk, next);
+        migration->prefetch_queued += chunk->size;
+        qemu_cond_broadcast(&migration->prefetch_cond);
+        qemu_mutex_unlock(&migration->prefetch_lock);
+    }
+
+    qemu_mutex_lock(&migration->prefetch_lock);
+    migration->prefetch_ret = ret;
+    migration->prefetch_done = true;
+    qemu_cond_broadcast(&migration->prefetch_cond);
+    qemu_mutex_unlock(&migration->prefetch_lock);
+    return NULL;
+}
+
+static void vfio_prefetch_start(VFIODevice *vbasedev)
+{
+    VFIOMigration *migration = vbasedev->migration;
+
+    migration->prefetch_queued = 0;
+    migration->prefetch_done = false;
+    migration->prefetch_quit = false;
+    migration->prefetch_ret = 0;
+    migration->prefetch_running = true;
+    trace_vfio_prefetch_start(vbasedev->name);
+    qemu_thread_create(&migration->prefetch_thread, "vfio-prefetch",
+                       vfio_prefetch_thread, vbasedev, QEMU_THREAD_JOINABLE);
+}
+
+static void vfio_prefetch_stop(VFIODevice *vbasedev)
+{
+    VFIOMigration *migration = vbasedev->migration;
+    VFIOStateChunk *chunk, *next;
+
+    if (!migration->prefetch_running) {
+        return;
+    }
+
+    qemu_mutex_lock(&migration->prefetch_lock);
+    migration->prefetch_quit = true;
+    qemu_cond_broadcast(&migration->prefetch_cond);
+    qemu_mutex_unlock(&migration->prefetch_lock);
+    qemu_thread_join(&migration->prefetch_thread);
+    migration->prefetch_running = false;
+
+    QSIMPLEQ_FOREACH_SAFE(chunk, &migration->prefetch_chunks, next, next) {
+        QSIMPLEQ_REMOVE_HEAD(&migration->prefetch_chunks, next);
+        g_free(chunk);
+    }
+    migration->prefetch_queued = 0;
+}
+
+/* Send the data read by the prefetch thread, as it comes in */
+static int vfio_save_prefetched(QEMUFile *f, VFIODevice *vbasedev)
+{
+    VFIOMigration *migration = vbasedev->migration;
+    int ret;
+
+    qemu_mutex_lock(&migration->prefetch_lock);
+    while (true) {
+        VFIOStateChunk *chunk = QSIMPLEQ_FIRST(&migration->prefetch_chunks);
+
+        if (!chunk) {
+            if (migration->prefetch_done) {
+                break;
+            }
+            qemu_cond_wait(&migration->prefetch_cond,
+                           &migration->prefetch_lock);
+            continue;
+        }
+        QSIMPLEQ_REMOVE_HEAD(&migration->prefetch_chunks, next);
+        migration->prefetch_queued -= chunk->size;
+        qemu_cond_broadcast(&migration->prefetch_cond);
+        qemu_mutex_unlock(&migration->prefetch_lock);
+
+        qemu_put_be64(f, VFIO_MIG_FLAG_DEV_DATA_STATE);
+        qemu_put_be64(f, chunk->size);
+        qemu_put_buffer(f, chunk->data, chunk->size);
+        bytes_transferred += chunk->size;
+        g_free(chunk);
+
+        qemu_mutex_lock(&migration->prefetch_lock);
+    }
+    ret = migration->prefetch_ret;
+    qemu_mutex_unlock(&migration->prefetch_lock);
+
+    vfio_prefetch_stop(vbasedev);
+    return ret;
+}
+
 static int vfio_save_device_config_state(QEMUFile *f, void *opaque)
 {
     VFIODevice *vbasedev = opaque;
@@ -452,6 +643,7 @@ static void vfio_save_cleanup(void *opaque)
 {
     VFIODevice *vbasedev = opaque;
 
+    vfio_prefetch_stop(vbasedev);
     vfio_migration_cleanup(vbasedev);
     trace_vfio_save_cleanup(vbasedev->name);
 }
@@ -500,11 +692,29 @@ static int vfio_save_iterate(QEMUFile *f, void *opaque)
         }
     }
 
-    ret = vfio_save_buffer(f, vbasedev, &data_size);
-    if (ret) {
-        error_report("%s: vfio_save_buffer failed %s", vbasedev->name,
-                     strerror(errno));
-        return ret;
+    /*
+     * Keep reading while the device has data and the stream has room, so
+     * that a device with a lot of precopy data doesn't send a single
+     * buffer per iteration.
+     */
+    while (true) {
+        ret = vfio_save_buffer(f, vbasedev, &data_size);
+        if (ret) {
+            error_report("%s: vfio_save_buffer failed %s", vbasedev->name,
+                         strerror(errno));
+            return ret;
+        }
+        if (!data_size || qemu_file_rate_limit(f)) {
+            break;
+        }
+        ret = vfio_update_pending(vbasedev);
+        if (ret) {
+            return ret;
+        }
+        if (!migration->pending_bytes) {
+            break;
+        }
+        qemu_put_be64(f, VFIO_MIG_FLAG_DEV_DATA_STATE);
     }
 
     qemu_put_be64(f, VFIO_MIG_FLAG_END_OF_STATE);
@@ -531,6 +741,16 @@ static int vfio_save_complete_precopy(QEMUFile *f, void *opaque)
     uint64_t data_size;
     int ret;
 
+    if (migration->prefetch_running) {
+        /* Already stopped and saving */
+        ret = vfio_save_prefetched(f, vbasedev);
+        if (ret) {
+            error_report("%s: Failed to save buffer", vbasedev->name);
+            return ret;
+        }
+        goto done;
+    }
+
     ret = vfio_migration_set_state(vbasedev, ~VFIO_DEVICE_STATE_RUNNING,
                                    VFIO_DEVICE_STATE_SAVING);
     if (ret) {
@@ -562,6 +782,7 @@ static int vfio_save_complete_precopy(QEMUFile *f, void *opaque)
         }
     }
 
+done:
     qemu_put_be64(f, VFIO_MIG_FLAG_END_OF_STATE);
 
     ret = qemu_file_get_error(f);
@@ -707,6 +928,9 @@ static void vfio_vmstate_change(void *opaque, bool running, RunState state)
         return;
     }
 
+    /* The device must not be touched while its data is read ahead */
+    vfio_prefetch_stop(vbasedev);
+
     if (running) {
         /*
          * Here device state can have one of _SAVING, _RESUMING or _STOP bit.
@@ -749,6 +973,16 @@ static void vfio_vmstate_change(void *opaque, bool running, RunState state)
     vbasedev->migration->vm_running = running;
     trace_vfio_vmstate_change(vbasedev->name, running, RunState_str(state),
             (migration->device_state & mask) | value);
+
+    /*
+     * Stopped for switchover: start reading the stop-and-copy data now, so
+     * that all devices read theirs in parallel instead of one after the
+     * other from vfio_save_complete_precopy().
+     */
+    if (!ret && state == RUN_STATE_FINISH_MIGRATE &&
+        (migration->device_state & VFIO_DEVICE_STATE_SAVING)) {
+        vfio_prefetch_start(vbasedev);
+    }
 }
 
 static void vfio_migration_state_notifier(Notifier *notifier, void *data)
@@ -767,6 +1001,7 @@ static void vfio_migration_state_notifier(Notifier *notifier, void *data)
     case MIGRATION_STATUS_CANCELLED:
     case MIGRATION_STATUS_FAILED:
         bytes_transferred = 0;
+        vfio_prefetch_stop(vbasedev);
         ret = vfio_migration_set_state(vbasedev,
                       ~(VFIO_DEVICE_STATE_SAVING | VFIO_DEVICE_STATE_RESUMING),
                       VFIO_DEVICE_STATE_RUNNING);
@@ -780,6 +1015,8 @@ static void vfio_migration_exit(VFIODevice *vbasedev)
 {
     VFIOMigration *migration = vbasedev->migration;
 
+    qemu_cond_destroy(&migration->prefetch_cond);
+    qemu_mutex_destroy(&migration->prefetch_lock);
     vfio_region_exit(&migration->region);
     vfio_region_finalize(&migration->region);
     g_free(vbasedev->migration);
@@ -805,6 +1042,9 @@ static int vfio_migration_init(VFIODevice *vbasedev,
     }
 
     vbasedev->migration = g_new0(VFIOMigration, 1);
+    qemu_mutex_init(&vbasedev->migration->prefetch_lock);
+    qemu_cond_init(&vbasedev->migration->prefetch_cond);
+    QSIMPLEQ_INIT(&vbasedev->migration->prefetch_chunks);
 
     ret = vfio_region_setup(obj, vbasedev, &vbasedev->migration->region,
                             info->index, "migration");
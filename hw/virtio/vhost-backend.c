@@ -161,7 +161,8 @@ static int vhost_kernel_set_features(struct vhost_dev *dev,
 static int vhost_kernel_set_backend_cap(struct vhost_dev *dev)
 {
     uint64_t features;
-    uint64_t f = 0x1ULL << VHOST_BACKEND_F_IOTLB_MSG_V2;
+    uint64_t f = 0x1ULL << VHOST_BACKEND_F_IOTLB_MSG_V2 |
+        0x1ULL << VHOST_BACKEND_F_IOTLB_BATCH;
     int r;
 
     if (vhost_kernel_call(dev, VHOST_GET_BACKEND_FEATURES, &features)) {
@@ -216,41 +217,66 @@ static int vhost_kernel_vsock_set_running(struct vhost_dev *dev, int start)
 }
 #endif /* CONFIG_VHOST_VSOCK */
 
-static void vhost_kernel_iotlb_read(void *opaque)
+static bool vhost_kernel_iotlb_read_msg(struct vhost_dev *dev,
+                                        struct vhost_iotlb_msg *iotlb)
 {
-    struct vhost_dev *dev = opaque;
     ssize_t len;
 
     if (dev->backend_cap &
         (0x1ULL << VHOST_BACKEND_F_IOTLB_MSG_V2)) {
         struct vhost_msg_v2 msg;
 
-        while ((len = read((uintptr_t)dev->opaque, &msg, sizeof msg)) > 0) {
-            if (len < sizeof msg) {
-                error_report("Wrong vhost message len: %d", (int)len);
-                break;
-            }
-            if (msg.type != VHOST_IOTLB_MSG_V2) {
-                error_report("Unknown vhost iotlb message type");
-                break;
-            }
-
-            vhost_backend_handle_iotlb_msg(dev, &msg.iotlb);
+        len = read((uintptr_t)dev->opaque, &msg, sizeof msg);
+        if (len <= 0) {
+            return false;
         }
+        if (len < sizeof msg) {
+            error_report("Wrong vhost message len: %d", (int)len);
+            return false;
+        }
+        if (msg.type != VHOST_IOTLB_MSG_V2) {
+            error_report("Unknown vhost iotlb message type");
+            return false;
+        }
+        *iotlb = msg.iotlb;
     } else {
         struct vhost_msg msg;
 
-        while ((len = read((uintptr_t)dev->opaque, &msg, sizeof msg)) > 0) {
-            if (len < sizeof msg) {
-                error_report("Wrong vhost message len: %d", (int)len);
-                break;
-            }
-            if (msg.type != VHOST_IOTLB_MSG) {
-                error_report("Unknown vhost iotlb message type");
+        len = read((uintptr_t)dev->opaque, &msg, sizeof msg);
+        if (len <= 0) {
+            return false;
+        }
+        if (len < sizeof msg) {
+            error_report("Wrong vhost message len: %d", (int)len);
+            return false;
+        }
+        if (msg.type != VHOST_IOTLB_MSG) {
+            error_report("Unknown vhost iotlb message type");
+            return false;
+        }
+        *iotlb = msg.iotlb;
+    }
+
+    return true;
+}
+
+static void vhost_kernel_iotlb_read(void *opaque)
+{
+    struct vhost_dev *dev = opaque;
+    struct vhost_iotlb_msg iotlb[VHOST_BACKEND_IOTLB_BATCH];
+    bool more = true;
+    int n;
+
+    /* The device queues misses while we serve them: take them all */
+    while (more) {
+        for (n = 0; n < VHOST_BACKEND_IOTLB_BATCH; n++) {
+            if (!vhost_kernel_iotlb_read_msg(dev, &iotlb[n])) {
+                more = false;
                 break;
             }
-
-            vhost_backend_handle_iotlb_msg(dev, &msg.iotlb);
+        }
+        if (n) {
+            vhost_backend_handle_iotlb_msgs(dev, iotlb, n);
         }
     }
 }
@@ -403,6 +429,80 @@ int vhost_backend_invalidate_device_iotlb(struct vhost_dev *dev,
     return -ENODEV;
 }
 
+static void vhost_backend_device_iotlb_batch(struct vhost_dev *dev,
+                                             uint8_t type)
+{
+    struct vhost_iotlb_msg imsg = { .type = type };
+
+    if (dev->backend_cap & (0x1ULL << VHOST_BACKEND_F_IOTLB_BATCH) &&
+        dev->vhost_ops && dev->vhost_ops->vhost_send_device_iotlb_msg) {
+        dev->vhost_ops->vhost_send_device_iotlb_msg(dev, &imsg);
+    }
+}
+
+/*
+ * Handle @n IOTLB messages read from the device at once.  The device
+ * often reports several misses for a single mapping, one per virtqueue
+ * or per buffer: a miss that falls within an entry sent for an earlier
+ * one is skipped.  If the backend supports it, the updates are sent as
+ * a single batch.
+ */
+void vhost_backend_handle_iotlb_msgs(struct vhost_dev *dev,
+                                     struct vhost_iotlb_msg *imsgs, int n)
+{
+    struct {
+        uint64_t start;
+        uint64_t end;
+        bool write;
+    } filled[VHOST_BACKEND_IOTLB_BATCH];
+    int nfilled = 0;
+    bool batch = false;
+    int i, j;
+
+    assert(n <= VHOST_BACKEND_IOTLB_BATCH);
+
+    if (unlikely(!dev->vdev)) {
+        error_report("Unexpected IOTLB message when virtio device is stopped");
+        return;
+    }
+
+    for (i = 0; i < n; i++) {
+        struct vhost_iotlb_msg *imsg = &imsgs[i];
+        bool write = imsg->perm != VHOST_ACCESS_RO;
+        uint64_t end;
+
+        if (imsg->type != VHOST_IOTLB_MISS) {
+            vhost_backend_handle_iotlb_msg(dev, imsg);
+            continue;
+        }
+
+        for (j = 0; j < nfilled; j++) {
+            if (imsg->iova >= filled[j].start && imsg->iova < filled[j].end &&
+                filled[j].write == write) {
+                break;
+            }
+        }
+        if (j < nfilled) {
+            continue;
+        }
+
+        if (!batch) {
+            vhost_backend_device_iotlb_batch(dev, VHOST_IOTLB_BATCH_BEGIN);
+            batch = true;
+        }
+        if (!vhost_device_iotlb_fill(dev, imsg->iova, write, &end)) {
+            filled[nfilled].start = imsg->iova;
+            filled[nfilled].end = end;
+            filled[nfilled].write = write;
+            nfilled++;
+        }
+    }
+
+    if (batch) {
+        vhost_backend_device_iotlb_batch(dev, VHOST_IOTLB_BATCH_END);
+    }
+}
+
 int vhost_backend_handle_iotlb_msg(struct vhost_dev *dev,
                                           struct vhost_iotlb_msg *imsg)
 {
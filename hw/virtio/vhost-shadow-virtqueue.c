@@ -0,0 +1,440 @@
+/*
+ * vhost shadow virtqueue
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ */
+
+/*
+ * A shadow virtqueue sits between the guest's virtqueue and a vhost
+ * device: QEMU pops the guest's buffers, forwards them through a ring of
+ * its own that the device processes, and returns them to the guest when
+ * the device is done.  The device never touches the guest's rings, so every
+ * write it makes to guest memory is seen by QEMU when the element is
+ * unmapped, and is logged in the dirty bitmap like the writes of an
+ * emulated device.  This lets devices that have no dirty page tracking of
+ * their own be migrated, at the cost of going through QEMU for every
+ * buffer while shadowing is enabled.
+ *
+ * Buffers are passed to the device with their guest physical addresses, so
+ * the device must have guest memory mapped at its guest physical address.
+ * Only split rings are supported.
+ */
+
+#include "qemu/osdep.h"
+#include "qapi/error.h"
+#include "qemu/main-loop.h"
+#include "standard-headers/linux/virtio_ring.h"
+#include "vhost-shadow-virtqueue.h"
+
+struct VhostShadowVirtqueue {
+    /* Ring seen by the device */
+    struct vring vring;
+    void *ring;
+
+    /* Guest side of the queue, set while the shadow virtqueue runs */
+    VirtIODevice *vdev;
+    VirtQueue *vq;
+
+    /* Guest kicks, on the ioeventfd that was meant for the device */
+    EventNotifier guest_kick;
+    /* Guest interrupts, on the irqfd that was meant for the device */
+    EventNotifier guest_call;
+
+    /* Device side of the notifications */
+    EventNotifier hdev_kick;
+    EventNotifier hdev_call;
+
+    /* Guest element behind each descriptor chain in the ring */
+    VirtQueueElement **ring_id_maps;
+
+    /* Head of the list of free descriptors, chained by their next field */
+    uint16_t free_head;
+    uint16_t num_free;
+
+    uint16_t shadow_avail_idx;
+    uint16_t last_used_idx;
+};
+
+static size_t vhost_svq_driver_area_size_num(unsigned int num)
+{
+    size_t desc_size = sizeof(vring_desc_t) * num;
+    size_t avail_size = offsetof(vring_avail_t, ring[num]) + sizeof(uint16_t);
+
+    return ROUND_UP(desc_size + avail_size, qemu_real_host_page_size);
+}
+
+static size_t vhost_svq_device_area_size_num(unsigned int num)
+{
+    size_t used_size = offsetof(vring_used_t, ring[num]) + sizeof(uint16_t);
+
+    return ROUND_UP(used_size, qemu_real_host_page_size);
+}
+
+size_t vhost_svq_driver_area_size(const VhostShadowVirtqueue *svq)
+{
+    return vhost_svq_driver_area_size_num(svq->vring.num);
+}
+
+size_t vhost_svq_device_area_size(const VhostShadowVirtqueue *svq)
+{
+    return vhost_svq_device_area_size_num(svq->vring.num);
+}
+
+/* Size of the rings of a shadow virtqueue with the largest queue size */
+size_t vhost_svq_max_area_size(void)
+{
+    return vhost_svq_driver_area_size_num(VIRTQUEUE_MAX_SIZE) +
+           vhost_svq_device_area_size_num(VIRTQUEUE_MAX_SIZE);
+}
+
+/*
+ * The rings are a single allocation: the driver area (descriptors and
+ * available ring), which the device only reads, followed on its own pages
+ * by the device area (used ring).
+ */
+void *vhost_svq_get_ring(const VhostShadowVirtqueue *svq)
+{
+    return svq->ring;
+}
+
+void vhost_svq_get_vring_addr(const VhostShadowVirtqueue *svq, uint64_t iova,
+                              struct vhost_vring_addr *addr)
+{
+    addr->desc_user_addr = iova;
+    addr->avail_user_addr = iova + sizeof(vring_desc_t) * svq->vring.num;
+    addr->used_user_addr = iova + vhost_svq_driver_area_size(svq);
+    addr->log_guest_addr = 0;
+    addr->flags = 0;
+}
+
+int vhost_svq_get_device_kick_fd(const VhostShadowVirtqueue *svq)
+{
+    return event_notifier_get_fd(&svq->hdev_kick);
+}
+
+int vhost_svq_get_device_call_fd(const VhostShadowVirtqueue *svq)
+{
+    return event_notifier_get_fd(&svq->hdev_call);
+}
+
+static void vhost_svq_add(VhostShadowVirtqueue *svq, VirtQueueElement *elem)
+{
+    unsigned int n = elem->out_num + elem->in_num;
+    uint16_t head = svq->free_head;
+    uint16_t i = head;
+    unsigned int k;
+
+    for (k = 0; k < n; k++) {
+        vring_desc_t *desc = &svq->vring.desc[i];
+        bool write = k >= elem->out_num;
+        const struct iovec *iov = write ? &elem->in_sg[k - elem->out_num]
+                                        : &elem->out_sg[k];
+        hwaddr addr = write ? elem->in_addr[k - elem->out_num]
+                            : elem->out_addr[k];
+        uint16_t flags = write ? VRING_DESC_F_WRITE : 0;
+
+        if (k + 1 < n) {
+            flags |= VRING_DESC_F_NEXT;
+        }
+        desc->addr = cpu_to_le64(addr);
+        desc->len = cpu_to_le32(iov->iov_len);
+        desc->flags = cpu_to_le16(flags);
+        i = le16_to_cpu(desc->next);
+    }
+
+    svq->free_head = i;
+    svq->num_free -= n;
+    svq->ring_id_maps[head] = elem;
+
+    svq->vring.avail->ring[svq->shadow_avail_idx & (svq->vring.num - 1)] =
+        cpu_to_le16(head);
+    svq->shadow_avail_idx++;
+
+    /* Descriptors must be visible before the index that publishes them */
+    smp_wmb();
+    svq->vring.avail->idx = cpu_to_le16(svq->shadow_avail_idx);
+}
+
+/* Forward the guest's available buffers to the device */
+static void vhost_svq_flush_avail(VhostShadowVirtqueue *svq)
+{
+    bool added = false;
+
+    if (event_notifier_get_fd(&svq->guest_kick) < 0) {
+        return;
+    }
+
+    for (;;) {
+        VirtQueueElement *elem = virtqueue_pop(svq->vq, sizeof(*elem));
+        unsigned int n;
+
+        if (!elem) {
+            break;
+        }
+
+        n = elem->out_num + elem->in_num;
+        if (n > svq->vring.num) {
+            virtqueue_detach_element(svq->vq, elem, 0);
+            g_free(elem);
+            virtio_error(svq->vdev, "vhost shadow virtqueue: chain of %u "
+                         "descriptors does not fit in the device ring", n);
+            break;
+        }
+        if (n > svq->num_free) {
+            /* Retried when the device returns some descriptors */
+            virtqueue_unpop(svq->vq, elem, 0);
+            g_free(elem);
+            break;
+        }
+
+        vhost_svq_add(svq, elem);
+        added = true;
+    }
+
+    if (added) {
+        /* The avail index must be visible before the device is kicked */
+        smp_mb();
+        event_notifier_set(&svq->hdev_kick);
+    }
+}
+
+static void vhost_svq_handle_guest_kick(EventNotifier *n)
+{
+    VhostShadowVirtqueue *svq = container_of(n, VhostShadowVirtqueue,
+                                             guest_kick);
+
+    if (event_notifier_test_and_clear(n)) {
+        vhost_svq_flush_avail(svq);
+    }
+}
+
+static bool vhost_svq_more_used(const VhostShadowVirtqueue *svq)
+{
+    return svq->last_used_idx !=
+           le16_to_cpu(qatomic_read(&svq->vring.used->idx));
+}
+
+static VirtQueueElement *vhost_svq_get_used(VhostShadowVirtqueue *svq,
+                                            uint32_t *len)
+{
+    vring_used_elem_t used;
+    VirtQueueElement *elem;
+    uint32_t id;
+    uint16_t i;
+
+    /* Read the used entry only after its index */
+    smp_rmb();
+    used = svq->vring.used->ring[svq->last_used_idx & (svq->vring.num - 1)];
+    svq->last_used_idx++;
+
+    id = le32_to_cpu(used.id);
+    if (id >= svq->vring.num || !svq->ring_id_maps[id]) {
+        virtio_error(svq->vdev, "vhost shadow virtqueue: device used "
+                     "invalid descriptor %u", id);
+        return NULL;
+    }
+
+    elem = svq->ring_id_maps[id];
+    svq->ring_id_maps[id] = NULL;
+
+    /* Give the chain back to the free list */
+    i = id;
+    while (le16_to_cpu(svq->vring.desc[i].flags) & VRING_DESC_F_NEXT) {
+        i = le16_to_cpu(svq->vring.desc[i].next);
+    }
+    svq->vring.desc[i].next = cpu_to_le16(svq->free_head);
+    svq->free_head = id;
+    svq->num_free += elem->out_num + elem->in_num;
+
+    *len = le32_to_cpu(used.len);
+    return elem;
+}
+
+static void vhost_svq_notify_guest(VhostShadowVirtqueue *svq)
+{
+    bool notify;
+
+    if (event_notifier_get_fd(&svq->guest_call) < 0) {
+        return;
+    }
+    WITH_RCU_READ_LOCK_GUARD() {
+        notify = virtio_should_notify(svq->vdev, svq->vq);
+    }
+    if (notify) {
+        event_notifier_set(&svq->guest_call);
+    }
+}
+
+/* Return the buffers used by the device to the guest */
+static void vhost_svq_flush_used(VhostShadowVirtqueue *svq)
+{
+    unsigned int i = 0;
+
+    for (;;) {
+        VirtQueueElement *elem;
+        uint32_t len;
+
+        if (!vhost_svq_more_used(svq)) {
+            /*
+             * Ask for an interrupt at the next used entry, then check
+             * again for entries that raced with the request.
+             */
+            vring_used_event(&svq->vring) = cpu_to_le16(svq->last_used_idx);
+            smp_mb();
+            if (!vhost_svq_more_used(svq)) {
+                break;
+            }
+        }
+
+        elem = vhost_svq_get_used(svq, &len);
+        if (!elem) {
+            break;
+        }
+        virtqueue_fill(svq->vq, elem, len, i++);
+        g_free(elem);
+    }
+
+    if (i) {
+        virtqueue_flush(svq->vq, i);
+        vhost_svq_notify_guest(svq);
+        /* The guest may have buffers that did not fit in the ring */
+        vhost_svq_flush_avail(svq);
+    }
+}
+
+static void vhost_svq_handle_device_call(EventNotifier *n)
+{
+    VhostShadowVirtqueue *svq = container_of(n, VhostShadowVirtqueue,
+                                             hdev_call);
+
+    if (event_notifier_test_and_clear(n)) {
+        vhost_svq_flush_used(svq);
+    }
+}
+
+/*
+ * Start the shadow virtqueue of @vq, with a device ring of the same size.
+ * The guest's kicks are only processed once vhost_svq_set_guest_kick_fd()
+ * is called.
+ */
+void vhost_svq_start(VhostShadowVirtqueue *svq, VirtIODevice *vdev,
+                     VirtQueue *vq)
+{
+    unsigned int num = virtio_queue_get_num(vdev, virtio_get_queue_index(vq));
+    size_t driver_size = vhost_svq_driver_area_size_num(num);
+    size_t size = driver_size + vhost_svq_device_area_size_num(num);
+    unsigned int i;
+
+    assert(!svq->vq);
+
+    svq->vdev = vdev;
+    svq->vq = vq;
+    svq->ring = qemu_memalign(qemu_real_host_page_size, size);
+    memset(svq->ring, 0, size);
+    svq->vring.num = num;
+    svq->vring.desc = svq->ring;
+    svq->vring.avail = svq->ring + sizeof(vring_desc_t) * num;
+    svq->vring.used = svq->ring + driver_size;
+    for (i = 0; i < num - 1; i++) {
+        svq->vring.desc[i].next = cpu_to_le16(i + 1);
+    }
+    svq->ring_id_maps = g_new0(VirtQueueElement *, num);
+    svq->free_head = 0;
+    svq->num_free = num;
+    svq->shadow_avail_idx = 0;
+    svq->last_used_idx = 0;
+
+    event_notifier_set_handler(&svq->hdev_call, vhost_svq_handle_device_call);
+}
+
+/*
+ * Called after the device has been stopped.  Buffers that the device did
+ * not use are given back to the guest's virtqueue, to be popped again by
+ * whatever processes it next.
+ */
+void vhost_svq_stop(VhostShadowVirtqueue *svq)
+{
+    unsigned int i;
+
+    if (!svq->vq) {
+        return;
+    }
+
+    vhost_svq_set_guest_kick_fd(svq, -1);
+    event_notifier_set_handler(&svq->hdev_call, NULL);
+    event_notifier_test_and_clear(&svq->hdev_call);
+    vhost_svq_flush_used(svq);
+
+    /*
+     * The device completes buffers in order, so the ones left are the last
+     * ones popped from the guest's ring.
+     */
+    for (i = 0; i < svq->vring.num; i++) {
+        if (svq->ring_id_maps[i]) {
+            virtqueue_unpop(svq->vq, svq->ring_id_maps[i], 0);
+            g_free(svq->ring_id_maps[i]);
+        }
+    }
+
+    g_free(svq->ring_id_maps);
+    svq->ring_id_maps = NULL;
+    qemu_vfree(svq->ring);
+    svq->ring = NULL;
+    svq->vq = NULL;
+    svq->vdev = NULL;
+}
+
+/*
+ * Take over the guest's kicks on @fd, or stop processing them if @fd is
+ * -1.  Buffers made available before the switch are forwarded at once.
+ */
+void vhost_svq_set_guest_kick_fd(VhostShadowVirtqueue *svq, int fd)
+{
+    if (event_notifier_get_fd(&svq->guest_kick) >= 0) {
+        event_notifier_set_handler(&svq->guest_kick, NULL);
+    }
+    event_notifier_init_fd(&svq->guest_kick, fd);
+    if (fd >= 0) {
+        event_notifier_set_handler(&svq->guest_kick,
+                                   vhost_svq_handle_guest_kick);
+        event_notifier_set(&svq->guest_kick);
+    }
+}
+
+void vhost_svq_set_guest_call_fd(VhostShadowVirtqueue *svq, int fd)
+{
+    event_notifier_init_fd(&svq->guest_call, fd);
+}
+
+VhostShadowVirtqueue *vhost_svq_new(Error **errp)
+{
+    g_autofree VhostShadowVirtqueue *svq = g_new0(VhostShadowVirtqueue, 1);
+    int r;
+
+    r = event_notifier_init(&svq->hdev_kick, 0);
+    if (r < 0) {
+        error_setg_errno(errp, -r, "vhost shadow virtqueue: cannot create "
+                         "kick notifier");
+        return NULL;
+    }
+    r = event_notifier_init(&svq->hdev_call, 0);
+    if (r < 0) {
+        error_setg_errno(errp, -r, "vhost shadow virtqueue: cannot create "
+                         "call notifier");
+        event_notifier_cleanup(&svq->hdev_kick);
+        return NULL;
+    }
+    event_notifier_init_fd(&svq->guest_kick, -1);
+    event_notifier_init_fd(&svq->guest_call, -1);
+
+    return g_steal_pointer(&svq);
+}
+
+void vhost_svq_free(VhostShadowVirtqueue *svq)
+{
+    vhost_svq_stop(svq);
+    event_notifier_cleanup(&svq->hdev_kick);
+    event_notifier_cleanup(&svq->hdev_call);
+    g_free(svq);
+}
@@ -0,0 +1,35 @@
+/*
+ * vhost shadow virtqueue
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ */
+
+#ifndef VHOST_SHADOW_VIRTQUEUE_H
+#define VHOST_SHADOW_VIRTQUEUE_H
+
+#include "hw/virtio/virtio.h"
+#include "standard-headers/linux/vhost_types.h"
+
+typedef struct VhostShadowVirtqueue VhostShadowVirtqueue;
+
+VhostShadowVirtqueue *vhost_svq_new(Error **errp);
+void vhost_svq_free(VhostShadowVirtqueue *svq);
+
+int vhost_svq_get_device_kick_fd(const VhostShadowVirtqueue *svq);
+int vhost_svq_get_device_call_fd(const VhostShadowVirtqueue *svq);
+void vhost_svq_set_guest_kick_fd(VhostShadowVirtqueue *svq, int fd);
+void vhost_svq_set_guest_call_fd(VhostShadowVirtqueue *svq, int fd);
+
+size_t vhost_svq_driver_area_size(const VhostShadowVirtqueue *svq);
+size_t vhost_svq_device_area_size(const VhostShadowVirtqueue *svq);
+size_t vhost_svq_max_area_size(void);
+void *vhost_svq_get_ring(const VhostShadowVirtqueue *svq);
+void vhost_svq_get_vring_addr(const VhostShadowVirtqueue *svq, uint64_t iova,
+                              struct vhost_vring_addr *addr);
+
+void vhost_svq_start(VhostShadowVirtqueue *svq, VirtIODevice *vdev,
+                     VirtQueue *vq);
+void vhost_svq_stop(VhostShadowVirtqueue *svq);
+
+#endif
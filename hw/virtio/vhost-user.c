@@ -1043,6 +1043,33 @@ static int vhost_user_set_mem_table_postcopy(struct vhost_dev *dev,
     return 0;
 }
 
+/*
+ * A backend that has just connected knows no regions yet.  Rather than
+ * one VHOST_USER_ADD_MEM_REG round trip per region, send them all with a
+ * single VHOST_USER_SET_MEM_TABLE if they fit in one message; later
+ * changes are still sent incrementally from the shadow table.
+ */
+static bool vhost_user_use_full_mem_table(struct vhost_dev *dev)
+{
+    struct vhost_user *u = dev->opaque;
+    ram_addr_t offset;
+    int i, fd, fd_num = 0;
+
+    if (u->num_shadow_regions) {
+        return false;
+    }
+
+    for (i = 0; i < dev->mem->nregions; ++i) {
+        vhost_user_get_mr_data(dev->mem->regions[i].userspace_addr,
+                               &offset, &fd);
+        if (fd > 0 && ++fd_num > VHOST_MEMORY_BASELINE_NREGIONS) {
+            return false;
+        }
+    }
+
+    return fd_num > 0;
+}
+
 static int vhost_user_set_mem_table(struct vhost_dev *dev,
                                     struct vhost_memory *mem)
 {
@@ -1073,7 +1100,7 @@ static int vhost_user_set_mem_table(struct vhost_dev *dev,
         msg.hdr.flags |= VHOST_USER_NEED_REPLY_MASK;
     }
 
-    if (config_mem_slots) {
+    if (config_mem_slots && !vhost_user_use_full_mem_table(dev)) {
         if (vhost_user_add_remove_regions(dev, &msg, reply_supported,
                                           false) < 0) {
             return -1;
@@ -1087,8 +1114,14 @@ static int vhost_user_set_mem_table(struct vhost_dev *dev,
             return -1;
         }
 
-        if (reply_supported) {
-            return process_message_reply(dev, &msg);
+        if (reply_supported && process_message_reply(dev, &msg) < 0) {
+            return -1;
+        }
+
+        if (config_mem_slots) {
+            memcpy(u->shadow_regions, dev->mem->regions,
+                   dev->mem->nregions * sizeof(struct vhost_memory_region));
+            u->num_shadow_regions = dev->mem->nregions;
         }
     }
 
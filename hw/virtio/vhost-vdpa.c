@@ -19,10 +19,12 @@
 #include "hw/virtio/virtio-net.h"
 #include "hw/virtio/vhost-vdpa.h"
 #include "exec/address-spaces.h"
+#include "qapi/error.h"
 #include "qemu/main-loop.h"
 #include "cpu.h"
 #include "trace.h"
 #include "qemu-common.h"
+#include "vhost-shadow-virtqueue.h"
 
 static bool vhost_vdpa_listener_skipped_section(MemoryRegionSection *section)
 {
@@ -267,9 +269,18 @@ static void vhost_vdpa_add_status(struct vhost_dev *dev, uint8_t status)
     vhost_vdpa_call(dev, VHOST_VDPA_SET_STATUS, &s);
 }
 
+static bool vhost_vdpa_driver_ok(struct vhost_dev *dev)
+{
+    uint8_t status = 0;
+
+    vhost_vdpa_call(dev, VHOST_VDPA_GET_STATUS, &status);
+    return status & VIRTIO_CONFIG_S_DRIVER_OK;
+}
+
 static int vhost_vdpa_init(struct vhost_dev *dev, void *opaque, Error **errp)
 {
     struct vhost_vdpa *v;
+    int i;
     assert(dev->vhost_ops->backend_type == VHOST_BACKEND_TYPE_VDPA);
     trace_vhost_vdpa_init(dev, opaque);
 
@@ -279,6 +290,24 @@ static int vhost_vdpa_init(struct vhost_dev *dev, void *opaque, Error **errp)
     v->listener = vhost_vdpa_memory_listener;
     v->msg_type = VHOST_IOTLB_MSG_V2;
 
+    if (vhost_vdpa_call(dev, VHOST_VDPA_GET_IOVA_RANGE, &v->iova_range)) {
+        v->iova_range.first = 0;
+        v->iova_range.last = UINT64_MAX;
+    }
+
+    v->shadow_vqs = g_ptr_array_new_full(dev->nvqs,
+                                         (GDestroyNotify)vhost_svq_free);
+    for (i = 0; i < dev->nvqs; i++) {
+        VhostShadowVirtqueue *svq = vhost_svq_new(errp);
+
+        if (!svq) {
+            g_ptr_array_free(v->shadow_vqs, true);
+            v->shadow_vqs = NULL;
+            return -1;
+        }
+        g_ptr_array_add(v->shadow_vqs, svq);
+    }
+
     vhost_vdpa_add_status(dev, VIRTIO_CONFIG_S_ACKNOWLEDGE |
                                VIRTIO_CONFIG_S_DRIVER);
 
@@ -375,6 +404,10 @@ static int vhost_vdpa_cleanup(struct vhost_dev *dev)
     trace_vhost_vdpa_cleanup(dev, v);
     vhost_vdpa_host_notifiers_uninit(dev, dev->nvqs);
     memory_listener_unregister(&v->listener);
+    if (v->shadow_vqs) {
+        g_ptr_array_free(v->shadow_vqs, true);
+        v->shadow_vqs = NULL;
+    }
 
     dev->opaque = NULL;
     return 0;
@@ -411,8 +444,26 @@ static int vhost_vdpa_set_mem_table(struct vhost_dev *dev,
 static int vhost_vdpa_set_features(struct vhost_dev *dev,
                                    uint64_t features)
 {
+    struct vhost_vdpa *v = dev->opaque;
     int ret;
     trace_vhost_vdpa_set_features(dev, features);
+
+    /*
+     * Features can only change across a restart; while running, this is
+     * vhost toggling the dirty log, which the device has no part in.
+     */
+    if (vhost_vdpa_driver_ok(dev)) {
+        return 0;
+    }
+    features &= ~(1ULL << VHOST_F_LOG_ALL);
+    if (v->shadow_vqs_enabled) {
+        /*
+         * The guest's rings are handled by QEMU, whatever their layout;
+         * the shadow rings that the device sees are split.
+         */
+        features &= ~(1ULL << VIRTIO_F_RING_PACKED);
+    }
+
     ret = vhost_vdpa_call(dev, VHOST_SET_FEATURES, &features);
     uint8_t status = 0;
     if (ret) {
@@ -550,7 +601,10 @@ static int vhost_vdpa_dev_start(struct vhost_dev *dev, bool started)
     if (started) {
         uint8_t status = 0;
         memory_listener_register(&v->listener, &address_space_memory);
-        vhost_vdpa_host_notifiers_init(dev);
+        if (!v->shadow_vqs_enabled) {
+            /* Guest kicks must reach the shadow virtqueues */
+            vhost_vdpa_host_notifiers_init(dev);
+        }
         vhost_vdpa_set_vring_ready(dev);
         vhost_vdpa_add_status(dev, VIRTIO_CONFIG_S_DRIVER_OK);
         vhost_vdpa_call(dev, VHOST_VDPA_GET_STATUS, &status);
@@ -570,18 +624,97 @@ static int vhost_vdpa_dev_start(struct vhost_dev *dev, bool started)
 static int vhost_vdpa_set_log_base(struct vhost_dev *dev, uint64_t base,
                                      struct vhost_log *log)
 {
+    struct vhost_vdpa *v = dev->opaque;
+
     trace_vhost_vdpa_set_log_base(dev, base, log->size, log->refcnt, log->fd,
                                   log->log);
+    if (v->shadow_vqs_enabled) {
+        /* QEMU logs the writes to guest memory itself */
+        return 0;
+    }
     return vhost_vdpa_call(dev, VHOST_SET_LOG_BASE, &base);
 }
 
+/*
+ * The shadow rings are mapped at the top of the device's IOVA range, one
+ * slot per virtqueue, away from guest memory which is mapped at its guest
+ * physical address.
+ */
+static hwaddr vhost_vdpa_svq_iova(struct vhost_vdpa *v, unsigned int index)
+{
+    hwaddr end = (v->iova_range.last + 1) & qemu_real_host_page_mask;
+
+    return end - (hwaddr)(index + 1) * vhost_svq_max_area_size();
+}
+
+static void vhost_vdpa_svq_stop(struct vhost_dev *dev, unsigned int index)
+{
+    struct vhost_vdpa *v = dev->opaque;
+    VhostShadowVirtqueue *svq = g_ptr_array_index(v->shadow_vqs, index);
+
+    if (!vhost_svq_get_ring(svq)) {
+        return;
+    }
+    vhost_vdpa_dma_unmap(v, vhost_vdpa_svq_iova(v, index),
+                         vhost_svq_driver_area_size(svq) +
+                         vhost_svq_device_area_size(svq));
+    vhost_svq_stop(svq);
+}
+
+static int vhost_vdpa_svq_start(struct vhost_dev *dev, unsigned int index)
+{
+    struct vhost_vdpa *v = dev->opaque;
+    VhostShadowVirtqueue *svq = g_ptr_array_index(v->shadow_vqs, index);
+    VirtQueue *vq = virtio_get_queue(dev->vdev, dev->vq_index + index);
+    struct vhost_vring_addr addr = { .index = index };
+    hwaddr iova = vhost_vdpa_svq_iova(v, index);
+    size_t driver_size;
+    void *ring;
+    int r;
+
+    if (iova < v->iova_range.first) {
+        error_report("vhost-vdpa: no room for shadow virtqueue %u in the "
+                     "device IOVA range", index);
+        return -ENOSPC;
+    }
+
+    vhost_vdpa_svq_stop(dev, index);
+    vhost_svq_start(svq, dev->vdev, vq);
+    ring = vhost_svq_get_ring(svq);
+    driver_size = vhost_svq_driver_area_size(svq);
+
+    r = vhost_vdpa_dma_map(v, iova, driver_size, ring, true);
+    if (!r) {
+        r = vhost_vdpa_dma_map(v, iova + driver_size,
+                               vhost_svq_device_area_size(svq),
+                               ring + driver_size, false);
+    }
+    if (!r) {
+        vhost_svq_get_vring_addr(svq, iova, &addr);
+        r = vhost_vdpa_call(dev, VHOST_SET_VRING_ADDR, &addr);
+    }
+    if (r) {
+        vhost_vdpa_svq_stop(dev, index);
+    }
+    return r;
+}
+
 static int vhost_vdpa_set_vring_addr(struct vhost_dev *dev,
                                        struct vhost_vring_addr *addr)
 {
+    struct vhost_vdpa *v = dev->opaque;
+
     trace_vhost_vdpa_set_vring_addr(dev, addr->index, addr->flags,
                                     addr->desc_user_addr, addr->used_user_addr,
                                     addr->avail_user_addr,
                                     addr->log_guest_addr);
+    if (vhost_vdpa_driver_ok(dev)) {
+        /* Only the log flag has changed */
+        return 0;
+    }
+    if (v->shadow_vqs_enabled) {
+        return vhost_vdpa_svq_start(dev, addr->index);
+    }
     return vhost_vdpa_call(dev, VHOST_SET_VRING_ADDR, addr);
 }
 
@@ -595,15 +728,37 @@ static int vhost_vdpa_set_vring_num(struct vhost_dev *dev,
 static int vhost_vdpa_set_vring_base(struct vhost_dev *dev,
                                        struct vhost_vring_state *ring)
 {
+    struct vhost_vdpa *v = dev->opaque;
+
     trace_vhost_vdpa_set_vring_base(dev, ring->index, ring->num);
+    if (v->shadow_vqs_enabled) {
+        /* The shadow rings always start empty */
+        struct vhost_vring_state state = { .index = ring->index };
+
+        return vhost_vdpa_call(dev, VHOST_SET_VRING_BASE, &state);
+    }
     return vhost_vdpa_call(dev, VHOST_SET_VRING_BASE, ring);
 }
 
 static int vhost_vdpa_get_vring_base(struct vhost_dev *dev,
                                        struct vhost_vring_state *ring)
 {
+    struct vhost_vdpa *v = dev->opaque;
     int ret;
 
+    if (v->shadow_vqs_enabled) {
+        /*
+         * The device is stopped: give the buffers it did not use back to
+         * the guest's ring, whose position is then the one to restart from.
+         */
+        vhost_vdpa_svq_stop(dev, ring->index);
+        ring->num = virtio_queue_get_last_avail_idx(dev->vdev,
+                                                    dev->vq_index +
+                                                    ring->index);
+        trace_vhost_vdpa_get_vring_base(dev, ring->index, ring->num);
+        return 0;
+    }
+
     ret = vhost_vdpa_call(dev, VHOST_GET_VRING_BASE, ring);
     trace_vhost_vdpa_get_vring_base(dev, ring->index, ring->num);
     return ret;
@@ -612,14 +767,43 @@ static int vhost_vdpa_get_vring_base(struct vhost_dev *dev,
 static int vhost_vdpa_set_vring_kick(struct vhost_dev *dev,
                                        struct vhost_vring_file *file)
 {
+    struct vhost_vdpa *v = dev->opaque;
+
     trace_vhost_vdpa_set_vring_kick(dev, file->index, file->fd);
+    if (v->shadow_vqs_enabled) {
+        VhostShadowVirtqueue *svq = g_ptr_array_index(v->shadow_vqs,
+                                                      file->index);
+        struct vhost_vring_file svq_file = {
+            .index = file->index,
+            .fd = vhost_svq_get_device_kick_fd(svq),
+        };
+        int r = vhost_vdpa_call(dev, VHOST_SET_VRING_KICK, &svq_file);
+
+        if (!r) {
+            vhost_svq_set_guest_kick_fd(svq, file->fd);
+        }
+        return r;
+    }
     return vhost_vdpa_call(dev, VHOST_SET_VRING_KICK, file);
 }
 
 static int vhost_vdpa_set_vring_call(struct vhost_dev *dev,
                                        struct vhost_vring_file *file)
 {
+    struct vhost_vdpa *v = dev->opaque;
+
     trace_vhost_vdpa_set_vring_call(dev, file->index, file->fd);
+    if (v->shadow_vqs_enabled) {
+        VhostShadowVirtqueue *svq = g_ptr_array_index(v->shadow_vqs,
+                                                      file->index);
+        struct vhost_vring_file svq_file = {
+            .index = file->index,
+            .fd = vhost_svq_get_device_call_fd(svq),
+        };
+
+        vhost_svq_set_guest_call_fd(svq, file->fd);
+        return vhost_vdpa_call(dev, VHOST_SET_VRING_CALL, &svq_file);
+    }
     return vhost_vdpa_call(dev, VHOST_SET_VRING_CALL, file);
 }
 
@@ -629,6 +813,11 @@ static int vhost_vdpa_get_features(struct vhost_dev *dev,
     int ret;
 
     ret = vhost_vdpa_call(dev, VHOST_GET_FEATURES, features);
+    /*
+     * The device cannot log its writes, but switching to shadow
+     * virtqueues for migration lets QEMU do it.
+     */
+    *features |= 1ULL << VHOST_F_LOG_ALL;
     trace_vhost_vdpa_get_features(dev, *features);
     return ret;
 }
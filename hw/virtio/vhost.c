@@ -1008,47 +1008,109 @@ static int vhost_memory_region_lookup(struct vhost_dev *hdev,
     return -EFAULT;
 }
 
-int vhost_device_iotlb_miss(struct vhost_dev *dev, uint64_t iova, int write)
+/*
+ * Number of IOMMU pages following a miss that are translated along with
+ * it.  Guests with dynamic DMA mappings tend to map buffers that span
+ * several pages, and the device would otherwise fault on each of them.
+ */
+#define VHOST_IOTLB_PREFETCH_PAGES 16
+
+/*
+ * Handle an IOTLB miss of the device at @iova, and prefetch the mappings
+ * that follow it.  Mappings that are contiguous both in IOVA and host
+ * virtual address space, with the same permissions, are sent to the device
+ * as a single entry.
+ *
+ * If @end is not NULL, it is set to the end of the entry that covers
+ * @iova, so that the caller can skip further misses in that range.
+ */
+int vhost_device_iotlb_fill(struct vhost_dev *dev, uint64_t iova, int write,
+                            uint64_t *end)
 {
     IOMMUTLBEntry iotlb;
-    uint64_t uaddr, len;
+    IOMMUAccessFlags perm = IOMMU_NONE;
+    uint64_t start = 0, uaddr = 0, len = 0;
+    bool first_entry = true;
     int ret = -EFAULT;
+    int i;
 
     RCU_READ_LOCK_GUARD();
 
     trace_vhost_iotlb_miss(dev, 1);
 
-    iotlb = address_space_get_iotlb_entry(dev->vdev->dma_as,
-                                          iova, write,
-                                          MEMTXATTRS_UNSPECIFIED);
-    if (iotlb.target_as != NULL) {
-        ret = vhost_memory_region_lookup(dev, iotlb.translated_addr,
-                                         &uaddr, &len);
-        if (ret) {
+    for (i = 0; i <= VHOST_IOTLB_PREFETCH_PAGES; i++) {
+        uint64_t page_iova, page_uaddr, page_len;
+
+        /* Prefetched pages only need to be readable to be mapped */
+        iotlb = address_space_get_iotlb_entry(dev->vdev->dma_as,
+                                              iova, i ? false : write,
+                                              MEMTXATTRS_UNSPECIFIED);
+        if (iotlb.target_as == NULL) {
+            break;
+        }
+        if (vhost_memory_region_lookup(dev, iotlb.translated_addr,
+                                       &page_uaddr, &page_len)) {
+            if (i) {
+                break;
+            }
             trace_vhost_iotlb_miss(dev, 3);
             error_report("Fail to lookup the translated address "
                          "%"PRIx64, iotlb.translated_addr);
-            goto out;
+            return -EFAULT;
+        }
+
+        page_len = MIN(iotlb.addr_mask + 1, page_len);
+        page_iova = iova & ~iotlb.addr_mask;
+
+        if (len && page_iova == start + len && page_uaddr == uaddr + len &&
+            iotlb.perm == perm) {
+            len += page_len;
+        } else {
+            if (len) {
+                ret = vhost_backend_update_device_iotlb(dev, start, uaddr,
+                                                        len, perm);
+                if (ret) {
+                    goto fail;
+                }
+                first_entry = false;
+            }
+            start = page_iova;
+            uaddr = page_uaddr;
+            len = page_len;
+            perm = iotlb.perm;
+        }
+        if (end && first_entry) {
+            *end = start + len;
         }
 
-        len = MIN(iotlb.addr_mask + 1, len);
-        iova = iova & ~iotlb.addr_mask;
+        /* Stop at the end of guest memory, or of the IOVA space */
+        if (page_len != iotlb.addr_mask + 1 || page_iova + page_len == 0) {
+            break;
+        }
+        iova = page_iova + page_len;
+    }
 
-        ret = vhost_backend_update_device_iotlb(dev, iova, uaddr,
-                                                len, iotlb.perm);
+    if (len) {
+        ret = vhost_backend_update_device_iotlb(dev, start, uaddr, len, perm);
         if (ret) {
-            trace_vhost_iotlb_miss(dev, 4);
-            error_report("Fail to update device iotlb");
-            goto out;
+            goto fail;
         }
     }
 
     trace_vhost_iotlb_miss(dev, 2);
+    return ret;
 
-out:
+fail:
+    trace_vhost_iotlb_miss(dev, 4);
+    error_report("Fail to update device iotlb");
     return ret;
 }
 
+int vhost_device_iotlb_miss(struct vhost_dev *dev, uint64_t iova, int write)
+{
+    return vhost_device_iotlb_fill(dev, iova, write, NULL);
+}
+
 static int vhost_virtqueue_start(struct vhost_dev *dev,
                                 struct VirtIODevice *vdev,
                                 struct vhost_virtqueue *vq,
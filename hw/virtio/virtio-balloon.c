@@ -324,23 +324,93 @@ static void balloon_stats_set_poll_interval(Object *obj, Visitor *v,
     balloon_stats_change_timer(s, 0);
 }
 
+typedef struct BalloonReportRange {
+    RAMBlock *rb;
+    ram_addr_t offset;
+    size_t size;
+} BalloonReportRange;
+
+static gint balloon_report_range_cmp(gconstpointer a, gconstpointer b)
+{
+    const BalloonReportRange *ra = a, *rb = b;
+
+    if (ra->rb != rb->rb) {
+        return ra->rb < rb->rb ? -1 : 1;
+    }
+    if (ra->offset != rb->offset) {
+        return ra->offset < rb->offset ? -1 : 1;
+    }
+    return 0;
+}
+
+/*
+ * Discard the reported ranges, merging the ones that touch.  The guest
+ * reports free pages at its own granularity, which can be smaller than
+ * the host page size of the RAMBlock (e.g. 2 MiB reports on 1 GiB huge
+ * pages): only the host pages that are entirely covered by a run of
+ * reported ranges can be discarded.
+ */
+static void virtio_balloon_discard_reported(GArray *ranges)
+{
+    guint i, j;
+
+    g_array_sort(ranges, balloon_report_range_cmp);
+
+    for (i = 0; i < ranges->len; i = j) {
+        BalloonReportRange *r = &g_array_index(ranges, BalloonReportRange, i);
+        size_t pagesize = qemu_ram_pagesize(r->rb);
+        ram_addr_t start = r->offset;
+        ram_addr_t end = r->offset + r->size;
+
+        for (j = i + 1; j < ranges->len; j++) {
+            BalloonReportRange *next = &g_array_index(ranges,
+                                                      BalloonReportRange, j);
+
+            if (next->rb != r->rb || next->offset > end) {
+                break;
+            }
+            end = MAX(end, next->offset + next->size);
+        }
+
+        start = ROUND_UP(start, pagesize);
+        end = QEMU_ALIGN_DOWN(end, pagesize);
+        if (start < end) {
+            ram_block_discard_range(r->rb, start, end - start);
+        }
+    }
+}
+
 static void virtio_balloon_handle_report(VirtIODevice *vdev, VirtQueue *vq)
 {
     VirtIOBalloon *dev = VIRTIO_BALLOON(vdev);
+    g_autoptr(GArray) ranges = g_array_new(false, false,
+                                           sizeof(BalloonReportRange));
+    g_autoptr(GPtrArray) elems = g_ptr_array_new_with_free_func(g_free);
     VirtQueueElement *elem;
+    BalloonReportRange range;
+    bool discard;
+    guint n;
+
+    /*
+     * When we discard the page it has the effect of removing the page
+     * from the hypervisor itself and causing it to be zeroed when it
+     * is returned to us. So we must not discard the page if it is
+     * accessible by another device or process, or if the guest is
+     * expecting it to retain a non-zero value.
+     */
+    discard = !virtio_balloon_inhibited() && !dev->poison_val;
 
+    /*
+     * The guest may reuse the pages of a report as soon as it is
+     * completed, so all the reports that are pending are collected and
+     * discarded together before any of them is returned.
+     */
     while ((elem = virtqueue_pop(vq, sizeof(VirtQueueElement)))) {
         unsigned int i;
 
-        /*
-         * When we discard the page it has the effect of removing the page
-         * from the hypervisor itself and causing it to be zeroed when it
-         * is returned to us. So we must not discard the page if it is
-         * accessible by another device or process, or if the guest is
-         * expecting it to retain a non-zero value.
-         */
-        if (virtio_balloon_inhibited() || dev->poison_val) {
-            goto skip_element;
+        g_ptr_array_add(elems, elem);
+        if (!discard) {
+            continue;
         }
 
         for (i = 0; i < elem->in_num; i++) {
@@ -366,23 +436,29 @@ static void virtio_balloon_handle_report(VirtIODevice *vdev, VirtQueue *vq)
                 continue;
             }
 
-            /*
-             * For now we will simply ignore unaligned memory regions, or
-             * regions that overrun the end of the RAMBlock.
-             */
-            if (!QEMU_IS_ALIGNED(ram_offset | size, qemu_ram_pagesize(rb)) ||
-                (ram_offset + size) > qemu_ram_get_used_length(rb)) {
+            /* Ignore regions that overrun the end of the RAMBlock */
+            if ((ram_offset + size) > qemu_ram_get_used_length(rb)) {
                 continue;
             }
 
-            ram_block_discard_range(rb, ram_offset, size);
+            range.rb = rb;
+            range.offset = ram_offset;
+            range.size = size;
+            g_array_append_val(ranges, range);
         }
+    }
 
-skip_element:
-        virtqueue_push(vq, elem, 0);
-        virtio_notify(vdev, vq);
-        g_free(elem);
+    if (!elems->len) {
+        return;
+    }
+
+    virtio_balloon_discard_reported(ranges);
+
+    for (n = 0; n < elems->len; n++) {
+        virtqueue_fill(vq, g_ptr_array_index(elems, n), 0, n);
     }
+    virtqueue_flush(vq, elems->len);
+    virtio_notify(vdev, vq);
 }
 
 static void virtio_balloon_handle_output(VirtIODevice *vdev, VirtQueue *vq)
@@ -595,11 +595,12 @@ static void virtio_iommu_handle_command(VirtIODevice *vdev, VirtQueue *vq)
     unsigned int iov_cnt;
     struct iovec *iov;
     void *buf = NULL;
+    bool pushed = false;
 
     for (;;) {
         elem = virtqueue_pop(vq, sizeof(VirtQueueElement));
         if (!elem) {
-            return;
+            break;
         }
 
         if (iov_size(elem->in_sg, elem->in_num) < sizeof(tail) ||
@@ -654,9 +655,19 @@ out:
         assert(sz == output_size);
 
         virtqueue_push(vq, elem, sz);
-        virtio_notify(vdev, vq);
+        pushed = true;
         g_free(elem);
         g_free(buf);
+        buf = NULL;
+        output_size = sizeof(tail);
+    }
+
+    /*
+     * Drivers queue MAP and UNMAP requests in bursts and kick once, so
+     * complete the whole burst with a single interrupt.
+     */
+    if (pushed) {
+        virtio_notify(vdev, vq);
     }
 }
 
@@ -28,67 +28,86 @@
 
 typedef struct VirtIODeviceRequest {
     VirtQueueElement elem;
-    int fd;
-    VirtIOPMEM *pmem;
-    VirtIODevice *vdev;
+    QSIMPLEQ_ENTRY(VirtIODeviceRequest) next;
     struct virtio_pmem_req req;
     struct virtio_pmem_resp resp;
 } VirtIODeviceRequest;
 
 static int worker_cb(void *opaque)
 {
-    VirtIODeviceRequest *req_data = opaque;
+    VirtIOPMEM *pmem = opaque;
     int err = 0;
 
     /* flush raw backing image */
-    err = fsync(req_data->fd);
+    err = fsync(pmem->flush_fd);
     trace_virtio_pmem_flush_done(err);
-    if (err != 0) {
-        err = 1;
-    }
-
-    virtio_stl_p(req_data->vdev, &req_data->resp.ret, err);
 
-    return 0;
+    return err != 0;
 }
 
+static void virtio_pmem_submit_flush(VirtIOPMEM *pmem);
+
 static void done_cb(void *opaque, int ret)
 {
-    VirtIODeviceRequest *req_data = opaque;
-    int len = iov_from_buf(req_data->elem.in_sg, req_data->elem.in_num, 0,
-                              &req_data->resp, sizeof(struct virtio_pmem_resp));
+    VirtIOPMEM *pmem = opaque;
+    VirtIODevice *vdev = VIRTIO_DEVICE(pmem);
+    VirtIODeviceRequest *req_data;
 
     /* Callbacks are serialized, so no need to use atomic ops. */
-    virtqueue_push(req_data->pmem->rq_vq, &req_data->elem, len);
-    virtio_notify((VirtIODevice *)req_data->pmem, req_data->pmem->rq_vq);
-    trace_virtio_pmem_response();
-    g_free(req_data);
+    while ((req_data = QSIMPLEQ_FIRST(&pmem->inflight_flushes))) {
+        int len;
+
+        QSIMPLEQ_REMOVE_HEAD(&pmem->inflight_flushes, next);
+        virtio_stl_p(vdev, &req_data->resp.ret, ret);
+        len = iov_from_buf(req_data->elem.in_sg, req_data->elem.in_num, 0,
+                           &req_data->resp, sizeof(struct virtio_pmem_resp));
+        virtqueue_push(pmem->rq_vq, &req_data->elem, len);
+        trace_virtio_pmem_response();
+        g_free(req_data);
+    }
+    virtio_notify(vdev, pmem->rq_vq);
+
+    if (!QSIMPLEQ_EMPTY(&pmem->pending_flushes)) {
+        virtio_pmem_submit_flush(pmem);
+    }
+}
+
+/*
+ * Start one fsync on behalf of all pending requests.  Requests that arrive
+ * while it runs cannot be completed by it, since the guest may have
+ * written data after the fsync started; they wait for the next one, which
+ * again covers all of them.
+ */
+static void virtio_pmem_submit_flush(VirtIOPMEM *pmem)
+{
+    HostMemoryBackend *backend = MEMORY_BACKEND(pmem->memdev);
+    ThreadPool *pool = aio_get_thread_pool(qemu_get_aio_context());
+
+    QSIMPLEQ_CONCAT(&pmem->inflight_flushes, &pmem->pending_flushes);
+    pmem->flush_fd = memory_region_get_fd(&backend->mr);
+    thread_pool_submit_aio(pool, worker_cb, pmem, done_cb, pmem);
 }
 
 static void virtio_pmem_flush(VirtIODevice *vdev, VirtQueue *vq)
 {
     VirtIODeviceRequest *req_data;
     VirtIOPMEM *pmem = VIRTIO_PMEM(vdev);
-    HostMemoryBackend *backend = MEMORY_BACKEND(pmem->memdev);
-    ThreadPool *pool = aio_get_thread_pool(qemu_get_aio_context());
 
     trace_virtio_pmem_flush_request();
-    req_data = virtqueue_pop(vq, sizeof(VirtIODeviceRequest));
-    if (!req_data) {
-        virtio_error(vdev, "virtio-pmem missing request data");
-        return;
+    while ((req_data = virtqueue_pop(vq, sizeof(VirtIODeviceRequest)))) {
+        if (req_data->elem.out_num < 1 || req_data->elem.in_num < 1) {
+            virtio_error(vdev, "virtio-pmem request not proper");
+            virtqueue_detach_element(vq, (VirtQueueElement *)req_data, 0);
+            g_free(req_data);
+            break;
+        }
+        QSIMPLEQ_INSERT_TAIL(&pmem->pending_flushes, req_data, next);
     }
 
-    if (req_data->elem.out_num < 1 || req_data->elem.in_num < 1) {
-        virtio_error(vdev, "virtio-pmem request not proper");
-        virtqueue_detach_element(vq, (VirtQueueElement *)req_data, 0);
-        g_free(req_data);
-        return;
+    if (QSIMPLEQ_EMPTY(&pmem->inflight_flushes) &&
+        !QSIMPLEQ_EMPTY(&pmem->pending_flushes)) {
+        virtio_pmem_submit_flush(pmem);
     }
-    req_data->fd   = memory_region_get_fd(&backend->mr);
-    req_data->pmem = pmem;
-    req_data->vdev = vdev;
-    thread_pool_submit_aio(pool, worker_cb, req_data, done_cb, req_data);
 }
 
 static void virtio_pmem_get_config(VirtIODevice *vdev, uint8_t *config)
@@ -123,6 +142,8 @@ static void virtio_pmem_realize(DeviceState *dev, Error **errp)
     }
 
     host_memory_backend_set_mapped(pmem->memdev, true);
+    QSIMPLEQ_INIT(&pmem->pending_flushes);
+    QSIMPLEQ_INIT(&pmem->inflight_flushes);
     virtio_init(vdev, TYPE_VIRTIO_PMEM, VIRTIO_ID_PMEM,
                 sizeof(struct virtio_pmem_config));
     pmem->rq_vq = virtio_add_queue(vdev, 128, virtio_pmem_flush);
@@ -19,6 +19,7 @@
 #include "qemu/log.h"
 #include "qemu/main-loop.h"
 #include "qemu/module.h"
+#include "qemu/timer.h"
 #include "hw/virtio/virtio.h"
 #include "migration/qemu-file-types.h"
 #include "qemu/atomic.h"
@@ -130,6 +131,14 @@ struct VirtQueue
     EventNotifier guest_notifier;
     EventNotifier host_notifier;
     bool host_notifier_enabled;
+
+    /* Interrupt moderation, see virtio_queue_set_notify_coalescing() */
+    QEMUTimer *coal_timer;
+    int64_t coal_last;
+    uint32_t coal_usecs;
+    uint32_t coal_frames;
+    uint32_t coal_pending;
+    bool coal_irqfd;
     QLIST_ENTRY(VirtQueue) node;
 };
 
@@ -541,22 +550,26 @@ static void vring_packed_desc_read(VirtIODevice *vdev,
     virtio_tswap32s(vdev, &desc->len);
 }
 
+/*
+ * len, id and flags are adjacent at the end of the descriptor, so they
+ * are written with a single access; @end selects whether the flags are
+ * included.
+ */
 static void vring_packed_desc_write_data(VirtIODevice *vdev,
                                          VRingPackedDesc *desc,
                                          MemoryRegionCache *cache,
-                                         int i)
+                                         int i, size_t end)
 {
-    hwaddr off_id = i * sizeof(VRingPackedDesc) +
-                    offsetof(VRingPackedDesc, id);
-    hwaddr off_len = i * sizeof(VRingPackedDesc) +
-                    offsetof(VRingPackedDesc, len);
+    hwaddr off = i * sizeof(VRingPackedDesc) + offsetof(VRingPackedDesc, len);
+    size_t len = end - offsetof(VRingPackedDesc, len);
 
-    virtio_tswap32s(vdev, &desc->len);
-    virtio_tswap16s(vdev, &desc->id);
-    address_space_write_cached(cache, off_id, &desc->id, sizeof(desc->id));
-    address_space_cache_invalidate(cache, off_id, sizeof(desc->id));
-    address_space_write_cached(cache, off_len, &desc->len, sizeof(desc->len));
-    address_space_cache_invalidate(cache, off_len, sizeof(desc->len));
+    QEMU_BUILD_BUG_ON(offsetof(VRingPackedDesc, id) !=
+                      offsetof(VRingPackedDesc, len) + sizeof(desc->len));
+    QEMU_BUILD_BUG_ON(offsetof(VRingPackedDesc, flags) !=
+                      offsetof(VRingPackedDesc, id) + sizeof(desc->id));
+
+    address_space_write_cached(cache, off, &desc->len, len);
+    address_space_cache_invalidate(cache, off, len);
 }
 
 static void vring_packed_desc_write_flags(VirtIODevice *vdev,
@@ -566,7 +579,6 @@ static void vring_packed_desc_write_flags(VirtIODevice *vdev,
 {
     hwaddr off = i * sizeof(VRingPackedDesc) + offsetof(VRingPackedDesc, flags);
 
-    virtio_tswap16s(vdev, &desc->flags);
     address_space_write_cached(cache, off, &desc->flags, sizeof(desc->flags));
     address_space_cache_invalidate(cache, off, sizeof(desc->flags));
 }
@@ -576,11 +588,18 @@ static void vring_packed_desc_write(VirtIODevice *vdev,
                                     MemoryRegionCache *cache,
                                     int i, bool strict_order)
 {
-    vring_packed_desc_write_data(vdev, desc, cache, i);
-    if (strict_order) {
-        /* Make sure data is wrote before flags. */
-        smp_wmb();
+    virtio_tswap32s(vdev, &desc->len);
+    virtio_tswap16s(vdev, &desc->id);
+    virtio_tswap16s(vdev, &desc->flags);
+    if (!strict_order) {
+        vring_packed_desc_write_data(vdev, desc, cache, i,
+                                     sizeof(VRingPackedDesc));
+        return;
     }
+    vring_packed_desc_write_data(vdev, desc, cache, i,
+                                 offsetof(VRingPackedDesc, flags));
+    /* Make sure data is wrote before flags. */
+    smp_wmb();
     vring_packed_desc_write_flags(vdev, desc, cache, i);
 }
 
@@ -797,24 +816,24 @@ static void virtqueue_packed_fill(VirtQueue *vq, const VirtQueueElement *elem,
     vq->used_elems[idx].ndescs = elem->ndescs;
 }
 
+/*
+ * Write the used descriptor for @elem, @off descriptors past used_idx.
+ * Called within rcu_read_lock().
+ */
 static void virtqueue_packed_fill_desc(VirtQueue *vq,
+                                       VRingMemoryRegionCaches *caches,
                                        const VirtQueueElement *elem,
-                                       unsigned int idx,
+                                       unsigned int off,
                                        bool strict_order)
 {
     uint16_t head;
-    VRingMemoryRegionCaches *caches;
     VRingPackedDesc desc = {
         .id = elem->index,
         .len = elem->len,
     };
     bool wrap_counter = vq->used_wrap_counter;
 
-    if (unlikely(!vq->vring.desc)) {
-        return;
-    }
-
-    head = vq->used_idx + idx;
+    head = vq->used_idx + off;
     if (head >= vq->vring.num) {
         head -= vq->vring.num;
         wrap_counter ^= 1;
@@ -827,11 +846,6 @@ static void virtqueue_packed_fill_desc(VirtQueue *vq,
         desc.flags &= ~(1 << VRING_PACKED_DESC_F_USED);
     }
 
-    caches = vring_get_region_caches(vq);
-    if (!caches) {
-        return;
-    }
-
     vring_packed_desc_write(vq->vdev, &desc, &caches->desc, head, strict_order);
 }
 
@@ -876,18 +890,31 @@ static void virtqueue_split_flush(VirtQueue *vq, unsigned int count)
 
 static void virtqueue_packed_flush(VirtQueue *vq, unsigned int count)
 {
-    unsigned int i, ndescs = 0;
+    VRingMemoryRegionCaches *caches;
+    unsigned int i, ndescs;
 
     if (unlikely(!vq->vring.desc)) {
         return;
     }
 
+    caches = vring_get_region_caches(vq);
+    if (!caches) {
+        return;
+    }
+
+    /*
+     * The driver only looks past the first used descriptor once it sees
+     * its flags, so the others are written in one go each and a single
+     * barrier before the first descriptor's flags orders the whole batch.
+     * Each used descriptor goes where its chain started in the ring.
+     */
+    ndescs = vq->used_elems[0].ndescs;
     for (i = 1; i < count; i++) {
-        virtqueue_packed_fill_desc(vq, &vq->used_elems[i], i, false);
+        virtqueue_packed_fill_desc(vq, caches, &vq->used_elems[i], ndescs,
+                                   false);
         ndescs += vq->used_elems[i].ndescs;
     }
-    virtqueue_packed_fill_desc(vq, &vq->used_elems[0], 0, true);
-    ndescs += vq->used_elems[0].ndescs;
+    virtqueue_packed_fill_desc(vq, caches, &vq->used_elems[0], 0, true);
 
     vq->inuse -= ndescs;
     vq->used_idx += ndescs;
@@ -1410,10 +1437,15 @@ static void *virtqueue_alloc_element(size_t sz, unsigned out_num, unsigned in_nu
     return elem;
 }
 
-static void *virtqueue_split_pop(VirtQueue *vq, size_t sz)
+/*
+ * Pop the element at vq->last_avail_idx, which the caller checked the guest
+ * made available.
+ * Called within rcu_read_lock().
+ */
+static void *virtqueue_split_pop_rcu(VirtQueue *vq, size_t sz,
+                                     VRingMemoryRegionCaches *caches)
 {
     unsigned int i, head, max;
-    VRingMemoryRegionCaches *caches;
     MemoryRegionCache indirect_desc_cache = MEMORY_REGION_CACHE_INVALID;
     MemoryRegionCache *desc_cache;
     int64_t len;
@@ -1425,14 +1457,6 @@ static void *virtqueue_split_pop(VirtQueue *vq, size_t sz)
     VRingDesc desc;
     int rc;
 
-    RCU_READ_LOCK_GUARD();
-    if (virtio_queue_empty_rcu(vq)) {
-        goto done;
-    }
-    /* Needed after virtio_queue_empty(), see comment in
-     * virtqueue_num_heads(). */
-    smp_rmb();
-
     /* When we start there are none of either input nor output. */
     out_num = in_num = elem_entries = 0;
 
@@ -1447,23 +1471,8 @@ static void *virtqueue_split_pop(VirtQueue *vq, size_t sz)
         goto done;
     }
 
-    if (virtio_vdev_has_feature(vdev, VIRTIO_RING_F_EVENT_IDX)) {
-        vring_set_avail_event(vq, vq->last_avail_idx);
-    }
-
     i = head;
 
-    caches = vring_get_region_caches(vq);
-    if (!caches) {
-        virtio_error(vdev, "Region caches not initialized");
-        goto done;
-    }
-
-    if (caches->desc.len < max * sizeof(VRingDesc)) {
-        virtio_error(vdev, "Cannot map descriptor ring");
-        goto done;
-    }
-
     desc_cache = &caches->desc;
     vring_split_desc_read(vdev, &desc, desc_cache, i);
     if (desc.flags & VRING_DESC_F_INDIRECT) {
@@ -1547,6 +1556,70 @@ err_undo_map:
     goto done;
 }
 
+static unsigned int virtqueue_split_pop_batch(VirtQueue *vq, size_t sz,
+                                              void **elems, unsigned int max)
+{
+    VRingMemoryRegionCaches *caches;
+    VirtIODevice *vdev = vq->vdev;
+    uint16_t start = vq->last_avail_idx;
+    unsigned int n = 0;
+    int num_heads;
+
+    RCU_READ_LOCK_GUARD();
+    if (unlikely(!vq->vring.avail)) {
+        return 0;
+    }
+
+    /*
+     * Only read the avail index again if the heads seen last time are not
+     * enough for the batch.
+     */
+    num_heads = (uint16_t)(vq->shadow_avail_idx - vq->last_avail_idx);
+    if (num_heads < max) {
+        num_heads = virtqueue_num_heads(vq, vq->last_avail_idx);
+        if (num_heads <= 0) {
+            return 0;
+        }
+    } else {
+        /* See comment in virtqueue_num_heads(). */
+        smp_rmb();
+    }
+
+    caches = vring_get_region_caches(vq);
+    if (!caches) {
+        virtio_error(vdev, "Region caches not initialized");
+        return 0;
+    }
+
+    if (caches->desc.len < vq->vring.num * sizeof(VRingDesc)) {
+        virtio_error(vdev, "Cannot map descriptor ring");
+        return 0;
+    }
+
+    max = MIN(max, num_heads);
+    while (n < max) {
+        elems[n] = virtqueue_split_pop_rcu(vq, sz, caches);
+        if (!elems[n]) {
+            break;
+        }
+        n++;
+    }
+
+    if (vq->last_avail_idx != start &&
+        virtio_vdev_has_feature(vdev, VIRTIO_RING_F_EVENT_IDX)) {
+        vring_set_avail_event(vq, vq->last_avail_idx);
+    }
+    return n;
+}
+
+static void *virtqueue_split_pop(VirtQueue *vq, size_t sz)
+{
+    void *elem = NULL;
+
+    virtqueue_split_pop_batch(vq, sz, &elem, 1);
+    return elem;
+}
+
 static void *virtqueue_packed_pop(VirtQueue *vq, size_t sz)
 {
     unsigned int i, max;
@@ -1695,6 +1768,29 @@ void *virtqueue_pop(VirtQueue *vq, size_t sz)
     }
 }
 
+/*
+ * Pop up to @max elements of @sz bytes into @elems, and return how many
+ * were popped.  With a split ring, the avail index is read and the avail
+ * event written at most once for the whole batch.
+ */
+unsigned int virtqueue_pop_batch(VirtQueue *vq, size_t sz, void **elems,
+                                 unsigned int max)
+{
+    unsigned int n = 0;
+
+    if (virtio_device_disabled(vq->vdev)) {
+        return 0;
+    }
+
+    if (!virtio_vdev_has_feature(vq->vdev, VIRTIO_F_RING_PACKED)) {
+        return virtqueue_split_pop_batch(vq, sz, elems, max);
+    }
+    while (n < max && (elems[n] = virtqueue_packed_pop(vq, sz))) {
+        n++;
+    }
+    return n;
+}
+
 static unsigned int virtqueue_packed_drop_all(VirtQueue *vq)
 {
     VRingMemoryRegionCaches *caches;
@@ -2025,6 +2121,11 @@ void virtio_reset(void *opaque)
         vdev->vq[i].notification = true;
         vdev->vq[i].vring.num = vdev->vq[i].vring.num_default;
         vdev->vq[i].inuse = 0;
+        if (vdev->vq[i].coal_timer) {
+            timer_del(vdev->vq[i].coal_timer);
+        }
+        vdev->vq[i].coal_pending = 0;
+        vdev->vq[i].coal_last = 0;
         virtio_virtqueue_reset_region_cache(&vdev->vq[i]);
     }
 }
@@ -2424,6 +2525,11 @@ void virtio_delete_queue(VirtQueue *vq)
     g_free(vq->used_elems);
     vq->used_elems = NULL;
     virtio_virtqueue_reset_region_cache(vq);
+    if (vq->coal_timer) {
+        timer_free(vq->coal_timer);
+        vq->coal_timer = NULL;
+    }
+    vq->coal_pending = 0;
 }
 
 void virtio_del_queue(VirtIODevice *vdev, int n)
@@ -2515,7 +2621,7 @@ static bool virtio_packed_should_notify(VirtIODevice *vdev, VirtQueue *vq)
 }
 
 /* Called within rcu_read_lock().  */
-static bool virtio_should_notify(VirtIODevice *vdev, VirtQueue *vq)
+bool virtio_should_notify(VirtIODevice *vdev, VirtQueue *vq)
 {
     if (virtio_vdev_has_feature(vdev, VIRTIO_F_RING_PACKED)) {
         return virtio_packed_should_notify(vdev, vq);
@@ -2524,7 +2630,47 @@ static bool virtio_should_notify(VirtIODevice *vdev, VirtQueue *vq)
     }
 }
 
-void virtio_notify_irqfd(VirtIODevice *vdev, VirtQueue *vq)
+/*
+ * Returns true if the notification for @vq is held back by interrupt
+ * moderation, to be delivered by the coalescing timer.  The first
+ * notification after a quiet period goes out at once, so that moderation
+ * only costs latency when completions come in faster than the window.
+ */
+static bool virtio_notify_coalesce(VirtQueue *vq, bool irqfd)
+{
+    int64_t now;
+
+    if (!vq->coal_timer) {
+        return false;
+    }
+
+    if (vq->coal_pending) {
+        vq->coal_irqfd = irqfd;
+        if (++vq->coal_pending < vq->coal_frames) {
+            return true;
+        }
+        /* The window is full, do not wait for the timer */
+        timer_del(vq->coal_timer);
+        vq->coal_pending = 0;
+        vq->coal_last = qemu_clock_get_ns(QEMU_CLOCK_VIRTUAL);
+        trace_virtio_notify_coalesce_flush(vq, vq->coal_frames);
+        return false;
+    }
+
+    now = qemu_clock_get_ns(QEMU_CLOCK_VIRTUAL);
+    if (now - vq->coal_last >= (int64_t)vq->coal_usecs * SCALE_US) {
+        vq->coal_last = now;
+        return false;
+    }
+
+    vq->coal_pending = 1;
+    vq->coal_irqfd = irqfd;
+    timer_mod(vq->coal_timer,
+              vq->coal_last + (int64_t)vq->coal_usecs * SCALE_US);
+    return true;
+}
+
+static void virtio_notify_irqfd_now(VirtIODevice *vdev, VirtQueue *vq)
 {
     WITH_RCU_READ_LOCK_GUARD() {
         if (!virtio_should_notify(vdev, vq)) {
@@ -2553,13 +2699,20 @@ void virtio_notify_irqfd(VirtIODevice *vdev, VirtQueue *vq)
     event_notifier_set(&vq->guest_notifier);
 }
 
+void virtio_notify_irqfd(VirtIODevice *vdev, VirtQueue *vq)
+{
+    if (!virtio_notify_coalesce(vq, true)) {
+        virtio_notify_irqfd_now(vdev, vq);
+    }
+}
+
 static void virtio_irq(VirtQueue *vq)
 {
     virtio_set_isr(vq->vdev, 0x1);
     virtio_notify_vector(vq->vdev, vq->vector);
 }
 
-void virtio_notify(VirtIODevice *vdev, VirtQueue *vq)
+static void virtio_notify_now(VirtIODevice *vdev, VirtQueue *vq)
 {
     WITH_RCU_READ_LOCK_GUARD() {
         if (!virtio_should_notify(vdev, vq)) {
@@ -2571,6 +2724,69 @@ void virtio_notify(VirtIODevice *vdev, VirtQueue *vq)
     virtio_irq(vq);
 }
 
+void virtio_notify(VirtIODevice *vdev, VirtQueue *vq)
+{
+    if (!virtio_notify_coalesce(vq, false)) {
+        virtio_notify_now(vdev, vq);
+    }
+}
+
+static void virtio_notify_coalesce_flush(VirtQueue *vq)
+{
+    uint32_t pending = vq->coal_pending;
+
+    if (!pending) {
+        return;
+    }
+
+    timer_del(vq->coal_timer);
+    vq->coal_pending = 0;
+    /*
+     * A window that collected a single notification only delayed it:
+     * the load is too low for moderation to pay off, so deliver the next
+     * one at once.
+     */
+    vq->coal_last = pending > 1 ? qemu_clock_get_ns(QEMU_CLOCK_VIRTUAL) : 0;
+    trace_virtio_notify_coalesce_flush(vq, pending);
+
+    if (vq->coal_irqfd) {
+        virtio_notify_irqfd_now(vq->vdev, vq);
+    } else {
+        virtio_notify_now(vq->vdev, vq);
+    }
+}
+
+static void virtio_notify_coalesce_timer(void *opaque)
+{
+    virtio_notify_coalesce_flush(opaque);
+}
+
+/*
+ * Hold back the notifications of @vq for up to @usecs after the previous
+ * one, or until @frames of them are pending, whichever comes first.
+ * @ctx is the AioContext that notifications for @vq are sent from; the
+ * coalescing timer runs there.  @usecs == 0 disables moderation.  Any
+ * notification held back under the previous settings is sent first, so
+ * this must be called from the context that sent it.
+ */
+void virtio_queue_set_notify_coalescing(VirtQueue *vq, AioContext *ctx,
+                                        uint32_t usecs, uint32_t frames)
+{
+    if (vq->coal_timer) {
+        virtio_notify_coalesce_flush(vq);
+        timer_free(vq->coal_timer);
+        vq->coal_timer = NULL;
+    }
+
+    vq->coal_usecs = usecs;
+    vq->coal_frames = MAX(frames, 1);
+    vq->coal_last = 0;
+    if (usecs) {
+        vq->coal_timer = aio_timer_new(ctx, QEMU_CLOCK_VIRTUAL, SCALE_NS,
+                                       virtio_notify_coalesce_timer, vq);
+    }
+}
+
 void virtio_notify_config(VirtIODevice *vdev)
 {
     if (!(vdev->status & VIRTIO_CONFIG_S_DRIVER_OK))
@@ -3226,6 +3442,19 @@ static void virtio_vmstate_change(void *opaque, bool running, RunState state)
     if (!backend_run) {
         virtio_set_status(vdev, vdev->status);
     }
+
+    if (!running) {
+        int i;
+
+        /*
+         * The coalescing timers run on the virtual clock, so they would
+         * not fire until the VM runs again; send what they hold now so
+         * that it is part of the migrated state.
+         */
+        for (i = 0; i < VIRTIO_QUEUE_MAX; i++) {
+            virtio_notify_coalesce_flush(&vdev->vq[i]);
+        }
+    }
 }
 
 void virtio_instance_init_common(Object *proxy_obj, void *data,
@@ -3725,7 +3954,7 @@ static Property virtio_properties[] = {
     DEFINE_PROP_END_OF_LIST(),
 };
 
-static int virtio_device_start_ioeventfd_impl(VirtIODevice *vdev)
+int virtio_device_start_ioeventfd_impl(VirtIODevice *vdev)
 {
     VirtioBusState *qbus = VIRTIO_BUS(qdev_get_parent_bus(DEVICE(vdev)));
     int i, n, r, err;
@@ -3795,7 +4024,7 @@ int virtio_device_start_ioeventfd(VirtIODevice *vdev)
     return virtio_bus_start_ioeventfd(vbus);
 }
 
-static void virtio_device_stop_ioeventfd_impl(VirtIODevice *vdev)
+void virtio_device_stop_ioeventfd_impl(VirtIODevice *vdev)
 {
     VirtioBusState *qbus = VIRTIO_BUS(qdev_get_parent_bus(DEVICE(vdev)));
     int n, r;
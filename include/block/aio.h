@@ -20,6 +20,7 @@
 #include "qemu/coroutine.h"
 #include "qemu/queue.h"
 #include "qemu/event_notifier.h"
+#include "qemu/stats64.h"
 #include "qemu/thread.h"
 #include "qemu/timer.h"
 
@@ -246,6 +247,13 @@ struct AioContext {
     /* Are we in polling mode or monitoring file descriptors? */
     bool poll_started;
 
+    /*
+     * Number of polling windows that found work and that ran out without
+     * finding any, respectively
+     */
+    Stat64 poll_hits;
+    Stat64 poll_misses;
+
     /* epoll(7) state used when built with CONFIG_EPOLL */
     int epollfd;
 
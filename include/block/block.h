@@ -855,6 +855,25 @@ int coroutine_fn bdrv_co_copy_range(BdrvChild *src, int64_t src_offset,
                                     int64_t bytes, BdrvRequestFlags read_flags,
                                     BdrvRequestFlags write_flags);
 
+/**
+ *
+ * bdrv_co_sendfile:
+ *
+ * Write @hdr_len bytes from @hdr to the socket @fd, followed by @bytes bytes
+ * of data read from @child at @offset, without copying the data through a
+ * buffer in QEMU.
+ *
+ * The caller must make sure that nothing else writes to @fd meanwhile.
+ *
+ * Returns: 0 if succeeded; -ENOTSUP if the node cannot send its data this
+ * way, in which case nothing has been written to @fd and the caller should
+ * fall back to a normal read.  After any other error, part of the data may
+ * have been written already, so the stream on @fd must be considered broken.
+ **/
+int coroutine_fn bdrv_co_sendfile(BdrvChild *child, int64_t offset,
+                                  int64_t bytes, int fd, const void *hdr,
+                                  size_t hdr_len);
+
 void bdrv_cancel_in_flight(BlockDriverState *bs);
 
 #endif
@@ -332,6 +332,18 @@ struct BlockDriver {
                                               BdrvRequestFlags read_flags,
                                               BdrvRequestFlags write_flags);
 
+    /* Map [offset, offset + bytes) onto a child of @bs and invoke
+     * bdrv_co_sendfile() on it, or write the header and the data to @fd if
+     * @bs is the leaf.
+     *
+     * See the comment of bdrv_co_sendfile for the parameter and return value
+     * semantics.
+     */
+    int coroutine_fn (*bdrv_co_sendfile)(BlockDriverState *bs,
+                                         int64_t offset, int64_t bytes,
+                                         int fd, const void *hdr,
+                                         size_t hdr_len);
+
     /*
      * Building block for bdrv_block_status[_above] and
      * bdrv_is_allocated[_above].  The driver should answer only
@@ -973,6 +985,16 @@ struct BlockDriverState {
     /* Offset after the highest byte written to */
     Stat64 wr_highest_offset;
 
+    /*
+     * Per-node request accounting, enabled by setting a latency histogram
+     * for the node.  @stats_enabled is accessed with atomic ops, the
+     * serialising wait counters are updated under @reqs_lock.
+     */
+    bool stats_enabled;
+    BlockAcctStats stats;
+    Stat64 serialising_waits;
+    Stat64 serialising_wait_ns;
+
     /* If true, copy read backing sectors into image.  Can be >1 if more
      * than one client has requested copy-on-read.  Accessed with atomic
      * ops.
@@ -57,6 +57,17 @@ typedef struct ThrottleGroupMember {
     unsigned       pending_reqs[2];
     QLIST_ENTRY(ThrottleGroupMember) round_robin;
 
+    /* I/O that this member may do without taking the ThrottleGroup lock.
+     * It has already been accounted in the group's ThrottleState, and is
+     * only valid while budget_gen matches the group's and until
+     * budget_expire_ns.  These fields are only used from aio_context.
+     */
+    double       budget_bytes[2];
+    double       budget_units[2];
+    int64_t      budget_expire_ns[2];
+    uint64_t     budget_op_size;
+    unsigned     budget_gen;
+
 } ThrottleGroupMember;
 
 #define TYPE_THROTTLE_GROUP "throttle-group"
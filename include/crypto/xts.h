@@ -29,6 +29,11 @@
 
 #define XTS_BLOCK_SIZE 16
 
+/*
+ * A cipher function processes @length bytes, which can be any multiple
+ * of XTS_BLOCK_SIZE, as consecutive independent blocks (ECB mode).  It
+ * must allow @dst and @src to be the same buffer.
+ */
 typedef void xts_cipher_func(const void *ctx,
                              size_t length,
                              uint8_t *dst,
@@ -78,6 +78,8 @@ typedef uint64_t target_ulong;
 
 /* use a fully associative victim tlb of 8 entries */
 #define CPU_VTLB_SIZE 8
+/* The number of large page mappings remembered for each mmu_idx.  */
+#define CPU_TLB_LARGE_SIZE 8
 
 #if HOST_LONG_BITS == 32 && TARGET_LONG_BITS == 32
 #define CPU_TLB_ENTRY_BITS 4
@@ -154,6 +156,20 @@ typedef struct CPUIOTLBEntry {
  * Data elements that are per MMU mode, minus the bits accessed by
  * the TCG fast path.
  */
+/*
+ * A mapping larger than TARGET_PAGE_SIZE, as passed to tlb_set_page.
+ * Only one page of it is entered into the tlb at a time; the others are
+ * entered from this record on a miss, without a page table walk.  An
+ * unused record has prot == 0.
+ */
+typedef struct CPUTLBLargePage {
+    target_ulong vaddr;
+    target_ulong mask;
+    hwaddr paddr;
+    MemTxAttrs attrs;
+    int prot;
+} CPUTLBLargePage;
+
 typedef struct CPUTLBDesc {
     /*
      * Describe a region covering all of the large pages allocated
@@ -173,6 +189,14 @@ typedef struct CPUTLBDesc {
     /* The tlb victim table, in two parts.  */
     CPUTLBEntry vtable[CPU_VTLB_SIZE];
     CPUIOTLBEntry viotlb[CPU_VTLB_SIZE];
+    /* The next index to use in the large page table.  */
+    size_t lindex;
+    /*
+     * The large page table.  All of these mappings lie within the
+     * large_page_addr/large_page_mask region, so they are discarded
+     * whenever one of their pages is flushed.
+     */
+    CPUTLBLargePage ltable[CPU_TLB_LARGE_SIZE];
     /* The iotlb.  */
     CPUIOTLBEntry *iotlb;
 } CPUTLBDesc;
@@ -191,6 +215,20 @@ typedef struct CPUTLBDescFast {
 /*
  * Data elements that are shared between all MMU modes.
  */
+/*
+ * A range of pages to flush from the tlbs indicated by idxmap.  Only
+ * the low @bits of the virtual address are significant when matching.
+ */
+typedef struct TLBFlushRangeData {
+    target_ulong addr;
+    target_ulong len;
+    uint16_t idxmap;
+    uint16_t bits;
+} TLBFlushRangeData;
+
+/* The number of distinct flush ranges that can wait for a cpu.  */
+#define CPU_TLB_PENDING_FLUSHES 8
+
 typedef struct CPUTLBCommon {
     /* Serialize updates to f.table and d.vtable, and others as noted. */
     QemuSpin lock;
@@ -200,6 +238,17 @@ typedef struct CPUTLBCommon {
      * Protected by tlb_c.lock.
      */
     uint16_t dirty;
+    /*
+     * Page and range flushes requested by other cpus that have not run
+     * yet.  While pending_queued is set, new requests are merged here
+     * instead of queueing more work on the cpu; the mmu_idx in
+     * pending_full are flushed entirely once the table overflows.
+     * Protected by tlb_c.lock.
+     */
+    bool pending_queued;
+    uint16_t pending_full;
+    unsigned pending_count;
+    TLBFlushRangeData pending[CPU_TLB_PENDING_FLUSHES];
     /*
      * Statistics.  These are not lock protected, but are read and
      * written atomically.  This allows the monitor to print a snapshot
@@ -208,6 +257,7 @@ typedef struct CPUTLBCommon {
     size_t full_flush_count;
     size_t part_flush_count;
     size_t elide_flush_count;
+    size_t fill_count;
 } CPUTLBCommon;
 
 /*
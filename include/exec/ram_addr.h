@@ -105,9 +105,10 @@ long qemu_maxrampagesize(void);
  *  @size: the size in bytes of the ram block
  *  @mr: the memory region where the ram block is
  *  @ram_flags: RamBlock flags. Supported flags: RAM_SHARED, RAM_PMEM,
- *              RAM_NORESERVE.
+ *              RAM_NORESERVE, RAM_READONLY_FD.
  *  @mem_path or @fd: specify the backing file or device
- *  @readonly: true to open @path for reading, false for read/write.
+ *  @readonly: true to open @path for reading and map the RAM read-only,
+ *             false for read/write.
  *  @errp: pointer to Error*, to store an error if it happens
  *
  * Return:
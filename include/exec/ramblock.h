@@ -43,6 +43,11 @@ struct RAMBlock {
     unsigned long *bmap;
     /* bitmap of already received pages in postcopy */
     unsigned long *receivedmap;
+    /* bitmap of the pages written to a mapped-ram file */
+    unsigned long *file_bmap;
+    /* offsets of file_bmap and of the pages in a mapped-ram file */
+    off_t bitmap_offset;
+    off_t pages_offset;
 
     /*
      * bitmap to track already cleared dirty bitmap.  When the bit is
@@ -580,6 +580,17 @@ float32 float32_rem(float32, float32, float_status *status);
 float32 float32_muladd(float32, float32, float32, int, float_status *status);
 float32 float32_sqrt(float32, float_status *status);
 float32 float32_exp2(float32, float_status *status);
+
+/*
+ * Element-wise d[i] = a[i] op b[i] for i < n, with the same results and
+ * exception flags as the scalar functions.  d may alias a or b.
+ */
+void float32_add_vec(float32 *d, const float32 *a, const float32 *b,
+                     size_t n, float_status *status);
+void float32_sub_vec(float32 *d, const float32 *a, const float32 *b,
+                     size_t n, float_status *status);
+void float32_mul_vec(float32 *d, const float32 *a, const float32 *b,
+                     size_t n, float_status *status);
 float32 float32_log2(float32, float_status *status);
 FloatRelation float32_compare(float32, float32, float_status *status);
 FloatRelation float32_compare_quiet(float32, float32, float_status *status);
@@ -770,6 +781,14 @@ float64 float64_rem(float64, float64, float_status *status);
 float64 float64_muladd(float64, float64, float64, int, float_status *status);
 float64 float64_sqrt(float64, float_status *status);
 float64 float64_log2(float64, float_status *status);
+
+/* Element-wise batch operations, see float32_add_vec. */
+void float64_add_vec(float64 *d, const float64 *a, const float64 *b,
+                     size_t n, float_status *status);
+void float64_sub_vec(float64 *d, const float64 *a, const float64 *b,
+                     size_t n, float_status *status);
+void float64_mul_vec(float64 *d, const float64 *a, const float64 *b,
+                     size_t n, float_status *status);
 FloatRelation float64_compare(float64, float64, float_status *status);
 FloatRelation float64_compare_quiet(float64, float64, float_status *status);
 float64 float64_min(float64, float64, float_status *status);
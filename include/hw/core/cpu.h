@@ -223,6 +223,9 @@ struct hvf_vcpu_state;
 #define TB_JMP_CACHE_BITS 12
 #define TB_JMP_CACHE_SIZE (1 << TB_JMP_CACHE_BITS)
 
+#define TB_LOOKUP_CACHE_BITS 14
+#define TB_LOOKUP_CACHE_SIZE (1 << TB_LOOKUP_CACHE_BITS)
+
 /* work queue */
 
 /* The union type allows passing of 64 bit target pointers on 32 bit
@@ -301,6 +304,7 @@ struct qemu_work_item;
  *    ring is enabled.
  * @kvm_fetch_index: Keeps the index that we last fetched from the per-vCPU
  *    dirty ring structure.
+ * @kvm_exits: Number of returns from KVM_RUN, indexed by exit reason.
  *
  * State of one CPU core or thread.
  */
@@ -353,6 +357,25 @@ struct CPUState {
 
     /* Accessed in parallel; all accesses must be atomic */
     TranslationBlock *tb_jmp_cache[TB_JMP_CACHE_SIZE];
+    /*
+     * Second level of TB lookup, consulted when tb_jmp_cache misses.
+     * Indexed by the TB hash, which includes the physical pc, so it
+     * survives changes to the virtual memory map.  Only accessed by
+     * this vCPU and by tb_flush, within the exclusive section.
+     */
+    TranslationBlock **tb_lookup_cache;
+    /* Statistics for lookups that missed tb_jmp_cache, see "info jit" */
+    size_t tb_lookup_cache_hits;
+    size_t tb_lookup_htable_hits;
+    size_t tb_lookup_misses;
+    /*
+     * Further statistics for query-tcg-stats.  Written only by this
+     * vCPU, and read atomically by the monitor.
+     */
+    size_t tb_jmp_cache_hits;
+    size_t tb_translations;
+    uint64_t tb_translate_ns;
+    size_t exception_exits;
 
     struct GDBRegisterState *gdb_regs;
     int gdb_num_regs;
@@ -378,6 +401,7 @@ struct CPUState {
     struct kvm_run *kvm_run;
     struct kvm_dirty_gfn *kvm_dirty_gfns;
     uint32_t kvm_fetch_index;
+    unsigned long *kvm_exits;
 
     /* Used for events with 'vcpu' and *without* the 'disabled' properties */
     DECLARE_BITMAP(trace_dstate_delayed, CPU_TRACE_DSTATE_MAX_EVENTS);
@@ -389,6 +413,8 @@ struct CPUState {
     GArray *plugin_mem_cbs;
     /* saved iotlb data from io_writex */
     SavedIOTLB saved_iotlb;
+    /* a sample is queued on the work list and has not run yet */
+    bool plugin_sample_pending;
 #endif
 
     /* TODO Move common fields from CPUArchState here. */
@@ -407,6 +433,12 @@ struct CPUState {
      */
     bool throttle_thread_scheduled;
 
+    /* Pages dirtied by this vcpu, as collected from its KVM dirty ring */
+    uint64_t dirty_pages;
+    /* Dirty limit state, see cpu_throttle_dirty_limit_set() */
+    uint64_t dirty_limit_prev_pages;
+    int64_t dirty_limit_sleep_us;
+
     bool ignore_memory_transaction_failures;
 
     struct hax_vcpu_state *hax_vcpu;
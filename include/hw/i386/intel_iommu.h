@@ -118,11 +118,13 @@ struct VTDBus {
 };
 
 struct VTDIOTLBEntry {
+    uint64_t key;               /* Key in IntelIOMMUState.iotlb */
     uint64_t gfn;
     uint16_t domain_id;
     uint64_t slpte;
     uint64_t mask;
     uint8_t access_flags;
+    QLIST_ENTRY(VTDIOTLBEntry) next;    /* Entries of the same domain */
 };
 
 /* VT-d Source-ID Qualifier types */
@@ -251,6 +253,7 @@ struct IntelIOMMUState {
 
     uint32_t context_cache_gen;     /* Should be in [1,MAX] */
     GHashTable *iotlb;              /* IOTLB */
+    GHashTable *iotlb_domains;      /* IOTLB entries indexed by domain id */
 
     GHashTable *vtd_as_by_busptr;   /* VTDBus objects indexed by PCIBus* reference */
     VTDBus *vtd_as_by_bus_num[VTD_PCI_BUS_MAX]; /* VTDBus objects indexed by bus number */
@@ -41,6 +41,8 @@ typedef enum {
     MPQEMU_CMD_BAR_READ,
     MPQEMU_CMD_SET_IRQFD,
     MPQEMU_CMD_DEVICE_RESET,
+    /* like MPQEMU_CMD_BAR_WRITE, but the remote does not reply */
+    MPQEMU_CMD_BAR_WRITE_POSTED,
     MPQEMU_CMD_MAX,
 } MPQemuCmd;
 
@@ -94,6 +96,7 @@ bool mpqemu_msg_recv(MPQemuMsg *msg, QIOChannel *ioc, Error **errp);
 
 uint64_t mpqemu_msg_send_and_await_reply(MPQemuMsg *msg, PCIProxyDev *pdev,
                                          Error **errp);
+bool mpqemu_msg_send_posted(MPQemuMsg *msg, PCIProxyDev *pdev, Error **errp);
 bool mpqemu_msg_valid(MPQemuMsg *msg);
 
 #endif
@@ -24,6 +24,7 @@
 #include "exec/memory.h"
 #include "qemu/queue.h"
 #include "qemu/notify.h"
+#include "qemu/thread.h"
 #include "ui/console.h"
 #include "hw/display/ramfb.h"
 #ifdef CONFIG_LINUX
@@ -58,6 +59,12 @@ typedef struct VFIORegion {
     uint8_t nr; /* cache the region number for debug */
 } VFIORegion;
 
+typedef struct VFIOStateChunk {
+    QSIMPLEQ_ENTRY(VFIOStateChunk) next;
+    uint64_t size;
+    uint8_t data[];
+} VFIOStateChunk;
+
 typedef struct VFIOMigration {
     struct VFIODevice *vbasedev;
     VMChangeStateEntry *vm_state;
@@ -66,6 +73,16 @@ typedef struct VFIOMigration {
     int vm_running;
     Notifier migration_state;
     uint64_t pending_bytes;
+    /* Stop-and-copy data read ahead of the migration stream */
+    QemuThread prefetch_thread;
+    bool prefetch_running;
+    QemuMutex prefetch_lock;
+    QemuCond prefetch_cond;
+    QSIMPLEQ_HEAD(, VFIOStateChunk) prefetch_chunks;
+    uint64_t prefetch_queued;
+    bool prefetch_done;
+    bool prefetch_quit;
+    int prefetch_ret;
 } VFIOMigration;
 
 typedef struct VFIOAddressSpace {
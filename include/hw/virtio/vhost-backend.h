@@ -190,6 +190,12 @@ int vhost_backend_invalidate_device_iotlb(struct vhost_dev *dev,
 int vhost_backend_handle_iotlb_msg(struct vhost_dev *dev,
                                           struct vhost_iotlb_msg *imsg);
 
+/* Maximum number of messages for vhost_backend_handle_iotlb_msgs() */
+#define VHOST_BACKEND_IOTLB_BATCH 32
+
+void vhost_backend_handle_iotlb_msgs(struct vhost_dev *dev,
+                                     struct vhost_iotlb_msg *imsgs, int n);
+
 int vhost_user_gpu_set_socket(struct vhost_dev *dev, int fd);
 
 #endif /* VHOST_BACKEND_H */
@@ -13,6 +13,7 @@
 #define HW_VIRTIO_VHOST_VDPA_H
 
 #include "hw/virtio/virtio.h"
+#include "standard-headers/linux/vhost_types.h"
 
 typedef struct VhostVDPAHostNotifier {
     MemoryRegion mr;
@@ -25,6 +26,13 @@ typedef struct vhost_vdpa {
     MemoryListener listener;
     struct vhost_dev *dev;
     VhostVDPAHostNotifier notifier[VIRTIO_QUEUE_MAX];
+    struct vhost_vdpa_iova_range iova_range;
+    /*
+     * Forward the virtqueues through QEMU, so that the device's writes to
+     * guest memory are logged.  Only changed while the device is stopped.
+     */
+    bool shadow_vqs_enabled;
+    GPtrArray *shadow_vqs;
 } VhostVDPA;
 
 #endif
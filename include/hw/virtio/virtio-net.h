@@ -20,6 +20,7 @@
 #include "net/announce.h"
 #include "qemu/option_int.h"
 #include "qom/object.h"
+#include "sysemu/iothread.h"
 
 #include "ebpf/ebpf_rss.h"
 
@@ -40,6 +41,8 @@ typedef struct virtio_net_conf
     uint32_t txtimer;
     int32_t txburst;
     char *tx;
+    uint32_t coalesce_usecs;
+    uint32_t coalesce_frames;
     uint16_t rx_queue_size;
     uint16_t tx_queue_size;
     uint16_t mtu;
@@ -148,10 +151,16 @@ typedef struct VirtIONetQueue {
     QEMUTimer *tx_timer;
     QEMUBH *tx_bh;
     uint32_t tx_waiting;
+    /* Coalesces the rx notifications of a burst of received packets */
+    QEMUBH *rx_bh;
+    bool rx_notify_pending;
     struct {
         VirtQueueElement *elem;
+        struct virtio_net_hdr_mrg_rxbuf hdr;
     } async_tx;
     struct VirtIONet *n;
+    /* IOThread that processes the queue pair, NULL for the main loop */
+    AioContext *ctx;
 } VirtIONetQueue;
 
 struct VirtIONet {
@@ -213,6 +222,10 @@ struct VirtIONet {
     VirtioNetRssData rss_data;
     struct NetRxPkt *rx_pkt;
     struct EBPFRSSContext ebpf_rss;
+    uint32_t num_iothreads;
+    char **iothread_ids;
+    IOThread **iothreads;
+    bool dataplane_started;
 };
 
 void virtio_net_set_netclient_name(VirtIONet *n, const char *name,
@@ -32,6 +32,14 @@ struct VirtIOPMEM {
     VirtQueue *rq_vq;
     uint64_t start;
     HostMemoryBackend *memdev;
+
+    /*
+     * Flush requests waiting for the next fsync, and those covered by the
+     * one that is running.
+     */
+    QSIMPLEQ_HEAD(, VirtIODeviceRequest) pending_flushes;
+    QSIMPLEQ_HEAD(, VirtIODeviceRequest) inflight_flushes;
+    int flush_fd;
 };
 
 struct VirtIOPMEMClass {
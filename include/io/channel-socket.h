@@ -47,6 +47,9 @@ struct QIOChannelSocket {
     socklen_t localAddrLen;
     struct sockaddr_storage remoteAddr;
     socklen_t remoteAddrLen;
+    /* writes sent with MSG_ZEROCOPY, and those the kernel is done with */
+    uint64_t zero_copy_queued;
+    uint64_t zero_copy_sent;
 };
 
 
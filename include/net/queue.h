@@ -32,6 +32,11 @@ typedef void (NetPacketSent) (NetClientState *sender, ssize_t ret);
 
 #define QEMU_NET_PACKET_FLAG_NONE  0
 #define QEMU_NET_PACKET_FLAG_RAW  (1<<0)
+/*
+ * The sender keeps the buffers valid until its sent callback is called,
+ * so a packet queued with a callback references them instead of copying.
+ */
+#define QEMU_NET_PACKET_FLAG_NOCOPY  (1<<1)
 
 /* Returns:
  *   >0 - success
@@ -122,6 +122,19 @@ bool qemu_in_coroutine(void);
  */
 bool qemu_coroutine_entered(Coroutine *co);
 
+/**
+ * Increase the number of coroutines kept in the free pools
+ *
+ * Call this when creating a device that may have up to
+ * @additional_pool_size requests in flight, each in its own coroutine.
+ */
+void qemu_coroutine_inc_pool_size(unsigned int additional_pool_size);
+
+/**
+ * Undo qemu_coroutine_inc_pool_size() when the device goes away
+ */
+void qemu_coroutine_dec_pool_size(unsigned int removing_pool_size);
+
 /**
  * Provides a mutex that can be used to synchronise coroutines
  */
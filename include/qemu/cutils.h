@@ -175,6 +175,7 @@ char *freq_to_str(uint64_t freq_hz);
 
 bool buffer_is_zero(const void *buf, size_t len);
 bool test_buffer_is_zero_next_accel(void);
+const char *test_buffer_is_zero_accel_name(void);
 
 /*
  * Implementation of ULEB128 (http://en.wikipedia.org/wiki/LEB128)
@@ -50,7 +50,7 @@ typedef uint64_t qemu_plugin_id_t;
 
 extern QEMU_PLUGIN_EXPORT int qemu_plugin_version;
 
-#define QEMU_PLUGIN_VERSION 1
+#define QEMU_PLUGIN_VERSION 2
 
 /**
  * struct qemu_info_t - system information for plugins
@@ -299,6 +299,74 @@ void qemu_plugin_register_vcpu_tb_exec_inline(struct qemu_plugin_tb *tb,
                                               enum qemu_plugin_op op,
                                               void *ptr, uint64_t imm);
 
+/**
+ * struct qemu_plugin_scoreboard - opaque handle for a per-vCPU array
+ *
+ * A scoreboard holds one element of a fixed size for each vCPU. Inline
+ * ops can target a field of the current vCPU's element, so that counters
+ * are never shared between vCPUs and need no atomics. The storage grows
+ * automatically as vCPUs are created.
+ */
+struct qemu_plugin_scoreboard;
+
+/**
+ * typedef qemu_plugin_u64 - a uint64_t field within a scoreboard
+ * @score: the scoreboard
+ * @offset: offset of the uint64_t field within each element
+ */
+typedef struct {
+    struct qemu_plugin_scoreboard *score;
+    size_t offset;
+} qemu_plugin_u64;
+
+/**
+ * qemu_plugin_scoreboard_new() - allocate a new scoreboard
+ * @element_size: size (in bytes) of the element for each vCPU
+ *
+ * All elements are zero-initialised.
+ */
+struct qemu_plugin_scoreboard *qemu_plugin_scoreboard_new(size_t element_size);
+
+/**
+ * qemu_plugin_scoreboard_free() - free a scoreboard
+ * @score: scoreboard to free
+ *
+ * The scoreboard must not be referenced by any inline op that may still
+ * execute, i.e. only call this from the atexit callback or after a reset.
+ */
+void qemu_plugin_scoreboard_free(struct qemu_plugin_scoreboard *score);
+
+/**
+ * qemu_plugin_scoreboard_find() - get the element of a given vCPU
+ * @score: scoreboard to query
+ * @vcpu_index: index of the vCPU
+ *
+ * The returned pointer is only valid until the next vCPU is created.
+ */
+void *qemu_plugin_scoreboard_find(struct qemu_plugin_scoreboard *score,
+                                  unsigned int vcpu_index);
+
+/**
+ * qemu_plugin_u64_sum() - sum a field over all vCPUs
+ * @entry: the scoreboard field
+ */
+uint64_t qemu_plugin_u64_sum(qemu_plugin_u64 entry);
+
+/**
+ * qemu_plugin_register_vcpu_tb_exec_inline_per_vcpu() - per-vCPU inline op
+ * @tb: the opaque qemu_plugin_tb handle for the translation
+ * @op: the type of qemu_plugin_op (e.g. ADD_U64)
+ * @entry: the scoreboard field to update
+ * @imm: the op data (e.g. 1)
+ *
+ * Like qemu_plugin_register_vcpu_tb_exec_inline(), but the op targets
+ * the @entry field of the executing vCPU, so the result is exact even
+ * with multiple vCPUs running in parallel.
+ */
+void qemu_plugin_register_vcpu_tb_exec_inline_per_vcpu(
+    struct qemu_plugin_tb *tb, enum qemu_plugin_op op,
+    qemu_plugin_u64 entry, uint64_t imm);
+
 /**
  * qemu_plugin_register_vcpu_insn_exec_cb() - register insn execution cb
  * @insn: the opaque qemu_plugin_insn handle for an instruction
@@ -327,6 +395,20 @@ void qemu_plugin_register_vcpu_insn_exec_inline(struct qemu_plugin_insn *insn,
                                                 enum qemu_plugin_op op,
                                                 void *ptr, uint64_t imm);
 
+/**
+ * qemu_plugin_register_vcpu_insn_exec_inline_per_vcpu() - per-vCPU inline op
+ * @insn: the opaque qemu_plugin_insn handle for an instruction
+ * @op: the type of qemu_plugin_op (e.g. ADD_U64)
+ * @entry: the scoreboard field to update
+ * @imm: the op data (e.g. 1)
+ *
+ * Like qemu_plugin_register_vcpu_insn_exec_inline(), but the op targets
+ * the @entry field of the executing vCPU.
+ */
+void qemu_plugin_register_vcpu_insn_exec_inline_per_vcpu(
+    struct qemu_plugin_insn *insn, enum qemu_plugin_op op,
+    qemu_plugin_u64 entry, uint64_t imm);
+
 /**
  * qemu_plugin_tb_n_insns() - query helper for number of insns in TB
  * @tb: opaque handle to TB passed to callback
@@ -496,6 +578,11 @@ void qemu_plugin_register_vcpu_mem_inline(struct qemu_plugin_insn *insn,
                                           enum qemu_plugin_op op, void *ptr,
                                           uint64_t imm);
 
+/* As above, but targeting the @entry field of the executing vCPU. */
+void qemu_plugin_register_vcpu_mem_inline_per_vcpu(
+    struct qemu_plugin_insn *insn, enum qemu_plugin_mem_rw rw,
+    enum qemu_plugin_op op, qemu_plugin_u64 entry, uint64_t imm);
+
 
 
 typedef void
@@ -515,6 +602,32 @@ void
 qemu_plugin_register_vcpu_syscall_ret_cb(qemu_plugin_id_t id,
                                          qemu_plugin_vcpu_syscall_ret_cb_t cb);
 
+/**
+ * typedef qemu_plugin_vcpu_sample_cb_t - vCPU sampling callback
+ * @id: the unique qemu_plugin_id_t
+ * @vcpu_index: the sampled vCPU
+ * @pc: the guest virtual address of the next instruction to execute
+ */
+typedef void (*qemu_plugin_vcpu_sample_cb_t)(qemu_plugin_id_t id,
+                                             unsigned int vcpu_index,
+                                             uint64_t pc);
+
+/**
+ * qemu_plugin_register_vcpu_sample_cb() - register a periodic PC sampler
+ * @id: plugin ID
+ * @period_ns: sampling period in nanoseconds of host time
+ * @cb: callback function
+ *
+ * Every @period_ns, each running vCPU is interrupted at the next
+ * translation block boundary and @cb is called from that vCPU's thread.
+ * No instrumentation is added to translated code, so the overhead only
+ * depends on the sampling rate. If several plugins register a sampler,
+ * the shortest period is used for all of them.
+ */
+void qemu_plugin_register_vcpu_sample_cb(qemu_plugin_id_t id,
+                                         uint64_t period_ns,
+                                         qemu_plugin_vcpu_sample_cb_t cb);
+
 
 /**
  * qemu_plugin_insn_disas() - return disassembly string for instruction
@@ -112,6 +112,14 @@ static inline void rcu_read_unlock(void)
 
 extern void synchronize_rcu(void);
 
+/*
+ * Polled grace periods: the cookie returned by get_state_synchronize_rcu()
+ * tells whether a full grace period has elapsed since it was taken.
+ */
+extern unsigned long get_state_synchronize_rcu(void);
+extern bool poll_state_synchronize_rcu(unsigned long cookie);
+extern void cond_synchronize_rcu(unsigned long cookie);
+
 /*
  * Reader thread registration.
  */
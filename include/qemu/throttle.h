@@ -152,6 +152,9 @@ bool throttle_schedule_timer(ThrottleState *ts,
                              bool is_write);
 
 void throttle_account(ThrottleState *ts, bool is_write, uint64_t size);
+
+bool throttle_reserve_budget(ThrottleState *ts, bool is_write, int64_t now,
+                             int64_t slice_ns, double *bytes, double *units);
 void throttle_limits_to_config(ThrottleLimits *arg, ThrottleConfig *cfg,
                                Error **errp);
 void throttle_config_to_limits(ThrottleConfig *cfg, ThrottleLimits *var);
@@ -65,4 +65,41 @@ bool cpu_throttle_active(void);
  */
 int cpu_throttle_get_percentage(void);
 
+/**
+ * cpu_throttle_dirty_limit_set:
+ * @bytes_per_sec: Dirty rate that each vcpu should not exceed.
+ *
+ * Throttles only the vcpus that dirty memory faster than @bytes_per_sec,
+ * by making them sleep whenever they fill their KVM dirty ring.  The
+ * sleep time of each vcpu is adjusted every second from its measured
+ * dirty rate.  Requires the KVM dirty ring.
+ *
+ * cpu_throttle_dirty_limit_set can be called again to change the limit.
+ * The limit stays in effect until cpu_throttle_dirty_limit_stop is called.
+ */
+void cpu_throttle_dirty_limit_set(uint64_t bytes_per_sec);
+
+/**
+ * cpu_throttle_dirty_limit_stop:
+ *
+ * Stops the per-vcpu throttling started by cpu_throttle_dirty_limit_set.
+ */
+void cpu_throttle_dirty_limit_stop(void);
+
+/**
+ * cpu_throttle_dirty_limit_active:
+ *
+ * Returns: %true if a per-vcpu dirty limit is in effect, %false otherwise.
+ */
+bool cpu_throttle_dirty_limit_active(void);
+
+/**
+ * cpu_throttle_dirty_limit_sleep:
+ * @cpu: The vcpu that just filled its dirty ring.
+ *
+ * Sleep for the time chosen for @cpu by the dirty limit.  Must be called
+ * from the thread of @cpu, without the BQL.
+ */
+void cpu_throttle_dirty_limit_sleep(CPUState *cpu);
+
 #endif /* SYSEMU_CPU_THROTTLE_H */
@@ -213,6 +213,8 @@ typedef struct Notifier Notifier;
 
 bool kvm_has_free_slot(MachineState *ms);
 bool kvm_has_sync_mmu(void);
+/* Number of entries of the per-vcpu dirty rings, 0 if they are not used */
+uint32_t kvm_dirty_ring_size(void);
 int kvm_has_vcpu_events(void);
 int kvm_has_robust_singlestep(void);
 int kvm_has_debugregs(void);
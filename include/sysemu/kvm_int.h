@@ -24,6 +24,11 @@ typedef struct KVMSlot
     /* Dirty bitmap cache for the slot */
     unsigned long *dirty_bmap;
     unsigned long dirty_bmap_size;
+    /*
+     * With the dirty ring, one bit per KVM_DIRTY_SUMMARY_PAGES pages of
+     * the slot, set if any of them may be set in dirty_bmap
+     */
+    unsigned long *dirty_summary;
     /* Cache of the address space ID */
     int as_id;
     /* Cache of the offset in ram address space */
@@ -33,6 +38,13 @@ typedef struct KVMSlot
 typedef struct KVMMemoryListener {
     MemoryListener listener;
     KVMSlot *slots;
+    /*
+     * Number of slots in use, and the used slots indexed by start_addr;
+     * both protected by the slots lock.  Slots are allocated from the
+     * lowest free index, so walks over slots can stop early.
+     */
+    int nr_slots_used;
+    GHashTable *slots_by_addr;
     int as_id;
 } KVMMemoryListener;
 
@@ -807,6 +807,8 @@ void tcg_pool_reset(TCGContext *s);
 TranslationBlock *tcg_tb_alloc(TCGContext *s);
 
 void tcg_region_reset_all(void);
+bool tcg_region_evict(void (*invalidate)(TranslationBlock *tb),
+                      size_t *n_tbs);
 
 size_t tcg_code_size(void);
 size_t tcg_code_capacity(void);
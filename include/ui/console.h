@@ -28,6 +28,11 @@
 /* in ms */
 #define GUI_REFRESH_INTERVAL_DEFAULT    30
 #define GUI_REFRESH_INTERVAL_IDLE     3000
+/*
+ * The listener needs no refresh until it calls update_displaychangelistener()
+ * again.  If no listener does, the refresh timer is stopped.
+ */
+#define GUI_REFRESH_INTERVAL_NONE     UINT64_MAX
 
 /* Color number is match to standard vga palette */
 enum qemu_color_names {
@@ -382,6 +382,11 @@ static int query_one_iothread(Object *object, void *opaque)
     info->poll_grow = iothread->poll_grow;
     info->poll_shrink = iothread->poll_shrink;
     info->aio_max_batch = iothread->aio_max_batch;
+    if (iothread->ctx) {
+        info->poll_ns = iothread->ctx->poll_ns;
+        info->poll_hits = stat64_get(&iothread->ctx->poll_hits);
+        info->poll_misses = stat64_get(&iothread->ctx->poll_misses);
+    }
 
     QAPI_LIST_APPEND(*tail, info);
     return 0;
@@ -64,6 +64,7 @@ static envlist_t *envlist;
 static const char *cpu_model;
 static const char *cpu_type;
 static const char *seed_optarg;
+static const char *pretranslate_dir;
 unsigned long mmap_min_addr;
 uintptr_t guest_base;
 bool have_guest_base;
@@ -382,6 +383,11 @@ static void handle_arg_strace(const char *arg)
     enable_strace = true;
 }
 
+static void handle_arg_pretranslate(const char *arg)
+{
+    pretranslate_dir = g_strdup(arg);
+}
+
 static void handle_arg_version(const char *arg)
 {
     printf("qemu-" TARGET_NAME " version " QEMU_FULL_VERSION
@@ -465,6 +471,8 @@ static const struct qemu_argument arg_table[] = {
     {"plugin",     "QEMU_PLUGIN",      true,  handle_arg_plugin,
      "",           "[file=]<file>[,arg=<string>]"},
 #endif
+    {"pretranslate", "QEMU_PRETRANSLATE", true, handle_arg_pretranslate,
+     "dir",        "profile translated code in 'dir' and translate it early next run"},
     {"version",    "QEMU_VERSION",     false, handle_arg_version,
      "",           "display version information and exit"},
 #if defined(TARGET_XTENSA)
@@ -874,6 +882,15 @@ int main(int argc, char **argv, char **envp)
 
     target_cpu_copy_regs(env, regs);
 
+    /*
+     * Translating on another thread would bypass the breakpoints set
+     * through the gdbstub, and call plugin translation hooks off the
+     * vCPU thread.
+     */
+    if (pretranslate_dir && !gdbstub && QTAILQ_EMPTY(&plugins)) {
+        pretranslate_start(cpu, pretranslate_dir, exec_path);
+    }
+
     if (gdbstub) {
         if (gdbserver_start(gdbstub) < 0) {
             fprintf(stderr, "qemu: could not open gdbserver on %s\n",
@@ -0,0 +1,192 @@
+/*
+ *  Translate guest code ahead of execution
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Short-lived programs, such as a cross compiler started through
+ * binfmt_misc once per source file, spend most of their run time
+ * translating the same startup code over and over.  When a profile
+ * directory is given, the start address and state of every block
+ * translated during a run are saved there at exit, and the next run of
+ * the same binary translates them again on a helper thread while the
+ * guest starts executing.
+ *
+ * Only addresses are saved, never host code: each block is translated
+ * afresh from the guest memory and CPU model of the current run, so a
+ * stale profile can only waste time, not change behaviour.  A block
+ * whose state does not match what the guest actually uses is simply
+ * never looked up.
+ */
+
+#include "qemu/osdep.h"
+#include "qemu.h"
+#include "qemu/atomic.h"
+#include "qemu/rcu.h"
+#include "qemu/thread.h"
+#include "exec/exec-all.h"
+#include "tcg/tcg.h"
+
+#define PRETRANSLATE_MAGIC    0x51544250   /* "QTBP" */
+#define PRETRANSLATE_VERSION  1
+#define PRETRANSLATE_MAX_TBS  65536
+
+typedef struct PretranslateHeader {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t n_entries;
+    uint32_t reserved;
+} PretranslateHeader;
+
+typedef struct PretranslateEntry {
+    uint64_t pc;
+    uint64_t cs_base;
+    uint32_t flags;
+    uint32_t cflags;
+} PretranslateEntry;
+
+typedef struct PretranslateState {
+    CPUState *cpu;
+    PretranslateEntry *entries;
+    uint32_t n_entries;
+} PretranslateState;
+
+static char *pretranslate_path;
+static bool pretranslate_stop;
+
+static void *pretranslate_thread(void *opaque)
+{
+    PretranslateState *s = opaque;
+    uint32_t i;
+
+    rcu_register_thread();
+    tcg_register_thread();
+
+    for (i = 0; i < s->n_entries && !qatomic_read(&pretranslate_stop); i++) {
+        PretranslateEntry *e = &s->entries[i];
+        bool more;
+
+        WITH_RCU_READ_LOCK_GUARD() {
+            more = tb_pretranslate(s->cpu, e->pc, e->cs_base,
+                                   e->flags, e->cflags);
+        }
+        if (!more) {
+            break;
+        }
+    }
+
+    object_unref(OBJECT(s->cpu));
+    g_free(s->entries);
+    g_free(s);
+    rcu_unregister_thread();
+    return NULL;
+}
+
+/*
+ * Use @dir to keep the profile of @exec_path, and start translating the
+ * blocks recorded by a previous run, if any.  Must be called once the
+ * prologue has been generated and @cpu holds the guest's start state.
+ */
+void pretranslate_start(CPUState *cpu, const char *dir, const char *exec_path)
+{
+    g_autofree char *name = g_strdup_printf("%s-%s.tbprof",
+                                            TARGET_NAME, exec_path);
+    g_autofree char *buf = NULL;
+    const PretranslateHeader *hdr;
+    PretranslateState *s;
+    QemuThread thread;
+    gsize len;
+
+    g_strdelimit(name, "/", '!');
+    pretranslate_path = g_build_filename(dir, name, NULL);
+
+    if (!g_file_get_contents(pretranslate_path, &buf, &len, NULL) ||
+        len < sizeof(*hdr)) {
+        return;
+    }
+    hdr = (const PretranslateHeader *)buf;
+    if (hdr->magic != PRETRANSLATE_MAGIC ||
+        hdr->version != PRETRANSLATE_VERSION ||
+        hdr->n_entries == 0 || hdr->n_entries > PRETRANSLATE_MAX_TBS ||
+        len != sizeof(*hdr) + hdr->n_entries * sizeof(PretranslateEntry)) {
+        return;
+    }
+
+    s = g_new(PretranslateState, 1);
+    s->cpu = cpu;
+    s->n_entries = hdr->n_entries;
+    s->entries = g_memdup(buf + sizeof(*hdr),
+                          s->n_entries * sizeof(PretranslateEntry));
+    object_ref(OBJECT(cpu));
+    qemu_thread_create(&thread, "pretranslate", pretranslate_thread, s,
+                       QEMU_THREAD_DETACHED);
+}
+
+static gboolean pretranslate_save_iter(gpointer key, gpointer value,
+                                       gpointer data)
+{
+    const TranslationBlock *tb = value;
+    GArray *entries = data;
+    PretranslateEntry e;
+
+    if (tb_cflags(tb) & CF_INVALID) {
+        return false;
+    }
+    e.pc = tb->pc;
+    e.cs_base = tb->cs_base;
+    e.flags = tb->flags;
+    e.cflags = tb_cflags(tb);
+    g_array_append_val(entries, e);
+    return entries->len >= PRETRANSLATE_MAX_TBS;
+}
+
+/*
+ * Save the blocks currently in the code buffer.  They are walked in
+ * code buffer order, which is roughly the order they were generated,
+ * so the next run translates its earliest code first.  The file is
+ * replaced atomically, since several processes running the same binary
+ * may exit at the same time.
+ */
+void pretranslate_save(void)
+{
+    PretranslateHeader hdr = {
+        .magic = PRETRANSLATE_MAGIC,
+        .version = PRETRANSLATE_VERSION,
+    };
+    g_autoptr(GArray) entries = NULL;
+    g_autoptr(GByteArray) buf = NULL;
+
+    if (!pretranslate_path) {
+        return;
+    }
+    qatomic_set(&pretranslate_stop, true);
+
+    entries = g_array_new(false, false, sizeof(PretranslateEntry));
+    mmap_lock();
+    tcg_tb_foreach(pretranslate_save_iter, entries);
+    mmap_unlock();
+    if (entries->len == 0) {
+        return;
+    }
+
+    hdr.n_entries = entries->len;
+    buf = g_byte_array_sized_new(sizeof(hdr) +
+                                 entries->len * sizeof(PretranslateEntry));
+    g_byte_array_append(buf, (const guint8 *)&hdr, sizeof(hdr));
+    g_byte_array_append(buf, (const guint8 *)entries->data,
+                        entries->len * sizeof(PretranslateEntry));
+    g_file_set_contents(pretranslate_path, (const gchar *)buf->data,
+                        buf->len, NULL);
+}
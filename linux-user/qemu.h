@@ -403,6 +403,10 @@ extern long safe_syscall_base(int *pending, long number, ...);
 /* syscall.c */
 int host_to_target_waitstatus(int status);
 
+/* pretranslate.c */
+void pretranslate_start(CPUState *cpu, const char *dir, const char *exec_path);
+void pretranslate_save(void);
+
 /* strace.c */
 void print_syscall(void *cpu_env, int num,
                    abi_long arg1, abi_long arg2, abi_long arg3,
@@ -0,0 +1,184 @@
+/*
+ * QEMU live migration to and from a file
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ */
+
+#include "qemu/osdep.h"
+#include "qapi/error.h"
+#include "channel.h"
+#include "file.h"
+#include "migration.h"
+#include "io/channel-file.h"
+#include "trace.h"
+
+/*
+ * The file is opened again by each multifd channel, and by the restore
+ * of a mapped-ram file with O_DIRECT.
+ */
+static char *outgoing_filename;
+static char *incoming_filename;
+
+static int file_open_flags(int flags, Error **errp)
+{
+    if (migrate_direct_io()) {
+#ifdef O_DIRECT
+        flags |= O_DIRECT;
+#else
+        error_setg(errp, "O_DIRECT is not supported on this host");
+        return -1;
+#endif
+    }
+    return flags;
+}
+
+/*
+ * The multifd channels of a mapped-ram migration write the pages straight
+ * to their offset in the file.
+ */
+void file_send_channel_create(QIOTaskFunc f, void *data)
+{
+    QIOChannelFile *ioc = NULL;
+    Error *err = NULL;
+    QIOTask *task;
+    int flags;
+
+    if (!outgoing_filename || !migrate_mapped_ram()) {
+        error_setg(&err, "Multifd to a file requires a file: URI and the "
+                   "mapped-ram capability");
+    } else {
+        flags = file_open_flags(O_WRONLY, &err);
+        if (flags >= 0) {
+            ioc = qio_channel_file_new_path(outgoing_filename, flags, 0,
+                                            &err);
+        }
+    }
+
+    task = qio_task_new(OBJECT(ioc), f, data, NULL);
+    if (err) {
+        qio_task_set_error(task, err);
+    }
+    qio_task_complete(task);
+}
+
+/*
+ * Open the incoming file again for reading the pages of a mapped-ram
+ * migration, with O_DIRECT if requested.
+ */
+QIOChannel *file_recv_channel_create(Error **errp)
+{
+    QIOChannelFile *ioc;
+    int flags;
+
+    if (!incoming_filename) {
+        error_setg(errp, "Reading the pages again requires a file: URI");
+        return NULL;
+    }
+    flags = file_open_flags(O_RDONLY, errp);
+    if (flags < 0) {
+        return NULL;
+    }
+    ioc = qio_channel_file_new_path(incoming_filename, flags, 0, errp);
+    return ioc ? QIO_CHANNEL(ioc) : NULL;
+}
+
+int file_pwrite_all(QIOChannel *ioc, const void *buf, size_t len,
+                    off_t offset, Error **errp)
+{
+    int fd = QIO_CHANNEL_FILE(ioc)->fd;
+
+    while (len) {
+        ssize_t ret = pwrite(fd, buf, len, offset);
+
+        if (ret < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            error_setg_errno(errp, errno, "Unable to write to file at "
+                             "offset %" PRId64, (int64_t)offset);
+            return -1;
+        }
+        buf += ret;
+        len -= ret;
+        offset += ret;
+    }
+    return 0;
+}
+
+int file_pread_all(QIOChannel *ioc, void *buf, size_t len,
+                   off_t offset, Error **errp)
+{
+    int fd = QIO_CHANNEL_FILE(ioc)->fd;
+
+    while (len) {
+        ssize_t ret = pread(fd, buf, len, offset);
+
+        if (ret < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            error_setg_errno(errp, errno, "Unable to read from file at "
+                             "offset %" PRId64, (int64_t)offset);
+            return -1;
+        }
+        if (ret == 0) {
+            error_setg(errp, "Unexpected end of file at offset %" PRId64,
+                       (int64_t)offset);
+            return -1;
+        }
+        buf += ret;
+        len -= ret;
+        offset += ret;
+    }
+    return 0;
+}
+
+void file_start_outgoing_migration(MigrationState *s, const char *filename,
+                                   Error **errp)
+{
+    QIOChannelFile *ioc;
+
+    trace_migration_file_outgoing(filename);
+    ioc = qio_channel_file_new_path(filename, O_CREAT | O_WRONLY | O_TRUNC,
+                                    0600, errp);
+    if (!ioc) {
+        return;
+    }
+
+    g_free(outgoing_filename);
+    outgoing_filename = g_strdup(filename);
+
+    qio_channel_set_name(QIO_CHANNEL(ioc), "migration-file-outgoing");
+    migration_channel_connect(s, QIO_CHANNEL(ioc), NULL, NULL);
+    object_unref(OBJECT(ioc));
+}
+
+static gboolean file_accept_incoming_migration(QIOChannel *ioc,
+                                               GIOCondition condition,
+                                               gpointer opaque)
+{
+    migration_channel_process_incoming(ioc);
+    object_unref(OBJECT(ioc));
+    return G_SOURCE_REMOVE;
+}
+
+void file_start_incoming_migration(const char *filename, Error **errp)
+{
+    QIOChannelFile *ioc;
+
+    trace_migration_file_incoming(filename);
+    ioc = qio_channel_file_new_path(filename, O_RDONLY, 0, errp);
+    if (!ioc) {
+        return;
+    }
+
+    g_free(incoming_filename);
+    incoming_filename = g_strdup(filename);
+
+    qio_channel_set_name(QIO_CHANNEL(ioc), "migration-file-incoming");
+    qio_channel_add_watch_full(QIO_CHANNEL(ioc), G_IO_IN,
+                               file_accept_incoming_migration,
+                               NULL, NULL,
+                               g_main_context_get_thread_default());
+}
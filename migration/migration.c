@@ -15,15 +15,18 @@
 
 #include "qemu/osdep.h"
 #include "qemu/cutils.h"
+#include "qemu/units.h"
 #include "qemu/error-report.h"
 #include "qemu/main-loop.h"
 #include "migration/blocker.h"
 #include "exec.h"
 #include "fd.h"
+#include "file.h"
 #include "socket.h"
 #include "sysemu/runstate.h"
 #include "sysemu/sysemu.h"
 #include "sysemu/cpu-throttle.h"
+#include "sysemu/kvm.h"
 #include "rdma.h"
 #include "ram.h"
 #include "migration/global_state.h"
@@ -88,6 +91,12 @@
 #define DEFAULT_MIGRATE_CPU_THROTTLE_INITIAL 20
 #define DEFAULT_MIGRATE_CPU_THROTTLE_INCREMENT 10
 #define DEFAULT_MIGRATE_MAX_CPU_THROTTLE 99
+/* Threads helping to sync the dirty bitmap of large guests */
+#define DEFAULT_MIGRATE_BITMAP_SYNC_THREADS 4
+/* Threads resolving background snapshot write faults */
+#define DEFAULT_MIGRATE_SNAPSHOT_FAULT_THREADS 2
+/* Define default dirty limit migration parameters */
+#define DEFAULT_MIGRATE_VCPU_DIRTY_LIMIT 1
 
 /* Migration XBZRLE default cache size */
 #define DEFAULT_MIGRATE_XBZRLE_CACHE_SIZE (64 * 1024 * 1024)
@@ -278,7 +287,13 @@ void migration_incoming_state_destroy(void)
         qemu_fclose(mis->from_src_file);
         mis->from_src_file = NULL;
     }
-    if (mis->postcopy_remote_fds) {
+    if (mis->postcopy_qemufile_dst) {
+        qemu_fclose(mis->postcopy_qemufile_dst);
+        mis->postcopy_qemufile_dst = NULL;
+    }
+    memset(mis->last_recv_block, 0, sizeof(mis->last_recv_block));
+    /* A lazy restore still resolves faults, it frees these once done */
+    if (mis->postcopy_remote_fds && !mis->lazy_restore) {
         g_array_free(mis->postcopy_remote_fds, TRUE);
         mis->postcopy_remote_fds = NULL;
     }
@@ -288,7 +303,7 @@ void migration_incoming_state_destroy(void)
 
     qemu_event_reset(&mis->main_thread_load_event);
 
-    if (mis->page_requested) {
+    if (mis->page_requested && !mis->lazy_restore) {
         g_tree_destroy(mis->page_requested);
         mis->page_requested = NULL;
     }
@@ -471,6 +486,8 @@ static void qemu_start_incoming_migration(const char *uri, Error **errp)
         exec_start_incoming_migration(p, errp);
     } else if (strstart(uri, "fd:", &p)) {
         fd_start_incoming_migration(p, errp);
+    } else if (strstart(uri, "file:", &p)) {
+        file_start_incoming_migration(p, errp);
     } else {
         error_setg(errp, "unknown migration protocol: %s", uri);
     }
@@ -717,9 +734,14 @@ void migration_ioc_process_incoming(QIOChannel *ioc, Error **errp)
 
         /*
          * Common migration only needs one channel, so we can start
-         * right now.  Multifd needs more than one channel, we wait.
+         * right now.  Multifd needs more than one channel, we wait,
+         * except for mapped-ram where the pages are read from the file.
          */
-        start_migration = !migrate_use_multifd();
+        start_migration = !migrate_use_multifd() || migrate_mapped_ram();
+    } else if (migrate_postcopy_preempt()) {
+        /* The postcopy preemption channel, which comes after the main one */
+        postcopy_preempt_new_channel(mis, qemu_fopen_channel_input(ioc));
+        return;
     } else {
         /* Multiple connections */
         assert(migrate_use_multifd());
@@ -747,6 +769,9 @@ bool migration_has_all_channels(void)
     bool all_channels;
 
     all_channels = multifd_recv_all_channels_created();
+    if (migrate_postcopy_preempt()) {
+        all_channels = all_channels && mis->postcopy_qemufile_dst != NULL;
+    }
 
     return all_channels && mis->from_src_file != NULL;
 }
@@ -893,6 +918,12 @@ MigrationParameters *qmp_query_migrate_parameters(Error **errp)
     params->multifd_zlib_level = s->parameters.multifd_zlib_level;
     params->has_multifd_zstd_level = true;
     params->multifd_zstd_level = s->parameters.multifd_zstd_level;
+    params->has_multifd_packet_size = true;
+    params->multifd_packet_size = s->parameters.multifd_packet_size;
+    params->has_vcpu_dirty_limit = true;
+    params->vcpu_dirty_limit = s->parameters.vcpu_dirty_limit;
+    params->has_direct_io = true;
+    params->direct_io = s->parameters.direct_io;
     params->has_xbzrle_cache_size = true;
     params->xbzrle_cache_size = s->parameters.xbzrle_cache_size;
     params->has_max_postcopy_bandwidth = true;
@@ -1014,7 +1045,7 @@ static void populate_ram_info(MigrationInfo *info, MigrationState *s)
     info->ram->multifd_bytes = ram_counters.multifd_bytes;
     info->ram->pages_per_second = s->pages_per_second;
 
-    if (migrate_use_xbzrle()) {
+    if (migrate_use_xbzrle() || migrate_use_multifd_xbzrle()) {
         info->has_xbzrle_cache = true;
         info->xbzrle_cache = g_malloc0(sizeof(*info->xbzrle_cache));
         info->xbzrle_cache->cache_size = migrate_xbzrle_cache_size();
@@ -1060,6 +1091,12 @@ static void populate_disk_info(MigrationInfo *info)
     }
 }
 
+static void populate_device_costs(MigrationInfo *info)
+{
+    info->device_costs = qemu_savevm_state_costs();
+    info->has_device_costs = info->device_costs != NULL;
+}
+
 static void fill_source_migration_info(MigrationInfo *info)
 {
     MigrationState *s = migrate_get_current();
@@ -1103,15 +1140,18 @@ static void fill_source_migration_info(MigrationInfo *info)
         populate_ram_info(info, s);
         populate_disk_info(info);
         populate_vfio_info(info);
+        populate_device_costs(info);
         break;
     case MIGRATION_STATUS_COLO:
         info->has_status = true;
         /* TODO: display COLO specific information (checkpoint info etc.) */
+        populate_device_costs(info);
         break;
     case MIGRATION_STATUS_COMPLETED:
         populate_time_info(info, s);
         populate_ram_info(info, s);
         populate_vfio_info(info);
+        populate_device_costs(info);
         break;
     case MIGRATION_STATUS_FAILED:
         info->has_status = true;
@@ -1249,6 +1289,94 @@ static bool migrate_caps_check(bool *cap_list,
         }
     }
 
+    if (cap_list[MIGRATION_CAPABILITY_DIRTY_LIMIT]) {
+        if (!kvm_enabled() || !kvm_dirty_ring_size()) {
+            error_setg(errp, "Dirty limit requires KVM with dirty ring");
+            return false;
+        }
+        if (cap_list[MIGRATION_CAPABILITY_AUTO_CONVERGE]) {
+            error_setg(errp, "Dirty limit is not compatible with "
+                       "auto-converge");
+            return false;
+        }
+    }
+
+    if (cap_list[MIGRATION_CAPABILITY_POSTCOPY_PREEMPT]) {
+        if (!cap_list[MIGRATION_CAPABILITY_POSTCOPY_RAM]) {
+            error_setg(errp, "Postcopy preemption requires postcopy-ram");
+            return false;
+        }
+        /*
+         * Both would have the preemption channel interleave pages with
+         * the ones in flight on the main stream.
+         */
+        if (cap_list[MIGRATION_CAPABILITY_MULTIFD] ||
+            cap_list[MIGRATION_CAPABILITY_COMPRESS]) {
+            error_setg(errp, "Postcopy preemption is not compatible with "
+                       "multifd or compress");
+            return false;
+        }
+    }
+
+    if (cap_list[MIGRATION_CAPABILITY_MULTIFD_POSTCOPY]) {
+        if (!cap_list[MIGRATION_CAPABILITY_MULTIFD] ||
+            !cap_list[MIGRATION_CAPABILITY_POSTCOPY_RAM]) {
+            error_setg(errp, "Multifd postcopy requires multifd and "
+                       "postcopy-ram");
+            return false;
+        }
+    }
+
+    if (cap_list[MIGRATION_CAPABILITY_MAPPED_RAM]) {
+        /* All of them need pages to be sent in the stream */
+        if (cap_list[MIGRATION_CAPABILITY_POSTCOPY_RAM] ||
+            cap_list[MIGRATION_CAPABILITY_XBZRLE] ||
+            cap_list[MIGRATION_CAPABILITY_COMPRESS] ||
+            cap_list[MIGRATION_CAPABILITY_X_COLO]) {
+            error_setg(errp, "Mapped RAM is not compatible with "
+                       "postcopy-ram, xbzrle, compress or x-colo");
+            return false;
+        }
+    }
+
+    if (cap_list[MIGRATION_CAPABILITY_LAZY_RESTORE]) {
+        if (!cap_list[MIGRATION_CAPABILITY_MAPPED_RAM]) {
+            error_setg(errp, "Lazy restore requires mapped-ram");
+            return false;
+        }
+        /* The fault thread is shared with postcopy, and reads the file */
+        if (cap_list[MIGRATION_CAPABILITY_POSTCOPY_RAM] ||
+            cap_list[MIGRATION_CAPABILITY_MULTIFD] ||
+            cap_list[MIGRATION_CAPABILITY_X_IGNORE_SHARED]) {
+            error_setg(errp, "Lazy restore is not compatible with "
+                       "postcopy-ram, multifd or x-ignore-shared");
+            return false;
+        }
+        if (runstate_check(RUN_STATE_INMIGRATE) &&
+            !postcopy_ram_supported_by_host(mis)) {
+            error_setg(errp, "Lazy restore is not supported");
+            return false;
+        }
+    }
+
+    if (cap_list[MIGRATION_CAPABILITY_ZERO_COPY_SEND]) {
+        MigrationState *s = migrate_get_current();
+
+#ifndef CONFIG_LINUX
+        error_setg(errp, "Zero copy send is not supported on this host");
+        return false;
+#endif
+        if (!cap_list[MIGRATION_CAPABILITY_MULTIFD] ||
+            cap_list[MIGRATION_CAPABILITY_COMPRESS] ||
+            s->parameters.multifd_compression != MULTIFD_COMPRESSION_NONE ||
+            (s->parameters.tls_creds && *s->parameters.tls_creds)) {
+            error_setg(errp,
+                       "Zero copy send is only available for non-compressed "
+                       "non-TLS multifd migration");
+            return false;
+        }
+    }
+
     return true;
 }
 
@@ -1410,6 +1538,23 @@ static bool migrate_params_check(MigrationParameters *params, Error **errp)
         return false;
     }
 
+    if (params->has_multifd_packet_size &&
+        (params->multifd_packet_size < qemu_target_page_size() ||
+         params->multifd_packet_size > MULTIFD_PACKET_SIZE_MAX ||
+         params->multifd_packet_size % qemu_target_page_size())) {
+        error_setg(errp, QERR_INVALID_PARAMETER_VALUE, "multifd_packet_size",
+                   "a multiple of the target page size no larger than 16 MiB");
+        return false;
+    }
+
+    if (params->has_vcpu_dirty_limit &&
+        (params->vcpu_dirty_limit < 1 ||
+         params->vcpu_dirty_limit > UINT64_MAX / MiB)) {
+        error_setg(errp, QERR_INVALID_PARAMETER_VALUE, "vcpu_dirty_limit",
+                   "a positive dirty rate in MB/s");
+        return false;
+    }
+
     if (params->has_xbzrle_cache_size &&
         (params->xbzrle_cache_size < qemu_target_page_size() ||
          !is_power_of_2(params->xbzrle_cache_size))) {
@@ -1464,6 +1609,17 @@ static bool migrate_params_check(MigrationParameters *params, Error **errp)
         return false;
     }
 
+    if (migrate_use_zero_copy_send() &&
+        ((params->has_multifd_compression &&
+          params->multifd_compression != MULTIFD_COMPRESSION_NONE) ||
+         (params->has_tls_creds && params->tls_creds &&
+          *params->tls_creds))) {
+        error_setg(errp,
+                   "Zero copy send is only available for non-compressed "
+                   "non-TLS multifd migration");
+        return false;
+    }
+
     return true;
 }
 
@@ -1537,6 +1693,15 @@ static void migrate_params_test_apply(MigrateSetParameters *params,
     if (params->has_multifd_compression) {
         dest->multifd_compression = params->multifd_compression;
     }
+    if (params->has_multifd_packet_size) {
+        dest->multifd_packet_size = params->multifd_packet_size;
+    }
+    if (params->has_vcpu_dirty_limit) {
+        dest->vcpu_dirty_limit = params->vcpu_dirty_limit;
+    }
+    if (params->has_direct_io) {
+        dest->direct_io = params->direct_io;
+    }
     if (params->has_xbzrle_cache_size) {
         dest->xbzrle_cache_size = params->xbzrle_cache_size;
     }
@@ -1649,6 +1814,18 @@ static void migrate_params_apply(MigrateSetParameters *params, Error **errp)
     if (params->has_multifd_compression) {
         s->parameters.multifd_compression = params->multifd_compression;
     }
+    if (params->has_multifd_packet_size) {
+        s->parameters.multifd_packet_size = params->multifd_packet_size;
+    }
+    if (params->has_vcpu_dirty_limit) {
+        s->parameters.vcpu_dirty_limit = params->vcpu_dirty_limit;
+        if (cpu_throttle_dirty_limit_active()) {
+            cpu_throttle_dirty_limit_set(params->vcpu_dirty_limit * MiB);
+        }
+    }
+    if (params->has_direct_io) {
+        s->parameters.direct_io = params->direct_io;
+    }
     if (params->has_xbzrle_cache_size) {
         s->parameters.xbzrle_cache_size = params->xbzrle_cache_size;
         xbzrle_cache_resize(params->xbzrle_cache_size, errp);
@@ -1794,7 +1971,7 @@ static void migrate_fd_cleanup(MigrationState *s)
     qemu_savevm_state_cleanup();
 
     if (s->to_dst_file) {
-        QEMUFile *tmp;
+        QEMUFile *tmp, *preempt_file;
 
         trace_migrate_fd_cleanup();
         qemu_mutex_unlock_iothread();
@@ -1808,7 +1985,12 @@ static void migrate_fd_cleanup(MigrationState *s)
         qemu_mutex_lock(&s->qemu_file_lock);
         tmp = s->to_dst_file;
         s->to_dst_file = NULL;
+        preempt_file = s->postcopy_qemufile_src;
+        s->postcopy_qemufile_src = NULL;
         qemu_mutex_unlock(&s->qemu_file_lock);
+        if (preempt_file) {
+            qemu_fclose(preempt_file);
+        }
         /*
          * Close the file handle without the lock to make sure the
          * critical section won't block for long.
@@ -1910,6 +2092,11 @@ static void migrate_fd_cancel(MigrationState *s)
      */
     if (s->state == MIGRATION_STATUS_CANCELLING && f) {
         qemu_file_shutdown(f);
+        WITH_QEMU_LOCK_GUARD(&s->qemu_file_lock) {
+            if (s->postcopy_qemufile_src) {
+                qemu_file_shutdown(s->postcopy_qemufile_src);
+            }
+        }
     }
     if (s->state == MIGRATION_STATUS_CANCELLING && s->block_inactive) {
         Error *local_err = NULL;
@@ -2051,6 +2238,7 @@ void migrate_init(MigrationState *s)
     s->vm_was_running = false;
     s->iteration_initial_bytes = 0;
     s->threshold_size = 0;
+    s->pending_size_prev = 0;
 }
 
 int migrate_add_blocker(Error *reason, Error **errp)
@@ -2306,6 +2494,8 @@ void qmp_migrate(const char *uri, bool has_blk, bool blk,
         exec_start_outgoing_migration(s, p, &local_err);
     } else if (strstart(uri, "fd:", &p)) {
         fd_start_outgoing_migration(s, p, &local_err);
+    } else if (strstart(uri, "file:", &p)) {
+        file_start_outgoing_migration(s, p, &local_err);
     } else {
         if (!(has_resume && resume)) {
             yank_unregister_instance(MIGRATION_YANK_INSTANCE);
@@ -2484,6 +2674,92 @@ bool migrate_use_multifd(void)
     return s->enabled_capabilities[MIGRATION_CAPABILITY_MULTIFD];
 }
 
+bool migrate_use_multifd_zero_page(void)
+{
+    MigrationState *s;
+
+    s = migrate_get_current();
+
+    /* Zero pages are left out of a mapped-ram file by the channels */
+    return s->enabled_capabilities[MIGRATION_CAPABILITY_MULTIFD] &&
+           (s->enabled_capabilities[MIGRATION_CAPABILITY_MULTIFD_ZERO_PAGE] ||
+            s->enabled_capabilities[MIGRATION_CAPABILITY_MAPPED_RAM]);
+}
+
+bool migrate_use_multifd_xbzrle(void)
+{
+    MigrationState *s;
+
+    s = migrate_get_current();
+
+    return s->enabled_capabilities[MIGRATION_CAPABILITY_MULTIFD] &&
+           s->parameters.multifd_compression == MULTIFD_COMPRESSION_XBZRLE;
+}
+
+bool migrate_dirty_limit(void)
+{
+    MigrationState *s;
+
+    s = migrate_get_current();
+
+    return s->enabled_capabilities[MIGRATION_CAPABILITY_DIRTY_LIMIT];
+}
+
+bool migrate_postcopy_preempt(void)
+{
+    MigrationState *s;
+
+    s = migrate_get_current();
+
+    return s->enabled_capabilities[MIGRATION_CAPABILITY_POSTCOPY_PREEMPT];
+}
+
+bool migrate_mapped_ram(void)
+{
+    MigrationState *s;
+
+    s = migrate_get_current();
+
+    return s->enabled_capabilities[MIGRATION_CAPABILITY_MAPPED_RAM];
+}
+
+bool migrate_lazy_restore(void)
+{
+    MigrationState *s;
+
+    s = migrate_get_current();
+
+    return s->enabled_capabilities[MIGRATION_CAPABILITY_LAZY_RESTORE];
+}
+
+bool migrate_direct_io(void)
+{
+    MigrationState *s;
+
+    s = migrate_get_current();
+
+    return s->parameters.direct_io;
+}
+
+bool migrate_multifd_postcopy(void)
+{
+    MigrationState *s;
+
+    s = migrate_get_current();
+
+    return s->enabled_capabilities[MIGRATION_CAPABILITY_MULTIFD_POSTCOPY];
+}
+
+bool migrate_use_zero_copy_send(void)
+{
+    MigrationState *s;
+
+    s = migrate_get_current();
+
+    return s->enabled_capabilities[MIGRATION_CAPABILITY_MULTIFD] &&
+           s->enabled_capabilities[MIGRATION_CAPABILITY_ZERO_COPY_SEND];
+}
+
 bool migrate_pause_before_switchover(void)
 {
     MigrationState *s;
@@ -2530,6 +2806,15 @@ int migrate_multifd_zstd_level(void)
     return s->parameters.multifd_zstd_level;
 }
 
+uint64_t migrate_multifd_packet_size(void)
+{
+    MigrationState *s;
+
+    s = migrate_get_current();
+
+    return s->parameters.multifd_packet_size;
+}
+
 int migrate_use_xbzrle(void)
 {
     MigrationState *s;
@@ -3352,7 +3637,7 @@ static MigThrError postcopy_pause(MigrationState *s)
     assert(s->state == MIGRATION_STATUS_POSTCOPY_ACTIVE);
 
     while (true) {
-        QEMUFile *file;
+        QEMUFile *file, *preempt_file;
 
         /*
          * Current channel is possibly broken. Release it.  Note that this is
@@ -3368,10 +3653,20 @@ static MigThrError postcopy_pause(MigrationState *s)
         qemu_mutex_lock(&s->qemu_file_lock);
         file = s->to_dst_file;
         s->to_dst_file = NULL;
+        /*
+         * The preemption channel is not reconnected, requested pages go
+         * through the new main channel after a recovery.
+         */
+        preempt_file = s->postcopy_qemufile_src;
+        s->postcopy_qemufile_src = NULL;
         qemu_mutex_unlock(&s->qemu_file_lock);
 
         qemu_file_shutdown(file);
         qemu_fclose(file);
+        if (preempt_file) {
+            qemu_file_shutdown(preempt_file);
+            qemu_fclose(preempt_file);
+        }
 
         migrate_set_state(&s->state, s->state,
                           MIGRATION_STATUS_POSTCOPY_PAUSED);
@@ -3524,14 +3819,6 @@ static void migration_update_counters(MigrationState *s,
     s->pages_per_second = (double) transferred_pages /
                              (((double) time_spent / 1000.0));
 
-    /*
-     * if we haven't sent anything, we don't want to
-     * recalculate. 10000 is a small enough number for our purposes
-     */
-    if (ram_counters.dirty_pages_rate && transferred > 10000) {
-        s->expected_downtime = ram_counters.remaining / bandwidth;
-    }
-
     qemu_file_reset_rate_limit(s->to_dst_file);
 
     update_iteration_initial_status(s);
@@ -3547,6 +3834,35 @@ typedef enum {
     MIG_ITERATE_BREAK,          /* Break the loop */
 } MigIterateState;
 
+/*
+ * Predict the downtime of switching over now, and return true if it is
+ * worth iterating further to bring it under the limit.
+ *
+ * Only the pending state is compared with the threshold to switch over;
+ * the device state that is sent once the guest is stopped costs downtime
+ * too, so keep iterating while it doesn't fit, but only as long as the
+ * iterations still make the pending state shrink.  Otherwise a large
+ * device state would keep the migration from ever completing.
+ */
+static bool migration_downtime_over_limit(MigrationState *s,
+                                          uint64_t pending_size)
+{
+    uint64_t stop_size = qemu_savevm_state_stop_size();
+    bool shrinking = pending_size < s->pending_size_prev;
+
+    s->pending_size_prev = pending_size;
+    if (!s->threshold_size) {
+        /* Nothing measured yet */
+        return false;
+    }
+
+    s->expected_downtime = (pending_size + stop_size) *
+                           s->parameters.downtime_limit / s->threshold_size;
+    trace_migrate_downtime_predict(pending_size, stop_size,
+                                   s->expected_downtime);
+    return shrinking && pending_size + stop_size >= s->threshold_size;
+}
+
 /*
  * Return true if continue to the next iteration directly, false
  * otherwise.
@@ -3555,6 +3871,7 @@ static MigIterateState migration_iteration_run(MigrationState *s)
 {
     uint64_t pending_size, pend_pre, pend_compat, pend_post;
     bool in_postcopy = s->state == MIGRATION_STATUS_POSTCOPY_ACTIVE;
+    bool over_limit;
 
     qemu_savevm_state_pending(s->to_dst_file, s->threshold_size, &pend_pre,
                               &pend_compat, &pend_post);
@@ -3563,7 +3880,8 @@ static MigIterateState migration_iteration_run(MigrationState *s)
     trace_migrate_pending(pending_size, s->threshold_size,
                           pend_pre, pend_compat, pend_post);
 
-    if (pending_size && pending_size >= s->threshold_size) {
+    over_limit = migration_downtime_over_limit(s, pending_size);
+    if (pending_size && (pending_size >= s->threshold_size || over_limit)) {
         /* Still a significant amount to transfer */
         if (!in_postcopy && pend_pre <= s->threshold_size &&
             qatomic_read(&s->start_postcopy)) {
@@ -3587,6 +3905,7 @@ static void migration_iteration_finish(MigrationState *s)
 {
     /* If we enabled cpu throttling for auto-converge, turn it off. */
     cpu_throttle_stop();
+    cpu_throttle_dirty_limit_stop();
 
     qemu_mutex_lock_iothread();
     switch (s->state) {
@@ -3799,6 +4118,18 @@ static void *migration_thread(void *opaque)
         qemu_savevm_send_colo_enable(s->to_dst_file);
     }
 
+    if (migrate_postcopy_preempt()) {
+        Error *local_err = NULL;
+
+        if (postcopy_preempt_setup(s, &local_err)) {
+            migrate_set_error(s, local_err);
+            error_report_err(local_err);
+            migrate_set_state(&s->state, MIGRATION_STATUS_SETUP,
+                              MIGRATION_STATUS_FAILED);
+            goto out;
+        }
+    }
+
     qemu_savevm_state_setup(s->to_dst_file);
 
     qemu_savevm_wait_unplug(s, MIGRATION_STATUS_SETUP,
@@ -3838,6 +4169,7 @@ static void *migration_thread(void *opaque)
         urgent = migration_rate_limit();
     }
 
+out:
     trace_migration_thread_after_loop();
     migration_iteration_finish(s);
     object_unref(OBJECT(s));
@@ -4115,6 +4447,10 @@ void migration_global_dump(Monitor *mon)
                    ms->decompress_error_check ? "on" : "off");
     monitor_printf(mon, "clear-bitmap-shift: %u\n",
                    ms->clear_bitmap_shift);
+    monitor_printf(mon, "bitmap-sync-threads: %u\n",
+                   ms->bitmap_sync_threads);
+    monitor_printf(mon, "snapshot-fault-threads: %u\n",
+                   ms->snapshot_fault_threads);
 }
 
 #define DEFINE_PROP_MIG_CAP(name, x)             \
@@ -4131,6 +4467,11 @@ static Property migration_properties[] = {
                       decompress_error_check, true),
     DEFINE_PROP_UINT8("x-clear-bitmap-shift", MigrationState,
                       clear_bitmap_shift, CLEAR_BITMAP_SHIFT_DEFAULT),
+    DEFINE_PROP_UINT8("x-bitmap-sync-threads", MigrationState,
+                      bitmap_sync_threads, DEFAULT_MIGRATE_BITMAP_SYNC_THREADS),
+    DEFINE_PROP_UINT8("x-snapshot-fault-threads", MigrationState,
+                      snapshot_fault_threads,
+                      DEFAULT_MIGRATE_SNAPSHOT_FAULT_THREADS),
 
     /* Migration parameters */
     DEFINE_PROP_UINT8("x-compress-level", MigrationState,
@@ -4175,6 +4516,14 @@ static Property migration_properties[] = {
     DEFINE_PROP_UINT8("multifd-zstd-level", MigrationState,
                       parameters.multifd_zstd_level,
                       DEFAULT_MIGRATE_MULTIFD_ZSTD_LEVEL),
+    DEFINE_PROP_SIZE("multifd-packet-size", MigrationState,
+                      parameters.multifd_packet_size,
+                      MULTIFD_PACKET_SIZE),
+    DEFINE_PROP_UINT64("vcpu-dirty-limit", MigrationState,
+                      parameters.vcpu_dirty_limit,
+                      DEFAULT_MIGRATE_VCPU_DIRTY_LIMIT),
+    DEFINE_PROP_BOOL("direct-io", MigrationState,
+                      parameters.direct_io, false),
     DEFINE_PROP_SIZE("xbzrle-cache-size", MigrationState,
                       parameters.xbzrle_cache_size,
                       DEFAULT_MIGRATE_XBZRLE_CACHE_SIZE),
@@ -4210,6 +4559,17 @@ static Property migration_properties[] = {
     DEFINE_PROP_MIG_CAP("x-block", MIGRATION_CAPABILITY_BLOCK),
     DEFINE_PROP_MIG_CAP("x-return-path", MIGRATION_CAPABILITY_RETURN_PATH),
     DEFINE_PROP_MIG_CAP("x-multifd", MIGRATION_CAPABILITY_MULTIFD),
+    DEFINE_PROP_MIG_CAP("x-multifd-zero-page",
+            MIGRATION_CAPABILITY_MULTIFD_ZERO_PAGE),
+    DEFINE_PROP_MIG_CAP("x-zero-copy-send",
+            MIGRATION_CAPABILITY_ZERO_COPY_SEND),
+    DEFINE_PROP_MIG_CAP("x-dirty-limit", MIGRATION_CAPABILITY_DIRTY_LIMIT),
+    DEFINE_PROP_MIG_CAP("x-postcopy-preempt",
+                        MIGRATION_CAPABILITY_POSTCOPY_PREEMPT),
+    DEFINE_PROP_MIG_CAP("x-multifd-postcopy",
+                        MIGRATION_CAPABILITY_MULTIFD_POSTCOPY),
+    DEFINE_PROP_MIG_CAP("x-mapped-ram", MIGRATION_CAPABILITY_MAPPED_RAM),
+    DEFINE_PROP_MIG_CAP("x-lazy-restore", MIGRATION_CAPABILITY_LAZY_RESTORE),
     DEFINE_PROP_MIG_CAP("x-background-snapshot",
             MIGRATION_CAPABILITY_BACKGROUND_SNAPSHOT),
 
@@ -4272,6 +4632,9 @@ static void migration_instance_init(Object *obj)
     params->has_multifd_compression = true;
     params->has_multifd_zlib_level = true;
     params->has_multifd_zstd_level = true;
+    params->has_multifd_packet_size = true;
+    params->has_vcpu_dirty_limit = true;
+    params->has_direct_io = true;
     params->has_xbzrle_cache_size = true;
     params->has_max_postcopy_bandwidth = true;
     params->has_max_cpu_throttle = true;
@@ -45,6 +45,15 @@ struct PostcopyBlocktimeContext;
  */
 #define CLEAR_BITMAP_SHIFT_MAX            31
 
+/* Channels the RAM pages are loaded from */
+enum {
+    /* The main migration stream */
+    RAM_CHANNEL_PRECOPY = 0,
+    /* The postcopy preemption channel, for the requested pages */
+    RAM_CHANNEL_POSTCOPY = 1,
+    RAM_CHANNEL_MAX,
+};
+
 /* State for the incoming migration */
 struct MigrationIncomingState {
     QEMUFile *from_src_file;
@@ -68,6 +77,8 @@ struct MigrationIncomingState {
     QemuSemaphore  fault_thread_sem;
     /* Set this when we want the fault thread to quit */
     bool           fault_thread_quit;
+    /* Faults are resolved from a mapped-ram file, see ram_lazy_restore */
+    bool           lazy_restore;
 
     bool           have_listen_thread;
     QemuThread     listen_thread;
@@ -83,6 +94,17 @@ struct MigrationIncomingState {
     RAMBlock *last_rb;
     void     *postcopy_tmp_page;
     void     *postcopy_tmp_zero_page;
+    /* Last RAMBlock loaded from each channel, for RAM_SAVE_FLAG_CONTINUE */
+    RAMBlock *last_recv_block[RAM_CHANNEL_MAX];
+
+    /* Postcopy preemption channel, and the thread loading its pages */
+    QEMUFile *postcopy_qemufile_dst;
+    /* Temporary page of the preemption thread */
+    void     *postcopy_preempt_tmp_page;
+    /* Set once the preemption thread can start, i.e. when listening */
+    bool      postcopy_preempt_ready;
+    bool      have_postcopy_preempt_thread;
+    QemuThread postcopy_preempt_thread;
     /* PostCopyFD's for external userfaultfds & handlers of shared memory */
     GArray   *postcopy_remote_fds;
 
@@ -156,6 +178,12 @@ struct MigrationState {
     QEMUBH *cleanup_bh;
     /* Protected by qemu_file_lock */
     QEMUFile *to_dst_file;
+    /*
+     * Postcopy preemption channel, where the pages requested by the
+     * destination are sent.  Protected by qemu_file_lock, and only used
+     * for I/O by the migration thread.
+     */
+    QEMUFile *postcopy_qemufile_src;
     QIOChannelBuffer *bioc;
     /*
      * Protects to_dst_file/from_dst_file pointers.  We need to make sure we
@@ -185,6 +213,8 @@ struct MigrationState {
      * measured bandwidth
      */
     int64_t threshold_size;
+    /* what was pending at the previous iteration, to tell if it shrinks */
+    uint64_t pending_size_prev;
 
     /* params from 'migrate-set-parameters' */
     MigrationParameters parameters;
@@ -292,6 +322,17 @@ struct MigrationState {
      */
     uint8_t clear_bitmap_shift;
 
+    /*
+     * Number of threads that help the migration thread sync the dirty
+     * bitmap of large guests, 0 to sync it from the migration thread only.
+     */
+    uint8_t bitmap_sync_threads;
+    /*
+     * Threads resolving the write faults of a background snapshot; with
+     * none, the migration thread resolves them itself.
+     */
+    uint8_t snapshot_fault_threads;
+
     /*
      * This save hostname when out-going migration starts
      */
@@ -333,11 +374,21 @@ bool migrate_validate_uuid(void);
 
 bool migrate_auto_converge(void);
 bool migrate_use_multifd(void);
+bool migrate_use_multifd_zero_page(void);
+bool migrate_use_multifd_xbzrle(void);
+bool migrate_use_zero_copy_send(void);
+bool migrate_dirty_limit(void);
+bool migrate_postcopy_preempt(void);
+bool migrate_multifd_postcopy(void);
+bool migrate_mapped_ram(void);
+bool migrate_lazy_restore(void);
+bool migrate_direct_io(void);
 bool migrate_pause_before_switchover(void);
 int migrate_multifd_channels(void);
 MultiFDCompression migrate_multifd_compression(void);
 int migrate_multifd_zlib_level(void);
 int migrate_multifd_zstd_level(void);
+uint64_t migrate_multifd_packet_size(void);
 
 int migrate_use_xbzrle(void);
 uint64_t migrate_xbzrle_cache_size(void);
@@ -0,0 +1,274 @@
+/*
+ * Multifd lz4 compression implementation
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ */
+
+#include "qemu/osdep.h"
+#include <lz4.h>
+#include "qemu/rcu.h"
+#include "exec/target_page.h"
+#include "qapi/error.h"
+#include "migration.h"
+#include "trace.h"
+#include "multifd.h"
+
+/*
+ * Every page is compressed as an independent lz4 block, preceded by its
+ * compressed length as a big endian 32 bit value.  A page that does not
+ * shrink is sent as is, with a length equal to the page size.
+ *
+ * Blocks never reference each other: the guest keeps writing to the pages
+ * while they are being compressed, and a match against an earlier page of
+ * the packet could then refer to data that the destination never saw.
+ */
+#define LZ4_HDR_SIZE sizeof(uint32_t)
+
+struct lz4_data {
+    /* compression state, only used on the send side */
+    void *state;
+    /* compressed buffer */
+    uint8_t *zbuff;
+    /* size of compressed buffer */
+    uint32_t zbuff_len;
+};
+
+/* Multifd lz4 compression */
+
+static struct lz4_data *lz4_data_new(int id, bool send, Error **errp)
+{
+    struct lz4_data *z = g_new0(struct lz4_data, 1);
+
+    /* We will never have more than page_count pages */
+    z->zbuff_len = multifd_packet_pages() *
+                   (qemu_target_page_size() + LZ4_HDR_SIZE);
+    z->zbuff = g_try_malloc(z->zbuff_len);
+    if (send && z->zbuff) {
+        z->state = g_try_malloc(LZ4_sizeofState());
+    }
+    if (!z->zbuff || (send && !z->state)) {
+        g_free(z->zbuff);
+        g_free(z);
+        error_setg(errp, "multifd %d: out of memory for zbuff", id);
+        return NULL;
+    }
+    return z;
+}
+
+static void lz4_data_free(struct lz4_data *z)
+{
+    g_free(z->state);
+    g_free(z->zbuff);
+    g_free(z);
+}
+
+/**
+ * lz4_send_setup: setup send side
+ *
+ * Setup each channel with lz4 compression.
+ *
+ * Returns 0 for success or -1 for error
+ *
+ * @p: Params for the channel that we are using
+ * @errp: pointer to an error
+ */
+static int lz4_send_setup(MultiFDSendParams *p, Error **errp)
+{
+    p->data = lz4_data_new(p->id, true, errp);
+    return p->data ? 0 : -1;
+}
+
+/**
+ * lz4_send_cleanup: cleanup send side
+ *
+ * Close the channel and return memory.
+ *
+ * @p: Params for the channel that we are using
+ */
+static void lz4_send_cleanup(MultiFDSendParams *p, Error **errp)
+{
+    lz4_data_free(p->data);
+    p->data = NULL;
+}
+
+/**
+ * lz4_send_prepare: prepare date to be able to send
+ *
+ * Create a compressed buffer with all the pages that we are going to
+ * send.
+ *
+ * Returns 0 for success or -1 for error
+ *
+ * @p: Params for the channel that we are using
+ * @used: number of pages used
+ */
+static int lz4_send_prepare(MultiFDSendParams *p, uint32_t used, Error **errp)
+{
+    struct iovec *iov = p->pages->iov;
+    struct lz4_data *z = p->data;
+    uint32_t out_size = 0;
+    uint32_t i;
+
+    for (i = 0; i < used; i++) {
+        uint8_t *out = z->zbuff + out_size + LZ4_HDR_SIZE;
+        int len;
+
+        /*
+         * Limit the output to one byte less than the page, so that lz4
+         * gives up as soon as the page turns out not to be compressible.
+         */
+        len = LZ4_compress_fast_extState(z->state, iov[i].iov_base,
+                                         (char *)out, iov[i].iov_len,
+                                         iov[i].iov_len - 1, 1);
+        if (len <= 0) {
+            memcpy(out, iov[i].iov_base, iov[i].iov_len);
+            len = iov[i].iov_len;
+        }
+        stl_be_p(z->zbuff + out_size, len);
+        out_size += LZ4_HDR_SIZE + len;
+    }
+    p->next_packet_size = out_size;
+    p->flags |= MULTIFD_FLAG_LZ4;
+
+    return 0;
+}
+
+/**
+ * lz4_send_write: do the actual write of the data
+ *
+ * Do the actual write of the comprresed buffer.
+ *
+ * Returns 0 for success or -1 for error
+ *
+ * @p: Params for the channel that we are using
+ * @used: number of pages used
+ * @errp: pointer to an error
+ */
+static int lz4_send_write(MultiFDSendParams *p, uint32_t used, Error **errp)
+{
+    struct lz4_data *z = p->data;
+
+    return qio_channel_write_all(p->c, (void *)z->zbuff, p->next_packet_size,
+                                 errp);
+}
+
+/**
+ * lz4_recv_setup: setup receive side
+ *
+ * Create the compressed buffer.
+ *
+ * Returns 0 for success or -1 for error
+ *
+ * @p: Params for the channel that we are using
+ * @errp: pointer to an error
+ */
+static int lz4_recv_setup(MultiFDRecvParams *p, Error **errp)
+{
+    p->data = lz4_data_new(p->id, false, errp);
+    return p->data ? 0 : -1;
+}
+
+/**
+ * lz4_recv_cleanup: cleanup receive side
+ *
+ * Return the memory of the compressed buffer.
+ *
+ * @p: Params for the channel that we are using
+ */
+static void lz4_recv_cleanup(MultiFDRecvParams *p)
+{
+    lz4_data_free(p->data);
+    p->data = NULL;
+}
+
+/**
+ * lz4_recv_pages: read the data from the channel into actual pages
+ *
+ * Read the compressed buffer, and uncompress it into the actual
+ * pages.
+ *
+ * Returns 0 for success or -1 for error
+ *
+ * @p: Params for the channel that we are using
+ * @used: number of pages used
+ * @errp: pointer to an error
+ */
+static int lz4_recv_pages(MultiFDRecvParams *p, uint32_t used, Error **errp)
+{
+    struct lz4_data *z = p->data;
+    uint32_t in_size = p->next_packet_size;
+    uint32_t flags = p->flags & MULTIFD_FLAG_COMPRESSION_MASK;
+    uint32_t in_off = 0;
+    int ret;
+    int i;
+
+    if (flags != MULTIFD_FLAG_LZ4) {
+        error_setg(errp, "multifd %d: flags received %x flags expected %x",
+                   p->id, flags, MULTIFD_FLAG_LZ4);
+        return -1;
+    }
+    if (in_size > z->zbuff_len) {
+        error_setg(errp, "multifd %d: packet size received %u size max %u",
+                   p->id, in_size, z->zbuff_len);
+        return -1;
+    }
+    ret = qio_channel_read_all(p->c, (void *)z->zbuff, in_size, errp);
+
+    if (ret != 0) {
+        return ret;
+    }
+
+    for (i = 0; i < used; i++) {
+        struct iovec *iov = &p->pages->iov[i];
+        uint32_t len;
+
+        if (in_size - in_off < LZ4_HDR_SIZE) {
+            goto truncated;
+        }
+        len = ldl_be_p(z->zbuff + in_off);
+        in_off += LZ4_HDR_SIZE;
+        if (len > iov->iov_len || in_size - in_off < len) {
+            goto truncated;
+        }
+
+        if (len == iov->iov_len) {
+            memcpy(iov->iov_base, z->zbuff + in_off, len);
+        } else {
+            ret = LZ4_decompress_safe((const char *)z->zbuff + in_off,
+                                      iov->iov_base, len, iov->iov_len);
+            if (ret != iov->iov_len) {
+                error_setg(errp, "multifd %d: lz4 decompressed %d bytes, "
+                           "expected %zu", p->id, ret, iov->iov_len);
+                return -1;
+            }
+        }
+        in_off += len;
+    }
+    if (in_off != in_size) {
+        goto truncated;
+    }
+    return 0;
+
+truncated:
+    error_setg(errp, "multifd %d: malformed lz4 packet of size %u",
+               p->id, in_size);
+    return -1;
+}
+
+static MultiFDMethods multifd_lz4_ops = {
+    .send_setup = lz4_send_setup,
+    .send_cleanup = lz4_send_cleanup,
+    .send_prepare = lz4_send_prepare,
+    .send_write = lz4_send_write,
+    .recv_setup = lz4_recv_setup,
+    .recv_cleanup = lz4_recv_cleanup,
+    .recv_pages = lz4_recv_pages
+};
+
+static void multifd_lz4_register(void)
+{
+    multifd_register_ops(MULTIFD_COMPRESSION_LZ4, &multifd_lz4_ops);
+}
+
+migration_init(multifd_lz4_register);
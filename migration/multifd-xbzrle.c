@@ -0,0 +1,420 @@
+/*
+ * Multifd xbzrle delta compression implementation
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ */
+
+#include "qemu/osdep.h"
+#include "qemu/rcu.h"
+#include "qemu/thread.h"
+#include "exec/ramblock.h"
+#include "exec/target_page.h"
+#include "qapi/error.h"
+#include "migration.h"
+#include "ram.h"
+#include "page_cache.h"
+#include "xbzrle.h"
+#include "trace.h"
+#include "multifd.h"
+
+/*
+ * Every page is sent as its length, a big endian 32 bit value, followed
+ * by the data.  A page whose length is the page size is sent as is, any
+ * shorter one is an xbzrle delta against the content the destination
+ * already has, possibly empty if the page did not change.
+ *
+ * The destination keeps no cache: it applies the delta to guest memory,
+ * which holds the last version sent.  The source keeps the copy of that
+ * version in a cache shared by all channels, because consecutive
+ * versions of a page may be sent through different channels.  Each send
+ * on a channel is ordered before the next version of the page by the
+ * multifd sync that follows every dirty bitmap sync, so the only
+ * concurrency is between different pages sharing a lock of the cache.
+ */
+#define XBZRLE_HDR_SIZE sizeof(uint32_t)
+
+struct xbzrle_data {
+    /* compressed buffer */
+    uint8_t *zbuff;
+    /* size of compressed buffer */
+    uint32_t zbuff_len;
+    /* stable copy of the page being encoded */
+    uint8_t *current_buf;
+};
+
+/* State shared by the send channels */
+static struct {
+    /* Versions of the pages that the destination has */
+    PageCache *cache;
+    /* Number of send channels using the cache */
+    int users;
+    /* Protects the updates of xbzrle_counters */
+    QemuMutex stats_lock;
+} multifd_xbzrle;
+
+/* Multifd xbzrle compression */
+
+/**
+ * xbzrle_send_setup: setup send side
+ *
+ * Setup each channel with xbzrle compression.  The page cache is
+ * created by the first channel, with the xbzrle-cache-size parameter
+ * of the start of the migration.
+ *
+ * Returns 0 for success or -1 for error
+ *
+ * @p: Params for the channel that we are using
+ * @errp: pointer to an error
+ */
+static int xbzrle_send_setup(MultiFDSendParams *p, Error **errp)
+{
+    size_t page_size = qemu_target_page_size();
+    struct xbzrle_data *z;
+
+    if (!multifd_xbzrle.users) {
+        multifd_xbzrle.cache = cache_init(migrate_xbzrle_cache_size(),
+                                          page_size, errp);
+        if (!multifd_xbzrle.cache) {
+            return -1;
+        }
+    }
+    multifd_xbzrle.users++;
+
+    z = g_new0(struct xbzrle_data, 1);
+    p->data = z;
+    /* We will never have more than page_count pages */
+    z->zbuff_len = multifd_packet_pages() * (page_size + XBZRLE_HDR_SIZE);
+    z->zbuff = g_try_malloc(z->zbuff_len);
+    if (!z->zbuff) {
+        error_setg(errp, "multifd %d: out of memory for zbuff", p->id);
+        return -1;
+    }
+    z->current_buf = g_malloc(page_size);
+    return 0;
+}
+
+/**
+ * xbzrle_send_cleanup: cleanup send side
+ *
+ * Close the channel and return memory.  The last channel frees the page
+ * cache.
+ *
+ * @p: Params for the channel that we are using
+ */
+static void xbzrle_send_cleanup(MultiFDSendParams *p, Error **errp)
+{
+    struct xbzrle_data *z = p->data;
+
+    if (!z) {
+        return;
+    }
+    g_free(z->zbuff);
+    g_free(z->current_buf);
+    g_free(z);
+    p->data = NULL;
+
+    if (!--multifd_xbzrle.users) {
+        cache_fini(multifd_xbzrle.cache);
+        multifd_xbzrle.cache = NULL;
+    }
+}
+
+/*
+ * Encode the page at @host, of address @addr, into @out.  Returns the
+ * length written after the header.
+ */
+static uint32_t xbzrle_send_page(struct xbzrle_data *z, uint64_t addr,
+                                 uint8_t *host, uint8_t *out, uint64_t age,
+                                 XBZRLECacheStats *stats)
+{
+    PageCache *cache = multifd_xbzrle.cache;
+    size_t page_size = qemu_target_page_size();
+    uint8_t *cached;
+    int len;
+
+    /*
+     * During the first pass over the guest every page misses, so don't
+     * thrash the cache with pages that may never be dirtied again.
+     */
+    if (age <= 1) {
+        memcpy(out, host, page_size);
+        return page_size;
+    }
+
+    cache_lock(cache, addr);
+    if (!cache_is_cached(cache, addr, age)) {
+        stats->cache_miss++;
+        if (cache_insert(cache, addr, host, age) == 0) {
+            /* send the cached copy, the guest might be changing the page */
+            host = get_cached_data(cache, addr);
+        }
+        memcpy(out, host, page_size);
+        cache_unlock(cache, addr);
+        return page_size;
+    }
+
+    stats->pages++;
+    cached = get_cached_data(cache, addr);
+    memcpy(z->current_buf, host, page_size);
+    /*
+     * Limit the output to one byte less than the page, so that a delta
+     * can be told apart from a page sent as is.
+     */
+    len = xbzrle_encode_buffer(cached, z->current_buf, page_size,
+                               out, page_size - 1);
+    if (len < 0) {
+        stats->overflow++;
+        memcpy(out, z->current_buf, page_size);
+        len = page_size;
+    }
+    if (len) {
+        memcpy(cached, z->current_buf, page_size);
+    }
+    cache_unlock(cache, addr);
+
+    stats->bytes += len + XBZRLE_HDR_SIZE;
+    return len;
+}
+
+/* Clear the cached copy, if any, of a page the destination now has as 0 */
+static void xbzrle_cache_zero_page(uint64_t addr, uint64_t age)
+{
+    PageCache *cache = multifd_xbzrle.cache;
+
+    cache_lock(cache, addr);
+    if (cache_is_cached(cache, addr, age)) {
+        memset(get_cached_data(cache, addr), 0, qemu_target_page_size());
+    }
+    cache_unlock(cache, addr);
+}
+
+/* The destination clears the zero pages of the packet */
+static void xbzrle_send_zero_pages(MultiFDPages_t *pages, uint64_t age)
+{
+    uint32_t i;
+
+    for (i = pages->used; i < pages->used + pages->zero; i++) {
+        xbzrle_cache_zero_page(pages->block->offset + pages->offset[i], age);
+    }
+}
+
+/**
+ * multifd_xbzrle_cache_zero_page: update the cache for a zero page
+ *
+ * Called by the migration thread for a page it sent as zero on the main
+ * stream, when the channels don't look for zero pages themselves.  Any
+ * earlier version of the page was encoded before the multifd sync that
+ * preceded this pass, so it can't race with a channel.
+ *
+ * @addr: ram address of the page
+ */
+void multifd_xbzrle_cache_zero_page(ram_addr_t addr)
+{
+    uint64_t age = ram_counters.dirty_sync_count;
+
+    if (multifd_xbzrle.cache && age > 1) {
+        xbzrle_cache_zero_page(addr, age);
+    }
+}
+
+/**
+ * xbzrle_send_prepare: prepare date to be able to send
+ *
+ * Create a buffer with the delta of each page that is in the cache, and
+ * the content of the others.
+ *
+ * Returns 0 for success or -1 for error
+ *
+ * @p: Params for the channel that we are using
+ * @used: number of pages used
+ */
+static int xbzrle_send_prepare(MultiFDSendParams *p, uint32_t used,
+                               Error **errp)
+{
+    struct xbzrle_data *z = p->data;
+    MultiFDPages_t *pages = p->pages;
+    XBZRLECacheStats stats = { };
+    uint32_t out_size = 0;
+    /* a torn read on 32 bit hosts only affects the cache replacement */
+    uint64_t age = ram_counters.dirty_sync_count;
+    uint32_t i;
+
+    for (i = 0; i < used; i++) {
+        uint64_t addr = pages->block->offset + pages->offset[i];
+        uint32_t len;
+
+        len = xbzrle_send_page(z, addr, pages->iov[i].iov_base,
+                               z->zbuff + out_size + XBZRLE_HDR_SIZE, age,
+                               &stats);
+        stl_be_p(z->zbuff + out_size, len);
+        out_size += XBZRLE_HDR_SIZE + len;
+    }
+    if (pages->zero && age > 1) {
+        xbzrle_send_zero_pages(pages, age);
+    }
+    p->next_packet_size = out_size;
+    p->flags |= MULTIFD_FLAG_XBZRLE;
+
+    qemu_mutex_lock(&multifd_xbzrle.stats_lock);
+    xbzrle_counters.pages += stats.pages;
+    xbzrle_counters.cache_miss += stats.cache_miss;
+    xbzrle_counters.overflow += stats.overflow;
+    xbzrle_counters.bytes += stats.bytes;
+    qemu_mutex_unlock(&multifd_xbzrle.stats_lock);
+
+    return 0;
+}
+
+/**
+ * xbzrle_send_write: do the actual write of the data
+ *
+ * Do the actual write of the encoded buffer.
+ *
+ * Returns 0 for success or -1 for error
+ *
+ * @p: Params for the channel that we are using
+ * @used: number of pages used
+ * @errp: pointer to an error
+ */
+static int xbzrle_send_write(MultiFDSendParams *p, uint32_t used,
+                             Error **errp)
+{
+    struct xbzrle_data *z = p->data;
+
+    return qio_channel_write_all(p->c, (void *)z->zbuff, p->next_packet_size,
+                                 errp);
+}
+
+/**
+ * xbzrle_recv_setup: setup receive side
+ *
+ * Create the encoded buffer.
+ *
+ * Returns 0 for success or -1 for error
+ *
+ * @p: Params for the channel that we are using
+ * @errp: pointer to an error
+ */
+static int xbzrle_recv_setup(MultiFDRecvParams *p, Error **errp)
+{
+    struct xbzrle_data *z = g_new0(struct xbzrle_data, 1);
+
+    p->data = z;
+    z->zbuff_len = multifd_packet_pages() *
+                   (qemu_target_page_size() + XBZRLE_HDR_SIZE);
+    z->zbuff = g_try_malloc(z->zbuff_len);
+    if (!z->zbuff) {
+        error_setg(errp, "multifd %d: out of memory for zbuff", p->id);
+        return -1;
+    }
+    return 0;
+}
+
+/**
+ * xbzrle_recv_cleanup: cleanup receive side
+ *
+ * Return the memory of the encoded buffer.
+ *
+ * @p: Params for the channel that we are using
+ */
+static void xbzrle_recv_cleanup(MultiFDRecvParams *p)
+{
+    struct xbzrle_data *z = p->data;
+
+    if (z) {
+        g_free(z->zbuff);
+        g_free(z);
+        p->data = NULL;
+    }
+}
+
+/**
+ * xbzrle_recv_pages: read the data from the channel into actual pages
+ *
+ * Read the encoded buffer, and apply it to the actual pages.
+ *
+ * Returns 0 for success or -1 for error
+ *
+ * @p: Params for the channel that we are using
+ * @used: number of pages used
+ * @errp: pointer to an error
+ */
+static int xbzrle_recv_pages(MultiFDRecvParams *p, uint32_t used,
+                             Error **errp)
+{
+    struct xbzrle_data *z = p->data;
+    uint32_t in_size = p->next_packet_size;
+    uint32_t flags = p->flags & MULTIFD_FLAG_COMPRESSION_MASK;
+    uint32_t in_off = 0;
+    int ret;
+    int i;
+
+    if (flags != MULTIFD_FLAG_XBZRLE) {
+        error_setg(errp, "multifd %d: flags received %x flags expected %x",
+                   p->id, flags, MULTIFD_FLAG_XBZRLE);
+        return -1;
+    }
+    if (in_size > z->zbuff_len) {
+        error_setg(errp, "multifd %d: packet size received %u size max %u",
+                   p->id, in_size, z->zbuff_len);
+        return -1;
+    }
+    ret = qio_channel_read_all(p->c, (void *)z->zbuff, in_size, errp);
+
+    if (ret != 0) {
+        return ret;
+    }
+
+    for (i = 0; i < used; i++) {
+        struct iovec *iov = &p->pages->iov[i];
+        uint32_t len;
+
+        if (in_size - in_off < XBZRLE_HDR_SIZE) {
+            goto truncated;
+        }
+        len = ldl_be_p(z->zbuff + in_off);
+        in_off += XBZRLE_HDR_SIZE;
+        if (len > iov->iov_len || in_size - in_off < len) {
+            goto truncated;
+        }
+
+        if (len == iov->iov_len) {
+            memcpy(iov->iov_base, z->zbuff + in_off, len);
+        } else if (len &&
+                   xbzrle_decode_buffer(z->zbuff + in_off, len,
+                                        iov->iov_base, iov->iov_len) < 0) {
+            error_setg(errp, "multifd %d: failed to decode xbzrle page %d "
+                       "of packet %" PRIu64, p->id, i, p->packet_num);
+            return -1;
+        }
+        in_off += len;
+    }
+    if (in_off != in_size) {
+        goto truncated;
+    }
+    return 0;
+
+truncated:
+    error_setg(errp, "multifd %d: malformed xbzrle packet of size %u",
+               p->id, in_size);
+    return -1;
+}
+
+static MultiFDMethods multifd_xbzrle_ops = {
+    .send_setup = xbzrle_send_setup,
+    .send_cleanup = xbzrle_send_cleanup,
+    .send_prepare = xbzrle_send_prepare,
+    .send_write = xbzrle_send_write,
+    .recv_setup = xbzrle_recv_setup,
+    .recv_cleanup = xbzrle_recv_cleanup,
+    .recv_pages = xbzrle_recv_pages
+};
+
+static void multifd_xbzrle_register(void)
+{
+    qemu_mutex_init(&multifd_xbzrle.stats_lock);
+    multifd_register_ops(MULTIFD_COMPRESSION_XBZRLE, &multifd_xbzrle_ops);
+}
+
+migration_init(multifd_xbzrle_register);
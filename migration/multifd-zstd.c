@@ -47,7 +47,7 @@ struct zstd_data {
  */
 static int zstd_send_setup(MultiFDSendParams *p, Error **errp)
 {
-    uint32_t page_count = MULTIFD_PACKET_SIZE / qemu_target_page_size();
+    uint32_t page_count = multifd_packet_pages();
     struct zstd_data *z = g_new0(struct zstd_data, 1);
     int res;
 
@@ -191,7 +191,7 @@ static int zstd_send_write(MultiFDSendParams *p, uint32_t used, Error **errp)
  */
 static int zstd_recv_setup(MultiFDRecvParams *p, Error **errp)
 {
-    uint32_t page_count = MULTIFD_PACKET_SIZE / qemu_target_page_size();
+    uint32_t page_count = multifd_packet_pages();
     struct zstd_data *z = g_new0(struct zstd_data, 1);
     int ret;
 
@@ -11,6 +11,7 @@
  */
 
 #include "qemu/osdep.h"
+#include "qemu/cutils.h"
 #include "qemu/rcu.h"
 #include "exec/target_page.h"
 #include "sysemu/sysemu.h"
@@ -20,10 +21,13 @@
 #include "ram.h"
 #include "migration.h"
 #include "socket.h"
+#include "file.h"
 #include "tls.h"
 #include "qemu-file.h"
 #include "trace.h"
 #include "multifd.h"
+#include "postcopy-ram.h"
+#include "migration/colo.h"
 
 #include "qemu/yank.h"
 #include "io/channel-socket.h"
@@ -105,7 +109,8 @@ static int nocomp_send_prepare(MultiFDSendParams *p, uint32_t used,
  */
 static int nocomp_send_write(MultiFDSendParams *p, uint32_t used, Error **errp)
 {
-    return qio_channel_writev_all(p->c, p->pages->iov, used, errp);
+    return qio_channel_writev_full_all(p->c, p->pages->iov, used, NULL, 0,
+                                       p->write_flags, errp);
 }
 
 /**
@@ -239,6 +244,12 @@ static int multifd_recv_initial_packet(QIOChannel *c, Error **errp)
     return msg.id;
 }
 
+/* Number of pages in a full packet */
+uint32_t multifd_packet_pages(void)
+{
+    return migrate_multifd_packet_size() / qemu_target_page_size();
+}
+
 static MultiFDPages_t *multifd_pages_init(size_t size)
 {
     MultiFDPages_t *pages = g_new0(MultiFDPages_t, 1);
@@ -253,6 +264,7 @@ static MultiFDPages_t *multifd_pages_init(size_t size)
 static void multifd_pages_clear(MultiFDPages_t *pages)
 {
     pages->used = 0;
+    pages->zero = 0;
     pages->allocated = 0;
     pages->packet_num = 0;
     pages->block = NULL;
@@ -273,12 +285,13 @@ static void multifd_send_fill_packet(MultiFDSendParams *p)
     packet->pages_used = cpu_to_be32(p->pages->used);
     packet->next_packet_size = cpu_to_be32(p->next_packet_size);
     packet->packet_num = cpu_to_be64(p->packet_num);
+    packet->zero_pages = cpu_to_be32(p->pages->zero);
 
     if (p->pages->block) {
         strncpy(packet->ramblock, p->pages->block->idstr, 256);
     }
 
-    for (i = 0; i < p->pages->used; i++) {
+    for (i = 0; i < p->pages->used + p->pages->zero; i++) {
         /* there are architectures where ram_addr_t is 32 bit */
         uint64_t temp = p->pages->offset[i];
 
@@ -289,8 +302,9 @@ static void multifd_send_fill_packet(MultiFDSendParams *p)
 static int multifd_recv_unfill_packet(MultiFDRecvParams *p, Error **errp)
 {
     MultiFDPacket_t *packet = p->packet;
-    uint32_t pages_max = MULTIFD_PACKET_SIZE / qemu_target_page_size();
+    uint32_t pages_max = multifd_packet_pages();
     RAMBlock *block;
+    uint8_t *host;
     int i;
 
     packet->magic = be32_to_cpu(packet->magic);
@@ -339,10 +353,18 @@ static int multifd_recv_unfill_packet(MultiFDRecvParams *p, Error **errp)
         return -1;
     }
 
+    p->pages->zero = be32_to_cpu(packet->zero_pages);
+    if (p->pages->zero > packet->pages_alloc - p->pages->used) {
+        error_setg(errp, "multifd: received packet "
+                   "with %d zero pages and expected maximum pages are %d",
+                   p->pages->zero, packet->pages_alloc - p->pages->used);
+        return -1;
+    }
+
     p->next_packet_size = be32_to_cpu(packet->next_packet_size);
     p->packet_num = be64_to_cpu(packet->packet_num);
 
-    if (p->pages->used == 0) {
+    if (p->pages->used == 0 && p->pages->zero == 0) {
         return 0;
     }
 
@@ -354,8 +376,10 @@ static int multifd_recv_unfill_packet(MultiFDRecvParams *p, Error **errp)
                    packet->ramblock);
         return -1;
     }
+    /* A COLO checkpoint goes to the cache, see multifd_recv_colo_pages() */
+    host = migration_incoming_in_colo_state() ? block->colo_cache : block->host;
 
-    for (i = 0; i < p->pages->used; i++) {
+    for (i = 0; i < p->pages->used + p->pages->zero; i++) {
         uint64_t offset = be64_to_cpu(packet->offset[i]);
 
         if (offset > (block->used_length - qemu_target_page_size())) {
@@ -364,9 +388,11 @@ static int multifd_recv_unfill_packet(MultiFDRecvParams *p, Error **errp)
                        offset, block->used_length);
             return -1;
         }
-        p->pages->iov[i].iov_base = block->host + offset;
+        p->pages->offset[i] = offset;
+        p->pages->iov[i].iov_base = host + offset;
         p->pages->iov[i].iov_len = qemu_target_page_size();
     }
+    p->pages->block = block;
 
     return 0;
 }
@@ -407,13 +433,30 @@ struct {
  * false.
  */
 
+/*
+ * Account the zero pages found by @p since the last call.  They were
+ * counted as normal pages with a payload when they were queued; returns
+ * the size of that payload.
+ *
+ * Called with p->mutex held.
+ */
+static uint64_t multifd_collect_zero_pages(MultiFDSendParams *p)
+{
+    uint64_t zero_pages = p->zero_pages;
+
+    p->zero_pages = 0;
+    ram_counters.normal -= zero_pages;
+    ram_counters.duplicate += zero_pages;
+    return zero_pages * qemu_target_page_size();
+}
+
 static int multifd_send_pages(QEMUFile *f)
 {
     int i;
     static int next_channel;
     MultiFDSendParams *p = NULL; /* make happy gcc */
     MultiFDPages_t *pages = multifd_send_state->pages;
-    uint64_t transferred;
+    int64_t transferred;
 
     if (qatomic_read(&multifd_send_state->exiting)) {
         return -1;
@@ -429,6 +472,14 @@ static int multifd_send_pages(QEMUFile *f)
     for (i = next_channel;; i = (i + 1) % migrate_multifd_channels()) {
         p = &multifd_send_state->params[i];
 
+        /* Skip busy channels without contending for their lock */
+        if (qatomic_read(&p->pending_job)) {
+            if (qatomic_read(&multifd_send_state->exiting)) {
+                return -1;
+            }
+            continue;
+        }
+
         qemu_mutex_lock(&p->mutex);
         if (p->quit) {
             error_report("%s: channel %d has already quit!", __func__, i);
@@ -445,11 +496,14 @@ static int multifd_send_pages(QEMUFile *f)
     assert(!p->pages->used);
     assert(!p->pages->block);
 
+    if (migration_in_postcopy()) {
+        p->flags |= MULTIFD_FLAG_POSTCOPY;
+    }
     p->packet_num = multifd_send_state->packet_num++;
     multifd_send_state->pages = p->pages;
     p->pages = pages;
     transferred = ((uint64_t) pages->used) * qemu_target_page_size()
-                + p->packet_len;
+                + p->packet_len - multifd_collect_zero_pages(p);
     qemu_file_update_transfer(f, transferred);
     ram_counters.multifd_bytes += transferred;
     ram_counters.transferred += transferred;
@@ -459,6 +513,23 @@ static int multifd_send_pages(QEMUFile *f)
     return 1;
 }
 
+/*
+ * Send the pages queued so far without waiting for the packet to fill up.
+ * During postcopy the destination may be waiting for one of them.
+ *
+ * Returns 0 if there was nothing to send, 1 if a packet was sent, or -1
+ * on error
+ */
+int multifd_send_flush(QEMUFile *f)
+{
+    MultiFDPages_t *pages = multifd_send_state->pages;
+
+    if (!pages->used && !pages->zero) {
+        return 0;
+    }
+    return multifd_send_pages(f);
+}
+
 int multifd_queue_page(QEMUFile *f, RAMBlock *block, ram_addr_t offset)
 {
     MultiFDPages_t *pages = multifd_send_state->pages;
@@ -590,6 +661,7 @@ void multifd_send_sync_main(QEMUFile *f)
     }
     for (i = 0; i < migrate_multifd_channels(); i++) {
         MultiFDSendParams *p = &multifd_send_state->params[i];
+        int64_t transferred;
 
         trace_multifd_send_sync_main_signal(p->id);
 
@@ -604,9 +676,10 @@ void multifd_send_sync_main(QEMUFile *f)
         p->packet_num = multifd_send_state->packet_num++;
         p->flags |= MULTIFD_FLAG_SYNC;
         p->pending_job++;
-        qemu_file_update_transfer(f, p->packet_len);
-        ram_counters.multifd_bytes += p->packet_len;
-        ram_counters.transferred += p->packet_len;
+        transferred = p->packet_len - multifd_collect_zero_pages(p);
+        qemu_file_update_transfer(f, transferred);
+        ram_counters.multifd_bytes += transferred;
+        ram_counters.transferred += transferred;
         qemu_mutex_unlock(&p->mutex);
         qemu_sem_post(&p->sem);
     }
@@ -619,6 +692,34 @@ void multifd_send_sync_main(QEMUFile *f)
     trace_multifd_send_sync_main(multifd_send_state->packet_num);
 }
 
+/*
+ * Move the zero pages of @pages after the other ones, which are the only
+ * ones whose content is sent.
+ */
+static void multifd_send_zero_pages(MultiFDPages_t *pages)
+{
+    size_t page_size = qemu_target_page_size();
+    uint32_t i = 0, used = pages->used;
+
+    while (i < used) {
+        if (buffer_is_zero(pages->iov[i].iov_base, page_size)) {
+            ram_addr_t offset = pages->offset[i];
+            struct iovec iov = pages->iov[i];
+
+            used--;
+            pages->offset[i] = pages->offset[used];
+            pages->iov[i] = pages->iov[used];
+            pages->offset[used] = offset;
+            pages->iov[used] = iov;
+        } else {
+            i++;
+        }
+    }
+
+    pages->zero = pages->used - used;
+    pages->used = used;
+}
+
 static void *multifd_send_thread(void *opaque)
 {
     MultiFDSendParams *p = opaque;
@@ -629,12 +730,15 @@ static void *multifd_send_thread(void *opaque)
     trace_multifd_send_thread_start(p->id);
     rcu_register_thread();
 
-    if (multifd_send_initial_packet(p, &local_err) < 0) {
-        ret = -1;
-        goto out;
+    /* The pages of a mapped-ram file go to their offset, without packets */
+    if (!migrate_mapped_ram()) {
+        if (multifd_send_initial_packet(p, &local_err) < 0) {
+            ret = -1;
+            goto out;
+        }
+        /* initial packet */
+        p->num_packets = 1;
     }
-    /* initial packet */
-    p->num_packets = 1;
 
     while (true) {
         qemu_sem_wait(&p->sem);
@@ -649,7 +753,25 @@ static void *multifd_send_thread(void *opaque)
             uint64_t packet_num = p->packet_num;
             flags = p->flags;
 
-            if (used) {
+            if (used && migrate_use_multifd_zero_page()) {
+                multifd_send_zero_pages(p->pages);
+                used = p->pages->used;
+                p->zero_pages += p->pages->zero;
+            }
+
+            if (migrate_mapped_ram()) {
+                /* Nobody else touches the pages while the job is pending */
+                qemu_mutex_unlock(&p->mutex);
+                ret = mapped_ram_write_pages(p->c, p->pages->block,
+                                             p->pages->offset, used,
+                                             p->pages->zero, &local_err);
+                qemu_mutex_lock(&p->mutex);
+                if (ret != 0) {
+                    qemu_mutex_unlock(&p->mutex);
+                    break;
+                }
+            } else if (used || p->pages->zero) {
+                /* methods that cache pages need to see the zero ones too */
                 ret = multifd_send_state->ops->send_prepare(p, used,
                                                             &local_err);
                 if (ret != 0) {
@@ -662,19 +784,22 @@ static void *multifd_send_thread(void *opaque)
             p->num_packets++;
             p->num_pages += used;
             p->pages->used = 0;
+            p->pages->zero = 0;
             p->pages->block = NULL;
             qemu_mutex_unlock(&p->mutex);
 
             trace_multifd_send(p->id, packet_num, used, flags,
                                p->next_packet_size);
 
-            ret = qio_channel_write_all(p->c, (void *)p->packet,
-                                        p->packet_len, &local_err);
-            if (ret != 0) {
-                break;
+            if (!migrate_mapped_ram()) {
+                ret = qio_channel_write_all(p->c, (void *)p->packet,
+                                            p->packet_len, &local_err);
+                if (ret != 0) {
+                    break;
+                }
             }
 
-            if (used) {
+            if (used && !migrate_mapped_ram()) {
                 ret = multifd_send_state->ops->send_write(p, used, &local_err);
                 if (ret != 0) {
                     break;
@@ -686,6 +811,19 @@ static void *multifd_send_thread(void *opaque)
             qemu_mutex_unlock(&p->mutex);
 
             if (flags & MULTIFD_FLAG_SYNC) {
+                /*
+                 * Pages sent without a copy must have left the host
+                 * before the main thread can consider them migrated.
+                 */
+                if (p->write_flags & QIO_CHANNEL_WRITE_FLAG_ZERO_COPY) {
+                    int copied = qio_channel_flush(p->c, &local_err);
+
+                    if (copied < 0) {
+                        ret = -1;
+                        break;
+                    }
+                    trace_multifd_send_zero_copy_flush(p->id, copied);
+                }
                 qemu_sem_post(&p->sem_sync);
             }
             qemu_sem_post(&multifd_send_state->channels_ready);
@@ -851,6 +989,14 @@ static void multifd_new_send_channel_async(QIOTask *task, gpointer opaque)
     if (qio_task_propagate_error(task, &local_err)) {
         goto cleanup;
     } else {
+        /* The cleanup path drops sioc, so p->c must not hold it yet */
+        if ((p->write_flags & QIO_CHANNEL_WRITE_FLAG_ZERO_COPY) &&
+            !qio_channel_has_feature(sioc,
+                                     QIO_CHANNEL_FEATURE_WRITE_ZERO_COPY)) {
+            error_setg(&local_err, "multifd %d: zero copy send is not "
+                       "supported by the host", p->id);
+            goto cleanup;
+        }
         p->c = QIO_CHANNEL(sioc);
         qio_channel_set_delay(p->c, false);
         p->running = true;
@@ -867,13 +1013,19 @@ cleanup:
 int multifd_save_setup(Error **errp)
 {
     int thread_count;
-    uint32_t page_count = MULTIFD_PACKET_SIZE / qemu_target_page_size();
+    uint32_t page_count = multifd_packet_pages();
     uint8_t i;
     MigrationState *s;
 
     if (!migrate_use_multifd()) {
         return 0;
     }
+    if (migrate_mapped_ram() &&
+        migrate_multifd_compression() != MULTIFD_COMPRESSION_NONE) {
+        error_setg(errp, "Mapped RAM is not compatible with multifd "
+                   "compression");
+        return -1;
+    }
     s = migrate_get_current();
     thread_count = migrate_multifd_channels();
     multifd_send_state = g_malloc0(sizeof(*multifd_send_state));
@@ -900,7 +1052,14 @@ int multifd_save_setup(Error **errp)
         p->packet->version = cpu_to_be32(MULTIFD_VERSION);
         p->name = g_strdup_printf("multifdsend_%d", i);
         p->tls_hostname = g_strdup(s->hostname);
-        socket_send_channel_create(multifd_new_send_channel_async, p);
+        if (migrate_use_zero_copy_send()) {
+            p->write_flags = QIO_CHANNEL_WRITE_FLAG_ZERO_COPY;
+        }
+        if (migrate_mapped_ram()) {
+            file_send_channel_create(multifd_new_send_channel_async, p);
+        } else {
+            socket_send_channel_create(multifd_new_send_channel_async, p);
+        }
     }
 
     for (i = 0; i < thread_count; i++) {
@@ -923,6 +1082,8 @@ struct {
     int count;
     /* syncs main thread and channels */
     QemuSemaphore sem_sync;
+    /* set once the destination listens for postcopy page faults */
+    QemuEvent postcopy_listening;
     /* global number of generated multifd packets */
     uint64_t packet_num;
     /* multifd ops */
@@ -961,13 +1122,15 @@ static void multifd_recv_terminate_threads(Error *err)
         }
         qemu_mutex_unlock(&p->mutex);
     }
+    /* Wake up the threads waiting to place postcopy pages */
+    qemu_event_set(&multifd_recv_state->postcopy_listening);
 }
 
 int multifd_load_cleanup(Error **errp)
 {
     int i;
 
-    if (!migrate_use_multifd()) {
+    if (!migrate_use_multifd() || migrate_mapped_ram()) {
         return 0;
     }
     multifd_recv_terminate_threads(NULL);
@@ -1002,9 +1165,13 @@ int multifd_load_cleanup(Error **errp)
         p->packet_len = 0;
         g_free(p->packet);
         p->packet = NULL;
+        qemu_vfree(p->postcopy_buf);
+        p->postcopy_buf = NULL;
+        p->postcopy_buf_pages = 0;
         multifd_recv_state->ops->recv_cleanup(p);
     }
     qemu_sem_destroy(&multifd_recv_state->sem_sync);
+    qemu_event_destroy(&multifd_recv_state->postcopy_listening);
     g_free(multifd_recv_state->params);
     multifd_recv_state->params = NULL;
     g_free(multifd_recv_state);
@@ -1017,7 +1184,7 @@ void multifd_recv_sync_main(void)
 {
     int i;
 
-    if (!migrate_use_multifd()) {
+    if (!migrate_use_multifd() || migrate_mapped_ram()) {
         return;
     }
     for (i = 0; i < migrate_multifd_channels(); i++) {
@@ -1040,6 +1207,136 @@ void multifd_recv_sync_main(void)
     trace_multifd_recv_sync_main(multifd_recv_state->packet_num);
 }
 
+/* Mark the pages received in the last packet in the received bitmap */
+static void multifd_recv_mark_pages(MultiFDPages_t *pages)
+{
+    uint32_t i;
+
+    for (i = 0; i < pages->used; i++) {
+        ramblock_recv_bitmap_set_offset(pages->block, pages->offset[i]);
+    }
+}
+
+/* Clear the zero pages received in the last packet */
+static void multifd_recv_zero_pages(MultiFDPages_t *pages)
+{
+    size_t page_size = qemu_target_page_size();
+    uint32_t i;
+
+    for (i = pages->used; i < pages->used + pages->zero; i++) {
+        void *host = pages->iov[i].iov_base;
+
+        /*
+         * Don't touch pages that were never written, not even to read
+         * them, and don't write to pages that are still zero, not to
+         * allocate them.
+         */
+        if (ramblock_recv_page_untouched(pages->block, pages->offset[i])) {
+            ramblock_recv_bitmap_set_offset(pages->block, pages->offset[i]);
+        } else if (!buffer_is_zero(host, page_size)) {
+            memset(host, 0, page_size);
+        }
+    }
+}
+
+/*
+ * Keep the COLO cache in step like ram_load_precopy() does for the main
+ * stream.  Before the COLO stage, the pages are received in guest memory
+ * and copied to the cache.  During it, they are received in the cache and
+ * recorded for colo_flush_ram_cache().
+ */
+static void multifd_recv_colo_pages(MultiFDPages_t *pages)
+{
+    RAMBlock *block = pages->block;
+    size_t page_size = qemu_target_page_size();
+    bool in_colo = migration_incoming_in_colo_state();
+    uint32_t i;
+
+    for (i = 0; i < pages->used + pages->zero; i++) {
+        ram_addr_t offset = pages->offset[i];
+
+        if (in_colo) {
+            set_bit_atomic(offset >> qemu_target_page_bits(), block->bmap);
+        } else {
+            memcpy(block->colo_cache + offset, block->host + offset,
+                   page_size);
+        }
+    }
+}
+
+/*
+ * Let the channels place the pages received during postcopy; until then
+ * userfaultfd is not armed and UFFDIO_COPY would fail.
+ */
+void multifd_recv_postcopy_listen(void)
+{
+    if (!migrate_use_multifd() || !multifd_recv_state) {
+        return;
+    }
+    qemu_event_set(&multifd_recv_state->postcopy_listening);
+}
+
+/*
+ * Receive the pages of a postcopy packet into a bounce buffer, and place
+ * each of them atomically: a vCPU may fault on them at any time, and
+ * guest memory must not be written to directly.
+ *
+ * Returns 0 for success or -1 for error
+ */
+static int multifd_recv_postcopy_pages(MultiFDRecvParams *p, uint32_t used,
+                                       uint32_t zero, Error **errp)
+{
+    MigrationIncomingState *mis = migration_incoming_get_current();
+    MultiFDPages_t *pages = p->pages;
+    size_t page_size = qemu_target_page_size();
+    uint32_t flags = p->flags & MULTIFD_FLAG_COMPRESSION_MASK;
+    uint32_t i;
+
+    if (flags == MULTIFD_FLAG_XBZRLE) {
+        error_setg(errp, "multifd %d: xbzrle packet received in postcopy",
+                   p->id);
+        return -1;
+    }
+    if (qemu_ram_pagesize(pages->block) != page_size) {
+        error_setg(errp, "multifd %d: postcopy packet for huge page block %s",
+                   p->id, pages->block->idstr);
+        return -1;
+    }
+
+    qemu_event_wait(&multifd_recv_state->postcopy_listening);
+
+    if (used > p->postcopy_buf_pages) {
+        qemu_vfree(p->postcopy_buf);
+        p->postcopy_buf = qemu_memalign(page_size, used * page_size);
+        p->postcopy_buf_pages = used;
+    }
+    for (i = 0; i < used; i++) {
+        pages->iov[i].iov_base = p->postcopy_buf + i * page_size;
+    }
+    if (used && multifd_recv_state->ops->recv_pages(p, used, errp)) {
+        return -1;
+    }
+
+    for (i = 0; i < used + zero; i++) {
+        void *host = pages->block->host + pages->offset[i];
+        int ret;
+
+        if (i < used) {
+            ret = postcopy_place_page(mis, host, pages->iov[i].iov_base,
+                                      pages->block);
+        } else {
+            ret = postcopy_place_page_zero(mis, host, pages->block);
+        }
+        if (ret) {
+            error_setg(errp, "multifd %d: failed to place page at offset "
+                       RAM_ADDR_FMT " of %s", p->id, pages->offset[i],
+                       pages->block->idstr);
+            return -1;
+        }
+    }
+    return 0;
+}
+
 static void *multifd_recv_thread(void *opaque)
 {
     MultiFDRecvParams *p = opaque;
@@ -1051,6 +1348,7 @@ static void *multifd_recv_thread(void *opaque)
 
     while (true) {
         uint32_t used;
+        uint32_t zero;
         uint32_t flags;
 
         if (p->quit) {
@@ -1074,6 +1372,7 @@ static void *multifd_recv_thread(void *opaque)
         }
 
         used = p->pages->used;
+        zero = p->pages->zero;
         flags = p->flags;
         /* recv methods don't know how to handle the SYNC flag */
         p->flags &= ~MULTIFD_FLAG_SYNC;
@@ -1083,11 +1382,26 @@ static void *multifd_recv_thread(void *opaque)
         p->num_pages += used;
         qemu_mutex_unlock(&p->mutex);
 
-        if (used) {
-            ret = multifd_recv_state->ops->recv_pages(p, used, &local_err);
+        if ((flags & MULTIFD_FLAG_POSTCOPY) && (used || zero)) {
+            ret = multifd_recv_postcopy_pages(p, used, zero, &local_err);
             if (ret != 0) {
                 break;
             }
+        } else {
+            if (used) {
+                ret = multifd_recv_state->ops->recv_pages(p, used, &local_err);
+                if (ret != 0) {
+                    break;
+                }
+                multifd_recv_mark_pages(p->pages);
+            }
+
+            if (zero) {
+                multifd_recv_zero_pages(p->pages);
+            }
+            if ((used || zero) && migration_incoming_colo_enabled()) {
+                multifd_recv_colo_pages(p->pages);
+            }
         }
 
         if (flags & MULTIFD_FLAG_SYNC) {
@@ -1113,10 +1427,11 @@ static void *multifd_recv_thread(void *opaque)
 int multifd_load_setup(Error **errp)
 {
     int thread_count;
-    uint32_t page_count = MULTIFD_PACKET_SIZE / qemu_target_page_size();
+    uint32_t page_count = multifd_packet_pages();
     uint8_t i;
 
-    if (!migrate_use_multifd()) {
+    /* The pages of a mapped-ram file are read by ram_load() itself */
+    if (!migrate_use_multifd() || migrate_mapped_ram()) {
         return 0;
     }
     thread_count = migrate_multifd_channels();
@@ -1124,6 +1439,7 @@ int multifd_load_setup(Error **errp)
     multifd_recv_state->params = g_new0(MultiFDRecvParams, thread_count);
     qatomic_set(&multifd_recv_state->count, 0);
     qemu_sem_init(&multifd_recv_state->sem_sync, 0);
+    qemu_event_init(&multifd_recv_state->postcopy_listening, false);
     multifd_recv_state->ops = multifd_ops[migrate_multifd_compression()];
 
     for (i = 0; i < thread_count; i++) {
@@ -1158,7 +1474,7 @@ bool multifd_recv_all_channels_created(void)
 {
     int thread_count = migrate_multifd_channels();
 
-    if (!migrate_use_multifd()) {
+    if (!migrate_use_multifd() || migrate_mapped_ram()) {
         return true;
     }
 
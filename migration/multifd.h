@@ -21,7 +21,10 @@ bool multifd_recv_all_channels_created(void);
 bool multifd_recv_new_channel(QIOChannel *ioc, Error **errp);
 void multifd_recv_sync_main(void);
 void multifd_send_sync_main(QEMUFile *f);
+int multifd_send_flush(QEMUFile *f);
+void multifd_recv_postcopy_listen(void);
 int multifd_queue_page(QEMUFile *f, RAMBlock *block, ram_addr_t offset);
+void multifd_xbzrle_cache_zero_page(ram_addr_t addr);
 
 /* Multifd Compression flags */
 #define MULTIFD_FLAG_SYNC (1 << 0)
@@ -32,9 +35,23 @@ int multifd_queue_page(QEMUFile *f, RAMBlock *block, ram_addr_t offset);
 #define MULTIFD_FLAG_NOCOMP (0 << 1)
 #define MULTIFD_FLAG_ZLIB (1 << 1)
 #define MULTIFD_FLAG_ZSTD (2 << 1)
+#define MULTIFD_FLAG_LZ4 (3 << 1)
+#define MULTIFD_FLAG_XBZRLE (4 << 1)
 
-/* This value needs to be a multiple of qemu_target_page_size() */
+/*
+ * The packet was sent during postcopy: its pages must be placed atomically
+ * in guest memory once the destination is listening for page faults.
+ */
+#define MULTIFD_FLAG_POSTCOPY (1 << 4)
+
+/*
+ * Default and maximum of the multifd-packet-size parameter.  It needs to be
+ * a multiple of qemu_target_page_size().
+ */
 #define MULTIFD_PACKET_SIZE (512 * 1024)
+#define MULTIFD_PACKET_SIZE_MAX (16 * 1024 * 1024)
+
+uint32_t multifd_packet_pages(void);
 
 typedef struct {
     uint32_t magic;
@@ -46,7 +63,13 @@ typedef struct {
     /* size of the next packet that contains pages */
     uint32_t next_packet_size;
     uint64_t packet_num;
-    uint64_t unused[4];    /* Reserved for future use */
+    /*
+     * number of zero pages, only with the multifd-zero-page capability.
+     * Their offsets follow those of the pages_used pages, which carry data.
+     */
+    uint32_t zero_pages;
+    uint32_t unused32;     /* Reserved for future use */
+    uint64_t unused[3];    /* Reserved for future use */
     char ramblock[256];
     uint64_t offset[];
 } __attribute__((packed)) MultiFDPacket_t;
@@ -54,6 +77,8 @@ typedef struct {
 typedef struct {
     /* number of used pages */
     uint32_t used;
+    /* number of zero pages, stored after the used ones */
+    uint32_t zero;
     /* number of allocated pages */
     uint32_t allocated;
     /* global number of generated multifd packets */
@@ -77,6 +102,8 @@ typedef struct {
     QemuThread thread;
     /* communication channel */
     QIOChannel *c;
+    /* flags used to write the pages (QIO_CHANNEL_WRITE_FLAG_*) */
+    int write_flags;
     /* sem where to wait for more work */
     QemuSemaphore sem;
     /* this mutex protects the following parameters */
@@ -104,6 +131,8 @@ typedef struct {
     uint64_t num_packets;
     /* pages sent through this channel */
     uint64_t num_pages;
+    /* zero pages found since the main thread last collected them */
+    uint64_t zero_pages;
     /* syncs main thread and channels */
     QemuSemaphore sem_sync;
     /* used for compression methods */
@@ -145,6 +174,10 @@ typedef struct {
     uint64_t num_pages;
     /* syncs main thread and channels */
     QemuSemaphore sem_sync;
+    /* bounce buffer for the pages placed during postcopy */
+    uint8_t *postcopy_buf;
+    /* number of pages that fit in postcopy_buf */
+    uint32_t postcopy_buf_pages;
     /* used for de-compression methods */
     void *data;
 } MultiFDRecvParams;
@@ -17,12 +17,21 @@
 #include "qapi/qmp/qerror.h"
 #include "qapi/error.h"
 #include "qemu/host-utils.h"
+#include "qemu/atomic.h"
+#include "qemu/thread.h"
 #include "page_cache.h"
 #include "trace.h"
 
 /* the page in cache will not be replaced in two cycles */
 #define CACHED_PAGE_LIFETIME 2
 
+/*
+ * Number of locks for callers that share a cache between threads.  Slot
+ * i is protected by lock i % CACHE_SHARDS, so that threads working on
+ * different parts of the guest rarely wait for each other.
+ */
+#define CACHE_SHARDS 64
+
 typedef struct CacheItem CacheItem;
 
 struct CacheItem {
@@ -36,6 +45,7 @@ struct PageCache {
     size_t page_size;
     size_t max_num_items;
     size_t num_items;
+    QemuMutex shard_lock[CACHE_SHARDS];
 };
 
 PageCache *cache_init(uint64_t new_size, size_t page_size, Error **errp)
@@ -83,6 +93,9 @@ PageCache *cache_init(uint64_t new_size, size_t page_size, Error **errp)
         cache->page_cache[i].it_age = 0;
         cache->page_cache[i].it_addr = -1;
     }
+    for (i = 0; i < CACHE_SHARDS; i++) {
+        qemu_mutex_init(&cache->shard_lock[i]);
+    }
 
     return cache;
 }
@@ -97,6 +110,9 @@ void cache_fini(PageCache *cache)
     for (i = 0; i < cache->max_num_items; i++) {
         g_free(cache->page_cache[i].it_data);
     }
+    for (i = 0; i < CACHE_SHARDS; i++) {
+        qemu_mutex_destroy(&cache->shard_lock[i]);
+    }
 
     g_free(cache->page_cache);
     cache->page_cache = NULL;
@@ -122,6 +138,18 @@ static CacheItem *cache_get_by_addr(const PageCache *cache, uint64_t addr)
     return &cache->page_cache[pos];
 }
 
+void cache_lock(PageCache *cache, uint64_t addr)
+{
+    qemu_mutex_lock(&cache->shard_lock[cache_get_cache_pos(cache, addr) %
+                                       CACHE_SHARDS]);
+}
+
+void cache_unlock(PageCache *cache, uint64_t addr)
+{
+    qemu_mutex_unlock(&cache->shard_lock[cache_get_cache_pos(cache, addr) %
+                                         CACHE_SHARDS]);
+}
+
 uint8_t *get_cached_data(const PageCache *cache, uint64_t addr)
 {
     return cache_get_by_addr(cache, addr)->it_data;
@@ -163,7 +191,7 @@ int cache_insert(PageCache *cache, uint64_t addr, const uint8_t *pdata,
             trace_migration_pagecache_insert();
             return -1;
         }
-        cache->num_items++;
+        qatomic_inc(&cache->num_items);
     }
 
     memcpy(it->it_data, pdata, cache->page_size);
@@ -47,6 +47,26 @@ void cache_fini(PageCache *cache);
 bool cache_is_cached(const PageCache *cache, uint64_t addr,
                      uint64_t current_age);
 
+/**
+ * cache_lock: Lock the part of the cache that holds a page
+ *
+ * Threads that share a cache must hold this lock around the lookup,
+ * insertion and use of the cached data of @addr.  Different pages may
+ * share a lock, so only one may be locked at a time.
+ *
+ * @cache pointer to the PageCache struct
+ * @addr: page addr
+ */
+void cache_lock(PageCache *cache, uint64_t addr);
+
+/**
+ * cache_unlock: Unlock the part of the cache locked by cache_lock()
+ *
+ * @cache pointer to the PageCache struct
+ * @addr: page addr
+ */
+void cache_unlock(PageCache *cache, uint64_t addr);
+
 /**
  * get_cached_data: Get the data cached for an addr
  *
@@ -32,6 +32,8 @@
 #include "trace.h"
 #include "hw/boards.h"
 #include "exec/ramblock.h"
+#include "socket.h"
+#include "qemu-file-channel.h"
 
 /* Arbitrary limit on size of each discard command,
  * keeps them around ~200 bytes
@@ -532,6 +534,17 @@ int postcopy_ram_incoming_cleanup(MigrationIncomingState *mis)
 {
     trace_postcopy_ram_incoming_cleanup_entry();
 
+    /*
+     * The source ends the preemption channel before the main one, so this
+     * only waits for the requested pages that are still in flight.  They
+     * must be placed before userfaults are disabled.
+     */
+    if (mis->have_postcopy_preempt_thread) {
+        qemu_thread_join(&mis->postcopy_preempt_thread);
+        mis->have_postcopy_preempt_thread = false;
+    }
+    mis->postcopy_preempt_ready = false;
+
     if (mis->have_fault_thread) {
         Error *local_err = NULL;
 
@@ -574,6 +587,10 @@ int postcopy_ram_incoming_cleanup(MigrationIncomingState *mis)
         munmap(mis->postcopy_tmp_zero_page, mis->largest_page_size);
         mis->postcopy_tmp_zero_page = NULL;
     }
+    if (mis->postcopy_preempt_tmp_page) {
+        munmap(mis->postcopy_preempt_tmp_page, mis->largest_page_size);
+        mis->postcopy_preempt_tmp_page = NULL;
+    }
     trace_postcopy_ram_incoming_cleanup_blocktime(
             get_postcopy_total_blocktime());
 
@@ -902,7 +919,7 @@ static void *postcopy_ram_fault_thread(void *opaque)
             break;
         }
 
-        if (!mis->to_src_file) {
+        if (!mis->to_src_file && !mis->lazy_restore) {
             /*
              * Possibly someone tells us that the return path is
              * broken already using the event. We should hold until
@@ -979,6 +996,14 @@ static void *postcopy_ram_fault_thread(void *opaque)
                     (uintptr_t)(msg.arg.pagefault.address),
                                 msg.arg.pagefault.feat.ptid, rb);
 
+            if (mis->lazy_restore) {
+                /* The page comes from the file rather than from a source */
+                if (ram_lazy_restore_fault(mis, rb, rb_offset)) {
+                    break;
+                }
+                continue;
+            }
+
 retry:
             /*
              * Send the request to the source - we want to request one
@@ -1128,6 +1153,24 @@ int postcopy_ram_incoming_setup(MigrationIncomingState *mis)
     }
     memset(mis->postcopy_tmp_zero_page, '\0', mis->largest_page_size);
 
+    if (migrate_postcopy_preempt()) {
+        mis->postcopy_preempt_tmp_page = mmap(NULL, mis->largest_page_size,
+                                              PROT_READ | PROT_WRITE,
+                                              MAP_PRIVATE | MAP_ANONYMOUS,
+                                              -1, 0);
+        if (mis->postcopy_preempt_tmp_page == MAP_FAILED) {
+            int e = errno;
+            mis->postcopy_preempt_tmp_page = NULL;
+            error_report("%s: Failed to map postcopy_preempt_tmp_page %s",
+                         __func__, strerror(e));
+            return -e;
+        }
+        mis->postcopy_preempt_ready = true;
+        if (mis->postcopy_qemufile_dst) {
+            postcopy_preempt_thread_start(mis);
+        }
+    }
+
     trace_postcopy_ram_enable_notify();
 
     return 0;
@@ -1443,3 +1486,80 @@ void postcopy_unregister_shared_ufd(struct PostCopyFD *pcfd)
         }
     }
 }
+
+/*
+ * Open the postcopy preemption channel, on the source.  Called by the
+ * migration thread before anything is sent, so that the destination
+ * accepts it right after the main channel.
+ */
+int postcopy_preempt_setup(MigrationState *s, Error **errp)
+{
+    QIOChannel *ioc;
+
+    if (s->parameters.tls_creds && *s->parameters.tls_creds) {
+        error_setg(errp, "Postcopy preemption does not support TLS");
+        return -1;
+    }
+
+    ioc = socket_send_channel_create_sync(errp);
+    if (!ioc) {
+        return -1;
+    }
+    WITH_QEMU_LOCK_GUARD(&s->qemu_file_lock) {
+        s->postcopy_qemufile_src = qemu_fopen_channel_output(ioc);
+    }
+    object_unref(OBJECT(ioc));
+    trace_postcopy_preempt_new_channel();
+    return 0;
+}
+
+static void *postcopy_preempt_thread(void *opaque)
+{
+    MigrationIncomingState *mis = opaque;
+    int ret;
+
+    trace_postcopy_preempt_thread_entry();
+    rcu_register_thread();
+
+    /* Runs until the source ends the channel with RAM_SAVE_FLAG_EOS */
+    WITH_RCU_READ_LOCK_GUARD() {
+        ret = ram_load_postcopy(mis->postcopy_qemufile_dst,
+                                RAM_CHANNEL_POSTCOPY);
+    }
+    if (ret) {
+        error_report("Postcopy preemption channel failed: %s",
+                     strerror(-ret));
+    }
+
+    rcu_unregister_thread();
+    trace_postcopy_preempt_thread_exit(ret);
+    return NULL;
+}
+
+void postcopy_preempt_thread_start(MigrationIncomingState *mis)
+{
+    qemu_thread_create(&mis->postcopy_preempt_thread, "postcopy/preempt",
+                       postcopy_preempt_thread, mis, QEMU_THREAD_JOINABLE);
+    mis->have_postcopy_preempt_thread = true;
+}
+
+/*
+ * Take the postcopy preemption channel, on the destination.  Its pages
+ * are loaded by a thread started once postcopy listens, since requests
+ * can only be answered from then on.
+ */
+void postcopy_preempt_new_channel(MigrationIncomingState *mis, QEMUFile *file)
+{
+    if (mis->postcopy_qemufile_dst) {
+        error_report("%s: unexpected extra migration channel", __func__);
+        qemu_fclose(file);
+        return;
+    }
+
+    mis->postcopy_qemufile_dst = file;
+    trace_postcopy_preempt_new_channel();
+
+    if (mis->postcopy_preempt_ready) {
+        postcopy_preempt_thread_start(mis);
+    }
+}
@@ -179,4 +179,10 @@ int postcopy_wake_shared(struct PostCopyFD *pcfd, uint64_t client_addr,
 int postcopy_request_shared_page(struct PostCopyFD *pcfd, RAMBlock *rb,
                                  uint64_t client_addr, uint64_t offset);
 
+/* Postcopy preemption channel, for the pages requested by the destination */
+int postcopy_preempt_setup(MigrationState *s, Error **errp);
+void postcopy_preempt_new_channel(MigrationIncomingState *mis,
+                                  QEMUFile *file);
+void postcopy_preempt_thread_start(MigrationIncomingState *mis);
+
 #endif
@@ -25,13 +25,20 @@
 #include <zlib.h>
 #include "qemu/error-report.h"
 #include "qemu/iov.h"
+#include "qemu/units.h"
 #include "migration.h"
 #include "qemu-file.h"
 #include "trace.h"
 #include "qapi/error.h"
 
 #define IO_BUF_SIZE 32768
-#define MAX_IOV_SIZE MIN_CONST(IOV_MAX, 64)
+/*
+ * Pages are queued by reference, with their headers in buf, so each page
+ * usually takes two entries.  Flush once either the entries or the bytes
+ * queued run out, so that a writev carries a few megabytes at most.
+ */
+#define MAX_IOV_SIZE MIN_CONST(IOV_MAX, 1024)
+#define MAX_IOV_BYTES (4 * MiB)
 
 struct QEMUFile {
     const QEMUFileOps *ops;
@@ -50,6 +57,8 @@ struct QEMUFile {
     DECLARE_BITMAP(may_free, MAX_IOV_SIZE);
     struct iovec iov[MAX_IOV_SIZE];
     unsigned int iovcnt;
+    /* total length of iov */
+    size_t iov_bytes;
 
     int last_error;
     Error *last_error_obj;
@@ -121,6 +130,149 @@ void qemu_file_set_hooks(QEMUFile *f, const QEMUFileHooks *hooks)
     f->hooks = hooks;
 }
 
+/*
+ * Returns the offset in the channel of the next byte written to a
+ * seekable file, or -1 on error
+ */
+off_t qemu_file_get_offset(QEMUFile *f, Error **errp)
+{
+    assert(qemu_file_is_writable(f) && (f->has_ioc || f->ops->seekable));
+
+    qemu_fflush(f);
+    if (qemu_file_get_error_obj(f, errp)) {
+        return -1;
+    }
+    if (!f->has_ioc) {
+        return f->pos;
+    }
+    return qio_channel_io_seek(QIO_CHANNEL(f->opaque), 0, SEEK_CUR, errp);
+}
+
+/*
+ * Moves a seekable file to @offset of its channel, dropping what was
+ * buffered ahead when reading.
+ *
+ * Returns 0 for success or -1 on error
+ */
+int qemu_file_set_offset(QEMUFile *f, off_t offset, Error **errp)
+{
+    assert(f->has_ioc || f->ops->seekable);
+
+    if (qemu_file_is_writable(f)) {
+        qemu_fflush(f);
+        if (qemu_file_get_error_obj(f, errp)) {
+            return -1;
+        }
+    } else {
+        f->buf_index = 0;
+        f->buf_size = 0;
+    }
+    if (!f->has_ioc) {
+        f->pos = offset;
+        return 0;
+    }
+    if (qio_channel_io_seek(QIO_CHANNEL(f->opaque), offset, SEEK_SET,
+                            errp) < 0) {
+        return -1;
+    }
+    return 0;
+}
+
+/*
+ * Whether the file is not a channel but can still be read and written at any
+ * position, like the VM state area of a block device.  Such files are
+ * accessed out of the stream with the functions below.
+ */
+bool qemu_file_is_seekable(QEMUFile *f)
+{
+    return !f->has_ioc && f->ops->seekable;
+}
+
+/*
+ * Write @len bytes at @pos of a seekable file, bypassing the buffer.
+ *
+ * Returns 0 for success or -1 on error
+ */
+int qemu_file_pwrite(QEMUFile *f, const void *buf, size_t len, int64_t pos,
+                     Error **errp)
+{
+    struct iovec iov = { .iov_base = (void *)buf, .iov_len = len };
+    Error *local_err = NULL;
+    ssize_t ret;
+
+    assert(qemu_file_is_seekable(f) && f->ops->writev_buffer);
+
+    ret = f->ops->writev_buffer(f->opaque, &iov, 1, pos, &local_err);
+    if (ret != len) {
+        if (local_err) {
+            error_propagate(errp, local_err);
+        } else {
+            error_setg_errno(errp, ret < 0 ? -ret : EIO,
+                             "Unable to write at offset %" PRId64, pos);
+        }
+        return -1;
+    }
+    return 0;
+}
+
+/*
+ * Read @len bytes at @pos of a seekable file, bypassing the buffer.
+ *
+ * Returns 0 for success or -1 on error
+ */
+int qemu_file_pread(QEMUFile *f, void *buf, size_t len, int64_t pos,
+                    Error **errp)
+{
+    assert(qemu_file_is_seekable(f) && f->ops->get_buffer);
+
+    while (len) {
+        Error *local_err = NULL;
+        ssize_t ret = f->ops->get_buffer(f->opaque, buf, pos, len, &local_err);
+
+        if (ret <= 0) {
+            if (local_err) {
+                error_propagate(errp, local_err);
+            } else if (ret < 0) {
+                error_setg_errno(errp, -ret, "Unable to read at offset %"
+                                 PRId64, pos);
+            } else {
+                error_setg(errp, "Unexpected end of file at offset %" PRId64,
+                           pos);
+            }
+            return -1;
+        }
+        buf += ret;
+        len -= ret;
+        pos += ret;
+    }
+    return 0;
+}
+
+/*
+ * Read several ranges of a seekable file, in parallel if the file can.
+ *
+ * Returns 0 for success or -1 on error
+ */
+int qemu_file_read_ranges(QEMUFile *f, const QEMUFileRange *ranges,
+                          int count, Error **errp)
+{
+    int i;
+
+    assert(qemu_file_is_seekable(f));
+
+    if (f->ops->read_ranges) {
+        return f->ops->read_ranges(f->opaque, ranges, count, errp) < 0 ?
+               -1 : 0;
+    }
+    for (i = 0; i < count; i++) {
+        if (qemu_file_pread(f, ranges[i].buf, ranges[i].len, ranges[i].pos,
+                            errp)) {
+            return -1;
+        }
+    }
+    return 0;
+}
+
 /*
  * Get last error for stream f with optional Error*
  *
@@ -231,7 +383,7 @@ void qemu_fflush(QEMUFile *f)
         return;
     }
     if (f->iovcnt > 0) {
-        expect = iov_size(f->iov, f->iovcnt);
+        expect = f->iov_bytes;
         ret = f->ops->writev_buffer(f->opaque, f->iov, f->iovcnt, f->pos,
                                     &local_error);
 
@@ -249,6 +401,7 @@ void qemu_fflush(QEMUFile *f)
     }
     f->buf_index = 0;
     f->iovcnt = 0;
+    f->iov_bytes = 0;
 }
 
 void ram_control_before_iterate(QEMUFile *f, uint64_t flags)
@@ -430,8 +583,9 @@ static int add_to_iovec(QEMUFile *f, const uint8_t *buf, size_t size,
         f->iov[f->iovcnt].iov_base = (uint8_t *)buf;
         f->iov[f->iovcnt++].iov_len = size;
     }
+    f->iov_bytes += size;
 
-    if (f->iovcnt >= MAX_IOV_SIZE) {
+    if (f->iovcnt >= MAX_IOV_SIZE || f->iov_bytes >= MAX_IOV_BYTES) {
         qemu_fflush(f);
         return 1;
     }
@@ -649,14 +803,7 @@ int qemu_get_byte(QEMUFile *f)
 
 int64_t qemu_ftell_fast(QEMUFile *f)
 {
-    int64_t ret = f->pos;
-    int i;
-
-    for (i = 0; i < f->iovcnt; i++) {
-        ret += f->iov[i].iov_len;
-    }
-
-    return ret;
+    return f->pos + f->iov_bytes;
 }
 
 int64_t qemu_ftell(QEMUFile *f)
@@ -808,6 +955,7 @@ int qemu_put_qemu_file(QEMUFile *f_des, QEMUFile *f_src)
         qemu_put_buffer(f_des, f_src->buf, f_src->buf_index);
         f_src->buf_index = 0;
         f_src->iovcnt = 0;
+        f_src->iov_bytes = 0;
     }
     return len;
 }
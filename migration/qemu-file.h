@@ -104,6 +104,20 @@ typedef QEMUFile *(QEMURetPathFunc)(void *opaque);
 typedef int (QEMUFileShutdownFunc)(void *opaque, bool rd, bool wr,
                                    Error **errp);
 
+typedef struct QEMUFileRange {
+    void *buf;
+    size_t len;
+    int64_t pos;
+} QEMUFileRange;
+
+/*
+ * Read @count ranges of a seekable file, possibly in parallel.
+ * Returns 0 on success, negative on error.
+ */
+typedef int (QEMUFileReadRangesFunc)(void *opaque,
+                                     const QEMUFileRange *ranges, int count,
+                                     Error **errp);
+
 typedef struct QEMUFileOps {
     QEMUFileGetBufferFunc *get_buffer;
     QEMUFileCloseFunc *close;
@@ -111,6 +125,9 @@ typedef struct QEMUFileOps {
     QEMUFileWritevBufferFunc *writev_buffer;
     QEMURetPathFunc *get_return_path;
     QEMUFileShutdownFunc *shut_down;
+    QEMUFileReadRangesFunc *read_ranges;
+    /* get_buffer and writev_buffer honour @pos, so the file can seek */
+    bool seekable;
 } QEMUFileOps;
 
 typedef struct QEMUFileHooks {
@@ -122,6 +139,15 @@ typedef struct QEMUFileHooks {
 
 QEMUFile *qemu_fopen_ops(void *opaque, const QEMUFileOps *ops, bool has_ioc);
 void qemu_file_set_hooks(QEMUFile *f, const QEMUFileHooks *hooks);
+off_t qemu_file_get_offset(QEMUFile *f, Error **errp);
+int qemu_file_set_offset(QEMUFile *f, off_t offset, Error **errp);
+bool qemu_file_is_seekable(QEMUFile *f);
+int qemu_file_pwrite(QEMUFile *f, const void *buf, size_t len, int64_t pos,
+                     Error **errp);
+int qemu_file_pread(QEMUFile *f, void *buf, size_t len, int64_t pos,
+                    Error **errp);
+int qemu_file_read_ranges(QEMUFile *f, const QEMUFileRange *ranges,
+                          int count, Error **errp);
 int qemu_get_fd(QEMUFile *f);
 int qemu_fclose(QEMUFile *f);
 int64_t qemu_ftell(QEMUFile *f);
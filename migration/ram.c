@@ -28,6 +28,7 @@
 
 #include "qemu/osdep.h"
 #include "qemu/cutils.h"
+#include "qemu/units.h"
 #include "qemu/bitops.h"
 #include "qemu/bitmap.h"
 #include "qemu/main-loop.h"
@@ -54,10 +55,14 @@
 #include "savevm.h"
 #include "qemu/iov.h"
 #include "multifd.h"
+#include "file.h"
+#include "io/channel-file.h"
 #include "sysemu/runstate.h"
 
 #if defined(__linux__)
+#include <poll.h>
 #include "qemu/userfaultfd.h"
+#include "qemu/event_notifier.h"
 #endif /* defined(__linux__) */
 
 /***********************************************************/
@@ -221,6 +226,25 @@ void ramblock_recv_bitmap_set_range(RAMBlock *rb, void *host_addr,
                       nr);
 }
 
+void ramblock_recv_bitmap_set_offset(RAMBlock *rb, uint64_t byte_offset)
+{
+    set_bit_atomic(byte_offset >> TARGET_PAGE_BITS, rb->receivedmap);
+}
+
+/*
+ * Whether the page at @byte_offset of @rb still has the zero contents it
+ * had when the incoming migration started.  Until then nothing writes to
+ * the anonymous memory of a destination (see rom_reset()), so that holds
+ * for the pages that were not received yet.  Must be called before the
+ * page is marked as received.
+ */
+bool ramblock_recv_page_untouched(RAMBlock *rb, uint64_t byte_offset)
+{
+    return rb->fd < 0 && runstate_check(RUN_STATE_INMIGRATE) &&
+           !migration_incoming_colo_enabled() &&
+           !ramblock_recv_bitmap_test_byte_offset(rb, byte_offset);
+}
+
 #define  RAMBLOCK_RECV_BITMAP_ENDING  (0x0123456789abcdefULL)
 
 /*
@@ -307,6 +331,26 @@ struct RAMState {
     RAMBlock *last_seen_block;
     /* Last block from where we have sent data */
     RAMBlock *last_sent_block;
+    /*
+     * Postcopy preemption channel, for the pages requested by the
+     * destination, and the last block sent on it.  They are swapped with
+     * f and last_sent_block while such a page is being sent.
+     */
+    QEMUFile *postcopy_preempt_f;
+    RAMBlock *postcopy_preempt_last_sent_block;
+    /* Whether f is currently the postcopy preemption channel */
+    bool postcopy_preempt_urgent;
+    /* Whether a page requested by the destination is being sent */
+    bool postcopy_requested;
+    /* Last page requested by the destination, to detect sequential faults */
+    RAMBlock *postcopy_last_req_block;
+    unsigned long postcopy_last_req_page;
+    /* Pages sent after each requested one while the faults are sequential */
+    unsigned long postcopy_prefetch_pages;
+    /* Run of contiguous pages not written to the mapped-ram file yet */
+    RAMBlock *mapped_run_block;
+    ram_addr_t mapped_run_start;
+    ram_addr_t mapped_run_len;
     /* Last dirty target page we have sent */
     ram_addr_t last_page;
     /* last ram version we have seen */
@@ -775,18 +819,39 @@ static int save_xbzrle_page(RAMState *rs, uint8_t **current_data,
  * @rb: RAMBlock where to search for dirty pages
  * @start: page where we start the search
  */
+/*
+ * Once most of the guest has been sent, the dirty bitmap is mostly clean.
+ * Skip clean runs with buffer_is_zero(), which is vectorized, rather than
+ * one word at a time.
+ */
+#define BITMAP_SCAN_CHUNK_BITS  (512 * BITS_PER_BYTE)
+
 static inline
 unsigned long migration_bitmap_find_dirty(RAMState *rs, RAMBlock *rb,
                                           unsigned long start)
 {
     unsigned long size = rb->used_length >> TARGET_PAGE_BITS;
     unsigned long *bitmap = rb->bmap;
+    unsigned long end, next;
 
     if (ramblock_is_ignored(rb)) {
         return size;
     }
 
-    return find_next_bit(bitmap, size, start);
+    while (start < size) {
+        end = MIN(QEMU_ALIGN_UP(start + 1, BITMAP_SCAN_CHUNK_BITS), size);
+        if (end - start < BITMAP_SCAN_CHUNK_BITS ||
+            !buffer_is_zero(bitmap + BIT_WORD(start),
+                            BITMAP_SCAN_CHUNK_BITS / BITS_PER_BYTE)) {
+            next = find_next_bit(bitmap, end, start);
+            if (next < end) {
+                return next;
+            }
+        }
+        start = end;
+    }
+
+    return size;
 }
 
 static void migration_clear_memory_region_dirty_bitmap(RAMState *rs,
@@ -870,6 +935,173 @@ static void ramblock_sync_dirty_bitmap(RAMState *rs, RAMBlock *rb)
     rs->num_dirty_pages_period += new_dirty_pages;
 }
 
+/*
+ * On large guests, the dirty bitmap is synced in chunks of this size, by
+ * x-bitmap-sync-threads worker threads together with the migration thread.
+ * It must be a multiple of 64 target pages, so that every chunk keeps the
+ * word-at-a-time path of cpu_physical_memory_sync_dirty_bitmap().
+ */
+#define BITMAP_SYNC_CHUNK  (1 * GiB)
+
+typedef struct {
+    RAMBlock *block;
+    ram_addr_t start;
+    ram_addr_t length;
+} BitmapSyncChunk;
+
+typedef struct {
+    QemuThread thread;
+    /* posted to start a sync, or to quit */
+    QemuSemaphore sem;
+    /* pages this worker found newly dirty in the last sync */
+    uint64_t dirty_pages;
+} BitmapSyncWorker;
+
+static struct {
+    BitmapSyncWorker *workers;
+    int nr_workers;
+    bool quit;
+    /* posted by each worker when it runs out of chunks */
+    QemuSemaphore done;
+    /* chunks of the current sync, and the next one to grab */
+    GArray *chunks;
+    unsigned int next_chunk;
+} bitmap_sync;
+
+static uint64_t bitmap_sync_run_chunks(void)
+{
+    uint64_t dirty_pages = 0;
+    unsigned int i;
+
+    while ((i = qatomic_fetch_inc(&bitmap_sync.next_chunk)) <
+           bitmap_sync.chunks->len) {
+        BitmapSyncChunk *c = &g_array_index(bitmap_sync.chunks,
+                                            BitmapSyncChunk, i);
+
+        dirty_pages += cpu_physical_memory_sync_dirty_bitmap(c->block,
+                                                             c->start,
+                                                             c->length);
+    }
+    return dirty_pages;
+}
+
+static void *bitmap_sync_thread(void *opaque)
+{
+    BitmapSyncWorker *w = opaque;
+
+    rcu_register_thread();
+    while (true) {
+        qemu_sem_wait(&w->sem);
+        if (qatomic_read(&bitmap_sync.quit)) {
+            break;
+        }
+        WITH_RCU_READ_LOCK_GUARD() {
+            w->dirty_pages = bitmap_sync_run_chunks();
+        }
+        qemu_sem_post(&bitmap_sync.done);
+    }
+    rcu_unregister_thread();
+    return NULL;
+}
+
+static void bitmap_sync_threads_setup(void)
+{
+    int i, n = migrate_get_current()->bitmap_sync_threads;
+
+    if (!n) {
+        return;
+    }
+
+    bitmap_sync.workers = g_new0(BitmapSyncWorker, n);
+    bitmap_sync.nr_workers = n;
+    bitmap_sync.quit = false;
+    bitmap_sync.chunks = g_array_new(false, false, sizeof(BitmapSyncChunk));
+    qemu_sem_init(&bitmap_sync.done, 0);
+    for (i = 0; i < n; i++) {
+        qemu_sem_init(&bitmap_sync.workers[i].sem, 0);
+        qemu_thread_create(&bitmap_sync.workers[i].thread, "mig/bitmapsync",
+                           bitmap_sync_thread, &bitmap_sync.workers[i],
+                           QEMU_THREAD_JOINABLE);
+    }
+}
+
+static void bitmap_sync_threads_cleanup(void)
+{
+    int i;
+
+    if (!bitmap_sync.workers) {
+        return;
+    }
+
+    qatomic_set(&bitmap_sync.quit, true);
+    for (i = 0; i < bitmap_sync.nr_workers; i++) {
+        qemu_sem_post(&bitmap_sync.workers[i].sem);
+    }
+    for (i = 0; i < bitmap_sync.nr_workers; i++) {
+        qemu_thread_join(&bitmap_sync.workers[i].thread);
+        qemu_sem_destroy(&bitmap_sync.workers[i].sem);
+    }
+    qemu_sem_destroy(&bitmap_sync.done);
+    g_array_free(bitmap_sync.chunks, true);
+    bitmap_sync.chunks = NULL;
+    g_free(bitmap_sync.workers);
+    bitmap_sync.workers = NULL;
+    bitmap_sync.nr_workers = 0;
+}
+
+/*
+ * Sync the dirty bitmap of all RAMBlocks with the help of the worker
+ * threads.  Returns false, without doing anything, if there are no
+ * workers or the guest is too small for them to help.
+ *
+ * Must be called with the RCU read lock and the bitmap mutex held.
+ */
+static bool migration_bitmap_sync_parallel(RAMState *rs)
+{
+    uint64_t dirty_pages;
+    RAMBlock *block;
+    int i, n;
+
+    if (!bitmap_sync.workers) {
+        return false;
+    }
+
+    g_array_set_size(bitmap_sync.chunks, 0);
+    RAMBLOCK_FOREACH_NOT_IGNORED(block) {
+        ram_addr_t start;
+
+        for (start = 0; start < block->used_length;
+             start += BITMAP_SYNC_CHUNK) {
+            BitmapSyncChunk c = {
+                .block = block,
+                .start = start,
+                .length = MIN(BITMAP_SYNC_CHUNK, block->used_length - start),
+            };
+            g_array_append_val(bitmap_sync.chunks, c);
+        }
+    }
+    if (bitmap_sync.chunks->len < 2) {
+        return false;
+    }
+
+    bitmap_sync.next_chunk = 0;
+    n = MIN(bitmap_sync.nr_workers, bitmap_sync.chunks->len - 1);
+    for (i = 0; i < n; i++) {
+        qemu_sem_post(&bitmap_sync.workers[i].sem);
+    }
+    dirty_pages = bitmap_sync_run_chunks();
+    for (i = 0; i < n; i++) {
+        qemu_sem_wait(&bitmap_sync.done);
+    }
+    for (i = 0; i < n; i++) {
+        dirty_pages += bitmap_sync.workers[i].dirty_pages;
+    }
+
+    rs->migration_dirty_pages += dirty_pages;
+    rs->num_dirty_pages_period += dirty_pages;
+    return true;
+}
+
 /**
  * ram_pagesize_summary: calculate all the pagesizes of a VM
  *
@@ -893,8 +1125,10 @@ uint64_t ram_pagesize_summary(void)
 
 uint64_t ram_get_total_transferred_pages(void)
 {
+    /* with multifd, xbzrle pages are already counted as normal ones */
     return  ram_counters.normal + ram_counters.duplicate +
-                compression_counters.pages + xbzrle_counters.pages;
+                compression_counters.pages +
+                (migrate_use_multifd() ? 0 : xbzrle_counters.pages);
 }
 
 static void migration_update_rates(RAMState *rs, int64_t end_time)
@@ -910,7 +1144,7 @@ static void migration_update_rates(RAMState *rs, int64_t end_time)
         return;
     }
 
-    if (migrate_use_xbzrle()) {
+    if (migrate_use_xbzrle() || migrate_use_multifd_xbzrle()) {
         double encoded_size, unencoded_size;
 
         xbzrle_counters.cache_miss_rate = (double)(xbzrle_counters.cache_miss -
@@ -961,7 +1195,8 @@ static void migration_trigger_throttle(RAMState *rs)
     /* During block migration the auto-converge logic incorrectly detects
      * that ram migration makes no progress. Avoid this by disabling the
      * throttling logic during the bulk phase of block migration. */
-    if (migrate_auto_converge() && !blk_mig_bulk_active()) {
+    if ((migrate_auto_converge() || migrate_dirty_limit()) &&
+        !blk_mig_bulk_active()) {
         /* The following detection logic can be refined later. For now:
            Check to see if the ratio between dirtied bytes and the approx.
            amount of bytes that just got transferred since the last time
@@ -972,8 +1207,16 @@ static void migration_trigger_throttle(RAMState *rs)
             (++rs->dirty_rate_high_cnt >= 2)) {
             trace_migration_throttle();
             rs->dirty_rate_high_cnt = 0;
-            mig_throttle_guest_down(bytes_dirty_period,
-                                    bytes_dirty_threshold);
+            if (migrate_dirty_limit()) {
+                /* The limit adjusts itself, it only needs to be started */
+                if (!cpu_throttle_dirty_limit_active()) {
+                    cpu_throttle_dirty_limit_set(
+                        s->parameters.vcpu_dirty_limit * MiB);
+                }
+            } else {
+                mig_throttle_guest_down(bytes_dirty_period,
+                                        bytes_dirty_threshold);
+            }
         }
     }
 }
@@ -994,8 +1237,10 @@ static void migration_bitmap_sync(RAMState *rs)
 
     qemu_mutex_lock(&rs->bitmap_mutex);
     WITH_RCU_READ_LOCK_GUARD() {
-        RAMBLOCK_FOREACH_NOT_IGNORED(block) {
-            ramblock_sync_dirty_bitmap(rs, block);
+        if (!migration_bitmap_sync_parallel(rs)) {
+            RAMBLOCK_FOREACH_NOT_IGNORED(block) {
+                ramblock_sync_dirty_bitmap(rs, block);
+            }
         }
         ram_counters.remaining = ram_bytes_remaining();
     }
@@ -1223,6 +1468,208 @@ static int ram_save_multifd_page(RAMState *rs, RAMBlock *block,
     return 1;
 }
 
+/*
+ * With mapped-ram, the stream only carries a header for each RAMBlock,
+ * that gives the offsets in the file of the bitmap of the pages present
+ * and of the pages themselves.  Each page is written at its own offset
+ * from the latter every time it is sent, and the bitmap at the end of the
+ * migration.  Pages that are not set in the bitmap are zero.
+ */
+#define MAPPED_RAM_HDR_VERSION 1
+#define MAPPED_RAM_HDR_SIZE    (2 * sizeof(uint32_t) + 2 * sizeof(uint64_t))
+/* Alignment of the pages of each block in the file, enough for O_DIRECT */
+#define MAPPED_RAM_FILE_ALIGN  (1 * MiB)
+/* Blocks smaller than this are restored by a single thread */
+#define MAPPED_RAM_LOAD_CHUNK  (64 * MiB)
+/* Largest write of contiguous pages, and read of a snapshot */
+#define MAPPED_RAM_RUN_MAX     (8 * MiB)
+
+/*
+ * The file is either a file channel, or the VM state area of a block
+ * device when saving or loading an internal snapshot.
+ */
+static bool mapped_ram_file_ok(QEMUFile *f)
+{
+    QIOChannel *ioc = qemu_file_get_ioc(f);
+
+    if (!ioc) {
+        return qemu_file_is_seekable(f);
+    }
+    return object_dynamic_cast(OBJECT(ioc), TYPE_QIO_CHANNEL_FILE);
+}
+
+static int mapped_ram_pwrite(QEMUFile *f, const void *buf, size_t len,
+                             off_t offset, Error **errp)
+{
+    QIOChannel *ioc = qemu_file_get_ioc(f);
+
+    if (!ioc) {
+        return qemu_file_pwrite(f, buf, len, offset, errp);
+    }
+    return file_pwrite_all(ioc, buf, len, offset, errp);
+}
+
+static int mapped_ram_pread(QEMUFile *f, void *buf, size_t len,
+                            off_t offset, Error **errp)
+{
+    QIOChannel *ioc = qemu_file_get_ioc(f);
+
+    if (!ioc) {
+        return qemu_file_pread(f, buf, len, offset, errp);
+    }
+    return file_pread_all(ioc, buf, len, offset, errp);
+}
+
+static size_t mapped_ram_bitmap_size(RAMBlock *block)
+{
+    return BITS_TO_LONGS(block->used_length >> TARGET_PAGE_BITS) *
+           sizeof(unsigned long);
+}
+
+static int mapped_ram_setup_ramblock(QEMUFile *f, RAMBlock *block,
+                                     Error **errp)
+{
+    off_t offset = qemu_file_get_offset(f, errp);
+
+    if (offset < 0) {
+        return -1;
+    }
+    block->bitmap_offset = offset + MAPPED_RAM_HDR_SIZE;
+    block->pages_offset = ROUND_UP(block->bitmap_offset +
+                                   mapped_ram_bitmap_size(block),
+                                   MAPPED_RAM_FILE_ALIGN);
+    if (!ramblock_is_ignored(block)) {
+        block->file_bmap = bitmap_new(block->used_length >> TARGET_PAGE_BITS);
+    }
+
+    qemu_put_be32(f, MAPPED_RAM_HDR_VERSION);
+    qemu_put_be32(f, TARGET_PAGE_SIZE);
+    qemu_put_be64(f, block->bitmap_offset);
+    qemu_put_be64(f, block->pages_offset);
+
+    /* The stream goes on after the pages */
+    return qemu_file_set_offset(f, block->pages_offset + block->used_length,
+                                errp);
+}
+
+static int mapped_ram_write_bitmaps(QEMUFile *f, Error **errp)
+{
+    RAMBlock *block;
+
+    RAMBLOCK_FOREACH_NOT_IGNORED(block) {
+        unsigned long pages = block->used_length >> TARGET_PAGE_BITS;
+        g_autofree unsigned long *le_bitmap = bitmap_new(pages);
+
+        bitmap_to_le(le_bitmap, block->file_bmap, pages);
+        if (mapped_ram_pwrite(f, le_bitmap, mapped_ram_bitmap_size(block),
+                              block->bitmap_offset, errp)) {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+/**
+ * mapped_ram_write_pages: write pages at their offset in the file
+ *
+ * Write @used pages of @block to a mapped-ram file, at once for the runs
+ * of contiguous pages, and drop the @zero pages that follow them in
+ * @offset from the file bitmap.  Called by the multifd channels too.
+ *
+ * Returns 0 for success or -1 for error
+ *
+ * @ioc: channel of the file
+ * @block: block the pages belong to
+ * @offset: offsets of the pages in the block
+ * @used: number of pages with data
+ * @zero: number of zero pages
+ * @errp: pointer to an error
+ */
+int mapped_ram_write_pages(QIOChannel *ioc, RAMBlock *block,
+                           const ram_addr_t *offset, uint32_t used,
+                           uint32_t zero, Error **errp)
+{
+    uint32_t i, start = 0;
+
+    for (i = 1; i <= used; i++) {
+        size_t len;
+
+        if (i < used && offset[i] == offset[i - 1] + TARGET_PAGE_SIZE) {
+            continue;
+        }
+        len = offset[i - 1] + TARGET_PAGE_SIZE - offset[start];
+        if (file_pwrite_all(ioc, block->host + offset[start], len,
+                            block->pages_offset + offset[start], errp)) {
+            return -1;
+        }
+        bitmap_set_atomic(block->file_bmap, offset[start] >> TARGET_PAGE_BITS,
+                          len >> TARGET_PAGE_BITS);
+        start = i;
+    }
+    for (i = used; i < used + zero; i++) {
+        bitmap_test_and_clear_atomic(block->file_bmap,
+                                     offset[i] >> TARGET_PAGE_BITS, 1);
+    }
+    return 0;
+}
+
+/* Write the pending run of pages, if any */
+static int mapped_ram_flush_run(RAMState *rs, Error **errp)
+{
+    RAMBlock *block = rs->mapped_run_block;
+
+    if (!block) {
+        return 0;
+    }
+    rs->mapped_run_block = NULL;
+    if (mapped_ram_pwrite(rs->f, block->host + rs->mapped_run_start,
+                          rs->mapped_run_len,
+                          block->pages_offset + rs->mapped_run_start, errp)) {
+        return -1;
+    }
+    bitmap_set_atomic(block->file_bmap,
+                      rs->mapped_run_start >> TARGET_PAGE_BITS,
+                      rs->mapped_run_len >> TARGET_PAGE_BITS);
+    return 0;
+}
+
+/*
+ * Without multifd, the migration thread writes the pages to the file
+ * itself, a run of contiguous pages at a time.  Zero pages are not written
+ * at all.
+ */
+static int ram_save_mapped_page(RAMState *rs, RAMBlock *block,
+                                ram_addr_t offset)
+{
+    bool zero = buffer_is_zero(block->host + offset, TARGET_PAGE_SIZE);
+    Error *local_err = NULL;
+
+    if (rs->mapped_run_block &&
+        (zero || block != rs->mapped_run_block ||
+         offset != rs->mapped_run_start + rs->mapped_run_len ||
+         rs->mapped_run_len >= MAPPED_RAM_RUN_MAX) &&
+        mapped_ram_flush_run(rs, &local_err)) {
+        error_report_err(local_err);
+        return -EIO;
+    }
+    if (zero) {
+        bitmap_test_and_clear_atomic(block->file_bmap,
+                                     offset >> TARGET_PAGE_BITS, 1);
+        ram_counters.duplicate++;
+        return 1;
+    }
+    if (!rs->mapped_run_block) {
+        rs->mapped_run_block = block;
+        rs->mapped_run_start = offset;
+        rs->mapped_run_len = 0;
+    }
+    rs->mapped_run_len += TARGET_PAGE_SIZE;
+    ram_counters.normal++;
+    ram_counters.transferred += TARGET_PAGE_SIZE;
+    qemu_file_update_transfer(rs->f, TARGET_PAGE_SIZE);
+    return 1;
+}
+
 static bool do_compress_ram_page(QEMUFile *f, z_stream *stream, RAMBlock *block,
                                  ram_addr_t offset, uint8_t *source_buf)
 {
@@ -1447,6 +1894,302 @@ static RAMBlock *unqueue_page(RAMState *rs, ram_addr_t *offset)
 }
 
 #if defined(__linux__)
+/*
+ * Write faults of a background snapshot are normally resolved by the
+ * migration thread, which saves the faulting page from guest memory and
+ * only then removes the protection: a vCPU writing to memory that hasn't
+ * been saved yet waits behind whatever else is in the stream.
+ *
+ * With x-snapshot-fault-threads, a pool of threads reads the faults
+ * instead.  When nothing of the host page has been saved yet, the thread
+ * claims it in the dirty bitmap, copies it into a slot of a bounce ring
+ * and unprotects it right away; the migration thread saves the copy later.
+ * Pages that the migration thread is already saving, and pages that don't
+ * fit a slot, are handed over to the migration thread as before.
+ */
+#define WP_FAULT_RING_SLOTS 256
+
+typedef struct {
+    RAMBlock *block;
+    /* host page aligned, NULL block if nothing could be claimed */
+    ram_addr_t offset;
+    unsigned long npages;
+    bool ready;
+} WPFaultSlot;
+
+typedef struct WPFaultRequest {
+    RAMBlock *block;
+    ram_addr_t offset;
+    QSIMPLEQ_ENTRY(WPFaultRequest) next;
+} WPFaultRequest;
+
+static struct {
+    QemuThread *threads;
+    int nr_threads;
+    bool quit;
+    EventNotifier quit_notifier;
+    /* Protects everything below */
+    QemuMutex lock;
+    /* signalled when a slot is released by the migration thread */
+    QemuCond slot_free;
+    /* signalled when a fault thread is done with its slot */
+    QemuCond slot_ready;
+    size_t slot_size;
+    uint8_t *buf;
+    WPFaultSlot slots[WP_FAULT_RING_SLOTS];
+    unsigned int head;
+    unsigned int count;
+    /* faults left to the migration thread */
+    QSIMPLEQ_HEAD(, WPFaultRequest) requests;
+} wp_fault;
+
+static void wp_fault_defer(RAMBlock *block, ram_addr_t offset)
+{
+    WPFaultRequest *req = g_new(WPFaultRequest, 1);
+
+    req->block = block;
+    req->offset = offset;
+    qemu_mutex_lock(&wp_fault.lock);
+    QSIMPLEQ_INSERT_TAIL(&wp_fault.requests, req, next);
+    qemu_mutex_unlock(&wp_fault.lock);
+}
+
+static void wp_fault_handle(RAMState *rs, void *addr)
+{
+    ram_addr_t offset;
+    RAMBlock *block = qemu_ram_block_from_host(addr, false, &offset);
+    size_t pagesize;
+    unsigned long page, npages;
+    WPFaultSlot *slot;
+    unsigned int idx;
+    bool claimed;
+
+    assert(block && (block->flags & RAM_UF_WRITEPROTECT) != 0);
+    pagesize = qemu_ram_pagesize(block);
+    offset = QEMU_ALIGN_DOWN(offset, pagesize);
+
+    if (pagesize > wp_fault.slot_size || offset >= block->used_length) {
+        wp_fault_defer(block, offset);
+        return;
+    }
+
+    /*
+     * Reserve the slot before claiming the pages, so that the migration
+     * thread never sees them gone from the bitmap but not in the ring.
+     */
+    qemu_mutex_lock(&wp_fault.lock);
+    while (wp_fault.count == WP_FAULT_RING_SLOTS &&
+           !qatomic_read(&wp_fault.quit)) {
+        qemu_cond_wait(&wp_fault.slot_free, &wp_fault.lock);
+    }
+    if (qatomic_read(&wp_fault.quit)) {
+        qemu_mutex_unlock(&wp_fault.lock);
+        return;
+    }
+    idx = (wp_fault.head + wp_fault.count++) % WP_FAULT_RING_SLOTS;
+    slot = &wp_fault.slots[idx];
+    slot->ready = false;
+    qemu_mutex_unlock(&wp_fault.lock);
+
+    /*
+     * The migration thread saves a host page one target page at a time
+     * and unprotects it at the end; only take the host page as a whole,
+     * or the guest could change what it has yet to flush.
+     */
+    page = offset >> TARGET_PAGE_BITS;
+    npages = MIN(pagesize, block->used_length - offset) >> TARGET_PAGE_BITS;
+    qemu_mutex_lock(&rs->bitmap_mutex);
+    claimed = find_next_zero_bit(block->bmap, page + npages, page) >=
+              page + npages;
+    if (claimed) {
+        migration_clear_memory_region_dirty_bitmap_range(rs, block, page,
+                                                         npages);
+        bitmap_clear(block->bmap, page, npages);
+        rs->migration_dirty_pages -= npages;
+    }
+    qemu_mutex_unlock(&rs->bitmap_mutex);
+
+    if (claimed) {
+        memcpy(wp_fault.buf + idx * wp_fault.slot_size, block->host + offset,
+               npages << TARGET_PAGE_BITS);
+    }
+    slot->block = claimed ? block : NULL;
+    slot->offset = offset;
+    slot->npages = npages;
+
+    qemu_mutex_lock(&wp_fault.lock);
+    slot->ready = true;
+    qemu_cond_broadcast(&wp_fault.slot_ready);
+    qemu_mutex_unlock(&wp_fault.lock);
+
+    trace_ram_write_tracking_fault(block->idstr, offset, claimed);
+    if (claimed) {
+        uffd_change_protection(rs->uffdio_fd, block->host + offset, pagesize,
+                               false, false);
+    } else {
+        wp_fault_defer(block, offset);
+    }
+}
+
+static void *wp_fault_thread(void *opaque)
+{
+    RAMState *rs = opaque;
+    struct pollfd pfd[2] = {
+        { .fd = rs->uffdio_fd, .events = POLLIN },
+        { .fd = event_notifier_get_fd(&wp_fault.quit_notifier),
+          .events = POLLIN },
+    };
+
+    rcu_register_thread();
+    while (!qatomic_read(&wp_fault.quit)) {
+        struct uffd_msg uffd_msg;
+        int res;
+
+        if (poll(pfd, ARRAY_SIZE(pfd), -1) <= 0 ||
+            !(pfd[0].revents & POLLIN)) {
+            continue;
+        }
+        /* Other threads were woken up by the same fault */
+        res = uffd_read_events(rs->uffdio_fd, &uffd_msg, 1);
+        if (res < 0) {
+            break;
+        }
+        if (res > 0) {
+            wp_fault_handle(rs, (void *)(uintptr_t)
+                            uffd_msg.arg.pagefault.address);
+        }
+    }
+    rcu_unregister_thread();
+    return NULL;
+}
+
+static void wp_fault_threads_setup(RAMState *rs)
+{
+    int i, n = migrate_get_current()->snapshot_fault_threads;
+
+    if (!n || migrate_mapped_ram()) {
+        return;
+    }
+    if (event_notifier_init(&wp_fault.quit_notifier, false) < 0) {
+        error_report("Failed to create snapshot fault threads, "
+                     "the migration thread will handle write faults");
+        return;
+    }
+
+    wp_fault.quit = false;
+    wp_fault.head = 0;
+    wp_fault.count = 0;
+    wp_fault.slot_size = qemu_real_host_page_size;
+    wp_fault.buf = qemu_memalign(wp_fault.slot_size,
+                                 WP_FAULT_RING_SLOTS * wp_fault.slot_size);
+    QSIMPLEQ_INIT(&wp_fault.requests);
+    qemu_mutex_init(&wp_fault.lock);
+    qemu_cond_init(&wp_fault.slot_free);
+    qemu_cond_init(&wp_fault.slot_ready);
+
+    wp_fault.threads = g_new0(QemuThread, n);
+    wp_fault.nr_threads = n;
+    for (i = 0; i < n; i++) {
+        qemu_thread_create(&wp_fault.threads[i], "mig/snapfault",
+                           wp_fault_thread, rs, QEMU_THREAD_JOINABLE);
+    }
+}
+
+static void wp_fault_threads_cleanup(void)
+{
+    WPFaultRequest *req, *next_req;
+    int i;
+
+    if (!wp_fault.nr_threads) {
+        return;
+    }
+
+    qemu_mutex_lock(&wp_fault.lock);
+    qatomic_set(&wp_fault.quit, true);
+    qemu_cond_broadcast(&wp_fault.slot_free);
+    qemu_mutex_unlock(&wp_fault.lock);
+    event_notifier_set(&wp_fault.quit_notifier);
+    for (i = 0; i < wp_fault.nr_threads; i++) {
+        qemu_thread_join(&wp_fault.threads[i]);
+    }
+    g_free(wp_fault.threads);
+    wp_fault.threads = NULL;
+    wp_fault.nr_threads = 0;
+
+    /* Whatever is left is only there on failure, drop it */
+    QSIMPLEQ_FOREACH_SAFE(req, &wp_fault.requests, next, next_req) {
+        QSIMPLEQ_REMOVE_HEAD(&wp_fault.requests, next);
+        g_free(req);
+    }
+    qemu_vfree(wp_fault.buf);
+    wp_fault.buf = NULL;
+    qemu_cond_destroy(&wp_fault.slot_ready);
+    qemu_cond_destroy(&wp_fault.slot_free);
+    qemu_mutex_destroy(&wp_fault.lock);
+    event_notifier_cleanup(&wp_fault.quit_notifier);
+}
+
+/**
+ * ram_save_wp_fault_copies: save the pages copied by the snapshot fault
+ *   threads
+ *
+ * Returns the number of pages written
+ *
+ * Called with bitmap_mutex held; it is dropped while waiting, because the
+ * fault threads take it to claim their pages.
+ *
+ * @rs: current RAM state
+ * @wait: wait for the copies still in progress
+ */
+static int ram_save_wp_fault_copies(RAMState *rs, bool wait)
+{
+    int pages = 0;
+
+    if (!wp_fault.nr_threads) {
+        return 0;
+    }
+
+    qemu_mutex_lock(&wp_fault.lock);
+    while (wp_fault.count) {
+        WPFaultSlot *slot = &wp_fault.slots[wp_fault.head];
+
+        if (!slot->ready) {
+            if (!wait) {
+                break;
+            }
+            qemu_mutex_unlock(&rs->bitmap_mutex);
+            qemu_cond_wait(&wp_fault.slot_ready, &wp_fault.lock);
+            /* bitmap_mutex is taken before wp_fault.lock */
+            qemu_mutex_unlock(&wp_fault.lock);
+            qemu_mutex_lock(&rs->bitmap_mutex);
+            qemu_mutex_lock(&wp_fault.lock);
+            continue;
+        }
+
+        if (slot->block) {
+            uint8_t *buf = wp_fault.buf + wp_fault.head * wp_fault.slot_size;
+            unsigned long i;
+
+            /* The slot stays ours until head moves past it */
+            qemu_mutex_unlock(&wp_fault.lock);
+            for (i = 0; i < slot->npages; i++) {
+                pages += save_normal_page(rs, slot->block,
+                                          slot->offset +
+                                          (i << TARGET_PAGE_BITS),
+                                          buf + (i << TARGET_PAGE_BITS),
+                                          false);
+            }
+            qemu_mutex_lock(&wp_fault.lock);
+        }
+        wp_fault.head = (wp_fault.head + 1) % WP_FAULT_RING_SLOTS;
+        wp_fault.count--;
+        qemu_cond_signal(&wp_fault.slot_free);
+    }
+    qemu_mutex_unlock(&wp_fault.lock);
+
+    return pages;
+}
+
 /**
  * poll_fault_page: try to get next UFFD write fault page and, if pending fault
  *   is found, return RAM block pointer and page offset
@@ -1468,6 +2211,24 @@ static RAMBlock *poll_fault_page(RAMState *rs, ram_addr_t *offset)
         return NULL;
     }
 
+    if (wp_fault.nr_threads) {
+        WPFaultRequest *req;
+
+        qemu_mutex_lock(&wp_fault.lock);
+        req = QSIMPLEQ_FIRST(&wp_fault.requests);
+        if (req) {
+            QSIMPLEQ_REMOVE_HEAD(&wp_fault.requests, next);
+        }
+        qemu_mutex_unlock(&wp_fault.lock);
+        if (!req) {
+            return NULL;
+        }
+        block = req->block;
+        *offset = req->offset;
+        g_free(req);
+        return block;
+    }
+
     res = uffd_read_events(rs->uffdio_fd, &uffd_msg, 1);
     if (res <= 0) {
         return NULL;
@@ -1501,6 +2262,15 @@ static int ram_save_release_protection(RAMState *rs, PageSearchStatus *pss,
 
         /* Flush async buffers before un-protect. */
         qemu_fflush(rs->f);
+        /* mapped-ram holds back a run of pages, write it out too */
+        if (migrate_mapped_ram()) {
+            Error *local_err = NULL;
+
+            if (mapped_ram_flush_run(rs, &local_err)) {
+                error_report_err(local_err);
+                return -EIO;
+            }
+        }
         /* Un-protect memory range. */
         res = uffd_change_protection(rs->uffdio_fd, page_address, run_length,
                 false, false);
@@ -1658,6 +2428,7 @@ int ram_write_tracking_start(void)
                 block->host, block->max_length);
     }
 
+    wp_fault_threads_setup(rs);
     return 0;
 
 fail:
@@ -1692,6 +2463,8 @@ void ram_write_tracking_stop(void)
     RAMState *rs = ram_state;
     RAMBlock *block;
 
+    wp_fault_threads_cleanup();
+
     RCU_READ_LOCK_GUARD();
 
     RAMBLOCK_FOREACH_NOT_IGNORED(block) {
@@ -1719,6 +2492,11 @@ void ram_write_tracking_stop(void)
 #else
 /* No target OS support, stubs just fail or ignore */
 
+static int ram_save_wp_fault_copies(RAMState *rs, bool wait)
+{
+    return 0;
+}
+
 static RAMBlock *poll_fault_page(RAMState *rs, ram_addr_t *offset)
 {
     (void) rs;
@@ -1792,6 +2570,13 @@ static bool get_queued_page(RAMState *rs, PageSearchStatus *pss)
             if (!dirty) {
                 trace_get_queued_page_not_dirty(block->idstr, (uint64_t)offset,
                                                 page);
+                /*
+                 * The page may still be waiting for the multifd packet
+                 * it was queued in to fill up.
+                 */
+                if (migrate_multifd_postcopy() && migration_in_postcopy()) {
+                    multifd_send_flush(rs->f);
+                }
             } else {
                 trace_get_queued_page(block->idstr, (uint64_t)offset, page);
             }
@@ -1974,43 +2759,70 @@ static bool save_compress_page(RAMState *rs, RAMBlock *block, ram_addr_t offset)
  * @pss: data about the page we want to send
  * @last_stage: if we are at the completion stage
  */
+/*
+ * Whether the page can go through multifd during postcopy.  Each page
+ * sent there must be a whole host page, that the destination places on
+ * its own; requested pages stay on the main stream, which is not held
+ * back by the multifd packets.
+ */
+static bool postcopy_use_multifd(RAMState *rs, RAMBlock *block)
+{
+    return migrate_multifd_postcopy() && !rs->postcopy_requested &&
+           qemu_ram_pagesize(block) == TARGET_PAGE_SIZE &&
+           !migrate_use_multifd_xbzrle();
+}
+
 static int ram_save_target_page(RAMState *rs, PageSearchStatus *pss,
                                 bool last_stage)
 {
     RAMBlock *block = pss->block;
     ram_addr_t offset = ((ram_addr_t)pss->page) << TARGET_PAGE_BITS;
+    bool use_multifd;
     int res;
 
     if (control_save_page(rs, block, offset, &res)) {
         return res;
     }
 
-    if (save_compress_page(rs, block, offset)) {
-        return 1;
+    if (migrate_mapped_ram() && !migrate_use_multifd()) {
+        return ram_save_mapped_page(rs, block, offset);
     }
 
-    res = save_zero_page(rs, block, offset);
-    if (res > 0) {
-        /* Must let xbzrle know, otherwise a previous (now 0'd) cached
-         * page would be stale
-         */
-        if (!save_page_use_compression(rs)) {
-            XBZRLE_cache_lock();
-            xbzrle_cache_zero_page(rs, block->offset + offset);
-            XBZRLE_cache_unlock();
-        }
-        ram_release_pages(block->idstr, offset, res);
-        return res;
+    if (save_compress_page(rs, block, offset)) {
+        return 1;
     }
 
     /*
      * Do not use multifd for:
      * 1. Compression as the first page in the new block should be posted out
      *    before sending the compressed page
-     * 2. In postcopy as one whole host page should be placed
+     * 2. In postcopy as one whole host page should be placed, unless
+     *    postcopy_use_multifd() allows it
      */
-    if (!save_page_use_compression(rs) && migrate_use_multifd()
-        && !migration_in_postcopy()) {
+    use_multifd = !save_page_use_compression(rs) && migrate_use_multifd() &&
+                  (!migration_in_postcopy() ||
+                   postcopy_use_multifd(rs, block));
+
+    /* The multifd channels look for zero pages themselves if asked to */
+    if (!use_multifd || !migrate_use_multifd_zero_page()) {
+        res = save_zero_page(rs, block, offset);
+        if (res > 0) {
+            /* Must let xbzrle know, otherwise a previous (now 0'd) cached
+             * page would be stale
+             */
+            if (use_multifd && migrate_use_multifd_xbzrle()) {
+                multifd_xbzrle_cache_zero_page(block->offset + offset);
+            } else if (!save_page_use_compression(rs)) {
+                XBZRLE_cache_lock();
+                xbzrle_cache_zero_page(rs, block->offset + offset);
+                XBZRLE_cache_unlock();
+            }
+            ram_release_pages(block->idstr, offset, res);
+            return res;
+        }
+    }
+
+    if (use_multifd) {
         return ram_save_multifd_page(rs, block, offset);
     }
 
@@ -2051,32 +2863,143 @@ static int ram_save_host_page(RAMState *rs, PageSearchStatus *pss,
         return 0;
     }
 
-    do {
-        /* Check the pages is dirty and if it is send it */
-        if (migration_bitmap_clear_dirty(rs, pss->block, pss->page)) {
-            tmppages = ram_save_target_page(rs, pss, last_stage);
-            if (tmppages < 0) {
-                return tmppages;
-            }
+    do {
+        /* Check the pages is dirty and if it is send it */
+        if (migration_bitmap_clear_dirty(rs, pss->block, pss->page)) {
+            tmppages = ram_save_target_page(rs, pss, last_stage);
+            if (tmppages < 0) {
+                return tmppages;
+            }
+
+            pages += tmppages;
+            /*
+             * Allow rate limiting to happen in the middle of huge pages if
+             * something is sent in the current iteration.  Requested pages
+             * on the preemption channel are never delayed.
+             */
+            if (pagesize_bits > 1 && tmppages > 0 &&
+                !rs->postcopy_preempt_urgent) {
+                migration_rate_limit();
+            }
+        }
+        pss->page = migration_bitmap_find_dirty(rs, pss->block, pss->page);
+    } while ((pss->page < hostpage_boundary) &&
+             offset_in_ramblock(pss->block,
+                                ((ram_addr_t)pss->page) << TARGET_PAGE_BITS));
+    /* The offset we leave with is the min boundary of host page and block */
+    pss->page = MIN(pss->page, hostpage_boundary) - 1;
+
+    res = ram_save_release_protection(rs, pss, start_page);
+    return (res < 0 ? res : pages);
+}
+
+/*
+ * Switch rs->f between the main channel and the postcopy preemption one.
+ * Each keeps its own last sent block, since the destination tracks
+ * RAM_SAVE_FLAG_CONTINUE per channel.
+ */
+static void postcopy_preempt_swap_channel(RAMState *rs)
+{
+    QEMUFile *f = rs->f;
+    RAMBlock *block = rs->last_sent_block;
+
+    rs->f = rs->postcopy_preempt_f;
+    rs->last_sent_block = rs->postcopy_preempt_last_sent_block;
+    rs->postcopy_preempt_f = f;
+    rs->postcopy_preempt_last_sent_block = block;
+    rs->postcopy_preempt_urgent = !rs->postcopy_preempt_urgent;
+}
+
+/* Bounds of the prefetch window after a requested page, in target pages */
+#define POSTCOPY_PREFETCH_MIN 16
+#define POSTCOPY_PREFETCH_MAX ((1 * MiB) >> TARGET_PAGE_BITS)
+
+/*
+ * Grow the prefetch window while the destination faults on ascending
+ * pages close to the previous request, and drop it as soon as it faults
+ * elsewhere: random accesses would only have the prefetched pages delay
+ * the next request.  Huge page blocks send enough with each host page.
+ */
+static void postcopy_prefetch_update(RAMState *rs, RAMBlock *block,
+                                     unsigned long page)
+{
+    unsigned long window = rs->postcopy_prefetch_pages;
+    size_t pagesize_bits = qemu_ram_pagesize(block) >> TARGET_PAGE_BITS;
+
+    if (block == rs->postcopy_last_req_block &&
+        page > rs->postcopy_last_req_page &&
+        page - rs->postcopy_last_req_page <=
+        2 * window + POSTCOPY_PREFETCH_MIN &&
+        pagesize_bits < POSTCOPY_PREFETCH_MAX) {
+        window = MIN(MAX(2 * window, POSTCOPY_PREFETCH_MIN),
+                     POSTCOPY_PREFETCH_MAX);
+    } else {
+        window = 0;
+    }
+    rs->postcopy_prefetch_pages = window;
+    rs->postcopy_last_req_block = block;
+    rs->postcopy_last_req_page = page;
+}
+
+/*
+ * Send a page requested by the destination, and the dirty pages that
+ * follow it in the prefetch window.  They go on the postcopy preemption
+ * channel if there is one, so that they don't wait behind the pages
+ * already queued on the main one.
+ */
+static int ram_save_requested_page(RAMState *rs, PageSearchStatus *pss,
+                                   bool last_stage)
+{
+    bool preempt = rs->postcopy_preempt_f;
+    unsigned long end;
+    int pages, tmppages, ret;
+
+    postcopy_prefetch_update(rs, pss->block, pss->page);
+    trace_ram_save_requested_page(pss->block->idstr, pss->page,
+                                  rs->postcopy_prefetch_pages);
+
+    if (preempt) {
+        postcopy_preempt_swap_channel(rs);
+    }
+    rs->postcopy_requested = true;
+
+    pages = ram_save_host_page(rs, pss, last_stage);
+    end = pss->page + 1 + rs->postcopy_prefetch_pages;
+    while (pages >= 0) {
+        unsigned long page;
+
+        page = migration_bitmap_find_dirty(rs, pss->block, pss->page + 1);
+        if (page >= end ||
+            !offset_in_ramblock(pss->block,
+                                ((ram_addr_t)page) << TARGET_PAGE_BITS)) {
+            break;
+        }
+        pss->page = page;
+        tmppages = ram_save_host_page(rs, pss, last_stage);
+        if (tmppages < 0) {
+            pages = tmppages;
+            break;
+        }
+        pages += tmppages;
+    }
+
+    rs->postcopy_requested = false;
+    if (!preempt) {
+        return pages;
+    }
 
-            pages += tmppages;
-            /*
-             * Allow rate limiting to happen in the middle of huge pages if
-             * something is sent in the current iteration.
-             */
-            if (pagesize_bits > 1 && tmppages > 0) {
-                migration_rate_limit();
-            }
-        }
-        pss->page = migration_bitmap_find_dirty(rs, pss->block, pss->page);
-    } while ((pss->page < hostpage_boundary) &&
-             offset_in_ramblock(pss->block,
-                                ((ram_addr_t)pss->page) << TARGET_PAGE_BITS));
-    /* The offset we leave with is the min boundary of host page and block */
-    pss->page = MIN(pss->page, hostpage_boundary) - 1;
+    qemu_fflush(rs->f);
+    ret = qemu_file_get_error(rs->f);
+    postcopy_preempt_swap_channel(rs);
 
-    res = ram_save_release_protection(rs, pss, start_page);
-    return (res < 0 ? res : pages);
+    if (ret) {
+        /*
+         * The page is lost; fail the main channel too, so that postcopy
+         * recovery resends whatever the destination did not receive.
+         */
+        qemu_file_set_error(rs->f, ret);
+    }
+    return pages;
 }
 
 /**
@@ -2105,6 +3028,12 @@ static int ram_find_and_save_block(RAMState *rs, bool last_stage)
         return pages;
     }
 
+    /* Pages copied away from write faults go first */
+    pages = ram_save_wp_fault_copies(rs, false);
+    if (pages) {
+        return pages;
+    }
+
     pss.block = rs->last_seen_block;
     pss.page = rs->last_page;
     pss.complete_round = false;
@@ -2117,6 +3046,11 @@ static int ram_find_and_save_block(RAMState *rs, bool last_stage)
         again = true;
         found = get_queued_page(rs, &pss);
 
+        if (found && migration_in_postcopy()) {
+            pages = ram_save_requested_page(rs, &pss, last_stage);
+            continue;
+        }
+
         if (!found) {
             /* priority queue empty, so just search for something dirty */
             found = find_dirty_block(rs, &pss, &again);
@@ -2130,6 +3064,11 @@ static int ram_find_and_save_block(RAMState *rs, bool last_stage)
     rs->last_seen_block = pss.block;
     rs->last_page = pss.page;
 
+    if (!pages) {
+        /* The last dirty pages may have been claimed by a fault thread */
+        pages = ram_save_wp_fault_copies(rs, true);
+    }
+
     return pages;
 }
 
@@ -2226,10 +3165,13 @@ static void ram_save_cleanup(void *opaque)
         block->clear_bmap = NULL;
         g_free(block->bmap);
         block->bmap = NULL;
+        g_free(block->file_bmap);
+        block->file_bmap = NULL;
     }
 
     xbzrle_cleanup();
     compress_threads_save_cleanup();
+    bitmap_sync_threads_cleanup();
     ram_state_cleanup(rsp);
 }
 
@@ -2237,6 +3179,10 @@ static void ram_state_reset(RAMState *rs)
 {
     rs->last_seen_block = NULL;
     rs->last_sent_block = NULL;
+    rs->postcopy_preempt_last_sent_block = NULL;
+    rs->postcopy_last_req_block = NULL;
+    rs->postcopy_last_req_page = 0;
+    rs->postcopy_prefetch_pages = 0;
     rs->last_page = 0;
     rs->last_version = ram_list.version;
     rs->xbzrle_enabled = false;
@@ -2670,8 +3616,59 @@ static void ram_list_init_bitmaps(void)
     }
 }
 
+static void dirty_bitmap_clear_section(MemoryRegionSection *section,
+                                       void *opaque)
+{
+    const hwaddr offset = section->offset_within_region;
+    const hwaddr size = int128_get64(section->size);
+    const unsigned long start = offset >> TARGET_PAGE_BITS;
+    const unsigned long npages = size >> TARGET_PAGE_BITS;
+    RAMBlock *rb = section->mr->ram_block;
+    uint64_t *cleared_bits = opaque;
+
+    /*
+     * No need to take the bitmap mutex: this only runs while setting up
+     * the bitmaps, before the migration thread starts sending pages.
+     */
+    if (!migrate_background_snapshot()) {
+        migration_clear_memory_region_dirty_bitmap_range(ram_state, rb, start,
+                                                         npages);
+    }
+    *cleared_bits += bitmap_count_one_with_offset(rb->bmap, start, npages);
+    bitmap_clear(rb->bmap, start, npages);
+}
+
+/*
+ * Exclude from migration the pages that a RamDiscardManager (virtio-mem)
+ * reports as discarded.  Their content is undefined, and merely reading
+ * them would populate memory that the guest gave back.  The plugged state
+ * cannot change while migration is running.
+ *
+ * Returns the number of bits cleared in the dirty bitmap of @rb.
+ */
+static uint64_t ramblock_dirty_bitmap_clear_discarded_pages(RAMBlock *rb)
+{
+    uint64_t cleared_bits = 0;
+
+    if (rb->mr && rb->bmap && memory_region_has_ram_discard_manager(rb->mr)) {
+        RamDiscardManager *rdm = memory_region_get_ram_discard_manager(rb->mr);
+        MemoryRegionSection section = {
+            .mr = rb->mr,
+            .offset_within_region = 0,
+            .size = int128_make64(qemu_ram_get_used_length(rb)),
+        };
+
+        ram_discard_manager_replay_discarded(rdm, &section,
+                                             dirty_bitmap_clear_section,
+                                             &cleared_bits);
+    }
+    return cleared_bits;
+}
+
 static void ram_init_bitmaps(RAMState *rs)
 {
+    RAMBlock *block;
+
     /* For memory_global_dirty_log_start below.  */
     qemu_mutex_lock_iothread();
     qemu_mutex_lock_ramlist();
@@ -2683,6 +3680,11 @@ static void ram_init_bitmaps(RAMState *rs)
             memory_global_dirty_log_start();
             migration_bitmap_sync_precopy(rs);
         }
+
+        RAMBLOCK_FOREACH_NOT_IGNORED(block) {
+            rs->migration_dirty_pages -=
+                ramblock_dirty_bitmap_clear_discarded_pages(block);
+        }
     }
     qemu_mutex_unlock_ramlist();
     qemu_mutex_unlock_iothread();
@@ -2727,6 +3729,8 @@ static void ram_state_resume_prepare(RAMState *rs, QEMUFile *out)
 
     /* Update RAMState cache of output QEMUFile */
     rs->f = out;
+    /* The requested pages go through the new main channel from now on */
+    rs->postcopy_preempt_f = NULL;
 
     trace_ram_state_resume_prepare(pages);
 }
@@ -2805,19 +3809,28 @@ static int ram_save_setup(QEMUFile *f, void *opaque)
 {
     RAMState **rsp = opaque;
     RAMBlock *block;
+    Error *local_err = NULL;
+
+    if (migrate_mapped_ram() && !mapped_ram_file_ok(f)) {
+        error_report("Mapped RAM requires migrating to a file");
+        return -1;
+    }
 
     if (compress_threads_save_setup()) {
         return -1;
     }
+    bitmap_sync_threads_setup();
 
     /* migration has already setup the bitmap, reuse it. */
     if (!migration_in_colo_state()) {
         if (ram_init_all(rsp) != 0) {
+            bitmap_sync_threads_cleanup();
             compress_threads_save_cleanup();
             return -1;
         }
     }
     (*rsp)->f = f;
+    (*rsp)->postcopy_preempt_f = migrate_get_current()->postcopy_qemufile_src;
 
     WITH_RCU_READ_LOCK_GUARD() {
         qemu_put_be64(f, ram_bytes_total_common(true) | RAM_SAVE_FLAG_MEM_SIZE);
@@ -2833,6 +3846,11 @@ static int ram_save_setup(QEMUFile *f, void *opaque)
             if (migrate_ignore_shared()) {
                 qemu_put_be64(f, block->mr->addr);
             }
+            if (migrate_mapped_ram() &&
+                mapped_ram_setup_ramblock(f, block, &local_err)) {
+                error_report_err(local_err);
+                return -1;
+            }
         }
     }
 
@@ -2872,8 +3890,9 @@ static int ram_save_iterate(QEMUFile *f, void *opaque)
 
     /*
      * We'll take this lock a little bit long, but it's okay for two reasons.
-     * Firstly, the only possible other thread to take it is who calls
-     * qemu_guest_free_page_hint(), which should be rare; secondly, see
+     * Firstly, the only possible other threads to take it are who calls
+     * qemu_guest_free_page_hint(), which should be rare, and the snapshot
+     * fault threads, whose claims must not race with ours; secondly, see
      * MAX_WAIT (if curious, further see commit 4508bd9ed8053ce) below, which
      * guarantees that we'll at least released it in a regular basis.
      */
@@ -2988,6 +4007,7 @@ static int ram_save_complete(QEMUFile *f, void *opaque)
         /* try transferring iterative blocks of memory */
 
         /* flush all remaining blocks regardless of rate limiting */
+        qemu_mutex_lock(&rs->bitmap_mutex);
         while (true) {
             int pages;
 
@@ -3001,6 +4021,7 @@ static int ram_save_complete(QEMUFile *f, void *opaque)
                 break;
             }
         }
+        qemu_mutex_unlock(&rs->bitmap_mutex);
 
         flush_compressed_data(rs);
         ram_control_after_iterate(f, RAM_CONTROL_FINISH);
@@ -3008,6 +4029,20 @@ static int ram_save_complete(QEMUFile *f, void *opaque)
 
     if (ret >= 0) {
         multifd_send_sync_main(rs->f);
+        if (migrate_mapped_ram()) {
+            Error *local_err = NULL;
+
+            if (mapped_ram_flush_run(rs, &local_err) ||
+                mapped_ram_write_bitmaps(f, &local_err)) {
+                error_report_err(local_err);
+                return -EIO;
+            }
+        }
+        if (rs->postcopy_preempt_f) {
+            /* Let the destination's preemption thread finish */
+            qemu_put_be64(rs->postcopy_preempt_f, RAM_SAVE_FLAG_EOS);
+            qemu_fflush(rs->postcopy_preempt_f);
+        }
         qemu_put_be64(f, RAM_SAVE_FLAG_EOS);
         qemu_fflush(f);
     }
@@ -3087,14 +4122,18 @@ static int load_xbzrle(QEMUFile *f, ram_addr_t addr, void *host)
  *
  * @f: QEMUFile where to read the data from
  * @flags: Page flags (mostly to see if it's a continuation of previous block)
+ * @channel: the channel that @f belongs to, RAM_CHANNEL_*
  */
-static inline RAMBlock *ram_block_from_stream(QEMUFile *f, int flags)
+static inline RAMBlock *ram_block_from_stream(QEMUFile *f, int flags,
+                                              int channel)
 {
-    static RAMBlock *block;
+    MigrationIncomingState *mis = migration_incoming_get_current();
+    RAMBlock *block;
     char id[256];
     uint8_t len;
 
     if (flags & RAM_SAVE_FLAG_CONTINUE) {
+        block = mis->last_recv_block[channel];
         if (!block) {
             error_report("Ack, bad migration stream!");
             return NULL;
@@ -3117,6 +4156,8 @@ static inline RAMBlock *ram_block_from_stream(QEMUFile *f, int flags)
         return NULL;
     }
 
+    mis->last_recv_block[channel] = block;
+
     return block;
 }
 
@@ -3159,10 +4200,11 @@ static inline void *colo_cache_from_block_offset(RAMBlock *block,
     /*
     * During colo checkpoint, we need bitmap of these migrated pages.
     * It help us to decide which pages in ram cache should be flushed
-    * into VM's RAM later.
+    * into VM's RAM later.  Multifd channels set bits of the bitmap
+    * concurrently, so that must be atomic.
     */
-    if (record_bitmap &&
-        !test_and_set_bit(offset >> TARGET_PAGE_BITS, block->bmap)) {
+    if (record_bitmap && !test_bit(offset >> TARGET_PAGE_BITS, block->bmap)) {
+        set_bit_atomic(offset >> TARGET_PAGE_BITS, block->bmap);
         ram_state->migration_dirty_pages++;
     }
     return block->colo_cache + offset;
@@ -3486,6 +4528,8 @@ static int ram_load_setup(QEMUFile *f, void *opaque)
     return 0;
 }
 
+static void ram_lazy_restore_load_done(void);
+
 static int ram_load_cleanup(void *opaque)
 {
     RAMBlock *rb;
@@ -3497,6 +4541,11 @@ static int ram_load_cleanup(void *opaque)
     xbzrle_load_cleanup();
     compress_threads_load_cleanup();
 
+    if (migration_incoming_get_current()->lazy_restore) {
+        /* Still needed to resolve faults, freed at the end of it */
+        ram_lazy_restore_load_done();
+        return 0;
+    }
     RAMBLOCK_FOREACH_NOT_IGNORED(rb) {
         g_free(rb->receivedmap);
         rb->receivedmap = NULL;
@@ -3526,19 +4575,23 @@ int ram_postcopy_incoming_init(MigrationIncomingState *mis)
  *
  * Returns 0 for success or -errno in case of error
  *
- * Called in postcopy mode by ram_load().
+ * Called in postcopy mode by ram_load(), and by the postcopy preemption
+ * thread.
  * rcu_read_lock is taken prior to this being called.
  *
  * @f: QEMUFile where to send the data
+ * @channel: the channel that @f belongs to, RAM_CHANNEL_*
  */
-static int ram_load_postcopy(QEMUFile *f)
+int ram_load_postcopy(QEMUFile *f, int channel)
 {
     int flags = 0, ret = 0;
     bool place_needed = false;
     bool matches_target_page_size = false;
     MigrationIncomingState *mis = migration_incoming_get_current();
     /* Temporary page that is later 'placed' */
-    void *postcopy_host_page = mis->postcopy_tmp_page;
+    void *postcopy_host_page = channel == RAM_CHANNEL_POSTCOPY ?
+                               mis->postcopy_preempt_tmp_page :
+                               mis->postcopy_tmp_page;
     void *host_page = NULL;
     bool all_zero = true;
     int target_pages = 0;
@@ -3568,7 +4621,7 @@ static int ram_load_postcopy(QEMUFile *f)
         trace_ram_load_postcopy_loop((uint64_t)addr, flags);
         if (flags & (RAM_SAVE_FLAG_ZERO | RAM_SAVE_FLAG_PAGE |
                      RAM_SAVE_FLAG_COMPRESS_PAGE)) {
-            block = ram_block_from_stream(f, flags);
+            block = ram_block_from_stream(f, flags, channel);
             if (!block) {
                 ret = -EINVAL;
                 break;
@@ -3715,16 +4768,57 @@ static bool postcopy_is_running(void)
     return ps >= POSTCOPY_INCOMING_LISTENING && ps < POSTCOPY_INCOMING_END;
 }
 
+/* The cache is flushed in chunks of this size, a multiple of a bitmap word */
+#define COLO_FLUSH_CHUNK  (32 * MiB)
+
+typedef struct ColoFlushChunk {
+    RAMBlock *block;
+    /* range of pages of the chunk */
+    unsigned long start;
+    unsigned long end;
+} ColoFlushChunk;
+
+typedef struct ColoFlush {
+    GArray *chunks;
+    /* next chunk to flush */
+    unsigned int next;
+} ColoFlush;
+
+static void *colo_flush_thread(void *opaque)
+{
+    ColoFlush *flush = opaque;
+    unsigned int i;
+
+    while ((i = qatomic_fetch_inc(&flush->next)) < flush->chunks->len) {
+        ColoFlushChunk *c = &g_array_index(flush->chunks, ColoFlushChunk, i);
+        unsigned long run, next = c->start;
+
+        while ((run = find_next_bit(c->block->bmap, c->end, next)) < c->end) {
+            next = find_next_zero_bit(c->block->bmap, c->end, run);
+            memcpy(c->block->host + (run << TARGET_PAGE_BITS),
+                   c->block->colo_cache + (run << TARGET_PAGE_BITS),
+                   (next - run) << TARGET_PAGE_BITS);
+        }
+        /* Chunks are word aligned, no other thread touches these words */
+        bitmap_clear(c->block->bmap, c->start, c->end - c->start);
+    }
+    return NULL;
+}
+
 /*
  * Flush content of RAM cache into SVM's memory.
  * Only flush the pages that be dirtied by PVM or SVM or both.
+ * The runs of dirty pages are copied by as many threads as there are
+ * multifd channels, taking chunks of RAM in turn.
  */
 void colo_flush_ram_cache(void)
 {
+    unsigned long chunk_pages = COLO_FLUSH_CHUNK >> TARGET_PAGE_BITS;
+    int nthreads = migrate_use_multifd() ? migrate_multifd_channels() : 1;
+    g_autofree QemuThread *threads = NULL;
+    ColoFlush flush = { 0 };
     RAMBlock *block = NULL;
-    void *dst_host;
-    void *src_host;
-    unsigned long offset = 0;
+    int i;
 
     memory_global_dirty_log_sync();
     qemu_mutex_lock(&ram_state->bitmap_mutex);
@@ -3735,30 +4829,446 @@ void colo_flush_ram_cache(void)
     }
 
     trace_colo_flush_ram_cache_begin(ram_state->migration_dirty_pages);
+    flush.chunks = g_array_new(false, false, sizeof(ColoFlushChunk));
     WITH_RCU_READ_LOCK_GUARD() {
-        block = QLIST_FIRST_RCU(&ram_list.blocks);
-
-        while (block) {
-            offset = migration_bitmap_find_dirty(ram_state, block, offset);
+        RAMBLOCK_FOREACH_NOT_IGNORED(block) {
+            unsigned long pages = block->used_length >> TARGET_PAGE_BITS;
+            ColoFlushChunk c = { .block = block };
 
-            if (!offset_in_ramblock(block,
-                                    ((ram_addr_t)offset) << TARGET_PAGE_BITS)) {
-                offset = 0;
-                block = QLIST_NEXT_RCU(block, next);
-            } else {
-                migration_bitmap_clear_dirty(ram_state, block, offset);
-                dst_host = block->host
-                         + (((ram_addr_t)offset) << TARGET_PAGE_BITS);
-                src_host = block->colo_cache
-                         + (((ram_addr_t)offset) << TARGET_PAGE_BITS);
-                memcpy(dst_host, src_host, TARGET_PAGE_SIZE);
+            for (c.start = 0; c.start < pages; c.start += chunk_pages) {
+                c.end = MIN(c.start + chunk_pages, pages);
+                if (find_next_bit(block->bmap, c.end, c.start) < c.end) {
+                    g_array_append_val(flush.chunks, c);
+                }
             }
         }
+
+        nthreads = MAX(MIN(nthreads, flush.chunks->len), 1);
+        threads = g_new(QemuThread, nthreads);
+        for (i = 1; i < nthreads; i++) {
+            qemu_thread_create(&threads[i], "colo-flush", colo_flush_thread,
+                               &flush, QEMU_THREAD_JOINABLE);
+        }
+        colo_flush_thread(&flush);
+        for (i = 1; i < nthreads; i++) {
+            qemu_thread_join(&threads[i]);
+        }
     }
+    g_array_free(flush.chunks, true);
+    ram_state->migration_dirty_pages = 0;
     trace_colo_flush_ram_cache_end();
     qemu_mutex_unlock(&ram_state->bitmap_mutex);
 }
 
+typedef struct MappedRamLoad {
+    QIOChannel *ioc;
+    RAMBlock *block;
+    const unsigned long *bitmap;
+    /* range of pages loaded by this thread */
+    unsigned long start;
+    unsigned long end;
+    QemuThread thread;
+    Error *err;
+} MappedRamLoad;
+
+static void *mapped_ram_load_thread(void *opaque)
+{
+    MappedRamLoad *l = opaque;
+    unsigned long run, next = l->start;
+
+    while ((run = find_next_bit(l->bitmap, l->end, next)) < l->end) {
+        next = find_next_zero_bit(l->bitmap, l->end, run);
+        if (file_pread_all(l->ioc, l->block->host + (run << TARGET_PAGE_BITS),
+                           (next - run) << TARGET_PAGE_BITS,
+                           l->block->pages_offset +
+                           ((off_t)run << TARGET_PAGE_BITS), &l->err)) {
+            break;
+        }
+    }
+    return NULL;
+}
+
+/*
+ * Read the runs of pages present in the file straight into the block.
+ * With multifd, as many threads as channels split large blocks between
+ * them.
+ */
+static int mapped_ram_load_pages(QIOChannel *ioc, RAMBlock *block,
+                                 const unsigned long *bitmap, Error **errp)
+{
+    unsigned long pages = block->used_length >> TARGET_PAGE_BITS;
+    int nthreads = 1;
+    g_autofree MappedRamLoad *load = NULL;
+    unsigned long chunk;
+    int i, ret = 0;
+
+    if (migrate_use_multifd() && block->used_length > MAPPED_RAM_LOAD_CHUNK) {
+        nthreads = MIN(migrate_multifd_channels(),
+                       block->used_length / MAPPED_RAM_LOAD_CHUNK);
+    }
+    chunk = ROUND_UP(DIV_ROUND_UP(pages, nthreads), BITS_PER_LONG);
+
+    load = g_new0(MappedRamLoad, nthreads);
+    for (i = 0; i < nthreads; i++) {
+        load[i].ioc = ioc;
+        load[i].block = block;
+        load[i].bitmap = bitmap;
+        load[i].start = MIN(i * chunk, pages);
+        load[i].end = MIN(load[i].start + chunk, pages);
+        if (i > 0) {
+            qemu_thread_create(&load[i].thread, "mapped-ram-load",
+                               mapped_ram_load_thread, &load[i],
+                               QEMU_THREAD_JOINABLE);
+        }
+    }
+    mapped_ram_load_thread(&load[0]);
+
+    for (i = 0; i < nthreads; i++) {
+        if (i > 0) {
+            qemu_thread_join(&load[i].thread);
+        }
+        if (load[i].err) {
+            if (!ret) {
+                error_propagate(errp, load[i].err);
+                ret = -1;
+            } else {
+                error_free(load[i].err);
+            }
+        }
+    }
+    return ret;
+}
+
+/*
+ * Snapshots are read through the block layer, which keeps several runs of
+ * pages in flight at once.
+ */
+static int mapped_ram_load_ranges(QEMUFile *f, RAMBlock *block,
+                                  const unsigned long *bitmap, Error **errp)
+{
+    unsigned long pages = block->used_length >> TARGET_PAGE_BITS;
+    unsigned long run_max = MAPPED_RAM_RUN_MAX >> TARGET_PAGE_BITS;
+    g_autoptr(GArray) ranges = g_array_new(false, false,
+                                           sizeof(QEMUFileRange));
+    unsigned long run, next = 0;
+
+    while ((run = find_next_bit(bitmap, pages, next)) < pages) {
+        QEMUFileRange r;
+
+        next = MIN(find_next_zero_bit(bitmap, pages, run), run + run_max);
+        r.buf = block->host + (run << TARGET_PAGE_BITS);
+        r.len = (next - run) << TARGET_PAGE_BITS;
+        r.pos = block->pages_offset + ((off_t)run << TARGET_PAGE_BITS);
+        g_array_append_val(ranges, r);
+    }
+    return qemu_file_read_ranges(f, (QEMUFileRange *)ranges->data,
+                                 ranges->len, errp);
+}
+
+/*
+ * Load the pages of @block from a mapped-ram file, and move the stream
+ * past them.
+ */
+static int mapped_ram_read_ramblock(QEMUFile *f, RAMBlock *block,
+                                    Error **errp)
+{
+    QIOChannel *ioc = qemu_file_get_ioc(f);
+    unsigned long pages = block->used_length >> TARGET_PAGE_BITS;
+    g_autofree unsigned long *le_bitmap = NULL;
+    g_autofree unsigned long *bitmap = NULL;
+    uint32_t version, page_size;
+    int ret;
+
+    version = qemu_get_be32(f);
+    page_size = qemu_get_be32(f);
+    block->bitmap_offset = qemu_get_be64(f);
+    block->pages_offset = qemu_get_be64(f);
+    if (qemu_file_get_error(f)) {
+        error_setg(errp, "Unable to read the mapped-ram header of %s",
+                   block->idstr);
+        return -1;
+    }
+    if (version != MAPPED_RAM_HDR_VERSION) {
+        error_setg(errp, "Unsupported mapped-ram version %u for %s",
+                   version, block->idstr);
+        return -1;
+    }
+    if (page_size != TARGET_PAGE_SIZE) {
+        error_setg(errp, "Mapped-ram page size %u of %s does not match %u",
+                   page_size, block->idstr, (unsigned)TARGET_PAGE_SIZE);
+        return -1;
+    }
+    if (!mapped_ram_file_ok(f)) {
+        error_setg(errp, "Mapped RAM requires migrating from a file");
+        return -1;
+    }
+
+    if (!ramblock_is_ignored(block)) {
+        le_bitmap = bitmap_new(pages);
+        bitmap = bitmap_new(pages);
+        if (mapped_ram_pread(f, le_bitmap, mapped_ram_bitmap_size(block),
+                             block->bitmap_offset, errp)) {
+            return -1;
+        }
+        bitmap_from_le(bitmap, le_bitmap, pages);
+
+        if (migrate_lazy_restore()) {
+            /* Keep the bitmap to resolve faults, see ram_lazy_restore */
+            g_free(block->file_bmap);
+            block->file_bmap = g_steal_pointer(&bitmap);
+            ret = 0;
+        } else if (!ioc) {
+            ret = mapped_ram_load_ranges(f, block, bitmap, errp);
+        } else if (migrate_direct_io()) {
+            QIOChannel *dioc = file_recv_channel_create(errp);
+
+            if (!dioc) {
+                return -1;
+            }
+            ret = mapped_ram_load_pages(dioc, block, bitmap, errp);
+            object_unref(OBJECT(dioc));
+        } else {
+            ret = mapped_ram_load_pages(ioc, block, bitmap, errp);
+        }
+        if (ret) {
+            return ret;
+        }
+    }
+
+    return qemu_file_set_offset(f, block->pages_offset + block->used_length,
+                                errp);
+}
+
+/*
+ * Lazy restore: with the lazy-restore capability, the pages of a mapped-ram
+ * file are not read while the stream is loaded.  Guest memory is emptied
+ * and registered with userfaultfd as for postcopy, instead.  The postcopy
+ * fault thread then reads each page from the file when it is first
+ * touched, and a prefetch thread reads all the others in the background,
+ * so that the guest can start as soon as the device state is loaded.
+ *
+ * Pages that are not in the file are only placed when faulted, as they are
+ * zero anyway once userfaultfd is unregistered at the end.
+ */
+static struct {
+    QIOChannel *ioc;
+    QemuThread thread;
+    /* Serialises the placement of a page by the two threads */
+    QemuMutex lock;
+    QEMUBH *bh;
+    int ret;
+    /* The load is over, and left the received bitmaps to us */
+    bool load_done;
+} lazy_restore;
+
+static bool lazy_restore_present(RAMBlock *block, ram_addr_t offset,
+                                 size_t len)
+{
+    unsigned long end = (offset + len) >> TARGET_PAGE_BITS;
+
+    return find_next_bit(block->file_bmap, end,
+                         offset >> TARGET_PAGE_BITS) < end;
+}
+
+/* Read @len bytes of @block from @offset, zeroing what is not in the file */
+static int lazy_restore_read(RAMBlock *block, ram_addr_t offset, size_t len,
+                             uint8_t *buf, Error **errp)
+{
+    unsigned long first = offset >> TARGET_PAGE_BITS;
+    unsigned long end = (offset + len) >> TARGET_PAGE_BITS;
+    unsigned long run, next = first;
+
+    while (next < end) {
+        run = find_next_bit(block->file_bmap, end, next);
+        memset(buf + ((next - first) << TARGET_PAGE_BITS), 0,
+               (run - next) << TARGET_PAGE_BITS);
+        if (run == end) {
+            break;
+        }
+        next = find_next_zero_bit(block->file_bmap, end, run);
+        if (file_pread_all(lazy_restore.ioc,
+                           buf + ((run - first) << TARGET_PAGE_BITS),
+                           (next - run) << TARGET_PAGE_BITS,
+                           block->pages_offset +
+                           ((off_t)run << TARGET_PAGE_BITS), errp)) {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+/* Place the host page at @offset of @block, unless it is already there */
+static int lazy_restore_place(MigrationIncomingState *mis, RAMBlock *block,
+                              ram_addr_t offset, void *buf)
+{
+    void *host = block->host + offset;
+    int ret = 0;
+
+    qemu_mutex_lock(&lazy_restore.lock);
+    if (!ramblock_recv_bitmap_test_byte_offset(block, offset)) {
+        ret = buf ? postcopy_place_page(mis, host, buf, block) :
+                    postcopy_place_page_zero(mis, host, block);
+    }
+    qemu_mutex_unlock(&lazy_restore.lock);
+    return ret;
+}
+
+/*
+ * Called by the postcopy fault thread for a fault at @offset of @rb,
+ * aligned to the host page size.
+ */
+int ram_lazy_restore_fault(MigrationIncomingState *mis, RAMBlock *rb,
+                           ram_addr_t offset)
+{
+    size_t pagesize = qemu_ram_pagesize(rb);
+    Error *local_err = NULL;
+    bool present;
+
+    if (ramblock_recv_bitmap_test_byte_offset(rb, offset)) {
+        /* Placed by the prefetch thread, which woke the guest up */
+        return 0;
+    }
+    present = lazy_restore_present(rb, offset, pagesize);
+    trace_ram_lazy_restore_fault(rb->idstr, offset, present);
+    if (!present) {
+        return lazy_restore_place(mis, rb, offset, NULL);
+    }
+    if (lazy_restore_read(rb, offset, pagesize, mis->postcopy_tmp_page,
+                          &local_err)) {
+        error_report_err(local_err);
+        return -1;
+    }
+    return lazy_restore_place(mis, rb, offset, mis->postcopy_tmp_page);
+}
+
+static void *lazy_restore_thread(void *opaque)
+{
+    MigrationIncomingState *mis = opaque;
+    size_t buf_size = MAX(MAPPED_RAM_RUN_MAX, mis->largest_page_size);
+    uint8_t *buf = qemu_memalign(qemu_real_host_page_size, buf_size);
+    Error *local_err = NULL;
+    RAMBlock *block;
+
+    rcu_register_thread();
+    WITH_RCU_READ_LOCK_GUARD() {
+        RAMBLOCK_FOREACH_NOT_IGNORED(block) {
+            size_t pagesize = qemu_ram_pagesize(block);
+            ram_addr_t offset, pos;
+
+            for (offset = 0; offset < block->postcopy_length;
+                 offset += buf_size) {
+                size_t len = MIN(buf_size, block->postcopy_length - offset);
+                unsigned long first = offset >> TARGET_PAGE_BITS;
+                unsigned long end = (offset + len) >> TARGET_PAGE_BITS;
+
+                if (!lazy_restore_present(block, offset, len) ||
+                    find_next_zero_bit(block->receivedmap, end,
+                                       first) >= end) {
+                    continue;
+                }
+                if (lazy_restore_read(block, offset, len, buf, &local_err)) {
+                    error_report_err(local_err);
+                    lazy_restore.ret = -1;
+                    goto out;
+                }
+                for (pos = 0; pos < len; pos += pagesize) {
+                    if (lazy_restore_present(block, offset + pos, pagesize) &&
+                        lazy_restore_place(mis, block, offset + pos,
+                                           buf + pos)) {
+                        lazy_restore.ret = -1;
+                        goto out;
+                    }
+                }
+            }
+        }
+    }
+out:
+    qemu_vfree(buf);
+    rcu_unregister_thread();
+    qemu_bh_schedule(lazy_restore.bh);
+    return NULL;
+}
+
+static void lazy_restore_bh(void *opaque)
+{
+    MigrationIncomingState *mis = opaque;
+    RAMBlock *block;
+
+    qemu_thread_join(&lazy_restore.thread);
+    qemu_bh_delete(lazy_restore.bh);
+    lazy_restore.bh = NULL;
+    trace_ram_lazy_restore_done(lazy_restore.ret);
+    if (lazy_restore.ret) {
+        /*
+         * Unregistering would leave the missing pages zero: keep the
+         * fault thread resolving them, or failing like postcopy does.
+         */
+        error_report("Lazy restore could not read all pages of the file");
+        return;
+    }
+
+    postcopy_ram_incoming_cleanup(mis);
+    mis->lazy_restore = false;
+    RAMBLOCK_FOREACH_NOT_IGNORED(block) {
+        g_free(block->file_bmap);
+        block->file_bmap = NULL;
+        if (lazy_restore.load_done) {
+            g_free(block->receivedmap);
+            block->receivedmap = NULL;
+        }
+    }
+    object_unref(OBJECT(lazy_restore.ioc));
+    lazy_restore.ioc = NULL;
+    qemu_mutex_destroy(&lazy_restore.lock);
+
+    /* The incoming state left these to us if it is already gone */
+    if (mis->state == MIGRATION_STATUS_COMPLETED) {
+        g_array_free(mis->postcopy_remote_fds, TRUE);
+        mis->postcopy_remote_fds = NULL;
+        g_tree_destroy(mis->page_requested);
+        mis->page_requested = NULL;
+    }
+}
+
+static void ram_lazy_restore_load_done(void)
+{
+    lazy_restore.load_done = true;
+}
+
+/*
+ * Called once the headers of all RAMBlocks are loaded, before anything
+ * touches guest memory.
+ */
+static int ram_lazy_restore_start(QEMUFile *f, Error **errp)
+{
+    MigrationIncomingState *mis = migration_incoming_get_current();
+
+    if (!qemu_file_get_ioc(f)) {
+        error_setg(errp, "Lazy restore requires migrating from a file");
+        return -1;
+    }
+    /* The main channel is closed at the end of the load, open our own */
+    lazy_restore.ioc = file_recv_channel_create(errp);
+    if (!lazy_restore.ioc) {
+        return -1;
+    }
+    trace_ram_lazy_restore_start();
+
+    mis->lazy_restore = true;
+    if (postcopy_ram_incoming_init(mis) ||
+        postcopy_ram_incoming_setup(mis)) {
+        error_setg(errp, "Unable to register guest memory with userfaultfd");
+        return -1;
+    }
+
+    lazy_restore.ret = 0;
+    qemu_mutex_init(&lazy_restore.lock);
+    lazy_restore.bh = qemu_bh_new(lazy_restore_bh, mis);
+    qemu_thread_create(&lazy_restore.thread, "lazy-restore",
+                       lazy_restore_thread, mis, QEMU_THREAD_JOINABLE);
+    return 0;
+}
+
 /**
  * ram_load_precopy: load pages in precopy case
  *
@@ -3781,6 +5291,7 @@ static int ram_load_precopy(QEMUFile *f)
     while (!ret && !(flags & RAM_SAVE_FLAG_EOS)) {
         ram_addr_t addr, total_ram_bytes;
         void *host = NULL, *host_bak = NULL;
+        bool untouched = false;
         uint8_t ch;
 
         /*
@@ -3809,7 +5320,8 @@ static int ram_load_precopy(QEMUFile *f)
 
         if (flags & (RAM_SAVE_FLAG_ZERO | RAM_SAVE_FLAG_PAGE |
                      RAM_SAVE_FLAG_COMPRESS_PAGE | RAM_SAVE_FLAG_XBZRLE)) {
-            RAMBlock *block = ram_block_from_stream(f, flags);
+            RAMBlock *block = ram_block_from_stream(f, flags,
+                                                    RAM_CHANNEL_PRECOPY);
 
             host = host_from_ram_block_offset(block, addr);
             /*
@@ -3841,6 +5353,7 @@ static int ram_load_precopy(QEMUFile *f)
                 break;
             }
             if (!migration_incoming_in_colo_state()) {
+                untouched = ramblock_recv_page_untouched(block, addr);
                 ramblock_recv_bitmap_set(block, host);
             }
 
@@ -3898,6 +5411,14 @@ static int ram_load_precopy(QEMUFile *f)
                             ret = -EINVAL;
                         }
                     }
+                    if (!ret && migrate_mapped_ram()) {
+                        Error *local_err = NULL;
+
+                        if (mapped_ram_read_ramblock(f, block, &local_err)) {
+                            error_report_err(local_err);
+                            ret = -EINVAL;
+                        }
+                    }
                     ram_control_load_hook(f, RAM_CONTROL_BLOCK_REG,
                                           block->idstr);
                 } else {
@@ -3908,11 +5429,22 @@ static int ram_load_precopy(QEMUFile *f)
 
                 total_ram_bytes -= length;
             }
+            if (!ret && migrate_lazy_restore()) {
+                Error *local_err = NULL;
+
+                if (ram_lazy_restore_start(f, &local_err)) {
+                    error_report_err(local_err);
+                    ret = -EINVAL;
+                }
+            }
             break;
 
         case RAM_SAVE_FLAG_ZERO:
             ch = qemu_get_byte(f);
-            ram_handle_compressed(host, ch, TARGET_PAGE_SIZE);
+            /* Don't even read a page that was never touched, not to map it */
+            if (ch != 0 || !untouched) {
+                ram_handle_compressed(host, ch, TARGET_PAGE_SIZE);
+            }
             break;
 
         case RAM_SAVE_FLAG_PAGE:
@@ -3986,7 +5518,7 @@ static int ram_load(QEMUFile *f, void *opaque, int version_id)
      */
     WITH_RCU_READ_LOCK_GUARD() {
         if (postcopy_running) {
-            ret = ram_load_postcopy(f);
+            ret = ram_load_postcopy(f, RAM_CHANNEL_PRECOPY);
         } else {
             ret = ram_load_precopy(f);
         }
@@ -40,6 +40,7 @@
 #include "qemu-file.h"
 #include "savevm.h"
 #include "postcopy-ram.h"
+#include "multifd.h"
 #include "qapi/error.h"
 #include "qapi/qapi-commands-migration.h"
 #include "qapi/qmp/json-writer.h"
@@ -151,6 +152,60 @@ static ssize_t block_get_buffer(void *opaque, uint8_t *buf, int64_t pos,
     return bdrv_load_vmstate(opaque, buf, pos, size);
 }
 
+/* Requests in flight when reading a mapped-ram snapshot */
+#define BLOCK_READ_RANGES_COROUTINES 16
+
+typedef struct BlockReadRanges {
+    BlockDriverState *bs;
+    const QEMUFileRange *ranges;
+    int count;
+    int next;
+    int active;
+    int ret;
+} BlockReadRanges;
+
+static void coroutine_fn block_read_ranges_co(void *opaque)
+{
+    BlockReadRanges *r = opaque;
+
+    while (r->next < r->count && !r->ret) {
+        const QEMUFileRange *range = &r->ranges[r->next++];
+        QEMUIOVector qiov;
+        int ret;
+
+        qemu_iovec_init_buf(&qiov, range->buf, range->len);
+        ret = bdrv_readv_vmstate(r->bs, &qiov, range->pos);
+        if (ret < 0 && !r->ret) {
+            r->ret = ret;
+        }
+    }
+    r->active--;
+    aio_wait_kick();
+}
+
+static int block_read_ranges(void *opaque, const QEMUFileRange *ranges,
+                             int count, Error **errp)
+{
+    BlockReadRanges r = {
+        .bs = opaque,
+        .ranges = ranges,
+        .count = count,
+    };
+    int i;
+
+    for (i = 0; i < MIN(count, BLOCK_READ_RANGES_COROUTINES); i++) {
+        r.active++;
+        bdrv_coroutine_enter(r.bs, qemu_coroutine_create(block_read_ranges_co,
+                                                         &r));
+    }
+    BDRV_POLL_WHILE(r.bs, r.active > 0);
+
+    if (r.ret < 0) {
+        error_setg_errno(errp, -r.ret, "Unable to read the VM state");
+    }
+    return r.ret;
+}
+
 static int bdrv_fclose(void *opaque, Error **errp)
 {
     return bdrv_flush(opaque);
@@ -158,12 +213,15 @@ static int bdrv_fclose(void *opaque, Error **errp)
 
 static const QEMUFileOps bdrv_read_ops = {
     .get_buffer = block_get_buffer,
-    .close =      bdrv_fclose
+    .read_ranges = block_read_ranges,
+    .close =      bdrv_fclose,
+    .seekable =   true,
 };
 
 static const QEMUFileOps bdrv_write_ops = {
     .writev_buffer  = block_writev_buffer,
-    .close          = bdrv_fclose
+    .close          = bdrv_fclose,
+    .seekable       = true,
 };
 
 static QEMUFile *qemu_fopen_bdrv(BlockDriverState *bs, int is_writable)
@@ -249,6 +307,15 @@ typedef struct SaveStateEntry {
     void *opaque;
     CompatEntry *compat;
     int is_ram;
+    /* Cost of saving the section in the current migration */
+    uint64_t pending;
+    uint64_t transferred;
+    int64_t save_time_us;
+    /*
+     * Bytes sent with the guest stopped the last time the section was
+     * saved, kept across migrations to predict the downtime of the next.
+     */
+    uint64_t stop_size;
 } SaveStateEntry;
 
 typedef struct SaveState {
@@ -275,6 +342,7 @@ static bool should_validate_capability(int capability)
     /* Validate only new capabilities to keep compatibility. */
     switch (capability) {
     case MIGRATION_CAPABILITY_X_IGNORE_SHARED:
+    case MIGRATION_CAPABILITY_MAPPED_RAM:
         return true;
     default:
         return false;
@@ -360,6 +428,13 @@ static bool configuration_validate_capabilities(SaveState *state)
         }
         source_state = test_bit(i, source_caps_bm);
         target_state = s->enabled_capabilities[i];
+        if (i == MIGRATION_CAPABILITY_MAPPED_RAM &&
+            qemu_file_is_seekable(migration_incoming_get_current()->
+                                  from_src_file)) {
+            /* A snapshot is loaded the way it was saved, see load_snapshot() */
+            s->enabled_capabilities[i] = source_state;
+            continue;
+        }
         if (source_state != target_state) {
             error_report("Capability %s is %s, but received capability is %s",
                          MigrationCapability_str(i),
@@ -1196,6 +1271,20 @@ bool qemu_savevm_state_guest_unplug_pending(void)
     return false;
 }
 
+/*
+ * Account the bytes written to @f and the time spent since @pos and
+ * @start_us to @se, and return the number of bytes.
+ */
+static uint64_t savevm_account(SaveStateEntry *se, QEMUFile *f, int64_t pos,
+                               int64_t start_us)
+{
+    uint64_t len = qemu_ftell_fast(f) - pos;
+
+    se->transferred += len;
+    se->save_time_us += qemu_clock_get_us(QEMU_CLOCK_REALTIME) - start_us;
+    return len;
+}
+
 void qemu_savevm_state_setup(QEMUFile *f)
 {
     SaveStateEntry *se;
@@ -1204,6 +1293,11 @@ void qemu_savevm_state_setup(QEMUFile *f)
 
     trace_savevm_state_setup();
     QTAILQ_FOREACH(se, &savevm_state.handlers, entry) {
+        int64_t pos, start_us;
+
+        se->pending = 0;
+        se->transferred = 0;
+        se->save_time_us = 0;
         if (!se->ops || !se->ops->save_setup) {
             continue;
         }
@@ -1212,10 +1306,13 @@ void qemu_savevm_state_setup(QEMUFile *f)
                 continue;
             }
         }
+        pos = qemu_ftell_fast(f);
+        start_us = qemu_clock_get_us(QEMU_CLOCK_REALTIME);
         save_section_header(f, se, QEMU_VM_SECTION_START);
 
         ret = se->ops->save_setup(f, se->opaque);
         save_section_footer(f, se);
+        savevm_account(se, f, pos, start_us);
         if (ret < 0) {
             qemu_file_set_error(f, ret);
             break;
@@ -1265,6 +1362,8 @@ int qemu_savevm_state_iterate(QEMUFile *f, bool postcopy)
 
     trace_savevm_state_iterate();
     QTAILQ_FOREACH(se, &savevm_state.handlers, entry) {
+        int64_t pos, start_us;
+
         if (!se->ops || !se->ops->save_live_iterate) {
             continue;
         }
@@ -1291,11 +1390,14 @@ int qemu_savevm_state_iterate(QEMUFile *f, bool postcopy)
         }
         trace_savevm_section_start(se->idstr, se->section_id);
 
+        pos = qemu_ftell_fast(f);
+        start_us = qemu_clock_get_us(QEMU_CLOCK_REALTIME);
         save_section_header(f, se, QEMU_VM_SECTION_PART);
 
         ret = se->ops->save_live_iterate(f, se->opaque);
         trace_savevm_section_end(se->idstr, se->section_id, ret);
         save_section_footer(f, se);
+        savevm_account(se, f, pos, start_us);
 
         if (ret < 0) {
             error_report("failed to save SaveStateEntry with id(name): %d(%s)",
@@ -1366,6 +1468,8 @@ int qemu_savevm_state_complete_precopy_iterable(QEMUFile *f, bool in_postcopy)
     int ret;
 
     QTAILQ_FOREACH(se, &savevm_state.handlers, entry) {
+        int64_t pos, start_us;
+
         if (!se->ops ||
             (in_postcopy && se->ops->has_postcopy &&
              se->ops->has_postcopy(se->opaque)) ||
@@ -1380,11 +1484,14 @@ int qemu_savevm_state_complete_precopy_iterable(QEMUFile *f, bool in_postcopy)
         }
         trace_savevm_section_start(se->idstr, se->section_id);
 
+        pos = qemu_ftell_fast(f);
+        start_us = qemu_clock_get_us(QEMU_CLOCK_REALTIME);
         save_section_header(f, se, QEMU_VM_SECTION_END);
 
         ret = se->ops->save_live_complete_precopy(f, se->opaque);
         trace_savevm_section_end(se->idstr, se->section_id, ret);
         save_section_footer(f, se);
+        se->stop_size = savevm_account(se, f, pos, start_us);
         if (ret < 0) {
             qemu_file_set_error(f, ret);
             return -1;
@@ -1408,6 +1515,7 @@ int qemu_savevm_state_complete_precopy_non_iterable(QEMUFile *f,
     json_writer_int64(vmdesc, "page_size", qemu_target_page_size());
     json_writer_start_array(vmdesc, "devices");
     QTAILQ_FOREACH(se, &savevm_state.handlers, entry) {
+        int64_t pos, start_us;
 
         if ((!se->ops || !se->ops->save_state) && !se->vmsd) {
             continue;
@@ -1423,6 +1531,8 @@ int qemu_savevm_state_complete_precopy_non_iterable(QEMUFile *f,
         json_writer_str(vmdesc, "name", se->idstr);
         json_writer_int64(vmdesc, "instance_id", se->instance_id);
 
+        pos = qemu_ftell_fast(f);
+        start_us = qemu_clock_get_us(QEMU_CLOCK_REALTIME);
         save_section_header(f, se, QEMU_VM_SECTION_FULL);
         ret = vmstate_save(f, se, vmdesc);
         if (ret) {
@@ -1431,6 +1541,7 @@ int qemu_savevm_state_complete_precopy_non_iterable(QEMUFile *f,
         }
         trace_savevm_section_end(se->idstr, se->section_id, 0);
         save_section_footer(f, se);
+        se->stop_size = savevm_account(se, f, pos, start_us);
 
         json_writer_end_object(vmdesc);
     }
@@ -1511,6 +1622,7 @@ void qemu_savevm_state_pending(QEMUFile *f, uint64_t threshold_size,
                                uint64_t *res_postcopy_only)
 {
     SaveStateEntry *se;
+    uint64_t pending;
 
     *res_precopy_only = 0;
     *res_compatible = 0;
@@ -1526,12 +1638,64 @@ void qemu_savevm_state_pending(QEMUFile *f, uint64_t threshold_size,
                 continue;
             }
         }
+        pending = *res_precopy_only + *res_compatible + *res_postcopy_only;
         se->ops->save_live_pending(f, se->opaque, threshold_size,
                                    res_precopy_only, res_compatible,
                                    res_postcopy_only);
+        se->pending = *res_precopy_only + *res_compatible +
+                      *res_postcopy_only - pending;
     }
 }
 
+/*
+ * qemu_savevm_state_stop_size: estimate the bytes that only get sent once
+ * the guest is stopped, on top of what qemu_savevm_state_pending() reports.
+ *
+ * Sections without live iteration are sent entirely with the guest stopped,
+ * and are estimated from the last time they were saved; sections that
+ * iterate are expected to report everything left in their pending size.
+ */
+uint64_t qemu_savevm_state_stop_size(void)
+{
+    SaveStateEntry *se;
+    uint64_t size = 0;
+
+    QTAILQ_FOREACH(se, &savevm_state.handlers, entry) {
+        if (se->ops && se->ops->save_live_pending) {
+            continue;
+        }
+        size += se->stop_size;
+    }
+    return size;
+}
+
+/*
+ * qemu_savevm_state_costs: the save cost of every section that sent or
+ * still has something to send in the current migration
+ */
+MigrationDeviceCostList *qemu_savevm_state_costs(void)
+{
+    MigrationDeviceCostList *head = NULL, **tail = &head;
+    SaveStateEntry *se;
+
+    QTAILQ_FOREACH(se, &savevm_state.handlers, entry) {
+        MigrationDeviceCost *cost;
+
+        if (!se->transferred && !se->pending) {
+            continue;
+        }
+        cost = g_new0(MigrationDeviceCost, 1);
+        cost->name = g_strdup(se->idstr);
+        cost->instance_id = se->instance_id;
+        cost->pending = se->pending;
+        cost->transferred = se->transferred;
+        cost->save_time = se->save_time_us;
+        cost->stop_size = se->stop_size;
+        QAPI_LIST_APPEND(tail, cost);
+    }
+    return head;
+}
+
 void qemu_savevm_state_cleanup(void)
 {
     SaveStateEntry *se;
@@ -1972,6 +2136,7 @@ static int loadvm_postcopy_handle_listen(MigrationIncomingState *mis)
             postcopy_ram_incoming_cleanup(mis);
             return -1;
         }
+        multifd_recv_postcopy_listen();
     }
 
     if (postcopy_notify(POSTCOPY_NOTIFY_INBOUND_LISTEN, &local_err)) {
@@ -2996,6 +3161,9 @@ bool load_snapshot(const char *name, const char *vmstate,
     int ret;
     AioContext *aio_context;
     MigrationIncomingState *mis = migration_incoming_get_current();
+    MigrationState *s = migrate_get_current();
+    /* The snapshot may have been saved with another RAM layout */
+    bool mapped_ram = s->enabled_capabilities[MIGRATION_CAPABILITY_MAPPED_RAM];
 
     if (!bdrv_all_can_snapshot(has_devices, devices, errp)) {
         return false;
@@ -3060,6 +3228,7 @@ bool load_snapshot(const char *name, const char *vmstate,
     ret = qemu_loadvm_state(f);
     migration_incoming_state_destroy();
     aio_context_release(aio_context);
+    s->enabled_capabilities[MIGRATION_CAPABILITY_MAPPED_RAM] = mapped_ram;
 
     bdrv_drain_all_end();
 
@@ -373,6 +373,23 @@ void hmp_info_migrate(Monitor *mon, const QDict *qdict)
                        info->vfio->transferred >> 10);
     }
 
+    if (info->has_device_costs) {
+        MigrationDeviceCostList *cost;
+
+        monitor_printf(mon, "device costs:\n");
+        for (cost = info->device_costs; cost; cost = cost->next) {
+            monitor_printf(mon, "  %s/%" PRIu32 ": pending %" PRIu64
+                           " kbytes, transferred %" PRIu64 " kbytes, "
+                           "time %" PRId64 " us, stop size %" PRIu64
+                           " kbytes\n",
+                           cost->value->name, cost->value->instance_id,
+                           cost->value->pending >> 10,
+                           cost->value->transferred >> 10,
+                           cost->value->save_time,
+                           cost->value->stop_size >> 10);
+        }
+    }
+
     qapi_free_MigrationInfo(info);
 }
 
@@ -478,6 +495,16 @@ void hmp_info_migrate_parameters(Monitor *mon, const QDict *qdict)
         monitor_printf(mon, "%s: %s\n",
             MigrationParameter_str(MIGRATION_PARAMETER_MULTIFD_COMPRESSION),
             MultiFDCompression_str(params->multifd_compression));
+        monitor_printf(mon, "%s: %" PRIu64 " bytes\n",
+            MigrationParameter_str(MIGRATION_PARAMETER_MULTIFD_PACKET_SIZE),
+            params->multifd_packet_size);
+        monitor_printf(mon, "%s: %" PRIu64 " MB/s\n",
+            MigrationParameter_str(MIGRATION_PARAMETER_VCPU_DIRTY_LIMIT),
+            params->vcpu_dirty_limit);
+        assert(params->has_direct_io);
+        monitor_printf(mon, "%s: %s\n",
+            MigrationParameter_str(MIGRATION_PARAMETER_DIRECT_IO),
+            params->direct_io ? "on" : "off");
         monitor_printf(mon, "%s: %" PRIu64 " bytes\n",
             MigrationParameter_str(MIGRATION_PARAMETER_XBZRLE_CACHE_SIZE),
             params->xbzrle_cache_size);
@@ -1364,6 +1391,18 @@ void hmp_migrate_set_parameter(Monitor *mon, const QDict *qdict)
         p->has_multifd_zstd_level = true;
         visit_type_uint8(v, param, &p->multifd_zstd_level, &err);
         break;
+    case MIGRATION_PARAMETER_MULTIFD_PACKET_SIZE:
+        p->has_multifd_packet_size = true;
+        visit_type_size(v, param, &p->multifd_packet_size, &err);
+        break;
+    case MIGRATION_PARAMETER_VCPU_DIRTY_LIMIT:
+        p->has_vcpu_dirty_limit = true;
+        visit_type_uint64(v, param, &p->vcpu_dirty_limit, &err);
+        break;
+    case MIGRATION_PARAMETER_DIRECT_IO:
+        p->has_direct_io = true;
+        visit_type_bool(v, param, &p->direct_io, &err);
+        break;
     case MIGRATION_PARAMETER_XBZRLE_CACHE_SIZE:
         p->has_xbzrle_cache_size = true;
         if (!visit_type_size(v, param, &cache_size, &err)) {
@@ -1895,6 +1934,10 @@ void hmp_info_iothreads(Monitor *mon, const QDict *qdict)
         monitor_printf(mon, "  poll-shrink=%" PRId64 "\n", value->poll_shrink);
         monitor_printf(mon, "  aio-max-batch=%" PRId64 "\n",
                        value->aio_max_batch);
+        monitor_printf(mon, "  poll-ns=%" PRId64 "\n", value->poll_ns);
+        monitor_printf(mon, "  poll-hits=%" PRIu64 "\n", value->poll_hits);
+        monitor_printf(mon, "  poll-misses=%" PRIu64 "\n",
+                       value->poll_misses);
     }
 
     qapi_free_IOThreadInfoList(info_list);
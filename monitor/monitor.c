@@ -29,6 +29,7 @@
 #include "qapi/qapi-emit-events.h"
 #include "qapi/qapi-visit-control.h"
 #include "qapi/qmp/qdict.h"
+#include "qemu/cutils.h"
 #include "qemu/error-report.h"
 #include "qemu/option.h"
 #include "sysemu/qtest.h"
@@ -211,23 +212,25 @@ void monitor_flush(Monitor *mon)
 /* flush at every end of line */
 int monitor_puts(Monitor *mon, const char *str)
 {
-    int i;
-    char c;
+    const char *p = str;
+    const char *eol;
 
     qemu_mutex_lock(&mon->mon_lock);
-    for (i = 0; str[i]; i++) {
-        c = str[i];
-        if (c == '\n') {
-            g_string_append_c(mon->outbuf, '\r');
-        }
-        g_string_append_c(mon->outbuf, c);
-        if (c == '\n') {
-            monitor_flush_locked(mon);
+    for (;;) {
+        /* QMP responses can be large; copy whole lines, not characters */
+        eol = qemu_strchrnul(p, '\n');
+        g_string_append_len(mon->outbuf, p, eol - p);
+        p = eol;
+        if (!*p) {
+            break;
         }
+        g_string_append(mon->outbuf, "\r\n");
+        monitor_flush_locked(mon);
+        p++;
     }
     qemu_mutex_unlock(&mon->mon_lock);
 
-    return i;
+    return p - str;
 }
 
 int monitor_vprintf(Monitor *mon, const char *fmt, va_list ap)
@@ -97,6 +97,7 @@ struct NBDExport {
     Notifier eject_notifier;
 
     bool allocation_depth;
+    bool zero_copy;
     BdrvDirtyBitmap **export_bitmaps;
     size_t nr_export_bitmaps;
 };
@@ -1634,7 +1635,8 @@ static int nbd_export_create(BlockExport *blk_exp, BlockExportOptions *exp_args,
     int64_t size;
     uint64_t perm, shared_perm;
     bool readonly = !exp_args->writable;
-    bool shared = !exp_args->writable;
+    OnOffAuto multi_conn = arg->has_multi_conn ? arg->multi_conn
+                                               : ON_OFF_AUTO_AUTO;
     strList *bitmaps;
     size_t i;
     int ret;
@@ -1687,13 +1689,18 @@ static int nbd_export_create(BlockExport *blk_exp, BlockExportOptions *exp_args,
                      NBD_FLAG_SEND_FUA | NBD_FLAG_SEND_CACHE);
     if (readonly) {
         exp->nbdflags |= NBD_FLAG_READ_ONLY;
-        if (shared) {
-            exp->nbdflags |= NBD_FLAG_CAN_MULTI_CONN;
-        }
     } else {
         exp->nbdflags |= (NBD_FLAG_SEND_TRIM | NBD_FLAG_SEND_WRITE_ZEROES |
                           NBD_FLAG_SEND_FAST_ZERO);
     }
+    if (multi_conn == ON_OFF_AUTO_AUTO) {
+        multi_conn = readonly ? ON_OFF_AUTO_ON : ON_OFF_AUTO_OFF;
+    }
+    if (multi_conn == ON_OFF_AUTO_ON) {
+        /* All connections go through the same BlockBackend, so a flush on
+         * any of them also flushes what the others have written. */
+        exp->nbdflags |= NBD_FLAG_CAN_MULTI_CONN;
+    }
     exp->size = QEMU_ALIGN_DOWN(size, BDRV_SECTOR_SIZE);
 
     for (bitmaps = arg->bitmaps; bitmaps; bitmaps = bitmaps->next) {
@@ -1745,6 +1752,7 @@ static int nbd_export_create(BlockExport *blk_exp, BlockExportOptions *exp_args,
     }
 
     exp->allocation_depth = arg->allocation_depth;
+    exp->zero_copy = arg->zero_copy;
 
     /*
      * We need to inhibit request queuing in the block layer to ensure we can
@@ -1939,6 +1947,58 @@ static int coroutine_fn nbd_co_send_structured_read(NBDClient *client,
     return nbd_co_send_iov(client, iov, 2, errp);
 }
 
+/*
+ * Send @hdr followed by @size bytes of export data at @offset directly from
+ * the image file to the socket.  Return -ENOTSUP, without having sent
+ * anything, if this export or client cannot do that.
+ */
+static int coroutine_fn nbd_co_sendfile(NBDClient *client,
+                                        const void *hdr, size_t hdr_len,
+                                        uint64_t offset, uint32_t size,
+                                        Error **errp)
+{
+    int ret;
+
+    /* TLS has to encrypt the data in user space */
+    if (!client->exp->zero_copy || client->ioc != QIO_CHANNEL(client->sioc)) {
+        return -ENOTSUP;
+    }
+
+    qemu_co_mutex_lock(&client->send_lock);
+    client->send_coroutine = qemu_coroutine_self();
+
+    ret = blk_co_sendfile(client->exp->common.blk, offset, size,
+                          client->sioc->fd, hdr, hdr_len);
+
+    client->send_coroutine = NULL;
+    qemu_co_mutex_unlock(&client->send_lock);
+
+    trace_nbd_co_sendfile(offset, size, ret);
+    if (ret < 0 && ret != -ENOTSUP) {
+        error_setg_errno(errp, -ret, "sending data from file failed");
+        return -EIO;
+    }
+    return ret;
+}
+
+static int coroutine_fn nbd_co_sendfile_structured_read(NBDClient *client,
+                                                        uint64_t handle,
+                                                        uint64_t offset,
+                                                        size_t size,
+                                                        bool final,
+                                                        Error **errp)
+{
+    NBDStructuredReadData chunk;
+
+    assert(size);
+    set_be_chunk(&chunk.h, final ? NBD_REPLY_FLAG_DONE : 0,
+                 NBD_REPLY_TYPE_OFFSET_DATA, handle,
+                 sizeof(chunk) - sizeof(chunk.h) + size);
+    stq_be_p(&chunk.offset, offset);
+
+    return nbd_co_sendfile(client, &chunk, sizeof(chunk), offset, size, errp);
+}
+
 static int coroutine_fn nbd_co_send_structured_error(NBDClient *client,
                                                      uint64_t handle,
                                                      uint32_t error,
@@ -2012,15 +2072,21 @@ static int coroutine_fn nbd_co_send_sparse_read(NBDClient *client,
             stl_be_p(&chunk.length, pnum);
             ret = nbd_co_send_iov(client, iov, 1, errp);
         } else {
-            ret = blk_pread(exp->common.blk, offset + progress,
-                            data + progress, pnum);
-            if (ret < 0) {
-                error_setg_errno(errp, -ret, "reading from file failed");
-                break;
+            ret = nbd_co_sendfile_structured_read(client, handle,
+                                                  offset + progress, pnum,
+                                                  final, errp);
+            if (ret == -ENOTSUP) {
+                ret = blk_pread(exp->common.blk, offset + progress,
+                                data + progress, pnum);
+                if (ret < 0) {
+                    error_setg_errno(errp, -ret, "reading from file failed");
+                    break;
+                }
+                ret = nbd_co_send_structured_read(client, handle,
+                                                  offset + progress,
+                                                  data + progress, pnum, final,
+                                                  errp);
             }
-            ret = nbd_co_send_structured_read(client, handle, offset + progress,
-                                              data + progress, pnum, final,
-                                              errp);
         }
 
         if (ret < 0) {
@@ -2418,6 +2484,23 @@ static coroutine_fn int nbd_do_cmd_read(NBDClient *client, NBDRequest *request,
                                        data, request->len, errp);
     }
 
+    if (request->len) {
+        if (client->structured_reply) {
+            ret = nbd_co_sendfile_structured_read(client, request->handle,
+                                                  request->from, request->len,
+                                                  true, errp);
+        } else {
+            NBDSimpleReply reply;
+
+            set_be_simple_reply(&reply, 0, request->handle);
+            ret = nbd_co_sendfile(client, &reply, sizeof(reply),
+                                  request->from, request->len, errp);
+        }
+        if (ret != -ENOTSUP) {
+            return ret;
+        }
+    }
+
     ret = blk_pread(exp->common.blk, request->from, data, request->len);
     if (ret < 0) {
         return nbd_send_generic_reply(client, request->handle, ret,
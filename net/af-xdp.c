@@ -0,0 +1,469 @@
+/*
+ * AF_XDP network backend.
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ */
+
+/*
+ * Every queue of the netdev is an XDP socket bound to one queue of the
+ * host NIC.  The socket has its own UMEM area, which is split into
+ * frames that move between a free pool kept by QEMU and the four rings
+ * shared with the kernel: frames are handed to the kernel through the
+ * fill ring and come back filled on the rx ring, while frames to be sent
+ * go out on the tx ring and come back on the completion ring.
+ *
+ * Both directions work in batches.  The rx ring is drained up to
+ * AF_XDP_BATCH_SIZE descriptors at a time and the fill ring is refilled
+ * once per batch.  Packets from the guest are only placed on the tx
+ * ring; when the kernel needs a wakeup the socket is polled for writing,
+ * and that poll, done once per event loop iteration, is what kicks the
+ * transmission of everything queued so far.
+ */
+
+#include "qemu/osdep.h"
+#include <linux/if_link.h>
+#include <net/if.h>
+#include <xdp/libxdp.h>
+#include <xdp/xsk.h>
+
+#include "block/aio.h"
+#include "clients.h"
+#include "net/net.h"
+#include "qapi/error.h"
+#include "qemu/cutils.h"
+#include "qemu/error-report.h"
+#include "qemu/main-loop.h"
+
+#define AF_XDP_BATCH_SIZE 64
+
+/* Enough frames to fill all four rings at once */
+#define AF_XDP_NUM_FRAMES ((XSK_RING_PROD__DEFAULT_NUM_DESCS + \
+                            XSK_RING_CONS__DEFAULT_NUM_DESCS) * 2)
+
+typedef struct AFXDPState {
+    NetClientState       nc;
+
+    struct xsk_socket    *xsk;
+    struct xsk_ring_cons rx;
+    struct xsk_ring_prod tx;
+    struct xsk_ring_cons cq;
+    struct xsk_ring_prod fq;
+
+    char                 ifname[IFNAMSIZ];
+    int                  ifindex;
+    AioContext           *ctx;
+    bool                 read_poll;
+    bool                 write_poll;
+    uint32_t             outstanding_tx;
+
+    uint64_t             *pool;
+    uint32_t             n_pool;
+    char                 *buffer;
+    struct xsk_umem      *umem;
+
+    uint32_t             n_queues;
+    uint32_t             xdp_flags;
+} AFXDPState;
+
+static void af_xdp_send(void *opaque);
+static void af_xdp_writable(void *opaque);
+
+/* Set the event-loop handlers for the af-xdp backend. */
+static void af_xdp_update_fd_handler(AFXDPState *s)
+{
+    IOHandler *fd_read = s->read_poll ? af_xdp_send : NULL;
+    IOHandler *fd_write = s->write_poll ? af_xdp_writable : NULL;
+    int fd;
+
+    if (!s->xsk) {
+        /* The fill ring is populated before the socket exists. */
+        return;
+    }
+
+    fd = xsk_socket__fd(s->xsk);
+    if (s->ctx) {
+        aio_set_fd_handler(s->ctx, fd, false, fd_read, fd_write, NULL, s);
+    } else {
+        qemu_set_fd_handler(fd, fd_read, fd_write, s);
+    }
+}
+
+/* Update the read handler. */
+static void af_xdp_read_poll(AFXDPState *s, bool enable)
+{
+    if (s->read_poll != enable) {
+        s->read_poll = enable;
+        af_xdp_update_fd_handler(s);
+    }
+}
+
+/* Update the write handler. */
+static void af_xdp_write_poll(AFXDPState *s, bool enable)
+{
+    if (s->write_poll != enable) {
+        s->write_poll = enable;
+        af_xdp_update_fd_handler(s);
+    }
+}
+
+static void af_xdp_poll(NetClientState *nc, bool enable)
+{
+    AFXDPState *s = DO_UPCAST(AFXDPState, nc, nc);
+
+    if (s->read_poll != enable || s->write_poll != enable) {
+        s->write_poll = enable;
+        s->read_poll  = enable;
+        af_xdp_update_fd_handler(s);
+    }
+}
+
+static void af_xdp_set_aio_context(NetClientState *nc, AioContext *ctx)
+{
+    AFXDPState *s = DO_UPCAST(AFXDPState, nc, nc);
+    bool read_poll = s->read_poll;
+    bool write_poll = s->write_poll;
+
+    if (s->ctx == ctx) {
+        return;
+    }
+
+    /* Remove the handlers from the old context before adding them back */
+    af_xdp_poll(nc, false);
+    s->ctx = ctx;
+    s->read_poll = read_poll;
+    s->write_poll = write_poll;
+    af_xdp_update_fd_handler(s);
+}
+
+/* Move the frames that the kernel has finished sending back to the pool. */
+static void af_xdp_complete_tx(AFXDPState *s)
+{
+    uint32_t idx = 0;
+    uint32_t done, i;
+
+    done = xsk_ring_cons__peek(&s->cq, XSK_RING_CONS__DEFAULT_NUM_DESCS, &idx);
+    for (i = 0; i < done; i++) {
+        s->pool[s->n_pool++] = *xsk_ring_cons__comp_addr(&s->cq, idx++);
+    }
+    if (done) {
+        xsk_ring_cons__release(&s->cq, done);
+        s->outstanding_tx -= done;
+    }
+}
+
+/*
+ * The fd_write() callback, invoked if the socket is marked as writable
+ * after a poll.  The poll itself has kicked the tx ring; keep polling
+ * while packets are in flight and the kernel still asks for wakeups,
+ * and flush any packets that were queued for lack of frames.
+ */
+static void af_xdp_writable(void *opaque)
+{
+    AFXDPState *s = opaque;
+
+    af_xdp_complete_tx(s);
+
+    if (!s->outstanding_tx || !xsk_ring_prod__needs_wakeup(&s->tx)) {
+        af_xdp_write_poll(s, false);
+    }
+
+    qemu_flush_queued_packets(&s->nc);
+}
+
+static ssize_t af_xdp_receive(NetClientState *nc,
+                              const uint8_t *buf, size_t size)
+{
+    AFXDPState *s = DO_UPCAST(AFXDPState, nc, nc);
+    struct xdp_desc *desc;
+    uint32_t idx;
+
+    af_xdp_complete_tx(s);
+
+    if (size > XSK_UMEM__DEFAULT_FRAME_SIZE) {
+        /* The packet does not fit in a frame, drop it. */
+        return size;
+    }
+
+    if (!s->n_pool || !xsk_ring_prod__reserve(&s->tx, 1, &idx)) {
+        /*
+         * Out of frames or of room on the tx ring.  Poll until the
+         * kernel sends some of them, the packet is queued meanwhile.
+         */
+        af_xdp_write_poll(s, true);
+        return 0;
+    }
+
+    desc = xsk_ring_prod__tx_desc(&s->tx, idx);
+    desc->addr = s->pool[--s->n_pool];
+    desc->len = size;
+    memcpy(xsk_umem__get_data(s->buffer, desc->addr), buf, size);
+
+    xsk_ring_prod__submit(&s->tx, 1);
+    s->outstanding_tx++;
+
+    if (xsk_ring_prod__needs_wakeup(&s->tx)) {
+        af_xdp_write_poll(s, true);
+    }
+
+    return size;
+}
+
+/* Give up to @n frames from the pool to the kernel for receiving. */
+static void af_xdp_fq_refill(AFXDPState *s, uint32_t n)
+{
+    uint32_t i, idx = 0;
+
+    /* Leave one frame for transmission, so that tx never stalls on rx. */
+    if (s->n_pool < n + 1) {
+        n = s->n_pool ? s->n_pool - 1 : 0;
+    }
+
+    if (!n || !xsk_ring_prod__reserve(&s->fq, n, &idx)) {
+        return;
+    }
+
+    for (i = 0; i < n; i++) {
+        *xsk_ring_prod__fill_addr(&s->fq, idx++) = s->pool[--s->n_pool];
+    }
+    xsk_ring_prod__submit(&s->fq, n);
+
+    if (xsk_ring_prod__needs_wakeup(&s->fq)) {
+        /* Receive was blocked by not having enough frames, wake it up. */
+        af_xdp_read_poll(s, true);
+    }
+}
+
+static void af_xdp_send_completed(NetClientState *nc, ssize_t len)
+{
+    AFXDPState *s = DO_UPCAST(AFXDPState, nc, nc);
+
+    af_xdp_read_poll(s, true);
+}
+
+static void af_xdp_send(void *opaque)
+{
+    AFXDPState *s = opaque;
+    uint32_t i, n_rx, idx = 0;
+
+    n_rx = xsk_ring_cons__peek(&s->rx, AF_XDP_BATCH_SIZE, &idx);
+    if (!n_rx) {
+        return;
+    }
+
+    for (i = 0; i < n_rx; i++) {
+        const struct xdp_desc *desc = xsk_ring_cons__rx_desc(&s->rx, idx++);
+        struct iovec iov = {
+            .iov_base = xsk_umem__get_data(s->buffer, desc->addr),
+            .iov_len = desc->len,
+        };
+
+        /* The packet is either delivered or copied to the queue. */
+        s->pool[s->n_pool++] = desc->addr;
+
+        if (!qemu_sendv_packet_async(&s->nc, &iov, 1,
+                                     af_xdp_send_completed)) {
+            /*
+             * The peer cannot receive any more, stop polling until it
+             * drains the queue and leave the rest of the batch on the
+             * ring.
+             */
+            af_xdp_read_poll(s, false);
+            xsk_ring_cons__cancel(&s->rx, n_rx - i - 1);
+            n_rx = i + 1;
+            break;
+        }
+    }
+
+    xsk_ring_cons__release(&s->rx, n_rx);
+    af_xdp_fq_refill(s, n_rx);
+}
+
+static void af_xdp_cleanup(NetClientState *nc)
+{
+    AFXDPState *s = DO_UPCAST(AFXDPState, nc, nc);
+
+    qemu_purge_queued_packets(nc);
+
+    if (s->xsk) {
+        af_xdp_poll(nc, false);
+        xsk_socket__delete(s->xsk);
+        s->xsk = NULL;
+    }
+    if (s->umem) {
+        xsk_umem__delete(s->umem);
+        s->umem = NULL;
+    }
+    g_free(s->pool);
+    s->pool = NULL;
+    qemu_vfree(s->buffer);
+    s->buffer = NULL;
+
+    /* The XDP program is shared by all queues, remove it with the last. */
+    if (nc->queue_index == s->n_queues - 1 && s->xdp_flags) {
+        struct xdp_multiprog *mp = xdp_multiprog__get_from_ifindex(s->ifindex);
+
+        if (!libxdp_get_error(mp)) {
+            if (xdp_multiprog__detach(mp)) {
+                warn_report("af-xdp: unable to remove XDP program from '%s'",
+                            s->ifname);
+            }
+            xdp_multiprog__close(mp);
+        }
+    }
+}
+
+static int af_xdp_umem_create(AFXDPState *s, Error **errp)
+{
+    struct xsk_umem_config config = {
+        .fill_size = XSK_RING_PROD__DEFAULT_NUM_DESCS,
+        .comp_size = XSK_RING_CONS__DEFAULT_NUM_DESCS,
+        .frame_size = XSK_UMEM__DEFAULT_FRAME_SIZE,
+        .frame_headroom = 0,
+    };
+    uint64_t size = (uint64_t)AF_XDP_NUM_FRAMES * XSK_UMEM__DEFAULT_FRAME_SIZE;
+    int64_t i;
+    int ret;
+
+    s->buffer = qemu_memalign(qemu_real_host_page_size, size);
+    memset(s->buffer, 0, size);
+
+    ret = xsk_umem__create(&s->umem, s->buffer, size, &s->fq, &s->cq, &config);
+    if (ret) {
+        s->umem = NULL;
+        error_setg_errno(errp, -ret, "failed to create umem for '%s' "
+                         "queue %d", s->ifname, s->nc.queue_index);
+        return -1;
+    }
+
+    /* The pool is used as a stack, fill it so that frame 0 is on top. */
+    s->pool = g_new(uint64_t, AF_XDP_NUM_FRAMES);
+    for (i = AF_XDP_NUM_FRAMES - 1; i >= 0; i--) {
+        s->pool[s->n_pool++] = i * XSK_UMEM__DEFAULT_FRAME_SIZE;
+    }
+
+    af_xdp_fq_refill(s, XSK_RING_PROD__DEFAULT_NUM_DESCS);
+
+    return 0;
+}
+
+static int af_xdp_socket_create(AFXDPState *s,
+                                const NetdevAFXDPOptions *opts, Error **errp)
+{
+    struct xsk_socket_config cfg = {
+        .rx_size = XSK_RING_CONS__DEFAULT_NUM_DESCS,
+        .tx_size = XSK_RING_PROD__DEFAULT_NUM_DESCS,
+        .bind_flags = XDP_USE_NEED_WAKEUP,
+        .xdp_flags = XDP_FLAGS_UPDATE_IF_NOEXIST,
+    };
+    int queue_id = s->nc.queue_index;
+    int ret;
+
+    if (opts->has_force_copy && opts->force_copy) {
+        cfg.bind_flags |= XDP_COPY;
+    }
+    if (opts->has_start_queue) {
+        queue_id += opts->start_queue;
+    }
+
+    if (!opts->has_mode || opts->mode == AFXDP_MODE_NATIVE) {
+        cfg.xdp_flags |= XDP_FLAGS_DRV_MODE;
+        ret = xsk_socket__create(&s->xsk, s->ifname, queue_id, s->umem,
+                                 &s->rx, &s->tx, &cfg);
+        /* Fall back to generic mode if the driver has no XDP support. */
+        if (ret && !opts->has_mode) {
+            cfg.xdp_flags &= ~XDP_FLAGS_DRV_MODE;
+            cfg.xdp_flags |= XDP_FLAGS_SKB_MODE;
+            ret = xsk_socket__create(&s->xsk, s->ifname, queue_id, s->umem,
+                                     &s->rx, &s->tx, &cfg);
+        }
+    } else {
+        cfg.xdp_flags |= XDP_FLAGS_SKB_MODE;
+        ret = xsk_socket__create(&s->xsk, s->ifname, queue_id, s->umem,
+                                 &s->rx, &s->tx, &cfg);
+    }
+
+    if (ret) {
+        s->xsk = NULL;
+        error_setg_errno(errp, -ret, "failed to create AF_XDP socket for "
+                         "'%s' queue %d", s->ifname, queue_id);
+        return -1;
+    }
+
+    s->xdp_flags = cfg.xdp_flags;
+    return 0;
+}
+
+/* NetClientInfo methods */
+static NetClientInfo net_af_xdp_info = {
+    .type = NET_CLIENT_DRIVER_AF_XDP,
+    .size = sizeof(AFXDPState),
+    .receive = af_xdp_receive,
+    .poll = af_xdp_poll,
+    .cleanup = af_xdp_cleanup,
+    .set_aio_context = af_xdp_set_aio_context,
+};
+
+/* The exported init function
+ *
+ * ... -netdev af-xdp,ifname="..."
+ */
+int net_init_af_xdp(const Netdev *netdev,
+                    const char *name, NetClientState *peer, Error **errp)
+{
+    const NetdevAFXDPOptions *opts = &netdev->u.af_xdp;
+    NetClientState *nc, *nc0 = NULL;
+    unsigned int ifindex;
+    uint32_t xdp_flags = 0;
+    int64_t i, queues;
+    AFXDPState *s;
+
+    ifindex = if_nametoindex(opts->ifname);
+    if (!ifindex) {
+        error_setg_errno(errp, errno, "failed to get ifindex for '%s'",
+                         opts->ifname);
+        return -1;
+    }
+
+    queues = opts->has_queues ? opts->queues : 1;
+    if (queues < 1 || queues > MAX_QUEUE_NUM) {
+        error_setg(errp, "invalid number of queues (%" PRIi64 ") for '%s'",
+                   queues, opts->ifname);
+        return -1;
+    }
+    if (opts->has_start_queue && opts->start_queue < 0) {
+        error_setg(errp, "invalid start queue (%" PRIi64 ") for '%s'",
+                   opts->start_queue, opts->ifname);
+        return -1;
+    }
+
+    for (i = 0; i < queues; i++) {
+        nc = qemu_new_net_client(&net_af_xdp_info, peer, "af-xdp", name);
+        nc->queue_index = i;
+        if (!nc0) {
+            nc0 = nc;
+        }
+
+        s = DO_UPCAST(AFXDPState, nc, nc);
+        pstrcpy(s->ifname, sizeof(s->ifname), opts->ifname);
+        s->ifindex = ifindex;
+        s->n_queues = queues;
+
+        if (af_xdp_umem_create(s, errp) ||
+            af_xdp_socket_create(s, opts, errp)) {
+            /* Let the failed queue remove the XDP program. */
+            s->n_queues = i + 1;
+            s->xdp_flags = xdp_flags;
+            qemu_del_net_client(nc0);
+            return -1;
+        }
+
+        xdp_flags = s->xdp_flags;
+        snprintf(nc->info_str, sizeof(nc->info_str), "ifname=%s,queue=%d",
+                 s->ifname, (int)(i + (opts->has_start_queue ?
+                                       opts->start_queue : 0)));
+        af_xdp_read_poll(s, true); /* Initially only poll for reads. */
+    }
+
+    return 0;
+}
@@ -10,6 +10,7 @@
 #include "qemu-common.h"
 #include "net/announce.h"
 #include "net/net.h"
+#include "block/aio-wait.h"
 #include "qapi/clone-visitor.h"
 #include "qapi/qapi-visit-net.h"
 #include "qapi/qapi-commands-net.h"
@@ -120,6 +121,37 @@ static int announce_self_create(uint8_t *buf,
     return 60; /* len (FCS will be added by hardware) */
 }
 
+typedef struct AnnounceSend {
+    NetClientState *nc;
+    uint8_t *buf;
+    int len;
+} AnnounceSend;
+
+static void qemu_announce_send_bh(void *opaque)
+{
+    AnnounceSend *as = opaque;
+
+    qemu_send_packet_raw(as->nc, as->buf, as->len);
+}
+
+/*
+ * Send the announcement from the context the peer runs in, because that
+ * is where its queue and fd handlers are used.
+ */
+static void qemu_announce_send(NetClientState *nc, uint8_t *buf, int len)
+{
+    AnnounceSend as = { .nc = nc, .buf = buf, .len = len };
+    AioContext *ctx = nc->peer ? nc->peer->ctx : NULL;
+
+    if (ctx) {
+        aio_context_acquire(ctx);
+        aio_wait_bh_oneshot(ctx, qemu_announce_send_bh, &as);
+        aio_context_release(ctx);
+    } else {
+        qemu_announce_send_bh(&as);
+    }
+}
+
 static void qemu_announce_self_iter(NICState *nic, void *opaque)
 {
     AnnounceTimer *timer = opaque;
@@ -151,7 +183,7 @@ static void qemu_announce_self_iter(NICState *nic, void *opaque)
     if (!skip) {
         len = announce_self_create(buf, nic->conf->macaddr.a);
 
-        qemu_send_packet_raw(qemu_get_queue(nic), buf, len);
+        qemu_announce_send(qemu_get_queue(nic), buf, len);
 
         /* if the NIC provides it's own announcement support, use it as well */
         if (nic->ncs->info->announce) {
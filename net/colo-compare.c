@@ -194,7 +194,7 @@ static void colo_compare_inconsistency_notify(CompareState *s)
     }
 }
 
-/* Use restricted to colo_insert_packet() */
+/* Use restricted to colo_insert_tcp_packet() */
 static gint seq_sorter(Packet *a, Packet *b, gpointer data)
 {
     return a->tcp_seq - b->tcp_seq;
@@ -217,6 +217,25 @@ static void fill_pkt_tcp_info(void *data, uint32_t *max_ack)
     pkt->flags = tcphd->th_flags;
 }
 
+/*
+ * Insert pkt after the packets with a lower or equal sequence number, like
+ * g_queue_insert_sorted() would.  Segments mostly arrive in order, so look
+ * for the place from the tail rather than walk the whole queue each time.
+ */
+static void colo_insert_tcp_packet(GQueue *queue, Packet *pkt)
+{
+    GList *link = queue->tail;
+
+    while (link && seq_sorter(link->data, pkt, NULL) > 0) {
+        link = link->prev;
+    }
+    if (link) {
+        g_queue_insert_after(queue, link, pkt);
+    } else {
+        g_queue_push_head(queue, pkt);
+    }
+}
+
 /*
  * Return 1 on success, if return 0 means the
  * packet will be dropped
@@ -226,10 +245,7 @@ static int colo_insert_packet(GQueue *queue, Packet *pkt, uint32_t *max_ack)
     if (g_queue_get_length(queue) <= max_queue_size) {
         if (pkt->ip->ip_p == IPPROTO_TCP) {
             fill_pkt_tcp_info(pkt, max_ack);
-            g_queue_insert_sorted(queue,
-                                  pkt,
-                                  (GCompareDataFunc)seq_sorter,
-                                  NULL);
+            colo_insert_tcp_packet(queue, pkt);
         } else {
             g_queue_push_tail(queue, pkt);
         }
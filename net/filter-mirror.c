@@ -13,9 +13,11 @@
 #include "net/filter.h"
 #include "net/net.h"
 #include "qapi/error.h"
+#include "qapi/visitor.h"
 #include "qom/object.h"
 #include "qemu/main-loop.h"
 #include "qemu/error-report.h"
+#include "qemu/thread.h"
 #include "trace.h"
 #include "chardev/char-fe.h"
 #include "qemu/iov.h"
@@ -40,58 +42,162 @@ struct MirrorState {
     CharBackend chr_out;
     SocketReadState rs;
     bool vnet_hdr;
+
+    /*
+     * With a non-zero queue_size, filter-mirror appends the packets to
+     * @pending, and the main loop writes each batch that accumulated as
+     * far as @outdev takes it without blocking, then waits for it to be
+     * writable again.  A slow reader of @outdev thus does not stall the
+     * network backend.  Packets that do not fit are dropped and counted
+     * in @dropped.
+     */
+    uint32_t queue_size;
+    /* Protects @dropped and @pending, packets may come from an IOThread */
+    QemuMutex lock;
+    uint64_t dropped;
+    GByteArray *pending;
+    /* Main loop only: the batch being written and how much of it is out */
+    GByteArray *batch;
+    size_t batch_off;
+    QEMUBH *flush_bh;
+    guint watch;
 };
 
+static size_t filter_frame_len(MirrorState *s, size_t size)
+{
+    return sizeof(uint32_t) * (s->vnet_hdr ? 2 : 1) + size;
+}
+
+/*
+ * Store a packet of @size bytes in @dst, preceded by its length and,
+ * if vnet_hdr = on, by the vnet header length, which lets the receiving
+ * module (like colo-compare) know how to parse the packet correctly.
+ */
+static void filter_frame(MirrorState *s, uint8_t *dst,
+                         const struct iovec *iov, int iovcnt, size_t size)
+{
+    NetFilterState *nf = NETFILTER(s);
+
+    stl_be_p(dst, size);
+    dst += sizeof(uint32_t);
+    if (s->vnet_hdr) {
+        stl_be_p(dst, nf->netdev->vnet_hdr_len);
+        dst += sizeof(uint32_t);
+    }
+    iov_to_buf(iov, iovcnt, 0, dst, size);
+}
+
 static int filter_send(MirrorState *s,
                        const struct iovec *iov,
                        int iovcnt)
 {
-    NetFilterState *nf = NETFILTER(s);
     int ret = 0;
     ssize_t size = 0;
-    uint32_t len = 0;
-    char *buf;
+    size_t len;
+    uint8_t *buf;
 
     size = iov_size(iov, iovcnt);
     if (!size) {
         return 0;
     }
 
-    len = htonl(size);
-    ret = qemu_chr_fe_write_all(&s->chr_out, (uint8_t *)&len, sizeof(len));
-    if (ret != sizeof(len)) {
-        goto err;
+    len = filter_frame_len(s, size);
+    buf = g_malloc(len);
+    filter_frame(s, buf, iov, iovcnt, size);
+    ret = qemu_chr_fe_write_all(&s->chr_out, buf, len);
+    g_free(buf);
+    if (ret != len) {
+        return ret < 0 ? ret : -EIO;
     }
 
-    if (s->vnet_hdr) {
-        /*
-         * If vnet_hdr = on, we send vnet header len to make other
-         * module(like colo-compare) know how to parse net
-         * packet correctly.
-         */
-        ssize_t vnet_hdr_len;
-
-        vnet_hdr_len = nf->netdev->vnet_hdr_len;
-
-        len = htonl(vnet_hdr_len);
-        ret = qemu_chr_fe_write_all(&s->chr_out, (uint8_t *)&len, sizeof(len));
-        if (ret != sizeof(len)) {
-            goto err;
+    return size;
+}
+
+static void filter_mirror_flush(void *opaque);
+
+static gboolean filter_mirror_writable(void *do_not_use, GIOCondition cond,
+                                       void *opaque)
+{
+    MirrorState *s = opaque;
+
+    s->watch = 0;
+    filter_mirror_flush(s);
+    return G_SOURCE_REMOVE;
+}
+
+/* Context: main loop */
+static void filter_mirror_flush(void *opaque)
+{
+    MirrorState *s = opaque;
+    GByteArray *tmp;
+    int ret;
+
+    /* Still waiting for @outdev to take the current batch */
+    if (s->watch) {
+        return;
+    }
+
+    for (;;) {
+        if (s->batch_off == s->batch->len) {
+            /* Take everything queued so far and let the backend go on. */
+            g_byte_array_set_size(s->batch, 0);
+            s->batch_off = 0;
+            qemu_mutex_lock(&s->lock);
+            tmp = s->pending;
+            s->pending = s->batch;
+            s->batch = tmp;
+            qemu_mutex_unlock(&s->lock);
+            if (!s->batch->len) {
+                return;
+            }
+        }
+
+        ret = qemu_chr_fe_write(&s->chr_out, s->batch->data + s->batch_off,
+                                s->batch->len - s->batch_off);
+        if (ret > 0) {
+            s->batch_off += ret;
+            continue;
+        }
+
+        s->watch = qemu_chr_fe_add_watch(&s->chr_out, G_IO_OUT | G_IO_HUP,
+                                         filter_mirror_writable, s);
+        if (s->watch) {
+            return;
         }
+        /* There is nothing to wait for, like a missing backend */
+        error_report("filter mirror send failed(%s)",
+                     strerror(ret < 0 ? errno : EIO));
+        s->batch_off = s->batch->len;
     }
+}
 
-    buf = g_malloc(size);
-    iov_to_buf(iov, iovcnt, 0, buf, size);
-    ret = qemu_chr_fe_write_all(&s->chr_out, (uint8_t *)buf, size);
-    g_free(buf);
-    if (ret != size) {
-        goto err;
+static void filter_mirror_queue(MirrorState *s,
+                                const struct iovec *iov,
+                                int iovcnt)
+{
+    size_t size = iov_size(iov, iovcnt);
+    size_t len, old_len;
+
+    if (!size) {
+        return;
     }
 
-    return size;
+    len = filter_frame_len(s, size);
+    qemu_mutex_lock(&s->lock);
+    old_len = s->pending->len;
+    if (old_len + len > s->queue_size) {
+        s->dropped++;
+        qemu_mutex_unlock(&s->lock);
+        trace_filter_mirror_drop(NETFILTER(s)->netdev_id, size, old_len);
+        return;
+    }
+    g_byte_array_set_size(s->pending, old_len + len);
+    filter_frame(s, s->pending->data + old_len, iov, iovcnt, size);
+    qemu_mutex_unlock(&s->lock);
 
-err:
-    return ret < 0 ? ret : -EIO;
+    if (!old_len) {
+        qemu_bh_schedule(s->flush_bh);
+    }
 }
 
 static void redirector_to_filter(NetFilterState *nf,
@@ -158,6 +264,11 @@ static ssize_t filter_mirror_receive_iov(NetFilterState *nf,
     MirrorState *s = FILTER_MIRROR(nf);
     int ret;
 
+    if (s->queue_size) {
+        filter_mirror_queue(s, iov, iovcnt);
+        return 0;
+    }
+
     ret = filter_send(s, iov, iovcnt);
     if (ret < 0) {
         error_report("filter mirror send failed(%s)", strerror(-ret));
@@ -195,6 +306,19 @@ static void filter_mirror_cleanup(NetFilterState *nf)
 {
     MirrorState *s = FILTER_MIRROR(nf);
 
+    if (s->pending) {
+        if (s->watch) {
+            g_source_remove(s->watch);
+            s->watch = 0;
+        }
+        qemu_bh_delete(s->flush_bh);
+        s->flush_bh = NULL;
+        g_byte_array_unref(s->batch);
+        s->batch = NULL;
+        g_byte_array_unref(s->pending);
+        s->pending = NULL;
+    }
+
     qemu_chr_fe_deinit(&s->chr_out, false);
 }
 
@@ -224,7 +348,16 @@ static void filter_mirror_setup(NetFilterState *nf, Error **errp)
         return;
     }
 
-    qemu_chr_fe_init(&s->chr_out, chr, errp);
+    if (!qemu_chr_fe_init(&s->chr_out, chr, errp)) {
+        return;
+    }
+
+    if (s->queue_size) {
+        s->pending = g_byte_array_sized_new(s->queue_size);
+        s->batch = g_byte_array_sized_new(s->queue_size);
+        s->batch_off = 0;
+        s->flush_bh = qemu_bh_new(filter_mirror_flush, s);
+    }
 }
 
 static void redirector_rs_finalize(SocketReadState *rs)
@@ -337,6 +470,46 @@ static void filter_mirror_set_vnet_hdr(Object *obj, bool value, Error **errp)
     s->vnet_hdr = value;
 }
 
+static void filter_mirror_get_queue_size(Object *obj, Visitor *v,
+                                         const char *name, void *opaque,
+                                         Error **errp)
+{
+    MirrorState *s = FILTER_MIRROR(obj);
+
+    visit_type_uint32(v, name, &s->queue_size, errp);
+}
+
+static void filter_mirror_set_queue_size(Object *obj, Visitor *v,
+                                         const char *name, void *opaque,
+                                         Error **errp)
+{
+    MirrorState *s = FILTER_MIRROR(obj);
+    uint32_t value;
+
+    if (NETFILTER(obj)->netdev) {
+        error_setg(errp, "Property '%s.%s' can not be changed once the "
+                   "filter is running", object_get_typename(obj), name);
+        return;
+    }
+    if (!visit_type_uint32(v, name, &value, errp)) {
+        return;
+    }
+    s->queue_size = value;
+}
+
+static void filter_mirror_get_dropped(Object *obj, Visitor *v,
+                                      const char *name, void *opaque,
+                                      Error **errp)
+{
+    MirrorState *s = FILTER_MIRROR(obj);
+    uint64_t value;
+
+    WITH_QEMU_LOCK_GUARD(&s->lock) {
+        value = s->dropped;
+    }
+    visit_type_uint64(v, name, &value, errp);
+}
+
 static char *filter_redirector_get_outdev(Object *obj, Error **errp)
 {
     MirrorState *s = FILTER_REDIRECTOR(obj);
@@ -379,6 +552,9 @@ static void filter_mirror_class_init(ObjectClass *oc, void *data)
     object_class_property_add_bool(oc, "vnet_hdr_support",
                                    filter_mirror_get_vnet_hdr,
                                    filter_mirror_set_vnet_hdr);
+    object_class_property_add(oc, "queue-size", "uint32",
+                              filter_mirror_get_queue_size,
+                              filter_mirror_set_queue_size, NULL, NULL);
 
     nfc->setup = filter_mirror_setup;
     nfc->cleanup = filter_mirror_cleanup;
@@ -407,6 +583,9 @@ static void filter_mirror_init(Object *obj)
     MirrorState *s = FILTER_MIRROR(obj);
 
     s->vnet_hdr = false;
+    qemu_mutex_init(&s->lock);
+    object_property_add(obj, "dropped", "uint64", filter_mirror_get_dropped,
+                        NULL, NULL, NULL);
 }
 
 static void filter_redirector_init(Object *obj)
@@ -420,6 +599,7 @@ static void filter_mirror_fini(Object *obj)
 {
     MirrorState *s = FILTER_MIRROR(obj);
 
+    qemu_mutex_destroy(&s->lock);
     g_free(s->outdev);
 }
 
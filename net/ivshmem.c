@@ -0,0 +1,487 @@
+/*
+ * ivshmem network backend.
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ */
+
+/*
+ * Two QEMU instances exchange frames through the shared memory and the
+ * eventfd doorbells handed out by an ivshmem-server that is dedicated to
+ * the link.  The shared memory is split in two rings, one per direction;
+ * the first one is written by the peer with the lower id.  A ring is a
+ * power-of-two array of fixed size slots holding one frame each, with
+ * free-running producer and consumer indices that are each written by
+ * one side only.
+ *
+ * Frames from the guest are copied into the next slot, and the peer's
+ * doorbell is rung from a bottom half, so a burst of frames costs a
+ * single eventfd write.  Incoming frames are passed to the net layer
+ * straight from the shared memory.  When the ring is full, the producer
+ * sets a flag asking the consumer to ring back once it has freed slots,
+ * and the frame waits on the net queue meanwhile.
+ *
+ * A peer that connects cannot trust indices left over by a predecessor,
+ * so the consumer of each ring skips whatever is on it when its partner
+ * changes.  Frames in flight at that point are lost.
+ */
+
+#include "qemu/osdep.h"
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include "clients.h"
+#include "hw/misc/ivshmem.h"
+#include "net/net.h"
+#include "qapi/error.h"
+#include "qemu/atomic.h"
+#include "qemu/error-report.h"
+#include "qemu/host-utils.h"
+#include "qemu/iov.h"
+#include "qemu/main-loop.h"
+#include "qemu/sockets.h"
+
+#define IVSHMEM_NET_SLOT_SIZE 2048
+#define IVSHMEM_NET_MAX_FRAME (IVSHMEM_NET_SLOT_SIZE - sizeof(uint32_t))
+
+typedef struct IvshmemNetSlot {
+    uint32_t len;
+    uint8_t data[IVSHMEM_NET_MAX_FRAME];
+} IvshmemNetSlot;
+
+typedef struct IvshmemNetRing {
+    /* written by the producer */
+    uint32_t prod;
+    /* set by the producer when the ring is full, cleared by the consumer */
+    uint32_t prod_waiting;
+    uint8_t pad0[56];
+    /* written by the consumer */
+    uint32_t cons;
+    uint8_t pad1[60];
+    IvshmemNetSlot slots[];
+} IvshmemNetRing;
+
+typedef struct IvshmemNetState {
+    NetClientState nc;
+
+    int sock_fd;
+    int64_t id;
+    int doorbell_fd;
+
+    /* the other end of the link, -1 while it is not connected */
+    int64_t peer_id;
+    int peer_doorbell_fd;
+
+    void *shm;
+    size_t shm_size;
+    IvshmemNetRing *tx;
+    IvshmemNetRing *rx;
+    uint32_t nr_slots;
+
+    QEMUBH *kick_bh;
+    bool read_poll;
+    bool tx_blocked;
+} IvshmemNetState;
+
+static void ivshmem_net_doorbell(void *opaque);
+
+static void ivshmem_net_read_poll(IvshmemNetState *s, bool enable)
+{
+    if (s->read_poll != enable) {
+        s->read_poll = enable;
+        if (s->doorbell_fd >= 0) {
+            qemu_set_fd_handler(s->doorbell_fd,
+                                enable ? ivshmem_net_doorbell : NULL, NULL, s);
+        }
+    }
+}
+
+/* Ring the partner's doorbell, once for everything done since last time. */
+static void ivshmem_net_kick(void *opaque)
+{
+    IvshmemNetState *s = opaque;
+    uint64_t one = 1;
+
+    if (s->peer_doorbell_fd < 0) {
+        return;
+    }
+    if (write(s->peer_doorbell_fd, &one, sizeof(one)) != sizeof(one) &&
+        errno != EAGAIN) {
+        warn_report_once("ivshmem netdev: cannot ring the peer's doorbell: %s",
+                         strerror(errno));
+    }
+}
+
+static uint32_t ivshmem_net_ring_used(IvshmemNetState *s,
+                                      uint32_t prod, uint32_t cons)
+{
+    uint32_t used = prod - cons;
+
+    return used > s->nr_slots ? s->nr_slots : used;
+}
+
+static ssize_t ivshmem_net_receive_iov(NetClientState *nc,
+                                       const struct iovec *iov, int iovcnt)
+{
+    IvshmemNetState *s = DO_UPCAST(IvshmemNetState, nc, nc);
+    size_t size = iov_size(iov, iovcnt);
+    IvshmemNetRing *ring = s->tx;
+    IvshmemNetSlot *slot;
+    uint32_t prod, cons;
+
+    if (s->peer_id < 0 || size > IVSHMEM_NET_MAX_FRAME) {
+        /* Nobody to send to, or the frame does not fit in a slot. */
+        return size;
+    }
+
+    prod = ring->prod;
+    cons = qatomic_load_acquire(&ring->cons);
+    if (ivshmem_net_ring_used(s, prod, cons) == s->nr_slots) {
+        /*
+         * Ask the consumer to ring back when it makes room, then look
+         * again in case it did so before seeing the request.
+         */
+        qatomic_set(&ring->prod_waiting, 1);
+        smp_mb();
+        cons = qatomic_load_acquire(&ring->cons);
+        if (ivshmem_net_ring_used(s, prod, cons) == s->nr_slots) {
+            s->tx_blocked = true;
+            qemu_bh_schedule(s->kick_bh);
+            return 0;
+        }
+    }
+
+    slot = &ring->slots[prod & (s->nr_slots - 1)];
+    iov_to_buf(iov, iovcnt, 0, slot->data, size);
+    slot->len = size;
+    qatomic_store_release(&ring->prod, prod + 1);
+
+    qemu_bh_schedule(s->kick_bh);
+    return size;
+}
+
+static ssize_t ivshmem_net_receive(NetClientState *nc,
+                                   const uint8_t *buf, size_t size)
+{
+    struct iovec iov = {
+        .iov_base = (void *)buf,
+        .iov_len = size,
+    };
+
+    return ivshmem_net_receive_iov(nc, &iov, 1);
+}
+
+static void ivshmem_net_send(IvshmemNetState *s);
+
+static void ivshmem_net_send_completed(NetClientState *nc, ssize_t len)
+{
+    IvshmemNetState *s = DO_UPCAST(IvshmemNetState, nc, nc);
+
+    ivshmem_net_read_poll(s, true);
+    ivshmem_net_send(s);
+}
+
+/* Pass the frames on the receive ring to the net layer. */
+static void ivshmem_net_send(IvshmemNetState *s)
+{
+    IvshmemNetRing *ring = s->rx;
+    uint32_t prod, cons;
+
+    if (s->peer_id < 0 || !s->read_poll) {
+        return;
+    }
+
+    cons = ring->cons;
+    prod = qatomic_load_acquire(&ring->prod);
+    if (prod - cons > s->nr_slots) {
+        /* Garbage from a misbehaving peer, drop everything. */
+        cons = prod;
+    }
+
+    while (cons != prod) {
+        IvshmemNetSlot *slot = &ring->slots[cons & (s->nr_slots - 1)];
+        uint32_t len = qatomic_read(&slot->len);
+        ssize_t ret;
+
+        cons++;
+        if (len > IVSHMEM_NET_MAX_FRAME) {
+            continue;
+        }
+
+        /* The frame is either delivered or copied to the queue. */
+        ret = qemu_send_packet_async(&s->nc, slot->data, len,
+                                     ivshmem_net_send_completed);
+        if (ret == 0) {
+            /* The peer cannot receive any more, wait until it drains. */
+            ivshmem_net_read_poll(s, false);
+            break;
+        }
+    }
+
+    qatomic_store_release(&ring->cons, cons);
+
+    smp_mb();
+    if (qatomic_read(&ring->prod_waiting)) {
+        qatomic_set(&ring->prod_waiting, 0);
+        qemu_bh_schedule(s->kick_bh);
+    }
+}
+
+static void ivshmem_net_doorbell(void *opaque)
+{
+    IvshmemNetState *s = opaque;
+    uint64_t val;
+
+    if (read(s->doorbell_fd, &val, sizeof(val)) < 0 && errno != EAGAIN) {
+        warn_report_once("ivshmem netdev: cannot read doorbell: %s",
+                         strerror(errno));
+    }
+
+    /* The same doorbell announces new frames and free slots. */
+    if (s->tx_blocked) {
+        s->tx_blocked = false;
+        qemu_flush_queued_packets(&s->nc);
+    }
+    ivshmem_net_send(s);
+}
+
+/* Read one message from the server: a 64-bit index and maybe a fd. */
+static int ivshmem_net_read_msg(int sock_fd, int64_t *index, int *fd)
+{
+    struct msghdr msg = { 0 };
+    struct iovec iov = {
+        .iov_base = index,
+        .iov_len = sizeof(*index),
+    };
+    union {
+        struct cmsghdr cmsg;
+        char control[CMSG_SPACE(sizeof(int))];
+    } msg_control;
+    struct cmsghdr *cmsg;
+    ssize_t ret;
+
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = &msg_control;
+    msg.msg_controllen = sizeof(msg_control);
+
+    do {
+        ret = recvmsg(sock_fd, &msg, 0);
+    } while (ret < 0 && errno == EINTR);
+    if (ret < (ssize_t)sizeof(*index)) {
+        return -1;
+    }
+
+    *index = le64_to_cpu(*index);
+    *fd = -1;
+    for (cmsg = CMSG_FIRSTHDR(&msg); cmsg; cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+        if (cmsg->cmsg_len == CMSG_LEN(sizeof(int)) &&
+            cmsg->cmsg_level == SOL_SOCKET &&
+            cmsg->cmsg_type == SCM_RIGHTS) {
+            memcpy(fd, CMSG_DATA(cmsg), sizeof(*fd));
+        }
+    }
+
+    return 0;
+}
+
+static void ivshmem_net_peer_connected(IvshmemNetState *s, int64_t id, int fd)
+{
+    IvshmemNetRing *ring0 = s->shm;
+    IvshmemNetRing *ring1 = s->shm + QEMU_ALIGN_DOWN(s->shm_size / 2, 64);
+
+    s->tx = s->id < id ? ring0 : ring1;
+    s->rx = s->id < id ? ring1 : ring0;
+    s->peer_id = id;
+    s->peer_doorbell_fd = fd;
+
+    /* Skip whatever a previous partner left on the ring. */
+    qatomic_store_release(&s->rx->cons, qatomic_load_acquire(&s->rx->prod));
+    qemu_bh_schedule(s->kick_bh);
+
+    if (s->tx_blocked) {
+        s->tx_blocked = false;
+        qemu_flush_queued_packets(&s->nc);
+    }
+}
+
+/*
+ * The server announces the doorbells of every peer, including ours, as
+ * they connect, and sends a message without a fd when a peer goes away.
+ * Only the first vector of each peer is used.
+ */
+static void ivshmem_net_server_msg(void *opaque)
+{
+    IvshmemNetState *s = opaque;
+    int64_t id;
+    int fd;
+
+    if (ivshmem_net_read_msg(s->sock_fd, &id, &fd) < 0) {
+        warn_report("ivshmem netdev: lost connection to the server");
+        qemu_set_fd_handler(s->sock_fd, NULL, NULL, NULL);
+        return;
+    }
+
+    if (fd < 0) {
+        if (id == s->peer_id) {
+            close(s->peer_doorbell_fd);
+            s->peer_doorbell_fd = -1;
+            s->peer_id = -1;
+            /* Nobody will drain the ring now, drop what was waiting on it. */
+            if (s->tx_blocked) {
+                s->tx_blocked = false;
+                qemu_flush_queued_packets(&s->nc);
+            }
+        }
+        return;
+    }
+
+    if (id == s->id && s->doorbell_fd < 0) {
+        qemu_set_nonblock(fd);
+        s->doorbell_fd = fd;
+        /* Pick up the frames that were sent before we got here. */
+        ivshmem_net_read_poll(s, true);
+        ivshmem_net_send(s);
+    } else if (id != s->id && s->peer_id < 0) {
+        qemu_set_nonblock(fd);
+        ivshmem_net_peer_connected(s, id, fd);
+        ivshmem_net_send(s);
+    } else {
+        if (id != s->id && id != s->peer_id) {
+            warn_report_once("ivshmem netdev: ignoring peer %" PRId64
+                             ", only two peers can share a link", id);
+        }
+        close(fd);
+    }
+}
+
+static void ivshmem_net_cleanup(NetClientState *nc)
+{
+    IvshmemNetState *s = DO_UPCAST(IvshmemNetState, nc, nc);
+
+    qemu_purge_queued_packets(nc);
+
+    ivshmem_net_read_poll(s, false);
+    qemu_set_fd_handler(s->sock_fd, NULL, NULL, NULL);
+    qemu_bh_delete(s->kick_bh);
+
+    if (s->doorbell_fd >= 0) {
+        close(s->doorbell_fd);
+    }
+    if (s->peer_doorbell_fd >= 0) {
+        close(s->peer_doorbell_fd);
+    }
+    close(s->sock_fd);
+    munmap(s->shm, s->shm_size);
+}
+
+/* Connect to the server and map the shared memory it hands out. */
+static int ivshmem_net_connect(const char *path, int64_t *id, void **shm,
+                               size_t *shm_size, Error **errp)
+{
+    int64_t version;
+    struct stat st;
+    int sock_fd, shm_fd = -1;
+    int fd;
+
+    sock_fd = unix_connect(path, errp);
+    if (sock_fd < 0) {
+        return -1;
+    }
+
+    if (ivshmem_net_read_msg(sock_fd, &version, &fd) < 0 || fd >= 0 ||
+        version != IVSHMEM_PROTOCOL_VERSION) {
+        error_setg(errp, "ivshmem server '%s' speaks an unknown protocol",
+                   path);
+        goto fail;
+    }
+    if (ivshmem_net_read_msg(sock_fd, id, &fd) < 0 || fd >= 0 || *id < 0) {
+        error_setg(errp, "ivshmem server '%s' did not send a peer id", path);
+        goto fail;
+    }
+    if (ivshmem_net_read_msg(sock_fd, &version, &shm_fd) < 0 || shm_fd < 0) {
+        error_setg(errp, "ivshmem server '%s' did not send the shared memory",
+                   path);
+        goto fail;
+    }
+
+    if (fstat(shm_fd, &st) < 0) {
+        error_setg_errno(errp, errno, "cannot get the shared memory size");
+        goto fail;
+    }
+    *shm_size = st.st_size;
+    *shm = mmap(NULL, *shm_size, PROT_READ | PROT_WRITE, MAP_SHARED,
+                shm_fd, 0);
+    if (*shm == MAP_FAILED) {
+        error_setg_errno(errp, errno, "cannot map the shared memory");
+        goto fail;
+    }
+    close(shm_fd);
+
+    return sock_fd;
+
+fail:
+    if (shm_fd >= 0) {
+        close(shm_fd);
+    }
+    close(sock_fd);
+    return -1;
+}
+
+/* NetClientInfo methods */
+static NetClientInfo net_ivshmem_info = {
+    .type = NET_CLIENT_DRIVER_IVSHMEM,
+    .size = sizeof(IvshmemNetState),
+    .receive = ivshmem_net_receive,
+    .receive_iov = ivshmem_net_receive_iov,
+    .cleanup = ivshmem_net_cleanup,
+};
+
+/* The exported init function
+ *
+ * ... -netdev ivshmem,server="..."
+ */
+int net_init_ivshmem(const Netdev *netdev,
+                     const char *name, NetClientState *peer, Error **errp)
+{
+    const NetdevIvshmemOptions *opts = &netdev->u.ivshmem;
+    NetClientState *nc;
+    IvshmemNetState *s;
+    size_t shm_size, ring_size;
+    int64_t id;
+    void *shm;
+    int fd;
+
+    fd = ivshmem_net_connect(opts->server, &id, &shm, &shm_size, errp);
+    if (fd < 0) {
+        return -1;
+    }
+
+    ring_size = QEMU_ALIGN_DOWN(shm_size / 2, 64);
+    if (ring_size < sizeof(IvshmemNetRing) + sizeof(IvshmemNetSlot)) {
+        error_setg(errp, "ivshmem server '%s' shared memory is too small",
+                   opts->server);
+        munmap(shm, shm_size);
+        close(fd);
+        return -1;
+    }
+
+    nc = qemu_new_net_client(&net_ivshmem_info, peer, "ivshmem", name);
+    s = DO_UPCAST(IvshmemNetState, nc, nc);
+    s->sock_fd = fd;
+    s->id = id;
+    s->doorbell_fd = -1;
+    s->peer_id = -1;
+    s->peer_doorbell_fd = -1;
+    s->shm = shm;
+    s->shm_size = shm_size;
+    s->nr_slots = pow2floor((ring_size - sizeof(IvshmemNetRing)) /
+                            sizeof(IvshmemNetSlot));
+    s->kick_bh = qemu_bh_new(ivshmem_net_kick, s);
+
+    snprintf(nc->info_str, sizeof(nc->info_str), "server=%s,id=%" PRId64,
+             opts->server, id);
+    qemu_set_fd_handler(fd, ivshmem_net_server_msg, NULL, s);
+
+    return 0;
+}
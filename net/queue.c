@@ -23,6 +23,7 @@
 
 #include "qemu/osdep.h"
 #include "net/queue.h"
+#include "qemu/iov.h"
 #include "qemu/queue.h"
 #include "net/net.h"
 
@@ -46,6 +47,9 @@ struct NetPacket {
     unsigned flags;
     int size;
     NetPacketSent *sent_cb;
+    /* The sender's buffers, if they were not copied to data */
+    struct iovec *iov;
+    int iovcnt;
     uint8_t data[];
 };
 
@@ -78,13 +82,19 @@ NetQueue *qemu_new_net_queue(NetQueueDeliverFunc *deliver, void *opaque)
     return queue;
 }
 
+static void qemu_net_packet_free(NetPacket *packet)
+{
+    g_free(packet->iov);
+    g_free(packet);
+}
+
 void qemu_del_net_queue(NetQueue *queue)
 {
     NetPacket *packet, *next;
 
     QTAILQ_FOREACH_SAFE(packet, &queue->packets, entry, next) {
         QTAILQ_REMOVE(&queue->packets, packet, entry);
-        g_free(packet);
+        qemu_net_packet_free(packet);
     }
 
     g_free(queue);
@@ -107,6 +117,8 @@ static void qemu_net_queue_append(NetQueue *queue,
     packet->flags = flags;
     packet->size = size;
     packet->sent_cb = sent_cb;
+    packet->iov = NULL;
+    packet->iovcnt = 0;
     memcpy(packet->data, buf, size);
 
     queue->nq_count++;
@@ -127,6 +139,21 @@ void qemu_net_queue_append_iov(NetQueue *queue,
     if (queue->nq_count >= queue->nq_maxlen && !sent_cb) {
         return; /* drop if queue full and no callback */
     }
+
+    if (sent_cb && (flags & QEMU_NET_PACKET_FLAG_NOCOPY)) {
+        packet = g_malloc(sizeof(NetPacket));
+        packet->sender = sender;
+        packet->sent_cb = sent_cb;
+        packet->flags = flags;
+        packet->size = iov_size(iov, iovcnt);
+        packet->iov = g_memdup(iov, iovcnt * sizeof(*iov));
+        packet->iovcnt = iovcnt;
+
+        queue->nq_count++;
+        QTAILQ_INSERT_TAIL(&queue->packets, packet, entry);
+        return;
+    }
+
     for (i = 0; i < iovcnt; i++) {
         max_len += iov[i].iov_len;
     }
@@ -136,6 +163,8 @@ void qemu_net_queue_append_iov(NetQueue *queue,
     packet->sent_cb = sent_cb;
     packet->flags = flags;
     packet->size = 0;
+    packet->iov = NULL;
+    packet->iovcnt = 0;
 
     for (i = 0; i < iovcnt; i++) {
         size_t len = iov[i].iov_len;
@@ -265,7 +294,7 @@ void qemu_net_queue_purge(NetQueue *queue, NetClientState *from)
             if (packet->sent_cb) {
                 packet->sent_cb(packet->sender, 0);
             }
-            g_free(packet);
+            qemu_net_packet_free(packet);
         }
     }
 }
@@ -283,11 +312,19 @@ bool qemu_net_queue_flush(NetQueue *queue)
         QTAILQ_REMOVE(&queue->packets, packet, entry);
         queue->nq_count--;
 
-        ret = qemu_net_queue_deliver(queue,
-                                     packet->sender,
-                                     packet->flags,
-                                     packet->data,
-                                     packet->size);
+        if (packet->iov) {
+            ret = qemu_net_queue_deliver_iov(queue,
+                                             packet->sender,
+                                             packet->flags,
+                                             packet->iov,
+                                             packet->iovcnt);
+        } else {
+            ret = qemu_net_queue_deliver(queue,
+                                         packet->sender,
+                                         packet->flags,
+                                         packet->data,
+                                         packet->size);
+        }
         if (ret == 0) {
             queue->nq_count++;
             QTAILQ_INSERT_HEAD(&queue->packets, packet, entry);
@@ -298,7 +335,7 @@ bool qemu_net_queue_flush(NetQueue *queue)
             packet->sent_cb(packet->sender, ret);
         }
 
-        g_free(packet);
+        qemu_net_packet_free(packet);
     }
     return true;
 }
@@ -12,6 +12,7 @@
 #include "clients.h"
 #include "net/vhost_net.h"
 #include "net/vhost-user.h"
+#include "hw/virtio/vhost.h"
 #include "hw/virtio/vhost-user.h"
 #include "chardev/char-fe.h"
 #include "qapi/error.h"
@@ -26,6 +27,11 @@ typedef struct NetVhostUserState {
     CharBackend chr; /* only queue index 0 */
     VhostUserState *vhost_user;
     VHostNetState *vhost_net;
+    /*
+     * survives backend restarts, cleared when the guest resets the device;
+     * NULL with multiple queue pairs
+     */
+    struct vhost_inflight *inflight;
     guint watch;
     uint64_t acked_features;
     bool started;
@@ -45,6 +51,13 @@ uint64_t vhost_user_get_acked_features(NetClientState *nc)
     return s->acked_features;
 }
 
+struct vhost_inflight *vhost_user_get_inflight(NetClientState *nc)
+{
+    NetVhostUserState *s = DO_UPCAST(NetVhostUserState, nc, nc);
+    assert(nc->info->type == NET_CLIENT_DRIVER_VHOST_USER);
+    return s->inflight;
+}
+
 static void vhost_user_stop(int queues, NetClientState *ncs[])
 {
     NetVhostUserState *s;
@@ -156,6 +169,11 @@ static void net_vhost_user_cleanup(NetClientState *nc)
         g_free(s->vhost_net);
         s->vhost_net = NULL;
     }
+    if (s->inflight) {
+        vhost_dev_free_inflight(s->inflight);
+        g_free(s->inflight);
+        s->inflight = NULL;
+    }
     if (nc->queue_index == 0) {
         if (s->watch) {
             g_source_remove(s->watch);
@@ -340,6 +358,13 @@ static int net_vhost_user_init(NetClientState *peer, const char *device,
         }
         s = DO_UPCAST(NetVhostUserState, nc, nc);
         s->vhost_user = user;
+        /*
+         * The backend keeps one inflight region per connection, while each
+         * queue pair has its own vhost_dev: only track a single one.
+         */
+        if (queues == 1) {
+            s->inflight = g_new0(struct vhost_inflight, 1);
+        }
     }
 
     s = DO_UPCAST(NetVhostUserState, nc, nc0);
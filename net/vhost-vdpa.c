@@ -18,6 +18,7 @@
 #include "qemu/error-report.h"
 #include "qemu/option.h"
 #include "qapi/error.h"
+#include "migration/misc.h"
 #include <sys/ioctl.h>
 #include <err.h>
 #include "standard-headers/linux/virtio_net.h"
@@ -31,6 +32,7 @@ typedef struct VhostVDPAState {
     VHostNetState *vhost_net;
     uint64_t acked_features;
     bool started;
+    Notifier migration_state;
 } VhostVDPAState;
 
 const int vdpa_feature_bits[] = {
@@ -133,6 +135,10 @@ static void vhost_vdpa_cleanup(NetClientState *nc)
 {
     VhostVDPAState *s = DO_UPCAST(VhostVDPAState, nc, nc);
 
+    if (s->migration_state.notify) {
+        remove_migration_state_change_notifier(&s->migration_state);
+        s->migration_state.notify = NULL;
+    }
     if (s->vhost_net) {
         vhost_net_cleanup(s->vhost_net);
         g_free(s->vhost_net);
@@ -162,6 +168,51 @@ static bool vhost_vdpa_has_ufo(NetClientState *nc)
 
 }
 
+/*
+ * The device must be restarted for the switch, since the rings it uses
+ * change.  One queue pair is supported.
+ */
+static void vhost_vdpa_net_set_shadow_vqs(VhostVDPAState *s, bool enable)
+{
+    struct vhost_dev *dev = &s->vhost_net->dev;
+    VirtIODevice *vdev = dev->vdev;
+    int r;
+
+    if (s->vhost_vdpa.shadow_vqs_enabled == enable) {
+        return;
+    }
+    if (!dev->started) {
+        s->vhost_vdpa.shadow_vqs_enabled = enable;
+        return;
+    }
+
+    vhost_net_stop(vdev, s->nc.peer, 1);
+    s->vhost_vdpa.shadow_vqs_enabled = enable;
+    r = vhost_net_start(vdev, s->nc.peer, 1);
+    if (r < 0) {
+        error_report("vhost-vdpa: failed to restart %s shadow virtqueues: %s",
+                     enable ? "with" : "without", strerror(-r));
+    }
+}
+
+/*
+ * The device cannot log the pages it writes, so its queues go through
+ * QEMU for as long as a migration runs.
+ */
+static void vhost_vdpa_net_migration_state_notifier(Notifier *notifier,
+                                                    void *data)
+{
+    VhostVDPAState *s = container_of(notifier, VhostVDPAState,
+                                     migration_state);
+    MigrationState *migration = data;
+
+    if (migration_in_setup(migration)) {
+        vhost_vdpa_net_set_shadow_vqs(s, true);
+    } else if (migration_has_failed(migration)) {
+        vhost_vdpa_net_set_shadow_vqs(s, false);
+    }
+}
+
 static NetClientInfo net_vhost_vdpa_info = {
         .type = NET_CLIENT_DRIVER_VHOST_VDPA,
         .size = sizeof(VhostVDPAState),
@@ -189,6 +240,10 @@ static int net_vhost_vdpa_init(NetClientState *peer, const char *device,
     s->vhost_vdpa.device_fd = vdpa_device_fd;
     ret = vhost_vdpa_add(nc, (void *)&s->vhost_vdpa);
     assert(s->vhost_net);
+    if (!ret) {
+        s->migration_state.notify = vhost_vdpa_net_migration_state_notifier;
+        add_migration_state_change_notifier(&s->migration_state);
+    }
     return ret;
 }
 
@@ -60,6 +60,8 @@ static void plugin_cpu_update__async(CPUState *cpu, run_on_cpu_data data)
     cpu_tb_jmp_cache_clear(cpu);
 }
 
+static void plugin_sampler_stop__locked(void);
+
 static void plugin_cpu_update__locked(gpointer k, gpointer v, gpointer udata)
 {
     CPUState *cpu = container_of(k, CPUState, cpu_index);
@@ -86,6 +88,9 @@ void plugin_unregister_cb__locked(struct qemu_plugin_ctx *ctx,
     if (QLIST_EMPTY_RCU(&plugin.cb_lists[ev])) {
         clear_bit(ev, plugin.mask);
         g_hash_table_foreach(plugin.cpu_ht, plugin_cpu_update__locked, NULL);
+        if (ev == QEMU_PLUGIN_EV_VCPU_SAMPLE) {
+            plugin_sampler_stop__locked();
+        }
     }
 }
 
@@ -211,6 +216,65 @@ plugin_register_cb_udata(qemu_plugin_id_t id, enum qemu_plugin_event ev,
     do_plugin_register_cb(id, ev, func, udata);
 }
 
+/*
+ * Make sure every scoreboard has an element for @cpu.  Translated code
+ * embeds the address of the scoreboard storage, so this must run as safe
+ * work: with every vCPU stopped, the code cache is flushed before the old
+ * storage is released.
+ */
+static void plugin_grow_scoreboards__locked(CPUState *cpu)
+{
+    size_t size = plugin.scoreboard_alloc_size;
+    struct qemu_plugin_scoreboard *score;
+
+    if (cpu->cpu_index < size) {
+        return;
+    }
+    while (cpu->cpu_index >= size) {
+        size *= 2;
+    }
+    if (!QLIST_EMPTY(&plugin.scoreboards)) {
+        g_assert(cpu_in_exclusive_context(cpu));
+        /* synchronous here, so no TB can refer to the old storage below */
+        tb_flush(cpu);
+        QLIST_FOREACH(score, &plugin.scoreboards, entry) {
+            g_array_set_size(score->data, size);
+        }
+    }
+    plugin.scoreboard_alloc_size = size;
+}
+
+struct qemu_plugin_scoreboard *plugin_scoreboard_new(size_t element_size)
+{
+    struct qemu_plugin_scoreboard *score;
+
+    score = g_new0(struct qemu_plugin_scoreboard, 1);
+    score->data = g_array_new(false, true, element_size);
+    QEMU_LOCK_GUARD(&plugin.lock);
+    g_array_set_size(score->data, plugin.scoreboard_alloc_size);
+    QLIST_INSERT_HEAD(&plugin.scoreboards, score, entry);
+    return score;
+}
+
+void plugin_scoreboard_free(struct qemu_plugin_scoreboard *score)
+{
+    qemu_rec_mutex_lock(&plugin.lock);
+    QLIST_REMOVE(score, entry);
+    qemu_rec_mutex_unlock(&plugin.lock);
+
+    g_array_free(score->data, true);
+    g_free(score);
+}
+
+static void qemu_plugin_vcpu_init__async(CPUState *cpu, run_on_cpu_data unused)
+{
+    qemu_rec_mutex_lock(&plugin.lock);
+    plugin_grow_scoreboards__locked(cpu);
+    qemu_rec_mutex_unlock(&plugin.lock);
+
+    plugin_vcpu_cb__simple(cpu, QEMU_PLUGIN_EV_VCPU_INIT);
+}
+
 void qemu_plugin_vcpu_init_hook(CPUState *cpu)
 {
     bool success;
@@ -222,7 +286,11 @@ void qemu_plugin_vcpu_init_hook(CPUState *cpu)
     g_assert(success);
     qemu_rec_mutex_unlock(&plugin.lock);
 
-    plugin_vcpu_cb__simple(cpu, QEMU_PLUGIN_EV_VCPU_INIT);
+    /*
+     * The vCPU runs this before executing any code, and the init callbacks
+     * follow it so that they always find the vCPU's scoreboard entries.
+     */
+    async_safe_run_on_cpu(cpu, qemu_plugin_vcpu_init__async, RUN_ON_CPU_NULL);
 }
 
 void qemu_plugin_vcpu_exit_hook(CPUState *cpu)
@@ -283,7 +351,7 @@ static struct qemu_plugin_dyn_cb *plugin_get_dyn_cb(GArray **arr)
 void plugin_register_inline_op(GArray **arr,
                                enum qemu_plugin_mem_rw rw,
                                enum qemu_plugin_op op, void *ptr,
-                               uint64_t imm)
+                               size_t stride, uint64_t imm)
 {
     struct qemu_plugin_dyn_cb *dyn_cb;
 
@@ -293,6 +361,7 @@ void plugin_register_inline_op(GArray **arr,
     dyn_cb->rw = rw;
     dyn_cb->inline_insn.op = op;
     dyn_cb->inline_insn.imm = imm;
+    dyn_cb->inline_insn.stride = stride;
 }
 
 void plugin_register_dyn_cb__udata(GArray **arr,
@@ -391,6 +460,104 @@ void qemu_plugin_vcpu_syscall_ret(CPUState *cpu, int64_t num, int64_t ret)
     }
 }
 
+/*
+ * Disable CFI checks.
+ * The callback function has been loaded from an external library so we do not
+ * have type information
+ */
+QEMU_DISABLE_CFI
+static void plugin_vcpu_sample__async(CPUState *cpu, run_on_cpu_data unused)
+{
+    CPUArchState *env = cpu->env_ptr;
+    struct qemu_plugin_cb *cb, *next;
+    enum qemu_plugin_event ev = QEMU_PLUGIN_EV_VCPU_SAMPLE;
+    target_ulong pc, cs_base;
+    uint32_t flags;
+
+    qatomic_set(&cpu->plugin_sample_pending, false);
+    if (!test_bit(ev, cpu->plugin_mask)) {
+        return;
+    }
+
+    /* We run between TBs, so the guest state is up to date. */
+    cpu_get_tb_cpu_state(env, &pc, &cs_base, &flags);
+
+    QLIST_FOREACH_SAFE_RCU(cb, &plugin.cb_lists[ev], entry, next) {
+        qemu_plugin_vcpu_sample_cb_t func = cb->f.vcpu_sample;
+
+        func(cb->ctx->id, cpu->cpu_index, pc);
+    }
+}
+
+/*
+ * The sampler thread only queues work on the vCPUs; the callbacks
+ * themselves run in vCPU context.  Queueing the work kicks the vCPU
+ * out of the chained TBs it is executing, which is exactly the point
+ * at which we want to look at its state.  A vCPU that has not got round
+ * to its previous sample yet is skipped, so that a slow vCPU does not
+ * pile up work items.
+ */
+static void *plugin_sampler_thread(void *opaque)
+{
+    CPUState *cpu;
+
+    rcu_register_thread();
+    while (!qatomic_read(&plugin.sampler_stop)) {
+        uint64_t period = qatomic_read(&plugin.sample_period_ns);
+
+        g_usleep(MAX(period / 1000, 1));
+        if (QLIST_EMPTY_RCU(&plugin.cb_lists[QEMU_PLUGIN_EV_VCPU_SAMPLE])) {
+            continue;
+        }
+        WITH_RCU_READ_LOCK_GUARD() {
+            CPU_FOREACH(cpu) {
+                if (cpu->created && !cpu->halted && !cpu->stopped &&
+                    !qatomic_xchg(&cpu->plugin_sample_pending, true)) {
+                    async_run_on_cpu(cpu, plugin_vcpu_sample__async,
+                                     RUN_ON_CPU_NULL);
+                }
+            }
+        }
+    }
+    rcu_unregister_thread();
+    return NULL;
+}
+
+/*
+ * Called when the last sample callback goes away and at exit.  The thread
+ * only queues work, so it can be joined with the plugin lock held.
+ */
+static void plugin_sampler_stop__locked(void)
+{
+    if (plugin.sample_period_ns == 0) {
+        return;
+    }
+    qatomic_set(&plugin.sampler_stop, true);
+    qemu_thread_join(&plugin.sampler);
+    plugin.sampler_stop = false;
+    qatomic_set(&plugin.sample_period_ns, 0);
+}
+
+void qemu_plugin_register_vcpu_sample_cb(qemu_plugin_id_t id,
+                                         uint64_t period_ns,
+                                         qemu_plugin_vcpu_sample_cb_t cb)
+{
+    plugin_register_cb(id, QEMU_PLUGIN_EV_VCPU_SAMPLE, cb);
+    if (!cb) {
+        return;
+    }
+
+    QEMU_LOCK_GUARD(&plugin.lock);
+    period_ns = MAX(period_ns, 1000);
+    if (plugin.sample_period_ns == 0) {
+        qatomic_set(&plugin.sample_period_ns, period_ns);
+        qemu_thread_create(&plugin.sampler, "plugin-sampler",
+                           plugin_sampler_thread, NULL, QEMU_THREAD_JOINABLE);
+    } else if (period_ns < plugin.sample_period_ns) {
+        qatomic_set(&plugin.sample_period_ns, period_ns);
+    }
+}
+
 void qemu_plugin_vcpu_idle_cb(CPUState *cpu)
 {
     plugin_vcpu_cb__simple(cpu, QEMU_PLUGIN_EV_VCPU_IDLE);
@@ -433,9 +600,9 @@ void qemu_plugin_flush_cb(void)
     plugin_cb__simple(QEMU_PLUGIN_EV_FLUSH);
 }
 
-void exec_inline_op(struct qemu_plugin_dyn_cb *cb)
+void exec_inline_op(struct qemu_plugin_dyn_cb *cb, unsigned int cpu_index)
 {
-    uint64_t *val = cb->userp;
+    uint64_t *val = cb->userp + cpu_index * cb->inline_insn.stride;
 
     switch (cb->inline_insn.op) {
     case QEMU_PLUGIN_INLINE_ADD_U64:
@@ -467,7 +634,7 @@ void qemu_plugin_vcpu_mem_cb(CPUState *cpu, uint64_t vaddr, uint32_t info)
             cb->f.vcpu_mem(cpu->cpu_index, info, vaddr, cb->userp);
             break;
         case PLUGIN_CB_INLINE:
-            exec_inline_op(cb);
+            exec_inline_op(cb, cpu->cpu_index);
             break;
         default:
             g_assert_not_reached();
@@ -477,6 +644,9 @@ void qemu_plugin_vcpu_mem_cb(CPUState *cpu, uint64_t vaddr, uint32_t info)
 
 void qemu_plugin_atexit_cb(void)
 {
+    WITH_QEMU_LOCK_GUARD(&plugin.lock) {
+        plugin_sampler_stop__locked();
+    }
     plugin_cb__udata(QEMU_PLUGIN_EV_ATEXIT);
 }
 
@@ -552,6 +722,8 @@ static void __attribute__((__constructor__)) plugin_init(void)
     plugin.id_ht = g_hash_table_new(g_int64_hash, g_int64_equal);
     plugin.cpu_ht = g_hash_table_new(g_int_hash, g_int_equal);
     QTAILQ_INIT(&plugin.ctxs);
+    QLIST_INIT(&plugin.scoreboards);
+    plugin.scoreboard_alloc_size = 16; /* avoid frequent reallocation */
     qht_init(&plugin.dyn_cb_arr_ht, plugin_dyn_cb_arr_cmp, 16,
              QHT_MODE_AUTO_RESIZE);
     atexit(qemu_plugin_atexit_cb);
@@ -44,6 +44,18 @@ struct qemu_plugin_state {
      * the code cache is flushed.
      */
     struct qht dyn_cb_arr_ht;
+    /* period of the sampler thread; 0 while the thread is not running */
+    uint64_t sample_period_ns;
+    QemuThread sampler;
+    bool sampler_stop;
+    /* all live scoreboards, and how many vCPUs each has room for */
+    QLIST_HEAD(, qemu_plugin_scoreboard) scoreboards;
+    size_t scoreboard_alloc_size;
+};
+
+struct qemu_plugin_scoreboard {
+    GArray *data;
+    QLIST_ENTRY(qemu_plugin_scoreboard) entry;
 };
 
 
@@ -67,7 +79,10 @@ struct qemu_plugin_ctx *plugin_id_to_ctx_locked(qemu_plugin_id_t id);
 void plugin_register_inline_op(GArray **arr,
                                enum qemu_plugin_mem_rw rw,
                                enum qemu_plugin_op op, void *ptr,
-                               uint64_t imm);
+                               size_t stride, uint64_t imm);
+
+struct qemu_plugin_scoreboard *plugin_scoreboard_new(size_t element_size);
+void plugin_scoreboard_free(struct qemu_plugin_scoreboard *score);
 
 void plugin_reset_uninstall(qemu_plugin_id_t id,
                             qemu_plugin_simple_cb_t cb,
@@ -95,6 +110,6 @@ void plugin_register_vcpu_mem_cb(GArray **arr,
                                  enum qemu_plugin_mem_rw rw,
                                  void *udata);
 
-void exec_inline_op(struct qemu_plugin_dyn_cb *cb);
+void exec_inline_op(struct qemu_plugin_dyn_cb *cb, unsigned int cpu_index);
 
 #endif /* _PLUGIN_INTERNAL_H_ */
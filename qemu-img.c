@@ -40,6 +40,7 @@
 #include "qemu/log.h"
 #include "qemu/main-loop.h"
 #include "qemu/module.h"
+#include "qemu/rcu.h"
 #include "qemu/sockets.h"
 #include "qemu/units.h"
 #include "qom/object_interfaces.h"
@@ -83,6 +84,11 @@ enum {
     OPTION_BITMAPS = 275,
     OPTION_FORCE = 276,
     OPTION_SKIP_BROKEN = 277,
+    OPTION_DEDUP = 278,
+    OPTION_READ_PERCENT = 279,
+    OPTION_RANDOM_PERCENT = 280,
+    OPTION_THREADS = 281,
+    OPTION_HISTOGRAM = 282,
 };
 
 typedef enum OutputFormat {
@@ -197,8 +203,11 @@ static void QEMU_NORETURN help(void)
            "\n"
            "Parameters to convert subcommand:\n"
            "  '--bitmaps' copies all top-level persistent bitmaps to destination\n"
+           "  '--dedup' lets clusters with identical content share storage in the\n"
+           "       destination (qcow2 only)\n"
            "  '-m' specifies how many coroutines work in parallel during the convert\n"
-           "       process (defaults to 8)\n"
+           "       process (defaults to 8, or to the number of host CPUs up to 16\n"
+           "       for compressed targets)\n"
            "  '-W' allow to write to the target out of order rather than sequential\n"
            "\n"
            "Parameters to snapshot subcommand:\n"
@@ -1621,6 +1630,7 @@ enum ImgConvertBlockStatus {
 };
 
 #define MAX_COROUTINES 16
+#define DEFAULT_COROUTINES 8
 #define CONVERT_THROTTLE_GROUP "img_convert"
 
 typedef struct ImgConvertState {
@@ -1924,6 +1934,34 @@ static int coroutine_fn convert_co_copy_range(ImgConvertState *s, int64_t sector
     return 0;
 }
 
+/*
+ * In in-order mode, let the coroutine waiting to write at @wr_offs go
+ * ahead.  With @defer, it only runs once the current coroutine yields,
+ * i.e. once the current write has been submitted.
+ */
+static void coroutine_fn convert_co_write_done(ImgConvertState *s,
+                                               int64_t wr_offs, bool defer)
+{
+    int i;
+
+    s->wr_offs = wr_offs;
+    for (i = 0; i < s->num_coroutines; i++) {
+        if (s->co[i] && s->wait_sector_num[i] == s->wr_offs) {
+            /*
+             * A -> B -> A cannot occur because A has
+             * s->wait_sector_num[i] == -1 during A -> B.  Therefore
+             * B will never enter A during this time window.
+             */
+            if (defer) {
+                aio_co_enter(qemu_get_aio_context(), s->co[i]);
+            } else {
+                qemu_coroutine_enter(s->co[i]);
+            }
+            break;
+        }
+    }
+}
+
 static void coroutine_fn convert_co_do_copy(void *opaque)
 {
     ImgConvertState *s = opaque;
@@ -1997,6 +2035,17 @@ retry:
                 qemu_coroutine_yield();
             }
             s->wait_sector_num[index] = -1;
+
+            /*
+             * Compressed writes spend most of their time being compressed
+             * in the driver's thread pool, and the data is only placed in
+             * the image afterwards.  Waiting for each of them to complete
+             * would compress one cluster at a time, so only keep their
+             * submission in order.
+             */
+            if (s->compressed) {
+                convert_co_write_done(s, sector_num + n, true);
+            }
         }
 
         if (s->ret == -EINPROGRESS) {
@@ -2016,21 +2065,10 @@ retry:
             }
         }
 
-        if (s->wr_in_order) {
+        if (s->wr_in_order && !s->compressed) {
             /* reenter the coroutine that might have waited
              * for this write to complete */
-            s->wr_offs = sector_num + n;
-            for (i = 0; i < s->num_coroutines; i++) {
-                if (s->co[i] && s->wait_sector_num[i] == s->wr_offs) {
-                    /*
-                     * A -> B -> A cannot occur because A has
-                     * s->wait_sector_num[i] == -1 during A -> B.  Therefore
-                     * B will never enter A during this time window.
-                     */
-                    qemu_coroutine_enter(s->co[i]);
-                    break;
-                }
-            }
+            convert_co_write_done(s, sector_num + n, false);
         }
     }
 
@@ -2199,6 +2237,7 @@ static int img_convert(int argc, char **argv)
     bool explict_min_sparse = false;
     bool bitmaps = false;
     bool skip_broken = false;
+    bool dedup = false;
     int64_t rate_limit = 0;
 
     ImgConvertState s = (ImgConvertState) {
@@ -2207,7 +2246,6 @@ static int img_convert(int argc, char **argv)
         .copy_range         = false,
         .buf_sectors        = IO_BUF_SIZE / BDRV_SECTOR_SIZE,
         .wr_in_order        = true,
-        .num_coroutines     = 8,
     };
 
     for(;;) {
@@ -2221,6 +2259,7 @@ static int img_convert(int argc, char **argv)
             {"target-is-zero", no_argument, 0, OPTION_TARGET_IS_ZERO},
             {"bitmaps", no_argument, 0, OPTION_BITMAPS},
             {"skip-broken-bitmaps", no_argument, 0, OPTION_SKIP_BROKEN},
+            {"dedup", no_argument, 0, OPTION_DEDUP},
             {0, 0, 0, 0}
         };
         c = getopt_long(argc, argv, ":hf:O:B:Cco:l:S:pt:T:qnm:WUr:",
@@ -2352,6 +2391,9 @@ static int img_convert(int argc, char **argv)
         case OPTION_SKIP_BROKEN:
             skip_broken = true;
             break;
+        case OPTION_DEDUP:
+            dedup = true;
+            break;
         }
     }
 
@@ -2359,6 +2401,11 @@ static int img_convert(int argc, char **argv)
         out_fmt = "raw";
     }
 
+    if (dedup && (s.compressed || s.copy_range || skip_create)) {
+        error_report("--dedup cannot be used with -c, -C or -n");
+        goto fail_getopt;
+    }
+
     if (skip_broken && !bitmaps) {
         error_report("Use of --skip-broken-bitmaps requires --bitmaps");
         goto fail_getopt;
@@ -2609,6 +2656,9 @@ static int img_convert(int argc, char **argv)
     if (!skip_create) {
         open_opts = qdict_new();
         qemu_opt_foreach(opts, img_add_key_secrets, open_opts, &error_abort);
+        if (dedup) {
+            qdict_put_bool(open_opts, "dedup", true);
+        }
 
         /* Create the new image */
         ret = bdrv_create(drv, out_filename, opts, &local_err);
@@ -2712,6 +2762,18 @@ static int img_convert(int argc, char **argv)
         s.cluster_sectors = bdi.cluster_size / BDRV_SECTOR_SIZE;
     }
 
+    if (!s.num_coroutines) {
+        /*
+         * Compression is CPU bound and done in the driver's thread pool,
+         * so keep enough writes in flight to give every CPU something to do
+         */
+        s.num_coroutines = DEFAULT_COROUTINES;
+        if (s.compressed) {
+            s.num_coroutines = MIN(MAX(g_get_num_processors(),
+                                       DEFAULT_COROUTINES), MAX_COROUTINES);
+        }
+    }
+
     if (rate_limit) {
         set_rate_limit(s.target, rate_limit);
     }
@@ -4221,10 +4283,28 @@ out_no_progress:
     return 0;
 }
 
-typedef struct BenchData {
+/* Latency histogram boundaries: 1, 1.25, 1.6, ... 8 times 1 us ... 1 s */
+static const unsigned bench_hist_steps[] = {
+    100, 125, 160, 200, 250, 320, 400, 500, 630, 800
+};
+#define BENCH_HIST_MIN_NS   1000
+#define BENCH_HIST_DECADES  7
+
+typedef struct BenchData BenchData;
+
+typedef struct BenchRequest {
+    BenchData *b;
+    QEMUIOVector *qiov;
+    BlockAcctCookie acct;
+    QSLIST_ENTRY(BenchRequest) next;
+} BenchRequest;
+
+struct BenchData {
     BlockBackend *blk;
     uint64_t image_size;
     bool write;
+    int read_percent;
+    int random_percent;
     int bufsize;
     int step;
     int nrreq;
@@ -4233,29 +4313,87 @@ typedef struct BenchData {
     bool drain_on_flush;
     uint8_t *buf;
     QEMUIOVector *qiov;
+    BenchRequest *reqs;
+    QSLIST_HEAD(, BenchRequest) free_reqs;
+    BlockAcctStats stats;
+    GRand *rand;
+
+    /* Only used for --threads, otherwise the main loop runs the requests */
+    AioContext *ctx;
+    QemuThread thread;
+    bool stopping;
 
     int in_flight;
     bool in_flush;
     uint64_t offset;
-} BenchData;
+};
+
+static void bench_cb(void *opaque, int ret);
 
 static void bench_undrained_flush_cb(void *opaque, int ret)
 {
+    BenchRequest *req = opaque;
+
     if (ret < 0) {
         error_report("Failed flush request: %s", strerror(-ret));
         exit(EXIT_FAILURE);
     }
+    block_acct_done(&req->b->stats, &req->acct);
+    g_free(req);
 }
 
-static void bench_cb(void *opaque, int ret)
+static void bench_flush_cb(void *opaque, int ret)
 {
-    BenchData *b = opaque;
-    BlockAIOCB *acb;
+    BenchRequest *req = opaque;
+    BenchData *b = req->b;
+
+    if (ret < 0) {
+        error_report("Failed flush request: %s", strerror(-ret));
+        exit(EXIT_FAILURE);
+    }
+    block_acct_done(&b->stats, &req->acct);
+    g_free(req);
+    bench_cb(b, 0);
+}
+
+static void bench_request_cb(void *opaque, int ret)
+{
+    BenchRequest *req = opaque;
+    BenchData *b = req->b;
 
     if (ret < 0) {
         error_report("Failed request: %s", strerror(-ret));
         exit(EXIT_FAILURE);
     }
+    block_acct_done(&b->stats, &req->acct);
+    QSLIST_INSERT_HEAD(&b->free_reqs, req, next);
+    bench_cb(b, 0);
+}
+
+static uint64_t bench_next_offset(BenchData *b)
+{
+    uint64_t offset;
+
+    if (b->random_percent &&
+        g_rand_int_range(b->rand, 0, 100) < b->random_percent)
+    {
+        uint64_t nblocks = b->image_size / b->bufsize;
+        uint64_t r = ((uint64_t)g_rand_int(b->rand) << 32) |
+                     g_rand_int(b->rand);
+
+        return (r % nblocks) * b->bufsize;
+    }
+
+    offset = b->offset;
+    b->offset += b->step;
+    b->offset %= b->image_size;
+    return offset;
+}
+
+static void bench_cb(void *opaque, int ret)
+{
+    BenchData *b = opaque;
+    BlockAIOCB *acb;
 
     if (b->in_flush) {
         /* Just finished a flush with drained queue: Start next requests */
@@ -4264,22 +4402,28 @@ static void bench_cb(void *opaque, int ret)
     } else if (b->in_flight > 0) {
         int remaining = b->n - b->in_flight;
 
-        b->n--;
+        qatomic_set(&b->n, b->n - 1);
         b->in_flight--;
+        if (b->n == 0 && b->ctx) {
+            aio_notify(qemu_get_aio_context());
+        }
 
         /* Time for flush? Drain queue if requested, then flush */
         if (b->flush_interval && remaining % b->flush_interval == 0) {
             if (!b->in_flight || !b->drain_on_flush) {
+                BenchRequest *req = g_new0(BenchRequest, 1);
                 BlockCompletionFunc *cb;
 
                 if (b->drain_on_flush) {
                     b->in_flush = true;
-                    cb = bench_cb;
+                    cb = bench_flush_cb;
                 } else {
                     cb = bench_undrained_flush_cb;
                 }
 
-                acb = blk_aio_flush(b->blk, cb, b);
+                req->b = b;
+                block_acct_start(&b->stats, &req->acct, 0, BLOCK_ACCT_FLUSH);
+                acb = blk_aio_flush(b->blk, cb, req);
                 if (!acb) {
                     error_report("Failed to issue flush request");
                     exit(EXIT_FAILURE);
@@ -4292,18 +4436,28 @@ static void bench_cb(void *opaque, int ret)
     }
 
     while (b->n > b->in_flight && b->in_flight < b->nrreq) {
-        int64_t offset = b->offset;
+        BenchRequest *req = QSLIST_FIRST(&b->free_reqs);
+        int64_t offset = bench_next_offset(b);
+        bool is_write = b->write &&
+            (!b->read_percent ||
+             g_rand_int_range(b->rand, 0, 100) >= b->read_percent);
+
         /* blk_aio_* might look for completed I/Os and kick bench_cb
          * again, so make sure this operation is counted by in_flight
          * and b->offset is ready for the next submission.
          */
+        QSLIST_REMOVE_HEAD(&b->free_reqs, next);
         b->in_flight++;
-        b->offset += b->step;
-        b->offset %= b->image_size;
-        if (b->write) {
-            acb = blk_aio_pwritev(b->blk, offset, b->qiov, 0, bench_cb, b);
+        if (is_write) {
+            block_acct_start(&b->stats, &req->acct, b->bufsize,
+                             BLOCK_ACCT_WRITE);
+            acb = blk_aio_pwritev(b->blk, offset, req->qiov, 0,
+                                  bench_request_cb, req);
         } else {
-            acb = blk_aio_preadv(b->blk, offset, b->qiov, 0, bench_cb, b);
+            block_acct_start(&b->stats, &req->acct, b->bufsize,
+                             BLOCK_ACCT_READ);
+            acb = blk_aio_preadv(b->blk, offset, req->qiov, 0,
+                                 bench_request_cb, req);
         }
         if (!acb) {
             error_report("Failed to issue request");
@@ -4312,6 +4466,153 @@ static void bench_cb(void *opaque, int ret)
     }
 }
 
+static void bench_start_bh(void *opaque)
+{
+    bench_cb(opaque, 0);
+}
+
+static void bench_stop_bh(void *opaque)
+{
+    BenchData *b = opaque;
+
+    b->stopping = true;
+}
+
+static void *bench_thread(void *opaque)
+{
+    BenchData *b = opaque;
+
+    rcu_register_thread();
+    qemu_set_current_aio_context(b->ctx);
+    while (!b->stopping) {
+        aio_poll(b->ctx, true);
+    }
+    rcu_unregister_thread();
+    return NULL;
+}
+
+static void bench_init_histograms(BenchData *b)
+{
+    uint64List *boundaries = NULL, **tail = &boundaries;
+    uint64_t scale = BENCH_HIST_MIN_NS / bench_hist_steps[0];
+    int i, j;
+
+    for (i = 0; i < BENCH_HIST_DECADES; i++, scale *= 10) {
+        for (j = 0; j < ARRAY_SIZE(bench_hist_steps); j++) {
+            QAPI_LIST_APPEND(tail, bench_hist_steps[j] * scale);
+        }
+    }
+
+    block_acct_init(&b->stats);
+    block_latency_histogram_set(&b->stats, BLOCK_ACCT_READ, boundaries);
+    block_latency_histogram_set(&b->stats, BLOCK_ACCT_WRITE, boundaries);
+    block_latency_histogram_set(&b->stats, BLOCK_ACCT_FLUSH, boundaries);
+    qapi_free_uint64List(boundaries);
+}
+
+/*
+ * Return the index of the bin of the merged histogram @bins that
+ * contains the request at @permille per mille of @total.
+ */
+static int bench_percentile_bin(const uint64_t *bins, int nbins,
+                                uint64_t total, int permille)
+{
+    uint64_t target = MAX(1, (total * permille + 999) / 1000);
+    uint64_t sum = 0;
+    int i;
+
+    for (i = 0; i < nbins - 1; i++) {
+        sum += bins[i];
+        if (sum >= target) {
+            break;
+        }
+    }
+    return i;
+}
+
+static void bench_report(BenchData *data, int nworkers, double seconds,
+                         bool show_histogram)
+{
+    static const struct {
+        enum BlockAcctType type;
+        const char *name;
+    } types[] = {
+        { BLOCK_ACCT_READ,  "read" },
+        { BLOCK_ACCT_WRITE, "write" },
+        { BLOCK_ACCT_FLUSH, "flush" },
+    };
+    static const struct {
+        int permille;
+        const char *name;
+    } quantiles[] = {
+        { 500, "p50" },
+        { 990, "p99" },
+        { 999, "p99.9" },
+    };
+    const BlockLatencyHistogram *h0 =
+        &data[0].stats.latency_histogram[BLOCK_ACCT_READ];
+    g_autofree uint64_t *bins = g_new(uint64_t, h0->nbins);
+    int t, i, j;
+
+    for (t = 0; t < ARRAY_SIZE(types); t++) {
+        uint64_t total = 0, bytes = 0;
+
+        memset(bins, 0, h0->nbins * sizeof(bins[0]));
+        for (i = 0; i < nworkers; i++) {
+            BlockAcctStats *stats = &data[i].stats;
+            const BlockLatencyHistogram *h =
+                &stats->latency_histogram[types[t].type];
+
+            for (j = 0; j < h->nbins; j++) {
+                bins[j] += h->bins[j];
+            }
+            total += stats->nr_ops[types[t].type];
+            bytes += stats->nr_bytes[types[t].type];
+        }
+        if (!total) {
+            continue;
+        }
+
+        printf("%s: %" PRIu64 " requests, %.0f IOPS", types[t].name, total,
+               total / seconds);
+        if (bytes) {
+            printf(", %.1f MiB/s", bytes / seconds / MiB);
+        }
+        printf("\n  latency");
+        for (i = 0; i < ARRAY_SIZE(quantiles); i++) {
+            int bin = bench_percentile_bin(bins, h0->nbins, total,
+                                           quantiles[i].permille);
+
+            if (bin < h0->nbins - 1) {
+                printf(" %s < %.2f us", quantiles[i].name,
+                       h0->boundaries[bin] / 1000.0);
+            } else {
+                printf(" %s >= %.2f us", quantiles[i].name,
+                       h0->boundaries[bin - 1] / 1000.0);
+            }
+            printf(i < ARRAY_SIZE(quantiles) - 1 ? "," : "\n");
+        }
+
+        if (!show_histogram) {
+            continue;
+        }
+        for (j = 0; j < h0->nbins; j++) {
+            double lo = j ? h0->boundaries[j - 1] / 1000.0 : 0;
+
+            if (!bins[j]) {
+                continue;
+            }
+            if (j < h0->nbins - 1) {
+                printf("  [%10.2f, %10.2f) us: %" PRIu64 "\n",
+                       lo, h0->boundaries[j] / 1000.0, bins[j]);
+            } else {
+                printf("  [%10.2f,        inf) us: %" PRIu64 "\n",
+                       lo, bins[j]);
+            }
+        }
+    }
+}
+
 static int img_bench(int argc, char **argv)
 {
     int c, ret = 0;
@@ -4327,15 +4628,20 @@ static int img_bench(int argc, char **argv)
     size_t step = 0;
     int flush_interval = 0;
     bool drain_on_flush = true;
+    int read_percent = 0;
+    int random_percent = 0;
+    int nworkers = 1;
+    bool show_histogram = false;
     int64_t image_size;
-    BlockBackend *blk = NULL;
-    BenchData data = {};
+    BenchData *data = NULL;
+    g_autofree char *mode = NULL;
     int flags = 0;
     bool writethrough = false;
     struct timeval t1, t2;
-    int i;
+    int i, w;
     bool force_share = false;
     size_t buf_size;
+    bool running;
 
     for (;;) {
         static const struct option long_options[] = {
@@ -4345,6 +4651,10 @@ static int img_bench(int argc, char **argv)
             {"pattern", required_argument, 0, OPTION_PATTERN},
             {"no-drain", no_argument, 0, OPTION_NO_DRAIN},
             {"force-share", no_argument, 0, 'U'},
+            {"read-percent", required_argument, 0, OPTION_READ_PERCENT},
+            {"random-percent", required_argument, 0, OPTION_RANDOM_PERCENT},
+            {"threads", required_argument, 0, OPTION_THREADS},
+            {"histogram", no_argument, 0, OPTION_HISTOGRAM},
             {0, 0, 0, 0}
         };
         c = getopt_long(argc, argv, ":hc:d:f:ni:o:qs:S:t:wU", long_options,
@@ -4478,6 +4788,37 @@ static int img_bench(int argc, char **argv)
         case OPTION_IMAGE_OPTS:
             image_opts = true;
             break;
+        case OPTION_READ_PERCENT:
+        case OPTION_RANDOM_PERCENT:
+        {
+            unsigned long res;
+
+            if (qemu_strtoul(optarg, NULL, 0, &res) < 0 || res > 100) {
+                error_report("Invalid percentage specified");
+                return 1;
+            }
+            if (c == OPTION_READ_PERCENT) {
+                read_percent = res;
+            } else {
+                random_percent = res;
+            }
+            break;
+        }
+        case OPTION_THREADS:
+        {
+            unsigned long res;
+
+            if (qemu_strtoul(optarg, NULL, 0, &res) < 0 || res < 1 ||
+                res > 256) {
+                error_report("Invalid number of threads specified");
+                return 1;
+            }
+            nworkers = res;
+            break;
+        }
+        case OPTION_HISTOGRAM:
+            show_histogram = true;
+            break;
         }
     }
 
@@ -4496,71 +4837,189 @@ static int img_bench(int argc, char **argv)
         ret = -1;
         goto out;
     }
-
-    blk = img_open(image_opts, filename, fmt, flags, writethrough, quiet,
-                   force_share);
-    if (!blk) {
+    if (!is_write && read_percent) {
+        error_report("--read-percent is only available in write tests");
         ret = -1;
         goto out;
     }
-
-    image_size = blk_getlength(blk);
-    if (image_size < 0) {
-        ret = image_size;
+    if (is_write && nworkers > 1) {
+        /* Every thread opens the image on its own */
+        error_report("--threads is only available in read tests");
+        ret = -1;
+        goto out;
+    }
+    if (count < nworkers) {
+        error_report("Request count can't be smaller than the number of "
+                     "threads");
+        ret = -1;
         goto out;
     }
 
-    data = (BenchData) {
-        .blk            = blk,
-        .image_size     = image_size,
-        .bufsize        = bufsize,
-        .step           = step ?: bufsize,
-        .nrreq          = depth,
-        .n              = count,
-        .offset         = offset,
-        .write          = is_write,
-        .flush_interval = flush_interval,
-        .drain_on_flush = drain_on_flush,
-    };
+    data = g_new0(BenchData, nworkers);
+    for (w = 0; w < nworkers; w++) {
+        BenchData *b = &data[w];
+        BlockBackend *blk;
+
+        blk = img_open(image_opts, filename, fmt, flags, writethrough, quiet,
+                       force_share);
+        if (!blk) {
+            ret = -1;
+            goto out;
+        }
+
+        image_size = blk_getlength(blk);
+        if (image_size < 0) {
+            blk_unref(blk);
+            ret = image_size;
+            goto out;
+        }
+        if (image_size < bufsize) {
+            /* The offsets wrap around at image_size, in bufsize blocks */
+            error_report("Image is smaller than the buffer size");
+            blk_unref(blk);
+            ret = -1;
+            goto out;
+        }
+
+        /*
+         * Each thread gets its share of the requests and covers its own
+         * part of the sequential range, so that the threads together
+         * touch the same data as a single thread would.
+         */
+        *b = (BenchData) {
+            .blk            = blk,
+            .image_size     = image_size,
+            .bufsize        = bufsize,
+            .step           = step ?: bufsize,
+            .nrreq          = depth,
+            .n              = count / nworkers + (w < count % nworkers),
+            .write          = is_write,
+            .read_percent   = read_percent,
+            .random_percent = random_percent,
+            .flush_interval = flush_interval,
+            .drain_on_flush = drain_on_flush,
+            .rand           = g_rand_new_with_seed(w),
+        };
+        b->offset = (offset + (uint64_t)(count / nworkers) * w * b->step) %
+                    image_size;
+        bench_init_histograms(b);
+
+        buf_size = b->nrreq * b->bufsize;
+        b->buf = blk_blockalign(blk, buf_size);
+        memset(b->buf, pattern, buf_size);
+
+        blk_register_buf(blk, b->buf, buf_size);
+
+        b->qiov = g_new(QEMUIOVector, b->nrreq);
+        b->reqs = g_new0(BenchRequest, b->nrreq);
+        for (i = 0; i < b->nrreq; i++) {
+            qemu_iovec_init(&b->qiov[i], 1);
+            qemu_iovec_add(&b->qiov[i],
+                           b->buf + i * b->bufsize, b->bufsize);
+            b->reqs[i].b = b;
+            b->reqs[i].qiov = &b->qiov[i];
+            QSLIST_INSERT_HEAD(&b->free_reqs, &b->reqs[i], next);
+        }
+
+        if (nworkers > 1) {
+            Error *local_err = NULL;
+
+            b->ctx = aio_context_new(&local_err);
+            if (!b->ctx) {
+                error_report_err(local_err);
+                ret = -1;
+                goto out;
+            }
+            qemu_thread_create(&b->thread, "bench", bench_thread, b,
+                               QEMU_THREAD_JOINABLE);
+            if (blk_set_aio_context(blk, b->ctx, &local_err) < 0) {
+                error_report_err(local_err);
+                ret = -1;
+                goto out;
+            }
+        }
+    }
+
+    if (is_write && read_percent) {
+        mode = g_strdup_printf("mixed (%d%% read)", read_percent);
+    } else {
+        mode = g_strdup(is_write ? "write" : "read");
+    }
     printf("Sending %d %s requests, %d bytes each, %d in parallel "
            "(starting at offset %" PRId64 ", step size %d)\n",
-           data.n, data.write ? "write" : "read", data.bufsize, data.nrreq,
-           data.offset, data.step);
+           count, mode, data[0].bufsize, data[0].nrreq,
+           offset, data[0].step);
+    if (random_percent) {
+        printf("Sending %d%% of the requests to random offsets\n",
+               random_percent);
+    }
+    if (nworkers > 1) {
+        printf("Using %d threads, each with its own queue\n", nworkers);
+    }
     if (flush_interval) {
         printf("Sending flush every %d requests\n", flush_interval);
     }
 
-    buf_size = data.nrreq * data.bufsize;
-    data.buf = blk_blockalign(blk, buf_size);
-    memset(data.buf, pattern, data.nrreq * data.bufsize);
-
-    blk_register_buf(blk, data.buf, buf_size);
-
-    data.qiov = g_new(QEMUIOVector, data.nrreq);
-    for (i = 0; i < data.nrreq; i++) {
-        qemu_iovec_init(&data.qiov[i], 1);
-        qemu_iovec_add(&data.qiov[i],
-                       data.buf + i * data.bufsize, data.bufsize);
-    }
-
     gettimeofday(&t1, NULL);
-    bench_cb(&data, 0);
-
-    while (data.n > 0) {
-        main_loop_wait(false);
+    for (w = 0; w < nworkers; w++) {
+        if (data[w].ctx) {
+            aio_bh_schedule_oneshot(data[w].ctx, bench_start_bh, &data[w]);
+        } else {
+            bench_cb(&data[w], 0);
+        }
     }
+
+    do {
+        running = false;
+        for (w = 0; w < nworkers; w++) {
+            running |= qatomic_read(&data[w].n) > 0;
+        }
+        if (running) {
+            main_loop_wait(false);
+        }
+    } while (running);
     gettimeofday(&t2, NULL);
 
     printf("Run completed in %3.3f seconds.\n",
            (t2.tv_sec - t1.tv_sec)
            + ((double)(t2.tv_usec - t1.tv_usec) / 1000000));
+    bench_report(data, nworkers,
+                 (t2.tv_sec - t1.tv_sec)
+                 + ((double)(t2.tv_usec - t1.tv_usec) / 1000000),
+                 show_histogram);
 
 out:
-    if (data.buf) {
-        blk_unregister_buf(blk, data.buf);
+    for (w = 0; data && w < nworkers; w++) {
+        BenchData *b = &data[w];
+
+        if (b->ctx) {
+            if (b->blk) {
+                aio_context_acquire(b->ctx);
+                blk_set_aio_context(b->blk, qemu_get_aio_context(),
+                                    &error_abort);
+                aio_context_release(b->ctx);
+            }
+            aio_bh_schedule_oneshot(b->ctx, bench_stop_bh, b);
+            qemu_thread_join(&b->thread);
+            aio_context_unref(b->ctx);
+        }
+        if (b->buf) {
+            blk_unregister_buf(b->blk, b->buf);
+        }
+        qemu_vfree(b->buf);
+        blk_unref(b->blk);
+        for (i = 0; b->qiov && i < b->nrreq; i++) {
+            qemu_iovec_destroy(&b->qiov[i]);
+        }
+        g_free(b->qiov);
+        g_free(b->reqs);
+        if (b->rand) {
+            g_rand_free(b->rand);
+            block_latency_histograms_clear(&b->stats);
+            block_acct_cleanup(&b->stats);
+        }
     }
-    qemu_vfree(data.buf);
-    blk_unref(blk);
+    g_free(data);
 
     if (ret) {
         return 1;
@@ -146,6 +146,7 @@ DEF("accel", HAS_ARG, QEMU_OPTION_accel,
     "                split-wx=on|off (enable TCG split w^x mapping)\n"
     "                tb-size=n (TCG translation block cache size)\n"
     "                dirty-ring-size=n (KVM dirty ring GFN count, default 0)\n"
+    "                halt-poll-ns=n (KVM halt polling time in ns, default: host's)\n"
     "                thread=single|multi (enable multi-threaded TCG)\n", QEMU_ARCH_ALL)
 SRST
 ``-accel name[,prop=value[,...]]``
@@ -197,6 +198,14 @@ SRST
         is disabled (dirty-ring-size=0).  When enabled, KVM will instead
         record dirty pages in a bitmap.
 
+    ``halt-poll-ns=n``
+        When the KVM accelerator is used, it sets how long, in
+        nanoseconds, a halted vCPU of this VM keeps polling for a wakeup
+        before the host puts its thread to sleep.  Polling lowers wakeup
+        latency at the cost of host CPU time; 0 disables it.  By
+        default (halt-poll-ns=-1), the host's ``halt_poll_ns`` module
+        parameter applies.
+
 ERST
 
 DEF("smp", HAS_ARG, QEMU_OPTION_smp,
@@ -2009,7 +2018,8 @@ DEF("spice", HAS_ARG, QEMU_OPTION_spice,
     "       [,image-compression=[auto_glz|auto_lz|quic|glz|lz|off]]\n"
     "       [,jpeg-wan-compression=[auto|never|always]]\n"
     "       [,zlib-glz-wan-compression=[auto|never|always]]\n"
-    "       [,streaming-video=[off|all|filter]][,disable-copy-paste=on|off]\n"
+    "       [,streaming-video=[off|all|filter]][,video-codecs=<list>]\n"
+    "       [,disable-copy-paste=on|off]\n"
     "       [,disable-agent-file-xfer=on|off][,agent-mouse=[on|off]]\n"
     "       [,playback-compression=[on|off]][,seamless-migration=[on|off]]\n"
     "       [,gl=[on|off]][,rendernode=<file>]\n"
@@ -2096,6 +2106,14 @@ SRST
     ``streaming-video=[off|all|filter]``
         Configure video stream detection. Default is off.
 
+    ``video-codecs=<list>``
+        Set the encoders, in order of preference, that the server may
+        use for the video streams it detects, as a semicolon separated
+        list of ``encoder:codec`` pairs, for example
+        ``gstreamer:h264;spice:mjpeg``.  The ``gstreamer`` encoders can
+        use hardware encoding when the host's GStreamer installation
+        provides it.  Requires spice-server 0.13.2 or newer.
+
     ``agent-mouse=[on|off]``
         Enable/disable passing mouse events via vdagent. Default is on.
 
@@ -2648,6 +2666,20 @@ DEF("netdev", HAS_ARG, QEMU_OPTION_netdev,
     "                VALE port (created on the fly) called 'name' ('nmname' is name of the \n"
     "                netmap device, defaults to '/dev/netmap')\n"
 #endif
+#ifdef CONFIG_AF_XDP
+    "-netdev af-xdp,id=str,ifname=name[,mode=native|skb][,force-copy=on|off]\n"
+    "         [,queues=n][,start-queue=m]\n"
+    "                attach to the existing network interface 'name' with AF_XDP socket\n"
+    "                use 'mode=MODE' to specify an XDP program attach mode\n"
+    "                use 'force-copy=on|off' to force XDP copy mode even if device supports zero-copy (default: off)\n"
+    "                use 'queues=n' to specify how many queues of a multiqueue interface should be used\n"
+    "                use 'start-queue=m' to specify the first queue that should be used\n"
+#endif
+#ifdef CONFIG_EVENTFD
+    "-netdev ivshmem,id=str,server=path\n"
+    "                link to another QEMU instance through the shared memory of the\n"
+    "                ivshmem server listening on UNIX domain socket 'path'\n"
+#endif
 #ifdef CONFIG_POSIX
     "-netdev vhost-user,id=str,chardev=dev[,vhostforce=on|off]\n"
     "                configure a vhost-user network, backed by a chardev 'dev'\n"
@@ -2672,6 +2704,12 @@ DEF("nic", HAS_ARG, QEMU_OPTION_nic,
 #ifdef CONFIG_NETMAP
     "netmap|"
 #endif
+#ifdef CONFIG_AF_XDP
+    "af-xdp|"
+#endif
+#ifdef CONFIG_EVENTFD
+    "ivshmem|"
+#endif
 #ifdef CONFIG_POSIX
     "vhost-user|"
 #endif
@@ -3115,6 +3153,52 @@ SRST
         # launch QEMU instance
         |qemu_system| linux.img -nic vde,sock=/tmp/myswitch
 
+``-netdev af-xdp,id=str,ifname=name[,mode=native|skb][,force-copy=on|off][,queues=n][,start-queue=m]``
+    Configure AF_XDP backend to connect to a network interface 'name'
+    using AF_XDP socket. A specific program attach mode for a default
+    XDP program can be forced with 'mode', defaults to best-effort,
+    where the likely most performant mode will be in use. Number of
+    queues 'n' should generally match the number of queues in the
+    interface, defaults to 1. Traffic arriving on non-configured device
+    queues will not be delivered to the network backend. Each queue is
+    bound to its own AF_XDP socket and UMEM area; incoming packets are
+    processed in batches and a single wakeup of the kernel sends all
+    the packets queued by the guest since the previous one. This option
+    is only available if QEMU has been compiled with libxdp support.
+
+    .. parsed-literal::
+
+        # set number of queues to 4
+        ethtool -L eth0 combined 4
+        # launch QEMU instance
+        |qemu_system| linux.img -device virtio-net-pci,netdev=n1 \\
+            -netdev af-xdp,id=n1,ifname=eth0,queues=4
+
+    'start-queue' option can be specified if a particular range of queues
+    [m, m + n - 1] should be in use. For example, this is necessary in order
+    to use MLX NICs in native mode. Traffic should be steered to these
+    queues with ethtool.
+
+``-netdev ivshmem,id=str,server=path``
+    Connect to another QEMU instance on the same host through the shared
+    memory and the doorbells of an ivshmem server listening on UNIX
+    domain socket 'path'. The server must be dedicated to the link
+    between exactly two QEMU instances; further peers are ignored.
+    Frames are copied to a ring in the shared memory and the other side
+    is notified once for a burst of them, without going through the
+    host network stack. Frames larger than 2044 bytes are dropped, so
+    the guests should use the standard Ethernet MTU.
+
+    .. parsed-literal::
+
+        # launch the server, with 4 MiB of shared memory
+        ivshmem-server -S /tmp/link0 -l 4M -n 1
+        # launch the QEMU instances
+        |qemu_system| vm1.img -device virtio-net-pci,netdev=n1,mac=52:54:00:12:34:01 \\
+            -netdev ivshmem,id=n1,server=/tmp/link0
+        |qemu_system| vm2.img -device virtio-net-pci,netdev=n1,mac=52:54:00:12:34:02 \\
+            -netdev ivshmem,id=n1,server=/tmp/link0
+
 ``-netdev vhost-user,chardev=id[,vhostforce=on|off][,queues=n]``
     Establish a vhost-user netdev, backed by a chardev id. The chardev
     should be a unix domain socket backed one. The vhost-user uses a
@@ -4186,13 +4270,13 @@ SRST
 ERST
 
 DEF("icount", HAS_ARG, QEMU_OPTION_icount, \
-    "-icount [shift=N|auto][,align=on|off][,sleep=on|off][,rr=record|replay,rrfile=<filename>[,rrsnapshot=<snapshot>]]\n" \
+    "-icount [shift=N|auto][,align=on|off][,sleep=on|off][,rr=record|replay,rrfile=<filename>[,rrsnapshot=<snapshot>][,rrperiod=<seconds>]]\n" \
     "                enable virtual instruction counter with 2^N clock ticks per\n" \
     "                instruction, enable aligning the host and virtual clocks\n" \
     "                or disable real time cpu sleeping, and optionally enable\n" \
     "                record-and-replay mode\n", QEMU_ARCH_ALL)
 SRST
-``-icount [shift=N|auto][,align=on|off][,sleep=on|off][,rr=record|replay,rrfile=filename[,rrsnapshot=snapshot]]``
+``-icount [shift=N|auto][,align=on|off][,sleep=on|off][,rr=record|replay,rrfile=filename[,rrsnapshot=snapshot][,rrperiod=seconds]]``
     Enable virtual instruction counter. The virtual cpu will execute one
     instruction every 2^N ns of virtual time. If ``auto`` is specified
     then the virtual cpu speed will be automatically adjusted to keep
@@ -4234,6 +4318,11 @@ SRST
     name. In record mode, a new VM snapshot with the given name is created
     at the start of execution recording. In replay mode this option
     specifies the snapshot name used to load the initial VM state.
+    If the ``rrperiod`` option is given in record mode, an additional VM
+    snapshot is created every ``seconds`` seconds of host time. These
+    snapshots are named after the ``rrsnapshot`` name (or ``replay``)
+    followed by the instruction count they were taken at, and are used
+    by reverse debugging to avoid replaying from the very beginning.
 ERST
 
 DEF("watchdog", HAS_ARG, QEMU_OPTION_watchdog, \
@@ -4317,6 +4406,8 @@ DEF("incoming", HAS_ARG, QEMU_OPTION_incoming, \
     "-incoming exec:cmdline\n" \
     "                accept incoming migration on given file descriptor\n" \
     "                or from given external command\n" \
+    "-incoming file:filename\n" \
+    "                accept incoming migration from given file\n" \
     "-incoming defer\n" \
     "                wait for the URI to be specified via migrate_incoming\n",
     QEMU_ARCH_ALL)
@@ -4336,6 +4427,10 @@ SRST
     Accept incoming migration as an output from specified external
     command.
 
+``-incoming file:filename``
+    Accept incoming migration from a file written by ``migrate
+    file:filename``.
+
 ``-incoming defer``
     Wait for the URI to be specified via migrate\_incoming. The monitor
     can be used to change settings (such as migration parameters) prior
@@ -4619,7 +4714,7 @@ SRST
     they are specified. Note that the 'id' property must be set. These
     objects are placed in the '/objects' path.
 
-    ``-object memory-backend-file,id=id,size=size,mem-path=dir,share=on|off,discard-data=on|off,merge=on|off,dump=on|off,prealloc=on|off,host-nodes=host-nodes,policy=default|preferred|bind|interleave,align=align,readonly=on|off``
+    ``-object memory-backend-file,id=id,size=size,mem-path=dir,share=on|off,discard-data=on|off,merge=on|off,dump=on|off,prealloc=on|off,host-nodes=host-nodes,policy=default|preferred|bind|interleave,align=align,readonly=on|off,rom=on|off|auto``
         Creates a memory file backend object, which can be used to back
         the guest RAM with huge pages.
 
@@ -4705,6 +4800,14 @@ SRST
         The ``readonly`` option specifies whether the backing file is opened
         read-only or read-write (default).
 
+        The ``rom`` option specifies whether the guest sees the memory
+        as read-only.  It defaults to ``auto``, which follows ``readonly``.
+        ``readonly=on,rom=off,share=off`` maps a read-only file as
+        writable private memory: guest writes go to copy-on-write pages
+        and the file is never modified.  Several VMs can start from the
+        same memory template this way and share all the pages that none
+        of them writes to.
+
     ``-object memory-backend-ram,id=id,merge=on|off,dump=on|off,share=on|off,prealloc=on|off,size=size,host-nodes=host-nodes,policy=default|preferred|bind|interleave``
         Creates a memory backend object, which can be used to back the
         guest RAM. Memory backend objects offer more control than the
@@ -17,6 +17,8 @@
 #include "qga-qapi-types.h"
 
 #define QGA_READ_COUNT_DEFAULT 4096
+/* Bytes read from the channel per wakeup, e.g. for large guest-file-write */
+#define QGA_CHANNEL_READ_SIZE (64 * 1024)
 
 typedef struct GAState GAState;
 typedef struct GACommandState GACommandState;
@@ -102,6 +102,7 @@ struct GAState {
     GAConfig *config;
     int socket_activation;
     bool force_exit;
+    gchar read_buf[QGA_CHANNEL_READ_SIZE + 1];
 };
 
 struct GAState *ga_state;
@@ -586,9 +587,10 @@ end:
 static gboolean channel_event_cb(GIOCondition condition, gpointer data)
 {
     GAState *s = data;
-    gchar buf[QGA_READ_COUNT_DEFAULT + 1];
+    gchar *buf = s->read_buf;
     gsize count;
-    GIOStatus status = ga_channel_read(s->channel, buf, QGA_READ_COUNT_DEFAULT, &count);
+    GIOStatus status = ga_channel_read(s->channel, buf, QGA_CHANNEL_READ_SIZE,
+                                       &count);
     switch (status) {
     case G_IO_STATUS_ERROR:
         g_warning("error reading channel");
@@ -596,7 +598,10 @@ static gboolean channel_event_cb(GIOCondition condition, gpointer data)
         return false;
     case G_IO_STATUS_NORMAL:
         buf[count] = 0;
-        g_debug("read data, count: %d, data: %s", (int)count, buf);
+        /* don't format a copy of every request unless it will be logged */
+        if (s->log_level & G_LOG_LEVEL_DEBUG) {
+            g_debug("read data, count: %d, data: %s", (int)count, buf);
+        }
         json_message_parser_feed(&s->parser, (char *)buf, (int)count);
         break;
     case G_IO_STATUS_EOF:
@@ -194,5 +194,8 @@ void *replay_event_net_load(void);
    Should be called before virtual devices initialization
    to make cached timers available for post_load functions. */
 void replay_vmstate_register(void);
+/* Starts taking a VM snapshot every period_ms milliseconds of host time.
+   Only useful in record mode. */
+void replay_snapshot_timer_start(int64_t period_ms);
 
 #endif
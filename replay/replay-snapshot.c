@@ -16,6 +16,8 @@
 #include "monitor/monitor.h"
 #include "qapi/qmp/qstring.h"
 #include "qemu/error-report.h"
+#include "qemu/timer.h"
+#include "sysemu/runstate.h"
 #include "migration/vmstate.h"
 #include "migration/snapshot.h"
 
@@ -93,6 +95,57 @@ void replay_vmstate_init(void)
     }
 }
 
+/* Delay before retrying a snapshot that could not be taken yet */
+#define REPLAY_SNAPSHOT_RETRY_MS 100
+
+static QEMUTimer *replay_snapshot_timer;
+static int64_t replay_snapshot_period_ms;
+
+/*
+ * Periodic snapshots give replay_seek() a nearby starting point, so that
+ * reverse debugging of a long recording only has to replay the last
+ * period instead of the whole log.  The seek picks the snapshot by the
+ * instruction count saved in it; the name, made of the same count, only
+ * tells the snapshots apart in "info snapshots".  The timer runs on the
+ * realtime clock, which is not part of the recorded state, exactly like
+ * a savevm issued from the monitor.
+ */
+static void replay_snapshot_timer_cb(void *opaque)
+{
+    int64_t now = qemu_clock_get_ms(QEMU_CLOCK_REALTIME);
+    g_autofree char *name = NULL;
+    Error *err = NULL;
+
+    if (!runstate_is_running() || !replay_can_snapshot()) {
+        /* Not at a point where a snapshot can be taken, retry shortly */
+        timer_mod(replay_snapshot_timer, now + REPLAY_SNAPSHOT_RETRY_MS);
+        return;
+    }
+
+    name = g_strdup_printf("%s-%" PRIu64,
+                           replay_snapshot ? replay_snapshot : "replay",
+                           replay_get_current_icount());
+    if (!save_snapshot(name, true, NULL, false, NULL, &err)) {
+        error_report_err(err);
+        error_report("Could not create periodic snapshot for icount record,"
+                     " disabling them");
+        return;
+    }
+    timer_mod(replay_snapshot_timer,
+              qemu_clock_get_ms(QEMU_CLOCK_REALTIME)
+              + replay_snapshot_period_ms);
+}
+
+void replay_snapshot_timer_start(int64_t period_ms)
+{
+    assert(!replay_snapshot_timer);
+    replay_snapshot_period_ms = period_ms;
+    replay_snapshot_timer = timer_new_ms(QEMU_CLOCK_REALTIME,
+                                         replay_snapshot_timer_cb, NULL);
+    timer_mod(replay_snapshot_timer,
+              qemu_clock_get_ms(QEMU_CLOCK_REALTIME) + period_ms);
+}
+
 bool replay_can_snapshot(void)
 {
     return replay_mode == REPLAY_MODE_NONE
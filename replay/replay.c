@@ -31,6 +31,8 @@ char *replay_snapshot;
 
 /* Name of replay file  */
 static char *replay_filename;
+/* Interval between automatic snapshots in record mode, in seconds */
+static uint64_t replay_snapshot_period;
 ReplayState replay_state;
 static GSList *replay_blockers;
 
@@ -325,6 +327,12 @@ void replay_configure(QemuOpts *opts)
     }
 
     replay_snapshot = g_strdup(qemu_opt_get(opts, "rrsnapshot"));
+    replay_snapshot_period = qemu_opt_get_number(opts, "rrperiod", 0);
+    if (replay_snapshot_period > UINT32_MAX) {
+        error_report("Invalid icount rrperiod option: must be at most %u "
+                     "seconds", UINT32_MAX);
+        exit(1);
+    }
     replay_vmstate_register();
     replay_enable(fname, mode);
 
@@ -347,7 +355,9 @@ void replay_start(void)
         exit(1);
     }
 
-    /* Timer for snapshotting will be set up here. */
+    if (replay_mode == REPLAY_MODE_RECORD && replay_snapshot_period) {
+        replay_snapshot_timer_start((int64_t)replay_snapshot_period * 1000);
+    }
 
     replay_enable_events();
 }
@@ -165,6 +165,59 @@ def is_contiguous(bits):
         return -1
 
 
+def bit_groups(bits):
+    """Return the runs of set bits in BITS as (shift, length) pairs,
+       starting with the least significant one."""
+    r = []
+    while bits != 0:
+        shift = ctz(bits)
+        length = ctz(~(bits >> shift))
+        r.append((shift, length))
+        bits &= ~(((1 << length) - 1) << shift)
+    return r
+
+
+def str_switch_case(mask, ncases):
+    """Return the expression to switch on for the bits in MASK, and
+       a function that maps the fixed bits of a case to its label."""
+
+    # Attempt to aid the compiler in producing compact switch statements.
+    # If the bits in the mask are contiguous, extract them.
+    sh = is_contiguous(mask)
+    if sh > 0:
+        return (f'(insn >> {sh}) & {mask >> sh:#x}',
+                lambda b: hex(b >> sh))
+
+    # If the mask is split in several runs of bits, but the cases still
+    # fill a good part of the space of values for the bits, gather the
+    # runs into a dense index.  This lets the compiler use a jump table
+    # rather than a tree of comparisons against sparse constants.
+    groups = bit_groups(mask)
+    nbits = bin(mask).count('1')
+    if len(groups) > 1 and (1 << nbits) <= 4 * ncases:
+        terms = []
+        pos = 0
+        for shift, length in groups:
+            t = f'(insn >> {shift})' if shift else 'insn'
+            t = f'({t} & {(1 << length) - 1:#x})'
+            if pos:
+                t = f'({t} << {pos})'
+            terms.append(t)
+            pos += length
+
+        def str_case(b):
+            r = 0
+            pos = 0
+            for shift, length in groups:
+                r |= ((b >> shift) & ((1 << length) - 1)) << pos
+                pos += length
+            return hex(r)
+
+        return (' | '.join(terms), str_case)
+
+    return (f'insn & {whexC(mask)}', whexC)
+
+
 def eq_fields_for_args(flds_a, arg):
     if len(flds_a) != len(arg.fields):
         return False
@@ -542,24 +595,8 @@ def output_code(self, i, extracted, outerbits, outermask):
                    '(ctx, &u.f_', self.base.base.name, ', insn);\n')
             extracted = True
 
-        # Attempt to aid the compiler in producing compact switch statements.
-        # If the bits in the mask are contiguous, extract them.
-        sh = is_contiguous(self.thismask)
-        if sh > 0:
-            # Propagate SH down into the local functions.
-            def str_switch(b, sh=sh):
-                return f'(insn >> {sh}) & {b >> sh:#x}'
-
-            def str_case(b, sh=sh):
-                return hex(b >> sh)
-        else:
-            def str_switch(b):
-                return f'insn & {whexC(b)}'
-
-            def str_case(b):
-                return whexC(b)
-
-        output(ind, 'switch (', str_switch(self.thismask), ') {\n')
+        sw, str_case = str_switch_case(self.thismask, len(self.subs))
+        output(ind, 'switch (', sw, ') {\n')
         for b, s in sorted(self.subs):
             assert (self.thismask & ~s.fixedmask) == 0
             innermask = outermask | self.thismask
@@ -1146,24 +1183,8 @@ def output_code(self, i, extracted, outerbits, outermask):
                    f'(ctx, insn, {extracted // 8}, {self.width // 8});\n')
             extracted = self.width
 
-        # Attempt to aid the compiler in producing compact switch statements.
-        # If the bits in the mask are contiguous, extract them.
-        sh = is_contiguous(self.mask)
-        if sh > 0:
-            # Propagate SH down into the local functions.
-            def str_switch(b, sh=sh):
-                return f'(insn >> {sh}) & {b >> sh:#x}'
-
-            def str_case(b, sh=sh):
-                return hex(b >> sh)
-        else:
-            def str_switch(b):
-                return f'insn & {whexC(b)}'
-
-            def str_case(b):
-                return whexC(b)
-
-        output(ind, 'switch (', str_switch(self.mask), ') {\n')
+        sw, str_case = str_switch_case(self.mask, len(self.subs))
+        output(ind, 'switch (', sw, ') {\n')
         for b, s in sorted(self.subs):
             innermask = outermask | self.mask
             innerbits = outerbits | b
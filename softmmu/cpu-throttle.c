@@ -29,6 +29,8 @@
 #include "qemu/main-loop.h"
 #include "sysemu/cpus.h"
 #include "sysemu/cpu-throttle.h"
+#include "sysemu/kvm.h"
+#include "trace.h"
 
 /* vcpu throttling controls */
 static QEMUTimer *throttle_timer;
@@ -38,6 +40,13 @@ static unsigned int throttle_percentage;
 #define CPU_THROTTLE_PCT_MAX 99
 #define CPU_THROTTLE_TIMESLICE_NS 10000000
 
+/* per-vcpu dirty limit controls */
+static QEMUTimer *dirty_limit_timer;
+static uint64_t dirty_limit_bytes_per_sec;
+static int64_t dirty_limit_last_ns;
+
+#define DIRTY_LIMIT_PERIOD_NS (1000 * SCALE_MS)
+
 static void cpu_throttle_thread(CPUState *cpu, run_on_cpu_data opaque)
 {
     double pct;
@@ -122,8 +131,115 @@ int cpu_throttle_get_percentage(void)
     return qatomic_read(&throttle_percentage);
 }
 
+/*
+ * A vcpu that fills its dirty ring sleeps for dirty_limit_sleep_us before
+ * running again, so vcpus that do not write to memory are never slowed
+ * down.  If a vcpu dirties the ring_bytes of its ring at a rate R, one
+ * cycle lasts ring_bytes / R, of which it spent the current sleep time
+ * throttled.  For the next cycle to last ring_bytes / limit, the sleep
+ * time has to grow by the difference; half of it is applied to damp the
+ * noise of the measurement.
+ */
+static int64_t cpu_throttle_dirty_limit_adjust(int64_t sleep_us, double rate,
+                                               double limit, double ring_bytes)
+{
+    double cycle_us, run_us, target_us;
+
+    if (rate < 1) {
+        return 0;
+    }
+
+    cycle_us = ring_bytes / rate * G_USEC_PER_SEC;
+    run_us = MAX(cycle_us - sleep_us, 1);
+    target_us = ring_bytes / limit * G_USEC_PER_SEC - run_us;
+    target_us = MIN(target_us, run_us * CPU_THROTTLE_PCT_MAX /
+                               (100 - CPU_THROTTLE_PCT_MAX));
+
+    return MAX((int64_t)(sleep_us + target_us) / 2, 0);
+}
+
+static void cpu_throttle_dirty_limit_tick(void *opaque)
+{
+    uint64_t limit = qatomic_read(&dirty_limit_bytes_per_sec);
+    int64_t now = qemu_clock_get_ns(QEMU_CLOCK_REALTIME);
+    double period = (double)(now - dirty_limit_last_ns) /
+                    NANOSECONDS_PER_SECOND;
+    double ring_bytes = (double)kvm_dirty_ring_size() *
+                        qemu_real_host_page_size;
+    CPUState *cpu;
+
+    if (!limit) {
+        return;
+    }
+
+    CPU_FOREACH(cpu) {
+        uint64_t pages = qatomic_read(&cpu->dirty_pages);
+        double rate = (double)(pages - cpu->dirty_limit_prev_pages) *
+                      qemu_real_host_page_size / period;
+        int64_t sleep_us;
+
+        sleep_us = cpu_throttle_dirty_limit_adjust(cpu->dirty_limit_sleep_us,
+                                                   rate, limit, ring_bytes);
+        cpu->dirty_limit_prev_pages = pages;
+        qatomic_set(&cpu->dirty_limit_sleep_us, sleep_us);
+        trace_cpu_throttle_dirty_limit(cpu->cpu_index, (uint64_t)rate,
+                                       sleep_us);
+    }
+
+    dirty_limit_last_ns = now;
+    timer_mod(dirty_limit_timer, now + DIRTY_LIMIT_PERIOD_NS);
+}
+
+void cpu_throttle_dirty_limit_set(uint64_t bytes_per_sec)
+{
+    bool active = cpu_throttle_dirty_limit_active();
+    CPUState *cpu;
+
+    qatomic_set(&dirty_limit_bytes_per_sec, MAX(bytes_per_sec, 1));
+    if (active) {
+        return;
+    }
+
+    CPU_FOREACH(cpu) {
+        cpu->dirty_limit_prev_pages = qatomic_read(&cpu->dirty_pages);
+        qatomic_set(&cpu->dirty_limit_sleep_us, 0);
+    }
+    dirty_limit_last_ns = qemu_clock_get_ns(QEMU_CLOCK_REALTIME);
+    timer_mod(dirty_limit_timer, dirty_limit_last_ns + DIRTY_LIMIT_PERIOD_NS);
+}
+
+void cpu_throttle_dirty_limit_stop(void)
+{
+    CPUState *cpu;
+
+    qatomic_set(&dirty_limit_bytes_per_sec, 0);
+    CPU_FOREACH(cpu) {
+        qatomic_set(&cpu->dirty_limit_sleep_us, 0);
+    }
+}
+
+bool cpu_throttle_dirty_limit_active(void)
+{
+    return qatomic_read(&dirty_limit_bytes_per_sec) != 0;
+}
+
+void cpu_throttle_dirty_limit_sleep(CPUState *cpu)
+{
+    int64_t sleeptime_ns, endtime_ns;
+
+    sleeptime_ns = qatomic_read(&cpu->dirty_limit_sleep_us) * SCALE_US;
+    endtime_ns = qemu_clock_get_ns(QEMU_CLOCK_REALTIME) + sleeptime_ns;
+    while (sleeptime_ns > 0 && !qatomic_read(&cpu->stop) &&
+           !qatomic_read(&cpu->exit_request)) {
+        g_usleep(MIN(sleeptime_ns, CPU_THROTTLE_TIMESLICE_NS) / SCALE_US);
+        sleeptime_ns = endtime_ns - qemu_clock_get_ns(QEMU_CLOCK_REALTIME);
+    }
+}
+
 void cpu_throttle_init(void)
 {
     throttle_timer = timer_new_ns(QEMU_CLOCK_VIRTUAL_RT,
                                   cpu_throttle_timer_tick, NULL);
+    dirty_limit_timer = timer_new_ns(QEMU_CLOCK_REALTIME,
+                                     cpu_throttle_dirty_limit_tick, NULL);
 }
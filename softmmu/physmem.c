@@ -125,7 +125,8 @@ typedef struct PhysPageMap {
 } PhysPageMap;
 
 struct AddressSpaceDispatch {
-    MemoryRegionSection *mru_section;
+    /* Never reused, unlike the address of the dispatch itself.  */
+    uint64_t id;
     /* This is a multi-level map on the physical address space.
      * The bottom level has pointers to MemoryRegionSections.
      */
@@ -329,18 +330,35 @@ static MemoryRegionSection *phys_page_find(AddressSpaceDispatch *d, hwaddr addr)
     }
 }
 
+/*
+ * Most recently used section of each dispatch, per thread.  A single
+ * shared pointer would bounce between the vCPUs and the I/O threads as
+ * soon as they work on different regions, and then miss every time.
+ */
+#define MRU_CACHE_SIZE 8
+
+typedef struct MRUCacheEntry {
+    uint64_t id;
+    MemoryRegionSection *section;
+} MRUCacheEntry;
+
+static __thread MRUCacheEntry mru_cache[MRU_CACHE_SIZE];
+
 /* Called from RCU critical section */
 static MemoryRegionSection *address_space_lookup_region(AddressSpaceDispatch *d,
                                                         hwaddr addr,
                                                         bool resolve_subpage)
 {
-    MemoryRegionSection *section = qatomic_read(&d->mru_section);
+    MRUCacheEntry *mru = &mru_cache[d->id % MRU_CACHE_SIZE];
+    MemoryRegionSection *section = mru->section;
     subpage_t *subpage;
 
-    if (!section || section == &d->map.sections[PHYS_SECTION_UNASSIGNED] ||
+    if (mru->id != d->id ||
+        section == &d->map.sections[PHYS_SECTION_UNASSIGNED] ||
         !section_covers_addr(section, addr)) {
         section = phys_page_find(d, addr);
-        qatomic_set(&d->mru_section, section);
+        mru->id = d->id;
+        mru->section = section;
     }
     if (resolve_subpage && section->mr->subpage) {
         subpage = container_of(section->mr, subpage_t, iomem);
@@ -2052,7 +2070,8 @@ RAMBlock *qemu_ram_alloc_from_fd(ram_addr_t size, MemoryRegion *mr,
     int64_t file_size, file_align;
 
     /* Just support these ram flags by now. */
-    assert((ram_flags & ~(RAM_SHARED | RAM_PMEM | RAM_NORESERVE)) == 0);
+    assert((ram_flags & ~(RAM_SHARED | RAM_PMEM | RAM_NORESERVE |
+                          RAM_READONLY_FD)) == 0);
 
     if (xen_enabled()) {
         error_setg(errp, "-mem-path not supported with Xen");
@@ -2113,7 +2132,8 @@ RAMBlock *qemu_ram_alloc_from_file(ram_addr_t size, MemoryRegion *mr,
     bool created;
     RAMBlock *block;
 
-    fd = file_ram_open(mem_path, memory_region_name(mr), readonly, &created,
+    fd = file_ram_open(mem_path, memory_region_name(mr),
+                       readonly || (ram_flags & RAM_READONLY_FD), &created,
                        errp);
     if (fd < 0) {
         return NULL;
@@ -2581,9 +2601,13 @@ static void io_mem_init(void)
 
 AddressSpaceDispatch *address_space_dispatch_new(FlatView *fv)
 {
+    /* Written under the BQL; 0 is never used, so mru_cache starts empty. */
+    static uint64_t next_id = 1;
     AddressSpaceDispatch *d = g_new0(AddressSpaceDispatch, 1);
     uint16_t n;
 
+    d->id = next_id++;
+
     n = dummy_section(&d->map, fv, &io_mem_unassigned);
     assert(n == PHYS_SECTION_UNASSIGNED);
 
@@ -2744,7 +2768,7 @@ static bool prepare_mmio_access(MemoryRegion *mr)
 {
     bool release_lock = false;
 
-    if (!qemu_mutex_iothread_locked()) {
+    if (!mr->lockless_io && !qemu_mutex_iothread_locked()) {
         qemu_mutex_lock_iothread();
         release_lock = true;
     }
@@ -3538,6 +3562,21 @@ int ram_block_discard_range(RAMBlock *rb, uint64_t start, size_t length)
          */
         need_madvise = (rb->page_size == qemu_host_page_size);
         need_fallocate = rb->fd != -1;
+        if (rb->flags & RAM_READONLY_FD) {
+            /*
+             * The file must not be modified, and with MAP_PRIVATE dropping
+             * the private copies is all we can do: discarded pages read
+             * back the contents of the file, not zeroes.
+             */
+            if (!need_madvise) {
+                ret = -ENOTSUP;
+                error_report("ram_block_discard_range: Discarding huge pages "
+                             "of readonly files is not supported: %s",
+                             rb->idstr);
+                goto err;
+            }
+            need_fallocate = false;
+        }
         if (need_fallocate) {
             /* For a file, this causes the area of the file to be zero'd
              * if read, and for hugetlbfs also causes it to be unmapped
@@ -3639,14 +3678,13 @@ void mtree_print_dispatch(AddressSpaceDispatch *d, MemoryRegion *root)
                                 " [ROM]", " [watch]" };
 
         qemu_printf("      #%d @" TARGET_FMT_plx ".." TARGET_FMT_plx
-                    " %s%s%s%s%s",
+                    " %s%s%s%s",
             i,
             s->offset_within_address_space,
             s->offset_within_address_space + MR_SIZE(s->mr->size),
             s->mr->name ? s->mr->name : "(noname)",
             i < ARRAY_SIZE(names) ? names[i] : "",
             s->mr == root ? " [ROOT]" : "",
-            s == d->mru_section ? " [MRU]" : "",
             s->mr->is_iommu ? " [iommu]" : "");
 
         if (s->mr->alias) {
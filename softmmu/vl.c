@@ -155,6 +155,7 @@ static uint64_t ram_slots;
 static int display_remote;
 static int snapshot;
 static bool preconfig_requested;
+static int64_t qemu_init_start_ns;
 static QemuPluginList plugin_list = QTAILQ_HEAD_INITIALIZER(plugin_list);
 static BlockdevOptionsQueue bdo_queue = QSIMPLEQ_HEAD_INITIALIZER(bdo_queue);
 static bool nographic = false;
@@ -433,6 +434,9 @@ static QemuOptsList qemu_icount_opts = {
         }, {
             .name = "rrsnapshot",
             .type = QEMU_OPT_STRING,
+        }, {
+            .name = "rrperiod",
+            .type = QEMU_OPT_NUMBER,
         },
         { /* end of list */ }
     },
@@ -1179,11 +1183,25 @@ static int device_help_func(void *opaque, QemuOpts *opts, Error **errp)
     return qdev_device_help(opts);
 }
 
+/*
+ * Startup profiling: each step of qemu_init() reports the time elapsed
+ * since QEMU started, so that slow phases can be found with
+ * "-trace qemu_init_*".
+ */
+static int64_t qemu_init_elapsed_us(void)
+{
+    return (get_clock() - qemu_init_start_ns) / SCALE_US;
+}
+
 static int device_init_func(void *opaque, QemuOpts *opts, Error **errp)
 {
     DeviceState *dev;
+    int64_t start_us = qemu_init_elapsed_us();
 
     dev = qdev_device_add(opts, errp);
+    trace_qemu_init_device(qemu_opt_get(opts, "driver") ?: "",
+                           qemu_opts_id(opts) ?: "",
+                           qemu_init_elapsed_us() - start_us);
     if (!dev && *errp) {
         error_report_err(*errp);
         return -1;
@@ -2671,8 +2689,11 @@ void qmp_x_exit_preconfig(Error **errp)
     }
 
     qemu_init_board();
+    trace_qemu_init_phase("board", qemu_init_elapsed_us());
     qemu_create_cli_devices();
+    trace_qemu_init_phase("cli_devices", qemu_init_elapsed_us());
     qemu_machine_creation_done();
+    trace_qemu_init_phase("machine_done", qemu_init_elapsed_us());
 
     if (loadvm) {
         Error *local_err = NULL;
@@ -2711,6 +2732,7 @@ void qemu_init(int argc, char **argv, char **envp)
     bool userconfig = true;
     FILE *vmstate_dump_file = NULL;
 
+    qemu_init_start_ns = get_clock();
     qemu_add_opts(&qemu_drive_opts);
     qemu_add_drive_opts(&qemu_legacy_drive_opts);
     qemu_add_drive_opts(&qemu_common_drive_opts);
@@ -3615,6 +3637,7 @@ void qemu_init(int argc, char **argv, char **envp)
         exit(1);
     }
     trace_init_file();
+    trace_qemu_init_phase("options", qemu_init_elapsed_us());
 
     qemu_init_main_loop(&error_fatal);
     cpu_timers_init();
@@ -3631,6 +3654,7 @@ void qemu_init(int argc, char **argv, char **envp)
     qemu_disable_default_devices();
     qemu_create_default_devices();
     qemu_create_early_backends();
+    trace_qemu_init_phase("early_backends", qemu_init_elapsed_us());
 
     qemu_apply_legacy_machine_options(machine_opts_dict);
     qemu_apply_machine_options(machine_opts_dict);
@@ -3643,6 +3667,7 @@ void qemu_init(int argc, char **argv, char **envp)
      */
     configure_accelerators(argv[0]);
     phase_advance(PHASE_ACCEL_CREATED);
+    trace_qemu_init_phase("accel", qemu_init_elapsed_us());
 
     /*
      * Beware, QOM objects created before this point miss global and
@@ -3673,6 +3698,7 @@ void qemu_init(int argc, char **argv, char **envp)
     migration_object_init();
 
     qemu_create_late_backends();
+    trace_qemu_init_phase("late_backends", qemu_init_elapsed_us());
 
     /* parse features once if machine provides default cpu_type */
     current_machine->cpu_type = machine_class->default_cpu_type;
@@ -3697,4 +3723,5 @@ void qemu_init(int argc, char **argv, char **envp)
     accel_setup_post(current_machine);
     os_setup_post();
     resume_mux_open();
+    trace_qemu_init_phase("done", qemu_init_elapsed_us());
 }
@@ -45,6 +45,7 @@
 #include "qemu-common.h"
 #include "qemu-version.h"
 #include "qemu/config-file.h"
+#include "qemu/cutils.h"
 #include "qemu/error-report.h"
 #include "qemu/help_option.h"
 #include "qemu/log.h"
@@ -56,10 +57,16 @@
 #include "storage-daemon/qapi/qapi-commands.h"
 #include "storage-daemon/qapi/qapi-init-commands.h"
 
+#include "sysemu/iothread.h"
 #include "sysemu/runstate.h"
 #include "trace/control.h"
 
 static const char *pid_file;
+
+/* iothreads created by --iothreads, assigned round-robin to exports */
+static char **auto_iothread_ids;
+static unsigned long num_auto_iothreads;
+static unsigned long next_auto_iothread;
 static volatile bool exit_requested = false;
 
 void qemu_system_killed(int signal, pid_t pid)
@@ -102,6 +109,9 @@ static void help(void)
 "           [,growable=on|off][,writable=on|off]\n"
 "                         export the specified block node over FUSE\n"
 "\n"
+"  --iothreads <n>        create <n> iothreads and spread the following\n"
+"                         exports without an iothread over them\n"
+"\n"
 "  --monitor [chardev=]name[,mode=control][,pretty[=on|off]]\n"
 "                         configure a QMP monitor\n"
 "\n"
@@ -130,6 +140,7 @@ enum {
     OPTION_BLOCKDEV = 256,
     OPTION_CHARDEV,
     OPTION_EXPORT,
+    OPTION_IOTHREADS,
     OPTION_MONITOR,
     OPTION_NBD_SERVER,
     OPTION_OBJECT,
@@ -161,6 +172,8 @@ static int getopt_set_loc(int argc, char **argv, const char *optstring,
     return c;
 }
 
+#define MAX_AUTO_IOTHREADS 1024
+
 static void process_options(int argc, char *argv[])
 {
     int c;
@@ -170,6 +183,7 @@ static void process_options(int argc, char *argv[])
         {"chardev", required_argument, NULL, OPTION_CHARDEV},
         {"export", required_argument, NULL, OPTION_EXPORT},
         {"help", no_argument, NULL, 'h'},
+        {"iothreads", required_argument, NULL, OPTION_IOTHREADS},
         {"monitor", required_argument, NULL, OPTION_MONITOR},
         {"nbd-server", required_argument, NULL, OPTION_NBD_SERVER},
         {"object", required_argument, NULL, OPTION_OBJECT},
@@ -239,10 +253,44 @@ static void process_options(int argc, char *argv[])
                 visit_type_BlockExportOptions(v, NULL, &export, &error_fatal);
                 visit_free(v);
 
+                if (!export->has_iothread && num_auto_iothreads) {
+                    unsigned long i = next_auto_iothread++ % num_auto_iothreads;
+
+                    export->has_iothread = true;
+                    export->iothread = g_strdup(auto_iothread_ids[i]);
+                }
+
                 qmp_block_export_add(export, &error_fatal);
                 qapi_free_BlockExportOptions(export);
                 break;
             }
+        case OPTION_IOTHREADS:
+            {
+                unsigned long i;
+
+                if (num_auto_iothreads) {
+                    error_report("--iothreads can only be used once");
+                    exit(EXIT_FAILURE);
+                }
+                if (qemu_strtoul(optarg, NULL, 10, &num_auto_iothreads) < 0 ||
+                    num_auto_iothreads == 0 ||
+                    num_auto_iothreads > MAX_AUTO_IOTHREADS) {
+                    error_report("Number of iothreads must be between 1 "
+                                 "and %d", MAX_AUTO_IOTHREADS);
+                    exit(EXIT_FAILURE);
+                }
+
+                auto_iothread_ids = g_new(char *, num_auto_iothreads);
+                for (i = 0; i < num_auto_iothreads; i++) {
+                    auto_iothread_ids[i] = g_strdup_printf("qsd-iothread%lu",
+                                                           i);
+                    object_new_with_props(TYPE_IOTHREAD,
+                                          object_get_objects_root(),
+                                          auto_iothread_ids[i], &error_fatal,
+                                          NULL);
+                }
+                break;
+            }
         case OPTION_MONITOR:
             {
                 Visitor *v;
@@ -600,12 +600,149 @@ static bool swap_commutative2(TCGArg *p1, TCGArg *p2)
     return false;
 }
 
+/*
+ * Track stores to the CPU state that have not been read back yet, so that
+ * a later store covering the same bytes can eliminate them.  Only the
+ * ops between two calls, guest memory accesses or basic block ends are
+ * considered: any of those may observe env, e.g. by raising an exception.
+ */
+#define MAX_ENV_STORES 8
+
+typedef struct EnvStoreInfo {
+    TCGOp *op;
+    intptr_t ofs;
+    intptr_t len;
+} EnvStoreInfo;
+
+typedef struct EnvStoreState {
+    int nb;
+    EnvStoreInfo st[MAX_ENV_STORES];
+} EnvStoreState;
+
+static int env_access_size(TCGOpcode opc)
+{
+    switch (opc) {
+    case INDEX_op_ld8u_i32:
+    case INDEX_op_ld8s_i32:
+    case INDEX_op_st8_i32:
+    case INDEX_op_ld8u_i64:
+    case INDEX_op_ld8s_i64:
+    case INDEX_op_st8_i64:
+        return 1;
+    case INDEX_op_ld16u_i32:
+    case INDEX_op_ld16s_i32:
+    case INDEX_op_st16_i32:
+    case INDEX_op_ld16u_i64:
+    case INDEX_op_ld16s_i64:
+    case INDEX_op_st16_i64:
+        return 2;
+    case INDEX_op_ld_i32:
+    case INDEX_op_st_i32:
+    case INDEX_op_ld32u_i64:
+    case INDEX_op_ld32s_i64:
+    case INDEX_op_st32_i64:
+        return 4;
+    case INDEX_op_ld_i64:
+    case INDEX_op_st_i64:
+        return 8;
+    default:
+        return 0;
+    }
+}
+
+static void env_stores_reset(EnvStoreState *es)
+{
+    es->nb = 0;
+}
+
+/* Forget the pending stores that overlap [ofs, ofs + len). */
+static void env_stores_read(EnvStoreState *es, intptr_t ofs, intptr_t len)
+{
+    int i, j;
+
+    for (i = j = 0; i < es->nb; i++) {
+        EnvStoreInfo *e = &es->st[i];
+        if (e->ofs + e->len <= ofs || ofs + len <= e->ofs) {
+            es->st[j++] = *e;
+        }
+    }
+    es->nb = j;
+}
+
+/*
+ * Remove the pending stores that are completely overwritten by OP,
+ * then record OP itself.
+ */
+static void env_stores_write(TCGContext *s, EnvStoreState *es, TCGOp *op,
+                             intptr_t ofs, intptr_t len)
+{
+    int i, j;
+
+    for (i = j = 0; i < es->nb; i++) {
+        EnvStoreInfo *e = &es->st[i];
+        if (ofs <= e->ofs && e->ofs + e->len <= ofs + len) {
+            tcg_op_remove(s, e->op);
+        } else {
+            es->st[j++] = *e;
+        }
+    }
+    if (j == MAX_ENV_STORES) {
+        /* Drop the oldest entry; it simply stays in the op stream.  */
+        memmove(&es->st[0], &es->st[1], sizeof(es->st[0]) * (j - 1));
+        j--;
+    }
+    es->st[j] = (EnvStoreInfo){ .op = op, .ofs = ofs, .len = len };
+    es->nb = j + 1;
+}
+
+static void env_stores_update(TCGContext *s, EnvStoreState *es, TCGOp *op)
+{
+    const TCGOpDef *def = &tcg_op_defs[op->opc];
+    TCGTemp *env = tcgv_ptr_temp(cpu_env);
+    int len;
+
+    if (def->flags & (TCG_OPF_BB_END | TCG_OPF_SIDE_EFFECTS |
+                      TCG_OPF_CALL_CLOBBER)) {
+        env_stores_reset(es);
+        return;
+    }
+
+    switch (op->opc) {
+    case INDEX_op_mb:
+    case INDEX_op_plugin_cb_start:
+    case INDEX_op_ld_vec:
+    case INDEX_op_dupm_vec:
+        env_stores_reset(es);
+        return;
+    case INDEX_op_st_vec:
+        return;
+    default:
+        break;
+    }
+
+    len = env_access_size(op->opc);
+    if (len == 0) {
+        return;
+    }
+    if (def->nb_oargs) {
+        /* A load: through anything but env it may alias the CPU state.  */
+        if (arg_temp(op->args[1]) == env) {
+            env_stores_read(es, op->args[2], len);
+        } else {
+            env_stores_reset(es);
+        }
+    } else if (arg_temp(op->args[1]) == env) {
+        env_stores_write(s, es, op, op->args[2], len);
+    }
+}
+
 /* Propagate constants and copies, fold constant expressions. */
 void tcg_optimize(TCGContext *s)
 {
     int nb_temps, nb_globals, i;
     TCGOp *op, *op_next, *prev_mb = NULL;
     TCGTempSet temps_used;
+    EnvStoreState env_stores;
 
     /* Array VALS has an element for each temp.
        If this temp holds a constant then its value is kept in VALS' element.
@@ -619,6 +756,7 @@ void tcg_optimize(TCGContext *s)
     for (i = 0; i < nb_temps; ++i) {
         s->temps[i].state_ptr = NULL;
     }
+    env_stores_reset(&env_stores);
 
     QTAILQ_FOREACH_SAFE(op, &s->ops, link, op_next) {
         uint64_t mask, partmask, affected, tmp;
@@ -1599,5 +1737,8 @@ void tcg_optimize(TCGContext *s)
         } else if (opc == INDEX_op_mb) {
             prev_mb = op;
         }
+
+        /* Eliminate stores to env that are overwritten before use.  */
+        env_stores_update(s, &env_stores, op);
     }
 }
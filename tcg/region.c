@@ -24,6 +24,7 @@
 
 #include "qemu/osdep.h"
 #include "qemu/units.h"
+#include "qemu/bitmap.h"
 #include "qapi/error.h"
 #include "exec/exec-all.h"
 #include "tcg/tcg.h"
@@ -56,6 +57,9 @@ struct tcg_region_state {
     /* fields protected by the lock */
     size_t current; /* current region index */
     size_t agg_size_full; /* aggregate size of full regions */
+    uint64_t alloc_count; /* number of region allocations so far */
+    uint64_t *alloc_seq; /* value of alloc_count when each region was taken */
+    unsigned long *evicted; /* regions emptied by tcg_region_evict */
 };
 
 static struct tcg_region_state region;
@@ -163,10 +167,23 @@ static void tcg_region_trees_init(void)
     }
 }
 
-static struct tcg_region_tree *tc_ptr_to_region_tree(const void *p)
+/* Return the index of the region containing @p, a rw buffer pointer. */
+static size_t tcg_region_index(const void *p)
 {
-    size_t region_idx;
+    ptrdiff_t offset;
+
+    if (p < region.start_aligned) {
+        return 0;
+    }
+    offset = p - region.start_aligned;
+    if (offset > region.stride * (region.n - 1)) {
+        return region.n - 1;
+    }
+    return offset / region.stride;
+}
 
+static struct tcg_region_tree *tc_ptr_to_region_tree(const void *p)
+{
     /*
      * Like tcg_splitwx_to_rw, with no assert.  The pc may come from
      * a signal handler over which the caller has no control.
@@ -177,19 +194,7 @@ static struct tcg_region_tree *tc_ptr_to_region_tree(const void *p)
             return NULL;
         }
     }
-
-    if (p < region.start_aligned) {
-        region_idx = 0;
-    } else {
-        ptrdiff_t offset = p - region.start_aligned;
-
-        if (offset > region.stride * (region.n - 1)) {
-            region_idx = region.n - 1;
-        } else {
-            region_idx = offset / region.stride;
-        }
-    }
-    return region_trees + region_idx * tree_size;
+    return region_trees + tcg_region_index(p) * tree_size;
 }
 
 void tcg_tb_insert(TranslationBlock *tb)
@@ -331,11 +336,20 @@ static void tcg_region_assign(TCGContext *s, size_t curr_region)
 
 static bool tcg_region_alloc__locked(TCGContext *s)
 {
-    if (region.current == region.n) {
-        return true;
+    size_t idx;
+
+    if (region.current < region.n) {
+        idx = region.current++;
+    } else {
+        /* All regions have been handed out; reuse an evicted one. */
+        idx = find_first_bit(region.evicted, region.n);
+        if (idx == region.n) {
+            return true;
+        }
+        clear_bit(idx, region.evicted);
     }
-    tcg_region_assign(s, region.current);
-    region.current++;
+    tcg_region_assign(s, idx);
+    region.alloc_seq[idx] = ++region.alloc_count;
     return false;
 }
 
@@ -384,6 +398,7 @@ void tcg_region_reset_all(void)
     qemu_mutex_lock(&region.lock);
     region.current = 0;
     region.agg_size_full = 0;
+    bitmap_zero(region.evicted, region.n);
 
     for (i = 0; i < n_ctxs; i++) {
         TCGContext *s = qatomic_read(&tcg_ctxs[i]);
@@ -394,6 +409,85 @@ void tcg_region_reset_all(void)
     tcg_region_tree_reset_all();
 }
 
+static gboolean tcg_region_evict_iter(gpointer key, gpointer value,
+                                      gpointer data)
+{
+    g_ptr_array_add(data, value);
+    return false;
+}
+
+/*
+ * Call from a safe-work context.
+ *
+ * Pick the region that was allocated longest ago among those that are
+ * full, i.e. not currently assigned to any context, call @invalidate on
+ * every TB in it, and make it available to tcg_region_alloc again.
+ * Any hot TBs in that region are simply retranslated into a newer one,
+ * after which they are again the last to be evicted.
+ *
+ * Returns the number of TBs evicted in *@n_tbs and true on success,
+ * or false if there is no region that can be evicted.
+ */
+bool tcg_region_evict(void (*invalidate)(TranslationBlock *tb),
+                      size_t *n_tbs)
+{
+    unsigned int n_ctxs = qatomic_read(&tcg_cur_ctxs);
+    g_autofree unsigned long *in_use = bitmap_new(region.n);
+    struct tcg_region_tree *rt;
+    GPtrArray *tbs;
+    void *start, *end;
+    size_t i, victim = region.n;
+    uint64_t oldest = UINT64_MAX;
+
+    qemu_mutex_lock(&region.lock);
+    if (region.current < region.n) {
+        /* There are still unused regions; we should not get here. */
+        qemu_mutex_unlock(&region.lock);
+        return false;
+    }
+    for (i = 0; i < n_ctxs; i++) {
+        const TCGContext *s = qatomic_read(&tcg_ctxs[i]);
+        set_bit(tcg_region_index(s->code_gen_buffer), in_use);
+    }
+    for (i = 0; i < region.n; i++) {
+        if (!test_bit(i, in_use) && !test_bit(i, region.evicted) &&
+            region.alloc_seq[i] < oldest) {
+            oldest = region.alloc_seq[i];
+            victim = i;
+        }
+    }
+    qemu_mutex_unlock(&region.lock);
+
+    if (victim == region.n) {
+        return false;
+    }
+
+    rt = region_trees + victim * tree_size;
+    tbs = g_ptr_array_new();
+    qemu_mutex_lock(&rt->lock);
+    g_tree_foreach(rt->tree, tcg_region_evict_iter, tbs);
+    qemu_mutex_unlock(&rt->lock);
+
+    for (i = 0; i < tbs->len; i++) {
+        invalidate(g_ptr_array_index(tbs, i));
+    }
+    *n_tbs = tbs->len;
+    g_ptr_array_free(tbs, true);
+
+    qemu_mutex_lock(&rt->lock);
+    /* Increment the refcount first so that destroy acts as a reset */
+    g_tree_ref(rt->tree);
+    g_tree_destroy(rt->tree);
+    qemu_mutex_unlock(&rt->lock);
+
+    tcg_region_bounds(victim, &start, &end);
+    qemu_mutex_lock(&region.lock);
+    region.agg_size_full -= (end - start) - TCG_HIGHWATER;
+    set_bit(victim, region.evicted);
+    qemu_mutex_unlock(&region.lock);
+    return true;
+}
+
 static size_t tcg_n_regions(size_t tb_size, unsigned max_cpus)
 {
 #ifdef CONFIG_USER_ONLY
@@ -407,9 +501,13 @@ static size_t tcg_n_regions(size_t tb_size, unsigned max_cpus)
      * being of reasonable size. If that's not possible we make do by evenly
      * dividing the code_gen_buffer among the vCPUs.
      */
-    /* Use a single region if all we have is one vCPU thread */
+    /*
+     * With a single vCPU thread there is no contention, but we still
+     * want a few regions so that tcg_region_evict can recycle the
+     * oldest one instead of flushing everything.
+     */
     if (max_cpus == 1 || !qemu_tcg_mttcg_enabled()) {
-        return 1;
+        return MAX(1, MIN(tb_size / (16 * MiB), 8));
     }
 
     /*
@@ -873,6 +971,8 @@ void tcg_region_init(size_t tb_size, int splitwx, unsigned max_cpus)
 
     /* init the region struct */
     qemu_mutex_init(&region.lock);
+    region.alloc_seq = g_new0(uint64_t, region.n);
+    region.evicted = bitmap_new(region.n);
 
     /*
      * Set guard pages in the rw buffer, as that's the one into which
@@ -0,0 +1,172 @@
+/*
+ * QEMU utility functions speed benchmark
+ *
+ * Covers helpers that sit on hot paths of the block layer, migration
+ * and the device models: buffer_is_zero() with each accelerator the
+ * host supports, HBitmap updates and iteration, and the iovec helpers.
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or
+ * (at your option) any later version.  See the COPYING file in the
+ * top-level directory.
+ */
+#include "qemu/osdep.h"
+#include "qemu/units.h"
+#include "qemu/cutils.h"
+#include "qemu/hbitmap.h"
+#include "qemu/iov.h"
+
+/*
+ * Selecting the next accelerator cannot be undone, so every length is
+ * measured within a single pass over the accelerators.
+ */
+static void test_buffer_is_zero_speed(void)
+{
+    static const size_t lens[] = { 64, 512, 4096, 65536 };
+    const size_t total = 2 * GiB;
+    uint8_t *buf = g_malloc0(lens[ARRAY_SIZE(lens) - 1]);
+    size_t remain;
+    int i;
+
+    do {
+        for (i = 0; i < ARRAY_SIZE(lens); i++) {
+            g_test_timer_start();
+            for (remain = total; remain; remain -= lens[i]) {
+                g_assert(buffer_is_zero(buf, lens[i]));
+            }
+            g_test_timer_elapsed();
+
+            g_test_message("buffer_is_zero: %s len %zu bytes %.2f MB/sec",
+                           test_buffer_is_zero_accel_name(), lens[i],
+                           total / MiB / g_test_timer_last());
+        }
+    } while (test_buffer_is_zero_next_accel());
+
+    g_free(buf);
+}
+
+#define HBITMAP_BENCH_SIZE (1ULL << 26)
+
+static void test_hbitmap_set_speed(const void *opaque)
+{
+    uint64_t count = (uintptr_t)opaque;
+    const uint64_t calls = MAX((1ULL << 28) / count, 1 << 10);
+    const uint64_t total = calls * count;
+    HBitmap *hb = hbitmap_alloc(HBITMAP_BENCH_SIZE, 0);
+    uint64_t start = 0, i;
+
+    g_test_timer_start();
+    for (i = 0; i < calls; i++) {
+        hbitmap_set(hb, start, count);
+        start += count * 3;
+        if (start + count > HBITMAP_BENCH_SIZE) {
+            /* start over on a clean bitmap, so that bits really change */
+            start = 0;
+            hbitmap_reset_all(hb);
+        }
+    }
+    g_test_timer_elapsed();
+
+    g_test_message("hbitmap_set: %" PRIu64 " bits per call "
+                   "%.2f Mbits/sec", count,
+                   total / 1e6 / g_test_timer_last());
+
+    hbitmap_free(hb);
+}
+
+static void test_hbitmap_iter_speed(const void *opaque)
+{
+    uint64_t stride = (uintptr_t)opaque;
+    const int rounds = 4;
+    HBitmap *hb = hbitmap_alloc(HBITMAP_BENCH_SIZE, 0);
+    HBitmapIter hbi;
+    uint64_t i, found = 0;
+    int round;
+
+    for (i = 0; i < HBITMAP_BENCH_SIZE; i += stride) {
+        hbitmap_set(hb, i, 1);
+    }
+
+    g_test_timer_start();
+    for (round = 0; round < rounds; round++) {
+        hbitmap_iter_init(&hbi, hb, 0);
+        while (hbitmap_iter_next(&hbi) >= 0) {
+            found++;
+        }
+    }
+    g_test_timer_elapsed();
+    g_assert_cmpuint(found, ==, rounds * DIV_ROUND_UP(HBITMAP_BENCH_SIZE,
+                                                      stride));
+
+    g_test_message("hbitmap_iter_next: one bit in %" PRIu64 " "
+                   "%.2f Mbits scanned/sec", stride,
+                   rounds * HBITMAP_BENCH_SIZE / 1e6 / g_test_timer_last());
+
+    hbitmap_free(hb);
+}
+
+#define IOV_BENCH_BUF_SIZE (64 * KiB)
+
+static void test_iov_speed(const void *opaque)
+{
+    size_t frag = (uintptr_t)opaque;
+    unsigned int niov = IOV_BENCH_BUF_SIZE / frag;
+    const size_t total = 2 * GiB;
+    uint8_t *buf = g_malloc0(IOV_BENCH_BUF_SIZE);
+    uint8_t *data = g_malloc0(IOV_BENCH_BUF_SIZE);
+    struct iovec *iov = g_new(struct iovec, niov);
+    size_t remain;
+    unsigned int i;
+
+    for (i = 0; i < niov; i++) {
+        iov[i].iov_base = data + i * frag;
+        iov[i].iov_len = frag;
+    }
+
+    g_test_timer_start();
+    for (remain = total; remain; remain -= IOV_BENCH_BUF_SIZE) {
+        iov_from_buf(iov, niov, 0, buf, IOV_BENCH_BUF_SIZE);
+        iov_to_buf(iov, niov, 0, buf, IOV_BENCH_BUF_SIZE);
+    }
+    g_test_timer_elapsed();
+
+    g_test_message("iov_from_buf+iov_to_buf: %u x %zu bytes %.2f MB/sec",
+                   niov, frag, total / MiB / g_test_timer_last());
+
+    g_free(iov);
+    g_free(data);
+    g_free(buf);
+}
+
+int main(int argc, char **argv)
+{
+    static const uint64_t set_counts[] = { 1, 64, 4096, 1 << 20 };
+    static const uint64_t iter_strides[] = { 1, 64, 4096 };
+    static const size_t iov_frags[] = { 64, 512, 4096 };
+    char name[64];
+    int i;
+
+    g_test_init(&argc, &argv, NULL);
+
+    g_test_add_func("/util/benchmark/buffer-is-zero",
+                    test_buffer_is_zero_speed);
+    for (i = 0; i < ARRAY_SIZE(set_counts); i++) {
+        snprintf(name, sizeof(name), "/util/benchmark/hbitmap-set/count-%"
+                 PRIu64, set_counts[i]);
+        g_test_add_data_func(name, (void *)(uintptr_t)set_counts[i],
+                             test_hbitmap_set_speed);
+    }
+    for (i = 0; i < ARRAY_SIZE(iter_strides); i++) {
+        snprintf(name, sizeof(name), "/util/benchmark/hbitmap-iter/stride-%"
+                 PRIu64, iter_strides[i]);
+        g_test_add_data_func(name, (void *)(uintptr_t)iter_strides[i],
+                             test_hbitmap_iter_speed);
+    }
+    for (i = 0; i < ARRAY_SIZE(iov_frags); i++) {
+        snprintf(name, sizeof(name), "/util/benchmark/iov/frag-%zu",
+                 iov_frags[i]);
+        g_test_add_data_func(name, (void *)(uintptr_t)iov_frags[i],
+                             test_iov_speed);
+    }
+
+    return g_test_run();
+}
@@ -9,6 +9,7 @@
 #include "qemu/atomic.h"
 #include "qemu/qht.h"
 #include "qemu/rcu.h"
+#include "qemu/timer.h"
 #include "qemu/xxhash.h"
 
 struct thread_stats {
@@ -20,6 +21,7 @@ struct thread_stats {
     size_t not_rm;
     size_t rz;
     size_t not_rz;
+    int64_t max_update_ns;
 };
 
 struct thread_info {
@@ -60,6 +62,7 @@ static double resize_rate; /* 0.0 to 1.0 */
 static unsigned int n_rz_threads = 1;
 static QemuThread *rz_threads;
 static bool precompute_hash;
+static bool measure_latency;
 
 static double update_rate; /* 0.0 to 1.0 */
 static uint64_t update_threshold;
@@ -88,6 +91,7 @@ static const char commands_string[] =
     " -r = update range of keys (will be rounded up to pow2)\n"
     "\n"
     " -u = update rate (0.0 to 100.0), 50/50 split of insertions/removals\n"
+    " -L = measure the worst-case latency of updates, e.g. during resizes\n"
     "\n"
     " -R = enable auto-resize\n"
     " -S = resize rate (0.0 to 100.0)\n"
@@ -174,6 +178,8 @@ static void do_rw(struct thread_info *info)
             stats->not_rd++;
         }
     } else {
+        int64_t start = measure_latency ? get_clock() : 0;
+
         p = &keys[r & (update_range - 1)];
         hash = hfunc(*p);
         if (info->write_op) {
@@ -200,6 +206,10 @@ static void do_rw(struct thread_info *info)
             }
         }
         info->write_op = !info->write_op;
+        if (measure_latency) {
+            stats->max_update_ns = MAX(stats->max_update_ns,
+                                       get_clock() - start);
+        }
     }
 }
 
@@ -383,6 +393,8 @@ static void add_stats(struct thread_stats *s, struct thread_info *info, int n)
 
         s->rz += stats->rz;
         s->not_rz += stats->not_rz;
+
+        s->max_update_ns = MAX(s->max_update_ns, stats->max_update_ns);
     }
 }
 
@@ -414,6 +426,10 @@ static void pr_stats(void)
            (double)s.rm / (s.rm + s.not_rm) * 100,
            (double)(s.rm + s.not_rm) / 1e6);
 
+    if (measure_latency) {
+        printf(" Max update time:   %.2f us\n", s.max_update_ns / 1e3);
+    }
+
     tx = (s.rd + s.not_rd + s.in + s.not_in + s.rm + s.not_rm) / 1e6 / duration;
     printf(" Throughput:        %.2f MT/s\n", tx);
     printf(" Throughput/thread: %.2f MT/s/thread\n", tx / n_rw_threads);
@@ -444,7 +460,7 @@ static void parse_args(int argc, char *argv[])
     int c;
 
     for (;;) {
-        c = getopt(argc, argv, "d:D:g:k:K:l:hn:N:o:pr:Rs:S:u:");
+        c = getopt(argc, argv, "d:D:g:k:K:l:Lhn:N:o:pr:Rs:S:u:");
         if (c < 0) {
             break;
         }
@@ -474,6 +490,9 @@ static void parse_args(int argc, char *argv[])
         case 'l':
             lookup_range = pow2ceil(atol(optarg));
             break;
+        case 'L':
+            measure_latency = true;
+            break;
         case 'n':
             n_rw_threads = atoi(optarg);
             break;
@@ -19,6 +19,7 @@
 #include "qemu/option.h"
 #include "qemu/range.h"
 #include "qemu/sockets.h"
+#include "qemu/units.h"
 #include "chardev/char.h"
 #include "qapi/qapi-visit-sockets.h"
 #include "qapi/qobject-input-visitor.h"
@@ -395,6 +396,19 @@ static void migrate_set_parameter_str(QTestState *who, const char *parameter,
     migrate_check_parameter_str(who, parameter, value);
 }
 
+static void migrate_set_parameter_bool(QTestState *who, const char *parameter,
+                                       bool value)
+{
+    QDict *rsp;
+
+    rsp = qtest_qmp(who,
+                    "{ 'execute': 'migrate-set-parameters',"
+                    "'arguments': { %s: %i } }",
+                    parameter, value);
+    g_assert(qdict_haskey(rsp, "return"));
+    qobject_unref(rsp);
+}
+
 static void migrate_pause(QTestState *who)
 {
     QDict *rsp;
@@ -474,6 +488,8 @@ typedef struct {
     bool only_target;
     /* Use dirty ring if true; dirty logging otherwise */
     bool use_dirty_ring;
+    /* guest RAM size, the default of the architecture if NULL */
+    const char *memory_size;
     char *opts_source;
     char *opts_target;
 } MigrateStart;
@@ -563,6 +579,10 @@ static int test_migrate_start(QTestState **from, QTestState **to,
         g_assert_not_reached();
     }
 
+    if (args->memory_size) {
+        memory_size = args->memory_size;
+    }
+
     if (!getenv("QTEST_LOG") && args->hide_stderr) {
         ignore_stderr = "2>/dev/null";
     } else {
@@ -982,6 +1002,103 @@ static void test_precopy_tcp(void)
     test_migrate_end(from, to, true);
 }
 
+#define FILE_TEST_FILENAME "migfile"
+
+/*
+ * Save the source to a file, then restore it on a destination that was
+ * started with "-incoming defer" only once the file is complete.
+ */
+static void test_precopy_file_common(bool mapped_ram, bool multifd,
+                                     bool direct_io)
+{
+    g_autofree char *uri = g_strdup_printf("file:%s/%s", tmpfs,
+                                           FILE_TEST_FILENAME);
+    MigrateStart *args = migrate_start_new();
+    QTestState *from, *to;
+    QDict *rsp;
+
+    if (test_migrate_start(&from, &to, "defer", args)) {
+        return;
+    }
+
+    /* Let the save converge: nobody reads the file while it is written */
+    migrate_set_parameter_int(from, "max-bandwidth", 1000000000);
+    migrate_set_parameter_int(from, "downtime-limit", CONVERGE_DOWNTIME);
+
+    if (mapped_ram) {
+        migrate_set_capability(from, "mapped-ram", true);
+        migrate_set_capability(to, "mapped-ram", true);
+    }
+    if (multifd) {
+        migrate_set_parameter_int(from, "multifd-channels", 4);
+        migrate_set_parameter_int(to, "multifd-channels", 4);
+        migrate_set_capability(from, "multifd", true);
+        migrate_set_capability(to, "multifd", true);
+    }
+    if (direct_io) {
+        migrate_set_parameter_bool(from, "direct-io", true);
+        migrate_set_parameter_bool(to, "direct-io", true);
+    }
+
+    /* Wait for the first serial output from the source */
+    wait_for_serial("src_serial");
+
+    migrate_qmp(from, uri, "{}");
+    wait_for_migration_complete(from);
+    if (!got_stop) {
+        qtest_qmp_eventwait(from, "STOP");
+    }
+
+    rsp = wait_command(to, "{ 'execute': 'migrate-incoming',"
+                           "  'arguments': { 'uri': %s }}", uri);
+    qobject_unref(rsp);
+    qtest_qmp_eventwait(to, "RESUME");
+
+    wait_for_serial("dest_serial");
+    test_migrate_end(from, to, true);
+    cleanup(FILE_TEST_FILENAME);
+}
+
+static void test_precopy_file(void)
+{
+    test_precopy_file_common(false, false, false);
+}
+
+static void test_precopy_file_mapped_ram(void)
+{
+    test_precopy_file_common(true, false, false);
+}
+
+static void test_multifd_file_mapped_ram(void)
+{
+    test_precopy_file_common(true, true, false);
+}
+
+#ifdef O_DIRECT
+static bool probe_o_direct_support(const char *dir)
+{
+    g_autofree char *path = g_strdup_printf("%s/%s", dir, "odirect-probe");
+    int fd;
+
+    fd = open(path, O_CREAT | O_RDWR | O_DIRECT, 0600);
+    if (fd < 0) {
+        return false;
+    }
+    close(fd);
+    unlink(path);
+    return true;
+}
+
+static void test_multifd_file_mapped_ram_dio(void)
+{
+    if (!probe_o_direct_support(tmpfs)) {
+        g_test_skip("Filesystem does not support O_DIRECT");
+        return;
+    }
+    test_precopy_file_common(true, true, true);
+}
+#endif
+
 static void test_migrate_fd_proto(void)
 {
     MigrateStart *args = migrate_start_new();
@@ -1225,7 +1342,7 @@ static void test_migrate_auto_converge(void)
     test_migrate_end(from, to, true);
 }
 
-static void test_multifd_tcp(const char *method)
+static void test_multifd_tcp(const char *method, bool zero_page)
 {
     MigrateStart *args = migrate_start_new();
     QTestState *from, *to;
@@ -1255,6 +1372,9 @@ static void test_multifd_tcp(const char *method)
     migrate_set_capability(from, "multifd", true);
     migrate_set_capability(to, "multifd", true);
 
+    migrate_set_capability(from, "multifd-zero-page", zero_page);
+    migrate_set_capability(to, "multifd-zero-page", zero_page);
+
     /* Start incoming migration from the 1st socket */
     rsp = wait_command(to, "{ 'execute': 'migrate-incoming',"
                            "  'arguments': { 'uri': 'tcp:127.0.0.1:0' }}");
@@ -1283,21 +1403,114 @@ static void test_multifd_tcp(const char *method)
 
 static void test_multifd_tcp_none(void)
 {
-    test_multifd_tcp("none");
+    test_multifd_tcp("none", false);
+}
+
+static void test_multifd_tcp_zero_page(void)
+{
+    test_multifd_tcp("none", true);
 }
 
 static void test_multifd_tcp_zlib(void)
 {
-    test_multifd_tcp("zlib");
+    test_multifd_tcp("zlib", false);
 }
 
 #ifdef CONFIG_ZSTD
 static void test_multifd_tcp_zstd(void)
 {
-    test_multifd_tcp("zstd");
+    test_multifd_tcp("zstd", false);
+}
+#endif
+
+#ifdef CONFIG_LZ4
+static void test_multifd_tcp_lz4(void)
+{
+    test_multifd_tcp("lz4", false);
 }
 #endif
 
+/*
+ * Benchmark of a multifd migration.  The A-B guest keeps dirtying its
+ * test memory, one byte per page for every pass over it, while the rest of
+ * the guest RAM only needs to be sent once; QTEST_MIGRATION_PERF_MEM (e.g.
+ * "4G") sets the total RAM size and QTEST_MIGRATION_PERF_CHANNELS the
+ * number of channels.  Only run with -m perf.
+ */
+static void test_multifd_perf(const void *opaque)
+{
+    const char *method = opaque;
+    MigrateStart *args = migrate_start_new();
+    QTestState *from, *to;
+    QDict *rsp, *rsp_ram;
+    g_autofree char *uri = NULL;
+    const char *channels_env = getenv("QTEST_MIGRATION_PERF_CHANNELS");
+    int channels = channels_env ? atoi(channels_env) : 8;
+    int64_t total_time;
+
+    args->memory_size = getenv("QTEST_MIGRATION_PERF_MEM");
+    args->hide_stderr = true;
+    if (test_migrate_start(&from, &to, "defer", args)) {
+        return;
+    }
+
+    migrate_set_parameter_int(from, "downtime-limit", CONVERGE_DOWNTIME);
+    /* 100GB/s, do not let the rate limit be what we measure */
+    migrate_set_parameter_int(from, "max-bandwidth", 100000000000LL);
+
+    migrate_set_parameter_int(from, "multifd-channels", channels);
+    migrate_set_parameter_int(to, "multifd-channels", channels);
+
+    migrate_set_parameter_str(from, "multifd-compression", method);
+    migrate_set_parameter_str(to, "multifd-compression", method);
+
+    migrate_set_capability(from, "multifd", true);
+    migrate_set_capability(to, "multifd", true);
+
+    rsp = wait_command(to, "{ 'execute': 'migrate-incoming',"
+                           "  'arguments': { 'uri': 'tcp:127.0.0.1:0' }}");
+    qobject_unref(rsp);
+
+    wait_for_serial("src_serial");
+
+    uri = migrate_get_socket_address(to, "socket-address");
+
+    migrate_qmp(from, uri, "{}");
+
+    if (!got_stop) {
+        qtest_qmp_eventwait(from, "STOP");
+    }
+    qtest_qmp_eventwait(to, "RESUME");
+
+    wait_for_serial("dest_serial");
+    wait_for_migration_complete(from);
+
+    rsp = migrate_query(from);
+    rsp_ram = qdict_get_qdict(rsp, "ram");
+    total_time = qdict_get_int(rsp, "total-time");
+    g_test_message("multifd %s: %d channels, total %" PRId64 " ms, "
+                   "setup %" PRId64 " ms, downtime %" PRId64 " ms",
+                   method, channels, total_time,
+                   qdict_get_int(rsp, "setup-time"),
+                   qdict_get_int(rsp, "downtime"));
+    g_test_message("multifd %s: %" PRId64 " MB sent, %" PRId64 " MB over "
+                   "multifd (%.2f MB/s per channel), %.2f mbps last pass",
+                   method, qdict_get_int(rsp_ram, "transferred") / MiB,
+                   qdict_get_int(rsp_ram, "multifd-bytes") / MiB,
+                   (double)qdict_get_int(rsp_ram, "multifd-bytes") / MiB /
+                   channels / MAX(total_time, 1) * 1000,
+                   qdict_get_double(rsp_ram, "mbps"));
+    g_test_message("multifd %s: %" PRId64 " dirty syncs, %" PRId64 " zero "
+                   "pages, %" PRId64 " normal pages, %" PRId64 " pages/s",
+                   method, qdict_get_int(rsp_ram, "dirty-sync-count"),
+                   qdict_get_int(rsp_ram, "duplicate"),
+                   qdict_get_int(rsp_ram, "normal"),
+                   qdict_get_int(rsp_ram, "pages-per-second"));
+    qobject_unref(rsp);
+
+    test_migrate_end(from, to, true);
+}
+
 /*
  * This test does:
  *  source               target
@@ -1469,6 +1682,9 @@ int main(int argc, char **argv)
     qtest_add_func("/migration/bad_dest", test_baddest);
     qtest_add_func("/migration/precopy/unix", test_precopy_unix);
     qtest_add_func("/migration/precopy/tcp", test_precopy_tcp);
+    qtest_add_func("/migration/precopy/file", test_precopy_file);
+    qtest_add_func("/migration/precopy/file/mapped-ram",
+                   test_precopy_file_mapped_ram);
     /* qtest_add_func("/migration/ignore_shared", test_ignore_shared); */
     qtest_add_func("/migration/xbzrle/unix", test_xbzrle_unix);
     qtest_add_func("/migration/fd_proto", test_migrate_fd_proto);
@@ -1481,11 +1697,37 @@ int main(int argc, char **argv)
 
     qtest_add_func("/migration/auto_converge", test_migrate_auto_converge);
     qtest_add_func("/migration/multifd/tcp/none", test_multifd_tcp_none);
+    qtest_add_func("/migration/multifd/tcp/zero-page",
+                   test_multifd_tcp_zero_page);
     qtest_add_func("/migration/multifd/tcp/cancel", test_multifd_tcp_cancel);
     qtest_add_func("/migration/multifd/tcp/zlib", test_multifd_tcp_zlib);
+    qtest_add_func("/migration/multifd/file/mapped-ram",
+                   test_multifd_file_mapped_ram);
+#ifdef O_DIRECT
+    qtest_add_func("/migration/multifd/file/mapped-ram/dio",
+                   test_multifd_file_mapped_ram_dio);
+#endif
 #ifdef CONFIG_ZSTD
     qtest_add_func("/migration/multifd/tcp/zstd", test_multifd_tcp_zstd);
 #endif
+#ifdef CONFIG_LZ4
+    qtest_add_func("/migration/multifd/tcp/lz4", test_multifd_tcp_lz4);
+#endif
+
+    if (g_test_perf()) {
+        qtest_add_data_func("/migration/perf/multifd/none", "none",
+                            test_multifd_perf);
+        qtest_add_data_func("/migration/perf/multifd/zlib", "zlib",
+                            test_multifd_perf);
+#ifdef CONFIG_ZSTD
+        qtest_add_data_func("/migration/perf/multifd/zstd", "zstd",
+                            test_multifd_perf);
+#endif
+#ifdef CONFIG_LZ4
+        qtest_add_data_func("/migration/perf/multifd/lz4", "lz4",
+                            test_multifd_perf);
+#endif
+    }
 
     if (kvm_dirty_ring_supported()) {
         qtest_add_func("/migration/dirty_ring",
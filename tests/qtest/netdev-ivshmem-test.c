@@ -0,0 +1,342 @@
+/*
+ * QTest testcase for the ivshmem netdev
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ */
+
+#include "qemu/osdep.h"
+#include <glib/gstdio.h>
+#include "contrib/ivshmem-server/ivshmem-server.h"
+#include "libqos/libqtest.h"
+#include "qapi/qmp/qdict.h"
+#include "qemu/sockets.h"
+#include "qemu-common.h"
+
+/* Small enough for a ring to hold only a handful of frames. */
+#define TMPSHMSIZE (64 << 10)
+#define FRAME_LEN 1024
+#define NR_FRAMES 64
+
+static char *tmpshm;
+static char *tmpdir;
+static char *tmpserver;
+
+typedef struct ServerThread {
+    GThread *thread;
+    IvshmemServer *server;
+    int pipe[2]; /* to handle quit */
+} ServerThread;
+
+static ServerThread thread;
+static IvshmemServer server;
+
+/* A QEMU whose ivshmem netdev is bridged to a socket netdev. */
+typedef struct Peer {
+    QTestState *qts;
+    int sock[2];
+} Peer;
+
+static void *server_thread(void *data)
+{
+    ServerThread *t = data;
+    IvshmemServer *server = t->server;
+
+    while (true) {
+        fd_set fds;
+        int maxfd, ret;
+
+        FD_ZERO(&fds);
+        FD_SET(t->pipe[0], &fds);
+        maxfd = t->pipe[0] + 1;
+
+        ivshmem_server_get_fds(server, &fds, &maxfd);
+
+        ret = select(maxfd, &fds, NULL, NULL, NULL);
+
+        if (ret < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+
+            g_critical("select error: %s\n", strerror(errno));
+            break;
+        }
+        if (ret == 0) {
+            continue;
+        }
+
+        if (FD_ISSET(t->pipe[0], &fds)) {
+            break;
+        }
+
+        if (ivshmem_server_handle_fds(server, &fds, maxfd) < 0) {
+            g_critical("ivshmem_server_handle_fds() failed\n");
+            break;
+        }
+    }
+
+    return NULL;
+}
+
+static void peer_start(Peer *p)
+{
+    int ret;
+
+    ret = socketpair(PF_UNIX, SOCK_STREAM, 0, p->sock);
+    g_assert_cmpint(ret, !=, -1);
+
+    p->qts = qtest_initf("-netdev ivshmem,id=iv,server=%s "
+                         "-netdev socket,id=sock,fd=%d "
+                         "-netdev hubport,id=p0,hubid=0,netdev=iv "
+                         "-netdev hubport,id=p1,hubid=0,netdev=sock",
+                         tmpserver, p->sock[1]);
+}
+
+static void peer_stop(Peer *p)
+{
+    qtest_quit(p->qts);
+    close(p->sock[0]);
+    close(p->sock[1]);
+}
+
+static void peer_qmp(Peer *p, const char *cmd)
+{
+    QDict *rsp;
+
+    rsp = qtest_qmp(p->qts, "{ 'execute': %s }", cmd);
+    g_assert(qdict_haskey(rsp, "return"));
+    qobject_unref(rsp);
+}
+
+/*
+ * Frames carry a kind, 'p' for the probes sent while waiting for the
+ * link to come up and 'd' for data, followed by a sequence number.
+ */
+static void send_frame(Peer *p, char kind, uint32_t seq)
+{
+    uint8_t buf[4 + FRAME_LEN];
+
+    stl_be_p(buf, FRAME_LEN);
+    memset(buf + 4, seq, FRAME_LEN);
+    buf[4] = kind;
+    stl_be_p(buf + 5, seq);
+    g_assert_cmpint(qemu_write_full(p->sock[0], buf, sizeof(buf)), ==,
+                    sizeof(buf));
+}
+
+static bool recv_frame(Peer *p, uint8_t *buf, int timeout_ms)
+{
+    GPollFD pfd = { .fd = p->sock[0], .events = G_IO_IN };
+    uint32_t len;
+    ssize_t ret;
+
+    if (g_poll(&pfd, 1, timeout_ms) <= 0) {
+        return false;
+    }
+
+    ret = recv(p->sock[0], &len, sizeof(len), MSG_WAITALL);
+    g_assert_cmpint(ret, ==, sizeof(len));
+    g_assert_cmpint(be32_to_cpu(len), ==, FRAME_LEN);
+    ret = recv(p->sock[0], buf, FRAME_LEN, MSG_WAITALL);
+    g_assert_cmpint(ret, ==, FRAME_LEN);
+    return true;
+}
+
+static void recv_data(Peer *p, uint32_t seq)
+{
+    uint8_t buf[FRAME_LEN];
+
+    do {
+        g_assert(recv_frame(p, buf, 5000));
+    } while (buf[0] == 'p');
+
+    g_assert_cmpint(buf[0], ==, 'd');
+    g_assert_cmpint(ldl_be_p(buf + 1), ==, seq);
+    g_assert_cmpint(buf[FRAME_LEN - 1], ==, (uint8_t)seq);
+}
+
+/*
+ * Frames sent before the two netdevs learn about each other are dropped,
+ * so keep probing until one makes it through.
+ */
+static void wait_link(Peer *from, Peer *to)
+{
+    uint8_t buf[FRAME_LEN];
+    int i;
+
+    for (i = 0; i < 100; i++) {
+        send_frame(from, 'p', i);
+        while (recv_frame(to, buf, 100)) {
+            if (buf[0] == 'p') {
+                return;
+            }
+        }
+    }
+
+    g_assert_not_reached();
+}
+
+static void test_netdev_ivshmem_pair(void)
+{
+    Peer a, b;
+
+    peer_start(&a);
+    peer_start(&b);
+
+    wait_link(&a, &b);
+    wait_link(&b, &a);
+
+    send_frame(&a, 'd', 1);
+    recv_data(&b, 1);
+    send_frame(&b, 'd', 2);
+    recv_data(&a, 2);
+
+    peer_stop(&b);
+    peer_stop(&a);
+}
+
+static void test_netdev_ivshmem_backpressure(void)
+{
+    uint8_t buf[FRAME_LEN];
+    Peer a, b;
+    int i;
+
+    peer_start(&a);
+    peer_start(&b);
+    wait_link(&a, &b);
+
+    /*
+     * A stopped VM does not pass frames on, so b leaves them on the ring
+     * and a has to queue everything past the first few.
+     */
+    peer_qmp(&b, "stop");
+    for (i = 0; i < NR_FRAMES; i++) {
+        send_frame(&a, 'd', i);
+    }
+    while (recv_frame(&b, buf, 500)) {
+        g_assert_cmpint(buf[0], ==, 'p');
+    }
+
+    /* Nothing may be lost once b starts draining the ring again. */
+    peer_qmp(&b, "cont");
+    for (i = 0; i < NR_FRAMES; i++) {
+        recv_data(&b, i);
+    }
+
+    peer_stop(&b);
+    peer_stop(&a);
+}
+
+static void test_netdev_ivshmem_restart(void)
+{
+    Peer a, b;
+    int i;
+
+    peer_start(&a);
+    peer_start(&b);
+    wait_link(&a, &b);
+
+    /* Leave a blocked on a full ring when its partner goes away. */
+    peer_qmp(&b, "stop");
+    for (i = 0; i < NR_FRAMES; i++) {
+        send_frame(&a, 'd', i);
+    }
+    peer_stop(&b);
+
+    peer_start(&b);
+    wait_link(&a, &b);
+    wait_link(&b, &a);
+
+    send_frame(&a, 'd', NR_FRAMES);
+    recv_data(&b, NR_FRAMES);
+    send_frame(&b, 'd', NR_FRAMES + 1);
+    recv_data(&a, NR_FRAMES + 1);
+
+    peer_stop(&b);
+    peer_stop(&a);
+}
+
+static void server_start(void)
+{
+    int ret;
+
+    ret = ivshmem_server_init(&server, tmpserver, tmpshm, true,
+                              TMPSHMSIZE, 1, g_test_verbose());
+    g_assert_cmpint(ret, ==, 0);
+
+    ret = ivshmem_server_start(&server);
+    g_assert_cmpint(ret, ==, 0);
+
+    thread.server = &server;
+    ret = pipe(thread.pipe);
+    g_assert_cmpint(ret, ==, 0);
+    thread.thread = g_thread_new("ivshmem-server", server_thread, &thread);
+    g_assert(thread.thread != NULL);
+}
+
+static void server_stop(void)
+{
+    if (qemu_write_full(thread.pipe[1], "q", 1) != 1) {
+        g_error("qemu_write_full: %s", g_strerror(errno));
+    }
+
+    g_thread_join(thread.thread);
+
+    ivshmem_server_close(&server);
+    close(thread.pipe[1]);
+    close(thread.pipe[0]);
+}
+
+static void cleanup(void)
+{
+    if (tmpshm) {
+        shm_unlink(tmpshm);
+        g_free(tmpshm);
+        tmpshm = NULL;
+    }
+
+    if (tmpserver) {
+        g_unlink(tmpserver);
+        g_free(tmpserver);
+        tmpserver = NULL;
+    }
+
+    if (tmpdir) {
+        g_rmdir(tmpdir);
+        tmpdir = NULL;
+    }
+}
+
+static void abrt_handler(void *data)
+{
+    cleanup();
+}
+
+int main(int argc, char **argv)
+{
+    int ret;
+    gchar dir[] = "/tmp/netdev-ivshmem-test.XXXXXX";
+
+    g_test_init(&argc, &argv, NULL);
+
+    qtest_add_abrt_handler(abrt_handler, NULL);
+    if (mkdtemp(dir) == NULL) {
+        g_error("mkdtemp: %s", g_strerror(errno));
+    }
+    tmpdir = dir;
+    tmpserver = g_strconcat(tmpdir, "/server", NULL);
+    tmpshm = g_strdup_printf("/qtest-netdev-%u-%u", getpid(),
+                             g_test_rand_int());
+
+    qtest_add_func("/netdev/ivshmem/pair", test_netdev_ivshmem_pair);
+    qtest_add_func("/netdev/ivshmem/backpressure",
+                   test_netdev_ivshmem_backpressure);
+    qtest_add_func("/netdev/ivshmem/restart", test_netdev_ivshmem_restart);
+
+    server_start();
+    ret = g_test_run();
+    server_stop();
+    cleanup();
+    return ret;
+}
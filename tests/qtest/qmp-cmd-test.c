@@ -45,6 +45,10 @@ static int query_error_class(const char *cmd)
         { "query-acpi-ospm-status", ERROR_CLASS_GENERIC_ERROR },
         { "query-balloon", ERROR_CLASS_DEVICE_NOT_ACTIVE },
         { "query-hotpluggable-cpus", ERROR_CLASS_GENERIC_ERROR },
+        { "query-kvm-exits", ERROR_CLASS_GENERIC_ERROR },
+#ifdef CONFIG_TCG
+        { "query-tcg-stats", ERROR_CLASS_GENERIC_ERROR },
+#endif
         { "query-vm-generation-id", ERROR_CLASS_GENERIC_ERROR },
         { NULL, -1 }
     };
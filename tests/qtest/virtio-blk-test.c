@@ -766,6 +766,127 @@ static void resize(void *obj, void *data, QGuestAllocator *t_alloc)
 
 }
 
+/*
+ * Requests kept in flight by perf_read, and how many to submit.  Each
+ * request takes three descriptors; they are recycled every batch.
+ */
+#define PERF_QUEUE_DEPTH  32
+#define PERF_REQUESTS     (64 * 1024)
+#define PERF_REQUEST_SIZE 4096
+
+static int perf_latency_cmp(const void *a, const void *b)
+{
+    gint64 x = *(const gint64 *)a, y = *(const gint64 *)b;
+
+    return x < y ? -1 : x > y;
+}
+
+/*
+ * Measure the cost of the virtio-blk device model on a null-co backend.
+ * The absolute numbers include the qtest protocol round trips needed to
+ * fill the virtqueue, so they are only meaningful compared between
+ * builds on the same host.
+ */
+static void perf_read(void *obj, void *data, QGuestAllocator *t_alloc)
+{
+    QVirtioBlk *blk_if = obj;
+    QVirtioDevice *dev = blk_if->vdev;
+    QTestState *qts = global_qtest;
+    uint64_t req_addr[PERF_QUEUE_DEPTH];
+    gint64 submitted[PERF_QUEUE_DEPTH];
+    gint64 *latency = g_new(gint64, PERF_REQUESTS);
+    QVirtioBlkReq req;
+    uint64_t features;
+    QVirtQueue *vq;
+    gint64 start, elapsed;
+    int done = 0;
+    int i, n;
+
+    features = qvirtio_get_features(dev);
+    features = features & ~(QVIRTIO_F_BAD_FEATURE |
+                    (1u << VIRTIO_RING_F_INDIRECT_DESC) |
+                    (1u << VIRTIO_RING_F_EVENT_IDX) |
+                    (1u << VIRTIO_BLK_F_SCSI));
+    qvirtio_set_features(dev, features);
+
+    vq = qvirtqueue_setup(dev, t_alloc, 0);
+    g_assert_cmpint(vq->size, >=, PERF_QUEUE_DEPTH * 3);
+
+    qvirtio_set_driver_ok(dev);
+
+    req.data = g_malloc0(PERF_REQUEST_SIZE);
+    for (i = 0; i < PERF_QUEUE_DEPTH; i++) {
+        req.type = VIRTIO_BLK_T_IN;
+        req.ioprio = 1;
+        req.sector = i * (PERF_REQUEST_SIZE / 512);
+        req_addr[i] = virtio_blk_request(t_alloc, dev, &req,
+                                         PERF_REQUEST_SIZE);
+    }
+    g_free(req.data);
+
+    start = g_get_monotonic_time();
+    while (done < PERF_REQUESTS) {
+        n = MIN(PERF_QUEUE_DEPTH, PERF_REQUESTS - done);
+
+        /* All descriptors of the previous batch are back */
+        vq->free_head = 0;
+        vq->num_free = vq->size;
+
+        for (i = 0; i < n; i++) {
+            uint32_t free_head;
+
+            free_head = qvirtqueue_add(qts, vq, req_addr[i], 16, false, true);
+            qvirtqueue_add(qts, vq, req_addr[i] + 16, PERF_REQUEST_SIZE,
+                           true, true);
+            qvirtqueue_add(qts, vq, req_addr[i] + 16 + PERF_REQUEST_SIZE, 1,
+                           true, false);
+            submitted[i] = g_get_monotonic_time();
+            qvirtqueue_kick(qts, dev, vq, free_head);
+        }
+
+        for (i = 0; i < n; i++) {
+            uint32_t head;
+
+            while (!qvirtqueue_get_buf(qts, vq, &head, NULL)) {
+                qtest_clock_step(qts, 100);
+                g_assert(g_get_monotonic_time() - start <=
+                         QVIRTIO_BLK_TIMEOUT_US * 10);
+            }
+            g_assert_cmpint(head % 3, ==, 0);
+            g_assert_cmpint(head / 3, <, n);
+            latency[done++] = g_get_monotonic_time() - submitted[head / 3];
+        }
+    }
+    elapsed = g_get_monotonic_time() - start;
+
+    for (i = 0; i < PERF_QUEUE_DEPTH; i++) {
+        g_assert_cmpint(readb(req_addr[i] + 16 + PERF_REQUEST_SIZE), ==, 0);
+        guest_free(t_alloc, req_addr[i]);
+    }
+
+    qsort(latency, PERF_REQUESTS, sizeof(latency[0]), perf_latency_cmp);
+    g_test_message("virtio-blk read: %d x %d bytes, queue depth %d: "
+                   "%.0f IOPS, latency p50 %" PRId64 " us, p99 %" PRId64
+                   " us, max %" PRId64 " us",
+                   PERF_REQUESTS, PERF_REQUEST_SIZE, PERF_QUEUE_DEPTH,
+                   PERF_REQUESTS * 1e6 / elapsed,
+                   latency[PERF_REQUESTS / 2],
+                   latency[PERF_REQUESTS * 99 / 100],
+                   latency[PERF_REQUESTS - 1]);
+
+    g_free(latency);
+    qvirtqueue_cleanup(dev->bus, vq, t_alloc);
+}
+
+static void *virtio_blk_perf_setup(GString *cmd_line, void *arg)
+{
+    g_string_append(cmd_line,
+                    " -drive if=none,id=drive0,file=null-co://,"
+                    "file.read-zeroes=on,format=raw ");
+
+    return arg;
+}
+
 static void *virtio_blk_test_setup(GString *cmd_line, void *arg)
 {
     char *tmp_path = drive_create();
@@ -797,6 +918,14 @@ static void register_virtio_blk_test(void)
     qos_add_test("nxvirtq", "virtio-blk-pci",
                       test_nonexistent_virtqueue, &opts);
     qos_add_test("hotplug", "virtio-blk-pci", pci_hotplug, &opts);
+
+    if (g_test_perf()) {
+        QOSGraphTestOptions perf_opts = {
+            .before = virtio_blk_perf_setup,
+        };
+
+        qos_add_test("perf-read", "virtio-blk", perf_read, &perf_opts);
+    }
 }
 
 libqos_init(register_virtio_blk_test);
@@ -0,0 +1,195 @@
+/*
+ * TCG micro-benchmarks
+ *
+ * A handful of fixed guest workloads, each stressing a different part of
+ * the translator and the runtime: straight integer code, floating point,
+ * loops the compiler can vectorize, pointer chasing across more memory
+ * than the softmmu/linux-user TLB covers, and indirect branches that miss
+ * in the TB jump cache.  Each kernel is timed on its own and the results
+ * are printed as JSON on stdout, so that runs can be compared across
+ * commits.  An optional argument scales the amount of work.
+ *
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <inttypes.h>
+#include <time.h>
+
+#define ARRAY_SIZE(x) (sizeof(x) / sizeof((x)[0]))
+
+typedef struct {
+    const char *name;
+    /* iterations at scale 1 */
+    uint64_t iterations;
+    uint64_t (*fn)(uint64_t iterations);
+} bench_kernel;
+
+static uint64_t bench_int(uint64_t iterations)
+{
+    uint64_t x = 88172645463325252ULL, acc = 0, i;
+
+    for (i = 0; i < iterations; i++) {
+        x ^= x << 13;
+        x ^= x >> 7;
+        x ^= x << 17;
+        acc += (x * 2654435761U) >> (x & 31);
+    }
+    return acc;
+}
+
+static uint64_t bench_fp(uint64_t iterations)
+{
+    double a = 1.0, b = 0.5, c = 0.25;
+    uint64_t i;
+
+    for (i = 0; i < iterations; i++) {
+        a = a * 0.999999 + b;
+        b = b * 1.000001 - c / (a + 1.0);
+        c = (a - b) * 0.5;
+    }
+    return (uint64_t)(int64_t)(a * 1000.0) ^ (uint64_t)(int64_t)(b * 1000.0);
+}
+
+#define VEC_LEN 1024
+
+static uint64_t bench_vector(uint64_t iterations)
+{
+    static int32_t va[VEC_LEN], vb[VEC_LEN], vc[VEC_LEN];
+    uint64_t acc = 0, i;
+    int j;
+
+    for (j = 0; j < VEC_LEN; j++) {
+        va[j] = j;
+        vb[j] = VEC_LEN - j;
+    }
+    for (i = 0; i < iterations / VEC_LEN; i++) {
+        for (j = 0; j < VEC_LEN; j++) {
+            vc[j] = va[j] * vb[j] + vc[j];
+        }
+        for (j = 0; j < VEC_LEN; j++) {
+            va[j] ^= vc[j] >> 3;
+        }
+    }
+    for (j = 0; j < VEC_LEN; j++) {
+        acc += vc[j];
+    }
+    return acc;
+}
+
+/* larger than any TLB, in pages of 4KiB */
+#define CHASE_PAGES 8192
+#define CHASE_STRIDE (4096 / sizeof(uint32_t))
+
+static uint64_t bench_memory(uint64_t iterations)
+{
+    uint32_t *chase = calloc(CHASE_PAGES, 4096);
+    uint32_t *order = malloc(CHASE_PAGES * sizeof(uint32_t));
+    uint64_t acc = 0, i;
+    uint32_t seed = 12345, pos;
+    int j;
+
+    if (!chase || !order) {
+        fprintf(stderr, "out of memory\n");
+        exit(1);
+    }
+
+    /* a random cycle through all pages, one entry per page */
+    for (j = 0; j < CHASE_PAGES; j++) {
+        order[j] = j;
+    }
+    for (j = CHASE_PAGES - 1; j > 0; j--) {
+        uint32_t k, tmp;
+
+        seed = seed * 1103515245 + 12345;
+        k = (seed >> 8) % (j + 1);
+        tmp = order[j];
+        order[j] = order[k];
+        order[k] = tmp;
+    }
+    for (j = 0; j < CHASE_PAGES; j++) {
+        chase[order[j] * CHASE_STRIDE] =
+            order[(j + 1) % CHASE_PAGES] * CHASE_STRIDE;
+    }
+
+    pos = order[0] * CHASE_STRIDE;
+    for (i = 0; i < iterations; i++) {
+        pos = chase[pos];
+        acc += pos;
+    }
+
+    free(order);
+    free(chase);
+    return acc;
+}
+
+static uint64_t op_add(uint64_t x) { return x + 3; }
+static uint64_t op_sub(uint64_t x) { return x - 1; }
+static uint64_t op_xor(uint64_t x) { return x ^ 0x5a5a; }
+static uint64_t op_shl(uint64_t x) { return (x << 1) | (x >> 63); }
+static uint64_t op_mul(uint64_t x) { return x * 5; }
+static uint64_t op_not(uint64_t x) { return ~x; }
+static uint64_t op_neg(uint64_t x) { return -x; }
+static uint64_t op_inc(uint64_t x) { return x + 1; }
+
+static uint64_t bench_indirect(uint64_t iterations)
+{
+    static uint64_t (* const ops[])(uint64_t) = {
+        op_add, op_sub, op_xor, op_shl, op_mul, op_not, op_neg, op_inc
+    };
+    uint64_t x = 1, sel = 7, i;
+
+    for (i = 0; i < iterations; i++) {
+        sel = sel * 6364136223846793005ULL + 1442695040888963407ULL;
+        x = ops[sel >> 61](x);
+    }
+    return x;
+}
+
+static bench_kernel kernels[] = {
+    { "int", 1 << 26, bench_int },
+    { "fp", 1 << 24, bench_fp },
+    { "vector", 1 << 26, bench_vector },
+    { "memory", 1 << 24, bench_memory },
+    { "indirect", 1 << 24, bench_indirect },
+};
+
+static uint64_t now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+int main(int argc, char **argv)
+{
+    unsigned int scale = argc > 1 ? atoi(argv[1]) : 1;
+    int i;
+
+    if (scale == 0) {
+        fprintf(stderr, "usage: %s [scale]\n", argv[0]);
+        return 1;
+    }
+
+    printf("{ \"scale\": %u, \"kernels\": [\n", scale);
+    for (i = 0; i < ARRAY_SIZE(kernels); i++) {
+        uint64_t iterations = kernels[i].iterations * scale;
+        uint64_t start, ns, result;
+
+        start = now_ns();
+        result = kernels[i].fn(iterations);
+        ns = now_ns() - start;
+
+        printf("  { \"name\": \"%s\", \"iterations\": %" PRIu64 ", "
+               "\"ns\": %" PRIu64 ", \"mops\": %.2f, "
+               "\"result\": %" PRIu64 " }%s\n",
+               kernels[i].name, iterations, ns,
+               ns ? iterations * 1000.0 / ns : 0.0, result,
+               i + 1 < ARRAY_SIZE(kernels) ? "," : "");
+    }
+    printf("] }\n");
+    return 0;
+}
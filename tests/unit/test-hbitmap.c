@@ -911,6 +911,40 @@ static void test_hbitmap_next_x_4(TestHBitmapData *data, const void *unused)
     test_hbitmap_next_x_do(data, 4);
 }
 
+static void test_hbitmap_merge_in_place(TestHBitmapData *data,
+                                        const void *unused)
+{
+    HBitmap *src = hbitmap_alloc(L3 * 2, 0);
+
+    hbitmap_test_init(data, L3 * 2, 0);
+    hbitmap_test_set(data, L1 - 1, L1 + 2);
+    hbitmap_test_set(data, L3, L2);
+
+    /* A sparse source, partly overlapping with the destination */
+    hbitmap_set(src, 0, 1);
+    hbitmap_set(src, L1, 3);
+    hbitmap_set(src, L2 * 3 + 7, L1 * 2);
+    hbitmap_set(src, L3 + L1, L1);
+    hbitmap_set(src, L3 * 2 - 1, 1);
+
+    g_assert(hbitmap_merge(data->hb, src, data->hb));
+
+    hbitmap_test_set(data, 0, 1);
+    hbitmap_test_set(data, L1, 3);
+    hbitmap_test_set(data, L2 * 3 + 7, L1 * 2);
+    hbitmap_test_set(data, L3 + L1, L1);
+    hbitmap_test_set(data, L3 * 2 - 1, 1);
+    hbitmap_test_check(data, 0);
+
+    /* The other direction must give the same result */
+    g_assert(hbitmap_merge(data->hb, src, src));
+    g_assert_cmpint(hbitmap_count(src), ==, hbitmap_count(data->hb));
+    g_assert_cmpint(hbitmap_next_dirty(src, L3 + L2, INT64_MAX), ==,
+                    L3 * 2 - 1);
+
+    hbitmap_free(src);
+}
+
 static void test_hbitmap_next_x_after_truncate(TestHBitmapData *data,
                                                const void *unused)
 {
@@ -1097,6 +1131,8 @@ int main(int argc, char **argv)
     hbitmap_test_add("/hbitmap/iter/iter_and_reset",
                      test_hbitmap_iter_and_reset);
 
+    hbitmap_test_add("/hbitmap/merge/in_place", test_hbitmap_merge_in_place);
+
     hbitmap_test_add("/hbitmap/next_zero/next_x_0",
                      test_hbitmap_next_x_0);
     hbitmap_test_add("/hbitmap/next_zero/next_x_4",
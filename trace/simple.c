@@ -43,6 +43,8 @@ static GCond trace_empty_cond;
 
 static bool trace_available;
 static bool trace_writeout_enabled;
+/* set once a writer has kicked the writeout thread, until it wakes up */
+static volatile gint trace_kick_pending;
 
 enum {
     TRACE_BUF_LEN = 4096 * 64,
@@ -81,25 +83,26 @@ static unsigned int write_to_buffer(unsigned int idx, void *dataptr, size_t size
 
 static void clear_buffer_range(unsigned int idx, size_t len)
 {
-    uint32_t num = 0;
-    while (num < len) {
-        if (idx >= TRACE_BUF_LEN) {
-            idx = idx % TRACE_BUF_LEN;
-        }
-        trace_buf[idx++] = 0;
-        num++;
-    }
+    size_t first;
+
+    idx %= TRACE_BUF_LEN;
+    first = MIN(len, TRACE_BUF_LEN - idx);
+    memset(&trace_buf[idx], 0, first);
+    memset(trace_buf, 0, len - first);
 }
 /**
  * Read a trace record from the trace buffer
  *
  * @idx         Trace buffer index
- * @record      Trace record to fill
+ * @record      Trace record to fill, only valid until the next call
  *
  * Returns false if the record is not valid.
  */
 static bool get_trace_record(unsigned int idx, TraceRecord **recordptr)
 {
+    /* only used by the writeout thread, reused across records */
+    static TraceRecord *copy;
+    static size_t copy_len;
     uint64_t event_flag = 0;
     TraceRecord record;
     /* read the event flag to see if its a valid record */
@@ -112,7 +115,13 @@ static bool get_trace_record(unsigned int idx, TraceRecord **recordptr)
     smp_rmb(); /* read memory barrier before accessing record */
     /* read the record header to know record length */
     read_from_buffer(idx, &record, sizeof(TraceRecord));
-    *recordptr = malloc(record.length); /* don't use g_malloc, can deadlock when traced */
+    if (record.length > copy_len) {
+        /* don't use g_realloc, can deadlock when traced */
+        free(copy);
+        copy_len = MAX(record.length, 256);
+        copy = malloc(copy_len);
+    }
+    *recordptr = copy;
     /* make a copy of record to avoid being overwritten */
     read_from_buffer(idx, *recordptr, record.length);
     smp_rmb(); /* memory barrier before clearing valid flag */
@@ -151,6 +160,7 @@ static void wait_for_trace_records_available(void)
         g_cond_wait(&trace_available_cond, &trace_lock);
     }
     trace_available = false;
+    g_atomic_int_set(&trace_kick_pending, 0);
     g_mutex_unlock(&trace_lock);
 }
 
@@ -187,7 +197,6 @@ static gpointer writeout_thread(gpointer opaque)
             unused = fwrite(&type, sizeof(type), 1, trace_fp);
             unused = fwrite(recordptr, recordptr->length, 1, trace_fp);
             writeout_idx += recordptr->length;
-            free(recordptr); /* don't use g_free, can deadlock when traced */
             idx = writeout_idx % TRACE_BUF_LEN;
         }
 
@@ -244,26 +253,25 @@ int trace_record_start(TraceBufferRecord *rec, uint32_t event, size_t datasize)
 static void read_from_buffer(unsigned int idx, void *dataptr, size_t size)
 {
     uint8_t *data_ptr = dataptr;
-    uint32_t x = 0;
-    while (x < size) {
-        if (idx >= TRACE_BUF_LEN) {
-            idx = idx % TRACE_BUF_LEN;
-        }
-        data_ptr[x++] = trace_buf[idx++];
-    }
+    size_t first;
+
+    idx %= TRACE_BUF_LEN;
+    first = MIN(size, TRACE_BUF_LEN - idx);
+    memcpy(data_ptr, &trace_buf[idx], first);
+    memcpy(data_ptr + first, trace_buf, size - first);
 }
 
 static unsigned int write_to_buffer(unsigned int idx, void *dataptr, size_t size)
 {
     uint8_t *data_ptr = dataptr;
-    uint32_t x = 0;
-    while (x < size) {
-        if (idx >= TRACE_BUF_LEN) {
-            idx = idx % TRACE_BUF_LEN;
-        }
-        trace_buf[idx++] = data_ptr[x++];
-    }
-    return idx; /* most callers wants to know where to write next */
+    size_t first;
+
+    idx %= TRACE_BUF_LEN;
+    first = MIN(size, TRACE_BUF_LEN - idx);
+    memcpy(&trace_buf[idx], data_ptr, first);
+    memcpy(trace_buf, data_ptr + first, size - first);
+    /* most callers wants to know where to write next */
+    return (idx + size) % TRACE_BUF_LEN;
 }
 
 void trace_record_finish(TraceBufferRecord *rec)
@@ -274,8 +282,13 @@ void trace_record_finish(TraceBufferRecord *rec)
     record.event |= TRACE_RECORD_VALID;
     write_to_buffer(rec->tbuf_idx, &record, sizeof(TraceRecord));
 
+    /*
+     * Only the first writer past the threshold takes trace_lock, the others
+     * would just wake up the writeout thread again.
+     */
     if (((unsigned int)g_atomic_int_get(&trace_idx) - writeout_idx)
-        > TRACE_BUF_FLUSH_THRESHOLD) {
+        > TRACE_BUF_FLUSH_THRESHOLD &&
+        g_atomic_int_compare_and_exchange(&trace_kick_pending, 0, 1)) {
         flush_trace_file(false);
     }
 }
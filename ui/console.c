@@ -204,12 +204,17 @@ static void gui_update(void *opaque)
     DisplayState *ds = opaque;
     DisplayChangeListener *dcl;
     QemuConsole *con;
+    bool need_refresh = false;
 
     ds->refreshing = true;
     dpy_refresh(ds);
     ds->refreshing = false;
 
     QLIST_FOREACH(dcl, &ds->listeners, next) {
+        if (dcl->update_interval == GUI_REFRESH_INTERVAL_NONE) {
+            continue;
+        }
+        need_refresh = true;
         dcl_interval = dcl->update_interval ?
             dcl->update_interval : GUI_REFRESH_INTERVAL_DEFAULT;
         if (interval > dcl_interval) {
@@ -226,7 +231,9 @@ static void gui_update(void *opaque)
         trace_console_refresh(interval);
     }
     ds->last_update = qemu_clock_get_ms(QEMU_CLOCK_REALTIME);
-    timer_mod(ds->gui_timer, ds->last_update + interval);
+    if (need_refresh) {
+        timer_mod(ds->gui_timer, ds->last_update + interval);
+    }
 }
 
 static void gui_setup_refresh(DisplayState *ds)
@@ -251,6 +258,9 @@ static void gui_setup_refresh(DisplayState *ds)
     if (need_timer && ds->gui_timer == NULL) {
         ds->gui_timer = timer_new_ms(QEMU_CLOCK_REALTIME, gui_update, ds);
         timer_mod(ds->gui_timer, qemu_clock_get_ms(QEMU_CLOCK_REALTIME));
+    } else if (need_timer && !timer_pending(ds->gui_timer)) {
+        /* All listeners were idle, give the new one a refresh */
+        timer_mod(ds->gui_timer, qemu_clock_get_ms(QEMU_CLOCK_REALTIME));
     }
     if (!need_timer && ds->gui_timer != NULL) {
         timer_free(ds->gui_timer);
@@ -1557,7 +1567,8 @@ void update_displaychangelistener(DisplayChangeListener *dcl,
     DisplayState *ds = dcl->ds;
 
     dcl->update_interval = interval;
-    if (!ds->refreshing && ds->update_interval > interval) {
+    if (!ds->refreshing && interval != GUI_REFRESH_INTERVAL_NONE &&
+        (ds->update_interval > interval || !timer_pending(ds->gui_timer))) {
         timer_mod(ds->gui_timer, ds->last_update + interval);
     }
 }
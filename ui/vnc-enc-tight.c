@@ -676,12 +676,11 @@ static bool
 check_solid_tile32(VncState *vs, int x, int y, int w, int h,
                    uint32_t *color, bool samecolor)
 {
-    VncDisplay *vd = vs->vd;
     uint32_t *fbptr;
     uint32_t c;
     int dx, dy;
 
-    fbptr = vnc_server_fb_ptr(vd, x, y);
+    fbptr = vnc_server_fb_ptr(vs, x, y);
 
     c = *fbptr;
     if (samecolor && (uint32_t)c != *color) {
@@ -695,7 +694,7 @@ check_solid_tile32(VncState *vs, int x, int y, int w, int h,
             }
         }
         fbptr = (uint32_t *)
-            ((uint8_t *)fbptr + vnc_server_fb_stride(vd));
+            ((uint8_t *)fbptr + vnc_server_fb_stride(vs));
     }
 
     *color = (uint32_t)c;
@@ -1212,7 +1211,7 @@ static int send_jpeg_rect(VncState *vs, int x, int y, int w, int h, int quality)
     buf = (uint8_t *)pixman_image_get_data(linebuf);
     row[0] = buf;
     for (dy = 0; dy < h; dy++) {
-        qemu_pixman_linebuf_fill(linebuf, vs->vd->server, w, x, y + dy);
+        qemu_pixman_linebuf_fill(linebuf, vs->server, w, x, y + dy);
         jpeg_write_scanlines(&cinfo, row, 1);
     }
     qemu_pixman_image_unref(linebuf);
@@ -1358,7 +1357,7 @@ static int send_png_rect(VncState *vs, int x, int y, int w, int h,
         if (color_type == PNG_COLOR_TYPE_PALETTE) {
             memcpy(buf, vs->tight->tight.buffer + (dy * w), w);
         } else {
-            qemu_pixman_linebuf_fill(linebuf, vs->vd->server, w, x, y + dy);
+            qemu_pixman_linebuf_fill(linebuf, vs->server, w, x, y + dy);
         }
         png_write_row(png_ptr, buf);
     }
@@ -45,28 +45,33 @@
  * - VncState::output lock: used to make sure the output buffer is not corrupted
  *                          if two threads try to write on it at the same time
  *
- * While the VNC worker thread is working, the VncDisplay global lock is held
- * to avoid screen corruption (this does not block vnc_refresh() because it
- * uses trylock()) but the output lock is not held because the thread works on
- * its own output buffer.
+ * The VNC worker thread holds the VncDisplay global lock only while it
+ * copies the rectangles of a job out of the server framebuffer (this does
+ * not block vnc_refresh() because it uses trylock()), and then encodes
+ * from its private copy.  The output lock is not held while encoding
+ * because the thread works on its own output buffer.
  * When the encoding job is done, the worker thread will hold the output lock
  * and copy its output buffer in vs->output.
+ *
+ * Several worker threads serve the queue.  The encoders keep compression
+ * streams in VncState, so the jobs of one client are encoded one at a time
+ * and in order; jobs of different clients are encoded in parallel, even
+ * when they share a display.
  */
 
+#define VNC_WORKER_THREADS 4
+
 struct VncJobQueue {
     QemuCond cond;
     QemuMutex mutex;
-    QemuThread thread;
+    int nr_threads;
     bool exit;
     QTAILQ_HEAD(, VncJob) jobs;
 };
 
 typedef struct VncJobQueue VncJobQueue;
 
-/*
- * We use a single global queue, but most of the functions are
- * already reentrant, so we can easily add more than one encoding thread
- */
+/* We use a single global queue */
 static VncJobQueue *queue;
 
 static void vnc_lock_queue(VncJobQueue *queue)
@@ -235,26 +240,51 @@ static bool vnc_worker_clamp_rect(VncState *vs, VncJob *job, VncRect *rect)
     return false;
 }
 
+/*
+ * Return the oldest job that can be encoded now: one that is not being
+ * encoded, and whose client has no older job in the queue.
+ */
+static VncJob *vnc_next_job_locked(VncJobQueue *queue)
+{
+    VncJob *job, *prev;
+
+    QTAILQ_FOREACH(job, &queue->jobs, next) {
+        if (job->busy) {
+            continue;
+        }
+        for (prev = QTAILQ_PREV(job, next); prev;
+             prev = QTAILQ_PREV(prev, next)) {
+            if (prev->vs == job->vs) {
+                break;
+            }
+        }
+        if (!prev) {
+            return job;
+        }
+    }
+    return NULL;
+}
+
 static int vnc_worker_thread_loop(VncJobQueue *queue)
 {
     VncJob *job;
     VncRectEntry *entry, *tmp;
     VncState vs = {};
+    pixman_image_t *server;
     int n_rectangles;
     int saved_offset;
 
     vnc_lock_queue(queue);
-    while (QTAILQ_EMPTY(&queue->jobs) && !queue->exit) {
+    while (!queue->exit && !(job = vnc_next_job_locked(queue))) {
         qemu_cond_wait(&queue->cond, &queue->mutex);
     }
-    /* Here job can only be NULL if queue->exit is true */
-    job = QTAILQ_FIRST(&queue->jobs);
-    vnc_unlock_queue(queue);
-    assert(job->vs->magic == VNC_MAGIC);
-
     if (queue->exit) {
+        vnc_unlock_queue(queue);
         return -1;
     }
+    job->busy = true;
+    vnc_unlock_queue(queue);
+    assert(job->vs->magic == VNC_MAGIC);
 
     vnc_lock_output(job->vs);
     if (job->vs->ioc == NULL || job->vs->abort == true) {
@@ -282,29 +312,45 @@ static int vnc_worker_thread_loop(VncJobQueue *queue)
     saved_offset = vs.output.offset;
     vnc_write_u16(&vs, 0);
 
+    /* Copy the rectangles out of the framebuffer, then encode the copy */
     vnc_lock_display(job->vs->vd);
+    server = job->vs->vd->server;
+    vs.server = pixman_image_create_bits(VNC_SERVER_FB_FORMAT,
+                                         pixman_image_get_width(server),
+                                         pixman_image_get_height(server),
+                                         NULL, 0);
+    QLIST_FOREACH_SAFE(entry, &job->rectangles, next, tmp) {
+        if (vnc_worker_clamp_rect(&vs, job, &entry->rect)) {
+            pixman_image_composite(PIXMAN_OP_SRC, server, NULL, vs.server,
+                                   entry->rect.x, entry->rect.y, 0, 0,
+                                   entry->rect.x, entry->rect.y,
+                                   entry->rect.w, entry->rect.h);
+        } else {
+            QLIST_REMOVE(entry, next);
+            g_free(entry);
+        }
+    }
+    vnc_unlock_display(job->vs->vd);
+
     QLIST_FOREACH_SAFE(entry, &job->rectangles, next, tmp) {
         int n;
 
         if (job->vs->ioc == NULL) {
-            vnc_unlock_display(job->vs->vd);
+            qemu_pixman_image_unref(vs.server);
             /* Copy persistent encoding data */
             vnc_async_encoding_end(job->vs, &vs);
             goto disconnected;
         }
 
-        if (vnc_worker_clamp_rect(&vs, job, &entry->rect)) {
-            n = vnc_send_framebuffer_update(&vs, entry->rect.x, entry->rect.y,
-                                            entry->rect.w, entry->rect.h);
-
-            if (n >= 0) {
-                n_rectangles += n;
-            }
+        n = vnc_send_framebuffer_update(&vs, entry->rect.x, entry->rect.y,
+                                        entry->rect.w, entry->rect.h);
+        if (n >= 0) {
+            n_rectangles += n;
         }
         g_free(entry);
     }
     trace_vnc_job_nrects(&vs, job, n_rectangles);
-    vnc_unlock_display(job->vs->vd);
+    qemu_pixman_image_unref(vs.server);
 
     /* Put n_rectangles at the beginning of the message */
     vs.output.buffer[saved_offset] = (n_rectangles >> 8) & 0xFF;
@@ -355,11 +401,16 @@ static void vnc_queue_clear(VncJobQueue *q)
 static void *vnc_worker_thread(void *arg)
 {
     VncJobQueue *queue = arg;
-
-    qemu_thread_get_self(&queue->thread);
+    bool last;
 
     while (!vnc_worker_thread_loop(queue)) ;
-    vnc_queue_clear(queue);
+
+    vnc_lock_queue(queue);
+    last = --queue->nr_threads == 0;
+    vnc_unlock_queue(queue);
+    if (last) {
+        vnc_queue_clear(queue);
+    }
     return NULL;
 }
 
@@ -371,12 +422,17 @@ static bool vnc_worker_thread_running(void)
 void vnc_start_worker_thread(void)
 {
     VncJobQueue *q;
+    QemuThread thread;
+    int i;
 
     if (vnc_worker_thread_running())
         return ;
 
     q = vnc_queue_init();
-    qemu_thread_create(&q->thread, "vnc_worker", vnc_worker_thread, q,
-                       QEMU_THREAD_DETACHED);
+    q->nr_threads = VNC_WORKER_THREADS;
+    for (i = 0; i < VNC_WORKER_THREADS; i++) {
+        qemu_thread_create(&thread, "vnc_worker", vnc_worker_thread, q,
+                           QEMU_THREAD_DETACHED);
+    }
     queue = q; /* Set global queue */
 }
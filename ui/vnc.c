@@ -781,17 +781,17 @@ static void vnc_abort_display_jobs(VncDisplay *vd)
     }
 }
 
-int vnc_server_fb_stride(VncDisplay *vd)
+int vnc_server_fb_stride(VncState *vs)
 {
-    return pixman_image_get_stride(vd->server);
+    return pixman_image_get_stride(vs->server);
 }
 
-void *vnc_server_fb_ptr(VncDisplay *vd, int x, int y)
+void *vnc_server_fb_ptr(VncState *vs, int x, int y)
 {
     uint8_t *ptr;
 
-    ptr  = (uint8_t *)pixman_image_get_data(vd->server);
-    ptr += y * vnc_server_fb_stride(vd);
+    ptr  = (uint8_t *)pixman_image_get_data(vs->server);
+    ptr += y * vnc_server_fb_stride(vs);
     ptr += x * VNC_SERVER_FB_BYTES;
     return ptr;
 }
@@ -948,12 +948,11 @@ int vnc_raw_send_framebuffer_update(VncState *vs, int x, int y, int w, int h)
 {
     int i;
     uint8_t *row;
-    VncDisplay *vd = vs->vd;
 
-    row = vnc_server_fb_ptr(vd, x, y);
+    row = vnc_server_fb_ptr(vs, x, y);
     for (i = 0; i < h; i++) {
         vs->write_pixels(vs, row, w * VNC_SERVER_FB_BYTES);
-        row += vnc_server_fb_stride(vd);
+        row += vnc_server_fb_stride(vs);
     }
     return 1;
 }
@@ -3130,8 +3129,8 @@ static int vnc_refresh_server_surface(VncDisplay *vd)
     line_bytes = MIN(server_stride, guest_ll);
 
     for (;;) {
-        int x;
-        uint8_t *guest_ptr, *server_ptr;
+        int x, x_start, x_end = DIV_ROUND_UP(width, VNC_DIRTY_PIXELS_PER_BIT);
+        uint8_t *guest_line, *server_line;
         unsigned long offset = find_next_bit((unsigned long *) &vd->guest.dirty,
                                              height * VNC_DIRTY_BPL(&vd->guest),
                                              y * VNC_DIRTY_BPL(&vd->guest));
@@ -3140,24 +3139,33 @@ static int vnc_refresh_server_surface(VncDisplay *vd)
             break;
         }
         y = offset / VNC_DIRTY_BPL(&vd->guest);
-        x = offset % VNC_DIRTY_BPL(&vd->guest);
+        x_start = offset % VNC_DIRTY_BPL(&vd->guest);
 
-        server_ptr = server_row0 + y * server_stride + x * cmp_bytes;
+        /* guest_line and server_line point to the chunk at x_start */
+        server_line = server_row0 + y * server_stride + x_start * cmp_bytes;
 
         if (vd->guest.format != VNC_SERVER_FB_FORMAT) {
-            qemu_pixman_linebuf_fill(tmpbuf, vd->guest.fb, width, 0, y);
-            guest_ptr = (uint8_t *)pixman_image_get_data(tmpbuf);
+            /* Only convert the part of the line that has dirty chunks */
+            int last = find_last_bit(vd->guest.dirty[y], x_end);
+            int x0 = x_start * VNC_DIRTY_PIXELS_PER_BIT;
+            int x1 = MIN(width, (last + 1) * VNC_DIRTY_PIXELS_PER_BIT);
+
+            if (x1 > x0) {
+                qemu_pixman_linebuf_fill(tmpbuf, vd->guest.fb, x1 - x0, x0, y);
+            }
+            guest_line = (uint8_t *)pixman_image_get_data(tmpbuf);
         } else {
-            guest_ptr = guest_row0 + y * guest_stride;
+            guest_line = guest_row0 + y * guest_stride + x_start * cmp_bytes;
         }
-        guest_ptr += x * cmp_bytes;
 
-        for (; x < DIV_ROUND_UP(width, VNC_DIRTY_PIXELS_PER_BIT);
-             x++, guest_ptr += cmp_bytes, server_ptr += cmp_bytes) {
+        for (x = find_next_bit(vd->guest.dirty[y], x_end, x_start);
+             x < x_end;
+             x = find_next_bit(vd->guest.dirty[y], x_end, x + 1)) {
+            uint8_t *guest_ptr = guest_line + (x - x_start) * cmp_bytes;
+            uint8_t *server_ptr = server_line + (x - x_start) * cmp_bytes;
             int _cmp_bytes = cmp_bytes;
-            if (!test_and_clear_bit(x, vd->guest.dirty[y])) {
-                continue;
-            }
+
+            clear_bit(x, vd->guest.dirty[y]);
             if ((x + 1) * cmp_bytes > line_bytes) {
                 _cmp_bytes = line_bytes - x * cmp_bytes;
             }
@@ -3189,7 +3197,8 @@ static void vnc_refresh(DisplayChangeListener *dcl)
     int has_dirty, rects = 0;
 
     if (QTAILQ_EMPTY(&vd->clients)) {
-        update_displaychangelistener(&vd->dcl, VNC_REFRESH_INTERVAL_MAX);
+        /* vnc_connect() restarts the refresh */
+        update_displaychangelistener(&vd->dcl, GUI_REFRESH_INTERVAL_NONE);
         return;
     }
 
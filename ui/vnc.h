@@ -250,6 +250,7 @@ struct VncRectEntry
 struct VncJob
 {
     VncState *vs;
+    bool busy;          /* Being encoded by a worker thread */
 
     QLIST_HEAD(, VncRectEntry) rectangles;
     QTAILQ_ENTRY(VncJob) next;
@@ -276,6 +277,7 @@ struct VncState
                            * vnc-jobs-async.c */
 
     VncDisplay *vd;
+    pixman_image_t *server; /* Copy of vd->server the job thread encodes */
     VncStateUpdate update; /* Most recent pending request from client */
     VncStateUpdate job_update; /* Currently processed by job thread */
     int has_dirty;
@@ -607,8 +609,8 @@ void vnc_framebuffer_update(VncState *vs, int x, int y, int w, int h,
 #define VNC_SERVER_FB_BITS   (PIXMAN_FORMAT_BPP(VNC_SERVER_FB_FORMAT))
 #define VNC_SERVER_FB_BYTES  ((VNC_SERVER_FB_BITS+7)/8)
 
-void *vnc_server_fb_ptr(VncDisplay *vd, int x, int y);
-int vnc_server_fb_stride(VncDisplay *vd);
+void *vnc_server_fb_ptr(VncState *vs, int x, int y);
+int vnc_server_fb_stride(VncState *vs);
 
 void vnc_convert_pixel(VncState *vs, uint8_t *buf, uint32_t v);
 double vnc_update_freq(VncState *vs, int x, int y, int w, int h);
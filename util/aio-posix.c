@@ -534,8 +534,10 @@ static bool try_poll_mode(AioContext *ctx, int64_t *timeout)
         poll_set_started(ctx, true);
 
         if (run_poll_handlers(ctx, max_ns, timeout)) {
+            stat64_add(&ctx->poll_hits, 1);
             return true;
         }
+        stat64_add(&ctx->poll_misses, 1);
     }
 
     if (poll_set_started(ctx, false)) {
@@ -229,42 +229,51 @@ buffer_zero_avx512(const void *buf, size_t len)
 #if defined(CONFIG_AVX512F_OPT) || defined(CONFIG_AVX2_OPT)
 # define INIT_CACHE 0
 # define INIT_ACCEL buffer_zero_int
+# define INIT_ACCEL_NAME "int"
 #else
 # ifndef __SSE2__
 #  error "ISA selection confusion"
 # endif
 # define INIT_CACHE CACHE_SSE2
 # define INIT_ACCEL buffer_zero_sse2
+# define INIT_ACCEL_NAME "sse2"
 #endif
 
 static unsigned cpuid_cache = INIT_CACHE;
 static bool (*buffer_accel)(const void *, size_t) = INIT_ACCEL;
+static const char *buffer_accel_name = INIT_ACCEL_NAME;
 static int length_to_accel = 64;
 
 static void init_accel(unsigned cache)
 {
     bool (*fn)(const void *, size_t) = buffer_zero_int;
+    const char *name = "int";
     if (cache & CACHE_SSE2) {
         fn = buffer_zero_sse2;
+        name = "sse2";
         length_to_accel = 64;
     }
 #ifdef CONFIG_AVX2_OPT
     if (cache & CACHE_SSE4) {
         fn = buffer_zero_sse4;
+        name = "sse4";
         length_to_accel = 64;
     }
     if (cache & CACHE_AVX2) {
         fn = buffer_zero_avx2;
+        name = "avx2";
         length_to_accel = 128;
     }
 #endif
 #ifdef CONFIG_AVX512F_OPT
     if (cache & CACHE_AVX512F) {
         fn = buffer_zero_avx512;
+        name = "avx512f";
         length_to_accel = 256;
     }
 #endif
     buffer_accel = fn;
+    buffer_accel_name = name;
 }
 
 #if defined(CONFIG_AVX512F_OPT) || defined(CONFIG_AVX2_OPT)
@@ -321,6 +330,11 @@ bool test_buffer_is_zero_next_accel(void)
     return true;
 }
 
+const char *test_buffer_is_zero_accel_name(void)
+{
+    return buffer_accel_name;
+}
+
 static bool select_accel_fn(const void *buf, size_t len)
 {
     if (likely(len >= length_to_accel)) {
@@ -335,6 +349,11 @@ bool test_buffer_is_zero_next_accel(void)
 {
     return false;
 }
+
+const char *test_buffer_is_zero_accel_name(void)
+{
+    return "int";
+}
 #endif
 
 /*
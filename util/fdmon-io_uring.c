@@ -182,17 +182,21 @@ static void add_poll_remove_sqe(AioContext *ctx, AioHandler *node)
     io_uring_prep_poll_remove(sqe, node);
 }
 
-/* Add a timeout that self-cancels when another cqe becomes ready */
-static void add_timeout_sqe(AioContext *ctx, int64_t ns)
+/*
+ * Add a timeout that self-cancels when another cqe becomes ready.  The
+ * kernel reads @ts when the sqe is submitted, so it must stay valid until
+ * then.
+ */
+static void add_timeout_sqe(AioContext *ctx, struct __kernel_timespec *ts,
+                            int64_t ns)
 {
     struct io_uring_sqe *sqe;
-    struct __kernel_timespec ts = {
-        .tv_sec = ns / NANOSECONDS_PER_SECOND,
-        .tv_nsec = ns % NANOSECONDS_PER_SECOND,
-    };
+
+    ts->tv_sec = ns / NANOSECONDS_PER_SECOND;
+    ts->tv_nsec = ns % NANOSECONDS_PER_SECOND;
 
     sqe = get_sqe(ctx);
-    io_uring_prep_timeout(sqe, &ts, 1, 0);
+    io_uring_prep_timeout(sqe, ts, 1, 0);
 }
 
 /* Add sqes from ctx->submit_list for submission */
@@ -241,7 +245,12 @@ static bool process_cqe(AioContext *ctx,
 
     aio_add_ready_handler(ready_list, node, pfd_events_from_poll(cqe->res));
 
-    /* IORING_OP_POLL_ADD is one-shot so we must re-arm it */
+    /*
+     * IORING_OP_POLL_ADD is one-shot so we must re-arm it.  Don't use
+     * multishot polls: they only post a cqe when the fd becomes ready
+     * again, so a handler that stops early, like tap_send() once it has
+     * read its budget of packets, would never be called for the rest.
+     */
     add_poll_add_sqe(ctx, node);
     return true;
 }
@@ -270,6 +279,7 @@ static int fdmon_io_uring_wait(AioContext *ctx, AioHandlerList *ready_list,
                                int64_t timeout)
 {
     unsigned wait_nr = 1; /* block until at least one cqe is ready */
+    struct __kernel_timespec ts;
     int ret;
 
     /* Fall back while external clients are disabled */
@@ -280,7 +290,7 @@ static int fdmon_io_uring_wait(AioContext *ctx, AioHandlerList *ready_list,
     if (timeout == 0) {
         wait_nr = 0; /* non-blocking */
     } else if (timeout > 0) {
-        add_timeout_sqe(ctx, timeout);
+        add_timeout_sqe(ctx, &ts, timeout);
     }
 
     fill_sq_ring(ctx);
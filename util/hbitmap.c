@@ -245,9 +245,19 @@ int64_t hbitmap_next_zero(const HBitmap *hb, int64_t start, int64_t count)
     assert((start >> hb->granularity) < hb->size);
 
     if (cur == (unsigned long)-1) {
-        do {
+        pos++;
+        /*
+         * Dense bitmaps have long runs of set words; check several of them
+         * at once, which the compiler can turn into vector operations.
+         */
+        while (pos + 4 <= sz &&
+               (last_lev[pos] & last_lev[pos + 1] &
+                last_lev[pos + 2] & last_lev[pos + 3]) == (unsigned long)-1) {
+            pos += 4;
+        }
+        while (pos < sz && last_lev[pos] == (unsigned long)-1) {
             pos++;
-        } while (pos < sz && last_lev[pos] == (unsigned long)-1);
+        }
 
         if (pos >= sz) {
             return -1;
@@ -554,9 +564,15 @@ void hbitmap_reset_all(HBitmap *hb)
 {
     unsigned int i;
 
-    /* Same as hbitmap_alloc() except for memset() instead of malloc() */
+    /*
+     * Same as hbitmap_alloc().  Allocate the levels again instead of
+     * clearing them: large allocations are backed by anonymous memory that
+     * the kernel only populates when it is written to, so this gives the
+     * memory of a big bitmap back instead of touching every page of it.
+     */
     for (i = HBITMAP_LEVELS; --i >= 1; ) {
-        memset(hb->levels[i], 0, hb->sizes[i] * sizeof(unsigned long));
+        g_free(hb->levels[i]);
+        hb->levels[i] = g_new0(unsigned long, hb->sizes[i]);
     }
 
     hb->levels[0][0] = 1UL << (BITS_PER_LONG - 1);
@@ -864,6 +880,37 @@ static void hbitmap_sparse_merge(HBitmap *dst, const HBitmap *src)
     }
 }
 
+/*
+ * OR @src into @dst, which have the same size and granularity.  Only the
+ * words of @dst's last level that @src has bits in are written, so merging
+ * a sparse bitmap costs time proportional to its set words plus a scan of
+ * the (BITS_PER_LONG times smaller) upper levels, and leaves the untouched
+ * parts of @dst unpopulated.
+ */
+static void hbitmap_merge_into(HBitmap *dst, const HBitmap *src)
+{
+    HBitmapIter hbi;
+    unsigned long cur;
+    size_t pos;
+    uint64_t j;
+    int i;
+
+    for (i = HBITMAP_LEVELS - 2; i >= 0; i--) {
+        for (j = 0; j < src->sizes[i]; j++) {
+            if (src->levels[i][j] & ~dst->levels[i][j]) {
+                dst->levels[i][j] |= src->levels[i][j];
+            }
+        }
+    }
+
+    hbitmap_iter_init(&hbi, src, 0);
+    while ((pos = hbitmap_iter_next_word(&hbi, &cur)) != (size_t)-1) {
+        dst->levels[HBITMAP_LEVELS - 1][pos] |= cur;
+    }
+
+    dst->count = hb_count_between(dst, 0, dst->size - 1);
+}
+
 /**
  * Given HBitmaps A and B, let R := A (BITOR) B.
  * Bitmaps A and B will not be modified,
@@ -905,11 +952,16 @@ bool hbitmap_merge(const HBitmap *a, const HBitmap *b, HBitmap *result)
         return true;
     }
 
+    assert(a->size == b->size);
+    if (result == a || result == b) {
+        hbitmap_merge_into(result, result == a ? b : a);
+        return true;
+    }
+
     /* This merge is O(size), as BITS_PER_LONG and HBITMAP_LEVELS are constant.
      * It may be possible to improve running times for sparsely populated maps
      * by using hbitmap_iter_next, but this is suboptimal for dense maps.
      */
-    assert(a->size == b->size);
     for (i = HBITMAP_LEVELS - 1; i >= 0; i--) {
         for (j = 0; j < a->sizes[i]; j++) {
             result->levels[i][j] = a->levels[i][j] | b->levels[i][j];
@@ -22,8 +22,9 @@
  * - Writes (i.e. insertions/removals) can be concurrent with writes to
  *   different buckets; writes to the same bucket are serialized through a lock.
  * - Optional auto-resizing: the hash table resizes up if the load surpasses
- *   a certain threshold. Resizing is done concurrently with readers; writes
- *   are serialized with the resize operation.
+ *   a certain threshold. Resizing is done concurrently with readers and, for
+ *   automatic resizes, with writers too; writes are only serialized with the
+ *   migration of the bucket they belong to.
  *
  * The key structure is the bucket, which is cacheline-sized. Buckets
  * contain a few hash values and pointers; the u32 hash values are stored in
@@ -48,6 +49,17 @@
  * ht->map pointer is set, and the old map is freed once no RCU readers can see
  * it anymore.
  *
+ * Automatic resizes, which double the number of buckets, avoid stopping all
+ * writers while the entries are copied.  Each old head bucket is locked in
+ * turn and its entries copied to the two new head buckets it splits into.
+ * Writers to an old bucket that has already been copied apply their change
+ * to the new map as well; they hold the old bucket's lock, which protects
+ * the two new buckets too.  Readers keep using the old map, which stays
+ * complete until the end.  Only the final switch of ht->map takes all the
+ * old bucket locks, without copying anything.  Operations that need the
+ * whole table (iterators, resets and the other resizes) take ht->lock and
+ * are therefore serialized with all resizes.
+ *
  * Writers check for concurrent resizes by comparing ht->map before and after
  * acquiring their bucket lock. If they don't match, a resize has occurred
  * while the bucket spinlock was being acquired.
@@ -159,6 +171,10 @@ QEMU_BUILD_BUG_ON(sizeof(struct qht_bucket) > QHT_BUCKET_ALIGN);
  * @n_added_buckets: number of added (i.e. "non-head") buckets
  * @n_added_buckets_threshold: threshold to trigger an upward resize once the
  *                             number of added buckets surpasses it.
+ * @resize_to: the map that an incremental resize is copying the entries to.
+ * @n_migrated: number of head buckets, starting from the first one, whose
+ *              entries have been copied to @resize_to. Only changes with the
+ *              lock of the affected bucket held.
  *
  * Buckets are tracked in what we call a "map", i.e. this structure.
  */
@@ -168,6 +184,8 @@ struct qht_map {
     size_t n_buckets;
     size_t n_added_buckets;
     size_t n_added_buckets_threshold;
+    struct qht_map *resize_to;
+    size_t n_migrated;
 };
 
 /* trigger a resize when n_added_buckets > n_buckets / div */
@@ -274,35 +292,6 @@ static inline bool qht_map_is_stale__locked(const struct qht *ht,
     return map != ht->map;
 }
 
-/*
- * Grab all bucket locks, and set @pmap after making sure the map isn't stale.
- *
- * Pairs with qht_map_unlock_buckets(), hence the pass-by-reference.
- *
- * Note: callers cannot have ht->lock held.
- */
-static inline
-void qht_map_lock_buckets__no_stale(struct qht *ht, struct qht_map **pmap)
-{
-    struct qht_map *map;
-
-    map = qatomic_rcu_read(&ht->map);
-    qht_map_lock_buckets(map);
-    if (likely(!qht_map_is_stale__locked(ht, map))) {
-        *pmap = map;
-        return;
-    }
-    qht_map_unlock_buckets(map);
-
-    /* we raced with a resize; acquire ht->lock to see the updated ht->map */
-    qht_lock(ht);
-    map = ht->map;
-    qht_map_lock_buckets(map);
-    qht_unlock(ht);
-    *pmap = map;
-    return;
-}
-
 /*
  * Get a head bucket and lock it, making sure its parent map is not stale.
  * @pmap is filled with a pointer to the bucket's parent map.
@@ -338,6 +327,22 @@ struct qht_bucket *qht_bucket_lock__no_stale(struct qht *ht, uint32_t hash,
     return b;
 }
 
+/*
+ * Call with @head->lock held, @head being a head bucket of @map.
+ *
+ * Returns the head bucket of the map being resized to that must see the same
+ * changes as @head, or NULL if @head has not been copied yet.
+ */
+static inline struct qht_bucket *
+qht_map_resize_bucket__locked(const struct qht_map *map,
+                              const struct qht_bucket *head, uint32_t hash)
+{
+    if (likely(head - map->buckets >= qatomic_read(&map->n_migrated))) {
+        return NULL;
+    }
+    return qht_map_to_bucket(map->resize_to, hash);
+}
+
 static inline bool qht_map_needs_resize(const struct qht_map *map)
 {
     return qatomic_read(&map->n_added_buckets) >
@@ -378,6 +383,8 @@ static struct qht_map *qht_map_create(size_t n_buckets)
     map->n_buckets = n_buckets;
 
     map->n_added_buckets = 0;
+    map->resize_to = NULL;
+    map->n_migrated = 0;
     map->n_added_buckets_threshold = n_buckets /
         QHT_NR_ADDED_BUCKETS_THRESHOLD_DIV;
 
@@ -450,9 +457,13 @@ void qht_reset(struct qht *ht)
 {
     struct qht_map *map;
 
-    qht_map_lock_buckets__no_stale(ht, &map);
+    /* ht->lock keeps an incremental resize from running concurrently */
+    qht_lock(ht);
+    map = ht->map;
+    qht_map_lock_buckets(map);
     qht_map_reset__all_locked(map);
     qht_map_unlock_buckets(map);
+    qht_unlock(ht);
 }
 
 static inline void qht_do_resize(struct qht *ht, struct qht_map *new)
@@ -603,6 +614,8 @@ static void *qht_insert__locked(const struct qht *ht, struct qht_map *map,
     return NULL;
 }
 
+static void qht_do_grow(struct qht *ht, struct qht_map *new);
+
 static __attribute__((noinline)) void qht_grow_maybe(struct qht *ht)
 {
     struct qht_map *map;
@@ -619,14 +632,14 @@ static __attribute__((noinline)) void qht_grow_maybe(struct qht *ht)
     if (qht_map_needs_resize(map)) {
         struct qht_map *new = qht_map_create(map->n_buckets * 2);
 
-        qht_do_resize(ht, new);
+        qht_do_grow(ht, new);
     }
     qht_unlock(ht);
 }
 
 bool qht_insert(struct qht *ht, void *p, uint32_t hash, void **existing)
 {
-    struct qht_bucket *b;
+    struct qht_bucket *b, *resize_b;
     struct qht_map *map;
     bool needs_resize = false;
     void *prev;
@@ -637,6 +650,10 @@ bool qht_insert(struct qht *ht, void *p, uint32_t hash, void **existing)
     b = qht_bucket_lock__no_stale(ht, hash, &map);
     prev = qht_insert__locked(ht, map, b, p, hash, &needs_resize);
     qht_bucket_debug__locked(b);
+    resize_b = qht_map_resize_bucket__locked(map, b, hash);
+    if (unlikely(resize_b) && prev == NULL) {
+        qht_insert__locked(ht, map->resize_to, resize_b, p, hash, NULL);
+    }
     qemu_spin_unlock(&b->lock);
 
     if (unlikely(needs_resize) && ht->mode & QHT_MODE_AUTO_RESIZE) {
@@ -738,7 +755,7 @@ bool qht_remove__locked(struct qht_bucket *head, const void *p, uint32_t hash)
 
 bool qht_remove(struct qht *ht, const void *p, uint32_t hash)
 {
-    struct qht_bucket *b;
+    struct qht_bucket *b, *resize_b;
     struct qht_map *map;
     bool ret;
 
@@ -748,6 +765,10 @@ bool qht_remove(struct qht *ht, const void *p, uint32_t hash)
     b = qht_bucket_lock__no_stale(ht, hash, &map);
     ret = qht_remove__locked(b, p, hash);
     qht_bucket_debug__locked(b);
+    resize_b = qht_map_resize_bucket__locked(map, b, hash);
+    if (unlikely(resize_b) && ret) {
+        qht_remove__locked(resize_b, p, hash);
+    }
     qemu_spin_unlock(&b->lock);
     return ret;
 }
@@ -804,10 +825,13 @@ do_qht_iter(struct qht *ht, const struct qht_iter *iter, void *userp)
 {
     struct qht_map *map;
 
-    map = qatomic_rcu_read(&ht->map);
+    /* ht->lock keeps an incremental resize from running concurrently */
+    qht_lock(ht);
+    map = ht->map;
     qht_map_lock_buckets(map);
     qht_map_iter__all_locked(map, iter, userp);
     qht_map_unlock_buckets(map);
+    qht_unlock(ht);
 }
 
 void qht_iter(struct qht *ht, qht_iter_func_t func, void *userp)
@@ -882,6 +906,52 @@ static void qht_do_resize_reset(struct qht *ht, struct qht_map *new, bool reset)
     call_rcu(old, qht_map_destroy, rcu);
 }
 
+/*
+ * Incrementally grow the table into @new, which must have twice as many
+ * buckets as the current map.  Writers only wait for the bucket being copied.
+ * Call with ht->lock held.
+ */
+static void qht_do_grow(struct qht *ht, struct qht_map *new)
+{
+    struct qht_map *old = ht->map;
+    const struct qht_iter iter = {
+        .f.retvoid = qht_map_copy,
+        .type = QHT_ITER_VOID,
+    };
+    struct qht_map_copy_data data = {
+        .ht = ht,
+        .new = new,
+    };
+    size_t i;
+
+    g_assert(new->n_buckets == old->n_buckets * 2);
+    /*
+     * Writers only look at resize_to once they see n_migrated go past their
+     * bucket, which is done with the bucket lock held below.
+     */
+    old->resize_to = new;
+
+    for (i = 0; i < old->n_buckets; i++) {
+        struct qht_bucket *head = &old->buckets[i];
+
+        /*
+         * The new buckets that the entries of @head go to only get entries
+         * from @head, so @head->lock protects them as well.
+         */
+        qemu_spin_lock(&head->lock);
+        qht_bucket_iter(head, &iter, &data);
+        qatomic_set(&old->n_migrated, i + 1);
+        qemu_spin_unlock(&head->lock);
+    }
+
+    /* wait until no writer is updating both maps, then switch readers */
+    qht_map_lock_buckets(old);
+    qht_map_debug__all_locked(new);
+    qatomic_rcu_set(&ht->map, new);
+    qht_map_unlock_buckets(old);
+    call_rcu(old, qht_map_destroy, rcu);
+}
+
 bool qht_resize(struct qht *ht, size_t n_elems)
 {
     size_t n_buckets = qht_elems_to_buckets(n_elems);
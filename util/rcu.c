@@ -49,6 +49,13 @@ QemuEvent rcu_gp_event;
 static QemuMutex rcu_registry_lock;
 static QemuMutex rcu_sync_lock;
 
+/*
+ * Grace period sequence number, written under rcu_sync_lock.  It is odd
+ * while synchronize_rcu() is waiting for readers, and goes up by two for
+ * every completed grace period.
+ */
+static unsigned long rcu_gp_seq;
+
 /*
  * Check whether a quiescent state was crossed between the beginning of
  * update_counter_and_wait and now.
@@ -140,16 +147,9 @@ static void wait_for_readers(void)
     QLIST_SWAP(&registry, &qsreaders, node);
 }
 
-void synchronize_rcu(void)
+/* Runs with rcu_registry_lock taken.  */
+static void synchronize_rcu_locked(void)
 {
-    QEMU_LOCK_GUARD(&rcu_sync_lock);
-
-    /* Write RCU-protected pointers before reading p_rcu_reader->ctr.
-     * Pairs with smp_mb_placeholder() in rcu_read_lock().
-     */
-    smp_mb_global();
-
-    QEMU_LOCK_GUARD(&rcu_registry_lock);
     if (!QLIST_EMPTY(&registry)) {
         /* In either case, the qatomic_mb_set below blocks stores that free
          * old RCU-protected pointers.
@@ -172,6 +172,61 @@ void synchronize_rcu(void)
     }
 }
 
+unsigned long get_state_synchronize_rcu(void)
+{
+    /* Order the caller's updates before the read of rcu_gp_seq; a grace
+     * period that starts after this point will see them.
+     */
+    smp_mb();
+
+    /* The end of the next grace period that starts after now.  */
+    return (qatomic_read(&rcu_gp_seq) + 3) & ~1UL;
+}
+
+bool poll_state_synchronize_rcu(unsigned long cookie)
+{
+    bool done = (long)(qatomic_read(&rcu_gp_seq) - cookie) >= 0;
+
+    /* Order the read of rcu_gp_seq before the caller's reclamation.  */
+    smp_mb();
+    return done;
+}
+
+void cond_synchronize_rcu(unsigned long cookie)
+{
+    if (!poll_state_synchronize_rcu(cookie)) {
+        synchronize_rcu();
+    }
+}
+
+void synchronize_rcu(void)
+{
+    unsigned long cookie = get_state_synchronize_rcu();
+
+    QEMU_LOCK_GUARD(&rcu_sync_lock);
+
+    /* If another thread ran a whole grace period while we were waiting
+     * for the lock, it covers our updates too.
+     */
+    if (poll_state_synchronize_rcu(cookie)) {
+        return;
+    }
+    qatomic_set(&rcu_gp_seq, rcu_gp_seq + 1);
+
+    /* Write RCU-protected pointers and rcu_gp_seq before reading
+     * p_rcu_reader->ctr.  Pairs with smp_mb_placeholder() in
+     * rcu_read_lock().
+     */
+    smp_mb_global();
+
+    WITH_QEMU_LOCK_GUARD(&rcu_registry_lock) {
+        synchronize_rcu_locked();
+    }
+
+    /* Readers are done with the old pointers before we advertise it.  */
+    qatomic_store_release(&rcu_gp_seq, rcu_gp_seq + 1);
+}
+
 
 #define RCU_CALL_MIN_SIZE        30
 
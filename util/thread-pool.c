@@ -39,8 +39,9 @@ struct ThreadPoolElement {
     void *arg;
 
     /* Moving state out of THREAD_QUEUED is protected by lock.  After
-     * that, only the worker thread can write to it.  Reads and writes
-     * of state and ret are ordered with memory barriers.
+     * that, only the worker thread can write to it.  ret is published
+     * to the completion bottom half together with the element, through
+     * the done list.
      */
     enum ThreadState state;
     int ret;
@@ -48,6 +49,9 @@ struct ThreadPoolElement {
     /* Access to this list is protected by lock.  */
     QTAILQ_ENTRY(ThreadPoolElement) reqs;
 
+    /* Pushed atomically by whoever moves state to THREAD_DONE.  */
+    QSLIST_ENTRY(ThreadPoolElement) done;
+
     /* Access to this list is protected by the global mutex.  */
     QLIST_ENTRY(ThreadPoolElement) all;
 };
@@ -57,12 +61,16 @@ struct ThreadPool {
     QEMUBH *completion_bh;
     QemuMutex lock;
     QemuCond worker_stopped;
-    QemuSemaphore sem;
+    QemuCond request_cond;
     int max_threads;
     QEMUBH *new_thread_bh;
 
+    /* Completed requests, not yet seen by the completion bottom half.  */
+    QSLIST_HEAD(, ThreadPoolElement) done_list;
+
     /* The following variables are only accessed from one AioContext. */
     QLIST_HEAD(, ThreadPoolElement) head;
+    QSLIST_HEAD(, ThreadPoolElement) completed;
 
     /* The following variables are protected by lock.  */
     QTAILQ_HEAD(, ThreadPoolElement) request_list;
@@ -73,6 +81,18 @@ struct ThreadPool {
     bool stopping;
 };
 
+/* Returns true if the done list was empty.  */
+static bool thread_pool_push_done(ThreadPool *pool, ThreadPoolElement *elem)
+{
+    ThreadPoolElement *first;
+
+    do {
+        first = qatomic_read(&pool->done_list.slh_first);
+        elem->done.sle_next = first;
+    } while (qatomic_cmpxchg(&pool->done_list.slh_first, first, elem) != first);
+    return first == NULL;
+}
+
 static void *worker_thread(void *opaque)
 {
     ThreadPool *pool = opaque;
@@ -83,17 +103,21 @@ static void *worker_thread(void *opaque)
 
     while (!pool->stopping) {
         ThreadPoolElement *req;
-        int ret;
+        bool signaled;
 
-        do {
+        /* A thread that is still busy keeps draining the list without
+         * going to sleep, so a burst of submissions only has to wake up
+         * as many threads as were idle.
+         */
+        if (QTAILQ_EMPTY(&pool->request_list)) {
             pool->idle_threads++;
-            qemu_mutex_unlock(&pool->lock);
-            ret = qemu_sem_timedwait(&pool->sem, 10000);
-            qemu_mutex_lock(&pool->lock);
+            signaled = qemu_cond_timedwait(&pool->request_cond, &pool->lock,
+                                           10000);
             pool->idle_threads--;
-        } while (ret == -1 && !QTAILQ_EMPTY(&pool->request_list));
-        if (ret == -1 || pool->stopping) {
-            break;
+            if (!signaled && QTAILQ_EMPTY(&pool->request_list)) {
+                break;
+            }
+            continue;
         }
 
         req = QTAILQ_FIRST(&pool->request_list);
@@ -101,16 +125,18 @@ static void *worker_thread(void *opaque)
         req->state = THREAD_ACTIVE;
         qemu_mutex_unlock(&pool->lock);
 
-        ret = req->func(req->arg);
-
-        req->ret = ret;
-        /* Write ret before state.  */
-        smp_wmb();
+        req->ret = req->func(req->arg);
         req->state = THREAD_DONE;
 
-        qemu_mutex_lock(&pool->lock);
+        /* Only the thread that finds the done list empty needs to kick
+         * the bottom half; the others ride on the same invocation.
+         * The atomic insertion orders the writes to ret and state.
+         */
+        if (thread_pool_push_done(pool, req)) {
+            qemu_bh_schedule(pool->completion_bh);
+        }
 
-        qemu_bh_schedule(pool->completion_bh);
+        qemu_mutex_lock(&pool->lock);
     }
 
     pool->cur_threads--;
@@ -162,23 +188,30 @@ static void spawn_thread(ThreadPool *pool)
 static void thread_pool_completion_bh(void *opaque)
 {
     ThreadPool *pool = opaque;
-    ThreadPoolElement *elem, *next;
+    ThreadPoolElement *elem;
 
     aio_context_acquire(pool->ctx);
-restart:
-    QLIST_FOREACH_SAFE(elem, &pool->head, all, next) {
-        if (elem->state != THREAD_DONE) {
-            continue;
+    for (;;) {
+        /* Take all the requests that completed since the last batch.
+         * pool->completed is shared with nested invocations from
+         * aio_poll() in a callback, so each element is dispatched once.
+         */
+        if (QSLIST_EMPTY(&pool->completed)) {
+            QSLIST_MOVE_ATOMIC(&pool->completed, &pool->done_list);
+            if (QSLIST_EMPTY(&pool->completed)) {
+                break;
+            }
         }
 
+        elem = QSLIST_FIRST(&pool->completed);
+        QSLIST_REMOVE_HEAD(&pool->completed, done);
+        assert(elem->state == THREAD_DONE);
+
         trace_thread_pool_complete(pool, elem, elem->common.opaque,
                                    elem->ret);
         QLIST_REMOVE(elem, all);
 
         if (elem->common.cb) {
-            /* Read state before ret.  */
-            smp_rmb();
-
             /* Schedule ourselves in case elem->common.cb() calls aio_poll() to
              * wait for another request that completed at the same time.
              */
@@ -189,16 +222,12 @@ restart:
             aio_context_acquire(pool->ctx);
 
             /* We can safely cancel the completion_bh here regardless of someone
-             * else having scheduled it meanwhile because we reenter the
-             * completion function anyway (goto restart).
+             * else having scheduled it meanwhile because we look at the done
+             * list again before returning.
              */
             qemu_bh_cancel(pool->completion_bh);
-
-            qemu_aio_unref(elem);
-            goto restart;
-        } else {
-            qemu_aio_unref(elem);
         }
+        qemu_aio_unref(elem);
     }
     aio_context_release(pool->ctx);
 }
@@ -211,20 +240,18 @@ static void thread_pool_cancel(BlockAIOCB *acb)
     trace_thread_pool_cancel(elem, elem->common.opaque);
 
     QEMU_LOCK_GUARD(&pool->lock);
-    if (elem->state == THREAD_QUEUED &&
-        /* No thread has yet started working on elem. we can try to "steal"
-         * the item from the worker if we can get a signal from the
-         * semaphore.  Because this is non-blocking, we can do it with
-         * the lock taken and ensure that elem will remain THREAD_QUEUED.
+    if (elem->state == THREAD_QUEUED) {
+        /* No thread has yet started working on elem, and workers only
+         * take requests off the list with the lock held, so we can
+         * "steal" the item from them.
          */
-        qemu_sem_timedwait(&pool->sem, 0) == 0) {
         QTAILQ_REMOVE(&pool->request_list, elem, reqs);
-        qemu_bh_schedule(pool->completion_bh);
 
         elem->state = THREAD_DONE;
         elem->ret = -ECANCELED;
+        thread_pool_push_done(pool, elem);
+        qemu_bh_schedule(pool->completion_bh);
     }
-
 }
 
 static AioContext *thread_pool_get_aio_context(BlockAIOCB *acb)
@@ -261,8 +288,10 @@ BlockAIOCB *thread_pool_submit_aio(ThreadPool *pool,
         spawn_thread(pool);
     }
     QTAILQ_INSERT_TAIL(&pool->request_list, req, reqs);
+    if (pool->idle_threads) {
+        qemu_cond_signal(&pool->request_cond);
+    }
     qemu_mutex_unlock(&pool->lock);
-    qemu_sem_post(&pool->sem);
     return &req->common;
 }
 
@@ -305,11 +334,13 @@ static void thread_pool_init_one(ThreadPool *pool, AioContext *ctx)
     pool->completion_bh = aio_bh_new(ctx, thread_pool_completion_bh, pool);
     qemu_mutex_init(&pool->lock);
     qemu_cond_init(&pool->worker_stopped);
-    qemu_sem_init(&pool->sem, 0);
+    qemu_cond_init(&pool->request_cond);
     pool->max_threads = 64;
     pool->new_thread_bh = aio_bh_new(ctx, spawn_thread_bh_fn, pool);
 
+    QSLIST_INIT(&pool->done_list);
     QLIST_INIT(&pool->head);
+    QSLIST_INIT(&pool->completed);
     QTAILQ_INIT(&pool->request_list);
 }
 
@@ -338,14 +369,14 @@ void thread_pool_free(ThreadPool *pool)
     /* Wait for worker threads to terminate */
     pool->stopping = true;
     while (pool->cur_threads > 0) {
-        qemu_sem_post(&pool->sem);
+        qemu_cond_broadcast(&pool->request_cond);
         qemu_cond_wait(&pool->worker_stopped, &pool->lock);
     }
 
     qemu_mutex_unlock(&pool->lock);
 
     qemu_bh_delete(pool->completion_bh);
-    qemu_sem_destroy(&pool->sem);
+    qemu_cond_destroy(&pool->request_cond);
     qemu_cond_destroy(&pool->worker_stopped);
     qemu_mutex_destroy(&pool->lock);
     g_free(pool);
@@ -23,6 +23,7 @@
  */
 
 #include "qemu/osdep.h"
+#include <math.h>
 #include "qapi/error.h"
 #include "qemu/throttle.h"
 #include "qemu/timer.h"
@@ -484,6 +485,84 @@ void throttle_account(ThrottleState *ts, bool is_write, uint64_t size)
     }
 }
 
+/* reserve a budget of I/O that can be done without checking the limits
+ *
+ * The budget covers @slice_ns worth of the average rate of every bucket
+ * that applies to this type of operation, and it is accounted right away
+ * as if the I/O had already been done.  Nothing is reserved if an
+ * operation of this type would have to wait now.  A budget of HUGE_VAL
+ * means that no limit of that kind applies.
+ *
+ * @is_write: the type of operation (read/write)
+ * @now:      the current clock timestamp
+ * @slice_ns: the length of the time slice to reserve
+ * @bytes:    the number of bytes reserved
+ * @units:    the number of operation units reserved
+ * @ret:      true if a budget was reserved
+ */
+bool throttle_reserve_budget(ThrottleState *ts, bool is_write, int64_t now,
+                             int64_t slice_ns, double *bytes, double *units)
+{
+    const BucketType bucket_types_size[2][2] = {
+        { THROTTLE_BPS_TOTAL, THROTTLE_BPS_READ },
+        { THROTTLE_BPS_TOTAL, THROTTLE_BPS_WRITE }
+    };
+    const BucketType bucket_types_units[2][2] = {
+        { THROTTLE_OPS_TOTAL, THROTTLE_OPS_READ },
+        { THROTTLE_OPS_TOTAL, THROTTLE_OPS_WRITE }
+    };
+    double size_budget = HUGE_VAL, units_budget = HUGE_VAL;
+    unsigned i;
+
+    throttle_do_leak(ts, now);
+    if (throttle_compute_wait_for(ts, is_write)) {
+        return false;
+    }
+
+    for (i = 0; i < 2; i++) {
+        LeakyBucket *bkt;
+
+        bkt = &ts->cfg.buckets[bucket_types_size[is_write][i]];
+        if (bkt->avg) {
+            size_budget = MIN(size_budget, (double) bkt->avg * slice_ns /
+                                           NANOSECONDS_PER_SECOND);
+        }
+        bkt = &ts->cfg.buckets[bucket_types_units[is_write][i]];
+        if (bkt->avg) {
+            units_budget = MIN(units_budget, (double) bkt->avg * slice_ns /
+                                             NANOSECONDS_PER_SECOND);
+        }
+    }
+
+    /* Not even a single operation fits into the slice */
+    if (units_budget < 1.0) {
+        return false;
+    }
+
+    for (i = 0; i < 2; i++) {
+        LeakyBucket *bkt;
+
+        if (size_budget != HUGE_VAL) {
+            bkt = &ts->cfg.buckets[bucket_types_size[is_write][i]];
+            bkt->level += size_budget;
+            if (bkt->burst_length > 1) {
+                bkt->burst_level += size_budget;
+            }
+        }
+        if (units_budget != HUGE_VAL) {
+            bkt = &ts->cfg.buckets[bucket_types_units[is_write][i]];
+            bkt->level += units_budget;
+            if (bkt->burst_length > 1) {
+                bkt->burst_level += units_budget;
+            }
+        }
+    }
+
+    *bytes = size_budget;
+    *units = units_budget;
+    return true;
+}
+
 /* return a ThrottleConfig based on the options in a ThrottleLimits
  *
  * @arg:    the ThrottleLimits object to read from